@@ -45,6 +45,7 @@
 #include <dirent.h>
 #include <signal.h>
 #include <wait.h>
+#include <sys/syscall.h>
 #include <security/pam_appl.h>
 
 #define PAM_SM_AUTH
@@ -206,11 +207,38 @@ sigterm_block_pop (void)
 }
 
 
+/* Close all file descriptors of the forked child. With a high RLIMIT_NOFILE
+   closing every possible descriptor one by one takes far longer than the
+   program itself, so only the open ones are closed. */
+static void close_all_fds(void)
+{
+	DIR *dir;
+	struct dirent *entry;
+	long max, fd;
+
+#ifdef SYS_close_range
+	if (syscall(SYS_close_range, 0U, ~0U, 0U) == 0)
+		return;
+#endif
+	if ((dir = opendir("/proc/self/fd")) != NULL) {
+		while ((entry = readdir(dir)) != NULL) {
+			fd = atol(entry->d_name);
+			if (entry->d_name[0] != '.' && fd != dirfd(dir))
+				close(fd);
+		}
+		closedir(dir);
+		return;
+	}
+	max = sysconf(_SC_OPEN_MAX);
+	for (fd = 0; fd < max; fd++)
+		close(fd);
+}
+
 int run_program(pam_handle_t * pamh, int ctrl, char *prog, const char * user, unsigned int pw,
 		const char * password, const int run_in_user_context )
 {
 	pid_t pid;
-	int status, i;
+	int status;
 	extern char **environ;
 	const struct passwd *pwd;
 
@@ -234,7 +262,8 @@ int run_program(pam_handle_t * pamh, int ctrl, char *prog, const char * user, un
 			int uidset = 0;
 			if(run_in_user_context) {
 				if ( pwd == NULL ) {
-					return PAM_USER_UNKNOWN;
+					_log_err ( LOG_ERR, "unknown user %s", user );
+					_exit ( 128 );
 				}
 				uidset = setgid(pwd->pw_gid);
 				if(!uidset) {
@@ -254,14 +283,14 @@ int run_program(pam_handle_t * pamh, int ctrl, char *prog, const char * user, un
 
 				char **env_vars_array = (char **)calloc((num_specific_env_vars + 1), sizeof(char *));
 				if (env_vars_array == NULL) {
-					return PAM_SYSTEM_ERR;
+					_exit ( 128 );
 				}
 
 				for (int i = 0; i < num_specific_env_vars; i++) {
 					if (env_var_values[i]) {
 						char *env_var = (char *)malloc((strlen(env_var_names[i]) + strlen(env_var_values[i]) + 2) * sizeof(char));
 						if (env_var == NULL) {
-							return PAM_SYSTEM_ERR;
+							_exit ( 128 );
 						}
 						sprintf(env_var, "%s=%s", env_var_names[i], env_var_values[i]);
 						env_vars_array[i] = env_var;
@@ -279,8 +308,7 @@ int run_program(pam_handle_t * pamh, int ctrl, char *prog, const char * user, un
 */
 
 				/* close all file handles */
-				for (i = 0; i < sysconf (_SC_OPEN_MAX); i++)
-					close(i);
+				close_all_fds();
 				open ("/dev/null", O_RDONLY); /* open stdin - fd 0 */
 				open ("/dev/null", O_RDWR); /* open stdout - fd 1 */
 				open ("/dev/null", O_RDWR); /* open stderr - fd 2 */
@@ -294,7 +322,7 @@ int run_program(pam_handle_t * pamh, int ctrl, char *prog, const char * user, un
 
 			_log_err ( LOG_ERR, "could not start program %s", prog );
 
-			exit ( 128 );
+			_exit ( 128 );
 
 
 		default:
@@ -46,6 +46,7 @@
 #include <dirent.h>
 #include <signal.h>
 #include <wait.h>
+#include <time.h>
 #include <security/pam_appl.h>
 #include <univention/ldap.h>
 
@@ -63,9 +64,21 @@ static char toattr[BUFSIZ];
 static char binddn[BUFSIZ];
 static char pwfile[BUFSIZ] = "/etc/machine.secret";
 static char bindpw[BUFSIZ];
+static unsigned int cache_ttl = 60;
 
 #define UNIVENTIONMAILCYRUS_QUIET 020
 
+/* Recently mapped users, valid for cache_ttl seconds and only for the
+ * configuration they were looked up with. */
+#define MAPCACHE_SIZE 32
+
+static struct mapcache_entry {
+   char *fromuser;
+   char *touser;
+   time_t expires;
+} mapcache[MAPCACHE_SIZE];
+static char *mapcache_config;
+
 /* some syslogging */
 static void _log_err(int err, const char *format, ...)
     __attribute__ ((format (printf, 2, 3)));
@@ -111,6 +124,8 @@ static int _pam_parse(int flags, int argc, const char **argv)
           rv = snprintf(binddn, BUFSIZ, "%s", *argv + 7);
       else if (!strncmp(*argv, "pwfile=", 7))
           rv = snprintf(pwfile, BUFSIZ, "%s", *argv + 7);
+      else if (!strncmp(*argv, "cache_ttl=", 10))
+          cache_ttl = atoi(*argv + 10);
       else
           _log_err(LOG_ERR, "unknown option: %s", *argv);
 
@@ -132,6 +147,82 @@ static int _pam_parse(int flags, int argc, const char **argv)
    return ctrl;
 }
 
+static void mapcache_clear(void)
+{
+   int i;
+
+   for (i = 0; i < MAPCACHE_SIZE; i++) {
+      free(mapcache[i].fromuser);
+      free(mapcache[i].touser);
+      mapcache[i].fromuser = mapcache[i].touser = NULL;
+      mapcache[i].expires = 0;
+   }
+}
+
+/* Drop all entries if the lookup parameters changed since they were cached. */
+static void mapcache_check_config(void)
+{
+   char *config;
+
+   if (asprintf(&config, "%s|%u|%s|%s|%s|%s", ldap_host, ldap_port, ldap_base, binddn, fromattr, toattr) < 0)
+      return;
+   if (mapcache_config != NULL && strcmp(mapcache_config, config) == 0) {
+      free(config);
+      return;
+   }
+   mapcache_clear();
+   free(mapcache_config);
+   mapcache_config = config;
+}
+
+static int mapcache_lookup(const char *fromuser, char *touser)
+{
+   time_t now = time(NULL);
+   int i;
+
+   for (i = 0; i < MAPCACHE_SIZE; i++) {
+      if (mapcache[i].fromuser == NULL || mapcache[i].expires <= now)
+         continue;
+      if (strcmp(mapcache[i].fromuser, fromuser) == 0) {
+         snprintf(touser, BUFSIZ, "%s", mapcache[i].touser);
+         return 1;
+      }
+   }
+   return 0;
+}
+
+static void mapcache_store(const char *fromuser, const char *touser)
+{
+   time_t now = time(NULL);
+   int i, slot = 0;
+
+   /* reuse an expired slot or replace the entry expiring first */
+   for (i = 0; i < MAPCACHE_SIZE; i++) {
+      if (mapcache[i].fromuser == NULL || mapcache[i].expires <= now) {
+         slot = i;
+         break;
+      }
+      if (mapcache[i].expires < mapcache[slot].expires)
+         slot = i;
+   }
+   free(mapcache[slot].fromuser);
+   free(mapcache[slot].touser);
+   mapcache[slot].fromuser = strdup(fromuser);
+   mapcache[slot].touser = strdup(touser);
+   if (mapcache[slot].fromuser == NULL || mapcache[slot].touser == NULL) {
+      free(mapcache[slot].fromuser);
+      free(mapcache[slot].touser);
+      mapcache[slot].fromuser = mapcache[slot].touser = NULL;
+      return;
+   }
+   mapcache[slot].expires = now + cache_ttl;
+}
+
+static int ldap_connection_lost(int rv)
+{
+   return rv == LDAP_SERVER_DOWN || rv == LDAP_CONNECT_ERROR || rv == LDAP_UNAVAILABLE || rv == LDAP_TIMEOUT;
+}
+
 static int mapuser(const char *fromuser, char *touser)
 {
    int msgid;
@@ -147,10 +238,18 @@ static int mapuser(const char *fromuser, char *touser)
    struct berval **values = NULL;
    int ret = PAM_USER_UNKNOWN;
    univention_ldap_parameters_t *lp;
+   char hosts[BUFSIZ];
    char *host;
    char *saved;
+   int retry = 1;
    int rv;
 
+   if (cache_ttl > 0) {
+      mapcache_check_config();
+      if (mapcache_lookup(fromuser, touser))
+         return PAM_SUCCESS;
+   }
+
    lp = univention_ldap_new();
    lp->port = ldap_port;
    lp->base = strdup(ldap_base);
@@ -164,11 +263,15 @@ static int mapuser(const char *fromuser, char *touser)
       goto cleanup;
    }
 
-   for(host=strtok_r(ldap_host, ",", &saved); host != NULL; host=strtok_r(NULL, ",", &saved)) {
+   /* univention_ldap_open() reuses the connection released by the last call */
+reconnect:
+   snprintf(hosts, BUFSIZ, "%s", ldap_host);
+   for(host=strtok_r(hosts, ",", &saved); host != NULL; host=strtok_r(NULL, ",", &saved)) {
       lp->host = strdup(host);
       if (univention_ldap_open(lp) != 0) {
          _log_err(LOG_NOTICE, "Failed to connect to LDAP server %s:%d", host, ldap_port);
          free(lp->host);
+         lp->host = NULL;
          continue;
       }
       break;
@@ -179,8 +282,16 @@ static int mapuser(const char *fromuser, char *touser)
    }
    if ((msgid = ldap_search_ext_s(lp->ld, ldap_base, scope, filter, attrs,
                    attrsonly, serverctrls, clientctrls, &timeout, sizelimit, &res)) != LDAP_SUCCESS) {
+       if (retry-- && ldap_connection_lost(msgid)) {
+          /* the pooled connection went away, open a new one */
+          ldap_msgfree(res);
+          res = NULL;
+          free(lp->host);
+          lp->host = NULL;
+          goto reconnect;
+       }
        _log_err(LOG_NOTICE, "Failed to query LDAP server: %s", filter);
-       goto cleanup;
+       goto cleanup_msg;
    }
    if (ldap_count_entries(lp->ld, res) != 1) {
        _log_err(LOG_NOTICE, "No or ambiguous result, found %d entries.", ldap_count_entries(lp->ld, res));
@@ -204,12 +315,15 @@ static int mapuser(const char *fromuser, char *touser)
       goto cleanup_values;
    }
    ret = PAM_SUCCESS;
+   if (cache_ttl > 0)
+      mapcache_store(fromuser, touser);
 
 cleanup_values:
    ldap_value_free_len(values);
 cleanup_msg:
    ldap_msgfree(res);
 cleanup:
+   univention_ldap_release(lp);
    univention_ldap_close(lp);
    return ret;
 }
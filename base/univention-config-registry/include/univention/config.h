@@ -37,12 +37,29 @@
 #define __UNIVENTION_CONFIG_H__
 
 #include <stdio.h>
+#include <stddef.h>
 
 /**
  * Retrieve value of config registry entry associated with key.
  * @return an allocated buffer containingt the value or NULL on errors or if not found.
  */
 char *univention_config_get_string(const char *key);
+/**
+ * Retrieve values of several config registry entries at once.
+ * The layers are read at most once for all keys.
+ * @return the number of keys found; values[i] is an allocated buffer containing the value of keys[i] or NULL.
+ */
+size_t univention_config_get_many(const char *const keys[], char *values[], size_t count);
+/**
+ * Retrieve all config registry entries whose key starts with prefix, sorted by key.
+ * The layers are read at most once and the keys are found by bisection.
+ * @return the number of entries found; keys and values are allocated arrays of as many allocated buffers, to be freed by univention_config_free_prefix().
+ */
+size_t univention_config_get_prefix(const char *prefix, char ***keys, char ***values);
+/**
+ * Free the entries returned by univention_config_get_prefix().
+ */
+void univention_config_free_prefix(char *keys[], char *values[], size_t count);
 /**
  * Retrieve integer value of config registry entry associated with key.
  * @return an integer value of -1 on errors of if not found.
@@ -53,10 +70,40 @@ int univention_config_get_int(const char *key);
  * @return an integer value of -1 on errors of if not found.
  */
 long univention_config_get_long(const char *key);
+/**
+ * Called for each config registry entry changed since the last dispatch.
+ * The values are not expanded; old_value is NULL for new entries and new_value is NULL for removed entries.
+ */
+typedef void (*univention_config_callback)(const char *key, const char *old_value, const char *new_value, void *data);
+struct univention_config_watch;
+/**
+ * Start watching the config registry for changes.
+ * @return an allocated watch or NULL on errors.
+ */
+struct univention_config_watch *univention_config_watch_new(void);
+/**
+ * Return the file descriptor of the watch, which becomes readable on changes.
+ */
+int univention_config_watch_fd(const struct univention_config_watch *watch);
+/**
+ * Call callback for each entry changed since the watch was created or last dispatched. Does not block.
+ * @return the number of changed entries, -1 on errors.
+ */
+int univention_config_watch_dispatch(struct univention_config_watch *watch, univention_config_callback callback, void *data);
+/**
+ * Stop watching and free the watch.
+ */
+void univention_config_watch_free(struct univention_config_watch *watch);
 /**
  * Set config registry entry associated with key to new value.
  * @return 0 on success, -1 on internal errors.
  */
 int univention_config_set_string(const char *key, const char *value);
+/**
+ * Set several config registry entries at once, keys[i] to values[i].
+ * This invokes univention-config-registry only once for all entries.
+ * @return 0 on success, -1 on internal errors.
+ */
+int univention_config_set_many(const char *const keys[], const char *const values[], size_t count);
 
 #endif
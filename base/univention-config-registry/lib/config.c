@@ -42,12 +42,19 @@
 # define __USE_GNU
 #endif
 #include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <endian.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/wait.h>
 
 #include <univention/config.h>
 #include <univention/debug.h>
 
-#define BASECONFIG_MAX_LINE 1024
 #define MAX_RECURSION 10
 
 #define VARIABLE_TOKEN "@%@"
@@ -64,65 +71,356 @@ static const char *LAYERS[] = {
 };
 #define ARRAY_SIZE(A) (sizeof (A) / sizeof ((A)[0]))
 
+/* Compiled form of the layers FORCED to DEFAULT written by UCR after each
+   change, all integers in little endian byte order:
+     struct compiled_header
+     struct compiled_layer[COMPILED_LAYERS]  identity of the files compiled
+     struct compiled_entry[count]  sorted by key
+     "key\0value\0" strings referenced by the entries */
+#define COMPILED_FILE "/etc/univention/base.cache"
+#define COMPILED_MAGIC 0x3130304352435555ULL  /* "UUCRC001" */
+#define COMPILED_LAYERS (DEFAULT - FORCED + 1)
+#define COMPILED_DEFAULT 1  /* value from base-defaults.conf */
+
+struct compiled_header {
+	uint64_t magic;
+	uint32_t count;
+	uint32_t layers;
+};
+
+struct compiled_layer {
+	uint64_t dev;
+	uint64_t ino;  /* 0 if the file does not exist */
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+};
+
+struct compiled_entry {
+	uint32_t key;
+	uint32_t key_len;
+	uint32_t value;
+	uint32_t value_len;
+	uint32_t flags;
+};
+
 static char *replace_variable_patterns(char *key, int recursion);
 
-static char *_get_variable(const char *key, int recursion)
+/* Parsed snapshot of all layers. Each key maps to the value of the layer
+   with the highest precedence. The snapshot is rebuilt once any layer file
+   is replaced, which UCR does by renaming a temporary file. */
+struct entry {
+	const char *key;
+	const char *value;
+	enum SCOPE scope;
+};
+
+struct layer {
+	char *name;  /* file name, only changes for CUSTOM */
+	char *data;  /* file content, keys and values are terminated in place */
+	bool exists;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+};
+
+static struct {
+	struct layer layers[ARRAY_SIZE(LAYERS)];
+	struct entry *table;  /* open addressing, size is a power of 2 */
+	size_t size;
+	size_t count;
+	struct entry **sorted;  /* the entries of table sorted by key, built on demand */
+	bool valid;
+	/* mapping of COMPILED_FILE used instead of the table */
+	const char *map;
+	size_t map_size;
+	const struct compiled_entry *entries;
+	uint32_t entry_count;
+} snapshot;
+static pthread_mutex_t snapshot_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static size_t hash_key(const char *key, size_t len)
+{
+	size_t hash = 2166136261u;  /* FNV-1a */
+
+	while (len-- > 0)
+		hash = (hash ^ (unsigned char)*key++) * 16777619u;
+	return hash;
+}
+
+static struct entry *snapshot_find(const char *key, size_t len)
+{
+	size_t i;
+
+	if (snapshot.size == 0)
+		return NULL;
+	for (i = hash_key(key, len) & (snapshot.size - 1); snapshot.table[i].key; i = (i + 1) & (snapshot.size - 1))
+		if (!strncmp(snapshot.table[i].key, key, len) && snapshot.table[i].key[len] == '\0')
+			return &snapshot.table[i];
+	return &snapshot.table[i];
+}
+
+static void snapshot_insert(const char *key, const char *value, enum SCOPE scope)
+{
+	struct entry *entry;
+
+	if (snapshot.count * 2 >= snapshot.size) {
+		struct entry *old = snapshot.table;
+		size_t i, size = snapshot.size;
+
+		snapshot.size = size ? size * 2 : 1024;
+		if ((snapshot.table = calloc(snapshot.size, sizeof(*snapshot.table))) == NULL)
+			abort();
+		for (i = 0; i < size; i++)
+			if (old[i].key)
+				*snapshot_find(old[i].key, strlen(old[i].key)) = old[i];
+		free(old);
+	}
+
+	/* the first occurrence of a key wins, as layers are read in order */
+	entry = snapshot_find(key, strlen(key));
+	if (entry->key)
+		return;
+	entry->key = key;
+	entry->value = value;
+	entry->scope = scope;
+	snapshot.count++;
+}
+
+/* Remember the identity of the file of @layer described by @st. */
+static void layer_stat(struct layer *layer, const struct stat *st)
 {
+	layer->exists = true;
+	layer->dev = st->st_dev;
+	layer->ino = st->st_ino;
+	layer->size = st->st_size;
+	layer->mtime = st->st_mtim;
+}
+
+/* Read the file of @layer and add its "key: value" lines. */
+static void layer_load(struct layer *layer, enum SCOPE scope)
+{
+	char *line, *next, *sep;
+	struct stat st;
+	size_t size;
 	FILE *file;
-	char line[BASECONFIG_MAX_LINE];
-	char *nvalue;
-	int len;
-	char *ret = NULL;
+
+	if ((file = fopen(layer->name, "re")) == NULL) {
+		univention_debug(UV_DEBUG_CONFIG, UV_DEBUG_ERROR, "Error on opening \"%s\"", layer->name);
+		/* do not retry before the file changes */
+		if (stat(layer->name, &st) == 0)
+			layer_stat(layer, &st);
+		return;
+	}
+	if (fstat(fileno(file), &st) == 0 && (layer->data = malloc(st.st_size + 1)) != NULL) {
+		layer_stat(layer, &st);
+		size = fread(layer->data, 1, st.st_size, file);
+		layer->data[size] = '\0';
+
+		for (line = layer->data; *line; line = next) {
+			size_t len = strcspn(line, "\n");
+
+			next = line + len + (line[len] == '\n');
+			while (len > 0 && line[len - 1] == '\r')
+				len--;
+			line[len] = '\0';
+			if ((sep = strstr(line, ": ")) == NULL)
+				continue;
+			*sep = '\0';
+			snapshot_insert(line, sep + 2, scope);
+		}
+	}
+	fclose(file);
+}
+
+/* Check whether the file of @layer or its @name changed since it was read. */
+static bool layer_changed(const struct layer *layer, const char *name)
+{
+	struct stat st;
+
+	if (!name || !layer->name)
+		return name != layer->name;
+	if (strcmp(name, layer->name))
+		return true;
+	if (stat(name, &st) != 0)
+		return layer->exists;
+	return !layer->exists ||
+		st.st_dev != layer->dev ||
+		st.st_ino != layer->ino ||
+		st.st_size != layer->size ||
+		st.st_mtim.tv_sec != layer->mtime.tv_sec ||
+		st.st_mtim.tv_nsec != layer->mtime.tv_nsec;
+}
+
+/* Map COMPILED_FILE if it was compiled from the current layer files.
+   Returns false to fall back to parsing the files. */
+static bool compiled_load(void)
+{
+	const struct compiled_header *header;
+	const struct compiled_layer *layers;
+	struct stat st;
+	uint32_t i;
+	void *map;
+	int fd;
+
+	if ((fd = open(COMPILED_FILE, O_RDONLY | O_CLOEXEC)) < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*header) + COMPILED_LAYERS * sizeof(*layers)) {
+		close(fd);
+		return false;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return false;
+
+	header = map;
+	layers = (const struct compiled_layer *)(header + 1);
+	if (le64toh(header->magic) != COMPILED_MAGIC ||
+			le32toh(header->layers) != COMPILED_LAYERS ||
+			le32toh(header->count) > (st.st_size - sizeof(*header) - COMPILED_LAYERS * sizeof(*layers)) / sizeof(struct compiled_entry) ||
+			((const char *)map)[st.st_size - 1] != '\0')
+		goto stale;
+
+	for (i = 0; i < COMPILED_LAYERS; i++) {
+		struct layer *layer = &snapshot.layers[FORCED + i];
+
+		if ((layer->name = strdup(LAYERS[FORCED + i])) == NULL)
+			abort();
+		layer->exists = le64toh(layers[i].ino) != 0;
+		layer->dev = le64toh(layers[i].dev);
+		layer->ino = le64toh(layers[i].ino);
+		layer->size = le64toh(layers[i].size);
+		layer->mtime.tv_sec = le64toh(layers[i].mtime_sec);
+		layer->mtime.tv_nsec = le64toh(layers[i].mtime_nsec);
+		if (layer_changed(layer, LAYERS[FORCED + i]))
+			goto stale;
+	}
+
+	snapshot.map = map;
+	snapshot.map_size = st.st_size;
+	snapshot.entries = (const struct compiled_entry *)(layers + COMPILED_LAYERS);
+	snapshot.entry_count = le32toh(header->count);
+	return true;
+
+stale:
+	univention_debug(UV_DEBUG_CONFIG, UV_DEBUG_INFO, "Ignoring outdated \"%s\"", COMPILED_FILE);
+	for (i = FORCED; i < ARRAY_SIZE(LAYERS); i++) {
+		free(snapshot.layers[i].name);
+		snapshot.layers[i].name = NULL;
+	}
+	munmap(map, st.st_size);
+	return false;
+}
+
+/* Bisect the compiled entries for @key. Returns its value and scope. */
+static const char *compiled_find(const char *key, enum SCOPE *scope)
+{
+	size_t len = strlen(key);
+	uint32_t lo = 0, hi = snapshot.entry_count;
+
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		const struct compiled_entry *entry = &snapshot.entries[mid];
+		uint32_t key_off = le32toh(entry->key), key_len = le32toh(entry->key_len);
+		int cmp;
+
+		if (key_off > snapshot.map_size || key_len > snapshot.map_size - key_off)
+			return NULL;
+		cmp = memcmp(snapshot.map + key_off, key, key_len < len ? key_len : len);
+		if (cmp == 0)
+			cmp = key_len < len ? -1 : key_len > len;
+		if (cmp == 0) {
+			uint32_t value_off = le32toh(entry->value), value_len = le32toh(entry->value_len);
+
+			if (value_off >= snapshot.map_size || value_len >= snapshot.map_size - value_off)
+				return NULL;
+			*scope = le32toh(entry->flags) & COMPILED_DEFAULT ? DEFAULT : NORMAL;
+			return snapshot.map + value_off;
+		}
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
+/* Rebuild the snapshot if any layer changed. Called with snapshot_lock held. */
+static void snapshot_update(void)
+{
+	bool changed = !snapshot.valid;
 	enum SCOPE i;
 
-	len = asprintf(&nvalue, "%s: ", key);
-	if (len < 0)
-		return ret;
+	for (i = 0; i < ARRAY_SIZE(LAYERS) && !changed; i++)
+		changed = layer_changed(&snapshot.layers[i], i ? LAYERS[i] : getenv("UNIVENTION_BASECONF"));
+	if (!changed)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(LAYERS); i++) {
+		free(snapshot.layers[i].name);
+		free(snapshot.layers[i].data);
+	}
+	memset(snapshot.layers, 0, sizeof(snapshot.layers));
+	if (snapshot.table)
+		memset(snapshot.table, 0, snapshot.size * sizeof(*snapshot.table));
+	snapshot.count = 0;
+	free(snapshot.sorted);
+	snapshot.sorted = NULL;
+	if (snapshot.map) {
+		munmap((void *)snapshot.map, snapshot.map_size);
+		snapshot.map = NULL;
+	}
+	snapshot.valid = true;
+
+	/* the compiled form does not cover a custom layer */
+	if (!getenv("UNIVENTION_BASECONF") && compiled_load())
+		return;
 
 	for (i = 0; i < ARRAY_SIZE(LAYERS); i++) {
 		const char *name = i ? LAYERS[i] : getenv("UNIVENTION_BASECONF");
 		if (!name)
 			continue;
+		if ((snapshot.layers[i].name = strdup(name)) == NULL)
+			abort();
+		layer_load(&snapshot.layers[i], i);
+	}
+}
 
-		if ((file = fopen(name, "re")) == NULL)
-		{
-			univention_debug(UV_DEBUG_CONFIG, UV_DEBUG_ERROR, "Error on opening \"%s\"", LAYERS[i]);
-			continue;
-		}
+/* Copy the value of @key from the snapshot. Called with snapshot_lock held. */
+static char *snapshot_get(const char *key, enum SCOPE *scope)
+{
+	struct entry *entry;
+	char *ret = NULL;
 
-		while (fgets(line, BASECONFIG_MAX_LINE, file) != NULL)
-		{
-			if (!strncmp(line, nvalue, len))
-			{
-				char *value;
-				size_t vlen;
-
-				value = line + len; // skip key
-				vlen = strlen(value);
-				while (vlen > 0) {
-					switch (value[vlen - 1]) {
-					case '\n':
-					case '\r':
-						value[--vlen] = '\0';
-						continue;
-					}
-					break;
-				}
-				ret = strndup(value, vlen);
-				fclose(file);
-				if (recursion > 0 && i == DEFAULT)
-					ret = replace_variable_patterns(ret, recursion);
-
-				goto done;
-			}
-		}
+	if (snapshot.map) {
+		const char *value = compiled_find(key, scope);
 
-		fclose(file);
+		if (value != NULL && (ret = strdup(value)) == NULL)
+			univention_debug(UV_DEBUG_CONFIG, UV_DEBUG_ERROR, "strdup() failed");
+	} else if ((entry = snapshot_find(key, strlen(key))) != NULL && entry->key) {
+		if ((ret = strdup(entry->value)) == NULL)
+			univention_debug(UV_DEBUG_CONFIG, UV_DEBUG_ERROR, "strdup() failed");
+		*scope = entry->scope;
 	}
+	if (ret == NULL)
+		univention_debug(UV_DEBUG_USERS, UV_DEBUG_INFO, "Did not find \"%s\"", key);
+	return ret;
+}
+
+static char *_get_variable(const char *key, int recursion)
+{
+	char *ret;
+	enum SCOPE scope = CUSTOM;
+
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_update();
+	ret = snapshot_get(key, &scope);
+	pthread_mutex_unlock(&snapshot_lock);
 
-	univention_debug(UV_DEBUG_USERS, UV_DEBUG_INFO, "Did not find \"%s\"", key);
-done:
-	free(nvalue);
+	if (ret != NULL && recursion > 0 && scope == DEFAULT)
+		ret = replace_variable_patterns(ret, recursion);
 	return ret;
 }
 
@@ -144,6 +442,8 @@ static char *replace_variable_patterns(char *key, int recursion)
 
 		char *content = _get_variable(start + VARIABLE_TOKEN_LEN, recursion - 1);
 		int ret = asprintf(&result, "%s%s%s", key, content ? content : "", end + VARIABLE_TOKEN_LEN);
+		/* continue after the replaced text */
+		size_t skip = (start - key) + (content ? strlen(content) : 0);
 		free(content);
 		free(key);
 		if (ret < 0) {
@@ -151,13 +451,305 @@ static char *replace_variable_patterns(char *key, int recursion)
 			result = NULL;
 			break;
 		}
-		next = result + (start - key) + (content ? strlen(content) : 0);
+		next = result + skip;
 		key = result;
 	}
 
 	return result;
 }
 
+size_t univention_config_get_many(const char *const keys[], char *values[], size_t count)
+{
+	enum SCOPE scopes[count];
+	size_t i, found = 0;
+
+	/* resolve all keys from the same state of the layers */
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_update();
+	for (i = 0; i < count; i++) {
+		scopes[i] = CUSTOM;
+		values[i] = snapshot_get(keys[i], &scopes[i]);
+	}
+	pthread_mutex_unlock(&snapshot_lock);
+
+	for (i = 0; i < count; i++) {
+		if (values[i] != NULL && scopes[i] == DEFAULT)
+			values[i] = replace_variable_patterns(values[i], MAX_RECURSION);
+		if (values[i] != NULL)
+			found++;
+	}
+	return found;
+}
+
+static int entry_cmp(const void *a, const void *b)
+{
+	return strcmp((*(struct entry *const *)a)->key, (*(struct entry *const *)b)->key);
+}
+
+/* Copy the raw values of all keys starting with @prefix, in the order of the
+   keys. Called with snapshot_lock held. */
+static size_t snapshot_prefix(const char *prefix, char ***keys, char ***values, enum SCOPE **scopes)
+{
+	size_t len = strlen(prefix), lo = 0, hi, first, n;
+
+	if (snapshot.map) {
+		/* bisect the compiled entries for the first key not before @prefix */
+		for (hi = snapshot.entry_count; lo < hi;) {
+			size_t mid = lo + (hi - lo) / 2;
+			const struct compiled_entry *entry = &snapshot.entries[mid];
+			uint32_t key_len = le32toh(entry->key_len);
+			int cmp = memcmp(snapshot.map + le32toh(entry->key), prefix, key_len < len ? key_len : len);
+
+			if (cmp < 0 || (cmp == 0 && key_len < len))
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (first = lo; lo < snapshot.entry_count; lo++) {
+			const struct compiled_entry *entry = &snapshot.entries[lo];
+
+			if (le32toh(entry->key_len) < len || memcmp(snapshot.map + le32toh(entry->key), prefix, len))
+				break;
+		}
+	} else {
+		if (snapshot.sorted == NULL && snapshot.count > 0) {
+			if ((snapshot.sorted = malloc(snapshot.count * sizeof(*snapshot.sorted))) == NULL)
+				abort();  // FIXME
+			for (lo = 0, n = 0; lo < snapshot.size; lo++)
+				if (snapshot.table[lo].key)
+					snapshot.sorted[n++] = &snapshot.table[lo];
+			qsort(snapshot.sorted, n, sizeof(*snapshot.sorted), entry_cmp);
+		}
+		for (lo = 0, hi = snapshot.count; lo < hi;) {
+			size_t mid = lo + (hi - lo) / 2;
+
+			if (strcmp(snapshot.sorted[mid]->key, prefix) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (first = lo; lo < snapshot.count && !strncmp(snapshot.sorted[lo]->key, prefix, len); lo++)
+			;
+	}
+
+	n = lo - first;
+	*keys = *values = NULL;
+	*scopes = NULL;
+	if (n == 0)
+		return 0;
+	if ((*keys = calloc(n, sizeof(char *))) == NULL || (*values = calloc(n, sizeof(char *))) == NULL || (*scopes = calloc(n, sizeof(enum SCOPE))) == NULL)
+		abort();  // FIXME
+	for (lo = 0; lo < n; lo++) {
+		if (snapshot.map) {
+			const struct compiled_entry *entry = &snapshot.entries[first + lo];
+
+			(*keys)[lo] = strndup(snapshot.map + le32toh(entry->key), le32toh(entry->key_len));
+			(*values)[lo] = strndup(snapshot.map + le32toh(entry->value), le32toh(entry->value_len));
+			(*scopes)[lo] = le32toh(entry->flags) & COMPILED_DEFAULT ? DEFAULT : NORMAL;
+		} else {
+			(*keys)[lo] = strdup(snapshot.sorted[first + lo]->key);
+			(*values)[lo] = strdup(snapshot.sorted[first + lo]->value);
+			(*scopes)[lo] = snapshot.sorted[first + lo]->scope;
+		}
+		if (!(*keys)[lo] || !(*values)[lo])
+			abort();  // FIXME
+	}
+	return n;
+}
+
+size_t univention_config_get_prefix(const char *prefix, char ***keys, char ***values)
+{
+	enum SCOPE *scopes;
+	size_t i, count;
+
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_update();
+	count = snapshot_prefix(prefix, keys, values, &scopes);
+	pthread_mutex_unlock(&snapshot_lock);
+
+	for (i = 0; i < count; i++) {
+		if (scopes[i] == DEFAULT && ((*values)[i] = replace_variable_patterns((*values)[i], MAX_RECURSION)) == NULL)
+			abort();  // FIXME
+	}
+	free(scopes);
+	return count;
+}
+
+void univention_config_free_prefix(char *keys[], char *values[], size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		free(keys[i]);
+		free(values[i]);
+	}
+	free(keys);
+	free(values);
+}
+
+struct pair {
+	char *key;
+	char *value;
+};
+
+struct univention_config_watch {
+	int fd;
+	struct pair *pairs;  /* raw values of the last dispatch, sorted by key */
+	size_t count;
+};
+
+static int pair_cmp(const void *a, const void *b)
+{
+	return strcmp(((const struct pair *)a)->key, ((const struct pair *)b)->key);
+}
+
+static void pairs_free(struct pair *pairs, size_t count)
+{
+	while (count-- > 0) {
+		free(pairs[count].key);
+		free(pairs[count].value);
+	}
+	free(pairs);
+}
+
+/* Copy all variables of the snapshot sorted by key. Called with snapshot_lock held. */
+static struct pair *snapshot_pairs(size_t *count)
+{
+	size_t i, n = 0, max = snapshot.map ? snapshot.entry_count : snapshot.count;
+	struct pair *pairs;
+
+	if ((pairs = calloc(max ? max : 1, sizeof(*pairs))) == NULL)
+		abort();  // FIXME
+	if (snapshot.map) {
+		for (n = 0; n < snapshot.entry_count; n++) {
+			const struct compiled_entry *entry = &snapshot.entries[n];
+
+			pairs[n].key = strndup(snapshot.map + le32toh(entry->key), le32toh(entry->key_len));
+			pairs[n].value = strndup(snapshot.map + le32toh(entry->value), le32toh(entry->value_len));
+			if (!pairs[n].key || !pairs[n].value)
+				abort();  // FIXME
+		}
+	} else {
+		for (i = 0; i < snapshot.size; i++) {
+			if (!snapshot.table[i].key)
+				continue;
+			pairs[n].key = strdup(snapshot.table[i].key);
+			pairs[n].value = strdup(snapshot.table[i].value);
+			if (!pairs[n].key || !pairs[n].value)
+				abort();  // FIXME
+			n++;
+		}
+	}
+	qsort(pairs, n, sizeof(*pairs), pair_cmp);
+	*count = n;
+	return pairs;
+}
+
+static int watch_add(int fd, const char *filename)
+{
+	const char *slash = strrchr(filename, '/');
+	char *dir;
+	int ret;
+
+	/* UCR replaces the files by renaming, so watch the directory */
+	if (slash == NULL)
+		dir = strdup(".");
+	else
+		dir = strndup(filename, slash == filename ? 1 : slash - filename);
+	if (dir == NULL)
+		return -1;
+	ret = inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ONLYDIR);
+	if (ret < 0)
+		univention_debug(UV_DEBUG_CONFIG, UV_DEBUG_ERROR, "Failed to watch \"%s\": %s", dir, strerror(errno));
+	free(dir);
+	return ret < 0 ? -1 : 0;
+}
+
+struct univention_config_watch *univention_config_watch_new(void)
+{
+	struct univention_config_watch *watch;
+	const char *custom = getenv("UNIVENTION_BASECONF");
+
+	if ((watch = calloc(1, sizeof(*watch))) == NULL)
+		return NULL;
+	if ((watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0 ||
+			watch_add(watch->fd, LAYERS[NORMAL]) ||
+			(custom && watch_add(watch->fd, custom))) {
+		univention_config_watch_free(watch);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_update();
+	watch->pairs = snapshot_pairs(&watch->count);
+	pthread_mutex_unlock(&snapshot_lock);
+	return watch;
+}
+
+int univention_config_watch_fd(const struct univention_config_watch *watch)
+{
+	return watch->fd;
+}
+
+int univention_config_watch_dispatch(struct univention_config_watch *watch, univention_config_callback callback, void *data)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	struct pair *pairs;
+	size_t count, i = 0, j = 0;
+	bool events = false;
+	ssize_t len;
+	int changed = 0;
+
+	while ((len = read(watch->fd, buf, sizeof(buf))) > 0)
+		events = true;
+	if (len < 0 && errno != EAGAIN && errno != EINTR)
+		return -1;
+	if (!events)
+		return 0;
+
+	pthread_mutex_lock(&snapshot_lock);
+	snapshot_update();
+	pairs = snapshot_pairs(&count);
+	pthread_mutex_unlock(&snapshot_lock);
+
+	/* merge the sorted lists, the callback may look up variables itself */
+	while (i < watch->count || j < count) {
+		int cmp = i == watch->count ? 1 : j == count ? -1 : strcmp(watch->pairs[i].key, pairs[j].key);
+
+		if (cmp < 0) {
+			callback(watch->pairs[i].key, watch->pairs[i].value, NULL, data);
+			changed++;
+			i++;
+		} else if (cmp > 0) {
+			callback(pairs[j].key, NULL, pairs[j].value, data);
+			changed++;
+			j++;
+		} else {
+			if (strcmp(watch->pairs[i].value, pairs[j].value)) {
+				callback(pairs[j].key, watch->pairs[i].value, pairs[j].value, data);
+				changed++;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	pairs_free(watch->pairs, watch->count);
+	watch->pairs = pairs;
+	watch->count = count;
+	return changed;
+}
+
+void univention_config_watch_free(struct univention_config_watch *watch)
+{
+	if (!watch)
+		return;
+	if (watch->fd >= 0)
+		close(watch->fd);
+	pairs_free(watch->pairs, watch->count);
+	free(watch);
+}
+
 int univention_config_get_int(const char *key)
 {
 	int ret = -1;
@@ -180,40 +772,47 @@ long univention_config_get_long(const char *key)
 	return ret;
 }
 
-int univention_config_set_string(const char *key, const char *value)
+int univention_config_set_many(const char *const keys[], const char *const values[], size_t count)
 {
-	size_t len;
-	char *str;
-	int pid, status;
+	char **argv;
+	size_t i;
+	int pid, status, ret = -1;
 
-	len = strlen(key) + strlen(value) + 2;
-	str = malloc(len);
-	if (!str)
+	/* one invocation of UCR for all assignments, so its handlers run once */
+	argv = calloc(count + 3, sizeof(*argv));
+	if (!argv)
 		return -1;
-	snprintf(str, len, "%s=%s", key, value);
+	argv[0] = "univention-config-registry";
+	argv[1] = "set";
+	for (i = 0; i < count; i++)
+		if (asprintf(&argv[i + 2], "%s=%s", keys[i], values[i]) < 0) {
+			argv[i + 2] = NULL;
+			goto out;
+		}
 
 	pid = fork();
 	if (pid == -1)
-		return -1;
+		goto out;
 	if (pid == 0) {
 		/* child */
-		char *const argv[] = {
-			"univention-config-registry",
-			"set",
-			str,
-			NULL
-		};
 		execve("/usr/sbin/univention-config-registry", argv, NULL);
 		exit(127);
 	}
 	/* parent */
-	do {
-		if (waitpid(pid, &status, 0) == -1) {
-			if (errno != EINTR)
-				return -1;
-		} else
-			return status;
-	} while(1);
-
-	return 0;
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR)
+			goto out;
+	}
+	ret = status;
+
+out:
+	for (i = 2; argv[i]; i++)
+		free(argv[i]);
+	free(argv);
+	return ret;
+}
+
+int univention_config_set_string(const char *key, const char *value)
+{
+	return univention_config_set_many(&key, &value, 1);
 }
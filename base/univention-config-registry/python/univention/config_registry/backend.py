@@ -38,6 +38,7 @@ import errno
 import fcntl
 import os
 import re
+import struct
 import sys
 import time
 from collections.abc import ItemsView, Iterator, Mapping, MutableMapping
@@ -412,9 +413,69 @@ class ConfigRegistry(ReadOnlyConfigRegistry, _MM):
         """Return selected layer."""
         return self._registry[self.scope]
 
+    COMPILED = 'base.cache'
+    COMPILED_MAGIC = b'UUCRC001'
+    COMPILED_LAYERS = (ReadOnlyConfigRegistry.FORCED, ReadOnlyConfigRegistry.SCHEDULE, ReadOnlyConfigRegistry.LDAP, ReadOnlyConfigRegistry.NORMAL, ReadOnlyConfigRegistry.DEFAULTS)
+
     def save(self) -> None:
         """Save registry to file."""
         self._layer.save()
+        if self.scope != self.CUSTOM:
+            self._compile()
+
+    def _compile(self) -> None:
+        """
+        Compile the system layers into a single sorted table for `libunivention-config`.
+
+        The files are parsed the same way the C library does. The identity of each file is recorded, so readers fall back to the text files when they changed afterwards.
+        """
+        filename = os.path.join(self.PREFIX, self.COMPILED)
+        while True:
+            layers = []
+            merged: dict[bytes, tuple[bytes, int]] = {}
+            for reg in self.COMPILED_LAYERS:
+                path = os.path.join(self.PREFIX, self.BASES[reg])
+                try:
+                    with open(path, 'rb') as fd:
+                        before = os.fstat(fd.fileno())
+                        data = fd.read()
+                    after = os.stat(path)
+                except OSError:
+                    layers.append((0, 0, 0, 0, 0))
+                    continue
+                if (before.st_ino, before.st_size, before.st_mtime_ns) != (after.st_ino, after.st_size, after.st_mtime_ns):
+                    break
+                layers.append((after.st_dev, after.st_ino, after.st_size, after.st_mtime_ns // 1000000000, after.st_mtime_ns % 1000000000))
+                for line in data.split(b'\n'):
+                    key, sep, value = line.rstrip(b'\r').partition(b': ')
+                    if sep:
+                        merged.setdefault(key, (value, 1 if reg == self.DEFAULTS else 0))
+            else:
+                break
+
+        keys = sorted(merged)
+        header = struct.pack('<8sII', self.COMPILED_MAGIC, len(keys), len(layers))
+        header += b''.join(struct.pack('<QQQqq', *layer) for layer in layers)
+        offset = len(header) + len(keys) * struct.calcsize('<IIIII')
+        entries, strings = [], []
+        for key in keys:
+            value, flags = merged[key]
+            entries.append(struct.pack('<IIIII', offset, len(key), offset + len(key) + 1, len(value), flags))
+            strings.append(b'%s\0%s\0' % (key, value))
+            offset += len(key) + len(value) + 2
+
+        temp_filename = '%s.temp' % filename
+        try:
+            with open(temp_filename, 'wb') as fd:
+                fd.write(header)
+                fd.write(b''.join(entries))
+                fd.write(b''.join(strings))
+            os.chmod(temp_filename, 0o644)
+            os.rename(temp_filename, filename)
+        except OSError as ex:
+            # suppress certain errors
+            if ex.errno != errno.EACCES:
+                raise
 
     def lock(self) -> None:
         """Lock registry file."""
@@ -85,6 +85,33 @@ int main(void) {
 	fprintf(stderr, "set %s=%s [%d]\n", key, value, r);
 	assert(r == 0);
 
+	const char *const many_keys[] = {"test/clib/a", "test/clib/b"};
+	const char *const many_values[] = {"a", "b"};
+	r = univention_config_set_many(many_keys, many_values, ARRAY_SIZE(many_keys));
+	fprintf(stderr, "set_many [%d]\n", r);
+	assert(r == 0);
+	for (i = 0; i < ARRAY_SIZE(many_keys); i++) {
+		char *c = univention_config_get_string(many_keys[i]);
+		fprintf(stderr, "get_str %s=%s\n", many_keys[i], c);
+		assert(c != NULL && strcmp(c, many_values[i]) == 0);
+		free(c);
+	}
+	char **prefix_keys, **prefix_values;
+	size_t n = univention_config_get_prefix("test/clib/", &prefix_keys, &prefix_values);
+	fprintf(stderr, "get_prefix [%zu]\n", n);
+	assert(n == ARRAY_SIZE(many_keys));
+	for (i = 0; i < n; i++)
+		assert(strcmp(prefix_keys[i], many_keys[i]) == 0 && strcmp(prefix_values[i], many_values[i]) == 0);
+	univention_config_free_prefix(prefix_keys, prefix_values, n);
+	char *const unset_argv[] = {
+		ucr_name,
+		"unset",
+		(char *)many_keys[0],
+		(char *)many_keys[1],
+		NULL
+	};
+	fork_exec(unset_argv);
+
 	struct { char *key; char *val; } tests[] = {
 		{key, value},
 #if 0
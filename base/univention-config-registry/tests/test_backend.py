@@ -453,3 +453,39 @@ class TestDefault:
     def test_recusrion(self, ucr0, tmpdir):
         ucr0._registry[ucr0.DEFAULTS]["key"] = "@%@key@%@"
         assert ucr0["key"] == ""
+
+
+class TestCompiled:
+    def read(self, tmpdir):
+        import struct
+        data = (tmpdir / ConfigRegistry.COMPILED).read_binary()
+        magic, count, nlayers = struct.unpack_from('<8sII', data)
+        assert magic == ConfigRegistry.COMPILED_MAGIC
+        assert nlayers == len(ConfigRegistry.COMPILED_LAYERS)
+        offset = struct.calcsize('<8sII') + nlayers * struct.calcsize('<QQQqq')
+        result = {}
+        for i in range(count):
+            key, key_len, value, value_len, flags = struct.unpack_from('<IIIII', data, offset + i * struct.calcsize('<IIIII'))
+            result[data[key:key + key_len].decode()] = (data[value:value + value_len].decode(), flags)
+        return result
+
+    def test_save(self, ucrf, tmpdir):
+        assert self.read(tmpdir) == {
+            'bar': ('LDAP', 0),
+            'baz': ('NORMAL', 0),
+            'foo': ('LDAP', 0),
+        }
+
+    def test_default(self, ucr0, tmpdir):
+        ucr = ConfigRegistry(write_registry=ConfigRegistry.DEFAULTS)
+        ucr['key'] = '@%@ref@%@'
+        ucr.save()
+        ucr0['ref'] = 'val'
+        ucr0.save()
+        assert list(self.read(tmpdir).items()) == [('key', ('@%@ref@%@', 1)), ('ref', ('val', 0))]
+
+    def test_custom(self, ucr0, tmpdir):
+        ucr = ConfigRegistry(str(tmpdir / 'custom.conf'))
+        ucr['key'] = 'val'
+        ucr.save()
+        assert not (tmpdir / ConfigRegistry.COMPILED).exists()
@@ -37,6 +37,7 @@ implementation.
 
 import logging
 import sys
+import time
 from functools import wraps
 from itertools import chain
 from warnings import warn
@@ -141,6 +142,41 @@ _enable_syslog = False
 _logger_level = {key: DEFAULT for key in _map_id_old2new.values()}  # noqa: C420
 
 
+class _Limit:
+    """Rate limit and sampling of messages above WARN of one category."""
+
+    def __init__(self):
+        self.rate = self.burst = 0
+        self.tokens = 0.0
+        self.last = time.monotonic()
+        self.sample = self.counter = 0
+        self.suppressed = 0
+
+    def reset(self):
+        self.tokens = self.burst
+        self.last = time.monotonic()
+        self.counter = 0
+
+    def allow(self):
+        allow = True
+        if self.sample > 1:
+            allow = self.counter % self.sample == 0
+            self.counter += 1
+        if allow and self.rate:
+            now = time.monotonic()
+            self.tokens = min(self.burst, self.tokens + (now - self.last) * self.rate)
+            self.last = now
+            allow = self.tokens >= 1
+            if allow:
+                self.tokens -= 1
+        if not allow:
+            self.suppressed += 1
+        return allow
+
+
+_limits = {key: _Limit() for key in _map_id_old2new.values()}  # noqa: C420
+
+
 def init(logfile, force_flush=0, enable_function=0, enable_syslog=0):
     """
     Initialize debugging library for logging to 'logfile'.
@@ -243,6 +279,32 @@ def set_level(category, level):
     _logger_level[new_id] = level
 
 
+def set_rate(category, rate, burst=0):
+    """
+    Log at most 'rate' messages per second above WARN for facility 'category'.
+
+    :param int category: ID of the category, e.g. MAIN, LDAP, USERS, ...
+    :param int rate: messages per second, 0 for no limit.
+    :param int burst: messages logged at once, defaults to 'rate'.
+    """
+    limit = _limits[_map_id_old2new.get(category, 'MAIN')]
+    limit.rate = rate
+    limit.burst = burst or rate
+    limit.reset()
+
+
+def set_sampling(category, n):
+    """
+    Log only 1 in 'n' messages above WARN for facility 'category'.
+
+    :param int category: ID of the category, e.g. MAIN, LDAP, USERS, ...
+    :param int n: sampling interval, 0 or 1 to log all messages.
+    """
+    limit = _limits[_map_id_old2new.get(category, 'MAIN')]
+    limit.sample = n
+    limit.reset()
+
+
 def get_level(category):
     """
     Get minimum required severity for facility 'category'.
@@ -279,8 +341,15 @@ def debug(category, level, message, utf8=True):
     """
     new_id = _map_id_old2new.get(category, 'MAIN')
     if level <= _logger_level[new_id]:
+        limit = _limits[new_id]
+        if level > WARN and (limit.rate or limit.sample > 1) and not limit.allow():
+            return
         new_level = _map_lvl_old2new[level]
-        logging.getLogger('ud2').getChild(new_id).log(new_level, message)
+        logger = logging.getLogger('ud2').getChild(new_id)
+        if limit.suppressed and level > WARN:
+            logger.log(new_level, 'suppressed %d similar messages', limit.suppressed)
+            limit.suppressed = 0
+        logger.log(new_level, message)
         _flush()
 
 
@@ -57,11 +57,27 @@ py_univention_debug_debug(PyObject *self, PyObject *args)
     int level;
     char *string;
 
+    /* discard filtered messages before parsing the arguments */
+    if (PyTuple_GET_SIZE(args) == 3) {
+        long lid = PyLong_AsLong(PyTuple_GET_ITEM(args, 0));
+        long llevel = PyLong_AsLong(PyTuple_GET_ITEM(args, 1));
+
+        if (PyErr_Occurred()) {
+            /* leave the error reporting to PyArg_ParseTuple() */
+            PyErr_Clear();
+        } else if (lid >= 0 && lid < DEBUG_MODUL_COUNT && llevel > univention_debug_level[lid]) {
+            Py_RETURN_NONE;
+        }
+    }
+
     if (!PyArg_ParseTuple(args, "iis", &id, &level, &string)) {
         return NULL;
     }
 
+    /* string belongs to args, which the caller keeps alive */
+    Py_BEGIN_ALLOW_THREADS
     univention_debug(id, level, "%s", string);
+    Py_END_ALLOW_THREADS
 
     Py_RETURN_NONE;
 }
@@ -135,6 +151,49 @@ PyDoc_STRVAR(py_univention_debug_set_level__doc__,
         "category - ID of the category, e.g. MAIN, LDAP, USERS, ...\n"
         "level - Level of logging, e.g. ERROR, WARN, PROCESS, INFO, ALL");
 
+static PyObject *
+py_univention_debug_set_rate(PyObject *self, PyObject *args)
+{
+    int id;
+    unsigned int rate, burst = 0;
+
+    if (!PyArg_ParseTuple(args, "iI|I", &id, &rate, &burst)) {
+        return NULL;
+    }
+
+    univention_debug_set_rate(id, rate, burst);
+
+    Py_RETURN_NONE;
+}
+PyDoc_STRVAR(py_univention_debug_set_rate__doc__,
+        "set_rate(category, rate, burst=0) - Limit the message rate of category.\n"
+        "\n"
+        "Log at most 'rate' messages per second above WARN for facility 'category'.\n"
+        "category - ID of the category, e.g. MAIN, LDAP, USERS, ...\n"
+        "rate - messages per second, 0 for no limit\n"
+        "burst - messages logged at once, defaults to 'rate'");
+
+static PyObject *
+py_univention_debug_set_sampling(PyObject *self, PyObject *args)
+{
+    int id;
+    unsigned int n;
+
+    if (!PyArg_ParseTuple(args, "iI", &id, &n)) {
+        return NULL;
+    }
+
+    univention_debug_set_sampling(id, n);
+
+    Py_RETURN_NONE;
+}
+PyDoc_STRVAR(py_univention_debug_set_sampling__doc__,
+        "set_sampling(category, n) - Sample the messages of category.\n"
+        "\n"
+        "Log only 1 in 'n' messages above WARN for facility 'category'.\n"
+        "category - ID of the category, e.g. MAIN, LDAP, USERS, ...\n"
+        "n - sampling interval, 0 or 1 to log all messages");
+
 static PyObject *
 py_univention_debug_get_level(PyObject *self, PyObject *args)
 {
@@ -242,6 +301,8 @@ static struct PyMethodDef debug_methods[] = {
     {"init", (PyCFunction)py_univention_debug_init, METH_VARARGS, py_univention_debug_init__doc__},
     {"set_level", (PyCFunction)py_univention_debug_set_level, METH_VARARGS, py_univention_debug_set_level__doc__},
     {"get_level", (PyCFunction)py_univention_debug_get_level, METH_VARARGS, py_univention_debug_get_level__doc__},
+    {"set_rate", (PyCFunction)py_univention_debug_set_rate, METH_VARARGS, py_univention_debug_set_rate__doc__},
+    {"set_sampling", (PyCFunction)py_univention_debug_set_sampling, METH_VARARGS, py_univention_debug_set_sampling__doc__},
     {"set_function", (PyCFunction)py_univention_debug_set_function, METH_VARARGS, py_univention_debug_set_function__doc__},
     {"begin", (PyCFunction)py_univention_debug_begin, METH_VARARGS, py_univention_debug_begin__doc__},
     {"end", (PyCFunction)py_univention_debug_end, METH_VARARGS, py_univention_debug_end__doc__},
@@ -75,7 +75,8 @@ enum uv_debug_category {
 
 enum uv_debug_flag_flush {
 	UV_DEBUG_NO_FLUSH = 0x00,
-	UV_DEBUG_FLUSH = 0x01
+	UV_DEBUG_FLUSH = 0x01,
+	UV_DEBUG_ASYNC = 0x02  /* queue messages for a background thread */
 };
 
 enum uv_debug_flag_function {
@@ -83,11 +84,36 @@ enum uv_debug_flag_function {
 	UV_DEBUG_FUNCTION = 0x01
 };
 
+enum uv_debug_format {
+	UV_DEBUG_TEXT = 0x00,  /* text lines to the log file */
+	UV_DEBUG_JSON = 0x01,  /* JSON lines appended to a file */
+	UV_DEBUG_JOURNAL = 0x02  /* native protocol of systemd-journald */
+};
+
 /**
  * Log message of level and category id.
  */
 void univention_debug(enum uv_debug_category id, enum uv_debug_level level, const char *fmt, ...)
 	__attribute__ ((format (printf, 3, 4)));
+/**
+ * Current debug level of each category, use univention_debug_set_level() to change.
+ */
+extern enum uv_debug_level univention_debug_level[DEBUG_MODUL_COUNT];
+
+/**
+ * Highest level compiled in, messages above are removed at compile time.
+ * Build with -DUV_DEBUG_MAX_LEVEL=UV_DEBUG_INFO to drop UV_DEBUG_ALL.
+ */
+#ifndef UV_DEBUG_MAX_LEVEL
+#define UV_DEBUG_MAX_LEVEL UV_DEBUG_ALL
+#endif
+
+/* Check the level before the arguments are evaluated and the function is called. */
+#define univention_debug(id, level, ...) do { \
+	if ((level) <= UV_DEBUG_MAX_LEVEL && \
+			__builtin_expect((unsigned)(id) < DEBUG_MODUL_COUNT && (level) <= univention_debug_level[(id)], 0)) \
+		(univention_debug)((id), (level), __VA_ARGS__); \
+	} while (0)
 /**
  * Log begin of function s.
  */
@@ -104,6 +130,15 @@ void univention_debug_set_level(enum uv_debug_category id, enum uv_debug_level l
  * Get debug level of category id
  */
 enum uv_debug_level univention_debug_get_level(enum uv_debug_category id);
+/**
+ * Limit messages of category id above UV_DEBUG_WARN to rate per second, with bursts of up to burst messages.
+ * A rate of 0 removes the limit, a burst of 0 defaults to rate.
+ */
+void univention_debug_set_rate(enum uv_debug_category id, unsigned int rate, unsigned int burst);
+/**
+ * Log only 1 in n messages of category id above UV_DEBUG_WARN. A value below 2 logs all messages.
+ */
+void univention_debug_set_sampling(enum uv_debug_category id, unsigned int n);
 /**
  * Enable or disable logging of function begin and end.
  */
@@ -112,6 +147,12 @@ void univention_debug_set_function(enum uv_debug_flag_function function);
  * Initialize debugging library.
  */
 FILE * univention_debug_init(const char *logfile, enum uv_debug_flag_flush flush, enum uv_debug_flag_function function);
+/**
+ * Send messages as structured records instead of text lines.
+ * target is the file for UV_DEBUG_JSON and the datagram socket for UV_DEBUG_JOURNAL, by default the one of journald.
+ * @return 0 on success, -1 on errors with errno set.
+ */
+int univention_debug_set_format(enum uv_debug_format format, const char *target);
 /**
  * Close old logfile and re-open it.
  */
@@ -33,20 +33,29 @@
  * <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
 #include <time.h>
-#include <sys/time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 
 #include <univention/debug.h>
 
 #define UV_DEBUG_DEFAULT        UV_DEBUG_WARN
 
-static enum uv_debug_level univention_debug_level[DEBUG_MODUL_COUNT];
+enum uv_debug_level univention_debug_level[DEBUG_MODUL_COUNT];
 static char *univention_debug_filename = NULL;
 static FILE *univention_debug_file = NULL;
 static enum uv_debug_flag_flush univention_debug_flush;
@@ -54,6 +63,31 @@ static enum uv_debug_flag_function univention_debug_function;
 
 static bool univention_debug_ready = false;
 
+/* With UV_DEBUG_ASYNC callers format their messages into a bounded ring
+ * without taking any lock, and a background thread writes them in batches.
+ * Messages are dropped while the ring is full. Errors and long messages are
+ * written directly after the queued ones, so nothing is lost on abort(). */
+#define ASYNC_RECORDS 4096
+#define ASYNC_TEXT 512
+#define ASYNC_IDLE_MIN_NS 1000000
+#define ASYNC_IDLE_MAX_NS 100000000
+
+struct async_record {
+	atomic_size_t seq;
+	struct timespec ts;
+	char text[ASYNC_TEXT];
+};
+
+static struct async_record *async_ring;
+static atomic_size_t async_head;  /* next record to claim by callers */
+static size_t async_tail;  /* next record to write, protected by async_lock */
+static atomic_ulong async_dropped;
+static unsigned long async_reported;
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t async_thread;
+static atomic_bool async_running;
+static atomic_bool async_stop;
+
 static const char *const univention_debug_id_text[] = {
 	"MAIN",
 	"LDAP",
@@ -87,15 +121,384 @@ static const char *const univention_debug_level_text[] = {
 	"ALL"
 };
 
+/* "dd.mm.yy HH:MM:SS.mmm" */
+#define TIMESTAMP_SIZE 22
+
+/* Format @ts into @buf. localtime_r() takes the time zone lock, so the
+ * date and time are only converted once per second and thread. */
+static void format_timestamp(char buf[TIMESTAMP_SIZE], const struct timespec *ts)
+{
+	static __thread time_t last_sec = -1;
+	static __thread char prefix[80];  /* room for any int in the format */
+	int ms = ts->tv_nsec / 1000000;
+
+	if (ts->tv_sec != last_sec) {
+		struct tm tm;
+
+		localtime_r(&ts->tv_sec, &tm);
+		snprintf(prefix, sizeof(prefix), "%02d.%02d.%02d %02d:%02d:%02d.", tm.tm_mday, tm.tm_mon + 1, tm.tm_year - 100, tm.tm_hour, tm.tm_min, tm.tm_sec);
+		last_sec = ts->tv_sec;
+	}
+	memcpy(buf, prefix, TIMESTAMP_SIZE - 4);
+	buf[TIMESTAMP_SIZE - 4] = '0' + ms / 100;
+	buf[TIMESTAMP_SIZE - 3] = '0' + ms / 10 % 10;
+	buf[TIMESTAMP_SIZE - 2] = '0' + ms % 10;
+	buf[TIMESTAMP_SIZE - 1] = '\0';
+}
+
 #define LOG(fmt, ...) do { \
-	struct timeval tv; \
-	struct tm tm; \
-	gettimeofday(&tv, NULL); \
-	localtime_r(&tv.tv_sec, &tm); \
-	fprintf(univention_debug_file, "%02d.%02d.%02d %02d:%02d:%02d.%03d  " fmt, tm.tm_mday, tm.tm_mon + 1, tm.tm_year - 100, tm.tm_hour,tm.tm_min, tm.tm_sec, (int)(tv.tv_usec / 1000), ##__VA_ARGS__); \
+	struct timespec ts; \
+	char stamp[TIMESTAMP_SIZE]; \
+	clock_gettime(CLOCK_REALTIME, &ts); \
+	format_timestamp(stamp, &ts); \
+	fprintf(univention_debug_file, "%s  " fmt, stamp, ##__VA_ARGS__); \
 	} while (0)
 
 
+/* Write all queued records. Called with async_lock held. */
+static size_t async_drain(void)
+{
+	char stamp[TIMESTAMP_SIZE];
+	unsigned long dropped;
+	size_t count = 0;
+
+	if (!async_ring)
+		return 0;
+	for (;; async_tail++, count++) {
+		struct async_record *record = &async_ring[async_tail % ASYNC_RECORDS];
+
+		if (atomic_load_explicit(&record->seq, memory_order_acquire) != async_tail + 1)
+			break;
+		if (univention_debug_file) {
+			format_timestamp(stamp, &record->ts);
+			fprintf(univention_debug_file, "%s  %s\n", stamp, record->text);
+		}
+		atomic_store_explicit(&record->seq, async_tail + ASYNC_RECORDS, memory_order_release);
+	}
+
+	dropped = atomic_load(&async_dropped);
+	if (dropped != async_reported && univention_debug_file) {
+		LOG("%-11s ( %-7s ) : %lu messages dropped\n", "MAIN", "WARN", dropped - async_reported);
+		async_reported = dropped;
+		count++;
+	}
+	if (count && univention_debug_file)
+		fflush(univention_debug_file);
+	return count;
+}
+
+static void *async_writer(void *arg)
+{
+	struct timespec idle = {.tv_sec = 0, .tv_nsec = ASYNC_IDLE_MIN_NS};
+
+	for (;;) {
+		size_t count;
+
+		pthread_mutex_lock(&async_lock);
+		count = async_drain();
+		pthread_mutex_unlock(&async_lock);
+		if (count) {
+			idle.tv_nsec = ASYNC_IDLE_MIN_NS;
+			continue;
+		}
+		if (atomic_load(&async_stop))
+			break;
+		/* back off while idle */
+		nanosleep(&idle, NULL);
+		if (idle.tv_nsec < ASYNC_IDLE_MAX_NS / 2)
+			idle.tv_nsec *= 2;
+	}
+	return NULL;
+}
+
+/* Stop the writer after it wrote all queued records. */
+static void async_stop_writer(void)
+{
+	pthread_mutex_lock(&async_lock);
+	if (!async_running) {
+		async_drain();
+		pthread_mutex_unlock(&async_lock);
+		return;
+	}
+	async_running = false;
+	pthread_mutex_unlock(&async_lock);
+
+	atomic_store(&async_stop, true);
+	pthread_join(async_thread, NULL);
+	atomic_store(&async_stop, false);
+}
+
+/* The writer thread does not survive fork(), so start it on demand. */
+static void async_start_writer(void)
+{
+	pthread_mutex_lock(&async_lock);
+	if (!async_running && async_ring)
+		async_running = pthread_create(&async_thread, NULL, async_writer, NULL) == 0;
+	pthread_mutex_unlock(&async_lock);
+}
+
+/* Write the queued records before fork(), so they are not written twice. */
+static void async_prepare(void)
+{
+	pthread_mutex_lock(&async_lock);
+	async_drain();
+}
+
+static void async_parent(void)
+{
+	pthread_mutex_unlock(&async_lock);
+}
+
+static void async_child(void)
+{
+	async_running = false;
+	pthread_mutex_unlock(&async_lock);
+}
+
+static void async_init(void)
+{
+	static bool registered;
+	size_t i;
+
+	if (!async_ring) {
+		if ((async_ring = calloc(ASYNC_RECORDS, sizeof(*async_ring))) == NULL)
+			return;
+		for (i = 0; i < ASYNC_RECORDS; i++)
+			atomic_init(&async_ring[i].seq, i);
+		atomic_store(&async_head, 0);
+		async_tail = 0;
+	}
+	if (!registered) {
+		pthread_atfork(async_prepare, async_parent, async_child);
+		atexit(async_stop_writer);
+		registered = true;
+	}
+}
+
+/* Queue the message, returns false if it must be written directly. */
+static bool async_log(const char *id, const char *level, const char *fmt, va_list ap)
+{
+	struct async_record *record;
+	char text[ASYNC_TEXT];
+	size_t pos, seq;
+	int len;
+
+	len = snprintf(text, sizeof(text), "%-11s ( %-7s ) : ", id, level);
+	if (len >= 0 && len < sizeof(text))
+		len += vsnprintf(text + len, sizeof(text) - len, fmt, ap);
+	if (len < 0 || len >= sizeof(text))
+		return false;
+
+	if (!async_running)
+		async_start_writer();
+
+	pos = atomic_load_explicit(&async_head, memory_order_relaxed);
+	for (;;) {
+		record = &async_ring[pos % ASYNC_RECORDS];
+		seq = atomic_load_explicit(&record->seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&async_head, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+				break;
+		} else if (seq < pos) {
+			/* full */
+			atomic_fetch_add(&async_dropped, 1);
+			return true;
+		} else {
+			pos = atomic_load_explicit(&async_head, memory_order_relaxed);
+		}
+	}
+
+	clock_gettime(CLOCK_REALTIME, &record->ts);
+	memcpy(record->text, text, len + 1);
+	atomic_store_explicit(&record->seq, pos + 1, memory_order_release);
+	return true;
+}
+
+
+/* Structured sink replacing the text output of univention_debug(). */
+#define JOURNAL_SOCKET "/run/systemd/journal/socket"
+
+static enum uv_debug_format sink_format = UV_DEBUG_TEXT;
+static char *sink_target;
+static int sink_fd = -1;
+
+struct sink_buffer {
+	char *data;
+	size_t len, size;
+};
+
+static void sink_append(struct sink_buffer *buf, const void *data, size_t len)
+{
+	if (buf->len + len > buf->size) {
+		size_t size = buf->size ? buf->size : 1024;
+		char *tmp;
+
+		while (size < buf->len + len)
+			size *= 2;
+		if ((tmp = realloc(buf->data, size)) == NULL)
+			abort();  // FIXME
+		buf->data = tmp;
+		buf->size = size;
+	}
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+}
+
+static void sink_printf(struct sink_buffer *buf, const char *fmt, ...)
+	__attribute__ ((format (printf, 2, 3)));
+static void sink_printf(struct sink_buffer *buf, const char *fmt, ...)
+{
+	char tmp[128];
+	va_list ap;
+	int len;
+
+	va_start(ap, fmt);
+	len = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+	if (len > 0)
+		sink_append(buf, tmp, len < sizeof(tmp) ? len : sizeof(tmp) - 1);
+}
+
+static void sink_json_string(struct sink_buffer *buf, const char *str, size_t len)
+{
+	size_t i, start = 0;
+
+	sink_append(buf, "\"", 1);
+	for (i = 0; i < len; i++) {
+		unsigned char c = str[i];
+
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		sink_append(buf, str + start, i - start);
+		sink_printf(buf, "\\u%04x", c);
+		start = i + 1;
+	}
+	sink_append(buf, str + start, len - start);
+	sink_append(buf, "\"", 1);
+}
+
+/* Map to the syslog priorities used by the journal. */
+static int sink_priority(enum uv_debug_level level)
+{
+	switch (level) {
+	case UV_DEBUG_ERROR:
+		return 3;
+	case UV_DEBUG_WARN:
+		return 4;
+	case UV_DEBUG_PROCESS:
+		return 5;
+	case UV_DEBUG_INFO:
+		return 6;
+	default:
+		return 7;
+	}
+}
+
+static int sink_open(void)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	const char *path = sink_target ? sink_target : JOURNAL_SOCKET;
+	int fd;
+
+	switch (sink_format) {
+	case UV_DEBUG_JSON:
+		return open(sink_target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+	case UV_DEBUG_JOURNAL:
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			errno = ENAMETOOLONG;
+			return -1;
+		}
+		strcpy(addr.sun_path, path);
+		if ((fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0)) < 0)
+			return -1;
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+			close(fd);
+			return -1;
+		}
+		return fd;
+	default:
+		errno = EINVAL;
+		return -1;
+	}
+}
+
+/* Emit the message as one JSON line or one journal datagram. */
+static void sink_log(enum uv_debug_category id, enum uv_debug_level level, const char *level_text, const char *fmt, va_list ap)
+{
+	struct sink_buffer buf = {NULL, 0, 0};
+	struct timespec mono, real;
+	char text[1024], *message = text;
+	va_list copy;
+	int len;
+
+	va_copy(copy, ap);
+	len = vsnprintf(text, sizeof(text), fmt, copy);
+	va_end(copy);
+	if (len < 0)
+		return;
+	if (len >= sizeof(text) && vasprintf(&message, fmt, ap) < 0)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &mono);
+	clock_gettime(CLOCK_REALTIME, &real);
+	if (sink_format == UV_DEBUG_JSON) {
+		sink_printf(&buf, "{\"monotonic\":%lld.%06ld,\"realtime\":%lld.%06ld,\"pid\":%d,\"tid\":%ld,\"category\":\"%s\",\"level\":\"%s\",\"message\":",
+			(long long)mono.tv_sec, mono.tv_nsec / 1000, (long long)real.tv_sec, real.tv_nsec / 1000, getpid(), (long)syscall(SYS_gettid), univention_debug_id_text[id], level_text);
+		sink_json_string(&buf, message, len);
+		sink_append(&buf, "}\n", 2);
+		if (write(sink_fd, buf.data, buf.len) < 0)
+			;  /* nowhere to report */
+	} else {
+		uint64_t size = len;  /* little endian on all supported architectures */
+
+		sink_printf(&buf, "PRIORITY=%d\nSYSLOG_IDENTIFIER=%s\nSYSLOG_PID=%d\nTID=%ld\nUNIVENTION_CATEGORY=%s\nUNIVENTION_LEVEL=%s\nUNIVENTION_MONOTONIC_USEC=%lld\n",
+			sink_priority(level), program_invocation_short_name, getpid(), (long)syscall(SYS_gettid), univention_debug_id_text[id], level_text,
+			(long long)mono.tv_sec * 1000000 + mono.tv_nsec / 1000);
+		/* the binary form allows new lines in the message */
+		sink_append(&buf, "MESSAGE\n", 8);
+		sink_append(&buf, &size, sizeof(size));
+		sink_append(&buf, message, len);
+		sink_append(&buf, "\n", 1);
+		if (send(sink_fd, buf.data, buf.len, MSG_NOSIGNAL) < 0)
+			;  /* dropped, e.g. if the journal is not running */
+	}
+
+	free(buf.data);
+	if (message != text)
+		free(message);
+}
+
+int univention_debug_set_format(enum uv_debug_format format, const char *target)
+{
+	char *old_target = sink_target;
+	enum uv_debug_format old_format = sink_format;
+	int fd;
+
+	if (format == UV_DEBUG_JSON && !target) {
+		errno = EINVAL;
+		return -1;
+	}
+	sink_format = format;
+	if (target && (sink_target = strdup(target)) == NULL)
+		abort();  // FIXME
+	if (!target)
+		sink_target = NULL;
+	if (format == UV_DEBUG_TEXT) {
+		fd = -1;
+	} else if ((fd = sink_open()) < 0) {
+		free(sink_target);
+		sink_target = old_target;
+		sink_format = old_format;
+		return -1;
+	}
+	free(old_target);
+	if (sink_fd >= 0)
+		close(sink_fd);
+	sink_fd = fd;
+	return 0;
+}
+
+
 FILE * univention_debug_init(const char *logfile, enum uv_debug_flag_flush flush, enum uv_debug_flag_function function)
 {
 	int i;
@@ -123,6 +526,11 @@ FILE * univention_debug_init(const char *logfile, enum uv_debug_flag_flush flush
 
 	univention_debug_flush = flush;
 	univention_debug_function = function;
+	if (flush == UV_DEBUG_ASYNC) {
+		async_init();
+		if (!async_ring)
+			univention_debug_flush = UV_DEBUG_FLUSH;
+	}
 
 	LOG("DEBUG_INIT\n");
 	fflush(univention_debug_file);
@@ -132,74 +540,271 @@ FILE * univention_debug_init(const char *logfile, enum uv_debug_flag_flush flush
 	return univention_debug_file;
 }
 
-void univention_debug(enum uv_debug_category id, enum uv_debug_level level, const char *fmt, ...)
+/* Rate limits and sampling of the categories, for levels above UV_DEBUG_WARN.
+ * Suppressed messages are counted per call site, identified by the format
+ * string, and reported with the next message logged from the same site. */
+#define LIMIT_SITES 256
+
+struct limit {
+	unsigned int rate, burst;  /* token bucket in messages per second, 0 for unlimited */
+	double tokens;
+	struct timespec last;
+	unsigned int sample, counter;  /* log 1 in sample messages */
+	unsigned long suppressed;  /* from call sites not fitting into limit_sites */
+};
+
+static struct limit limits[DEBUG_MODUL_COUNT];
+static atomic_bool limit_active[DEBUG_MODUL_COUNT];
+static pthread_mutex_t limit_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct {
+	const char *fmt;
+	enum uv_debug_category id;
+	unsigned long suppressed;
+} limit_sites[LIMIT_SITES];
+
+static unsigned long *limit_site(enum uv_debug_category id, const char *fmt)
 {
-	va_list ap;
+	size_t i, slot = ((uintptr_t)fmt >> 3) % LIMIT_SITES;
 
-	if (!univention_debug_ready)
-		return;
+	for (i = 0; i < LIMIT_SITES; i++, slot = (slot + 1) % LIMIT_SITES) {
+		if (!limit_sites[slot].fmt) {
+			limit_sites[slot].fmt = fmt;
+			limit_sites[slot].id = id;
+		}
+		if (limit_sites[slot].fmt == fmt && limit_sites[slot].id == id)
+			return &limit_sites[slot].suppressed;
+	}
+	return &limits[id].suppressed;
+}
+
+/* Return whether the message may be logged, and in @reported the number of
+ * messages suppressed at the same call site before. */
+static bool limit_check(enum uv_debug_category id, enum uv_debug_level level, const char *fmt, unsigned long *reported)
+{
+	struct limit *limit = &limits[id];
+	unsigned long *suppressed;
+	bool allow = true;
+
+	*reported = 0;
+	if (level <= UV_DEBUG_WARN || !atomic_load_explicit(&limit_active[id], memory_order_relaxed))
+		return true;
+
+	pthread_mutex_lock(&limit_lock);
+	if (limit->sample > 1 && limit->counter++ % limit->sample)
+		allow = false;
+	if (allow && limit->rate) {
+		struct timespec now;
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		limit->tokens += ((now.tv_sec - limit->last.tv_sec) + (now.tv_nsec - limit->last.tv_nsec) / 1e9) * limit->rate;
+		if (limit->tokens > limit->burst)
+			limit->tokens = limit->burst;
+		limit->last = now;
+		if (limit->tokens < 1)
+			allow = false;
+		else
+			limit->tokens -= 1;
+	}
+	suppressed = limit_site(id, fmt);
+	if (allow) {
+		*reported = *suppressed;
+		*suppressed = 0;
+	} else {
+		++*suppressed;
+	}
+	pthread_mutex_unlock(&limit_lock);
+	return allow;
+}
+
+static void limit_update(enum uv_debug_category id)
+{
+	struct limit *limit = &limits[id];
+
+	clock_gettime(CLOCK_MONOTONIC, &limit->last);
+	limit->tokens = limit->burst;
+	limit->counter = 0;
+	atomic_store(&limit_active[id], limit->rate > 0 || limit->sample > 1);
+}
+
+void univention_debug_set_rate(enum uv_debug_category id, unsigned int rate, unsigned int burst)
+{
 	if (id < 0)
 		return;
 	if (id >= DEBUG_MODUL_COUNT)
 		return;
-	if (!univention_debug_file)
+
+	pthread_mutex_lock(&limit_lock);
+	limits[id].rate = rate;
+	limits[id].burst = burst ? burst : rate;
+	limit_update(id);
+	pthread_mutex_unlock(&limit_lock);
+}
+
+void univention_debug_set_sampling(enum uv_debug_category id, unsigned int n)
+{
+	if (id < 0)
 		return;
-	if (level > univention_debug_level[id])
+	if (id >= DEBUG_MODUL_COUNT)
 		return;
 
+	pthread_mutex_lock(&limit_lock);
+	limits[id].sample = n;
+	limit_update(id);
+	pthread_mutex_unlock(&limit_lock);
+}
+
+static void debug_vlog(enum uv_debug_category id, enum uv_debug_level level, const char *fmt, va_list ap)
+{
+	char level_text[12];
+	va_list copy;
+
 	if (level >= UV_DEBUG_ERROR && level <= UV_DEBUG_ALL)
-		LOG("%-11s ( %-7s ) : ", univention_debug_id_text[id], univention_debug_level_text[level]);
+		snprintf(level_text, sizeof(level_text), "%s", univention_debug_level_text[level]);
 	else
-		LOG("%-11s ( %-7d ) : ", univention_debug_id_text[id], level);
+		snprintf(level_text, sizeof(level_text), "%d", level);
+
+	if (sink_fd >= 0) {
+		sink_log(id, level, level_text, fmt, ap);
+		return;
+	}
+
+	if (univention_debug_flush == UV_DEBUG_ASYNC && level != UV_DEBUG_ERROR) {
+		bool queued;
+
+		va_copy(copy, ap);
+		queued = async_log(univention_debug_id_text[id], level_text, fmt, copy);
+		va_end(copy);
+		if (queued)
+			return;
+	}
+
+	if (univention_debug_flush == UV_DEBUG_ASYNC) {
+		/* keep the order with the queued messages */
+		pthread_mutex_lock(&async_lock);
+		async_drain();
+	}
+	/* keep the line together when called concurrently */
+	flockfile(univention_debug_file);
+	LOG("%-11s ( %-7s ) : ", univention_debug_id_text[id], level_text);
 
 	{
-		va_start(ap, fmt);
 		vfprintf(univention_debug_file, fmt, ap);
-		va_end(ap);
 		fprintf(univention_debug_file, "\n");
-		if (univention_debug_flush == UV_DEBUG_FLUSH) {
+		if (univention_debug_flush != UV_DEBUG_NO_FLUSH) {
 			fflush(univention_debug_file);
 		}
 	}
+	funlockfile(univention_debug_file);
+	if (univention_debug_flush == UV_DEBUG_ASYNC)
+		pthread_mutex_unlock(&async_lock);
 }
 
-void univention_debug_begin(const char *s)
+static void debug_log(enum uv_debug_category id, enum uv_debug_level level, const char *fmt, ...)
+	__attribute__ ((format (printf, 3, 4)));
+static void debug_log(enum uv_debug_category id, enum uv_debug_level level, const char *fmt, ...)
 {
+	va_list ap;
+
+	va_start(ap, fmt);
+	debug_vlog(id, level, fmt, ap);
+	va_end(ap);
+}
+
+/* Report the messages still suppressed. */
+static void limit_report(void)
+{
+	size_t i;
+
+	pthread_mutex_lock(&limit_lock);
+	for (i = 0; i < LIMIT_SITES; i++) {
+		if (limit_sites[i].suppressed)
+			debug_log(limit_sites[i].id, UV_DEBUG_WARN, "suppressed %lu similar messages: %s", limit_sites[i].suppressed, limit_sites[i].fmt);
+		limit_sites[i].suppressed = 0;
+	}
+	for (i = 0; i < DEBUG_MODUL_COUNT; i++) {
+		if (limits[i].suppressed)
+			debug_log(i, UV_DEBUG_WARN, "suppressed %lu messages", limits[i].suppressed);
+		limits[i].suppressed = 0;
+	}
+	pthread_mutex_unlock(&limit_lock);
+}
+
+void (univention_debug)(enum uv_debug_category id, enum uv_debug_level level, const char *fmt, ...)
+{
+	unsigned long suppressed;
+	va_list ap;
+
+	if (!univention_debug_ready)
+		return;
+	if (id < 0)
+		return;
+	if (id >= DEBUG_MODUL_COUNT)
+		return;
 	if (!univention_debug_file)
 		return;
-	if (univention_debug_function != UV_DEBUG_FUNCTION)
+	if (level > univention_debug_level[id])
+		return;
+	if (!limit_check(id, level, fmt, &suppressed))
 		return;
 
-	{
-		fprintf(univention_debug_file, "UNIVENTION_DEBUG_BEGIN  : %s\n", s);
-		if (univention_debug_flush == UV_DEBUG_FLUSH)
-			fflush(univention_debug_file);
-	}
+	if (suppressed)
+		debug_log(id, level, "suppressed %lu similar messages", suppressed);
+	va_start(ap, fmt);
+	debug_vlog(id, level, fmt, ap);
+	va_end(ap);
 }
 
-void univention_debug_end(const char *s)
+static void univention_debug_function_log(const char *what, const char *s)
 {
 	if (!univention_debug_file)
 		return;
 	if (univention_debug_function != UV_DEBUG_FUNCTION)
 		return;
 
+	if (univention_debug_flush == UV_DEBUG_ASYNC) {
+		pthread_mutex_lock(&async_lock);
+		async_drain();
+	}
 	{
-		fprintf(univention_debug_file, "UNIVENTION_DEBUG_END    : %s\n", s);
-		if (univention_debug_flush == UV_DEBUG_FLUSH)
+		fprintf(univention_debug_file, "%s: %s\n", what, s);
+		if (univention_debug_flush != UV_DEBUG_NO_FLUSH)
 			fflush(univention_debug_file);
 	}
+	if (univention_debug_flush == UV_DEBUG_ASYNC)
+		pthread_mutex_unlock(&async_lock);
+}
+
+void univention_debug_begin(const char *s)
+{
+	univention_debug_function_log("UNIVENTION_DEBUG_BEGIN  ", s);
+}
+
+void univention_debug_end(const char *s)
+{
+	univention_debug_function_log("UNIVENTION_DEBUG_END    ", s);
 }
 
 void univention_debug_reopen(void)
 {
 	if (!univention_debug_ready)
 		return;
+	if (sink_format == UV_DEBUG_JSON && sink_fd >= 0) {
+		int fd = sink_open();
+
+		/* replace the descriptor atomically for concurrent writers */
+		if (fd >= 0) {
+			dup2(fd, sink_fd);
+			close(fd);
+		}
+	}
 	if (!univention_debug_filename)
 		return;
 
 	if (univention_debug_file == stderr || univention_debug_file == stdout)
 		return;
+	/* write the queued messages to the old file */
+	pthread_mutex_lock(&async_lock);
+	async_drain();
 	if (univention_debug_file != NULL) {
 		fclose(univention_debug_file);
 		univention_debug_file = NULL;
@@ -210,11 +815,10 @@ void univention_debug_reopen(void)
 	else if (!strcmp(univention_debug_filename ,"stdout"))
 		univention_debug_file = stdout;
 	else {
-		if ((univention_debug_file = fopen(univention_debug_filename, "a+")) == NULL) {
+		if ((univention_debug_file = fopen(univention_debug_filename, "a+")) == NULL)
 			fprintf(stderr, "Could not open logfile \"%s\"\n", univention_debug_filename);
-			return /*1*/;
-		}
 	}
+	pthread_mutex_unlock(&async_lock);
 }
 
 void univention_debug_exit(void)
@@ -222,6 +826,9 @@ void univention_debug_exit(void)
 	if (!univention_debug_ready)
 		return;
 
+	limit_report();
+	async_stop_writer();
+	univention_debug_set_format(UV_DEBUG_TEXT, NULL);
 	LOG("DEBUG_EXIT\n");
 	if (univention_debug_file) {
 		fflush(univention_debug_file);
@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <univention/debug.h>
+
+#define THREADS 4
+#define MESSAGES 1000
+
+static void *producer(void *arg) {
+	int i;
+
+	for (i = 0; i < MESSAGES; i++)
+		univention_debug(UV_DEBUG_MAIN, UV_DEBUG_INFO, "thread %ld message %d", (long)arg, i);
+	return NULL;
+}
+
+int main(void) {
+	char logfile[] = "/tmp/test_async.XXXXXX", line[256];
+	unsigned long dropped = 0, n;
+	int info = 0, order = 0, fd;
+	pthread_t threads[THREADS];
+	long i;
+	pid_t pid;
+	FILE *f;
+
+	fd = mkstemp(logfile);
+	assert(fd >= 0);
+	close(fd);
+
+	f = univention_debug_init(logfile, UV_DEBUG_ASYNC, UV_DEBUG_NO_FUNCTION);
+	assert(f != NULL);
+	univention_debug_set_level(UV_DEBUG_MAIN, UV_DEBUG_ALL);
+
+	for (i = 0; i < THREADS; i++)
+		assert(pthread_create(&threads[i], NULL, producer, (void *)i) == 0);
+	for (i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	/* errors are written directly, after everything queued before */
+	univention_debug(UV_DEBUG_MAIN, UV_DEBUG_INFO, "before error");
+	univention_debug(UV_DEBUG_MAIN, UV_DEBUG_ERROR, "error");
+
+	pid = fork();
+	assert(pid >= 0);
+	if (pid == 0) {
+		univention_debug(UV_DEBUG_MAIN, UV_DEBUG_INFO, "child");
+		exit(0);
+	}
+	waitpid(pid, NULL, 0);
+
+	univention_debug_reopen();
+	univention_debug(UV_DEBUG_MAIN, UV_DEBUG_INFO, "last");
+	univention_debug_exit();
+
+	f = fopen(logfile, "r");
+	assert(f != NULL);
+	while (fgets(line, sizeof(line), f)) {
+		if (strstr(line, "( INFO    ) : thread "))
+			info++;
+		else if (sscanf(strstr(line, ": ") ? strstr(line, ": ") + 2 : "", "%lu messages dropped", &n) == 1)
+			dropped += n;
+		else if (strstr(line, ": before error"))
+			order = order == 0 ? 1 : -1;
+		else if (strstr(line, ": error"))
+			order = order == 1 ? 2 : -1;
+		else if (strstr(line, ": child"))
+			order = order == 2 ? 3 : -1;
+		else if (strstr(line, ": last"))
+			order = order == 3 ? 4 : -1;
+	}
+	fclose(f);
+	unlink(logfile);
+
+	fprintf(stderr, "info=%d dropped=%lu order=%d\n", info, dropped, order);
+	assert(info + dropped == THREADS * MESSAGES);
+	assert(order == 4);
+	return 0;
+}
@@ -0,0 +1,54 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <univention/debug.h>
+
+int main(void) {
+	char jsonfile[] = "/tmp/test_format.XXXXXX", line[512], packet[1024];
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	ssize_t len;
+	FILE *f;
+	int fd;
+
+	fd = mkstemp(jsonfile);
+	assert(fd >= 0);
+	close(fd);
+
+	f = univention_debug_init("stdout", UV_DEBUG_FLUSH, UV_DEBUG_NO_FUNCTION);
+	assert(f != NULL);
+	assert(univention_debug_set_format(UV_DEBUG_JSON, NULL) == -1);
+	assert(univention_debug_set_format(UV_DEBUG_JSON, jsonfile) == 0);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "quote \" backslash \\ tab \t");
+
+	f = fopen(jsonfile, "r");
+	assert(f != NULL);
+	assert(fgets(line, sizeof(line), f) != NULL);
+	fclose(f);
+	unlink(jsonfile);
+	fprintf(stderr, "%s", line);
+	assert(strstr(line, "\"category\":\"LISTENER\",\"level\":\"ERROR\",\"message\":\"quote \\u0022 backslash \\u005c tab \\u0009\"}\n"));
+
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/test_format.%d", getpid());
+	fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	assert(fd >= 0);
+	assert(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+	assert(univention_debug_set_format(UV_DEBUG_JOURNAL, addr.sun_path) == 0);
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "two\nlines");
+	len = recv(fd, packet, sizeof(packet), MSG_DONTWAIT);
+	close(fd);
+	unlink(addr.sun_path);
+	assert(len > 0);
+	assert(memmem(packet, len, "PRIORITY=4\n", 11));
+	assert(memmem(packet, len, "UNIVENTION_CATEGORY=TRANSFILE\n", 30));
+	assert(memmem(packet, len, "MESSAGE\n\x09\0\0\0\0\0\0\0two\nlines\n", 26));
+
+	assert(univention_debug_set_format(UV_DEBUG_TEXT, NULL) == 0);
+	univention_debug(UV_DEBUG_MAIN, UV_DEBUG_ERROR, "text again");
+	univention_debug_exit();
+	return 0;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <univention/debug.h>
+
+int main(void) {
+	char logfile[] = "/tmp/test_limit.XXXXXX", line[256];
+	int i, site = 0, sampled = 0, errors = 0, fd;
+	unsigned long n, suppressed = 0;
+	FILE *f;
+
+	fd = mkstemp(logfile);
+	assert(fd >= 0);
+	close(fd);
+
+	f = univention_debug_init(logfile, UV_DEBUG_NO_FLUSH, UV_DEBUG_NO_FUNCTION);
+	assert(f != NULL);
+	univention_debug_set_level(UV_DEBUG_LISTENER, UV_DEBUG_ALL);
+	univention_debug_set_level(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL);
+
+	/* a burst of 10, errors are never limited */
+	univention_debug_set_rate(UV_DEBUG_LISTENER, 1, 10);
+	for (i = 0; i < 100; i++) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "site %d", i);
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "error %d", i);
+	}
+	univention_debug_set_rate(UV_DEBUG_LISTENER, 0, 0);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "site %d", i);
+
+	univention_debug_set_sampling(UV_DEBUG_TRANSFILE, 10);
+	for (i = 0; i < 100; i++)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "sampled %d", i);
+	univention_debug_exit();
+
+	f = fopen(logfile, "r");
+	assert(f != NULL);
+	while (fgets(line, sizeof(line), f)) {
+		char *msg = strstr(line, " : ");
+
+		if (!msg)
+			continue;
+		msg += 3;
+		if (!strncmp(msg, "site ", 5))
+			site++;
+		else if (!strncmp(msg, "error ", 6))
+			errors++;
+		else if (!strncmp(msg, "sampled ", 8))
+			sampled++;
+		else if (sscanf(msg, "suppressed %lu similar messages", &n) == 1)
+			suppressed += n;
+	}
+	fclose(f);
+	unlink(logfile);
+
+	fprintf(stderr, "site=%d errors=%d sampled=%d suppressed=%lu\n", site, errors, sampled, suppressed);
+	assert(errors == 100);
+	assert(site >= 11 && site < 20);
+	assert(sampled == 10);
+	assert(site + sampled + suppressed == 101 + 100);
+	return 0;
+}
@@ -43,6 +43,7 @@ void univention_license_free(void);
 
 /* main admin function */
 int univention_license_check(const char *objectDN);
+void univention_license_check_cache_clear(void);
 
 /* main create license function */
 char *univention_license_sign_license(const char *licenseDN);
@@ -68,6 +69,7 @@ void univention_license_key_free(void);
 int univention_license_key_public_key_installed(void);
 int univention_license_key_public_key_load(void);
 int univention_license_verify(const char *data, const char *signature);
+int univention_license_verify_hash(const unsigned char *hash, const char *signature);
 
 /*private key*/
 int univention_license_key_private_key_installed(void);
@@ -79,6 +81,7 @@ int univention_license_qsort_hook(sortElement *a, sortElement *b);
 lObj *univention_license_sort(lObj *license);
 
 char *univention_license_build_data(lObj *license);
+int univention_license_hash_data(lObj *license, unsigned char *hash);
 unsigned int univention_license_base64_to_raw(const char *base64data, unsigned char **rawdata);
 char *univention_license_raw_to_base64(const unsigned char *data, unsigned int datalen);
 
@@ -94,7 +97,10 @@ void univention_license_ldap_close_connection(void);
 
 lStrings *univention_license_ldap_get_strings(const char *objectDN, const char *attribute);
 lObj *univention_license_ldap_search_licenseObject(const char *searchBaseDN, const char *licensetyp, int num);
+lObj **univention_license_ldap_search_licenseObjects(const lStrings *searchPath, const char *licensetyp);
+lStrings *univention_license_ldap_get_searchpath(void);
 lObj *univention_license_ldap_get_licenseObject(const char *licenseDN);
+char *univention_license_ldap_get_csn(const char *objectDN);
 
 lObj *univention_license_ldap_get(const char *search_base, int scope, const char *filter, char **attr, const char *attrFilter, int num);
 #endif
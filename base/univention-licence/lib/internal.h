@@ -9,6 +9,7 @@
 #include <time.h>
 
 #include <openssl/err.h>
+#include <openssl/evp.h>
 #include <openssl/objects.h>
 #include <openssl/sha.h>
 #include <openssl/rsa.h>
@@ -36,6 +37,7 @@
 DEFINE_AUTOPTR_FUNC(lStrings, univention_licenseStrings_free)
 DEFINE_AUTOPTR_FUNC(lObj, univention_licenseObject_free)
 DEFINE_AUTOPTR_FUNC(char, free);
+DEFINE_AUTOPTR_FUNC(int, free);
 DEFINE_AUTOPTR_FUNC(sortElement, free);
 DEFINE_AUTOPTR_FUNC(BIO, BIO_free)
 
@@ -1,11 +1,35 @@
 #include "internal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 /*! @file license.c
         @brief general lib license functions
 */
 
+#define LICENSE_CHECK_CACHE "/var/cache/univention-license.check" /*!< the verified license state shared by root processes*/
+#define LICENSE_CHECK_BITS (1 | 4)                                  /*!< the check results that only depend on the license object*/
+
 static lObj *global_license = NULL; /*!< the container for the current selected license*/
 static int is_init = 0;             /*!< the init-state of the lib*/
 
+/*!
+        @brief the last license verified by univention_license_check()
+
+        The signature and basedn results only change with the license object,
+        so they are kept together with its entryCSN. The end date is kept as
+        string, it has to be compared with the current date on every check.
+*/
+static struct {
+	char *dn;      /*!< the DN of the license object*/
+	char *csn;     /*!< its entryCSN or modifyTimestamp*/
+	char *basedn;  /*!< the local base DN the result was computed for*/
+	int result;    /*!< the LICENSE_CHECK_BITS of univention_license_check()*/
+	char *enddate; /*!< the value of univentionLicenseEndDate, NULL if missing*/
+} check_cache;
+
 /*****************************************************************************/
 /*!
         @brief	init the licenselib, is called automatic.
@@ -38,6 +62,7 @@ int univention_license_init(void) {
         @brief	cleanup the license lib
 */
 void univention_license_free(void) {
+	univention_license_check_cache_clear();
 	univention_license_ldap_free();
 	univention_license_key_free();
 	if (global_license != NULL) {
@@ -73,10 +98,10 @@ int univention_license_select(const char *licensetyp) {
 	int ret = -1;
 	// check init
 	if (univention_license_init()) {
-		AUTOPTR(char) directoryDN = NULL;
-		lStrings *searchPath = NULL;
+		AUTOPTR(lStrings) searchPath = NULL;
+		lObj **licenses = NULL;
 		char *baseDN = univention_license_ldap_get_basedn();
-		int len = 0;
+		int i;
 		if (!baseDN)
 			goto err1;
 
@@ -86,80 +111,49 @@ int univention_license_select(const char *licensetyp) {
 			global_license = NULL;
 		}
 
-		// build directoryDN
-		len = strlen(baseDN) + strlen("cn=directory,cn=univention,");
-		directoryDN = malloc(sizeof(char) * (len + 1));
-		if (!directoryDN)
+		// find location of licenses
+		if ((searchPath = univention_license_ldap_get_searchpath()) == NULL) {
+			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "Could not retrieve the location of licenses from: cn=directory,cn=univention,%s.", baseDN);
 			goto err1;
+		}
 
-		sprintf(directoryDN, "cn=directory,cn=univention,%s", baseDN);
+		// get the licenses of all paths at once
+		licenses = univention_license_ldap_search_licenseObjects(searchPath, licensetyp);
+		for (i = 0; licenses != NULL && licenses[i] != NULL; i++) {
+			if (global_license == NULL) {
+				int valid = 1;
+				global_license = licenses[i];
+				licenses[i] = NULL;
 
-		// find location of licenses
-		if ((searchPath = univention_license_ldap_get_strings(directoryDN, "univentionLicenseObject")) == NULL) {
-			free(directoryDN);
-			len = strlen(baseDN) + strlen("cn=default containers,cn=univention,");
-			directoryDN = malloc(sizeof(char) * (len + 1));
-			if (!directoryDN)
-				goto err1;
-			sprintf(directoryDN, "cn=default containers,cn=univention,%s", baseDN);
-			directoryDN[len] = 0;
-
-			searchPath = univention_license_ldap_get_strings(directoryDN, "univentionLicenseObject");
-		}
-		if (searchPath != NULL) {
-			int i = 0;
-			if (searchPath->num > 0) {
-				while (i < searchPath->num && global_license == NULL) {
-					int licenseNum = 0;
-					int license_found = 0;
-					// printf("Search:%s.\n",searchPath->line[i]);
-					do {
-						license_found = 0;
-						// get the license
-						global_license = univention_license_ldap_search_licenseObject(searchPath->line[i], licensetyp, licenseNum);
-						if (global_license != NULL) {
-							int valid = 1;
-							license_found = 1;
-							licenseNum++;  // count the found licenses so they will be skipped the in the next request for this searchpath
-
-							ret = 0;
-							if (!univention_license_check_signature()) {
-								ret |= 1;
-								valid &= 0;
-							}
-							if (!univention_license_check_enddate()) {
-								ret |= 2;
-								valid &= 0;
-							}
-							if (!univention_license_check_basedn()) {
-								ret |= 4;
-								valid &= 0;
-							}
-
-							if (!valid) {
-								univention_licenseObject_free(global_license);
-								global_license = NULL;
-								univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "The license found is invalid!");
-							}
-						}
-					} while (license_found && global_license == NULL);
-					i++;
+				ret = 0;
+				if (!univention_license_check_signature()) {
+					ret |= 1;
+					valid &= 0;
+				}
+				if (!univention_license_check_enddate()) {
+					ret |= 2;
+					valid &= 0;
+				}
+				if (!univention_license_check_basedn()) {
+					ret |= 4;
+					valid &= 0;
 				}
 
-				// do we finally found a license?
-				if (NULL == global_license) {
-					univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "No license of type '%s' found at:", licensetyp);
-					for (i = 0; i < searchPath->num; i++)
-						univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "->%s", searchPath->line[i]);
+				if (!valid) {
+					univention_licenseObject_free(global_license);
+					global_license = NULL;
+					univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "The license found is invalid!");
 				}
-			} else {
-				univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "The location of licenses %s doesn't contain any paths.", directoryDN);
 			}
+			univention_licenseObject_free(licenses[i]);
+		}
+		free(licenses);
 
-			univention_licenseStrings_free(searchPath);
-			searchPath = NULL;
-		} else {
-			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "Could not retrieve the location of licenses from: %s.", directoryDN);
+		// do we finally found a license?
+		if (NULL == global_license) {
+			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "No license of type '%s' found at:", licensetyp);
+			for (i = 0; i < searchPath->num; i++)
+				univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "->%s", searchPath->line[i]);
 		}
 	}
 err1:
@@ -208,9 +202,196 @@ int univention_license_selectDN(const char *licenseDN) {
 	return ret;
 }
 
+/*!
+        @brief	check the end date value of a license against the current date
+        @param enddate the value of univentionLicenseEndDate
+        @retval 0 if the license is expired or the value is invalid
+        @retval 1 if everything is fine
+*/
+static int license_check_enddate(const char *enddate) {
+	if (enddate == NULL) {
+		univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "This License is invalid because it lacks the attribute EndDate!");
+		return 0;
+	}
+
+	if (strcmp(enddate, "unlimited") == 0)
+		return 1;
+
+	int endDay = 0, endMonth = 0, endYear = 0;
+	if (sscanf(enddate, "%d.%d.%d", &endDay, &endMonth, &endYear) != 3)
+		return 0;
+
+	time_t cur_time;
+	cur_time = time(NULL);
+
+	struct tm tim;
+	localtime_r(&cur_time, &tim);
+
+	if ((endYear - 1900) > tim.tm_year) {
+		return 1;
+	} else if ((endYear - 1900) < tim.tm_year) {
+		// expired
+	} else {
+		/* same year */
+		if (endMonth > (tim.tm_mon + 1)) {
+			return 1;
+		} else if (endMonth < (tim.tm_mon + 1)) {
+			// expired
+		} else {
+			/* same month */
+			if (endDay > tim.tm_mday) {
+				return 1;
+			} else if (endDay < tim.tm_mday) {
+				// expired
+			} else {
+				/* same day */
+				return 1;
+			}
+		}
+	}
+	univention_debug(
+		UV_DEBUG_LICENSE, UV_DEBUG_INFO,
+		"This License expired on '%s'. Current date is '%i.%i.%i'.(day)",
+		enddate, tim.tm_mday, tim.tm_mon + 1, tim.tm_year + 1900);
+	return 0;
+}
+
+/*****************************************************************************/
+/*!
+        @brief	forget the license state cached by univention_license_check()
+
+        the file cache is left alone, it is invalidated by the entryCSN.
+*/
+void univention_license_check_cache_clear(void) {
+	free(check_cache.dn);
+	free(check_cache.csn);
+	free(check_cache.basedn);
+	free(check_cache.enddate);
+	memset(&check_cache, 0, sizeof(check_cache));
+}
+
+/*!
+        @brief	store a verified license state in the cache, taking ownership of the strings
+*/
+static void license_check_cache_set(char *dn, char *csn, char *basedn, int result, char *enddate) {
+	univention_license_check_cache_clear();
+	check_cache.dn = dn;
+	check_cache.csn = csn;
+	check_cache.basedn = basedn;
+	check_cache.result = result;
+	check_cache.enddate = enddate;
+	if (!dn || !csn || !basedn)
+		univention_license_check_cache_clear();
+}
+
+/*!
+        @brief	check if the cache holds the license objectDN in the state csn
+        @retval 1 if the cached result can be used
+        @retval 0 otherwise
+*/
+static int license_check_cache_valid(const char *objectDN, const char *csn) {
+	const char *baseDN = univention_license_ldap_get_basedn();
+	return check_cache.dn && baseDN &&
+	       strcasecmp(check_cache.dn, objectDN) == 0 &&
+	       strcmp(check_cache.csn, csn) == 0 &&
+	       strcasecmp(check_cache.basedn, baseDN) == 0;
+}
+
+/*!
+        @brief	read the line of LICENSE_CHECK_CACHE at *pos
+        @return a newly allocated string or NULL at the end of the data
+*/
+static char *license_check_cache_line(char **pos) {
+	char *line = *pos, *end = strchr(line, '\n');
+	if (!end)
+		return NULL;
+	*pos = end + 1;
+	return strndup(line, end - line);
+}
+
+/*!
+        @brief	load the cache from LICENSE_CHECK_CACHE
+
+        The file is only trusted if it's a regular file owned by root and
+        not writable by anybody else, as it replaces the signature check.
+        It is written by univention_license_check() if run as root.
+*/
+static void license_check_cache_load(void) {
+	char data[4096], *pos = data;
+	struct stat st;
+	ssize_t len;
+	int fd;
+
+	fd = open(LICENSE_CHECK_CACHE, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_uid != 0 || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_WARN, "Ignoring %s, it's not a regular file owned by root.", LICENSE_CHECK_CACHE);
+		close(fd);
+		return;
+	}
+	len = read(fd, data, sizeof(data) - 1);
+	close(fd);
+	if (len <= 0)
+		return;
+	data[len] = '\0';
+
+	char *dn = license_check_cache_line(&pos);
+	char *csn = license_check_cache_line(&pos);
+	char *basedn = license_check_cache_line(&pos);
+	char *result = license_check_cache_line(&pos);
+	char *enddate = license_check_cache_line(&pos);
+	if (result && enddate) {
+		if (!*enddate) {
+			free(enddate);
+			enddate = NULL;
+		}
+		license_check_cache_set(dn, csn, basedn, atoi(result) & LICENSE_CHECK_BITS, enddate);
+	} else {
+		free(dn);
+		free(csn);
+		free(basedn);
+		free(enddate);
+	}
+	free(result);
+}
+
+/*!
+        @brief	save the cache to LICENSE_CHECK_CACHE, only done as root
+*/
+static void license_check_cache_save(void) {
+	char tmp[] = LICENSE_CHECK_CACHE ".XXXXXX";
+	FILE *file;
+	int fd;
+
+	if (geteuid() != 0 || !check_cache.dn)
+		return;
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto err;
+	if (fchmod(fd, S_IRUSR | S_IWUSR) || !(file = fdopen(fd, "w"))) {
+		close(fd);
+		goto err1;
+	}
+	fprintf(file, "%s\n%s\n%s\n%d\n%s\n", check_cache.dn, check_cache.csn, check_cache.basedn, check_cache.result, check_cache.enddate ? check_cache.enddate : "");
+	if (fclose(file) || rename(tmp, LICENSE_CHECK_CACHE))
+		goto err1;
+	return;
+err1:
+	unlink(tmp);
+err:
+	univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_WARN, "Could not write %s: %s", LICENSE_CHECK_CACHE, strerror(errno));
+}
+
 /*****************************************************************************/
 /*!
         @brief check the license at objectDN
+
+        the results of the signature and basedn tests are cached together with
+        the entryCSN of the license object, in-process and for root also in
+        LICENSE_CHECK_CACHE. As long as the object is unchanged a check only
+        costs the lookup of its entryCSN.
+
         @param objectDN
         @retval -1 the object can not be found or is no license object
         @retval 0 the license is valid and has passed all tests
@@ -223,7 +404,21 @@ int univention_license_selectDN(const char *licenseDN) {
 int univention_license_check(const char *objectDN) {
 	int ret = -1;
 	if (univention_license_init()) {
+		AUTOPTR(char) csn = univention_license_ldap_get_csn(objectDN);
 		lObj *backup = global_license;
+
+		if (csn && !license_check_cache_valid(objectDN, csn))
+			license_check_cache_load();
+		if (csn && license_check_cache_valid(objectDN, csn)) {
+			univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_INFO, "Using cached license state of %s.", objectDN);
+			ret = check_cache.result;
+			if (!license_check_enddate(check_cache.enddate))
+				ret |= 2;
+			if (!univention_license_check_searchpath(objectDN))
+				ret |= 8;
+			return ret;
+		}
+
 		global_license = univention_license_ldap_get_licenseObject(objectDN);
 
 		if (global_license != NULL) {
@@ -234,6 +429,11 @@ int univention_license_check(const char *objectDN) {
 				ret |= 2;
 			if (!univention_license_check_basedn())
 				ret |= 4;
+			if (csn && univention_license_ldap_get_basedn()) {
+				AUTOPTR(lStrings) enddate = univention_license_get_value("univentionLicenseEndDate");
+				license_check_cache_set(strdup(objectDN), strdup(csn), strdup(univention_license_ldap_get_basedn()), ret & LICENSE_CHECK_BITS, enddate ? strdup(enddate->line[0]) : NULL);
+				license_check_cache_save();
+			}
 			if (!univention_license_check_searchpath(objectDN))
 				ret |= 8;
 			univention_licenseObject_free(global_license);
@@ -309,51 +509,7 @@ int univention_license_check_enddate() {
 	}
 
 	AUTOPTR(lStrings) licensedate = univention_license_get_value("univentionLicenseEndDate");
-	if (licensedate == NULL) {
-		univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "This License is invalid because it lacks the attribute EndDate!");
-		return 0;
-	}
-
-	if (strcmp(licensedate->line[0], "unlimited") == 0)
-		return 1;
-
-	int endDay = 0, endMonth = 0, endYear = 0;
-	if (sscanf(licensedate->line[0], "%d.%d.%d", &endDay, &endMonth, &endYear) != 3)
-		return 0;
-
-	time_t cur_time;
-	cur_time = time(NULL);
-
-	struct tm tim;
-	localtime_r(&cur_time, &tim);
-
-	if ((endYear - 1900) > tim.tm_year) {
-		return 1;
-	} else if ((endYear - 1900) < tim.tm_year) {
-		// expired
-	} else {
-		/* same year */
-		if (endMonth > (tim.tm_mon + 1)) {
-			return 1;
-		} else if (endMonth < (tim.tm_mon + 1)) {
-			// expired
-		} else {
-			/* same month */
-			if (endDay > tim.tm_mday) {
-				return 1;
-			} else if (endDay < tim.tm_mday) {
-				// expired
-			} else {
-				/* same day */
-				return 1;
-			}
-		}
-	}
-	univention_debug(
-		UV_DEBUG_LICENSE, UV_DEBUG_INFO,
-		"This License expired on '%s'. Current date is '%i.%i.%i'.(day)",
-		licensedate->line[0], tim.tm_mday, tim.tm_mon + 1, tim.tm_year + 1900);
-	return 0;
+	return license_check_enddate(licensedate ? licensedate->line[0] : NULL);
 }
 
 /*****************************************************************************/
@@ -374,29 +530,7 @@ int univention_license_check_searchpath(const char *objectDN) {
 	return 1;
 
 	if (univention_license_init()) {
-		AUTOPTR(char) directoryDN = NULL;
-		int len = 0;
-		lStrings *searchPath = NULL;
-		char *baseDN = univention_license_ldap_get_basedn();
-
-		// build directoryDN
-		len = strlen(baseDN) + strlen("cn=directory,cn=univention,");
-		directoryDN = malloc(sizeof(char) * (len + 1));
-		if (!directoryDN)
-			return 0;
-
-		sprintf(directoryDN, "cn=directory,cn=univention,%s", baseDN);
-		directoryDN[len] = 0;
-
-		// find location of licenses
-		if ((searchPath = univention_license_ldap_get_strings(directoryDN, "univentionLicenseObject")) == NULL) {
-			free(directoryDN);
-			len = strlen(baseDN) + strlen("cn=default containers,cn=univention,");
-			directoryDN = malloc(sizeof(char) * (len + 1));
-			sprintf(directoryDN, "cn=default containers,cn=univention,%s", baseDN);
-			directoryDN[len] = 0;
-			searchPath = univention_license_ldap_get_strings(directoryDN, "univentionLicenseObject");
-		}
+		lStrings *searchPath = univention_license_ldap_get_searchpath();
 
 		if (searchPath != NULL) {
 			int i = 0;
@@ -419,13 +553,11 @@ int univention_license_check_searchpath(const char *objectDN) {
 				}
 				if (!found)
 					univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "The ObjectDN(%s) is not inside the searchPaths of licenses.", objectDN);
-			} else {
-				univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "The location of licenses %s doesn't contain any paths.", directoryDN);
 			}
 			univention_licenseStrings_free(searchPath);
 			searchPath = NULL;
 		} else {
-			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "Could not retrieve the location of licenses from: %s.", directoryDN);
+			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "Could not retrieve the location of licenses.");
 		}
 	}
 	return found;
@@ -472,6 +604,17 @@ int univention_license_compare_string(const char *a, const char *b) {
 	return strcmp(a, b);
 }
 
+/*!
+        @brief	the qsort() compatible version of univention_license_qsort_hook()
+*/
+static int license_sort_compare(const void *a, const void *b) {
+	const sortElement *x = a, *y = b;
+	int ret = strcmp(x->key, y->key);
+	if (ret == 0)
+		ret = strcmp(x->val, y->val);
+	return ret;
+}
+
 /*****************************************************************************/
 /*!
         @brief	sort the key, value pairs of a license
@@ -486,8 +629,15 @@ int univention_license_compare_string(const char *a, const char *b) {
 */
 lObj *univention_license_sort(lObj *license) {
 	int size = license->size;
-	if (size > 1) {
-		int i;
+	int i;
+
+	// a license is sorted in place, so a repeated sort has nothing to do
+	for (i = 1; i < size; i++) {
+		int cmp = strcmp(license->key[i - 1], license->key[i]);
+		if (cmp > 0 || (cmp == 0 && strcmp(license->val[i - 1], license->val[i]) > 0))
+			break;
+	}
+	if (i < size) {
 		AUTOPTR(sortElement) sortarray = NULL;
 		// printf("DEBUG:do a sort with %i elements.\n",size);
 
@@ -502,7 +652,7 @@ lObj *univention_license_sort(lObj *license) {
 			sortarray[i].val = license->val[i];
 		}
 		// do the sort
-		qsort(&sortarray[0], size, sizeof(sortElement), (void *)univention_license_qsort_hook);
+		qsort(&sortarray[0], size, sizeof(sortElement), license_sort_compare);
 
 		for (i = 0; i < license->size; i++) {
 			license->key[i] = sortarray[i].key;
@@ -249,17 +249,33 @@ int univention_license_key_private_key_load_file(const char *filename, const cha
         @retval	0 on error
 */
 int univention_license_verify(const char *data, const char *signature) {
+	if (data != NULL) {
+		unsigned char hash[SHA_DIGEST_LENGTH];
+
+		// hash
+		SHA1((const unsigned char *)data, strlen(data), hash);
+		return univention_license_verify_hash(hash, signature);
+	}
+	univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "Can't veriy Data() with Signature(%s).", signature ? signature : "");
+	return 0;
+}
+
+/******************************************************************************/
+/*!
+        @brief	verify a SHA1 hash with the installed publicKeys against the signature
+        @param	hash the SHA_DIGEST_LENGTH bytes of the hashed data
+        @param	signature the base64 encoded signature
+        @retval	1 if it's a valid signature
+        @retval	0 if not or an error has occurred
+*/
+int univention_license_verify_hash(const unsigned char *hash, const char *signature) {
 	int ret = 0;
 	if (univention_license_key_public_key_installed()) {
-		if (signature != NULL && data != NULL) {
-			unsigned char hash[SHA_DIGEST_LENGTH];
+		if (signature != NULL && hash != NULL) {
 			int signaturelen = 0;
 			unsigned char *rawsignature = NULL;
 			int i = 0;
 
-			// hash
-			SHA1((const unsigned char *)data, strlen(data), hash);
-
 			// convert base64signature to rawsignature
 			signaturelen = univention_license_base64_to_raw(signature, &rawsignature);
 
@@ -270,7 +286,7 @@ int univention_license_verify(const char *data, const char *signature) {
 			}
 			free(rawsignature);
 		} else {
-			univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "Can't veriy Data(%s) with Signature(%s).", data ? data : "", signature ? signature : "");
+			univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "Can't veriy Signature(%s).", signature ? signature : "");
 		}
 	}
 	return ret;
@@ -187,6 +187,31 @@ out:
 	return ret;
 }
 
+/******************************************************************************/
+/*!
+        @brief get the change sequence number of the ldap object referenced by objectDN
+
+        this is the operational attribute entryCSN, with modifyTimestamp as
+        fallback for servers without it. Only these attributes are requested,
+        so this is a lot cheaper than fetching the whole license object.
+
+        @param objectDN the referenced ldap Object DN
+        @retval NULL if the object or both attributes are not found
+        @return a newly allocated string, free it with free()
+*/
+char *univention_license_ldap_get_csn(const char *objectDN) {
+	static const char *const names[] = {"entryCSN", "modifyTimestamp"};
+	char *ret = NULL;
+	size_t i;
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]) && ret == NULL; i++) {
+		AUTOPTR(lStrings) csn = univention_license_ldap_get_strings(objectDN, names[i]);
+		if (csn != NULL && csn->num > 0 && csn->line[0] != NULL)
+			ret = strdup(csn->line[0]);
+	}
+	return ret;
+}
+
 /******************************************************************************/
 /*!
         @brief get one or more strings form the ldap object attribute referenced by objectDN
@@ -250,6 +275,73 @@ out:
 	return ret;
 }
 
+/******************************************************************************/
+/*!
+        @brief convert a ldap entry to a lObj
+
+        @param element		the ldap entry
+        @param attrFilter	filter all attributes that not begin with this
+
+        @return Pointer to a lObj, or NULL if the entry has no such attributes.
+*/
+static lObj *license_ldap_entry(LDAPMessage *element, const char *attrFilter) {
+	lObj *ret = NULL;
+	int valuecount = 0;
+	char *attributeName = NULL;
+	BerElement *ber_walker;
+
+	/* count values*/
+	for (attributeName = ldap_first_attribute(lp->ld, element, &ber_walker); attributeName != NULL; attributeName = ldap_next_attribute(lp->ld, element, ber_walker)) {
+		if (strncmp(attrFilter, attributeName, strlen(attrFilter)) == 0) {
+			struct berval **values = NULL;
+			values = ldap_get_values_len(lp->ld, element, attributeName);
+
+			if (values != NULL) {
+				valuecount += ldap_count_values_len(values);
+				ldap_value_free_len(values);
+			}
+		} else {
+			univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_INFO, "Ignore object attribute '%s' because it don't begin with '%s'.", attributeName, attrFilter);
+		}
+		ldap_memfree(attributeName);
+	}
+	ber_free(ber_walker, 0);
+
+	/*store key and val in license*/
+	if (valuecount > 0) {
+		int i = 0;
+		ret = univention_licenseObject_malloc(valuecount);
+		if (!ret)
+			return NULL;
+
+		/*convert LDAPMessage to C Object*/
+		for (attributeName = ldap_first_attribute(lp->ld, element, &ber_walker); attributeName != NULL; attributeName = ldap_next_attribute(lp->ld, element, ber_walker)) {
+			if (strncmp(attrFilter, attributeName, strlen(attrFilter)) == 0) {
+				struct berval **values = NULL;
+
+				values = ldap_get_values_len(lp->ld, element, attributeName);
+				if (values != NULL) {
+					int x, count = ldap_count_values_len(values);
+					for (x = 0; x < count; i++, x++) {
+						// FIXME: check memory allocation error
+						ret->key[i] = strdup(attributeName);
+						// FIXME: bv_val may be binary and not a \0 terminated srting
+						ret->val[i] = strdup(values[x]->bv_val);
+						// printf("%p:key[%i]:%s.\n",ret->key[i],i,ret->key[i]);
+						// printf("%p:val[%i]:%s.\n",ret->val[i],i,ret->val[i]);
+					}
+					ldap_value_free_len(values);
+				}
+			}
+			ldap_memfree(attributeName);
+		}
+		ber_free(ber_walker, 0);
+	} else {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "LDAP-Element has 0 attributes!");
+	}
+	return ret;
+}
+
 /******************************************************************************/
 /*!
         @brief make a ldap search with the given parameters and convert a possible
@@ -296,10 +388,6 @@ lObj *univention_license_ldap_get(const char *search_base, int scope, const char
 		} else {
 			count = ldap_count_entries(lp->ld, result);
 			if (count > 0) {
-				int valuecount = 0;
-				char *attributeName = NULL;
-				BerElement *ber_walker;
-
 				if (count > 1) {
 					univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Found %d entries expected only 1 use the 1st.", count);
 				}
@@ -317,58 +405,12 @@ lObj *univention_license_ldap_get(const char *search_base, int scope, const char
 					}
 				}
 
-				if (element != NULL) {  // is there a element anymore?
-					/* count values*/
-					for (attributeName = ldap_first_attribute(lp->ld, element, &ber_walker); attributeName != NULL; attributeName = ldap_next_attribute(lp->ld, element, ber_walker)) {
-						if (strncmp(attrFilter, attributeName, strlen(attrFilter)) == 0) {
-							struct berval **values = NULL;
-							values = ldap_get_values_len(lp->ld, element, attributeName);
-
-							if (values != NULL) {
-								valuecount += ldap_count_values_len(values);
-								ldap_value_free_len(values);
-							}
-						} else {
-							univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_INFO, "Ignore object attribute '%s' because it don't begin with '%s'.", attributeName, attrFilter);
-						}
-					}
-
-					/*store key and val in license*/
-					if (valuecount > 0) {
-						int i = 0;
-						ret = univention_licenseObject_malloc(valuecount);
-						if (!ret)
-							goto err1;
-
-						/*convert LDAPMessage to C Object*/
-						for (attributeName = ldap_first_attribute(lp->ld, element, &ber_walker); attributeName != NULL; attributeName = ldap_next_attribute(lp->ld, element, ber_walker)) {
-							if (strncmp(attrFilter, attributeName, strlen(attrFilter)) == 0) {
-								struct berval **values = NULL;
-
-								values = ldap_get_values_len(lp->ld, element, attributeName);
-								if (values != NULL) {
-									int x, count = ldap_count_values_len(values);
-									for (x = 0; x < count; i++, x++) {
-										// FIXME: check memory allocation error
-										ret->key[i] = strdup(attributeName);
-										// FIXME: bv_val may be binary and not a \0 terminated srting
-										ret->val[i] = strdup(values[x]->bv_val);
-										// printf("%p:key[%i]:%s.\n",ret->key[i],i,ret->key[i]);
-										// printf("%p:val[%i]:%s.\n",ret->val[i],i,ret->val[i]);
-									}
-									ldap_value_free_len(values);
-								}
-							}
-						}
-					} else {
-						univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "LDAP-Element has 0 attributes!");
-					}
-				}
+				if (element != NULL)  // is there a element anymore?
+					ret = license_ldap_entry(element, attrFilter);
 			} else {
 				univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "The LDAP-Result has 0 elements, this should be normal if nothing is found.");
 			}
 		}
-err1:
 		/*WARNING!!! only free a ldapmessage after you have all you need from, this
 		cleans all, also subparts of the message!!!*/
 		if (result != NULL) {
@@ -378,4 +420,148 @@ err1:
 	}
 	return ret;
 }
+/******************************************************************************/
+/*!
+        @brief get the ldap paths where licenses are searched
+
+        these are the values of univentionLicenseObject in
+        'cn=directory,cn=univention,[basedn]' or, if it has none, in
+        'cn=default containers,cn=univention,[basedn]'. Both objects are
+        fetched with a single search.
+
+        @retval	NULL	if no path is found or an error has occurred
+        @return lStrings a struct with num as the size of the line[] array of char*
+*/
+lStrings *univention_license_ldap_get_searchpath(void) {
+	static const char *const containers[] = {"cn=directory,", "cn=default containers,"};
+	const char *filter = "(&(univentionLicenseObject=*)(|(cn=directory)(cn=default containers)))";
+	char *attr[] = {"univentionLicenseObject", NULL};
+	lStrings *ret = NULL;
+	LDAPMessage *result = NULL;
+	LDAPMessage *element;
+	struct timeval timeout;
+	char *univentionDN;
+	size_t c;
+	int rc;
+
+	if (!univention_license_ldap_open_connection() || lp->base == NULL)
+		return NULL;
+
+	univentionDN = malloc(strlen("cn=univention,") + strlen(lp->base) + 1);
+	if (!univentionDN)
+		return NULL;
+	sprintf(univentionDN, "cn=univention,%s", lp->base);
+
+	timeout.tv_sec = 3;
+	timeout.tv_usec = 0;
+
+	univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "LDAPSearch: searchBaseDN '%s', scope '%i' filter '%s' attr[0] '%s'", univentionDN, LDAP_SCOPE_ONELEVEL, filter, attr[0]);
+	if ((rc = ldap_search_ext_s(lp->ld, univentionDN, LDAP_SCOPE_ONELEVEL, filter, attr, 0, NULL, NULL, &timeout, 0, &result)) != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Not found:%s. Filter:%s. %s", univentionDN, filter, ldap_err2string(rc));
+		goto out;
+	}
+
+	for (c = 0; c < sizeof(containers) / sizeof(containers[0]) && ret == NULL; c++) {
+		for (element = ldap_first_entry(lp->ld, result); element != NULL && ret == NULL; element = ldap_next_entry(lp->ld, element)) {
+			char *dn = ldap_get_dn(lp->ld, element);
+			if (dn != NULL && strncasecmp(dn, containers[c], strlen(containers[c])) == 0) {
+				struct berval **values = ldap_get_values_len(lp->ld, element, attr[0]);
+				int i, num = ldap_count_values_len(values);
+				if (num > 0 && (ret = univention_licenseStrings_malloc(num)) != NULL) {
+					for (i = 0; i < num; i++)
+						ret->line[i] = strndup(values[i]->bv_val, values[i]->bv_len);
+				}
+				ldap_value_free_len(values);
+			}
+			ldap_memfree(dn);
+		}
+	}
+out:
+	ldap_msgfree(result);
+	free(univentionDN);
+	return ret;
+}
+
+/******************************************************************************/
+/*!
+        @brief search all licenseObjects with a specific type in the searchPath ldap paths
+
+        The searches of all paths are sent at once and their answers are
+        collected afterwards, so the lookup takes a single round trip. The
+        licenses are returned in the order of the paths.
+
+        @param searchPath	the ldap paths where licenseObjects are searched
+        @param licensetyp	the requested license type (the ldap attribute univentionLicenseModule have this value)
+
+        @return a NULL terminated array of lObj, or NULL if an error has occurred.
+                free each lObj with univention_licenseObject_free() and the array with free().
+*/
+lObj **univention_license_ldap_search_licenseObjects(const lStrings *searchPath, const char *licensetyp) {
+	char *attr[] = {NULL};
+	AUTOPTR(char) filter = NULL;
+	AUTOPTR(int) msgids = NULL;
+	lObj **ret = NULL;
+	struct timeval timeout;
+	int i, num = 0;
+
+	if (!univention_license_ldap_open_connection())
+		return NULL;
+
+	// build searchfilter
+	filter = malloc(strlen("(&(objectClass=univentionLicense)(univentionLicenseModule=") + strlen(licensetyp) + strlen("))") + 1);
+	msgids = malloc(sizeof(int) * searchPath->num);
+	ret = calloc(1, sizeof(lObj *));
+	if (!filter || !msgids || !ret) {
+		free(ret);
+		return NULL;
+	}
+	sprintf(filter, "(&(objectClass=univentionLicense)(univentionLicenseModule=%s))", licensetyp);
+
+	timeout.tv_sec = 3;
+	timeout.tv_usec = 0;
+
+	for (i = 0; i < searchPath->num; i++) {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "LDAPSearch: searchBaseDN '%s', scope '%i' filter '%s' attr[0] '%s'", searchPath->line[i], LDAP_SCOPE_ONELEVEL, filter, attr[0]);
+		if (ldap_search_ext(lp->ld, searchPath->line[i], LDAP_SCOPE_ONELEVEL, filter, attr, 0, NULL, NULL, &timeout, 0, &msgids[i]) != LDAP_SUCCESS)
+			msgids[i] = -1;
+	}
+
+	for (i = 0; i < searchPath->num; i++) {
+		LDAPMessage *result = NULL;
+		LDAPMessage *element;
+		int rc, err = LDAP_OTHER;
+
+		if (msgids[i] < 0) {
+			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Not found:%s. Filter:%s.", searchPath->line[i], filter);
+			continue;
+		}
+		rc = ldap_result(lp->ld, msgids[i], LDAP_MSG_ALL, &timeout, &result);
+		if (rc > 0)
+			ldap_parse_result(lp->ld, result, &err, NULL, NULL, NULL, NULL, 0);
+		else
+			ldap_abandon_ext(lp->ld, msgids[i], NULL, NULL);
+		if (err != LDAP_SUCCESS) {
+			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Not found:%s. Filter:%s. %s", searchPath->line[i], filter, ldap_err2string(rc > 0 ? err : LDAP_TIMEOUT));
+			ldap_msgfree(result);
+			continue;
+		}
+
+		for (element = ldap_first_entry(lp->ld, result); element != NULL; element = ldap_next_entry(lp->ld, element)) {
+			lObj *license = license_ldap_entry(element, "univentionLicense");
+			lObj **tmp;
+			if (license == NULL)
+				continue;
+			tmp = realloc(ret, sizeof(lObj *) * (num + 2));
+			if (!tmp) {
+				univention_licenseObject_free(license);
+				break;
+			}
+			ret = tmp;
+			ret[num++] = license;
+			ret[num] = NULL;
+		}
+		ldap_msgfree(result);
+	}
+	return ret;
+}
 /*eof*/
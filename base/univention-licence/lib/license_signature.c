@@ -12,13 +12,15 @@
         @retval pointer to the data string if succeed
 */
 char *univention_license_build_data(lObj *license) {
-	int len = 0;
-	int pos = 0;
+	size_t len = 0;
+	size_t pos = 0;
 	int i;
 	char *data = NULL;
 
 	// sort entries
 	license = univention_license_sort(license);
+	if (!license)
+		goto err;
 
 	for (i = 0; i < license->size; i++) {
 		if (!(strcmp(license->key[i], "univentionLicenseSignature") == 0))
@@ -26,16 +28,16 @@ char *univention_license_build_data(lObj *license) {
 	}
 
 	if (len > 0) {
-		data = calloc(len + 1, sizeof(char));
+		data = malloc(len + 1);
 		if (!data)
 			goto err;
 
 		for (i = 0; i < license->size; i++) {
 			if (!(strcmp(license->key[i], "univentionLicenseSignature") == 0)) {
-				// debug
-				// printf("%i,%i:%s.\n",i,strlen(license[i]),license[i]);
-
-				pos += sprintf(&(data[pos]), "%s\n", license->val[i]);
+				size_t vlen = strlen(license->val[i]);
+				memcpy(&data[pos], license->val[i], vlen);
+				pos += vlen;
+				data[pos++] = '\n';
 			}
 		}
 		data[pos] = 0;
@@ -46,13 +48,55 @@ err:
 	return data;
 }
 
+/******************************************************************************/
+/*!
+        @brief	hash the data of a license, used for the verify mechanism
+
+        the values are fed into the hash in the order and format of
+        univention_license_build_data(), without building the data string.
+        @param	license	the license object where the data to build from
+        @param	hash	the buffer for the hash, SHA_DIGEST_LENGTH bytes
+        @retval 0 if the licenseObject is empty or an error has occurred
+        @retval 1 if succeed
+*/
+int univention_license_hash_data(lObj *license, unsigned char *hash) {
+	EVP_MD_CTX *ctx;
+	int count = 0;
+	int ok;
+	int i;
+
+	// sort entries
+	license = univention_license_sort(license);
+	if (!license)
+		return 0;
+
+	ctx = EVP_MD_CTX_new();
+	if (!ctx)
+		return 0;
+	ok = EVP_DigestInit_ex(ctx, EVP_sha1(), NULL);
+	for (i = 0; ok && i < license->size; i++) {
+		if (!(strcmp(license->key[i], "univentionLicenseSignature") == 0)) {
+			ok = EVP_DigestUpdate(ctx, license->val[i], strlen(license->val[i])) && EVP_DigestUpdate(ctx, "\n", 1);
+			count++;
+		}
+	}
+	ok = ok && EVP_DigestFinal_ex(ctx, hash, NULL);
+	EVP_MD_CTX_free(ctx);
+
+	if (count == 0) {
+		univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_WARN, "License is empty! Can't create data.");
+		return 0;
+	}
+	return ok;
+}
+
 /******************************************************************************/
 /*!
         @brief	check the siganture of the global_license
 
         the data to hash of this license will be generated, also the
         signature is taken from this license.
-        for the real signature check univention_license_verify() is called
+        for the real signature check univention_license_verify_hash() is called
 
         @retval	0 if license is not valid, or a error has occurred
         @retval 1 if license signature is valid
@@ -60,22 +104,22 @@ err:
 int univention_license_check_signature() {
 	lObj *global_license = univention_license_get_global_license();
 	if (global_license != NULL) {
-		char *data = univention_license_build_data(global_license);
+		unsigned char hash[SHA_DIGEST_LENGTH];
+		const char *sign = NULL;
 		int valid = 0;
+		int i;
 
-		if (data != NULL) {
-			lStrings *sign = univention_license_get_value("univentionLicenseSignature");
-			if (sign != NULL) {
-				valid = univention_license_verify(data, sign->line[0]);
-
-				univention_licenseStrings_free(sign);
-				sign = NULL;
-			} else {
-				univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "License-Signature: can't get signature!");
-			}
-			free(data);
-		} else {
+		for (i = 0; i < global_license->size && sign == NULL; i++) {
+			if (strcmp(global_license->key[i], "univentionLicenseSignature") == 0)
+				sign = global_license->val[i];
+		}
+
+		if (sign == NULL) {
+			univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "License-Signature: can't get signature!");
+		} else if (!univention_license_hash_data(global_license, hash)) {
 			univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_ERROR, "License-Signature: can't get data!");
+		} else {
+			valid = univention_license_verify_hash(hash, sign);
 		}
 
 		if (valid)
@@ -120,9 +164,8 @@ char *univention_license_sign_license(const char *licenseDN) {
         @retval len	the amount of chars in returned rawdata
 */
 unsigned int univention_license_base64_to_raw(const char *base64data, unsigned char **rawdata) {
-	unsigned int rawlen, ret = 0;
-	char *temp = NULL;
-	int templen;
+	unsigned int ret = 0;
+	int rawlen;
 	AUTOPTR(BIO) b64 = NULL;
 	AUTOPTR(BIO) mem = NULL;
 
@@ -138,30 +181,21 @@ unsigned int univention_license_base64_to_raw(const char *base64data, unsigned c
 
 	b64 = BIO_push(b64, mem);  // connect b64 with mem, so b64 will read from mem
 
-	// create temp memory
-	templen = strlen(base64data);
-	temp = malloc((templen + 1) * sizeof(char));
-	if (!temp)
-		goto out;
-
-	// convert from base64
-	rawlen = BIO_read(b64, (void *)temp, templen);
-
-	// allocate signature data buffer
+	// allocate signature data buffer, the raw data is always shorter than its base64 encoding
 	if (*rawdata != NULL) {
 		univention_debug(UV_DEBUG_LICENSE, UV_DEBUG_WARN, "RawData is not NULL! I free it.");
 		free(*rawdata);
 	}
-	*rawdata = malloc(rawlen * sizeof(char));
+	*rawdata = malloc(strlen(base64data) + 1);
 	if (!*rawdata)
 		goto out;
 
-	// copy data to return string
-	memcpy(*rawdata, temp, rawlen * sizeof(char));
-	ret = rawlen;
+	// convert from base64
+	rawlen = BIO_read(b64, (void *)*rawdata, strlen(base64data));
+	if (rawlen > 0)
+		ret = rawlen;
 
 out:
-	free(temp);
 	return ret;
 }
 
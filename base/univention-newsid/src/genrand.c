@@ -21,225 +21,80 @@
 */
 
 #include "includes.h"
+#include <errno.h>
+#include <sys/random.h>
 
-static unsigned char hash[258];
-static uint32 counter;
-static unsigned char *reseed_data;
-static size_t reseed_data_size;
+/* Small requests are served from a buffer filled by one getrandom() call */
+static unsigned char pool[256];
+static size_t pool_avail;
+static pid_t pool_pid;
 
 /****************************************************************
- Copy any user given reseed data.
+ Fill buf with len bytes from the kernel, falling back to
+ /dev/urandom on kernels without getrandom().
 *****************************************************************/
 
-void set_rand_reseed_data(unsigned char *data, size_t len)
+static void read_random(unsigned char *buf, size_t len)
 {
-	SAFE_FREE(reseed_data);
-	reseed_data_size = 0;
-
-	reseed_data = (unsigned char *)memdup(data, len);
-	if (reseed_data)
-		reseed_data_size = len;
-}
-
-/****************************************************************
- Setup the seed.
-*****************************************************************/
-
-static void seed_random_stream(unsigned char *seedval, size_t seedlen)
-{
-	unsigned char j = 0;
-	size_t ind;
-
-	for (ind = 0; ind < 256; ind++)
-		hash[ind] = (unsigned char)ind;
-
-	for( ind = 0; ind < 256; ind++) {
-		unsigned char tc;
-
-		j += (hash[ind] + seedval[ind%seedlen]);
-
-		tc = hash[ind];
-		hash[ind] = hash[j];
-		hash[j] = tc;
+	while (len > 0) {
+		ssize_t n = getrandom(buf, len, 0);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0 && errno == ENOSYS) {
+			int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC, 0);
+			if (fd == -1)
+				break;
+			while (len > 0 && (n = read(fd, buf, len)) > 0) {
+				buf += n;
+				len -= n;
+			}
+			close(fd);
+			break;
+		}
+		if (n <= 0)
+			break;
+		buf += n;
+		len -= n;
 	}
 
-	hash[256] = 0;
-	hash[257] = 0;
-}
-
-/****************************************************************
- Get datasize bytes worth of random data.
-*****************************************************************/
-
-static void get_random_stream(unsigned char *data, size_t datasize)
-{
-	unsigned char index_i = hash[256];
-	unsigned char index_j = hash[257];
-	size_t ind;
-
-	for( ind = 0; ind < datasize; ind++) {
-		unsigned char tc;
-		unsigned char t;
-
-		index_i++;
-		index_j += hash[index_i];
-
-		tc = hash[index_i];
-		hash[index_i] = hash[index_j];
-		hash[index_j] = tc;
-
-		t = hash[index_i] + hash[index_j];
-		data[ind] = hash[t];
+	if (len > 0) {
+		fprintf ( stderr, "reading random data failed.\n" );
+		exit (1);
 	}
-
-	hash[256] = index_i;
-	hash[257] = index_j;
-}
-
-/****************************************************************
- Get a 16 byte hash from the contents of a file.
- Note that the hash is not initialised.
-*****************************************************************/
-
-static void do_filehash(const char *fname, unsigned char *the_hash)
-{
-	unsigned char buf[1011]; /* deliberate weird size */
-	unsigned char tmp_md4[16];
-	int fd, n;
-
-	fd = open(fname,O_RDONLY,0);
-	if (fd == -1)
-		return;
-
-	while ((n = read(fd, (char *)buf, sizeof(buf))) > 0) {
-		mdfour(tmp_md4, buf, n);
-		for (n=0;n<16;n++)
-			the_hash[n] ^= tmp_md4[n];
-	}
-	close(fd);
-}
-
-/**************************************************************
- Try and get a good random number seed. Try a number of
- different factors. Firstly, try /dev/urandom - use if exists.
-
- We use /dev/urandom as a read of /dev/random can block if
- the entropy pool dries up. This leads clients to timeout
- or be very slow on connect.
-
- If we can't use /dev/urandom then seed the stream random generator
- above...
-**************************************************************/
-
-static int do_reseed(BOOL use_fd, int fd)
-{
-	unsigned char seed_inbuf[40];
-	uint32 v1, v2; struct timeval tval; pid_t mypid;
-	struct passwd *pw;
-
-	if (use_fd) {
-		if (fd != -1)
-			return fd;
-
-		fd = open( "/dev/urandom", O_RDONLY,0);
-		if(fd >= 0)
-			return fd;
-	}
-
-	/* Add in some secret file contents */
-
-	do_filehash("/etc/shadow", &seed_inbuf[0]);
-	do_filehash("/etc/gshadow", &seed_inbuf[16]);
-
-	/*
-	 * Add in the root encrypted password.
-	 * On any system where security is taken
-	 * seriously this will be secret.
-	 */
-
-	pw = getpwnam_alloc("root");
-	if (pw && pw->pw_passwd) {
-		size_t i;
-		unsigned char md4_tmp[16];
-		mdfour(md4_tmp, (unsigned char *)pw->pw_passwd, strlen(pw->pw_passwd));
-		for (i=0;i<16;i++)
-			seed_inbuf[8+i] ^= md4_tmp[i];
-		passwd_free(&pw);
-	}
-
-	/*
-	 * Add the counter, time of day, and pid.
-	 */
-
-	gettimeofday(&tval,NULL);
-	mypid = getpid();
-	v1 = (counter++) + mypid + tval.tv_sec;
-	v2 = (counter++) * mypid + tval.tv_usec;
-
-	SIVAL(seed_inbuf, 32, v1 ^ IVAL(seed_inbuf, 32));
-	SIVAL(seed_inbuf, 36, v2 ^ IVAL(seed_inbuf, 36));
-
-	/*
-	 * Add any user-given reseed data.
-	 */
-
-	if (reseed_data) {
-		size_t i;
-		for (i = 0; i < sizeof(seed_inbuf); i++)
-			seed_inbuf[i] ^= reseed_data[i % reseed_data_size];
-	}
-
-	seed_random_stream(seed_inbuf, sizeof(seed_inbuf));
-
-	return -1;
 }
 
 /*******************************************************************
- Interface to the (hopefully) good crypto random number generator.
+ Interface to the kernel random number generator. do_reseed_now
+ discards anything left over in the pool.
 ********************************************************************/
 
 void generate_random_buffer( unsigned char *out, int len, BOOL do_reseed_now)
 {
-	static BOOL done_reseed = False;
-	static int urand_fd = -1;
-	unsigned char md4_buf[64];
-	unsigned char tmp_buf[16];
-	unsigned char *p;
-
-	if(!done_reseed || do_reseed_now) {
-		urand_fd = do_reseed(True, urand_fd);
-		done_reseed = True;
+	/* a forked child must not hand out the same bytes as its parent */
+	if (do_reseed_now || pool_pid != getpid()) {
+		memset(pool, 0, sizeof(pool));
+		pool_avail = 0;
+		pool_pid = getpid();
 	}
 
-	if (urand_fd != -1 && len > 0) {
-
-		if (read(urand_fd, out, len) == len)
-			return; /* len bytes of random data read from urandom. */
+	if (len <= 0)
+		return;
 
-		/* Read of urand error, drop back to non urand method. */
-		close(urand_fd);
-		urand_fd = -1;
-		do_reseed(False, -1);
-		done_reseed = True;
+	if ((size_t)len > sizeof(pool) / 2) {
+		read_random(out, len);
+		return;
 	}
 
-	/*
-	 * Generate random numbers in chunks of 64 bytes,
-	 * then md4 them & copy to the output buffer.
-	 * This way the raw state of the stream is never externally
-	 * seen.
-	 */
-
-	p = out;
-	while(len > 0) {
-		int copy_len = len > 16 ? 16 : len;
-
-		get_random_stream(md4_buf, sizeof(md4_buf));
-		mdfour(tmp_buf, md4_buf, sizeof(md4_buf));
-		memcpy(p, tmp_buf, copy_len);
-		p += copy_len;
-		len -= copy_len;
+	if (pool_avail < (size_t)len) {
+		read_random(pool, sizeof(pool));
+		pool_avail = sizeof(pool);
 	}
+
+	/* take from the end and wipe what has been handed out */
+	pool_avail -= len;
+	memcpy(out, pool + pool_avail, len);
+	memset(pool + pool_avail, 0, len);
 }
 
 /*******************************************************************
@@ -51,6 +51,7 @@ void *memdup(const void *p, size_t size);
 
 /* from md4.c */
 void mdfour(unsigned char *out, const unsigned char *in, int n);
+void mdfour_many(unsigned char *out, const unsigned char *const in[], const int n[], int count);
 
 /* from util_pw.c */
 struct passwd *getpwnam_alloc(const char *name);
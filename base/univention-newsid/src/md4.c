@@ -20,7 +20,9 @@
 
 #include "includes.h"
 
-/* NOTE: This code makes no attempt to be fast!
+/* NOTE: mdfour() makes no attempt to be fast! Use mdfour_many() for
+   hashing many messages, it runs 4 or 8 of them side by side in vector
+   registers.
 
    It assumes that a int is at least 32 bits long
 */
@@ -167,3 +169,80 @@ void mdfour(unsigned char *out, const unsigned char *in, int n)
 }
 
 
+
+/* number of 64 byte blocks of a padded message of n bytes */
+static int md4_blocks(int n)
+{
+	return (n + 8) / 64 + 1;
+}
+
+/* block j of the padded message as words 0..15 of column lane of W */
+static void md4_load_block(uint32 *W, int lanes, int lane, const unsigned char *in, int n, int j)
+{
+	unsigned char buf[64];
+	const unsigned char *p = in + j * 64;
+	int off = j * 64;
+	int k;
+
+	if (off + 64 > n) {
+		memset(buf, 0, sizeof(buf));
+		if (off < n)
+			memcpy(buf, in + off, n - off);
+		if (off <= n)
+			buf[n - off] = 0x80;
+		if (j == md4_blocks(n) - 1)
+			copy4(buf+56, n * 8);
+		p = buf;
+	}
+	for (k = 0; k < 16; k++)
+		W[k * lanes + lane] = IVAL(p, k * 4);
+	memset(buf, 0, sizeof(buf));
+}
+
+#define VF(X,Y,Z) (((X)&(Y)) | ((~(X))&(Z)))
+#define VG(X,Y,Z) (((X)&(Y)) | ((X)&(Z)) | ((Y)&(Z)))
+#define VH(X,Y,Z) ((X)^(Y)^(Z))
+#define VLSHIFT(x,s) (((x)<<(s)) | ((x)>>(32-(s))))
+#define VROUND1(a,b,c,d,k,s) a = a + VF(b,c,d) + X[k], a = VLSHIFT(a, s)
+#define VROUND2(a,b,c,d,k,s) a = a + VG(b,c,d) + X[k] + (uint32)0x5A827999, a = VLSHIFT(a, s)
+#define VROUND3(a,b,c,d,k,s) a = a + VH(b,c,d) + X[k] + (uint32)0x6ED9EBA1, a = VLSHIFT(a, s)
+
+typedef uint32 md4_x4 __attribute__((vector_size(16)));
+#define MD4_VEC md4_x4
+#define MD4_LANES 4
+#define MD4_FUNC mdfour_x4
+#define MD4_TARGET
+#include "md4_lanes.h"
+#undef MD4_VEC
+#undef MD4_LANES
+#undef MD4_FUNC
+#undef MD4_TARGET
+
+#if defined(__GNUC__) && defined(__x86_64__)
+typedef uint32 md4_x8 __attribute__((vector_size(32)));
+#define MD4_VEC md4_x8
+#define MD4_LANES 8
+#define MD4_FUNC mdfour_x8
+#define MD4_TARGET __attribute__((target("avx2")))
+#include "md4_lanes.h"
+#undef MD4_VEC
+#undef MD4_LANES
+#undef MD4_FUNC
+#undef MD4_TARGET
+#endif
+
+/* produce the md4 message digests of count messages, in[i] being n[i] bytes
+   long, into out, which has room for 16 * count bytes */
+void mdfour_many(unsigned char *out, const unsigned char *const in[], const int n[], int count)
+{
+	int i = 0;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+	if (__builtin_cpu_supports("avx2")) {
+		for (; count - i >= 8; i += 8)
+			mdfour_x8(out + 16 * i, in + i, n + i, 8);
+	}
+#endif
+	for (; i < count; i += 4)
+		mdfour_x4(out + 16 * i, in + i, n + i, count - i < 4 ? count - i : 4);
+}
@@ -0,0 +1,101 @@
+/*
+   Unix SMB/CIFS implementation.
+   multi-buffer variant of the MD4 rounds in md4.c
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+/* Included by md4.c once per vector width. Expects MD4_VEC (a GCC vector of
+   MD4_LANES uint32), MD4_LANES, MD4_FUNC and MD4_TARGET to be defined.
+   Each lane hashes one message, lanes whose message is already complete keep
+   their state while the longer ones go on. */
+
+MD4_TARGET static void MD4_FUNC(unsigned char *out, const unsigned char *const in[], const int n[], int count)
+{
+	MD4_VEC A, B, C, D, AA, BB, CC, DD, X[16], active;
+	uint32 W[16][MD4_LANES], mask[MD4_LANES];
+	int nblocks[MD4_LANES];
+	int i, j, k, max = 0;
+
+	for (i = 0; i < MD4_LANES; i++) {
+		nblocks[i] = i < count ? md4_blocks(n[i]) : 0;
+		if (nblocks[i] > max)
+			max = nblocks[i];
+	}
+
+	A = (MD4_VEC){0} + 0x67452301;
+	B = (MD4_VEC){0} + 0xefcdab89;
+	C = (MD4_VEC){0} + 0x98badcfe;
+	D = (MD4_VEC){0} + 0x10325476;
+
+	for (j = 0; j < max; j++) {
+		for (i = 0; i < MD4_LANES; i++) {
+			if (j < nblocks[i]) {
+				md4_load_block(&W[0][0], MD4_LANES, i, in[i], n[i], j);
+				mask[i] = 0xFFFFFFFF;
+			} else {
+				for (k = 0; k < 16; k++)
+					W[k][i] = 0;
+				mask[i] = 0;
+			}
+		}
+		memcpy(X, W, sizeof(X));
+		memcpy(&active, mask, sizeof(active));
+
+		AA = A; BB = B; CC = C; DD = D;
+
+		VROUND1(A,B,C,D,  0,  3);  VROUND1(D,A,B,C,  1,  7);
+		VROUND1(C,D,A,B,  2, 11);  VROUND1(B,C,D,A,  3, 19);
+		VROUND1(A,B,C,D,  4,  3);  VROUND1(D,A,B,C,  5,  7);
+		VROUND1(C,D,A,B,  6, 11);  VROUND1(B,C,D,A,  7, 19);
+		VROUND1(A,B,C,D,  8,  3);  VROUND1(D,A,B,C,  9,  7);
+		VROUND1(C,D,A,B, 10, 11);  VROUND1(B,C,D,A, 11, 19);
+		VROUND1(A,B,C,D, 12,  3);  VROUND1(D,A,B,C, 13,  7);
+		VROUND1(C,D,A,B, 14, 11);  VROUND1(B,C,D,A, 15, 19);
+
+		VROUND2(A,B,C,D,  0,  3);  VROUND2(D,A,B,C,  4,  5);
+		VROUND2(C,D,A,B,  8,  9);  VROUND2(B,C,D,A, 12, 13);
+		VROUND2(A,B,C,D,  1,  3);  VROUND2(D,A,B,C,  5,  5);
+		VROUND2(C,D,A,B,  9,  9);  VROUND2(B,C,D,A, 13, 13);
+		VROUND2(A,B,C,D,  2,  3);  VROUND2(D,A,B,C,  6,  5);
+		VROUND2(C,D,A,B, 10,  9);  VROUND2(B,C,D,A, 14, 13);
+		VROUND2(A,B,C,D,  3,  3);  VROUND2(D,A,B,C,  7,  5);
+		VROUND2(C,D,A,B, 11,  9);  VROUND2(B,C,D,A, 15, 13);
+
+		VROUND3(A,B,C,D,  0,  3);  VROUND3(D,A,B,C,  8,  9);
+		VROUND3(C,D,A,B,  4, 11);  VROUND3(B,C,D,A, 12, 15);
+		VROUND3(A,B,C,D,  2,  3);  VROUND3(D,A,B,C, 10,  9);
+		VROUND3(C,D,A,B,  6, 11);  VROUND3(B,C,D,A, 14, 15);
+		VROUND3(A,B,C,D,  1,  3);  VROUND3(D,A,B,C,  9,  9);
+		VROUND3(C,D,A,B,  5, 11);  VROUND3(B,C,D,A, 13, 15);
+		VROUND3(A,B,C,D,  3,  3);  VROUND3(D,A,B,C, 11,  9);
+		VROUND3(C,D,A,B,  7, 11);  VROUND3(B,C,D,A, 15, 15);
+
+		A = ((A + AA) & active) | (AA & ~active);
+		B = ((B + BB) & active) | (BB & ~active);
+		C = ((C + CC) & active) | (CC & ~active);
+		D = ((D + DD) & active) | (DD & ~active);
+	}
+
+	for (i = 0; i < count; i++) {
+		copy4(out + 16 * i, A[i]);
+		copy4(out + 16 * i + 4, B[i]);
+		copy4(out + 16 * i + 8, C[i]);
+		copy4(out + 16 * i + 12, D[i]);
+	}
+
+	memset(W, 0, sizeof(W));
+	memset(X, 0, sizeof(X));
+}
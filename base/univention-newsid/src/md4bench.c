@@ -0,0 +1,92 @@
+/*
+   benchmark of mdfour() against mdfour_many() on NT hashes
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+*/
+
+#include "includes.h"
+
+#define COUNT 100000
+#define BATCH 64
+
+static double now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* NT hash input: the password as UTF-16LE */
+static int utf16(unsigned char *out, const char *pw)
+{
+	int i;
+	for (i = 0; pw[i]; i++) {
+		out[2 * i] = pw[i];
+		out[2 * i + 1] = 0;
+	}
+	return 2 * i;
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned char expected[16] = {0x88, 0x46, 0xf7, 0xea, 0xee, 0x8f, 0xb1, 0x17, 0xad, 0x06, 0xbd, 0xd8, 0x30, 0xb7, 0x58, 0x6c};
+	int count = argc > 1 ? atoi(argv[1]) : COUNT;
+	unsigned char (*msgs)[256] = smb_xmalloc(count * sizeof(*msgs));
+	unsigned char *scalar = smb_xmalloc(16 * count), *many = smb_xmalloc(16 * count);
+	const unsigned char **in = smb_xmalloc(count * sizeof(*in));
+	int *n = smb_xmalloc(count * sizeof(*n));
+	unsigned char digest[16];
+	double t0, t1, t2;
+	char pw[128];
+	int i;
+
+	for (i = 0; i < count; i++) {
+		/* generated passwords of 8 to 40 characters, some spanning two blocks */
+		snprintf(pw, sizeof(pw), "Univention-%d-%.*s", i, i % 23, "abcdefghijklmnopqrstuvw");
+		n[i] = utf16(msgs[i], pw);
+		in[i] = msgs[i];
+	}
+
+	n[0] = utf16(msgs[0], "password");
+	mdfour_many(digest, in, n, 1);
+	if (memcmp(digest, expected, 16)) {
+		fprintf(stderr, "NT hash of \"password\" is wrong\n");
+		return 1;
+	}
+
+	t0 = now();
+	for (i = 0; i < count; i++)
+		mdfour(scalar + 16 * i, in[i], n[i]);
+	t1 = now();
+	for (i = 0; i < count; i += BATCH)
+		mdfour_many(many + 16 * i, in + i, n + i, count - i < BATCH ? count - i : BATCH);
+	t2 = now();
+
+	if (memcmp(scalar, many, 16 * count)) {
+		fprintf(stderr, "mdfour_many() differs from mdfour()\n");
+		return 1;
+	}
+
+	printf("%d NT hashes\n", count);
+	printf("mdfour:      %8.1f ms\n", (t1 - t0) * 1e3);
+	printf("mdfour_many: %8.1f ms (%.1fx)\n", (t2 - t1) * 1e3, (t1 - t0) / (t2 - t1));
+
+	SAFE_FREE(msgs);
+	SAFE_FREE(scalar);
+	SAFE_FREE(many);
+	SAFE_FREE(in);
+	SAFE_FREE(n);
+	return 0;
+}
@@ -58,6 +58,8 @@ typedef struct univention_ldap_parameters_s {
 univention_ldap_parameters_t* univention_ldap_new(void);
 int univention_ldap_open(univention_ldap_parameters_t *lp);
 void univention_ldap_close(univention_ldap_parameters_t *lp);
+void univention_ldap_release(univention_ldap_parameters_t *lp);
+void univention_ldap_pool_clear(void);
 int univention_ldap_set_admin_connection( univention_ldap_parameters_t *lp );
 
 #endif
@@ -36,6 +36,7 @@
 #ifndef __UNIVENTION_POLICY_H__
 #define __UNIVENTION_POLICY_H__
 
+#include <stddef.h>
 #include <ldap.h>
 
 typedef struct univention_policy_result_s {
@@ -47,7 +48,29 @@ typedef struct univention_policy_result_s {
 typedef struct univention_policy_handle_s univention_policy_handle_t;
 
 univention_policy_handle_t* univention_policy_open(LDAP *ld, const char *base, const char *dn);
+/* Open handles[i] for dns[i], returns the number opened; failed ones are NULL. */
+size_t univention_policy_open_many(LDAP *ld, const char *base, const char *const dns[], univention_policy_handle_t *handles[], size_t count);
 univention_policy_result_t* univention_policy_get(univention_policy_handle_t *handle, const char *policy_name, const char *attribute_name);
 void univention_policy_close(univention_policy_handle_t* handle);
 
+/* Cache policy objects process-wide, checking the contextCSN of base every ttl seconds; 0 disables. */
+void univention_policy_cache_set_ttl(unsigned int ttl);
+void univention_policy_cache_clear(void);
+
+/* Serialize the policies of a handle, to be freed by the caller, and create a handle from them again. */
+char *univention_policy_dump(univention_policy_handle_t *handle, size_t *size);
+univention_policy_handle_t *univention_policy_load(const char *data, size_t size);
+
+/*
+ * The index of the policies of each object maintained by the listener, where
+ * univention_policy_open() looks first. Its key is the DN as returned by
+ * univention_policy_index_key(), its value as returned by univention_policy_dump().
+ * The key UNIVENTION_POLICY_INDEX_BASE holds the base the policies were read from.
+ */
+#define UNIVENTION_POLICY_INDEX "/var/lib/univention-directory-listener/policy"
+#define UNIVENTION_POLICY_INDEX_BASE "@base"
+/* Use the index at path, or none if NULL; the default is UNIVENTION_POLICY_INDEX if it exists. */
+void univention_policy_index_set(const char *path);
+char *univention_policy_index_key(const char *dn);
+
 #endif
@@ -0,0 +1,268 @@
+/*
+ * Univention Policy
+ *  C source of the univention policy library
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2003-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdbool.h>
+
+#include "internal.h"
+
+/*
+ * Attributes fetched with the object to evaluate ldapFilter locally. Other
+ * attributes are left to the LDAP server, as their matching rules are unknown.
+ * objectClass is compared literally like requiredObjectClasses.
+ */
+char *univention_policy_filter_attributes[POLICY_FILTER_ATTRIBUTES + 1] = {
+	"objectClass",
+	"univentionObjectType",
+	"univentionServerRole",
+	"univentionService",
+	NULL
+};
+
+/* caseIgnoreMatch or caseExactMatch of univention_policy_filter_attributes */
+static const bool nocase[POLICY_FILTER_ATTRIBUTES] = {
+	true,
+	false,
+	false,
+	false,
+};
+
+static struct univention_policy_filter_s *filter_parse(const char **s);
+
+static struct univention_policy_filter_s *filter_new(enum univention_policy_filter_type type)
+{
+	struct univention_policy_filter_s *f;
+	if ((f = calloc(1, sizeof(struct univention_policy_filter_s))) == NULL)
+		return NULL;
+	f->type = type;
+	f->index = -1;
+	return f;
+}
+
+/* Parse filter list up to the closing parenthesis. */
+static struct univention_policy_filter_s *filter_parse_list(const char **s, enum univention_policy_filter_type type)
+{
+	struct univention_policy_filter_s *f, **tail;
+
+	if ((f = filter_new(type)) == NULL)
+		return NULL;
+	tail = &f->children;
+	while (**s == '(') {
+		if ((*tail = filter_parse(s)) == NULL) {
+			univention_policy_filter_free(f);
+			return NULL;
+		}
+		tail = &(*tail)->next;
+		if (type == POLICY_FILTER_NOT)
+			break;
+	}
+	if (f->children == NULL) {
+		/* absolute true and false filters are left to the server */
+		univention_policy_filter_free(f);
+		return NULL;
+	}
+	return f;
+}
+
+/* Parse simple item "attr=value" or "attr=*", other items are kept as POLICY_FILTER_OTHER. */
+static struct univention_policy_filter_s *filter_parse_item(const char **s)
+{
+	struct univention_policy_filter_s *f;
+	const char *attr = *s, *c;
+	char *value;
+	size_t len;
+	int i;
+
+	while (**s && !strchr("=~<>:()*\\", **s))
+		(*s)++;
+	if (*s == attr || **s == '\0' || **s == '(' || **s == ')')
+		return NULL;
+	len = *s - attr;
+
+	if (strncmp(*s, "=", 1) != 0 || (*s)[1] == '\0') {
+		/* approximate, ordering and extensible matches */
+		f = filter_new(POLICY_FILTER_OTHER);
+	} else if ((*s)[1] == '*' && (*s)[2] == ')') {
+		f = filter_new(POLICY_FILTER_PRESENT);
+	} else {
+		f = filter_new(POLICY_FILTER_EQUALITY);
+	}
+	if (f == NULL)
+		return NULL;
+
+	for (i = 0; i < POLICY_FILTER_ATTRIBUTES; i++) {
+		if (strlen(univention_policy_filter_attributes[i]) == len && !strncasecmp(univention_policy_filter_attributes[i], attr, len))
+			f->index = i;
+	}
+
+	/* unescape value */
+	if ((f->value = value = malloc(strlen(*s) + 1)) == NULL) {
+		univention_policy_filter_free(f);
+		return NULL;
+	}
+	for (c = *s + 1; *c && *c != ')'; c++) {
+		if (f->type == POLICY_FILTER_EQUALITY && *c == '*') {
+			/* substrings */
+			f->type = POLICY_FILTER_OTHER;
+		} else if (*c == '\\') {
+			unsigned int byte;
+			if (sscanf(c + 1, "%2x", &byte) != 1 || !c[1] || !c[2]) {
+				univention_policy_filter_free(f);
+				return NULL;
+			}
+			*value++ = byte;
+			c += 2;
+		} else {
+			*value++ = *c;
+		}
+	}
+	*value = '\0';
+	*s = c;
+	return f;
+}
+
+/* Parse "(...)" at *s. */
+static struct univention_policy_filter_s *filter_parse(const char **s)
+{
+	struct univention_policy_filter_s *f;
+
+	if (**s != '(')
+		return NULL;
+	(*s)++;
+	switch (**s) {
+	case '&':
+		(*s)++;
+		f = filter_parse_list(s, POLICY_FILTER_AND);
+		break;
+	case '|':
+		(*s)++;
+		f = filter_parse_list(s, POLICY_FILTER_OR);
+		break;
+	case '!':
+		(*s)++;
+		f = filter_parse_list(s, POLICY_FILTER_NOT);
+		break;
+	default:
+		f = filter_parse_item(s);
+		break;
+	}
+	if (f == NULL)
+		return NULL;
+	if (**s != ')') {
+		univention_policy_filter_free(f);
+		return NULL;
+	}
+	(*s)++;
+	return f;
+}
+
+struct univention_policy_filter_s *univention_policy_filter_compile(const char *filter)
+{
+	struct univention_policy_filter_s *f;
+	const char *s = filter;
+
+	if ((f = filter_parse(&s)) != NULL && *s != '\0') {
+		univention_policy_filter_free(f);
+		f = NULL;
+	}
+	return f;
+}
+
+void univention_policy_filter_free(struct univention_policy_filter_s *f)
+{
+	while (f != NULL) {
+		struct univention_policy_filter_s *next = f->next;
+		univention_policy_filter_free(f->children);
+		FREE(f->value);
+		FREE(f);
+		f = next;
+	}
+}
+
+int univention_policy_filter_match(const struct univention_policy_filter_s *f, char **const values[POLICY_FILTER_ATTRIBUTES])
+{
+	const struct univention_policy_filter_s *child;
+	int result, i;
+
+	switch (f->type) {
+	case POLICY_FILTER_AND:
+		result = 1;
+		for (child = f->children; child != NULL && result != 0; child = child->next) {
+			switch (univention_policy_filter_match(child, values)) {
+			case 0:
+				result = 0;
+				break;
+			case -1:
+				result = -1;
+				break;
+			}
+		}
+		return result;
+	case POLICY_FILTER_OR:
+		result = 0;
+		for (child = f->children; child != NULL && result != 1; child = child->next) {
+			switch (univention_policy_filter_match(child, values)) {
+			case 1:
+				result = 1;
+				break;
+			case -1:
+				result = -1;
+				break;
+			}
+		}
+		return result;
+	case POLICY_FILTER_NOT:
+		result = univention_policy_filter_match(f->children, values);
+		return result == -1 ? -1 : !result;
+	case POLICY_FILTER_PRESENT:
+		if (f->index < 0)
+			return -1;
+		return values[f->index] != NULL && values[f->index][0] != NULL;
+	case POLICY_FILTER_EQUALITY:
+		if (f->index < 0)
+			return -1;
+		for (i = 0; values[f->index] != NULL && values[f->index][i] != NULL; i++) {
+			if ((nocase[f->index] ? strcasecmp : strcmp)(values[f->index][i], f->value) == 0)
+				return 1;
+		}
+		return 0;
+	case POLICY_FILTER_OTHER:
+	default:
+		return -1;
+	}
+}
@@ -0,0 +1,163 @@
+/*
+ * Univention Policy
+ *  C source of the univention policy library
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <lmdb.h>
+
+#include <univention/debug.h>
+
+#include "internal.h"
+
+/* Read-only view of the index of the listener, opened on first use. */
+static struct {
+	bool configured;
+	char *path;
+	MDB_env *env;
+	MDB_dbi dbi;
+} policy_index;
+
+/*
+ * returns the key of dn in the index: only ASCII letters are folded, so other
+ * spellings are simply not found
+ */
+char *univention_policy_index_key(const char *dn)
+{
+	char *key, *c;
+
+	if ((key = strdup(dn)) == NULL)
+		return NULL;
+	for (c = key; *c; c++)
+		*c = tolower((unsigned char)*c);
+	return key;
+}
+
+static void policy_index_close(void)
+{
+	if (policy_index.env != NULL)
+		mdb_env_close(policy_index.env);
+	policy_index.env = NULL;
+	FREE(policy_index.path);
+}
+
+/*
+ * uses the index at path, or none if NULL
+ */
+void univention_policy_index_set(const char *path)
+{
+	policy_index_close();
+	policy_index.configured = true;
+	if (path != NULL)
+		policy_index.path = strdup(path);
+}
+
+static bool policy_index_open(void)
+{
+	MDB_txn *txn;
+	int rv;
+
+	if (!policy_index.configured) {
+		char file[PATH_MAX];
+
+		snprintf(file, sizeof(file), "%s/data.mdb", UNIVENTION_POLICY_INDEX);
+		univention_policy_index_set(access(file, R_OK) == 0 ? UNIVENTION_POLICY_INDEX : NULL);
+	}
+	if (policy_index.path == NULL)
+		return false;
+	if (policy_index.env != NULL)
+		return true;
+
+	if ((rv = mdb_env_create(&policy_index.env)) != MDB_SUCCESS)
+		goto error;
+	/* MDB_NOTLS: the handles of several threads share the environment */
+	if ((rv = mdb_env_open(policy_index.env, policy_index.path, MDB_RDONLY | MDB_NOTLS, 0600)) != MDB_SUCCESS)
+		goto error;
+	if ((rv = mdb_txn_begin(policy_index.env, NULL, MDB_RDONLY, &txn)) != MDB_SUCCESS)
+		goto error;
+	rv = mdb_dbi_open(txn, NULL, 0, &policy_index.dbi);
+	mdb_txn_abort(txn);
+	if (rv != MDB_SUCCESS)
+		goto error;
+	return true;
+
+error:
+	univention_debug(UV_DEBUG_POLICY, UV_DEBUG_WARN, "policy index %s: %s", policy_index.path, mdb_strerror(rv));
+	policy_index_close();
+	return false;
+}
+
+/* Look up key, true if it exists with the value str. */
+static bool policy_index_equals(MDB_txn *txn, const char *key, const char *str)
+{
+	MDB_val k = {.mv_size = strlen(key), .mv_data = (void *)key}, v;
+
+	return mdb_get(txn, policy_index.dbi, &k, &v) == MDB_SUCCESS && v.mv_size == strlen(str) && memcmp(v.mv_data, str, v.mv_size) == 0;
+}
+
+univention_policy_handle_t *univention_policy_index_get(const char *base, const char *dn)
+{
+	univention_policy_handle_t *handle = NULL;
+	char *dn_key = NULL, *base_key = NULL;
+	MDB_txn *txn;
+	MDB_val key, data;
+	int rv;
+
+	if (!policy_index_open())
+		return NULL;
+	if ((rv = mdb_txn_begin(policy_index.env, NULL, MDB_RDONLY, &txn)) != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_WARN, "policy index: %s", mdb_strerror(rv));
+		return NULL;
+	}
+	dn_key = univention_policy_index_key(dn);
+	base_key = univention_policy_index_key(base);
+	/* the policies depend on the base they are read from */
+	if (dn_key != NULL && base_key != NULL && policy_index_equals(txn, UNIVENTION_POLICY_INDEX_BASE, base_key)) {
+		key.mv_size = strlen(dn_key);
+		key.mv_data = dn_key;
+		if (mdb_get(txn, policy_index.dbi, &key, &data) == MDB_SUCCESS) {
+			univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "indexed: %s", dn);
+			handle = univention_policy_load(data.mv_data, data.mv_size);
+		}
+	}
+	mdb_txn_abort(txn);
+	FREE(dn_key);
+	FREE(base_key);
+	return handle;
+}
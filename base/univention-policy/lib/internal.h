@@ -18,9 +18,13 @@
 		}	\
 	} while (0)
 
+#define POLICY_HASH_BUCKETS 64
+#define POLICY_MAX_DEPTH 32
+
 struct univention_policy_attribute_list_s;
 struct univention_policy_attribute_list_s {
 	struct univention_policy_attribute_list_s* next;
+	struct univention_policy_attribute_list_s* hash_next;
 	char* name;
 	univention_policy_result_t* values;
 };
@@ -28,10 +32,80 @@ struct univention_policy_attribute_list_s {
 struct univention_policy_list_s;
 struct univention_policy_list_s {
 	struct univention_policy_list_s* next;
+	struct univention_policy_list_s* hash_next;
 	char* name;
 	struct univention_policy_attribute_list_s* attributes;
+	struct univention_policy_attribute_list_s* index[POLICY_HASH_BUCKETS];
 };
 
 struct univention_policy_handle_s {
 	struct univention_policy_list_s* policies;
+	struct univention_policy_list_s* index[POLICY_HASH_BUCKETS];
+};
+
+/* Hash set of attribute names, compared case-insensitively. */
+struct univention_policy_name_set_s {
+	unsigned int size;
+	const char** slots;
+};
+
+struct univention_policy_cache_entry_s;
+struct univention_policy_cache_entry_s {
+	struct univention_policy_cache_entry_s* next;
+	char* dn;
+	int rc;
+	LDAPMessage* res;
+};
+
+#define POLICY_FILTER_ATTRIBUTES 4
+
+enum univention_policy_filter_type {
+	POLICY_FILTER_AND,
+	POLICY_FILTER_OR,
+	POLICY_FILTER_NOT,
+	POLICY_FILTER_EQUALITY,
+	POLICY_FILTER_PRESENT,
+	POLICY_FILTER_OTHER,
+};
+
+/* Compiled ldapFilter for local evaluation. */
+struct univention_policy_filter_s;
+struct univention_policy_filter_s {
+	struct univention_policy_filter_s* next;
+	enum univention_policy_filter_type type;
+	struct univention_policy_filter_s* children;
+	int index;  /* in univention_policy_filter_attributes, -1 if unknown */
+	char* value;
 };
+
+extern char *univention_policy_filter_attributes[POLICY_FILTER_ATTRIBUTES + 1];
+/* Returns NULL if filter is invalid or too complex. */
+struct univention_policy_filter_s *univention_policy_filter_compile(const char *filter);
+void univention_policy_filter_free(struct univention_policy_filter_s *filter);
+/* Match values of univention_policy_filter_attributes, returns 1, 0 or -1 if the server must decide. */
+int univention_policy_filter_match(const struct univention_policy_filter_s *filter, char **const values[POLICY_FILTER_ATTRIBUTES]);
+
+/* Parsed policy object, ready to be applied to many objects. */
+struct univention_policy_object_s;
+struct univention_policy_object_s {
+	struct univention_policy_object_s* next;
+	char* dn;
+	char* name;
+	char** required_object_classes;
+	char** prohibited_object_classes;
+	char* ldap_filter;
+	struct univention_policy_filter_s* filter;
+	char** fixed_attributes;
+	struct univention_policy_name_set_s fixed;
+	char** empty_attributes;
+	struct univention_policy_attribute_list_s* attributes;
+};
+
+/* LDAP entries shared by the objects of one univention_policy_open_many() call. */
+struct univention_policy_cache_s {
+	struct univention_policy_cache_entry_s* ancestors[POLICY_HASH_BUCKETS];
+	struct univention_policy_object_s* policies[POLICY_HASH_BUCKETS];
+};
+
+/* Policies of dn below base from the index of the listener, NULL if not indexed. */
+univention_policy_handle_t *univention_policy_index_get(const char *base, const char *dn);
@@ -41,6 +41,8 @@
 #include <sasl/sasl.h>
 #include <sys/types.h>
 #include <pwd.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <univention/config.h>
@@ -49,6 +51,79 @@
 
 #include "internal.h"
 
+#define POOL_SIZE 4
+#define POOL_IDLE_MAX (15 * 60)
+
+/* Bound connections released by univention_ldap_release() for reuse by
+ * univention_ldap_open() with the same parameters. */
+static struct pool_entry {
+	char *key;
+	LDAP *ld;
+	time_t since;
+} pool[POOL_SIZE];
+
+/* Describe the connection parameters, which must match for reuse. */
+static char *pool_key(const univention_ldap_parameters_t *lp)
+{
+	char *key;
+
+	if (asprintf(&key, "%s|%d|%d|%d|%d|%s|%s|%s",
+			lp->uri ? lp->uri : lp->host ? lp->host : "",
+			lp->uri ? 0 : lp->port,
+			lp->version,
+			lp->start_tls,
+			lp->authmethod,
+			lp->binddn ? lp->binddn : "",
+			lp->sasl_mech ? lp->sasl_mech : "",
+			lp->sasl_authzid ? lp->sasl_authzid : "") < 0)
+		return NULL;
+	return key;
+}
+
+/* An idle connection must not have data pending; otherwise the server has
+ * closed it or sent a notice of disconnection. */
+static int pool_healthy(LDAP *ld)
+{
+	struct pollfd pfd = {.events = POLLIN};
+
+	if (ldap_get_option(ld, LDAP_OPT_DESC, &pfd.fd) != LDAP_OPT_SUCCESS || pfd.fd < 0)
+		return 0;
+	return poll(&pfd, 1, 0) == 0;
+}
+
+static void pool_drop(struct pool_entry *entry)
+{
+	ldap_unbind_ext(entry->ld, NULL, NULL);
+	entry->ld = NULL;
+	FREE(entry->key);
+}
+
+/* Take a healthy pooled connection matching @lp, dropping stale ones. */
+static LDAP *pool_take(const univention_ldap_parameters_t *lp)
+{
+	time_t now = time(NULL);
+	LDAP *ld = NULL;
+	char *key;
+	int i;
+
+	if ((key = pool_key(lp)) == NULL)
+		return NULL;
+	for (i = 0; i < POOL_SIZE; i++) {
+		if (pool[i].ld == NULL)
+			continue;
+		if (now - pool[i].since > POOL_IDLE_MAX || !pool_healthy(pool[i].ld)) {
+			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "dropping stale pooled connection");
+			pool_drop(&pool[i]);
+		} else if (ld == NULL && strcmp(pool[i].key, key) == 0) {
+			ld = pool[i].ld;
+			pool[i].ld = NULL;
+			FREE(pool[i].key);
+		}
+	}
+	free(key);
+	return ld;
+}
+
 univention_ldap_parameters_t* univention_ldap_new(void)
 {
 	univention_ldap_parameters_t* lp;
@@ -232,6 +307,11 @@ int univention_ldap_open(univention_ldap_parameters_t *lp)
 		}
 	}
 
+	if ((lp->ld = pool_take(lp)) != NULL) {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "reusing pooled connection");
+		return LDAP_SUCCESS;
+	}
+
 	/* if uri is given use that */
 	if (lp->uri != NULL) {
 		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_PROCESS, "connecting to %s", lp->uri);
@@ -298,6 +378,50 @@ success:
 	return rv;
 }
 
+/* Keep the connection of @lp open for the next univention_ldap_open() with
+ * the same parameters instead of closing it. */
+void univention_ldap_release(univention_ldap_parameters_t *lp)
+{
+	int i, slot = 0;
+
+	if (lp == NULL || lp->ld == NULL)
+		return;
+	if (!pool_healthy(lp->ld)) {
+		ldap_unbind_ext(lp->ld, NULL, NULL);
+		lp->ld = NULL;
+		return;
+	}
+	/* use a free slot or replace the oldest connection */
+	for (i = 0; i < POOL_SIZE; i++) {
+		if (pool[i].ld == NULL) {
+			slot = i;
+			break;
+		}
+		if (pool[i].since < pool[slot].since)
+			slot = i;
+	}
+	if (pool[slot].ld != NULL)
+		pool_drop(&pool[slot]);
+	if ((pool[slot].key = pool_key(lp)) == NULL) {
+		ldap_unbind_ext(lp->ld, NULL, NULL);
+	} else {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "releasing connection to pool");
+		pool[slot].ld = lp->ld;
+		pool[slot].since = time(NULL);
+	}
+	lp->ld = NULL;
+}
+
+/* Close all pooled connections. */
+void univention_ldap_pool_clear(void)
+{
+	int i;
+
+	for (i = 0; i < POOL_SIZE; i++)
+		if (pool[i].ld != NULL)
+			pool_drop(&pool[i]);
+}
+
 void univention_ldap_close(univention_ldap_parameters_t* lp)
 {
 	char *c;
@@ -38,6 +38,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <time.h>
 
 #include <univention/debug.h>
 
@@ -98,28 +100,87 @@ static const char *parent_dn(const char *dn)
 	return pdn;
 }
 
+/* Hash of s. */
+static unsigned long policy_string_hash(const char *s, bool nocase)
+{
+	unsigned long hash = 5381;
+	const char *c;
+	for (c = s; *c; c++)
+		hash = hash * 33 + (unsigned char)(nocase ? tolower(*c) : *c);
+	return hash;
+}
+
+/* Hash bucket of dn. */
+static unsigned int policy_hash(const char *dn)
+{
+	return policy_string_hash(dn, false) % POLICY_HASH_BUCKETS;
+}
+
+/* Index names, which must stay valid while set is in use. */
+static void policy_name_set_init(struct univention_policy_name_set_s *set, char **names)
+{
+	unsigned int count = 0, i, slot;
+
+	set->size = 0;
+	set->slots = NULL;
+	if (names == NULL)
+		return;
+	while (names[count] != NULL)
+		count++;
+	/* keep the table at most half full */
+	for (set->size = 8; set->size < 2 * count; set->size *= 2);
+	if ((set->slots = calloc(set->size, sizeof(char *))) == NULL) {
+		perror("calloc");
+		set->size = 0;
+		return;
+	}
+	for (i = 0; i < count; i++) {
+		for (slot = policy_string_hash(names[i], true) & (set->size - 1); set->slots[slot] != NULL; slot = (slot + 1) & (set->size - 1)) {
+			if (strcasecmp(set->slots[slot], names[i]) == 0)
+				break;
+		}
+		set->slots[slot] = names[i];
+	}
+}
+
+/** Check if set contains name. */
+static bool policy_name_set_has(const struct univention_policy_name_set_s *set, const char *name)
+{
+	unsigned int slot;
+	if (set->size == 0)
+		return false;
+	for (slot = policy_string_hash(name, true) & (set->size - 1); set->slots[slot] != NULL; slot = (slot + 1) & (set->size - 1)) {
+		if (strcasecmp(set->slots[slot], name) == 0)
+			return true;
+	}
+	return false;
+}
+
 /*
  * returns object from list if it already exists, create new object otherwise
  */
-static struct univention_policy_list_s* univention_policy_list_get(struct univention_policy_list_s** list, const char *name)
+static struct univention_policy_list_s* univention_policy_list_get(univention_policy_handle_t *handle, const char *name)
 {
 	struct univention_policy_list_s *new;
 	struct univention_policy_list_s *cur;
+	unsigned int bucket = policy_hash(name);
 
-	for (cur = *list; cur != NULL; cur = cur->next) {
+	for (cur = handle->index[bucket]; cur != NULL; cur = cur->hash_next) {
 		if (strcmp(cur->name, name) == 0)
 			return cur;
 	}
 
 	/* policy not found: create new object */
 	univention_debug(UV_DEBUG_POLICY, UV_DEBUG_ALL, "policy entry not found, creating new one");
-	if ((new = malloc(sizeof(struct univention_policy_list_s))) == NULL)
+	if ((new = calloc(1, sizeof(struct univention_policy_list_s))) == NULL)
 		return NULL;
 	new->name = strdup(name);
 	new->attributes = NULL;
 
-	new->next = *list;
-	*list = new;
+	new->next = handle->policies;
+	handle->policies = new;
+	new->hash_next = handle->index[bucket];
+	handle->index[bucket] = new;
 
 	return new;
 }
@@ -127,25 +188,28 @@ static struct univention_policy_list_s* univention_policy_list_get(struct univen
 /*
  * returns object from list if it already exists, create new object otherwise
  */
-static struct univention_policy_attribute_list_s* univention_policy_attribute_list_get(struct univention_policy_attribute_list_s **list, const char *name)
+static struct univention_policy_attribute_list_s* univention_policy_attribute_list_get(struct univention_policy_list_s *policy, const char *name)
 {
 	struct univention_policy_attribute_list_s *new;
 	struct univention_policy_attribute_list_s *cur;
+	unsigned int bucket = policy_hash(name);
 
-	for (cur = *list; cur != NULL; cur = cur->next) {
+	for (cur = policy->index[bucket]; cur != NULL; cur = cur->hash_next) {
 		if (strcmp(cur->name, name) == 0)
 			return cur;
 	}
 
 	/* policy not found: create new object */
 	univention_debug(UV_DEBUG_POLICY, UV_DEBUG_ALL, "attribute entry not found, creating new one");
-	if ((new = malloc(sizeof(struct univention_policy_attribute_list_s))) == NULL)
+	if ((new = calloc(1, sizeof(struct univention_policy_attribute_list_s))) == NULL)
 		return NULL;
 	new->name = strdup(name);
 	new->values = NULL;
 
-	new->next = *list;
-	*list = new;
+	new->next = policy->attributes;
+	policy->attributes = new;
+	new->hash_next = policy->index[bucket];
+	policy->index[bucket] = new;
 
 	return new;
 }
@@ -189,10 +253,121 @@ static void print_string_array(char **object_classes)
 }
 #endif
 
+/* Process-wide cache of parsed policy objects. */
+static struct {
+	unsigned int ttl;
+	time_t checked;
+	char *csn;
+	struct univention_policy_object_s *objects[POLICY_HASH_BUCKETS];
+} policy_cache;
+
+/*
+ * BASE search for dn, answered from cache if given. Results found in the cache
+ * belong to it, release them with policy_search_free().
+ */
+static struct univention_policy_cache_entry_s *policy_cache_find(struct univention_policy_cache_entry_s **cache, const char *dn)
+{
+	struct univention_policy_cache_entry_s *cur;
+	for (cur = cache[policy_hash(dn)]; cur != NULL; cur = cur->next) {
+		if (strcmp(cur->dn, dn) == 0)
+			return cur;
+	}
+	return NULL;
+}
+
+/*
+ * Collect the answer of the asynchronous search msgid. Returns -1 if no answer
+ * was received, the LDAP result code otherwise.
+ */
+static int policy_result(LDAP *ld, int msgid, LDAPMessage **res)
+{
+	struct timeval timeout = {.tv_sec=10, .tv_usec=0};
+	int rc, err;
+
+	*res = NULL;
+	rc = ldap_result(ld, msgid, LDAP_MSG_ALL, &timeout, res);
+	if (rc <= 0) {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "ldap_result returned %d", rc);
+		if (rc == 0)
+			ldap_abandon_ext(ld, msgid, NULL, NULL);
+		ldap_msgfree(*res);
+		*res = NULL;
+		return -1;
+	}
+	rc = ldap_parse_result(ld, *res, &err, NULL, NULL, NULL, NULL, 0);
+	return rc != LDAP_SUCCESS ? rc : err;
+}
+
+/*
+ * BASE search for dn, answered from cache if given. If msgid is not -1 the
+ * search was already sent by ldap_search_ext(), a plain search is the fallback.
+ * Results found in the cache belong to it, release them with policy_search_free().
+ */
+static int policy_search(LDAP *ld, struct univention_policy_cache_entry_s **cache, const char *dn, const char *filter, char **attrs, int msgid, LDAPMessage **res)
+{
+	struct timeval timeout = {.tv_sec=10, .tv_usec=0};
+	struct univention_policy_cache_entry_s *cur, **bucket;
+	int rc = -1;
+
+	if (cache != NULL && (cur = policy_cache_find(cache, dn)) != NULL) {
+		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_ALL, "cached: %s", dn);
+		*res = cur->res;
+		return cur->rc;
+	}
+
+	if (msgid != -1)
+		rc = policy_result(ld, msgid, res);
+	if (rc == -1)
+		rc = ldap_search_ext_s(ld, dn, LDAP_SCOPE_BASE, filter, attrs, 0, NULL, NULL, &timeout, 0, res);
+	if (cache == NULL)
+		return rc;
+	/* do not remember errors, the next object retries */
+	if (rc != LDAP_SUCCESS && rc != LDAP_NO_SUCH_OBJECT)
+		return rc;
+
+	if ((cur = malloc(sizeof(struct univention_policy_cache_entry_s))) == NULL || (cur->dn = strdup(dn)) == NULL) {
+		FREE(cur);
+		ldap_msgfree(*res);
+		*res = NULL;
+		return LDAP_NO_MEMORY;
+	}
+	bucket = &cache[policy_hash(dn)];
+	cur->rc = rc;
+	cur->res = *res;
+	cur->next = *bucket;
+	*bucket = cur;
+
+	return rc;
+}
+
+/* Release result of policy_search() unless it is kept in cache. */
+static void policy_search_free(struct univention_policy_cache_entry_s **cache, int rc, LDAPMessage *res)
+{
+	if (cache == NULL || (rc != LDAP_SUCCESS && rc != LDAP_NO_SUCH_OBJECT))
+		ldap_msgfree(res);
+}
+
+/* Free all entries of cache. */
+static void policy_cache_clear(struct univention_policy_cache_entry_s **cache)
+{
+	int i;
+	for (i = 0; i < POLICY_HASH_BUCKETS; i++) {
+		struct univention_policy_cache_entry_s *cur, *next;
+		for (cur = cache[i]; cur != NULL; cur = next) {
+			next = cur->next;
+			ldap_msgfree(cur->res);
+			FREE(cur->dn);
+			FREE(cur);
+		}
+		cache[i] = NULL;
+	}
+}
+
 /* clean up handle by removing empty attributes. */
 static void univention_policy_cleanup(univention_policy_handle_t* handle)
 {
 	struct univention_policy_list_s* policy;
+	struct univention_policy_attribute_list_s *o_cur;
 	for (policy = handle->policies; policy != NULL; policy = policy->next) {
 		struct univention_policy_attribute_list_s **cur = &policy->attributes;
 		while (*cur != NULL) {
@@ -203,36 +378,160 @@ static void univention_policy_cleanup(univention_policy_handle_t* handle)
 			} else
 				cur = &((*cur)->next);
 		}
+		/* rebuild index of the remaining attributes */
+		memset(policy->index, 0, sizeof(policy->index));
+		for (o_cur = policy->attributes; o_cur != NULL; o_cur = o_cur->next) {
+			unsigned int bucket = policy_hash(o_cur->name);
+			o_cur->hash_next = policy->index[bucket];
+			policy->index[bucket] = o_cur;
+		}
 	}
 }
 
-/* Retrieve policy 'dn' */
-static void univention_policy_merge(LDAP *ld, const char *dn, univention_policy_handle_t *handle, char **object_classes, const char *objectdn)
+/* Deep-free univention_policy_object. */
+static void univention_policy_object_free(struct univention_policy_object_s *o) {
+	if (o) {
+		struct univention_policy_attribute_list_s *cur, *next;
+		FREE(o->dn);
+		FREE(o->name);
+		FREE_ARRAY(o->required_object_classes);
+		FREE_ARRAY(o->prohibited_object_classes);
+		FREE(o->ldap_filter);
+		univention_policy_filter_free(o->filter);
+		FREE(o->fixed.slots);
+		FREE_ARRAY(o->fixed_attributes);
+		FREE_ARRAY(o->empty_attributes);
+		for (cur = o->attributes; cur != NULL; cur = next) {
+			next = cur->next;
+			univention_policy_attribute_list_free(cur);
+		}
+		FREE(o);
+	}
+}
+
+/* Free all policy objects of cache. */
+static void policy_objects_clear(struct univention_policy_object_s **cache)
+{
+	int i;
+	for (i = 0; i < POLICY_HASH_BUCKETS; i++) {
+		struct univention_policy_object_s *cur, *next;
+		for (cur = cache[i]; cur != NULL; cur = next) {
+			next = cur->next;
+			univention_policy_object_free(cur);
+		}
+		cache[i] = NULL;
+	}
+}
+
+/* Return policy object 'dn' from cache, NULL if not cached. */
+static struct univention_policy_object_s *policy_objects_find(struct univention_policy_object_s **cache, const char *dn)
+{
+	struct univention_policy_object_s *cur;
+	for (cur = cache[policy_hash(dn)]; cur != NULL; cur = cur->next) {
+		if (strcmp(cur->dn, dn) == 0)
+			return cur;
+	}
+	return NULL;
+}
+
+static void policy_objects_add(struct univention_policy_object_s **cache, struct univention_policy_object_s *o)
+{
+	struct univention_policy_object_s **bucket = &cache[policy_hash(o->dn)];
+	o->next = *bucket;
+	*bucket = o;
+}
+
+/* Copy multi-valued attribute into a NULL terminated string array. */
+static char **policy_values_dup(struct berval **vals)
+{
+	char **array;
+	int i;
+	i = ldap_count_values_len(vals);
+	if ((array = calloc(i + 1, sizeof(char *))) == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+	for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++)
+		array[i] = strdup(vals[i]->bv_val);
+	array[i] = NULL;
+	return array;
+}
+
+/* Deep-copy univention_policy_result. */
+static univention_policy_result_t *univention_policy_result_dup(const univention_policy_result_t *o)
+{
+	univention_policy_result_t *new;
+	int i;
+
+	if ((new = malloc(sizeof(univention_policy_result_t))) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	new->policy_dn = strdup(o->policy_dn);
+	new->count = o->count;
+	new->values = calloc(o->count + 1, sizeof(char*));
+	for (i = 0; i < o->count; i++)
+		new->values[i] = strdup(o->values[i]);
+	new->values[i] = NULL;
+	return new;
+}
+
+/* General policy attributes, which are not copied into the result. */
+static char *excluded_attributes[] = {
+	"cn",
+	"objectClass",
+	"fixedAttributes",
+	"emptyAttributes",
+	"requiredObjectClasses",
+	"prohibitedObjectClasses",
+	"ldapFilter",
+	"univentionObjectType",
+	NULL
+};
+static struct univention_policy_name_set_s excluded;
+
+/* Build the set at load time, so concurrent callers on other connections do not race. */
+static void __attribute__ ((constructor)) policy_init(void)
+{
+	policy_name_set_init(&excluded, excluded_attributes);
+}
+
+/* Fetch and parse policy 'dn', returns NULL on LDAP errors. */
+static struct univention_policy_object_s *univention_policy_fetch(LDAP *ld, const char *dn)
 {
 	int		rc;
 	LDAPMessage	*res;
 	struct  timeval	timeout = {.tv_sec=10, .tv_usec=0};
-
-	univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "considering policy: %s", dn);
+	struct univention_policy_object_s *o;
 
 	rc = ldap_search_ext_s(ld, dn, LDAP_SCOPE_BASE, "(objectClass=univentionPolicy)", NULL, 0, NULL, NULL, &timeout, 0, &res);
 	if (rc == LDAP_NO_SUCH_OBJECT) {
 		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Not found");
 	} else if (rc != LDAP_SUCCESS) {
 		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "ldap_search_ext_s returned ERROR");
-	} else {
+		ldap_msgfree(res);
+		return NULL;
+	}
+
+	if ((o = calloc(1, sizeof(struct univention_policy_object_s))) == NULL) {
+		perror("calloc");
+		ldap_msgfree(res);
+		return NULL;
+	}
+	o->dn = strdup(dn);
+
+	if (rc == LDAP_SUCCESS) {
 		LDAPMessage	*entry;
+		struct univention_policy_attribute_list_s **tail = &o->attributes;
 
 		/* BASE search returns at most one entry. */
 		for (entry = ldap_first_entry(ld, res);
 			 entry != NULL;
 			 entry = ldap_next_entry(ld, entry)) {
 
-			struct univention_policy_list_s *policy = NULL;
-			char **fixed_attributes = NULL;
-			char **empty_attributes = NULL;
 			struct berval **vals;
-			bool apply = true;
+			char *attr;
+			BerElement *ber;
 			int i;
 
 			dprint_dn(ld, entry);
@@ -247,191 +546,327 @@ static void univention_policy_merge(LDAP *ld, const char *dn, univention_policy_
 						(strcmp(vals[i]->bv_val, "univentionPolicy") &&
 							!strncmp(vals[i]->bv_val, "univentionPolicy" , strlen("univentionPolicy")))) {
 
-						if (policy != NULL) {
+						if (o->name != NULL) {
 							univention_debug(UV_DEBUG_POLICY, UV_DEBUG_ERROR, "more than one policy type has been determined for this policy!");
+							FREE(o->name);
 						}
-						policy = univention_policy_list_get(&handle->policies, vals[i]->bv_val);
-						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "current policy type is %s", policy->name);
+						o->name = strdup(vals[i]->bv_val);
+						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "current policy type is %s", o->name);
 					}
 				}
 				ldap_value_free_len(vals);
 			}
-			if ((vals = ldap_get_values_len(ld, entry, "requiredObjectClasses")) != NULL) {
-				for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++) {
-					if (!in_string_array(object_classes, vals[i]->bv_val)) {
-						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "objectclass %s is required", vals[i]->bv_val);
-						apply = false;
-						break;
-					}
-				}
+			if (o->required_object_classes == NULL && (vals = ldap_get_values_len(ld, entry, "requiredObjectClasses")) != NULL) {
+				o->required_object_classes = policy_values_dup(vals);
 				ldap_value_free_len(vals);
 			}
-			if (apply && (vals = ldap_get_values_len(ld, entry, "prohibitedObjectClasses")) != NULL) {
-				for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++) {
-					if (in_string_array(object_classes, vals[i]->bv_val)) {
-						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "objectclass %s is prohibited", vals[i]->bv_val);
-						apply = false;
-						break;
-					}
-				}
+			if (o->prohibited_object_classes == NULL && (vals = ldap_get_values_len(ld, entry, "prohibitedObjectClasses")) != NULL) {
+				o->prohibited_object_classes = policy_values_dup(vals);
 				ldap_value_free_len(vals);
 			}
-
-			if (apply && (vals = ldap_get_values_len(ld, entry, "ldapFilter")) != NULL) {
-				int ldap_filter_rc;
-				for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++) {
-					LDAPMessage *ldap_filter_res;
-					char *search_attrs[] = { LDAP_NO_ATTRS, NULL };
-					ldap_filter_rc = ldap_search_ext_s(ld, objectdn, LDAP_SCOPE_BASE, vals[i]->bv_val, search_attrs, 0, NULL, NULL, &timeout, 0, &ldap_filter_res);
-					if (ldap_filter_rc != LDAP_SUCCESS) {
-						univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "search filter '%s' caused error: %s: %s", vals[i]->bv_val, objectdn, ldap_err2string(ldap_filter_rc));
-					} else {
-						if (!ldap_count_entries(ld, ldap_filter_res))
-							apply = false;
-					}
-					ldap_msgfree(ldap_filter_res);
-					break;  // single-value
-				}
+			if (o->ldap_filter == NULL && (vals = ldap_get_values_len(ld, entry, "ldapFilter")) != NULL) {
+				if (vals[0] != NULL && vals[0]->bv_val != NULL)
+					o->ldap_filter = strdup(vals[0]->bv_val);  // single-value
 				ldap_value_free_len(vals);
 			}
-
-			if (fixed_attributes == NULL && (vals = ldap_get_values_len(ld, entry, "fixedAttributes")) != NULL) {
-				i = ldap_count_values_len(vals);
-				if ((fixed_attributes = calloc(i + 1, sizeof(char *))) == NULL)
-					perror("calloc");
-				for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++)
-					fixed_attributes[i] = strdup(vals[i]->bv_val);
-				fixed_attributes[i] = NULL;
+			if (o->fixed_attributes == NULL && (vals = ldap_get_values_len(ld, entry, "fixedAttributes")) != NULL) {
+				o->fixed_attributes = policy_values_dup(vals);
 				ldap_value_free_len(vals);
 			}
-			if (empty_attributes == NULL && (vals = ldap_get_values_len(ld, entry, "emptyAttributes")) != NULL) {
-				i = ldap_count_values_len(vals);
-				if ((empty_attributes = calloc(i + 1, sizeof(char *))) == NULL)
-					perror("calloc");
-				for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++)
-					empty_attributes[i] = strdup(vals[i]->bv_val);
-				empty_attributes[i] = NULL;
+			if (o->empty_attributes == NULL && (vals = ldap_get_values_len(ld, entry, "emptyAttributes")) != NULL) {
+				o->empty_attributes = policy_values_dup(vals);
 				ldap_value_free_len(vals);
 			}
 
-			if (policy != NULL && apply) {
-				char *attr;
-				BerElement *ber;
+			/* iterate over attributes of policy and parse remaining attributes. */
+			for (attr = ldap_first_attribute(ld, entry, &ber);
+				 attr != NULL;
+				 attr = ldap_next_attribute(ld, entry, ber)) {
 
-				univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "applying policy: %s", dn);
+				if (!policy_name_set_has(&excluded, attr) &&
+					(vals = ldap_get_values_len(ld, entry, attr)) != NULL) {
 
-				/* clear attributes defined in emptyAttributes; empty value entries
-				 * will be removed by _cleanup; they are necessary for now to mark that
-				 * attribute has been set (even though empty) */
-				for (i = 0; empty_attributes != NULL && empty_attributes[i] != NULL; i++) {
-#if 0
-					univention_policy_attribute_list_remove(&policy->attributes, empty_attributes[i]);
-#endif
-					struct univention_policy_attribute_list_s* policy_attr;
-
-					univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "considering %s/%s (EA)", policy->name, empty_attributes[i]);
-					policy_attr = univention_policy_attribute_list_get(&policy->attributes, empty_attributes[i]);
-					if (policy_attr->values == NULL || in_string_array(fixed_attributes, empty_attributes[i])) {
-						univention_policy_result_free(policy_attr->values);
-						if ((policy_attr->values = malloc(sizeof(univention_policy_result_t))) == NULL)
-							perror("malloc");
-
-						policy_attr->values->policy_dn = strdup(dn);
-						policy_attr->values->count = 0;
-						policy_attr->values->values = calloc(policy_attr->values->count + 1, sizeof(char*));
-						policy_attr->values->values[0] = NULL;
-					} else {
-						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "not setting attribute (EA)");
-					}
-				}
+					struct univention_policy_attribute_list_s *new;
 
-				/* iterate over attributes of policy and parse remaining attributes. */
-				for (attr = ldap_first_attribute(ld, entry, &ber);
-					 attr != NULL;
-					 attr = ldap_next_attribute(ld, entry, ber)) {
-
-					if (strcmp(attr, "cn") &&
-						strcmp(attr, "objectClass") &&
-						strcmp(attr, "fixedAttributes") &&
-						strcmp(attr, "emptyAttributes") &&
-						strcmp(attr, "requiredObjectClasses") &&
-						strcmp(attr, "prohibitedObjectClasses") &&
-						strcmp(attr, "ldapFilter") &&
-						strcmp(attr, "univentionObjectType") &&
-						(vals = ldap_get_values_len(ld, entry, attr)) != NULL) {
-
-						struct univention_policy_attribute_list_s* policy_attr;
-
-						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "considering %s/%s", policy->name, attr);
-						policy_attr = univention_policy_attribute_list_get(&policy->attributes, attr);
-						if (policy_attr->values == NULL || in_string_array(fixed_attributes, attr)) {
-							univention_policy_result_free(policy_attr->values);
-							if ((policy_attr->values = malloc(sizeof(univention_policy_result_t))) == NULL)
-								perror("malloc");
-
-							univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "setting attribute");
-							policy_attr->values->policy_dn = strdup(dn);
-							policy_attr->values->count = ldap_count_values_len(vals);
-							policy_attr->values->values = calloc(policy_attr->values->count + 1, sizeof(char*));
-							for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++) {
-								policy_attr->values->values[i] = strdup(vals[i]->bv_val);
-							}
-							policy_attr->values->values[i] = NULL;
-						} else {
-							univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "not setting attribute");
-						}
-						ldap_value_free_len( vals );
+					if ((new = calloc(1, sizeof(struct univention_policy_attribute_list_s))) == NULL ||
+						(new->values = malloc(sizeof(univention_policy_result_t))) == NULL) {
+						perror("malloc");
+						FREE(new);
+					} else {
+						/* keep the order of the LDAP entry */
+						new->name = strdup(attr);
+						new->values->policy_dn = strdup(dn);
+						new->values->count = ldap_count_values_len(vals);
+						new->values->values = policy_values_dup(vals);
+						*tail = new;
+						tail = &new->next;
 					}
-					ldap_memfree(attr);
-				}
-				if (ber != NULL) {
-					ber_free(ber, 0);
-					ber = NULL;
+					ldap_value_free_len( vals );
 				}
-			} /* apply */
-			FREE_ARRAY(fixed_attributes);
-			FREE_ARRAY(empty_attributes);
+				ldap_memfree(attr);
+			}
+			if (ber != NULL) {
+				ber_free(ber, 0);
+				ber = NULL;
+			}
 		}
 	}
 
 	ldap_msgfree( res );
 	univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ALL, "Search done.");
+
+	policy_name_set_init(&o->fixed, o->fixed_attributes);
+	if (o->ldap_filter != NULL && (o->filter = univention_policy_filter_compile(o->ldap_filter)) == NULL)
+		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "search filter '%s' is evaluated by the server", o->ldap_filter);
+
+	return o;
+}
+
+/* Apply policy object 'o' to the object 'objectdn' with 'values' of univention_policy_filter_attributes. */
+static void univention_policy_apply(LDAP *ld, const struct univention_policy_object_s *o, univention_policy_handle_t *handle, char **const values[POLICY_FILTER_ATTRIBUTES], const char *objectdn)
+{
+	char **object_classes = values[0];
+	struct univention_policy_list_s *policy;
+	struct univention_policy_attribute_list_s *cur;
+	struct  timeval	timeout = {.tv_sec=10, .tv_usec=0};
+	bool apply = true;
+	int i;
+
+	if (o->name == NULL)
+		return;
+	policy = univention_policy_list_get(handle, o->name);
+
+	for (i = 0; o->required_object_classes != NULL && o->required_object_classes[i] != NULL; i++) {
+		if (!in_string_array(object_classes, o->required_object_classes[i])) {
+			univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "objectclass %s is required", o->required_object_classes[i]);
+			apply = false;
+			break;
+		}
+	}
+	for (i = 0; apply && o->prohibited_object_classes != NULL && o->prohibited_object_classes[i] != NULL; i++) {
+		if (in_string_array(object_classes, o->prohibited_object_classes[i])) {
+			univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "objectclass %s is prohibited", o->prohibited_object_classes[i]);
+			apply = false;
+			break;
+		}
+	}
+
+	if (apply && o->filter != NULL) {
+		switch (univention_policy_filter_match(o->filter, values)) {
+		case 0:
+			univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "search filter '%s' does not match", o->ldap_filter);
+			apply = false;
+			/* fall through */
+		case 1:
+			goto filtered;
+		}
+	}
+	if (apply && o->ldap_filter != NULL) {
+		int ldap_filter_rc;
+		LDAPMessage *ldap_filter_res;
+		char *search_attrs[] = { LDAP_NO_ATTRS, NULL };
+		ldap_filter_rc = ldap_search_ext_s(ld, objectdn, LDAP_SCOPE_BASE, o->ldap_filter, search_attrs, 0, NULL, NULL, &timeout, 0, &ldap_filter_res);
+		if (ldap_filter_rc != LDAP_SUCCESS) {
+			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "search filter '%s' caused error: %s: %s", o->ldap_filter, objectdn, ldap_err2string(ldap_filter_rc));
+		} else {
+			if (!ldap_count_entries(ld, ldap_filter_res))
+				apply = false;
+		}
+		ldap_msgfree(ldap_filter_res);
+	}
+filtered:
+
+	if (!apply)
+		return;
+
+	univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "applying policy: %s", o->dn);
+
+	/* clear attributes defined in emptyAttributes; empty value entries
+	 * will be removed by _cleanup; they are necessary for now to mark that
+	 * attribute has been set (even though empty) */
+	for (i = 0; o->empty_attributes != NULL && o->empty_attributes[i] != NULL; i++) {
+		struct univention_policy_attribute_list_s* policy_attr;
+
+		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "considering %s/%s (EA)", policy->name, o->empty_attributes[i]);
+		policy_attr = univention_policy_attribute_list_get(policy, o->empty_attributes[i]);
+		if (policy_attr->values == NULL || policy_name_set_has(&o->fixed, o->empty_attributes[i])) {
+			univention_policy_result_free(policy_attr->values);
+			if ((policy_attr->values = malloc(sizeof(univention_policy_result_t))) == NULL)
+				perror("malloc");
+
+			policy_attr->values->policy_dn = strdup(o->dn);
+			policy_attr->values->count = 0;
+			policy_attr->values->values = calloc(policy_attr->values->count + 1, sizeof(char*));
+			policy_attr->values->values[0] = NULL;
+		} else {
+			univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "not setting attribute (EA)");
+		}
+	}
+
+	for (cur = o->attributes; cur != NULL; cur = cur->next) {
+		struct univention_policy_attribute_list_s* policy_attr;
+
+		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "considering %s/%s", policy->name, cur->name);
+		policy_attr = univention_policy_attribute_list_get(policy, cur->name);
+		if (policy_attr->values == NULL || policy_name_set_has(&o->fixed, cur->name)) {
+			univention_policy_result_free(policy_attr->values);
+			univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "setting attribute");
+			policy_attr->values = univention_policy_result_dup(cur->values);
+		} else {
+			univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "not setting attribute");
+		}
+	}
+}
+
+/* Retrieve policy 'dn' */
+static void univention_policy_merge(LDAP *ld, const char *dn, univention_policy_handle_t *handle, char **const values[POLICY_FILTER_ATTRIBUTES], const char *objectdn, struct univention_policy_cache_s *cache)
+{
+	struct univention_policy_object_s **objects = NULL;
+	struct univention_policy_object_s *o = NULL;
+
+	univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "considering policy: %s", dn);
+
+	if (policy_cache.ttl)
+		objects = policy_cache.objects;
+	else if (cache)
+		objects = cache->policies;
+
+	if (objects != NULL && (o = policy_objects_find(objects, dn)) != NULL) {
+		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_ALL, "cached: %s", dn);
+	} else {
+		if ((o = univention_policy_fetch(ld, dn)) == NULL)
+			return;
+		if (objects != NULL)
+			policy_objects_add(objects, o);
+	}
+
+	univention_policy_apply(ld, o, handle, values, objectdn);
+
+	if (objects == NULL)
+		univention_policy_object_free(o);
+}
+
+/* Return the contextCSN values of base joined by spaces, NULL if not available. */
+static char *policy_context_csn(LDAP *ld, const char *base)
+{
+	struct timeval timeout = {.tv_sec=10, .tv_usec=0};
+	char *attrs[] = {"contextCSN", NULL};
+	LDAPMessage *res, *entry;
+	struct berval **vals;
+	char *csn = NULL;
+	size_t len = 0;
+	int i, rc;
+
+	rc = ldap_search_ext_s(ld, base, LDAP_SCOPE_BASE, "(objectClass=*)", attrs, 0, NULL, NULL, &timeout, 0, &res);
+	if (rc != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "%s: %s", base, ldap_err2string(rc));
+	} else if ((entry = ldap_first_entry(ld, res)) != NULL && (vals = ldap_get_values_len(ld, entry, "contextCSN")) != NULL) {
+		for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++)
+			len += vals[i]->bv_len + 1;
+		if (len > 0 && (csn = malloc(len)) != NULL) {
+			csn[0] = '\0';
+			for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++) {
+				if (i > 0)
+					strcat(csn, " ");
+				strncat(csn, vals[i]->bv_val, vals[i]->bv_len);
+			}
+		}
+		ldap_value_free_len(vals);
+	}
+	ldap_msgfree(res);
+	return csn;
 }
 
 /*
- * reads policies for dn from conn
+ * Keep the process-wide policy cache while the contextCSN of base is
+ * unchanged, check at most every ttl seconds.
  */
-univention_policy_handle_t* univention_policy_open(LDAP* ld, const char *base, const char *dn)
+static void policy_cache_validate(LDAP *ld, const char *base)
+{
+	time_t now;
+	char *csn;
+
+	if (!policy_cache.ttl)
+		return;
+	now = time(NULL);
+	if (now >= policy_cache.checked && now - policy_cache.checked < policy_cache.ttl)
+		return;
+
+	csn = policy_context_csn(ld, base);
+	if (csn == NULL || policy_cache.csn == NULL || strcmp(csn, policy_cache.csn) != 0) {
+		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "policy cache expired");
+		policy_objects_clear(policy_cache.objects);
+	}
+	FREE(policy_cache.csn);
+	policy_cache.csn = csn;
+	policy_cache.checked = now;
+}
+
+/*
+ * reads policies for dn from conn, sharing ancestors and policies through cache
+ */
+static univention_policy_handle_t* policy_open(LDAP* ld, const char *base, const char *dn, struct univention_policy_cache_s *cache)
 {
 	const char* pdn;
 	int rc;
 	LDAPMessage *res;
 
-	struct timeval timeout = {.tv_sec=10, .tv_usec=0};
+	struct univention_policy_cache_entry_s **ancestors;
 	LDAPMessage	*entry;
 	struct berval		**vals;
 	int		i;
 	const char *filter = "(objectClass=*)";
 	char*		attrs[] = {"objectClass", "univentionPolicyReference", NULL};
+	char*		object_attrs[POLICY_FILTER_ATTRIBUTES + 2] = {"univentionPolicyReference"};
 
 	univention_policy_handle_t*	handle;
-	char **object_classes = NULL;
+	char **values[POLICY_FILTER_ATTRIBUTES] = {NULL};
+	int msgids[POLICY_MAX_DEPTH];
+	int depth, j;
 
 	univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "univention_policy_open with dn = %s", dn);
-	if ((handle = malloc(sizeof(univention_policy_handle_t))) == NULL)
+	if ((handle = calloc(1, sizeof(univention_policy_handle_t))) == NULL)
 		return NULL;
-	handle->policies = NULL;
+
+	/* fetch the attributes for evaluating ldapFilter with the object itself */
+	for (j = 0; j < POLICY_FILTER_ATTRIBUTES; j++)
+		object_attrs[j + 1] = univention_policy_filter_attributes[j];
+
+	/* send the searches for all parent tree nodes at once, answers are collected in order below. */
+	for (i = 0; i < POLICY_MAX_DEPTH; i++)
+		msgids[i] = -1;
+	for (pdn = dn, depth = 0; pdn != NULL && depth < POLICY_MAX_DEPTH; pdn = parent_dn(pdn), depth++) {
+		struct timeval timeout = {.tv_sec=10, .tv_usec=0};
+
+		if (pdn == dn || cache == NULL || policy_cache_find(cache->ancestors, pdn) == NULL) {
+			if (ldap_search_ext(ld, pdn, LDAP_SCOPE_BASE, pdn == dn ? filter : "(objectClass=univentionPolicyReference)", pdn == dn ? object_attrs : attrs, 0, NULL, NULL, &timeout, 0, &msgids[depth]) != LDAP_SUCCESS)
+				msgids[depth] = -1;
+		}
+		if (strcmp(pdn, base) == 0)
+			break;
+	}
 
 	/* iterate over all parent tree nodes. */
-	for (pdn = dn; pdn != NULL; pdn = parent_dn(pdn)) {
+	for (pdn = dn, depth = 0; pdn != NULL; pdn = parent_dn(pdn), depth++) {
 		univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "processing dn %s", pdn);
 
-		rc = ldap_search_ext_s(ld, pdn, LDAP_SCOPE_BASE, filter, attrs, 0, NULL, NULL, &timeout, 0, &res);
+		/* the object itself is never shared */
+		ancestors = (cache && pdn != dn) ? cache->ancestors : NULL;
+		rc = policy_search(ld, ancestors, pdn, filter, pdn == dn ? object_attrs : attrs, depth < POLICY_MAX_DEPTH ? msgids[depth] : -1, &res);
+		if (depth < POLICY_MAX_DEPTH)
+			msgids[depth] = -1;
 		if (rc == LDAP_NO_SUCH_OBJECT) {
 			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Not found");
 		} else if (rc != LDAP_SUCCESS) {
 			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ERROR, "%s: %s", pdn, ldap_err2string(rc));
-			ldap_msgfree(res);
+			policy_search_free(ancestors, rc, res);
+			/* drop the answers not collected yet */
+			for (i = 0; i < POLICY_MAX_DEPTH; i++) {
+				if (msgids[i] != -1)
+					ldap_abandon_ext(ld, msgids[i], NULL, NULL);
+			}
+			for (j = 0; j < POLICY_FILTER_ATTRIBUTES; j++)
+				FREE_ARRAY(values[j]);
 			univention_policy_close(handle);
 			return NULL;
 		} else {
@@ -442,17 +877,14 @@ univention_policy_handle_t* univention_policy_open(LDAP* ld, const char *base, c
 
 				dprint_dn(ld, entry);
 
-				/* only get all 'objectClass' attributes from dn. */
-				if (pdn == dn && (vals = ldap_get_values_len(ld, entry, "objectClass")) != NULL) {
-					univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "get object classes for %s", pdn);
-					i = ldap_count_values_len(vals);
-					if ((object_classes = calloc(i + 1, sizeof(char *))) == NULL)
-						perror("calloc");
-					for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++) {
-						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "   object class: %s", vals[i]->bv_val);
-						object_classes[i] = strdup(vals[i]->bv_val);
-					}
-					object_classes[i] = NULL;
+				/* only get all 'objectClass' and filter attributes from dn. */
+				for (j = 0; pdn == dn && j < POLICY_FILTER_ATTRIBUTES; j++) {
+					if ((vals = ldap_get_values_len(ld, entry, univention_policy_filter_attributes[j])) == NULL)
+						continue;
+					univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "get %s for %s", univention_policy_filter_attributes[j], pdn);
+					values[j] = policy_values_dup(vals);
+					for (i = 0; values[j] != NULL && values[j][i] != NULL; i++)
+						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "   %s: %s", univention_policy_filter_attributes[j], values[j][i]);
 					ldap_value_free_len(vals);
 				}
 
@@ -461,14 +893,14 @@ univention_policy_handle_t* univention_policy_open(LDAP* ld, const char *base, c
 					univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "found policies for %s", pdn);
 					for (i = 0; (vals[i] != NULL && vals[i]->bv_val != NULL); i++) {
 						univention_debug(UV_DEBUG_POLICY, UV_DEBUG_INFO, "   policy: %s", vals[i]->bv_val);
-						univention_policy_merge(ld, vals[i]->bv_val, handle, object_classes, dn);
+						univention_policy_merge(ld, vals[i]->bv_val, handle, values, dn, cache);
 					}
 					ldap_value_free_len(vals);
 				}
 			}
 		}
 
-		ldap_msgfree( res );
+		policy_search_free(ancestors, rc, res);
 		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ALL, "Search done.");
 
 		if (strcmp(pdn, base) == 0)
@@ -476,13 +908,56 @@ univention_policy_handle_t* univention_policy_open(LDAP* ld, const char *base, c
 
 		filter = "(objectClass=univentionPolicyReference)";
 	}
-	FREE_ARRAY(object_classes);
+	for (j = 0; j < POLICY_FILTER_ATTRIBUTES; j++)
+		FREE_ARRAY(values[j]);
 
 	univention_policy_cleanup(handle);
 
 	return handle;
 }
 
+/*
+ * reads policies for dn from conn
+ */
+univention_policy_handle_t* univention_policy_open(LDAP* ld, const char *base, const char *dn)
+{
+	univention_policy_handle_t *handle;
+
+	if ((handle = univention_policy_index_get(base, dn)) != NULL)
+		return handle;
+	policy_cache_validate(ld, base);
+	return policy_open(ld, base, dn, NULL);
+}
+
+/*
+ * reads policies for all dns from conn, fetching common ancestors and policies only once
+ */
+size_t univention_policy_open_many(LDAP *ld, const char *base, const char *const dns[], univention_policy_handle_t *handles[], size_t count)
+{
+	struct univention_policy_cache_s *cache;
+	size_t i, found = 0;
+
+	if ((cache = calloc(1, sizeof(struct univention_policy_cache_s))) == NULL) {
+		for (i = 0; i < count; i++)
+			handles[i] = NULL;
+		return 0;
+	}
+
+	policy_cache_validate(ld, base);
+	for (i = 0; i < count; i++) {
+		if ((handles[i] = univention_policy_index_get(base, dns[i])) == NULL)
+			handles[i] = policy_open(ld, base, dns[i], cache);
+		if (handles[i] != NULL)
+			found++;
+	}
+
+	policy_cache_clear(cache->ancestors);
+	policy_objects_clear(cache->policies);
+	FREE(cache);
+
+	return found;
+}
+
 /*
  * returns values for policy/attribute
  */
@@ -490,8 +965,8 @@ univention_policy_result_t* univention_policy_get(univention_policy_handle_t* ha
 {
 	struct univention_policy_list_s* policy;
 	struct univention_policy_attribute_list_s* attribute;
-	policy = univention_policy_list_get(&handle->policies, policy_name);
-	attribute = univention_policy_attribute_list_get(&policy->attributes, attribute_name);
+	policy = univention_policy_list_get(handle, policy_name);
+	attribute = univention_policy_attribute_list_get(policy, attribute_name);
 	return attribute->values;
 }
 
@@ -507,3 +982,135 @@ void univention_policy_close(univention_policy_handle_t* handle)
 	}
 	FREE(handle);
 }
+
+/* Append the NUL-terminated str to the buffer of dump. */
+static bool policy_dump_add(char **data, size_t *size, size_t *used, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *tmp;
+
+	if (*used + len > *size) {
+		while (*used + len > *size)
+			*size = *size ? *size * 2 : 1024;
+		if ((tmp = realloc(*data, *size)) == NULL)
+			return false;
+		*data = tmp;
+	}
+	memcpy(*data + *used, str, len);
+	*used += len;
+	return true;
+}
+
+/*
+ * serializes the policies of handle for univention_policy_load()
+ */
+char *univention_policy_dump(univention_policy_handle_t *handle, size_t *size)
+{
+	struct univention_policy_list_s *policy;
+	struct univention_policy_attribute_list_s *attribute;
+	char *data = NULL, count[16];
+	size_t allocated = 0;
+	bool ok = true;
+	int i;
+
+	*size = 0;
+	for (policy = handle->policies; ok && policy != NULL; policy = policy->next) {
+		for (attribute = policy->attributes; ok && attribute != NULL; attribute = attribute->next) {
+			if (attribute->values == NULL || attribute->values->values == NULL)
+				continue;
+			snprintf(count, sizeof(count), "%d", attribute->values->count);
+			ok = policy_dump_add(&data, &allocated, size, policy->name) &&
+				policy_dump_add(&data, &allocated, size, attribute->name) &&
+				policy_dump_add(&data, &allocated, size, attribute->values->policy_dn ? attribute->values->policy_dn : "") &&
+				policy_dump_add(&data, &allocated, size, count);
+			for (i = 0; ok && i < attribute->values->count; i++)
+				ok = policy_dump_add(&data, &allocated, size, attribute->values->values[i]);
+		}
+	}
+	if (!ok) {
+		FREE(data);
+		*size = 0;
+		return NULL;
+	}
+	/* no policies at all */
+	if (data == NULL && (data = malloc(1)) != NULL)
+		data[0] = '\0';
+	return data;
+}
+
+/* Return the next NUL-terminated string of data, NULL at the end or if it is not terminated. */
+static const char *policy_load_next(const char **data, const char *end)
+{
+	const char *str = *data, *nul;
+
+	if (str >= end || (nul = memchr(str, '\0', end - str)) == NULL)
+		return NULL;
+	*data = nul + 1;
+	return str;
+}
+
+/*
+ * creates a handle from the policies serialized by univention_policy_dump()
+ */
+univention_policy_handle_t *univention_policy_load(const char *data, size_t size)
+{
+	univention_policy_handle_t *handle;
+	struct univention_policy_list_s *policy;
+	struct univention_policy_attribute_list_s *attribute;
+	const char *end = data + size, *name, *attr, *dn, *count, *value;
+	char *tail;
+	long n;
+	int i;
+
+	if ((handle = calloc(1, sizeof(univention_policy_handle_t))) == NULL)
+		return NULL;
+	while (data < end && !(size == 1 && *data == '\0')) {
+		if ((name = policy_load_next(&data, end)) == NULL || (attr = policy_load_next(&data, end)) == NULL ||
+		    (dn = policy_load_next(&data, end)) == NULL || (count = policy_load_next(&data, end)) == NULL)
+			goto error;
+		n = strtol(count, &tail, 10);
+		if (*tail != '\0' || n < 0 || n > (long)size)
+			goto error;
+		if ((policy = univention_policy_list_get(handle, name)) == NULL || (attribute = univention_policy_attribute_list_get(policy, attr)) == NULL)
+			goto error;
+		univention_policy_result_free(attribute->values);
+		if ((attribute->values = calloc(1, sizeof(univention_policy_result_t))) == NULL)
+			goto error;
+		attribute->values->policy_dn = strdup(dn);
+		if ((attribute->values->values = calloc(n + 1, sizeof(char *))) == NULL)
+			goto error;
+		for (i = 0; i < n; i++) {
+			if ((value = policy_load_next(&data, end)) == NULL)
+				goto error;
+			attribute->values->values[i] = strdup(value);
+			attribute->values->count++;
+		}
+	}
+	return handle;
+
+error:
+	univention_debug(UV_DEBUG_POLICY, UV_DEBUG_ERROR, "invalid serialized policies");
+	univention_policy_close(handle);
+	return NULL;
+}
+
+/*
+ * enables the process-wide policy cache, revalidated every ttl seconds; 0 disables it
+ */
+void univention_policy_cache_set_ttl(unsigned int ttl)
+{
+	policy_cache.ttl = ttl;
+	policy_cache.checked = 0;
+	if (!ttl)
+		univention_policy_cache_clear();
+}
+
+/*
+ * drops all cached policy objects
+ */
+void univention_policy_cache_clear(void)
+{
+	policy_objects_clear(policy_cache.objects);
+	FREE(policy_cache.csn);
+	policy_cache.checked = 0;
+}
@@ -32,6 +32,7 @@
  * /usr/share/common-licenses/AGPL-3; if not, see
  * <https://www.gnu.org/licenses/>.
  */
+#define _GNU_SOURCE
 #include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -40,6 +41,8 @@
 #include <ldap.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdbool.h>
 
 #include <univention/config.h>
 #include <univention/debug.h>
@@ -48,7 +51,7 @@
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: univention_policy_result [-h <host>] [-D <binddn>] [-w <bindpw> | -y <pwfile> | -W] [-p port] [-s | -b] dn\n");
+	fprintf(stderr, "Usage: univention_policy_result [-h <host>] [-D <binddn>] [-w <bindpw> | -y <pwfile> | -W] [-p port] [-s | -b | -J] [-I] [-j jobs] dn...\n");
 	fprintf(stderr, "  -h host    LDAP server\n");
 	fprintf(stderr, "  -D binddn  bind DN\n");
 	fprintf(stderr, "  -W         prompt for password on the command line\n");
@@ -57,6 +60,9 @@ static void usage(void)
 	fprintf(stderr, "  -p port    port number where the ldap server is listening\n");
 	fprintf(stderr, "  -s         Shell output\n");
 	fprintf(stderr, "  -b         Basic output\n");
+	fprintf(stderr, "  -J, --json JSON output, one line per dn\n");
+	fprintf(stderr, "  -I, --stdin  Read additional dns from stdin, one per line\n");
+	fprintf(stderr, "  -j, --jobs jobs  Number of worker threads and connections\n");
 	fprintf(stderr, "  -d         Enable debug\n");
 }
 
@@ -114,24 +120,238 @@ static char* read_password_file(char* filename)
 #define OUTPUT_VERBOSE 0
 #define OUTPUT_SHELL 1
 #define OUTPUT_BASECONFIG 2
+#define OUTPUT_JSON 3
+
+#define MAX_JOBS 64
+
+/* DNs resolved by one worker over its own connection. */
+struct job {
+	LDAP *ld;
+	const char *base;
+	char **dns;
+	size_t count;
+	char output;
+	char **out;  /* output per dn */
+	char **err;  /* error message per dn, NULL on success */
+};
+
+static void print_json_string(FILE *out, const char *s)
+{
+	putc('"', out);
+	for (; *s; s++) {
+		switch (*s) {
+			case '"':
+			case '\\':
+				fprintf(out, "\\%c", *s);
+				break;
+			case '\n':
+				fputs("\\n", out);
+				break;
+			default:
+				if ((unsigned char)*s < 0x20)
+					fprintf(out, "\\u%04x", *s);
+				else
+					putc(*s, out);
+		}
+	}
+	putc('"', out);
+}
+
+static void print_policy(FILE *out, univention_policy_handle_t *handle, char output, const char *dn)
+{
+	struct univention_policy_list_s* policy;
+	struct univention_policy_attribute_list_s* attribute;
+	bool first = true;
+
+	if (output == OUTPUT_JSON) {
+		fputs("{\"dn\": ", out);
+		print_json_string(out, dn);
+		fputs(", \"attributes\": [", out);
+	}
+	for (policy = handle->policies; policy != NULL; policy = policy->next) {
+		if (output == OUTPUT_BASECONFIG && policy != handle->policies)
+			fprintf(out, " ");
+		for (attribute = policy->attributes; attribute != NULL; attribute = attribute->next) {
+			int i, j;
+			if (attribute->values == NULL)
+				continue;
+			if (output == OUTPUT_VERBOSE) {
+				fprintf(out, "Policy: %s\n", attribute->values->policy_dn);
+				fprintf(out, "Attribute: %s\n", attribute->name);
+				for (i = 0; attribute->values->values[i] != NULL; i++)
+					fprintf(out, "Value: %s\n", attribute->values->values[i]);
+				fprintf(out, "\n");
+			} else if (output == OUTPUT_SHELL) {
+				for (i = 0; attribute->values->values[i] != NULL; i++) {
+					for (j = 0; j < strlen(attribute->name); j++) {
+						if (attribute->name[j] == ';' || attribute->name[j] == '-') {
+							fprintf(out, "_");
+						} else {
+							fprintf(out, "%c", attribute->name[j]);
+						}
+					}
+					char *c;
+					fprintf(out, "=\"");
+					for (c = attribute->values->values[i]; *c; c++) {
+						switch (*c) {
+							case '"':
+							case '$':
+							case '\\':
+							case '`':
+								putc('\\', out);
+							default:
+								putc(*c, out);
+						}
+					}
+					fprintf(out, "\"\n");
+				}
+			} else if (output == OUTPUT_JSON) {
+				if (!first)
+					fputs(", ", out);
+				first = false;
+				fputs("{\"policy\": ", out);
+				print_json_string(out, attribute->values->policy_dn);
+				fputs(", \"attribute\": ", out);
+				print_json_string(out, attribute->name);
+				fputs(", \"values\": [", out);
+				for (i = 0; attribute->values->values[i] != NULL; i++) {
+					if (i > 0)
+						fputs(", ", out);
+					print_json_string(out, attribute->values->values[i]);
+				}
+				fputs("]}", out);
+			} else { /* output == OUTPUT_BASECONFIG */
+				if (attribute != policy->attributes)
+					fprintf(out, " ");
+				for (i = 0; attribute->values->values[i] != NULL; i++) {
+					if (i > 0)
+						fprintf(out, " ");
+					fprintf(out, "%s=\"%s\"", attribute->name, attribute->values->values[i]);
+				}
+			}
+		}
+	}
+	if (output == OUTPUT_JSON)
+		fputs("]}\n", out);
+}
+
+/* Resolve policies of all dns of job, formatting the output per dn. */
+static void *resolve(void *arg)
+{
+	struct job *job = arg;
+	univention_policy_handle_t **handles;
+	char **found;
+	size_t i, n = 0;
+
+	if (job->count == 0)
+		return NULL;
+	if ((handles = calloc(job->count, sizeof(univention_policy_handle_t *))) == NULL ||
+		(found = calloc(job->count, sizeof(char *))) == NULL) {
+		perror("calloc");
+		free(handles);
+		return NULL;
+	}
+
+	for (i = 0; i < job->count; i++) {
+		struct timeval timeout = {.tv_sec=10, .tv_usec=0};
+		char *attrs[] = {LDAP_NO_ATTRS, NULL};
+		LDAPMessage *res;
+		int rc;
+
+		if ((rc = ldap_search_ext_s(job->ld, job->dns[i], LDAP_SCOPE_BASE, "(objectClass=*)", attrs, 0, NULL, NULL, &timeout, 0, &res)) != LDAP_SUCCESS) {
+			if (asprintf(&job->err[i], "LDAP Error: %s\n", ldap_err2string(rc)) < 0)
+				job->err[i] = NULL;
+		} else {
+			found[n++] = job->dns[i];
+		}
+		ldap_msgfree(res);
+	}
+
+	univention_policy_open_many(job->ld, job->base, (const char *const *)found, handles, n);
+
+	for (i = 0, n = 0; i < job->count; i++) {
+		size_t size;
+		FILE *out;
+
+		if (job->err[i] != NULL)
+			continue;
+		if ((out = open_memstream(&job->out[i], &size)) == NULL) {
+			perror("open_memstream");
+			univention_policy_close(handles[n++]);
+			continue;
+		}
+		if (job->output == OUTPUT_VERBOSE) {
+			fprintf(out, "DN: %s\n\n", job->dns[i]);
+			fprintf(out, "POLICY %s\n\n", job->dns[i]);
+		}
+		if (handles[n] != NULL) {
+			print_policy(out, handles[n], job->output, job->dns[i]);
+			univention_policy_close(handles[n]);
+		} else {
+			job->err[i] = strdup("could not open policy\n");
+		}
+		n++;
+		fclose(out);
+	}
+
+	free(found);
+	free(handles);
+	return NULL;
+}
+
+/* Append dns read from stdin, one per line. */
+static char **read_dns(char **dns, size_t *count)
+{
+	char *line = NULL;
+	size_t len = 0;
+	ssize_t r;
+
+	while ((r = getline(&line, &len, stdin)) != -1) {
+		char **tmp;
+		while (r > 0 && (line[r - 1] == '\n' || line[r - 1] == '\r'))
+			line[--r] = '\0';
+		if (r == 0)
+			continue;
+		if ((tmp = realloc(dns, (*count + 1) * sizeof(char *))) == NULL) {
+			perror("realloc");
+			break;
+		}
+		dns = tmp;
+		dns[(*count)++] = strdup(line);
+	}
+	free(line);
+	return dns;
+}
 
 int main(int argc, char* argv[])
 {
 	int rc = 1;
 	int noLdapServer = 1;
-	char *dn;
 	univention_ldap_parameters_t* ldap_parameters;
-	univention_policy_handle_t* handle;
+	univention_ldap_parameters_t* workers[MAX_JOBS] = {NULL};
+	pthread_t threads[MAX_JOBS];
+	bool started[MAX_JOBS] = {false};
+	struct job jobs[MAX_JOBS];
 	char opt_debug = 0;
+	char opt_stdin = 0;
+	int opt_jobs = 1;
 	char output = OUTPUT_VERBOSE;
-	LDAPMessage	*res;
-	struct  timeval	timeout;
+	char **dns = NULL;
+	char **out = NULL, **err = NULL;
+	size_t count = 0, chunk, i;
+	int j;
+	static const struct option long_options[] = {
+		{"json", no_argument, NULL, 'J'},
+		{"stdin", no_argument, NULL, 'I'},
+		{"jobs", required_argument, NULL, 'j'},
+		{NULL, 0, NULL, 0}
+	};
 
 	if ((ldap_parameters = univention_ldap_new()) == NULL)
 		return 1;
 
 	int c;
-	while ((c = getopt(argc, argv, ":h:p:D:w:Wdsby:")) != -1) {
+	while ((c = getopt_long(argc, argv, ":h:p:D:w:Wdsby:JIj:", long_options, NULL)) != -1) {
 		switch (c) {
 			case 'h':
 				ldap_parameters->host = strdup(optarg);
@@ -166,6 +386,18 @@ int main(int argc, char* argv[])
 			case 'b':
 				output = OUTPUT_BASECONFIG;
 				break;
+			case 'J':
+				output = OUTPUT_JSON;
+				break;
+			case 'I':
+				opt_stdin = 1;
+				break;
+			case 'j':
+				if (sscanf(optarg, "%d", &opt_jobs) != 1 || opt_jobs < 1 || opt_jobs > MAX_JOBS) {
+					fprintf(stderr, "the given number of jobs '%s' is unusable, use 1 to %d\n", optarg, MAX_JOBS);
+					goto err2;
+				}
+				break;
 			case 'y':
 				ldap_parameters->bindpw = read_password_file(optarg);
 				if (ldap_parameters->bindpw == NULL) {
@@ -183,7 +415,7 @@ int main(int argc, char* argv[])
 		}
 	}
 
-	if (optind + 1 != argc) {
+	if (optind >= argc && !opt_stdin) {
 		univention_ldap_close(ldap_parameters);
 		usage();
 		goto err1;
@@ -197,7 +429,18 @@ int main(int argc, char* argv[])
 		univention_debug_init("/dev/null", 0, 0);
 	}
 
-	dn = argv[argc - 1];
+	if ((dns = calloc(argc - optind + 1, sizeof(char *))) == NULL) {
+		perror("calloc");
+		goto err2;
+	}
+	for (j = optind; j < argc; j++)
+		dns[count++] = strdup(argv[j]);
+	if (opt_stdin)
+		dns = read_dns(dns, &count);
+	if (count == 0) {
+		rc = 0;
+		goto err2;
+	}
 
 	/* if no host/uri is set in ldap_parameters univention_ldap_open uses
 	ldap/server/name. We try ldap/server/addition too, if no host/uri
@@ -225,88 +468,89 @@ int main(int argc, char* argv[])
 			free(addition);
 		}
 		if (! gotConnection) {
-			fprintf(stderr, "could not open policy for %s\n\n", dn);
+			fprintf(stderr, "could not open policy for %s\n\n", dns[0]);
 			goto err2;
 		}
 	}
 
-	timeout.tv_sec = 10;
-	timeout.tv_usec = 0;
-
-	if ((rc = ldap_search_ext_s(ldap_parameters->ld, dn, LDAP_SCOPE_BASE, "(objectClass=*)",  NULL, 0, NULL, NULL, &timeout, 0, &res )) != LDAP_SUCCESS) {
-			fprintf(stderr, "LDAP Error: %s\n", ldap_err2string(rc));
-			ldap_msgfree(res);
-			goto err2;
+	/* one connection per worker, opened here as the connection pool is not thread safe */
+	workers[0] = ldap_parameters;
+	if ((size_t)opt_jobs > count)
+		opt_jobs = count;
+	for (j = 1; j < opt_jobs; j++) {
+		if ((workers[j] = univention_ldap_new()) == NULL)
+			break;
+		workers[j]->host = ldap_parameters->host ? strdup(ldap_parameters->host) : NULL;
+		workers[j]->uri = ldap_parameters->uri ? strdup(ldap_parameters->uri) : NULL;
+		workers[j]->port = ldap_parameters->port;
+		workers[j]->base = strdup(ldap_parameters->base);
+		workers[j]->binddn = ldap_parameters->binddn ? strdup(ldap_parameters->binddn) : NULL;
+		workers[j]->bindpw = ldap_parameters->bindpw ? strdup(ldap_parameters->bindpw) : NULL;
+		if (univention_ldap_open(workers[j]) != 0) {
+			univention_ldap_close(workers[j]);
+			workers[j] = NULL;
+			break;
+		}
 	}
-	ldap_msgfree(res);
+	opt_jobs = j;
 
-	if (output == OUTPUT_VERBOSE) {
-		printf("DN: %s\n\n", dn);
+	if ((out = calloc(count, sizeof(char *))) == NULL || (err = calloc(count, sizeof(char *))) == NULL) {
+		perror("calloc");
+		rc = 1;
+		goto err2;
 	}
-
-	if (output == OUTPUT_VERBOSE) {
-		printf("POLICY %s\n\n", dn);
+	chunk = (count + opt_jobs - 1) / opt_jobs;
+	for (j = 0; j < opt_jobs; j++) {
+		size_t first = j * chunk;
+		jobs[j].ld = workers[j]->ld;
+		jobs[j].base = workers[j]->base;
+		jobs[j].dns = dns + first;
+		jobs[j].count = first < count ? (count - first < chunk ? count - first : chunk) : 0;
+		jobs[j].output = output;
+		jobs[j].out = out + first;
+		jobs[j].err = err + first;
+	}
+	for (j = 1; j < opt_jobs; j++) {
+		if (pthread_create(&threads[j], NULL, resolve, &jobs[j]) != 0) {
+			/* resolve the remaining jobs here */
+			perror("pthread_create");
+			break;
+		}
+		started[j] = true;
+	}
+	resolve(&jobs[0]);
+	for (j = 1; j < opt_jobs; j++) {
+		if (started[j])
+			pthread_join(threads[j], NULL);
+		else
+			resolve(&jobs[j]);
 	}
-	if ((handle = univention_policy_open(ldap_parameters->ld, ldap_parameters->base, dn)) != NULL) {
-		struct univention_policy_list_s* policy;
-		struct univention_policy_attribute_list_s* attribute;
 
-		for (policy = handle->policies; policy != NULL; policy = policy->next) {
-			if (output == OUTPUT_BASECONFIG && policy != handle->policies)
-				printf(" ");
-			for (attribute = policy->attributes; attribute != NULL; attribute = attribute->next) {
-				int i, j;
-				if (attribute->values == NULL)
-					continue;
-				if (output == OUTPUT_VERBOSE) {
-					printf("Policy: %s\n", attribute->values->policy_dn);
-					printf("Attribute: %s\n", attribute->name);
-					for (i = 0; attribute->values->values[i] != NULL; i++)
-						printf("Value: %s\n", attribute->values->values[i]);
-					printf("\n");
-				} else if (output == OUTPUT_SHELL) {
-					for (i = 0; attribute->values->values[i] != NULL; i++) {
-						for (j = 0; j < strlen(attribute->name); j++) {
-							if (attribute->name[j] == ';' || attribute->name[j] == '-') {
-								printf("_");
-							} else {
-								printf("%c", attribute->name[j]);
-							}
-						}
-						char *c;
-						printf("=\"");
-						for (c = attribute->values->values[i]; *c; c++) {
-							switch (*c) {
-								case '"':
-								case '$':
-								case '\\':
-								case '`':
-									putchar('\\');
-								default:
-									putchar(*c);
-							}
-						}
-						printf("\"\n");
-					}
-				} else { /* output == OUTPUT_BASECONFIG */
-					if (attribute != policy->attributes)
-						printf(" ");
-					for (i = 0; attribute->values->values[i] != NULL; i++) {
-						if (i > 0)
-							printf(" ");
-						printf("%s=\"%s\"", attribute->name, attribute->values->values[i]);
-					}
-				}
-			}
+	rc = 0;
+	for (i = 0; i < count; i++) {
+		if (out[i] != NULL) {
+			fputs(out[i], stdout);
+			if (output == OUTPUT_BASECONFIG && count > 1)
+				putchar('\n');
 		}
-		univention_policy_close(handle);
-		rc = 0;
-	} else {
-		rc = 1;
-		fprintf(stderr, "could not open policy\n");
+		if (err[i] != NULL) {
+			fputs(err[i], stderr);
+			rc = 1;
+		} else if (out[i] == NULL) {
+			rc = 1;
+		}
+		FREE(out[i]);
+		FREE(err[i]);
 	}
 err2:
+	for (j = 1; j < MAX_JOBS; j++)
+		univention_ldap_close(workers[j]);
 	univention_ldap_close(ldap_parameters);
+	for (i = 0; i < count; i++)
+		FREE(dns[i]);
+	FREE(dns);
+	FREE(out);
+	FREE(err);
 err1:
 	univention_debug_exit();
 	return rc;
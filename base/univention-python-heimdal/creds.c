@@ -103,12 +103,14 @@ krb5CredsObject *creds_new(PyObject *unused, PyObject *args)
 	Py_INCREF(context);
 	self->context = context;
 
+	Py_BEGIN_ALLOW_THREADS
 	err = krb5_get_init_creds_password(self->context->context, &self->creds,
 			principal->principal, NULL, kerb_prompter, password_string,
 			0, in_tkt_service, NULL);
+	Py_END_ALLOW_THREADS
 	if (err) {
-		Py_DECREF(self);
 		krb5_exception(self->context->context, err);
+		Py_DECREF(self);
 		return NULL;
 	}
 
@@ -174,8 +176,10 @@ static PyObject *creds_change_password(krb5CredsObject *self, PyObject *args)
 		return NULL;
 
 	// principal is set to NULL -> set_password uses the default principal in set case
+	Py_BEGIN_ALLOW_THREADS
 	err = krb5_set_password(self->context->context, &self->creds, newpw, NULL, &result_code,
 			&result_code_string, &result_string);
+	Py_END_ALLOW_THREADS
 	if (err) {
 		krb5_exception(self->context->context, err);
 		return NULL;
@@ -70,15 +70,19 @@ krb5KeyblockObject *keyblock_new(PyObject *unused, PyObject *args)
 #if PY_MAJOR_VERSION >= 2 && PY_MINOR_VERSION >= 2
 	if (PyObject_TypeCheck(arg, &krb5SaltType)) {
 		krb5SaltObject *salt = (krb5SaltObject*)arg;
+		Py_BEGIN_ALLOW_THREADS
 		err = krb5_string_to_key_salt(context->context, enctype->enctype, password,
 				salt->salt, &self->keyblock);
+		Py_END_ALLOW_THREADS
 	} else if (PyObject_TypeCheck(arg, &krb5PrincipalType)) {
 #else
 	if (1) {
 #endif
 		krb5PrincipalObject *principal = (krb5PrincipalObject*)arg;
+		Py_BEGIN_ALLOW_THREADS
 		err = krb5_string_to_key(context->context, enctype->enctype, password,
 				principal->principal, &self->keyblock);
+		Py_END_ALLOW_THREADS
 	} else {
 		PyErr_SetString(PyExc_TypeError, "either principal or salt needs to be passed");
 		Py_DECREF(self);
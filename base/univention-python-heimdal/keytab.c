@@ -156,6 +156,7 @@ static PyObject *keytab_add(krb5KeytabObject *self, PyObject *args)
 		}
 	}
 
+	Py_BEGIN_ALLOW_THREADS
 	if(password_string) {
 		if (!salt_flag) {
 			krb5_salt salt;
@@ -179,6 +180,7 @@ static PyObject *keytab_add(krb5KeytabObject *self, PyObject *args)
 	entry.vno = kvno;
 	entry.timestamp = time (NULL);
 	err = krb5_kt_add_entry(self->context->context, self->keytab, &entry);
+	Py_END_ALLOW_THREADS
 	if(err) {
 		krb5_exception(self->context->context, err, "add");
 		goto out;
@@ -190,32 +192,64 @@ static PyObject *keytab_add(krb5KeytabObject *self, PyObject *args)
 	Py_RETURN_NONE;
 }
 
-static PyObject *keytab_list(krb5KeytabObject *self)
+static PyObject *keytab_list(krb5KeytabObject *self, PyObject *args, PyObject *kwds)
 {
+	static char *kwlist[] = {"principal", "kvno", NULL};
 	krb5_error_code err;
 	krb5_keytab_entry entry;
 	krb5_kt_cursor cursor;
 	PyObject *list = NULL;
+	char *principal_string = NULL;
+	krb5_principal principal_filter = NULL;
+	int kvno_filter = -1;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zi", kwlist, &principal_string, &kvno_filter))
+		return NULL;
 
+	if (principal_string) {
+		err = krb5_parse_name(self->context->context, principal_string, &principal_filter);
+		if (err) {
+			krb5_exception(self->context->context, err, "%s", principal_string);
+			return NULL;
+		}
+	}
+
+	Py_BEGIN_ALLOW_THREADS
 	err = krb5_kt_start_seq_get(self->context->context, self->keytab, &cursor);
+	Py_END_ALLOW_THREADS
 	if(err) {
 		krb5_exception(self->context->context, err, "krb5_kt_start_seq_get");
-		return NULL;
+		goto out;
 	}
 
 	if ((list = PyList_New(0)) == NULL) {
 		krb5_kt_end_seq_get(self->context->context, self->keytab, &cursor);
-		return PyErr_NoMemory();
+		PyErr_NoMemory();
+		goto out;
 	}
 
-	while((err = krb5_kt_next_entry(self->context->context, self->keytab, &entry, &cursor)) == 0){
+	for (;;) {
 		char *etype, *principal;
 		PyObject *tuple;
 
+		Py_BEGIN_ALLOW_THREADS
+		err = krb5_kt_next_entry(self->context->context, self->keytab, &entry, &cursor);
+		Py_END_ALLOW_THREADS
+		if (err)
+			break;
+
+		if ((kvno_filter >= 0 && entry.vno != (krb5_kvno)kvno_filter) ||
+				(principal_filter && !krb5_principal_compare(self->context->context, entry.principal, principal_filter))) {
+			krb5_kt_free_entry(self->context->context, &entry);
+			continue;
+		}
+
 		if ((tuple = PyTuple_New(5)) == NULL) {
 			krb5_kt_free_entry(self->context->context, &entry);
-			Py_DECREF(list);
-			return PyErr_NoMemory();
+			krb5_kt_end_seq_get(self->context->context, self->keytab, &cursor);
+			Py_CLEAR(list);
+			PyErr_NoMemory();
+			goto out;
 		};
 
 		PyTuple_SetItem(tuple, 0, PyInt_FromLong(entry.vno));
@@ -224,9 +258,11 @@ static PyObject *keytab_list(krb5KeytabObject *self)
 		if (err != 0) {
 			if (asprintf(&etype, "unknown (%d)", entry.keyblock.keytype) < 0) {
 				krb5_kt_free_entry(self->context->context, &entry);
+				krb5_kt_end_seq_get(self->context->context, self->keytab, &cursor);
 				Py_DECREF(tuple);
-				Py_DECREF(list);
-				return PyErr_NoMemory();
+				Py_CLEAR(list);
+				PyErr_NoMemory();
+				goto out;
 			}
 		}
 
@@ -254,9 +290,201 @@ static PyObject *keytab_list(krb5KeytabObject *self)
 	}
 	krb5_kt_end_seq_get(self->context->context, self->keytab, &cursor);
 
+ out:
+	if (principal_filter)
+		krb5_free_principal(self->context->context, principal_filter);
+
 	return list;
 }
 
+struct keytab_add_item {
+	Py_ssize_t principal;	/* index into principals and passwords */
+	krb5_kvno kvno;
+	krb5_enctype enctype;
+};
+
+struct keytab_enctype_cache {
+	PyObject *name;
+	krb5_enctype enctype;
+};
+
+/* Entries usually share a handful of enctypes, so parse each name only once. */
+static int keytab_lookup_enctype(krb5KeytabObject *self, struct keytab_enctype_cache *cache, size_t *n_cache, size_t max_cache, PyObject *name, krb5_enctype *enctype)
+{
+	krb5_error_code err;
+	const char *enctype_string;
+	size_t i;
+	int t;
+
+	for (i = 0; i < *n_cache; i++) {
+		int cmp = PyObject_RichCompareBool(cache[i].name, name, Py_EQ);
+		if (cmp < 0)
+			return -1;
+		if (cmp) {
+			*enctype = cache[i].enctype;
+			return 0;
+		}
+	}
+
+	if ((enctype_string = PyUnicode_AsUTF8(name)) == NULL)
+		return -1;
+	err = krb5_string_to_enctype(self->context->context, enctype_string, enctype);
+	if (err) {
+		if (sscanf(enctype_string, "%d", &t) == 1)
+			*enctype = t;
+		else {
+			krb5_exception(self->context->context, err, "%s", enctype_string);
+			return -1;
+		}
+	}
+
+	if (*n_cache < max_cache) {
+		Py_INCREF(name);
+		cache[*n_cache].name = name;
+		cache[*n_cache].enctype = *enctype;
+		(*n_cache)++;
+	}
+	return 0;
+}
+
+static PyObject *keytab_add_many(krb5KeytabObject *self, PyObject *args, PyObject *kwds)
+{
+	static char *kwlist[] = {"entries", "salt_flag", NULL};
+	krb5_error_code err = 0;
+	PyObject *entries, *seq = NULL, *result = NULL;
+	int salt_flag = 1;
+	struct keytab_enctype_cache cache[16];
+	size_t n_cache = 0;
+	krb5_principal *principals = NULL;
+	char **passwords = NULL;
+	struct keytab_add_item *items = NULL;
+	Py_ssize_t n_entries, n_principals = 0, n_items = 0, max_items = 0, i, j;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", kwlist, &entries, &salt_flag))
+		return NULL;
+
+	if ((seq = PySequence_Fast(entries, "entries must be a sequence")) == NULL)
+		return NULL;
+	n_entries = PySequence_Fast_GET_SIZE(seq);
+
+	principals = PyMem_Calloc(n_entries ? n_entries : 1, sizeof(*principals));
+	passwords = PyMem_Calloc(n_entries ? n_entries : 1, sizeof(*passwords));
+	if (principals == NULL || passwords == NULL) {
+		PyErr_NoMemory();
+		goto out;
+	}
+
+	/* Convert everything while holding the GIL, the keys are derived and
+	 * written in one go afterwards. */
+	for (i = 0; i < n_entries; i++) {
+		PyObject *entry = PySequence_Fast_GET_ITEM(seq, i);
+		PyObject *enctypes, *enctypes_seq;
+		char *principal_string, *password_string;
+		int kvno;
+
+		if (!PyArg_ParseTuple(entry, "siOz;entries must be (principal, kvno, enctypes, password) tuples", &principal_string, &kvno, &enctypes, &password_string))
+			goto out;
+
+		err = krb5_parse_name(self->context->context, principal_string, &principals[n_principals]);
+		if (err) {
+			krb5_exception(self->context->context, err, "%s", principal_string);
+			goto out;
+		}
+		if (password_string && (passwords[n_principals] = strdup(password_string)) == NULL) {
+			krb5_free_principal(self->context->context, principals[n_principals]);
+			PyErr_NoMemory();
+			goto out;
+		}
+		n_principals++;
+
+		if ((enctypes_seq = PySequence_Fast(enctypes, "enctypes must be a sequence")) == NULL)
+			goto out;
+		for (j = 0; j < PySequence_Fast_GET_SIZE(enctypes_seq); j++) {
+			krb5_enctype enctype;
+
+			if (keytab_lookup_enctype(self, cache, &n_cache, sizeof(cache) / sizeof(cache[0]), PySequence_Fast_GET_ITEM(enctypes_seq, j), &enctype) < 0) {
+				Py_DECREF(enctypes_seq);
+				goto out;
+			}
+			if (n_items == max_items) {
+				struct keytab_add_item *tmp;
+				max_items = max_items ? 2 * max_items : 16;
+				if ((tmp = PyMem_Realloc(items, max_items * sizeof(*items))) == NULL) {
+					Py_DECREF(enctypes_seq);
+					PyErr_NoMemory();
+					goto out;
+				}
+				items = tmp;
+			}
+			items[n_items].principal = n_principals - 1;
+			items[n_items].kvno = kvno;
+			items[n_items].enctype = enctype;
+			n_items++;
+		}
+		Py_DECREF(enctypes_seq);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	time_t now = time(NULL);
+	for (i = 0; i < n_items && !err; i++) {
+		krb5_keytab_entry entry;
+		const char *password = passwords[items[i].principal];
+
+		memset(&entry, 0, sizeof(entry));
+		entry.principal = principals[items[i].principal];
+		if (password) {
+			if (!salt_flag) {
+				krb5_salt salt;
+				krb5_data pw;
+
+				salt.salttype         = KRB5_PW_SALT;
+				salt.saltvalue.data   = NULL;
+				salt.saltvalue.length = 0;
+				pw.data = (void*)password;
+				pw.length = strlen(password);
+				err = krb5_string_to_key_data_salt(self->context->context, items[i].enctype, pw, salt,
+						&entry.keyblock);
+			} else {
+				err = krb5_string_to_key(self->context->context, items[i].enctype, password,
+						entry.principal, &entry.keyblock);
+			}
+		} else {
+			err = krb5_generate_random_keyblock(self->context->context, items[i].enctype, &entry.keyblock);
+		}
+		if (err)
+			break;
+
+		entry.vno = items[i].kvno;
+		entry.timestamp = now;
+		err = krb5_kt_add_entry(self->context->context, self->keytab, &entry);
+		krb5_free_keyblock_contents(self->context->context, &entry.keyblock);
+	}
+	Py_END_ALLOW_THREADS
+
+	if (err) {
+		krb5_exception(self->context->context, err, "add");
+		goto out;
+	}
+	result = PyInt_FromLong(n_items);
+
+ out:
+	for (i = 0; i < n_principals; i++) {
+		krb5_free_principal(self->context->context, principals[i]);
+		if (passwords[i]) {
+			memset(passwords[i], 0, strlen(passwords[i]));
+			free(passwords[i]);
+		}
+	}
+	PyMem_Free(principals);
+	PyMem_Free(passwords);
+	PyMem_Free(items);
+	while (n_cache--)
+		Py_DECREF(cache[n_cache].name);
+	Py_DECREF(seq);
+
+	return result;
+}
+
 static PyObject *keytab_remove(krb5KeytabObject *self, PyObject *args)
 {
 	krb5_error_code err = 0;
@@ -299,7 +527,9 @@ static PyObject *keytab_remove(krb5KeytabObject *self, PyObject *args)
 	entry.principal = principal;
 	entry.keyblock.keytype = enctype;
 	entry.vno = kvno;
+	Py_BEGIN_ALLOW_THREADS
 	err = krb5_kt_remove_entry(self->context->context, self->keytab, &entry);
+	Py_END_ALLOW_THREADS
 
 	if(err) {
 		krb5_exception(self->context->context, err);
@@ -316,7 +546,8 @@ static PyObject *keytab_remove(krb5KeytabObject *self, PyObject *args)
 
 static struct PyMethodDef keytab_methods[] = {
 	{"add", (PyCFunction)keytab_add, METH_VARARGS, "Add principal to keytab"},
-	{"list", (PyCFunction)keytab_list, METH_NOARGS, "List keytab"},
+	{"add_many", (PyCFunction)keytab_add_many, METH_VARARGS | METH_KEYWORDS, "Add (principal, kvno, enctypes, password) entries to keytab"},
+	{"list", (PyCFunction)keytab_list, METH_VARARGS | METH_KEYWORDS, "List keytab, optionally only entries of principal and kvno"},
 	{"remove", (PyCFunction)keytab_remove, METH_VARARGS, "Remove principal from keytab"},
 	{NULL}
 };
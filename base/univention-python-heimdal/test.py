@@ -294,6 +294,29 @@ class TestKeytab(unittest.TestCase):
             assert timestamp > 0
             assert keyblock != ''
 
+    def test_keytab_add_many(self):
+        host = f'host/foo@{REALM}'
+        with NamedTemporaryFile() as tmpfile:
+            keytab = heimdal.keytab(self.context, tmpfile.name)
+            count = keytab.add_many([
+                (USER, KVNO, [ENCSTR, 'aes256-cts'], PASSWORD),
+                (host, 2, ['aes256-cts'], None),
+            ], salt_flag=0)
+            assert count == 3
+            assert len(keytab.list()) == 3
+            assert {enctype for (_kvno, enctype, _principal, _timestamp, _keyblock) in keytab.list(principal=USER)} == {ENCSTR, 'aes256-cts-hmac-sha1-96'}
+            ((kvno, enctype, principal, timestamp, keyblock),) = keytab.list(kvno=2)
+            assert principal == host
+            assert keytab.list(principal=host, kvno=KVNO) == []
+
+    def test_keytab_add_many_invalid(self):
+        with NamedTemporaryFile() as tmpfile:
+            keytab = heimdal.keytab(self.context, tmpfile.name)
+            with self.assertRaises(TypeError):
+                keytab.add_many([(USER, KVNO)])
+            with self.assertRaises(heimdal.Krb5Error):
+                keytab.add_many([(USER, KVNO, ['no-such-enctype'], PASSWORD)])
+
     def test_keytab_remove_missing(self):
         with NamedTemporaryFile() as tmpfile:
             keytab = heimdal.keytab(self.context, tmpfile.name)
@@ -313,7 +336,7 @@ class TestKeytab(unittest.TestCase):
     def test_dir(self):
         with NamedTemporaryFile() as tmpfile:
             keytab = heimdal.keytab(self.context, tmpfile.name)
-            assert {'add', 'list', 'remove'} <= set(dir(keytab))
+            assert {'add', 'add_many', 'list', 'remove'} <= set(dir(keytab))
 
 
 class TestSalt(unittest.TestCase):
@@ -0,0 +1,157 @@
+#
+# Like what you see? Join us!
+# https://www.univention.com/about-us/careers/vacancies/
+#
+# Copyright 2025 Univention GmbH
+#
+# https://www.univention.de/
+#
+# All rights reserved.
+#
+# The source code of this program is made available
+# under the terms of the GNU Affero General Public License version 3
+# (GNU AGPL V3) as published by the Free Software Foundation.
+#
+# Binary versions of this program provided by Univention to you as
+# well as other copyrighted, protected or trademarked materials like
+# Logos, graphics, fonts, specific documentations and configurations,
+# cryptographic keys etc. are subject to a license agreement between
+# you and Univention.
+#
+# In the case you use this program under the terms of the GNU AGPL V3,
+# the program is provided in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public
+# License with the Debian GNU/Linux or Univention distribution in file
+# /usr/share/common-licenses/AGPL-3; if not, see
+# <https://www.gnu.org/licenses/>.
+
+"""
+Read-only access to the listener cache
+
+The cache holds the objects replicated to this host as the listener modules see
+them, so simple lookups need not query the LDAP server. Reading never blocks the
+listener. Only `root` may read the cache.
+
+>>> with ListenerCache() as cache:
+...     notifier_id = cache.notifier_id()
+...     attrs = cache.get('uid=Administrator,cn=users,dc=example,dc=com')
+"""
+
+from __future__ import annotations
+
+import ctypes
+import errno
+import os
+from collections.abc import Iterator
+
+
+__all__ = ['ListenerCache']
+
+_lib = ctypes.CDLL('libuniventionlistenercache.so.0', use_errno=True)
+_entry_p = ctypes.c_void_p
+_lib.univention_listener_cache_open.argtypes = [ctypes.c_char_p]
+_lib.univention_listener_cache_close.argtypes = []
+_lib.univention_listener_cache_close.restype = None
+_lib.univention_listener_cache_id.argtypes = [ctypes.POINTER(ctypes.c_ulong)]
+_lib.univention_listener_cache_get.argtypes = [ctypes.c_char_p, ctypes.POINTER(_entry_p)]
+_lib.univention_listener_cache_entry_free.argtypes = [_entry_p]
+_lib.univention_listener_cache_entry_free.restype = None
+_lib.univention_listener_cache_entry_attributes.argtypes = [_entry_p]
+_lib.univention_listener_cache_entry_name.argtypes = [_entry_p, ctypes.c_int]
+_lib.univention_listener_cache_entry_name.restype = ctypes.c_char_p
+_lib.univention_listener_cache_entry_values.argtypes = [_entry_p, ctypes.c_int]
+_lib.univention_listener_cache_entry_value.argtypes = [_entry_p, ctypes.c_int, ctypes.c_int, ctypes.POINTER(ctypes.c_size_t)]
+_lib.univention_listener_cache_entry_value.restype = ctypes.c_void_p
+_lib.univention_listener_cache_iter_begin.argtypes = [ctypes.c_char_p, ctypes.POINTER(ctypes.c_void_p), ctypes.POINTER(ctypes.c_ulong)]
+_lib.univention_listener_cache_iter_next.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_char_p), ctypes.POINTER(_entry_p)]
+_lib.univention_listener_cache_iter_end.argtypes = [ctypes.c_void_p]
+_lib.univention_listener_cache_iter_end.restype = None
+
+
+def _check(rv: int) -> None:
+    if rv:
+        raise OSError(rv, os.strerror(rv))
+
+
+def _attributes(entry: int) -> dict[str, list[bytes]]:
+    attrs = {}
+    length = ctypes.c_size_t()
+    for i in range(_lib.univention_listener_cache_entry_attributes(entry)):
+        name = _lib.univention_listener_cache_entry_name(entry, i).decode('ASCII')
+        attrs[name] = [
+            ctypes.string_at(_lib.univention_listener_cache_entry_value(entry, i, j, ctypes.byref(length)), length.value)
+            for j in range(_lib.univention_listener_cache_entry_values(entry, i))
+        ]
+    return attrs
+
+
+class ListenerCache:
+    """
+    The listener cache of this host. There can only be one per process.
+
+    :param path: The directory of the cache, or the one of the listener if `None`.
+    """
+
+    def __init__(self, path: str | None = None) -> None:
+        _check(_lib.univention_listener_cache_open(path.encode('UTF-8') if path else None))
+
+    def close(self) -> None:
+        _lib.univention_listener_cache_close()
+
+    def __enter__(self) -> ListenerCache:
+        return self
+
+    def __exit__(self, *exc_info: object) -> None:
+        self.close()
+
+    def notifier_id(self) -> int:
+        """
+        Return the ID of the last transaction in the cache. Objects read
+        afterwards are at least as recent.
+        """
+        notifier_id = ctypes.c_ulong()
+        _check(_lib.univention_listener_cache_id(ctypes.byref(notifier_id)))
+        return notifier_id.value
+
+    def get(self, dn: str) -> dict[str, list[bytes]] | None:
+        """
+        Look up an object.
+
+        :param dn: The DN of the object, in any case.
+        :return: The attributes of the object, or `None` if it is not cached.
+        """
+        entry = _entry_p()
+        rv = _lib.univention_listener_cache_get(dn.encode('UTF-8'), ctypes.byref(entry))
+        if rv == errno.ENOENT:
+            return None
+        _check(rv)
+        try:
+            return _attributes(entry)
+        finally:
+            _lib.univention_listener_cache_entry_free(entry)
+
+    def search(self, base: str | None = None) -> Iterator[tuple[str, dict[str, list[bytes]]]]:
+        """
+        Iterate over all objects below and at `base` in one consistent snapshot.
+
+        :param base: The DN of the subtree, or all objects if `None`.
+        :return: The DNs in lower case and the attributes of the objects.
+        """
+        it = ctypes.c_void_p()
+        rv = _lib.univention_listener_cache_iter_begin(base.encode('UTF-8') if base else None, ctypes.byref(it), None)
+        if rv == errno.ENOENT:
+            return
+        _check(rv)
+        try:
+            dn = ctypes.c_char_p()
+            entry = _entry_p()
+            while (rv := _lib.univention_listener_cache_iter_next(it, ctypes.byref(dn), ctypes.byref(entry))) == 0:
+                yield dn.value.decode('UTF-8'), _attributes(entry)
+            if rv != errno.ENOENT:
+                _check(rv)
+        finally:
+            _lib.univention_listener_cache_iter_end(it)
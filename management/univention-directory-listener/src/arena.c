@@ -0,0 +1,163 @@
+/*
+ * Univention Directory Listener
+ *  bump allocator for the data of one transaction
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "memory.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define ARENA_ALIGN sizeof(void *)
+#define ARENA_ROUND(size) (((size) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct arena_block {
+	struct arena_block *next;
+	size_t size; /* bytes available in data */
+	size_t used;
+	char data[];
+};
+
+/* Each allocation is preceded by its size, which arena_realloc() needs. */
+struct arena_chunk {
+	size_t size;
+	char data[];
+};
+
+static inline struct arena_chunk *chunk_of(void *ptr) {
+	return (struct arena_chunk *)((char *)ptr - offsetof(struct arena_chunk, data));
+}
+
+void *arena_alloc(struct arena *arena, size_t size) {
+	struct arena_block *block = arena->blocks;
+	struct arena_chunk *chunk;
+	size_t need;
+
+	if (size > SIZE_MAX - sizeof(struct arena_chunk) - ARENA_ALIGN)
+		return NULL;
+	need = ARENA_ROUND(sizeof(struct arena_chunk) + size);
+	if (block == NULL || block->size - block->used < need) {
+		size_t block_size = need > ARENA_BLOCK_SIZE ? need : ARENA_BLOCK_SIZE;
+
+		if ((block = malloc(sizeof(struct arena_block) + block_size)) == NULL)
+			return NULL;
+		block->size = block_size;
+		block->used = 0;
+		memory_account(MEMORY_ARENAS, sizeof(struct arena_block) + block_size);
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+	chunk = (struct arena_chunk *)(block->data + block->used);
+	chunk->size = size;
+	block->used += need;
+	return chunk->data;
+}
+
+/*
+ * Grow or shrink an allocation like realloc(). The last allocation of the
+ * current block is resized in place, all others are copied.
+ * The old memory is only released by arena_reset().
+ */
+void *arena_realloc(struct arena *arena, void *ptr, size_t size) {
+	struct arena_block *block = arena->blocks;
+	struct arena_chunk *chunk;
+	size_t old;
+	void *tmp;
+
+	if (ptr == NULL)
+		return arena_alloc(arena, size);
+	chunk = chunk_of(ptr);
+	old = ARENA_ROUND(sizeof(struct arena_chunk) + chunk->size);
+	if (size <= chunk->size) {
+		chunk->size = size;
+		if ((char *)chunk + old == block->data + block->used)
+			block->used -= old - ARENA_ROUND(sizeof(struct arena_chunk) + size);
+		return ptr;
+	}
+	if ((char *)chunk + old == block->data + block->used && size <= SIZE_MAX - sizeof(struct arena_chunk) - ARENA_ALIGN) {
+		size_t need = ARENA_ROUND(sizeof(struct arena_chunk) + size);
+
+		if (block->used - old + need <= block->size) {
+			block->used += need - old;
+			chunk->size = size;
+			return ptr;
+		}
+	}
+	if ((tmp = arena_alloc(arena, size)) == NULL)
+		return NULL;
+	memcpy(tmp, ptr, chunk->size);
+	return tmp;
+}
+
+char *arena_strdup(struct arena *arena, const char *str) {
+	size_t len = strlen(str) + 1;
+	char *copy = arena_alloc(arena, len);
+
+	if (copy != NULL)
+		memcpy(copy, str, len);
+	return copy;
+}
+
+/* Release all allocations, keeping the oldest block for the next use. */
+void arena_reset(struct arena *arena) {
+	struct arena_block *block = arena->blocks;
+
+	if (block == NULL)
+		return;
+	while (block->next != NULL) {
+		struct arena_block *next = block->next;
+
+		memory_account(MEMORY_ARENAS, -(long)(sizeof(struct arena_block) + block->size));
+		free(block);
+		block = next;
+	}
+	block->used = 0;
+	arena->blocks = block;
+}
+
+void arena_free(struct arena *arena) {
+	struct arena_block *block = arena->blocks;
+
+	while (block != NULL) {
+		struct arena_block *next = block->next;
+
+		memory_account(MEMORY_ARENAS, -(long)(sizeof(struct arena_block) + block->size));
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+}
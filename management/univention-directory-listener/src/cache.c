@@ -52,11 +52,13 @@
    The function unparse_entry converts a C structure entry to a data
    chunk, parse_entry does the opposite.
 
-   To convert the entry, unparse_entry walks through all values of
-   all attributes, as well as through the list of modules registered
-   with it, and write a block for each (attribute, value) pair or
-   (, module) [write_header]. Each block starts with an entry_header
-   structure that specified the lengths of the following data.
+   To convert the entry, unparse_entry walks through all attributes,
+   as well as through the list of modules registered with it, and
+   writes a block for each attribute with all its values, or module.
+   The format is versioned: entries written by older versions with
+   one block per (attribute, value) pair are still read, and are
+   converted when they are written next, or by
+   univention-directory-listener-dump -u.
 */
 
 
@@ -70,10 +72,14 @@
 #include <sys/types.h>
 #include <sys/file.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <lmdb.h>
+#include <pthread.h>
+#include <time.h>
 #include <stdbool.h>
 #include <assert.h>
 #include <stdint.h>
+#include <stddef.h>
 
 #include <univention/config.h>
 
@@ -85,6 +91,7 @@
 #include "network.h"
 #include "signals.h"
 #include "filter.h"
+#include "probes.h"
 #include "utils.h"
 #include "error.h"
 
@@ -101,8 +108,20 @@ CacheMasterEntry cache_master_entry;
 static MDB_env *env;
 static MDB_dbi id2dn;
 static MDB_dbi id2entry;
+/* module name -> DNIDs of all entries registered with that module */
+static MDB_dbi module2dnid;
+static bool module_index = false;
 static int mdb_readonly = 0;
+static char *mdb_dir = NULL;
 static FILE *lock_fp = NULL;
+/* Group commit: all transactions are nested into this one until
+ * cache_batch_commit(), so only that commit syncs to disk. */
+static MDB_txn *batch_txn = NULL;
+/* reset between uses by read_txn_end() */
+static MDB_txn *reader_txn = NULL;
+static bool reader_busy = false;
+/* other top-level read-only transactions, which all use the current map */
+static int readers_open = 0;
 
 static struct filter cache_filter;
 static struct filter *cache_filters[] = {&cache_filter, NULL};
@@ -110,13 +129,33 @@ static struct filter *cache_filters[] = {&cache_filter, NULL};
 static void setup_cache_filter(void) {
 	FREE(cache_filter.filter);
 	FREE(cache_filter.base);
+	filter_free(cache_filter.node);
+	cache_filter.node = NULL;
 	cache_filter.filter = univention_config_get_string("listener/cache/filter");
 	if (cache_filter.filter && cache_filter.filter[0]) {
 		cache_filter.base = univention_config_get_string("ldap/base");
 		cache_filter.scope = LDAP_SCOPE_SUBTREE;
+		cache_filter.node = filter_compile(cache_filter.filter);
 	}
 }
 
+static void setup_compression(void) {
+	const int DEFAULT_THRESHOLD = 4096;
+	char *ucrvalue;
+	int threshold;
+
+	entry_compress_threshold = 0;
+	ucrvalue = univention_config_get_string("listener/cache/compression");
+	if (ucrvalue) {
+		if (!strcmp(ucrvalue, "yes") || !strcmp(ucrvalue, "true")) {
+			threshold = univention_config_get_int("listener/cache/compression/threshold");
+			entry_compress_threshold = threshold <= 0 ? DEFAULT_THRESHOLD : threshold;
+		}
+		free(ucrvalue);
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache_init: compression threshold %u", entry_compress_threshold);
+}
+
 /*
 int mdb_message_func(const char *msg, void *ctx) {
         univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO,
@@ -192,6 +231,239 @@ static size_t determine_mapsize_from_ucr() {
 	return mapsize;
 }
 
+/*
+ * Double the map size once the used pages exceed this percentage, so writes
+ * do not fail with MDB_MAP_FULL. The size can only be changed while no
+ * transaction is active, which is checked before each top-level write.
+ */
+#define MAPSIZE_GROW_PERCENT 80
+
+static void grow_mapsize(void) {
+	MDB_envinfo info;
+	MDB_stat stat;
+	size_t used, mapsize;
+	int rv;
+
+	if (mdb_env_info(env, &info) != MDB_SUCCESS || mdb_env_stat(env, &stat) != MDB_SUCCESS)
+		return;
+	used = (info.me_last_pgno + 1) * (size_t)stat.ms_psize;
+	if (used < info.me_mapsize / 100 * MAPSIZE_GROW_PERCENT)
+		return;
+
+	mapsize = info.me_mapsize * 2;
+	if (mapsize < info.me_mapsize) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "cache: map size %zu nearly exhausted and cannot grow", info.me_mapsize);
+		return;
+	}
+	rv = mdb_env_set_mapsize(env, mapsize);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB(rv, "mdb_env_set_mapsize");
+		return;
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache: %zu of %zu bytes used, map size grown to %zu", used, info.me_mapsize, mapsize);
+}
+
+/*
+ * Begin, or renew if @renew is set, the top-level read-only transaction @txn.
+ * Once the listener grew the map beyond the size mapped by this process, see
+ * grow_mapsize(), LMDB refuses with MDB_MAP_RESIZED until the new size is
+ * adopted, which may only be done while no other transaction uses the map.
+ */
+static int read_only_txn_begin(MDB_txn **txn, bool renew) {
+	int rv;
+
+	rv = renew ? mdb_txn_renew(*txn) : mdb_txn_begin(env, NULL, MDB_RDONLY, txn);
+	if (rv == MDB_MAP_RESIZED && !reader_busy && __atomic_load_n(&readers_open, __ATOMIC_RELAXED) == 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache: map grown by the listener, adopting its size");
+		if ((rv = mdb_env_set_mapsize(env, 0)) == MDB_SUCCESS)
+			rv = renew ? mdb_txn_renew(*txn) : mdb_txn_begin(env, NULL, MDB_RDONLY, txn);
+	}
+	if (rv == MDB_SUCCESS && !renew)
+		__atomic_add_fetch(&readers_open, 1, __ATOMIC_RELAXED);
+	return rv;
+}
+
+/* end a transaction begun by read_only_txn_begin() */
+static void read_only_txn_ended(void) {
+	__atomic_sub_fetch(&readers_open, 1, __ATOMIC_RELAXED);
+}
+
+/* Begin a transaction nested into the current batch, growing the map first. */
+static int cache_txn_begin(unsigned int flags, MDB_txn **txn) {
+	if (batch_txn == NULL && (flags & MDB_RDONLY))
+		return read_only_txn_begin(txn, false);
+	if (batch_txn == NULL && !mdb_readonly)
+		grow_mapsize();
+	return mdb_txn_begin(env, batch_txn, flags, txn);
+}
+
+/*
+ * Begin a transaction for reading. Outside of a batch the same read-only
+ * transaction is renewed each time instead of allocating a new one.
+ * It must be ended by read_txn_end().
+ */
+static int read_txn_begin(MDB_txn **txn) {
+	int rv;
+
+	if (batch_txn)
+		return mdb_txn_begin(env, batch_txn, 0, txn);
+	if (reader_busy)
+		return read_only_txn_begin(txn, false);
+	if (reader_txn) {
+		rv = read_only_txn_begin(&reader_txn, true);
+	} else {
+		rv = read_only_txn_begin(&reader_txn, false);
+		/* reader_txn is tracked by reader_busy instead */
+		if (rv == MDB_SUCCESS)
+			read_only_txn_ended();
+	}
+	reader_busy = rv == MDB_SUCCESS;
+	*txn = reader_txn;
+	return rv;
+}
+
+static void read_txn_end(MDB_txn *txn) {
+	if (txn == reader_txn) {
+		mdb_txn_reset(txn);
+		reader_busy = false;
+	} else {
+		if (!batch_txn)
+			read_only_txn_ended();
+		mdb_txn_abort(txn);
+	}
+}
+
+/* Return the interned names of the modules an entry is currently stored with. */
+static char **stored_modules(MDB_txn *txn, DNID dnid) {
+	MDB_val key, data;
+	CacheEntry entry;
+	char **modules;
+	int i;
+
+	key.mv_data = &dnid;
+	key.mv_size = sizeof(DNID);
+	if (mdb_get(txn, id2entry, &key, &data) != MDB_SUCCESS)
+		return NULL;
+
+	assert(data.mv_size <= UINT32_MAX);
+	if (parse_entry_view(data.mv_data, (u_int32_t)data.mv_size, &entry) != 0 && parse_entry(data.mv_data, (u_int32_t)data.mv_size, &entry) != 0) {
+		cache_free_entry(NULL, &entry);
+		return NULL;
+	}
+	if ((modules = malloc((entry.module_count + 1) * sizeof(char *))) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "stored_modules: malloc failed");
+		abort();  // FIXME
+	}
+	for (i = 0; i < entry.module_count; i++)
+		modules[i] = cache_entry_intern(entry.modules[i], strlen(entry.modules[i]));
+	modules[i] = NULL;
+	cache_free_entry(NULL, &entry);
+
+	return modules;
+}
+
+static bool has_module(char **modules, const char *module) {
+	for (; modules != NULL && *modules != NULL; modules++) {
+		if (strcmp(*modules, module) == 0)
+			return true;
+	}
+	return false;
+}
+
+static int module_index_set(MDB_txn *txn, const char *module, DNID dnid, bool add) {
+	MDB_val key, data;
+	int rv;
+
+	key.mv_data = (void *)module;
+	key.mv_size = strlen(module);
+	data.mv_data = &dnid;
+	data.mv_size = sizeof(DNID);
+	if (add) {
+		rv = mdb_put(txn, module2dnid, &key, &data, MDB_NODUPDATA);
+		if (rv == MDB_KEYEXIST)
+			rv = MDB_SUCCESS;
+	} else {
+		rv = mdb_del(txn, module2dnid, &key, &data);
+		if (rv == MDB_NOTFOUND)
+			rv = MDB_SUCCESS;
+	}
+	if (rv != MDB_SUCCESS)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "module_index_set: updating module index failed: %s", mdb_strerror(rv));
+	return rv;
+}
+
+/*
+ * Update the module index for an entry whose modules change from `old` to `new`.
+ * :param old: NULL-terminated module names currently stored, or NULL.
+ * :param new: NULL-terminated module names to be stored, or NULL.
+ */
+static int module_index_update(MDB_txn *txn, DNID dnid, char **old, char **new) {
+	char **module;
+	int rv;
+
+	if (!module_index)
+		return MDB_SUCCESS;
+	for (module = old; module != NULL && *module != NULL; module++) {
+		if (!has_module(new, *module) && (rv = module_index_set(txn, *module, dnid, false)) != MDB_SUCCESS)
+			return rv;
+	}
+	for (module = new; module != NULL && *module != NULL; module++) {
+		if (!has_module(old, *module) && (rv = module_index_set(txn, *module, dnid, true)) != MDB_SUCCESS)
+			return rv;
+	}
+	return MDB_SUCCESS;
+}
+
+/* Open the module index, and build it from all entries when it is created. */
+static int module_index_init(MDB_txn *txn) {
+	const int flags = MDB_DUPSORT | MDB_DUPFIXED | MDB_INTEGERDUP;
+	MDB_cursor *cur;
+	MDB_val key, data;
+	CacheEntry entry;
+	DNID dnid;
+	int rv, i, count = 0;
+
+	rv = mdb_dbi_open(txn, "module2dnid", flags, &module2dnid);
+	if (rv == MDB_SUCCESS || (rv == MDB_NOTFOUND && mdb_readonly)) {
+		/* without the index, module lookups fall back to a full scan */
+		module_index = rv == MDB_SUCCESS;
+		return MDB_SUCCESS;
+	}
+	if (rv != MDB_NOTFOUND)
+		return rv;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_init: building module index");
+	if ((rv = mdb_dbi_open(txn, "module2dnid", flags | MDB_CREATE, &module2dnid)) != MDB_SUCCESS)
+		return rv;
+	module_index = true;
+
+	if ((rv = mdb_cursor_open(txn, id2entry, &cur)) != MDB_SUCCESS)
+		return rv;
+	for (rv = mdb_cursor_get(cur, &key, &data, MDB_FIRST); rv == MDB_SUCCESS; rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT)) {
+		dnid = *(DNID *)key.mv_data;
+		if (dnid == MASTER_KEY)
+			continue;
+
+		assert(data.mv_size <= UINT32_MAX);
+		if (parse_entry(data.mv_data, (u_int32_t)data.mv_size, &entry) != 0) {
+			cache_free_entry(NULL, &entry);
+			continue;
+		}
+		for (i = 0; rv == MDB_SUCCESS && i < entry.module_count; i++)
+			rv = module_index_set(txn, entry.modules[i], dnid, true);
+		cache_free_entry(NULL, &entry);
+		if (rv != MDB_SUCCESS)
+			break;
+		count++;
+	}
+	mdb_cursor_close(cur);
+	if (rv != MDB_NOTFOUND)
+		return rv;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_init: module index built for %d entries", count);
+	return MDB_SUCCESS;
+}
+
 int cache_init(char *cache_mdb_dir, int mdb_flags) {
 	int rv;
 	MDB_txn *cache_init_txn;
@@ -219,14 +491,17 @@ int cache_init(char *cache_mdb_dir, int mdb_flags) {
 		return rv;
 	}
 
-	rv = mdb_env_set_maxdbs(env, 2);
+	rv = mdb_env_set_maxdbs(env, 3);
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_init: setting mdb maxdbs failed");
 		ERROR_MDB_ABORT(rv, "mdb_env_set_maxdbs");
 		return rv;
 	}
 
-	rv = mdb_env_open(env, cache_mdb_dir, mdb_readonly, 0600);
+	free(mdb_dir);
+	mdb_dir = strdup(cache_mdb_dir);
+	/* MDB_NOTLS: the reset reader_txn must not block other read-only transactions */
+	rv = mdb_env_open(env, cache_mdb_dir, mdb_readonly | MDB_NOTLS, 0600);
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_init: opening database failed");
 		ERROR_MDB_ABORT(rv, "mdb_env_open");
@@ -259,6 +534,16 @@ int cache_init(char *cache_mdb_dir, int mdb_flags) {
 		return rv;
 	}
 
+	rv = module_index_init(cache_init_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "module_index_init");
+		mdb_txn_abort(cache_init_txn);
+		mdb_dbi_close(env, id2dn);
+		mdb_dbi_close(env, id2entry);
+		mdb_env_close(env);
+		return rv;
+	}
+
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "Transaction commit");
 
 	rv = mdb_txn_commit(cache_init_txn);
@@ -271,10 +556,120 @@ int cache_init(char *cache_mdb_dir, int mdb_flags) {
 	}
 
 	setup_cache_filter();
+	setup_compression();
 
 	return 0;
 }
 
+/* Bytes read at once while prefaulting, see cache_warmup(). */
+#define WARMUP_CHUNK (1 << 20)
+
+static struct {
+	pthread_t thread;
+	bool running;
+	bool stop;
+	int fd;
+	size_t size;
+} warmup;
+/* advice for point lookups, and the number of full scans switching to MADV_SEQUENTIAL */
+static int steady_advice = MADV_NORMAL;
+static int scans;
+
+/* Advise the kernel about the access pattern of the whole map. */
+static void cache_madvise(int advice) {
+	MDB_envinfo info;
+
+	if (mdb_env_info(env, &info) != MDB_SUCCESS || info.me_mapaddr == NULL)
+		return;
+	if (madvise(info.me_mapaddr, info.me_mapsize, advice) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "cache: madvise(%d): %s", advice, strerror(errno));
+}
+
+static double elapsed(const struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* Read the used part of the database file into the page cache. Reading the
+   file instead of touching the map is not affected by grow_mapsize(). */
+static void *warmup_main(void *arg) {
+	struct timespec start;
+	size_t offset = 0;
+	ssize_t len = 1;
+	char *buf;
+
+	if ((buf = malloc(WARMUP_CHUNK)) == NULL)
+		return NULL;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while (offset < warmup.size && len > 0 && !__atomic_load_n(&warmup.stop, __ATOMIC_RELAXED)) {
+		if ((len = pread(warmup.fd, buf, WARMUP_CHUNK, offset)) > 0)
+			offset += len;
+	}
+	free(buf);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_warmup: prefaulted %zu of %zu bytes in %.3f s", offset < warmup.size ? offset : warmup.size, warmup.size, elapsed(&start));
+	return NULL;
+}
+
+/*
+ * Warm up the page cache for the map as configured by listener/cache/warmup:
+ * "willneed" asks the kernel to read it ahead, "prefault" reads it in a
+ * background thread. listener/cache/random disables the read-ahead for the
+ * point lookups done otherwise, full scans by cache_iter_next() always read
+ * ahead sequentially.
+ */
+void cache_warmup(void) {
+	struct timespec start;
+	MDB_envinfo info;
+	MDB_stat stat;
+	char *mode, *random;
+	int rv;
+
+	random = univention_config_get_string("listener/cache/random");
+	if (random && (!strcmp(random, "yes") || !strcmp(random, "true"))) {
+		steady_advice = MADV_RANDOM;
+		cache_madvise(steady_advice);
+	}
+	free(random);
+
+	mode = univention_config_get_string("listener/cache/warmup");
+	if (mode == NULL || !mode[0] || !strcmp(mode, "no") || !strcmp(mode, "false")) {
+		free(mode);
+		return;
+	}
+	if (warmup.running || mdb_env_info(env, &info) != MDB_SUCCESS || mdb_env_stat(env, &stat) != MDB_SUCCESS || mdb_env_get_fd(env, &warmup.fd) != MDB_SUCCESS) {
+		free(mode);
+		return;
+	}
+	warmup.size = (info.me_last_pgno + 1) * (size_t)stat.ms_psize;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!strcmp(mode, "willneed")) {
+		if (madvise(info.me_mapaddr, warmup.size, MADV_WILLNEED) != 0)
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "cache_warmup: madvise: %s", strerror(errno));
+		else
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_warmup: read-ahead of %zu bytes requested in %.3f s", warmup.size, elapsed(&start));
+	} else if (!strcmp(mode, "prefault")) {
+		warmup.stop = false;
+		if ((rv = pthread_create(&warmup.thread, NULL, warmup_main, NULL)) != 0)
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "cache_warmup: pthread_create: %s", strerror(rv));
+		else
+			warmup.running = true;
+	} else {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "cache_warmup: unknown listener/cache/warmup=%s", mode);
+	}
+	free(mode);
+}
+
+/* Stop prefaulting before the database file is closed. */
+static void cache_warmup_stop(void) {
+	if (!warmup.running)
+		return;
+	__atomic_store_n(&warmup.stop, true, __ATOMIC_RELAXED);
+	pthread_join(warmup.thread, NULL);
+	warmup.running = false;
+}
+
 int cache_set_schema_id(const NotifierID value) {
 	int rv, fd, len;
 	char file[PATH_MAX], buf[15];
@@ -354,6 +749,55 @@ int cache_get_int(char *key, NotifierID *value, const long def) {
 	return fclose(fp) || (rv != 1);
 }
 
+/* Store a string like cache_set_int(); NULL removes the key. */
+int cache_set_string(char *key, const char *value) {
+	int rv;
+	FILE *fp;
+	char file[PATH_MAX], tmpfile[PATH_MAX];
+
+	rv = snprintf(file, PATH_MAX, "%s/%s", cache_dir, key);
+	if (rv < 0 || rv >= PATH_MAX)
+		return rv;
+	if (value == NULL)
+		return unlink(file) != 0 && errno != ENOENT;
+
+	rv = snprintf(tmpfile, PATH_MAX, "%s/%s.tmp", cache_dir, key);
+	if (rv < 0 || rv >= PATH_MAX)
+		return rv;
+	if ((fp = fopen(tmpfile, "w")) == NULL)
+		abort_io("open", tmpfile);
+	fputs(value, fp);
+	rv = fclose(fp);
+	if (rv != 0)
+		abort_io("close", tmpfile);
+
+	rv = rename(tmpfile, file);
+	return rv;
+}
+
+/* Read a string stored by cache_set_string(), to be freed by the caller. */
+int cache_get_string(char *key, char **value) {
+	FILE *fp;
+	char file[PATH_MAX];
+	size_t size = 0;
+	ssize_t len;
+	int rv;
+
+	*value = NULL;
+
+	snprintf(file, PATH_MAX, "%s/%s", cache_dir, key);
+	if ((fp = fopen(file, "r")) == NULL)
+		return 1;
+	len = getdelim(value, &size, '\0', fp);
+	rv = fclose(fp);
+	if (len < 0) {
+		free(*value);
+		*value = NULL;
+		return 1;
+	}
+	return rv;
+}
+
 int cache_get_master_entry(CacheMasterEntry *master_entry) {
 	int rv;
 	MDB_txn *read_txn;
@@ -367,7 +811,7 @@ int cache_get_master_entry(CacheMasterEntry *master_entry) {
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_master_entry: Read Transaction begin");
 
-	rv = mdb_txn_begin(env, NULL, MDB_RDONLY, &read_txn);
+	rv = read_txn_begin(&read_txn);
 	if (rv != MDB_SUCCESS) {
 		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
 		return rv;
@@ -378,25 +822,32 @@ int cache_get_master_entry(CacheMasterEntry *master_entry) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_master_entry: Read Transaction abort"
 		                                                  ": %s",
 		                 mdb_strerror(rv));
-		mdb_txn_abort(read_txn);
+		read_txn_end(read_txn);
 		return rv;
 	} else if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_get_master_entry: reading master entry from database failed");
 		ERROR_MDB_ABORT(rv, "mdb_get");
-		mdb_txn_abort(read_txn);
+		read_txn_end(read_txn);
 		return rv;
 	}
 
+	/* data is only valid until a nested transaction ends */
+	if (data.mv_size == sizeof(CacheMasterEntry)) {
+		memcpy(master_entry, data.mv_data, sizeof(CacheMasterEntry));
+	} else if (data.mv_size == offsetof(CacheMasterEntry, flags)) {
+		/* written by a version without flags */
+		memcpy(master_entry, data.mv_data, offsetof(CacheMasterEntry, flags));
+		master_entry->flags = 0;
+	}
+
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_master_entry: Read Transaction abort");
-	mdb_txn_abort(read_txn);
+	read_txn_end(read_txn);
 
-	if (data.mv_size != sizeof(CacheMasterEntry)) {
+	if (data.mv_size != sizeof(CacheMasterEntry) && data.mv_size != offsetof(CacheMasterEntry, flags)) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_get_master_entry: master entry has unexpected length");
 		return 1;
 	}
 
-	memcpy(master_entry, data.mv_data, sizeof(CacheMasterEntry));
-
 	return MDB_SUCCESS;
 }
 
@@ -415,7 +866,7 @@ int cache_update_master_entry(CacheMasterEntry *master_entry) {
 	data.mv_size = sizeof(CacheMasterEntry);
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_update_master_entry: Transaction begin");
-	if ((rv = mdb_txn_begin(env, NULL, 0, &write_txn)) != MDB_SUCCESS) {
+	if ((rv = cache_txn_begin(0, &write_txn)) != MDB_SUCCESS) {
 		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
 		return rv;
 	}
@@ -466,6 +917,13 @@ static inline int cache_update_entry_in_transaction(NotifierID id, char *dn, Cac
 	key.mv_size = sizeof(DNID);
 
 	write_txn = mdb_cursor_txn(*id2dn_cursor_pp);
+	if (module_index) {
+		char **modules = stored_modules(write_txn, dnid);
+		rv = module_index_update(write_txn, dnid, modules, entry->modules);
+		free(modules);
+		if (rv != MDB_SUCCESS)
+			goto out;
+	}
 	rv = mdb_put(write_txn, id2entry, &key, &data, 0);
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_update_entry: storing entry in database failed: %s", dn);
@@ -487,7 +945,7 @@ inline int cache_update_entry(NotifierID id, char *dn, CacheEntry *entry) {
 	MDB_cursor *id2dn_write_cursor_p;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_update_entry: Transaction begin");
-	rv = mdb_txn_begin(env, NULL, 0, &write_txn);
+	rv = cache_txn_begin(0, &write_txn);
 	if (rv != MDB_SUCCESS) {
 		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
 		return rv;
@@ -506,20 +964,30 @@ inline int cache_update_entry(NotifierID id, char *dn, CacheEntry *entry) {
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_update_entry: Transaction abort");
 		mdb_txn_abort(write_txn);
+		dntree_cache_clear();
 		return rv;
 	}
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_update_entry: Transaction commit");
+	PROBE2(cache_commit_start, id, dn);
 	rv = mdb_txn_commit(write_txn);
+	PROBE2(cache_commit_end, id, rv);
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_update_entry: storing updated entry in database failed");
 		ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		dntree_cache_clear();
 		return rv;
 	}
 
 	return rv;
 }
 
+/* add the attributes tested by listener/cache/filter to a list */
+void cache_filter_attributes(char ***names, int *count) {
+	if (cache_filter.filter && cache_filter.filter[0])
+		cache_entry_ldap_filter_attributes(cache_filters, names, count);
+}
+
 int cache_update_entry_lower(NotifierID id, char *dn, CacheEntry *entry) {
 	char *lower_dn;
 	int rv = 0;
@@ -554,6 +1022,15 @@ static inline int cache_delete_entry_in_transaction(NotifierID id, char *dn, MDB
 	key.mv_size = sizeof(DNID);
 
 	write_txn = mdb_cursor_txn(*id2dn_cursor_pp);
+	if (module_index) {
+		char **modules = stored_modules(write_txn, dnid);
+		rv = module_index_update(write_txn, dnid, modules, NULL);
+		free(modules);
+		if (rv != MDB_SUCCESS) {
+			signals_unblock();
+			return rv;
+		}
+	}
 	rv = mdb_del(write_txn, id2entry, &key, 0);
 	if (rv != MDB_SUCCESS && rv != MDB_NOTFOUND) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_delete_entry: removing from database failed: %s", dn);
@@ -579,7 +1056,7 @@ int cache_delete_entry(NotifierID id, char *dn) {
 	MDB_cursor *id2dn_write_cursor_p;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_delete_entry: Transaction begin");
-	rv = mdb_txn_begin(env, NULL, 0, &write_txn);
+	rv = cache_txn_begin(0, &write_txn);
 	if (rv != MDB_SUCCESS) {
 		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
 		return rv;
@@ -598,6 +1075,7 @@ int cache_delete_entry(NotifierID id, char *dn) {
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_update_entry: Transaction abort");
 		mdb_txn_abort(write_txn);
+		dntree_cache_clear();
 		return rv;
 	}
 
@@ -606,6 +1084,7 @@ int cache_delete_entry(NotifierID id, char *dn) {
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_delete_entry: storing entry removal from database failed");
 		ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		dntree_cache_clear();
 	}
 
 	return rv;
@@ -619,7 +1098,7 @@ int cache_delete_entry_lower_upper(NotifierID id, char *dn) {
 	// convert to a lowercase dn
 	lower_dn = lower_utf8(dn);
 	rv = cache_delete_entry(id, lower_dn);
-	if (strcmp(dn, lower_dn) != 0) {
+	if (!(cache_master_entry.flags & CACHE_NORMALIZED) && strcmp(dn, lower_dn) != 0) {
 		mixedcase = true;
 		// try again with original dn
 		rv2 = cache_delete_entry(id, dn);
@@ -633,106 +1112,513 @@ int cache_delete_entry_lower_upper(NotifierID id, char *dn) {
 	}
 }
 
-int cache_update_or_deleteifunused_entry(NotifierID id, char *dn, CacheEntry *entry, MDB_cursor **id2dn_cursor_pp) {
-	if (entry->module_count == 0)
-		return cache_delete_entry_in_transaction(id, dn, id2dn_cursor_pp);
-	else
-		return cache_update_entry_in_transaction(id, dn, entry, id2dn_cursor_pp);
-}
-
-int cache_get_entry(char *dn, CacheEntry *entry) {
+/*
+ * Move the entry at @old_dn and all entries below it to @new_dn in one go by
+ * relinking it in the DN tree, storing @entry as its new content. The entries
+ * below keep their DNIDs and their content.
+ * @return MDB_NOTFOUND if @old_dn has no entries below it and MDB_KEYEXIST if
+ *         @new_dn exists already; then the entry must be deleted and added.
+ */
+int cache_move_subtree(NotifierID id, char *old_dn, char *new_dn, CacheEntry *entry) {
 	int rv;
 	DNID dnid;
-	MDB_txn *read_txn;
-	MDB_cursor *id2dn_read_cursor_p;
-	MDB_val key, data;
-
-	memset(&key, 0, sizeof(MDB_val));
-	memset(&data, 0, sizeof(MDB_val));
-	memset(entry, 0, sizeof(CacheEntry));
-
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_entry: Read Transaction begin");
+	MDB_txn *write_txn;
+	MDB_cursor *id2dn_write_cursor_p;
+	MDB_val key;
+	char *lower_old = lower_utf8(old_dn), *lower_new = lower_utf8(new_dn);
 
-	rv = mdb_txn_begin(env, NULL, MDB_RDONLY, &read_txn);
+	rv = cache_txn_begin(0, &write_txn);
 	if (rv != MDB_SUCCESS) {
 		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
 		return rv;
 	}
 
-	rv = mdb_cursor_open(read_txn, id2dn, &id2dn_read_cursor_p);
+	rv = mdb_cursor_open(write_txn, id2dn, &id2dn_write_cursor_p);
 	if (rv != MDB_SUCCESS) {
 		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
-		mdb_txn_abort(read_txn);
-		return rv;
-	}
-
-	rv = dntree_get_id4dn(id2dn_read_cursor_p, dn, &dnid, false);
-	mdb_cursor_close(id2dn_read_cursor_p);
-	if (rv == MDB_NOTFOUND) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_entry: Read Transaction abort");
-		mdb_txn_abort(read_txn);
 		return rv;
 	}
 
-	key.mv_data = &dnid;
-	key.mv_size = sizeof(DNID);
+	signals_block();
+	rv = dntree_get_id4dn(id2dn_write_cursor_p, lower_old, &dnid, false);
+	if (rv == MDB_SUCCESS)
+		rv = dntree_has_children(id2dn_write_cursor_p, dnid);
+	if (rv == MDB_SUCCESS)
+		rv = dntree_move_id(id2dn_write_cursor_p, dnid, lower_new);
+	signals_unblock();
 
-	// signals_block();	// TODO: Is this really required?
-	rv = mdb_get(read_txn, id2entry, &key, &data);
-	// signals_unblock();
+	if (rv == MDB_SUCCESS) {
+		if (cache_filter.filter && cache_entry_ldap_filter_match(cache_filters, new_dn, entry)) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "Not caching %s, filtered out.", new_dn);
+			key.mv_data = &dnid;
+			key.mv_size = sizeof(DNID);
+			if (module_index) {
+				char **modules = stored_modules(write_txn, dnid);
+				rv = module_index_update(write_txn, dnid, modules, NULL);
+				free(modules);
+			}
+			if (rv == MDB_SUCCESS && (rv = mdb_del(write_txn, id2entry, &key, 0)) == MDB_NOTFOUND)
+				rv = MDB_SUCCESS;
+		} else {
+			rv = cache_update_entry_in_transaction(id, lower_new, entry, &id2dn_write_cursor_p);
+		}
+	}
 
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_entry: Read Transaction abort");
-	mdb_txn_abort(read_txn);
+	mdb_cursor_close(id2dn_write_cursor_p);
 
-	if (rv == MDB_SUCCESS) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "got %zu bytes for %s", data.mv_size, dn);
-	} else if (rv == MDB_NOTFOUND) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache_get_entry: no cache entry found for %s", dn);
-		return rv;
-	} else {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "reading %s from database failed", dn);
-		ERROR_MDB_ABORT(rv, "mdb_get");
-		return rv;
+	if (rv != MDB_SUCCESS) {
+		mdb_txn_abort(write_txn);
+		dntree_cache_clear();
+		goto out;
 	}
 
-	assert(data.mv_size <= UINT32_MAX);
-	rv = parse_entry(data.mv_data, data.mv_size, entry);
-	if (rv != 0) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_get_entry: parsing entry failed");
-		exit(1);
+	rv = mdb_txn_commit(write_txn);
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_move_subtree: storing moved entry in database failed");
+		ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		dntree_cache_clear();
 	}
 
+out:
+	free(lower_old);
+	free(lower_new);
 	return rv;
 }
 
-int cache_get_entry_lower_upper(char *dn, CacheEntry *entry) {
-	char *lower_dn;
-	bool mixedcase = false;
-	int rv;
+/* A node whose DN is not stored lower-case yet, see cache_normalize(). */
+struct mixed_node {
+	DNID dnid;
+	size_t length;
+};
 
-	// convert to a lowercase dn
-	lower_dn = lower_utf8(dn);
-	if (strcmp(dn, lower_dn) != 0) {
-		mixedcase = true;
+static int mixed_node_compare(const void *a, const void *b) {
+	const struct mixed_node *node_a = a, *node_b = b;
+
+	return node_a->length < node_b->length ? -1 : node_a->length > node_b->length ? 1 : 0;
+}
+
+/*
+ * Merge the node @from into @to, which has the lower-case DN @to_dn: the
+ * children of @from are moved below @to, merging them likewise if they exist
+ * there already, and the entry of @from is kept only if @to has none.
+ */
+static int normalize_merge(MDB_cursor *cur, DNID from, DNID to, const char *to_dn) {
+	int rv, count, i;
+	DNID *children, id;
+	char **rdns, *lower_rdn, *child_dn, **modules;
+	MDB_txn *txn = mdb_cursor_txn(cur);
+	MDB_val key, data, to_key, to_data;
+	void *blob;
+	size_t len;
+
+	rv = dntree_children(cur, from, &children, &rdns, &count);
+	for (i = 0; i < count; i++) {
+		if (rv == MDB_SUCCESS) {
+			lower_rdn = lower_utf8(rdns[i]);
+			len = strlen(lower_rdn) + 1 + strlen(to_dn) + 1;
+			if ((child_dn = malloc(len)) == NULL)
+				abort();
+			snprintf(child_dn, len, "%s,%s", lower_rdn, to_dn);
+			rv = dntree_move_id(cur, children[i], child_dn);
+			if (rv == MDB_KEYEXIST && (rv = dntree_get_id4dn(cur, child_dn, &id, false)) == MDB_SUCCESS)
+				rv = normalize_merge(cur, children[i], id, child_dn);
+			free(child_dn);
+			free(lower_rdn);
+		}
+		free(rdns[i]);
 	}
+	free(children);
+	free(rdns);
+	if (rv != MDB_SUCCESS)
+		return rv;
 
-	rv = cache_get_entry(lower_dn, entry);
-	if (rv == MDB_NOTFOUND && mixedcase) {
-		// try again with original dn
-		rv = cache_get_entry(dn, entry);
+	key.mv_data = &from;
+	key.mv_size = sizeof(DNID);
+	to_key.mv_data = &to;
+	to_key.mv_size = sizeof(DNID);
+	rv = mdb_get(txn, id2entry, &key, &data);
+	if (rv == MDB_SUCCESS) {
+		modules = stored_modules(txn, from);
+		rv = module_index_update(txn, from, modules, NULL);
+		if (rv == MDB_SUCCESS && (rv = mdb_get(txn, id2entry, &to_key, &to_data)) == MDB_NOTFOUND) {
+			/* data is only valid until the next change */
+			if ((blob = malloc(data.mv_size)) == NULL)
+				abort();
+			memcpy(blob, data.mv_data, data.mv_size);
+			to_data.mv_data = blob;
+			to_data.mv_size = data.mv_size;
+			rv = mdb_put(txn, id2entry, &to_key, &to_data, 0);
+			free(blob);
+			if (rv == MDB_SUCCESS)
+				rv = module_index_update(txn, to, NULL, modules);
+		}
+		free(modules);
+		if (rv == MDB_SUCCESS)
+			rv = mdb_del(txn, id2entry, &key, 0);
 	}
+	if (rv == MDB_NOTFOUND)
+		rv = MDB_SUCCESS;
+	if (rv != MDB_SUCCESS)
+		return rv;
 
-	free(lower_dn);
+	/* position the cursor on the link for dntree_del_id() */
+	rv = dntree_lookup_dn4id(cur, from, &child_dn);
+	if (rv == MDB_SUCCESS) {
+		rv = dntree_get_id4dn(cur, child_dn, &id, false);
+		free(child_dn);
+	}
+	if (rv == MDB_SUCCESS)
+		rv = dntree_del_id(cur, from);
+	if (rv == MDB_SUCCESS)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache_normalize: merged %lu into %lu: %s", from, to, to_dn);
 	return rv;
 }
 
-int cache_first_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry) {
+/* Store the node @dnid under its lower-case DN, if it still exists. */
+static int normalize_node(DNID dnid) {
+	int rv;
+	DNID id;
+	MDB_txn *write_txn;
+	MDB_cursor *cur;
+	MDB_val key, data;
+	char *dn = NULL, *lower_dn = NULL;
+
+	rv = cache_txn_begin(0, &write_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+	rv = mdb_cursor_open(write_txn, id2dn, &cur);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+		mdb_txn_abort(write_txn);
+		return rv;
+	}
+
+	/* merged into another node meanwhile */
+	key.mv_data = &dnid;
+	key.mv_size = sizeof(DNID);
+	rv = mdb_cursor_get(cur, &key, &data, MDB_SET);
+	if (rv == MDB_SUCCESS)
+		rv = dntree_lookup_dn4id(cur, dnid, &dn);
+	if (rv == MDB_SUCCESS) {
+		/* the DN has changed if a node above was normalized */
+		lower_dn = lower_utf8(dn);
+		if (strcmp(dn, lower_dn) == 0)
+			rv = MDB_NOTFOUND;
+		else if ((rv = dntree_move_id(cur, dnid, lower_dn)) == MDB_KEYEXIST && (rv = dntree_get_id4dn(cur, lower_dn, &id, false)) == MDB_SUCCESS)
+			rv = normalize_merge(cur, dnid, id, lower_dn);
+	}
+	mdb_cursor_close(cur);
+
+	if (rv != MDB_SUCCESS) {
+		mdb_txn_abort(write_txn);
+		dntree_cache_clear();
+		if (rv != MDB_NOTFOUND)
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_normalize: normalizing %s failed: %s (%d)", dn, mdb_strerror(rv), rv);
+	} else if ((rv = mdb_txn_commit(write_txn)) != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		dntree_cache_clear();
+	}
+
+	free(lower_dn);
+	free(dn);
+	return rv;
+}
+
+/*
+ * Rewrite all DNs in the cache to lower-case, as stored by current versions.
+ * Older versions also stored mixed-case DNs, which had to be looked up twice.
+ * The nodes are rewritten from the top in one transaction each, so this can
+ * be interrupted and run again until the master entry has CACHE_NORMALIZED.
+ * :param count: Return variable to receive the number of nodes rewritten.
+ * :returns: 0 on success, an LMDB error otherwise.
+ */
+int cache_normalize(int *count) {
+	int rv;
+	MDB_txn *read_txn;
+	MDB_cursor *cur;
+	MDB_val key, data;
+	struct mixed_node *nodes = NULL;
+	size_t n = 0, max = 0, i;
+	subDN *subdn;
+	char *lower_dn;
+
+	*count = 0;
+	rv = read_txn_begin(&read_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+	rv = mdb_cursor_open(read_txn, id2dn, &cur);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+		read_txn_end(read_txn);
+		return rv;
+	}
+	/* the node sorts before the links of the same DNID */
+	for (rv = mdb_cursor_get(cur, &key, &data, MDB_FIRST); rv == MDB_SUCCESS; rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT_NODUP)) {
+		subdn = (subDN *)data.mv_data;
+		if (subdn->type != SUBDN_TYPE_NODE || *(DNID *)key.mv_data == 0)
+			continue;
+		lower_dn = lower_utf8(subdn->data);
+		if (strcmp(subdn->data, lower_dn) != 0) {
+			if (n == max) {
+				max = max ? max * 2 : 64;
+				if ((nodes = realloc(nodes, max * sizeof(*nodes))) == NULL)
+					abort();
+			}
+			nodes[n].dnid = *(DNID *)key.mv_data;
+			nodes[n++].length = strlen(subdn->data);
+		}
+		free(lower_dn);
+	}
+	mdb_cursor_close(cur);
+	read_txn_end(read_txn);
+	if (rv != MDB_NOTFOUND) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_get");
+		free(nodes);
+		return rv;
+	}
+
+	/* parents first, so the children only need to rewrite their RDN */
+	qsort(nodes, n, sizeof(*nodes), mixed_node_compare);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_normalize: %zu mixed-case DNs", n);
+	for (i = 0, rv = MDB_SUCCESS; i < n; i++) {
+		rv = normalize_node(nodes[i].dnid);
+		if (rv == MDB_SUCCESS)
+			(*count)++;
+		else if (rv != MDB_NOTFOUND)
+			break;
+		rv = MDB_SUCCESS;
+	}
+
+	free(nodes);
+	return rv;
+}
+
+static int dn_depth_compare(const void *a, const void *b) {
+	size_t len_a = strlen(*(char *const *)a), len_b = strlen(*(char *const *)b);
+
+	return len_a < len_b ? 1 : len_a > len_b ? -1 : 0;
+}
+
+/*
+ * Remove many entries, e.g. a subtree, in one write transaction. They are
+ * removed bottom-up, so entries below others in the list go first. An entry
+ * which can't be removed, e.g. because there are others below it, is kept
+ * without affecting the rest.
+ * :param dns: The DNs to remove, which are sorted.
+ * :param count: The number of DNs.
+ * :returns: 0 on success, an LMDB error otherwise.
+ */
+int cache_delete_entries(NotifierID id, char **dns, int count) {
+	int rv, i;
+	MDB_txn *write_txn, *entry_txn;
+	MDB_cursor *id2dn_write_cursor_p;
+	char *lower_dn;
+
+	qsort(dns, count, sizeof(char *), dn_depth_compare);
+
+	rv = cache_txn_begin(0, &write_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+
+	for (i = 0; i < count; i++) {
+		/* nested, so a failure only drops this entry */
+		rv = mdb_txn_begin(env, write_txn, 0, &entry_txn);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+			return rv;
+		}
+		rv = mdb_cursor_open(entry_txn, id2dn, &id2dn_write_cursor_p);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+			return rv;
+		}
+		lower_dn = lower_utf8(dns[i]);
+		rv = cache_delete_entry_in_transaction(id, lower_dn, &id2dn_write_cursor_p);
+		if (rv == MDB_NOTFOUND && !(cache_master_entry.flags & CACHE_NORMALIZED) && strcmp(dns[i], lower_dn) != 0)
+			rv = cache_delete_entry_in_transaction(id, dns[i], &id2dn_write_cursor_p);
+		free(lower_dn);
+		mdb_cursor_close(id2dn_write_cursor_p);
+
+		if (rv == MDB_SUCCESS) {
+			rv = mdb_txn_commit(entry_txn);
+			if (rv != MDB_SUCCESS)
+				ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		} else {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache_delete_entries: keeping %s: %d", dns[i], rv);
+			mdb_txn_abort(entry_txn);
+			dntree_cache_clear();
+		}
+	}
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_delete_entries: Transaction commit");
+	rv = mdb_txn_commit(write_txn);
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_delete_entries: storing entry removal from database failed");
+		ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		dntree_cache_clear();
+	}
+
+	return rv;
+}
+
+int cache_update_or_deleteifunused_entry(NotifierID id, char *dn, CacheEntry *entry, MDB_cursor **id2dn_cursor_pp) {
+	if (entry->module_count == 0)
+		return cache_delete_entry_in_transaction(id, dn, id2dn_cursor_pp);
+	else
+		return cache_update_entry_in_transaction(id, dn, entry, id2dn_cursor_pp);
+}
+
+static int get_entry_in_transaction(MDB_txn *read_txn, MDB_cursor *id2dn_read_cursor_p, char *dn, CacheEntry *entry) {
+	int rv;
+	DNID dnid;
+	MDB_val key, data;
+
+	memset(&data, 0, sizeof(MDB_val));
+	memset(entry, 0, sizeof(CacheEntry));
+
+	rv = dntree_get_id4dn(id2dn_read_cursor_p, dn, &dnid, false);
+	if (rv == MDB_NOTFOUND)
+		return rv;
+
+	key.mv_data = &dnid;
+	key.mv_size = sizeof(DNID);
+
+	// signals_block();	// TODO: Is this really required?
+	rv = mdb_get(read_txn, id2entry, &key, &data);
+	// signals_unblock();
+
+	if (rv == MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "got %zu bytes for %s", data.mv_size, dn);
+	} else if (rv == MDB_NOTFOUND) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache_get_entry: no cache entry found for %s", dn);
+		return rv;
+	} else {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "reading %s from database failed", dn);
+		ERROR_MDB_ABORT(rv, "mdb_get");
+		return rv;
+	}
+
+	/* data is only valid until a nested transaction ends */
+	assert(data.mv_size <= UINT32_MAX);
+	rv = parse_entry(data.mv_data, data.mv_size, entry);
+	if (rv != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_get_entry: parsing entry failed");
+		exit(1);
+	}
+
+	return rv;
+}
+
+int cache_get_entry(char *dn, CacheEntry *entry) {
+	MDB_txn *read_txn;
+	MDB_cursor *id2dn_read_cursor_p;
+	int rv;
+
+	memset(entry, 0, sizeof(CacheEntry));
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_entry: Read Transaction begin");
+
+	rv = read_txn_begin(&read_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+
+	rv = mdb_cursor_open(read_txn, id2dn, &id2dn_read_cursor_p);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+		read_txn_end(read_txn);
+		return rv;
+	}
+
+	rv = get_entry_in_transaction(read_txn, id2dn_read_cursor_p, dn, entry);
+
+	mdb_cursor_close(id2dn_read_cursor_p);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_get_entry: Read Transaction abort");
+	read_txn_end(read_txn);
+
+	return rv;
+}
+
+/*
+ * Look up many entries in one transaction, so all of them are from the same
+ * snapshot of the cache.
+ * :param dns: The DNs to look up.
+ * :param count: The number of DNs.
+ * :param entries: Array of `count` entries to receive the cache entries, which
+ *   are left empty for DNs not in the cache.
+ * :param results: Array of `count` return values, 0 or MDB_NOTFOUND.
+ * :returns: 0 on success, an LMDB error otherwise.
+ */
+int cache_get_entries(char **dns, int count, CacheEntry *entries, int *results) {
+	MDB_txn *read_txn;
+	MDB_cursor *id2dn_read_cursor_p;
+	int rv, i;
+
+	for (i = 0; i < count; i++)
+		memset(&entries[i], 0, sizeof(CacheEntry));
+
+	rv = read_txn_begin(&read_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+
+	rv = mdb_cursor_open(read_txn, id2dn, &id2dn_read_cursor_p);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+		read_txn_end(read_txn);
+		return rv;
+	}
+
+	for (i = 0, rv = MDB_SUCCESS; i < count && rv == MDB_SUCCESS; i++) {
+		results[i] = get_entry_in_transaction(read_txn, id2dn_read_cursor_p, dns[i], &entries[i]);
+		if (results[i] != MDB_NOTFOUND)
+			rv = results[i];
+	}
+
+	mdb_cursor_close(id2dn_read_cursor_p);
+	read_txn_end(read_txn);
+
+	return rv;
+}
+
+int cache_get_entry_lower_upper(char *dn, CacheEntry *entry) {
+	char *lower_dn;
+	bool mixedcase = false;
+	int rv;
+
+	// convert to a lowercase dn
+	lower_dn = lower_utf8(dn);
+	if (!(cache_master_entry.flags & CACHE_NORMALIZED) && strcmp(dn, lower_dn) != 0) {
+		mixedcase = true;
+	}
+
+	rv = cache_get_entry(lower_dn, entry);
+	if (rv == MDB_NOTFOUND && mixedcase) {
+		// try again with original dn
+		rv = cache_get_entry(dn, entry);
+	}
+
+	free(lower_dn);
+	return rv;
+}
+
+static int next_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry, bool view);
+
+static int first_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry, bool view) {
 	MDB_txn *read_txn;
 	int rv;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_first_entry: Transaction begin");
 
-	rv = mdb_txn_begin(env, NULL, mdb_readonly, &read_txn);
+	rv = cache_txn_begin(mdb_readonly, &read_txn);
 	if (rv != MDB_SUCCESS) {
 		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
 		return rv;
@@ -761,10 +1647,10 @@ int cache_first_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_r
 	        "LAST COMMITTED TXN: %zu", stat.me_last_txnid);
 	*/
 
-	return cache_next_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry);
+	return next_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry, view);
 }
 
-int cache_next_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry) {
+static int next_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry, bool view) {
 	MDB_val key, data;
 	DNID dnid;
 	int rv;
@@ -784,13 +1670,16 @@ int cache_next_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_re
 	// skip root node
 	dnid = *(DNID *)key.mv_data;
 	if (dnid == MASTER_KEY) {
-		return cache_next_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry);
+		return next_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry, view);
 	}
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "got %zu bytes", data.mv_size);
 
 	assert(data.mv_size <= UINT32_MAX);
-	rv = parse_entry(data.mv_data, (u_int32_t)data.mv_size, entry);
+	if (!view || parse_entry_view(data.mv_data, (u_int32_t)data.mv_size, entry) != 0)
+		rv = parse_entry(data.mv_data, (u_int32_t)data.mv_size, entry);
+	else
+		rv = 0;
 	if (rv != 0) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_next_entry: parsing entry failed: %s", *dn);
 		printf("%zu\n", data.mv_size);
@@ -803,7 +1692,7 @@ int cache_next_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_re
 		*dn = NULL;
 	}
 
-	rv = dntree_lookup_dn4id(*id2dn_read_cursor_pp, dnid, dn);
+	rv = dntree_scan_dn4id(*id2dn_read_cursor_pp, dnid, dn);
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_next_entry: DB corruption, DN entry for id %d not found", *(int *)key.mv_data);
 		ERROR_MDB_ABORT(rv, "mdb_get");
@@ -813,6 +1702,28 @@ int cache_next_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_re
 	return 0;
 }
 
+int cache_first_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry) {
+	return first_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry, false);
+}
+
+int cache_next_entry(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry) {
+	return next_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry, false);
+}
+
+/*
+ * Iterate like cache_first_entry() and cache_next_entry(), but return entries
+ * as read-only views into the database instead of copies.
+ * A view is only valid until the cursor is freed or the database is modified
+ * and must still be released by cache_free_entry().
+ */
+int cache_first_entry_view(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry) {
+	return first_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry, true);
+}
+
+int cache_next_entry_view(MDB_cursor **id2entry_read_cursor_pp, MDB_cursor **id2dn_read_cursor_pp, char **dn, CacheEntry *entry) {
+	return next_entry(id2entry_read_cursor_pp, id2dn_read_cursor_pp, dn, entry, true);
+}
+
 int cache_free_cursor(MDB_cursor *id2entry_read_cursor_pp, MDB_cursor *id2dn_read_cursor_pp) {
 	int rv = 0;
 	MDB_txn *read_txn;
@@ -823,14 +1734,761 @@ int cache_free_cursor(MDB_cursor *id2entry_read_cursor_pp, MDB_cursor *id2dn_rea
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_free_cursor: Transaction commit");
 	rv = mdb_txn_commit(read_txn);
+	/* begun by cache_txn_begin(mdb_readonly) in first_entry() */
+	if (mdb_readonly)
+		read_only_txn_ended();
 	if (rv != MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_free_cursor: Transaction commit failed");
 		ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		dntree_cache_clear();
+	}
+	return rv;
+}
+
+/* Start nesting all following cache transactions into one, which is written
+ * to disk by cache_batch_commit(). */
+int cache_batch_begin(void) {
+	int rv;
+
+	if (batch_txn != NULL)
+		return MDB_SUCCESS;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_batch_begin: Transaction begin");
+	rv = cache_txn_begin(0, &batch_txn);
+	if (rv != MDB_SUCCESS) {
+		batch_txn = NULL;
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+	return MDB_SUCCESS;
+}
+
+/* Commit the group of transactions started by cache_batch_begin(). */
+int cache_batch_commit(void) {
+	int rv;
+
+	if (batch_txn == NULL)
+		return MDB_SUCCESS;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "cache_batch_commit: Transaction commit");
+	PROBE0(batch_commit_start);
+	rv = mdb_txn_commit(batch_txn);
+	PROBE1(batch_commit_end, rv);
+	batch_txn = NULL;
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_batch_commit: storing group of transactions failed");
+		ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+		dntree_cache_clear();
+	}
+	return rv;
+}
+
+/*
+ * Rewrite all entries still stored in an older on-disk format, or not yet
+ * compressed although compression is enabled.
+ * Entries are otherwise only upgraded when they are modified.
+ * :param count: Return variable to receive the number of converted entries.
+ * :returns: 0 on success, an LMDB error otherwise.
+ */
+int cache_upgrade_entries(int *count) {
+	const int per_txn = 1000;
+	MDB_txn *write_txn;
+	MDB_cursor *cur;
+	MDB_val key, data, new_data;
+	DNID dnid = MASTER_KEY;
+	CacheEntry entry;
+	u_int32_t tmp_size;
+	int rv, converted;
+
+	*count = 0;
+	/* commit regularly, as a single transaction might not hold all dirty pages */
+	do {
+		rv = cache_txn_begin(0, &write_txn);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+			return rv;
+		}
+		rv = mdb_cursor_open(write_txn, id2entry, &cur);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+			mdb_txn_abort(write_txn);
+			return rv;
+		}
+
+		key.mv_data = &dnid;
+		key.mv_size = sizeof(DNID);
+		rv = mdb_cursor_get(cur, &key, &data, MDB_SET_RANGE);
+		for (converted = 0; rv == MDB_SUCCESS && converted < per_txn; rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT)) {
+			dnid = *(DNID *)key.mv_data;
+			if (dnid == MASTER_KEY || !entry_outdated(data.mv_data, data.mv_size))
+				continue;
+
+			if (parse_entry(data.mv_data, data.mv_size, &entry) != 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_upgrade_entries: parsing entry %lu failed, skipped", dnid);
+				cache_free_entry(NULL, &entry);
+				continue;
+			}
+			memset(&new_data, 0, sizeof(MDB_val));
+			tmp_size = 0;
+			rv = unparse_entry(&new_data.mv_data, &tmp_size, &entry);
+			new_data.mv_size = tmp_size;
+			cache_free_entry(NULL, &entry);
+			if (rv != 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_upgrade_entries: unparsing entry %lu failed", dnid);
+				free(new_data.mv_data);
+				mdb_cursor_close(cur);
+				mdb_txn_abort(write_txn);
+				return rv;
+			}
+			rv = mdb_cursor_put(cur, &key, &new_data, MDB_CURRENT);
+			free(new_data.mv_data);
+			if (rv != MDB_SUCCESS) {
+				ERROR_MDB_ABORT(rv, "mdb_cursor_put");
+				mdb_cursor_close(cur);
+				mdb_txn_abort(write_txn);
+				return rv;
+			}
+			converted++;
+		}
+		mdb_cursor_close(cur);
+		if (rv != MDB_SUCCESS && rv != MDB_NOTFOUND) {
+			ERROR_MDB_ABORT(rv, "mdb_cursor_get");
+			mdb_txn_abort(write_txn);
+			return rv;
+		}
+
+		rv = mdb_txn_commit(write_txn);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+			return rv;
+		}
+		*count += converted;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache_upgrade_entries: %d entries converted", *count);
+	} while (converted == per_txn);
+
+	return MDB_SUCCESS;
+}
+
+/* Remove a module from one stored entry, deleting it if no module is left. */
+static int remove_module_from_entry(MDB_txn *txn, MDB_cursor *dn_cur, DNID dnid, char *module, bool *modified) {
+	MDB_val key, data, new_data;
+	CacheEntry entry;
+	char *dn = NULL;
+	u_int32_t tmp_size = 0;
+	int rv;
+
+	*modified = false;
+	key.mv_data = &dnid;
+	key.mv_size = sizeof(DNID);
+	if ((rv = mdb_get(txn, id2entry, &key, &data)) != MDB_SUCCESS)
+		return rv;
+
+	assert(data.mv_size <= UINT32_MAX);
+	if (parse_entry_view(data.mv_data, (u_int32_t)data.mv_size, &entry) != 0 && parse_entry(data.mv_data, (u_int32_t)data.mv_size, &entry) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_remove_module: parsing entry %lu failed, skipped", dnid);
+		cache_free_entry(NULL, &entry);
+		return MDB_SUCCESS;
+	}
+	if (!cache_entry_module_present(&entry, module)) {
+		cache_free_entry(NULL, &entry);
+		return MDB_SUCCESS;
+	}
+	cache_entry_module_remove(&entry, module);
+	*modified = true;
+
+	if (entry.module_count == 0) {
+		/* also drops the entry from the module index */
+		cache_free_entry(NULL, &entry);
+		rv = dntree_lookup_dn4id(dn_cur, dnid, &dn);
+		if (rv == MDB_SUCCESS)
+			rv = cache_delete_entry_in_transaction(0, dn, &dn_cur);
+		free(dn);
+		return rv;
 	}
+
+	memset(&new_data, 0, sizeof(MDB_val));
+	rv = unparse_entry(&new_data.mv_data, &tmp_size, &entry);
+	new_data.mv_size = tmp_size;
+	cache_free_entry(NULL, &entry);
+	if (rv == 0)
+		rv = mdb_put(txn, id2entry, &key, &new_data, 0);
+	free(new_data.mv_data);
+	if (rv == MDB_SUCCESS && module_index)
+		rv = module_index_set(txn, module, dnid, false);
 	return rv;
 }
 
+/*
+ * Collect the next DNIDs to process for cache_remove_module(), either from the
+ * module index or by scanning id2entry for DNIDs after `*next`.
+ */
+static int module_dnids(MDB_txn *txn, char *module, DNID *next, DNID *dnids, int max, int *count) {
+	MDB_cursor *cur;
+	MDB_val key, data;
+	int rv;
+
+	*count = 0;
+	if (module_index) {
+		if ((rv = mdb_cursor_open(txn, module2dnid, &cur)) != MDB_SUCCESS)
+			return rv;
+		key.mv_data = module;
+		key.mv_size = strlen(module);
+		for (rv = mdb_cursor_get(cur, &key, &data, MDB_SET); rv == MDB_SUCCESS && *count < max; rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT_DUP))
+			memcpy(&dnids[(*count)++], data.mv_data, sizeof(DNID));
+	} else {
+		if ((rv = mdb_cursor_open(txn, id2entry, &cur)) != MDB_SUCCESS)
+			return rv;
+		key.mv_data = next;
+		key.mv_size = sizeof(DNID);
+		for (rv = mdb_cursor_get(cur, &key, &data, MDB_SET_RANGE); rv == MDB_SUCCESS && *count < max; rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT)) {
+			*next = *(DNID *)key.mv_data + 1;
+			if (*(DNID *)key.mv_data != MASTER_KEY)
+				dnids[(*count)++] = *(DNID *)key.mv_data;
+		}
+	}
+	mdb_cursor_close(cur);
+
+	return rv == MDB_NOTFOUND ? MDB_SUCCESS : rv;
+}
+
+/*
+ * Remove a module from all cache entries and delete those no longer used by
+ * any module. Only the entries registered with the module are looked at if the
+ * module index is available, otherwise all entries are read.
+ * :param module: The name of the module.
+ * :param count: Return variable to receive the number of modified entries.
+ * :returns: 0 on success, an LMDB error otherwise.
+ */
+int cache_remove_module(char *module, int *count) {
+	DNID dnids[1000], next = MASTER_KEY;
+	const int per_txn = sizeof(dnids) / sizeof(dnids[0]);
+	MDB_txn *write_txn;
+	MDB_cursor *dn_cur;
+	bool modified;
+	int rv, i, found;
+
+	*count = 0;
+	/* commit regularly, as a single transaction might not hold all dirty pages */
+	do {
+		rv = cache_txn_begin(0, &write_txn);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+			return rv;
+		}
+		rv = mdb_cursor_open(write_txn, id2dn, &dn_cur);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+			mdb_txn_abort(write_txn);
+			return rv;
+		}
+
+		rv = module_dnids(write_txn, module, &next, dnids, per_txn, &found);
+		for (i = 0; rv == MDB_SUCCESS && i < found; i++) {
+			rv = remove_module_from_entry(write_txn, dn_cur, dnids[i], module, &modified);
+			/* drop stale or unparsable index records, too */
+			if (rv == MDB_NOTFOUND)
+				rv = MDB_SUCCESS;
+			if (rv == MDB_SUCCESS && module_index && !modified)
+				rv = module_index_set(write_txn, module, dnids[i], false);
+			if (modified)
+				(*count)++;
+		}
+		mdb_cursor_close(dn_cur);
+		if (rv != MDB_SUCCESS) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_remove_module: updating entries failed");
+			ERROR_MDB_ABORT(rv, "cache_remove_module");
+			mdb_txn_abort(write_txn);
+			dntree_cache_clear();
+			return rv;
+		}
+
+		rv = mdb_txn_commit(write_txn);
+		if (rv != MDB_SUCCESS) {
+			ERROR_MDB_ABORT(rv, "mdb_txn_commit");
+			dntree_cache_clear();
+			return rv;
+		}
+	} while (found == per_txn);
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "cache_remove_module: %s removed from %d entries", module, *count);
+	return MDB_SUCCESS;
+}
+
+/*
+ * Call `func` for all cache entries registered with a module, until it
+ * returns non-zero.
+ * :param module: The name of the module.
+ * :param func: The callback receiving the DN and a read-only view of the entry.
+ * :returns: 0 on success, the non-zero return value of `func`, or an LMDB error.
+ */
+int cache_foreach_module_entry(char *module, int (*func)(char *dn, CacheEntry *entry, void *data), void *data) {
+	MDB_txn *read_txn;
+	MDB_cursor *cur, *dn_cur;
+	MDB_val key, value, entry_key, entry_data;
+	CacheEntry entry;
+	DNID dnid;
+	char *dn;
+	int rv;
+
+	rv = read_txn_begin(&read_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+	if ((rv = mdb_cursor_open(read_txn, module_index ? module2dnid : id2entry, &cur)) != MDB_SUCCESS || (rv = mdb_cursor_open(read_txn, id2dn, &dn_cur)) != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+		read_txn_end(read_txn);
+		return rv;
+	}
+
+	key.mv_data = module;
+	key.mv_size = strlen(module);
+	for (rv = mdb_cursor_get(cur, &key, &value, module_index ? MDB_SET : MDB_FIRST); rv == MDB_SUCCESS; rv = mdb_cursor_get(cur, &key, &value, module_index ? MDB_NEXT_DUP : MDB_NEXT)) {
+		if (module_index) {
+			memcpy(&dnid, value.mv_data, sizeof(DNID));
+			entry_key.mv_data = &dnid;
+			entry_key.mv_size = sizeof(DNID);
+			if ((rv = mdb_get(read_txn, id2entry, &entry_key, &entry_data)) == MDB_NOTFOUND)
+				continue;
+			if (rv != MDB_SUCCESS)
+				break;
+		} else {
+			dnid = *(DNID *)key.mv_data;
+			if (dnid == MASTER_KEY)
+				continue;
+			entry_data = value;
+		}
+
+		assert(entry_data.mv_size <= UINT32_MAX);
+		if (parse_entry_view(entry_data.mv_data, (u_int32_t)entry_data.mv_size, &entry) != 0 && parse_entry(entry_data.mv_data, (u_int32_t)entry_data.mv_size, &entry) != 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_foreach_module_entry: parsing entry %lu failed, skipped", dnid);
+			cache_free_entry(NULL, &entry);
+			continue;
+		}
+		if (!cache_entry_module_present(&entry, module)) {
+			cache_free_entry(NULL, &entry);
+			continue;
+		}
+		dn = NULL;
+		if ((rv = dntree_lookup_dn4id(dn_cur, dnid, &dn)) == MDB_SUCCESS)
+			rv = func(dn, &entry, data);
+		cache_free_entry(&dn, &entry);
+		if (rv != MDB_SUCCESS)
+			break;
+	}
+	mdb_cursor_close(dn_cur);
+	mdb_cursor_close(cur);
+	read_txn_end(read_txn);
+
+	return rv == MDB_NOTFOUND ? MDB_SUCCESS : rv;
+}
+
+/* Push the children of a node of the DN tree onto the stack of the iterator. */
+static int iter_push_children(CacheIter *iter, DNID dnid) {
+	MDB_val key, data;
+	subDN *subdn;
+	int rv;
+
+	key.mv_data = &dnid;
+	key.mv_size = sizeof(DNID);
+	for (rv = mdb_cursor_get(iter->dn_cur, &key, &data, MDB_SET); rv == MDB_SUCCESS; rv = mdb_cursor_get(iter->dn_cur, &key, &data, MDB_NEXT_DUP)) {
+		subdn = (subDN *)data.mv_data;
+		if (subdn->type != SUBDN_TYPE_LINK)
+			continue;
+		if (iter->stack_count == iter->stack_size) {
+			iter->stack_size = iter->stack_size ? iter->stack_size * 2 : 64;
+			if ((iter->stack = realloc(iter->stack, iter->stack_size * sizeof(DNID))) == NULL)
+				abort();  // FIXME
+		}
+		iter->stack[iter->stack_count++] = subdn->id;
+	}
+	return rv == MDB_NOTFOUND ? MDB_SUCCESS : rv;
+}
+
+/* Find the next DNID in the iterated order and the data of its entry. */
+static int iter_candidate(CacheIter *iter, DNID *dnid, MDB_val *data) {
+	MDB_val key, value;
+	DNID first = iter->options.first;
+	int rv;
+
+	for (;;) {
+		if (iter->options.base) {
+			if (iter->stack_count == 0)
+				return MDB_NOTFOUND;
+			*dnid = iter->stack[--iter->stack_count];
+			if ((rv = iter_push_children(iter, *dnid)) != MDB_SUCCESS)
+				return rv;
+			/* the children may still be in the range */
+			if (*dnid < iter->options.first || (iter->options.last && *dnid >= iter->options.last))
+				continue;
+		} else if (iter->module_cur) {
+			key.mv_data = (void *)iter->options.module;
+			key.mv_size = strlen(iter->options.module);
+			value.mv_data = &first;
+			value.mv_size = sizeof(DNID);
+			rv = mdb_cursor_get(iter->module_cur, &key, &value, iter->started ? MDB_NEXT_DUP : MDB_GET_BOTH_RANGE);
+			iter->started = true;
+			if (rv != MDB_SUCCESS)
+				return rv;
+			memcpy(dnid, value.mv_data, sizeof(DNID));
+			if (iter->options.last && *dnid >= iter->options.last)
+				return MDB_NOTFOUND;
+		} else {
+			key.mv_data = &first;
+			key.mv_size = sizeof(DNID);
+			rv = mdb_cursor_get(iter->cur, &key, data, iter->started ? MDB_NEXT : MDB_SET_RANGE);
+			iter->started = true;
+			if (rv != MDB_SUCCESS)
+				return rv;
+			*dnid = *(DNID *)key.mv_data;
+			if (*dnid == MASTER_KEY)
+				continue;
+			if (iter->options.last && *dnid >= iter->options.last)
+				return MDB_NOTFOUND;
+			return MDB_SUCCESS;
+		}
+
+		/* nodes of the DN tree and stale index records have no entry */
+		key.mv_data = dnid;
+		key.mv_size = sizeof(DNID);
+		rv = mdb_get(iter->txn, id2entry, &key, data);
+		if (rv != MDB_NOTFOUND)
+			return rv;
+	}
+}
+
+/*
+ * Begin iterating over the part of the cache given by the options.
+ * Entries are returned by ascending DNID, or parents before their children
+ * when iterating over a subtree. Each iterator uses a read-only transaction
+ * of its own, so several iterators, e.g. over disjoint DNID ranges from
+ * cache_get_dnid_range(), may be used in threads of their own.
+ * The iterator must be ended by cache_iter_end().
+ * :param iter: The iterator to initialize.
+ * :param options: The part of the cache to iterate over.
+ * :returns: 0 on success, MDB_NOTFOUND if the base does not exist, an LMDB error otherwise.
+ */
+int cache_iter_begin(CacheIter *iter, const CacheIterOptions *options) {
+	DNID base;
+	int rv;
+
+	memset(iter, 0, sizeof(CacheIter));
+	iter->options = *options;
+
+	if (batch_txn)
+		rv = mdb_txn_begin(env, batch_txn, 0, &iter->txn);
+	else if ((rv = read_only_txn_begin(&iter->txn, false)) == MDB_SUCCESS)
+		iter->read_only = true;
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		iter->txn = NULL;
+		return rv;
+	}
+	if ((rv = mdb_cursor_open(iter->txn, id2entry, &iter->cur)) != MDB_SUCCESS || (rv = mdb_cursor_open(iter->txn, id2dn, &iter->dn_cur)) != MDB_SUCCESS || (options->module && module_index && (rv = mdb_cursor_open(iter->txn, module2dnid, &iter->module_cur)) != MDB_SUCCESS)) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+		cache_iter_end(iter);
+		return rv;
+	}
+
+	if (!options->base && !options->module) {
+		/* read ahead for the whole scan, single subtrees and modules are scattered */
+		iter->sequential = true;
+		if (__atomic_fetch_add(&scans, 1, __ATOMIC_RELAXED) == 0)
+			cache_madvise(MADV_SEQUENTIAL);
+	}
+	if (options->base) {
+		if ((rv = dntree_get_id4dn(iter->dn_cur, (char *)options->base, &base, false)) != MDB_SUCCESS) {
+			cache_iter_end(iter);
+			return rv;
+		}
+		if ((iter->stack = malloc(sizeof(DNID))) == NULL)
+			abort();  // FIXME
+		iter->stack[0] = base;
+		iter->stack_count = iter->stack_size = 1;
+	}
+	return MDB_SUCCESS;
+}
+
+/*
+ * Return the next entry of the iterator as a read-only view, which is valid
+ * until cache_iter_end() and must be released by cache_free_entry().
+ * :param iter: The iterator from cache_iter_begin().
+ * :param dnid: Return variable for the DNID of the entry, or NULL.
+ * :param dn: Return variable for the DN, which is freed on the next call, unless CACHE_ITER_NO_DN is given.
+ * :param entry: Return variable for the entry, which is empty if CACHE_ITER_NO_ENTRY is given.
+ * :returns: 0 on success, -1 if the entry could not be parsed, MDB_NOTFOUND after the last entry, an LMDB error otherwise.
+ */
+int cache_iter_next(CacheIter *iter, DNID *dnid, char **dn, CacheEntry *entry) {
+	const char *module = iter->options.module;
+	bool by_module = iter->module_cur && !iter->options.base;
+	bool parse = !(iter->options.flags & CACHE_ITER_NO_ENTRY) || (module && !module_index);
+	bool broken;
+	MDB_val key, value, data;
+	DNID id;
+	int rv;
+
+	memset(entry, 0, sizeof(CacheEntry));
+	for (;;) {
+		if ((rv = iter_candidate(iter, &id, &data)) != MDB_SUCCESS)
+			return rv;
+
+		if (module && module_index && !by_module) {
+			key.mv_data = (void *)module;
+			key.mv_size = strlen(module);
+			value.mv_data = &id;
+			value.mv_size = sizeof(DNID);
+			rv = mdb_cursor_get(iter->module_cur, &key, &value, MDB_GET_BOTH);
+			if (rv == MDB_NOTFOUND)
+				continue;
+			if (rv != MDB_SUCCESS)
+				return rv;
+		}
+
+		broken = false;
+		if (parse) {
+			assert(data.mv_size <= UINT32_MAX);
+			if (parse_entry_view(data.mv_data, (u_int32_t)data.mv_size, entry) != 0 && parse_entry(data.mv_data, (u_int32_t)data.mv_size, entry) != 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_iter_next: parsing entry %lu failed", id);
+				cache_free_entry(NULL, entry);
+				memset(entry, 0, sizeof(CacheEntry));
+				broken = true;
+			} else if (module && !module_index && !cache_entry_module_present(entry, (char *)module)) {
+				cache_free_entry(NULL, entry);
+				memset(entry, 0, sizeof(CacheEntry));
+				continue;
+			}
+			if (iter->options.flags & CACHE_ITER_NO_ENTRY) {
+				cache_free_entry(NULL, entry);
+				memset(entry, 0, sizeof(CacheEntry));
+			}
+		}
+		break;
+	}
+
+	if (dnid)
+		*dnid = id;
+	if (!(iter->options.flags & CACHE_ITER_NO_DN)) {
+		free(*dn);
+		*dn = NULL;
+		/* the DN tree is visited in the ascending order of the DNIDs only without a subtree */
+		rv = iter->options.base ? dntree_lookup_dn4id(iter->dn_cur, id, dn) : dntree_scan_dn4id(iter->dn_cur, id, dn);
+		if (rv != MDB_SUCCESS) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_iter_next: DB corruption, DN entry for id %lu not found", id);
+			cache_free_entry(NULL, entry);
+			return rv;
+		}
+	}
+	return broken ? -1 : 0;
+}
+
+void cache_iter_end(CacheIter *iter) {
+	if (iter->module_cur)
+		mdb_cursor_close(iter->module_cur);
+	if (iter->dn_cur)
+		mdb_cursor_close(iter->dn_cur);
+	if (iter->cur)
+		mdb_cursor_close(iter->cur);
+	if (iter->txn)
+		mdb_txn_abort(iter->txn);
+	if (iter->read_only)
+		read_only_txn_ended();
+	if (iter->sequential && __atomic_sub_fetch(&scans, 1, __ATOMIC_RELAXED) == 0)
+		cache_madvise(steady_advice);
+	free(iter->stack);
+	memset(iter, 0, sizeof(CacheIter));
+}
+
+/* Read the master entry in the snapshot of the iterator, which matches its entries. */
+int cache_iter_master_entry(CacheIter *iter, CacheMasterEntry *master_entry) {
+	MDB_val key, data;
+	int rv;
+
+	key.mv_data = &MASTER_KEY;
+	key.mv_size = MASTER_KEY_SIZE;
+	if ((rv = mdb_get(iter->txn, id2entry, &key, &data)) != MDB_SUCCESS)
+		return rv;
+	memset(master_entry, 0, sizeof(CacheMasterEntry));
+	if (data.mv_size != sizeof(CacheMasterEntry) && data.mv_size != offsetof(CacheMasterEntry, flags)) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_iter_master_entry: master entry has unexpected length");
+		return 1;
+	}
+	memcpy(master_entry, data.mv_data, data.mv_size);
+	return MDB_SUCCESS;
+}
+
+/*
+ * Get the range of the DNIDs of all entries, e.g. to split it up for
+ * iterating over the cache in several threads.
+ * :param first: Return variable for the lowest DNID.
+ * :param last: Return variable for the DNID after the highest one, which is equal to `first` without entries.
+ * :returns: 0 on success, an LMDB error otherwise.
+ */
+int cache_get_dnid_range(DNID *first, DNID *last) {
+	MDB_txn *read_txn;
+	MDB_cursor *cur;
+	MDB_val key, data;
+	int rv;
+
+	*first = *last = 0;
+	rv = read_txn_begin(&read_txn);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_txn_begin");
+		return rv;
+	}
+	if ((rv = mdb_cursor_open(read_txn, id2entry, &cur)) != MDB_SUCCESS) {
+		ERROR_MDB_ABORT(rv, "mdb_cursor_open");
+		read_txn_end(read_txn);
+		return rv;
+	}
+	rv = mdb_cursor_get(cur, &key, &data, MDB_FIRST);
+	if (rv == MDB_SUCCESS && *(DNID *)key.mv_data == MASTER_KEY)
+		rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT);
+	if (rv == MDB_SUCCESS) {
+		*first = *(DNID *)key.mv_data;
+		if ((rv = mdb_cursor_get(cur, &key, &data, MDB_LAST)) == MDB_SUCCESS)
+			*last = *(DNID *)key.mv_data + 1;
+	}
+	mdb_cursor_close(cur);
+	read_txn_end(read_txn);
+
+	return rv == MDB_NOTFOUND ? MDB_SUCCESS : rv;
+}
+
+/*
+ * Compact the database by writing a copy without free pages and replacing the
+ * database file with it. The caller must hold the cache lock, as changes made
+ * by others after the copy are lost, and must re-open the cache afterwards.
+ * :returns: 0 on success, an LMDB or system error otherwise.
+ */
+int cache_compact(void) {
+	char tmp_dir[PATH_MAX], tmp_file[PATH_MAX], file[PATH_MAX];
+	MDB_envinfo info;
+	MDB_stat stat;
+	int rv;
+
+	rv = snprintf(tmp_dir, PATH_MAX, "%s.compact", mdb_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		return ENAMETOOLONG;
+	rv = snprintf(tmp_file, PATH_MAX, "%s/data.mdb", tmp_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		return ENAMETOOLONG;
+	rv = snprintf(file, PATH_MAX, "%s/data.mdb", mdb_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		return ENAMETOOLONG;
+
+	cache_batch_commit();
+	if (mdb_env_info(env, &info) == MDB_SUCCESS && mdb_env_stat(env, &stat) == MDB_SUCCESS)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_compact: compacting %zu bytes", (info.me_last_pgno + 1) * (size_t)stat.ms_psize);
+
+	unlink(tmp_file);
+	if (mkdir(tmp_dir, 0700) != 0 && errno != EEXIST) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_compact: mkdir %s failed: %s", tmp_dir, strerror(errno));
+		return errno;
+	}
+	rv = mdb_env_copy2(env, tmp_dir, MDB_CP_COMPACT);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB(rv, "mdb_env_copy2");
+		unlink(tmp_file);
+		rmdir(tmp_dir);
+		return rv;
+	}
+	if (rename(tmp_file, file) != 0) {
+		rv = errno;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_compact: rename %s failed: %s", tmp_file, strerror(rv));
+		unlink(tmp_file);
+		rmdir(tmp_dir);
+		return rv;
+	}
+	rmdir(tmp_dir);
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_compact: replaced %s", file);
+	return 0;
+}
+
+/*
+ * Write a consistent copy of the database, including the notifier ID of the
+ * master entry, to the existing empty directory, while the listener may keep
+ * running. It is used by cache_seed() on another system.
+ * :returns: 0 on success, an LMDB or system error otherwise.
+ */
+int cache_snapshot(const char *dir) {
+	int rv;
+
+	cache_batch_commit();
+	rv = mdb_env_copy2(env, dir, MDB_CP_COMPACT);
+	if (rv != MDB_SUCCESS) {
+		ERROR_MDB(rv, "mdb_env_copy2");
+		return rv;
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_snapshot: wrote %s/data.mdb", dir);
+	return 0;
+}
+
+/*
+ * Replace the database file in the directory with the one of a snapshot
+ * written by cache_snapshot(), before the cache is opened by cache_init().
+ * :returns: 0 on success, a system error otherwise.
+ */
+int cache_seed(const char *cache_mdb_dir, const char *snapshot_dir) {
+	char tmp_file[PATH_MAX], file[PATH_MAX], snapshot[PATH_MAX], buf[BUFSIZ];
+	FILE *in, *out;
+	size_t n;
+	int rv;
+
+	rv = snprintf(snapshot, PATH_MAX, "%s/data.mdb", snapshot_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		return ENAMETOOLONG;
+	rv = snprintf(tmp_file, PATH_MAX, "%s/data.mdb.seed", cache_mdb_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		return ENAMETOOLONG;
+	rv = snprintf(file, PATH_MAX, "%s/data.mdb", cache_mdb_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		return ENAMETOOLONG;
+
+	if ((in = fopen(snapshot, "r")) == NULL) {
+		rv = errno;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_seed: open %s failed: %s", snapshot, strerror(rv));
+		return rv;
+	}
+	if ((out = fopen(tmp_file, "w")) == NULL) {
+		rv = errno;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_seed: open %s failed: %s", tmp_file, strerror(rv));
+		fclose(in);
+		return rv;
+	}
+	rv = 0;
+	while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		if (fwrite(buf, 1, n, out) != n) {
+			rv = errno;
+			break;
+		}
+	}
+	if (rv == 0 && ferror(in))
+		rv = EIO;
+	if (rv == 0 && (fflush(out) != 0 || fsync(fileno(out)) != 0))
+		rv = errno;
+	if (fclose(out) != 0 && rv == 0)
+		rv = errno;
+	fclose(in);
+	if (rv == 0 && rename(tmp_file, file) != 0)
+		rv = errno;
+	if (rv != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_seed: copying %s failed: %s", snapshot, strerror(rv));
+		unlink(tmp_file);
+		return rv;
+	}
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "cache_seed: replaced %s with %s", file, snapshot);
+	return 0;
+}
+
 void cache_close(void) {
+	cache_warmup_stop();
+	cache_batch_commit();
+	if (reader_txn) {
+		mdb_txn_abort(reader_txn);
+		reader_txn = NULL;
+	}
 	mdb_close(env, id2dn);
 	mdb_close(env, id2entry);
 	mdb_env_close(env);
@@ -40,30 +40,82 @@
 
 #include "network.h"
 #include "cache_entry.h"
+#include "cache_dn.h"
 
 extern int INIT_ONLY;
+
+/* flags of CacheIterOptions */
+#define CACHE_ITER_NO_DN 0x1    /* do not look up the DNs */
+#define CACHE_ITER_NO_ENTRY 0x2 /* do not parse the entries */
+
+/* part of the cache iterated by cache_iter_next(), all conditions must hold */
+typedef struct {
+	DNID first;         /* lowest DNID, or 0 */
+	DNID last;          /* DNID after the highest one, or 0 */
+	const char *base;   /* only entries below or at this DN, or NULL */
+	const char *module; /* only entries registered with this module, or NULL */
+	int flags;
+} CacheIterOptions;
+
+typedef struct {
+	CacheIterOptions options;
+	MDB_txn *txn;
+	MDB_cursor *cur;        /* id2entry */
+	MDB_cursor *dn_cur;     /* id2dn */
+	MDB_cursor *module_cur; /* module2dnid, if there is an index */
+	DNID *stack;            /* nodes of the subtree still to be visited */
+	int stack_count;
+	int stack_size;
+	bool started;
+	bool sequential;        /* a full scan, see cache_warmup() */
+	bool read_only;         /* a top-level read-only transaction, not nested into a batch */
+} CacheIter;
+
 extern char *cache_dir;
 extern char *ldap_dir;
 
 int cache_lock(void);
 int cache_init(char *cache_mdb_dir, int mdb_flags);
+void cache_warmup(void);
 void cache_sync(void);
 int cache_get_master_entry(CacheMasterEntry *master_entry);
 int cache_update_master_entry(CacheMasterEntry *master_entry);
 int cache_update_entry(NotifierID id, char *dn, CacheEntry *entry);
 int cache_update_entry_lower(NotifierID id, char *dn, CacheEntry *entry);
+void cache_filter_attributes(char ***names, int *count);
 int cache_delete_entry(NotifierID id, char *dn);
 int cache_delete_entry_lower_upper(NotifierID id, char *dn);
+int cache_delete_entries(NotifierID id, char **dns, int count);
+int cache_move_subtree(NotifierID id, char *old_dn, char *new_dn, CacheEntry *entry);
+int cache_normalize(int *count);
 int cache_update_or_deleteifunused_entry(NotifierID id, char *dn, CacheEntry *entry, MDB_cursor **cur);
 int cache_get_entry(char *dn, CacheEntry *entry);
 int cache_get_entry_lower_upper(char *dn, CacheEntry *entry);
+int cache_get_entries(char **dns, int count, CacheEntry *entries, int *results);
 int cache_first_entry(MDB_cursor **cur, MDB_cursor **cur_dn, char **dn, CacheEntry *entry);
 int cache_next_entry(MDB_cursor **cur, MDB_cursor **cur_dn, char **dn, CacheEntry *entry);
+int cache_first_entry_view(MDB_cursor **cur, MDB_cursor **cur_dn, char **dn, CacheEntry *entry);
+int cache_next_entry_view(MDB_cursor **cur, MDB_cursor **cur_dn, char **dn, CacheEntry *entry);
 int cache_free_cursor(MDB_cursor *cur, MDB_cursor *cur_dn);
+int cache_upgrade_entries(int *count);
+int cache_remove_module(char *module, int *count);
+int cache_foreach_module_entry(char *module, int (*func)(char *dn, CacheEntry *entry, void *data), void *data);
+int cache_iter_begin(CacheIter *iter, const CacheIterOptions *options);
+int cache_iter_next(CacheIter *iter, DNID *dnid, char **dn, CacheEntry *entry);
+void cache_iter_end(CacheIter *iter);
+int cache_iter_master_entry(CacheIter *iter, CacheMasterEntry *master_entry);
+int cache_get_dnid_range(DNID *first, DNID *last);
+int cache_compact(void);
+int cache_snapshot(const char *dir);
+int cache_seed(const char *cache_mdb_dir, const char *snapshot_dir);
+int cache_batch_begin(void);
+int cache_batch_commit(void);
 void cache_close(void);
 
 int cache_set_int(char *key, const NotifierID value);
 int cache_get_int(char *key, NotifierID *value, const long def);
+int cache_set_string(char *key, const char *value);
+int cache_get_string(char *key, char **value);
 
 int cache_get_schema_id(NotifierID *value, const long def);
 int cache_set_schema_id(const NotifierID value);
@@ -46,6 +46,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -80,54 +81,150 @@ static unsigned int num_rdns(LDAPDN dn) {
 	return iRDN;
 }
 
+/* Most DNs share a few parent containers, so cache parent DN -> DNID.
+ * Only the listener writes the cache, so entries stay valid until the
+ * node is deleted or the transaction creating it is aborted. */
+#define DN_CACHE_SIZE 64
+static struct dn_cache_entry {
+	char *dn;
+	size_t hash;
+	DNID id;
+	unsigned long used;
+} dn_cache[DN_CACHE_SIZE];
+static unsigned long dn_cache_clock;
+
+static size_t dn_cache_hash(const char *dn) {
+	size_t hash = 2166136261u;  // FNV-1a
+
+	while (*dn)
+		hash = (hash ^ (unsigned char)*dn++) * 16777619u;
+	return hash;
+}
+
+static bool dn_cache_get(const char *dn, size_t hash, DNID *id) {
+	int i;
+
+	for (i = 0; i < DN_CACHE_SIZE; i++) {
+		struct dn_cache_entry *e = &dn_cache[i];
+
+		if (e->dn && e->hash == hash && !strcmp(e->dn, dn)) {
+			e->used = ++dn_cache_clock;
+			*id = e->id;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void dn_cache_put(const char *dn, size_t hash, DNID id) {
+	struct dn_cache_entry *lru = &dn_cache[0];
+	int i;
+
+	for (i = 0; i < DN_CACHE_SIZE && lru->dn; i++) {
+		if (!dn_cache[i].dn || dn_cache[i].used < lru->used)
+			lru = &dn_cache[i];
+	}
+	free(lru->dn);
+	if ((lru->dn = strdup(dn)) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: strdup failed", __func__);
+		abort();
+	}
+	lru->hash = hash;
+	lru->id = id;
+	lru->used = ++dn_cache_clock;
+}
+
+static void dn_cache_drop_id(DNID id) {
+	int i;
+
+	for (i = 0; i < DN_CACHE_SIZE; i++) {
+		if (dn_cache[i].dn && dn_cache[i].id == id) {
+			free(dn_cache[i].dn);
+			dn_cache[i].dn = NULL;
+		}
+	}
+}
+
+/* Must be called when a write transaction is aborted. */
+void dntree_cache_clear(void) {
+	int i;
+
+	for (i = 0; i < DN_CACHE_SIZE; i++) {
+		free(dn_cache[i].dn);
+		dn_cache[i].dn = NULL;
+	}
+}
+
 /* climb the dntree */
 static int dntree_lookup_id4ldapdn(MDB_cursor *cur, LDAPDN dn, DNID *dnid_out, int *found_out) {
 	int rv = MDB_NOTFOUND, iRDN, found;
 	MDB_val key, data;
 	DNID parent, id = 0;
-	char *rdn;
+	char *rdn, *parent_dn = NULL;
+	size_t hash = 0, rdn_len;
 	subDN *subdn;
+	union {
+		subDN subdn;
+		char buf[sizeof(subDN) + 256];
+	} probe;
 
 	key.mv_size = sizeof(DNID);
 
 	found = 0;
 	iRDN = num_rdns(dn);
+	/* start below the cached parent */
+	if (iRDN > 1 && ldap_dn2str(&dn[1], &parent_dn, LDAP_DN_FORMAT_LDAPV3) == LDAP_SUCCESS) {
+		hash = dn_cache_hash(parent_dn);
+		if (dn_cache_get(parent_dn, hash, &id)) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "%s: cached parent id=%lu: %s", __func__, id, parent_dn);
+			found = iRDN - 1;
+			iRDN = 1;
+			ldap_memfree(parent_dn);
+			parent_dn = NULL;
+		}
+	}
 	for (iRDN--; iRDN >= 0; iRDN--) {
 		rv = ldap_rdn2str(dn[iRDN], &rdn, LDAP_DN_FORMAT_LDAPV3);
 		if (rv != LDAP_SUCCESS) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: ldap_rdn2str failed: %s (%d)", __func__, ldap_err2string(rv), rv);
-			return rv;
+			goto out;
 		}
 
 		key.mv_data = &parent;
 		parent = id;
 
-		data.mv_size = sizeof(subDN) + strlen(rdn);
-		subdn = calloc(1, data.mv_size);
-		if (subdn == NULL) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: calloc failed", __func__);
+		rdn_len = strlen(rdn);
+		data.mv_size = sizeof(subDN) + rdn_len;
+		if (data.mv_size <= sizeof(probe)) {
+			subdn = &probe.subdn;
+		} else if ((subdn = malloc(data.mv_size)) == NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: malloc failed", __func__);
 			ldap_memfree(rdn);
 			abort();
 		}
+		subdn->id = 0;
 		subdn->type = SUBDN_TYPE_LINK;
-		strcpy(subdn->data, rdn);
+		memcpy(subdn->data, rdn, rdn_len + 1);
 		ldap_memfree(rdn);
 		data.mv_data = subdn;
 
 		rv = mdb_cursor_get(cur, &key, &data, MDB_GET_BOTH);
-		free(subdn);
+		if (subdn != &probe.subdn)
+			free(subdn);
 
 		if (rv == MDB_NOTFOUND) {
 			break;
 		}
 		if (rv != MDB_SUCCESS) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: mdb_cursor_get failed: %s (%d)", __func__, mdb_strerror(rv), rv);
-			return rv;
+			goto out;
 		};
 
 		subdn = (subDN *)data.mv_data;
 		id = subdn->id;
 		found++;
+		if (iRDN == 1 && parent_dn)
+			dn_cache_put(parent_dn, hash, id);
 	}
 
 	if (rv == MDB_SUCCESS) {
@@ -141,9 +238,45 @@ static int dntree_lookup_id4ldapdn(MDB_cursor *cur, LDAPDN dn, DNID *dnid_out, i
 		*found_out = found;
 	};
 
+out:
+	ldap_memfree(parent_dn);
 	return rv;
 }
 
+/* nodes skipped by dntree_scan_dn4id() before doing a random lookup */
+#define DN_SCAN_STEPS 8
+
+/*
+ * Like dntree_lookup_dn4id(), but optimized for ascending DNIDs as returned by
+ * a scan over id2entry: step the cursor forward to the next nodes first and
+ * only fall back to a random lookup when the node is not close by.
+ */
+int dntree_scan_dn4id(MDB_cursor *cur, DNID dnid, char **dn) {
+	int rv, step;
+	MDB_val key, data;
+	subDN *subdn;
+
+	for (step = 0; step < DN_SCAN_STEPS; step++) {
+		rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT_NODUP);
+		if (rv != MDB_SUCCESS || *(DNID *)key.mv_data > dnid)
+			break;
+		if (*(DNID *)key.mv_data < dnid)
+			continue;
+
+		subdn = (subDN *)data.mv_data;
+		if (subdn->type != SUBDN_TYPE_NODE)
+			break;
+		*dn = strdup(subdn->data);
+		if (*dn == NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: strdup failed", __func__);
+			abort();
+		}
+		return MDB_SUCCESS;
+	}
+
+	return dntree_lookup_dn4id(cur, dnid, dn);
+}
+
 int dntree_lookup_dn4id(MDB_cursor *cur, DNID dnid, char **dn) {
 	int rv;
 	MDB_val key, data;
@@ -289,7 +422,7 @@ static int dntree_add_id(MDB_cursor *write_cursor_p, DNID child, LDAPDN dn, DNID
 	return rv;
 }
 
-static int dntree_has_children(MDB_cursor *local_cursor, DNID dnid) {
+int dntree_has_children(MDB_cursor *local_cursor, DNID dnid) {
 	int rv;
 	size_t values;
 	MDB_val key, data;
@@ -353,6 +486,7 @@ int dntree_del_id(MDB_cursor *write_cursor_p, DNID dnid) {
 
 	if (rv == MDB_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "%s: deleted id=%lu", __func__, dnid);
+		dn_cache_drop_id(dnid);
 	}
 
 	return rv;
@@ -393,6 +527,254 @@ static int dntree_get_id4ldapdn(MDB_cursor *write_cursor_p, LDAPDN dn, DNID *dni
 	return rv;
 }
 
+/* read the node of @dnid: its DN and the DNID of its parent */
+static int dntree_get_node(MDB_cursor *cur, DNID dnid, DNID *parent, char **dn) {
+	int rv;
+	MDB_val key, data;
+
+	key.mv_size = sizeof(DNID);
+	key.mv_data = &dnid;
+	data.mv_size = sizeof(subDN);
+	data.mv_data = &(subDN){0, SUBDN_TYPE_NODE, ""};
+
+	rv = mdb_cursor_get(cur, &key, &data, MDB_GET_BOTH);
+	if (rv == MDB_SUCCESS)
+		rv = mdb_cursor_get(cur, &key, &data, MDB_GET_CURRENT);  // ITS#8393
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: mdb_cursor_get failed for %lu: %s (%d)", __func__, dnid, mdb_strerror(rv), rv);
+		return rv;
+	}
+	*parent = ((subDN *)data.mv_data)->id;
+	if (dn != NULL && (*dn = strdup(((subDN *)data.mv_data)->data)) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: strdup failed", __func__);
+		abort();
+	}
+	return rv;
+}
+
+/* replace the node of @dnid, keeping its links to the children */
+static int dntree_set_node(MDB_cursor *write_cursor_p, DNID dnid, DNID parent, const char *dn) {
+	int rv;
+	MDB_val key, data;
+	size_t dn_len = strlen(dn);
+	subDN *subdn;
+
+	key.mv_size = sizeof(DNID);
+	key.mv_data = &dnid;
+	data.mv_size = sizeof(subDN);
+	data.mv_data = &(subDN){0, SUBDN_TYPE_NODE, ""};
+
+	rv = mdb_cursor_get(write_cursor_p, &key, &data, MDB_GET_BOTH);
+	if (rv == MDB_SUCCESS)
+		rv = mdb_cursor_del(write_cursor_p, 0);
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: removing node %lu failed: %s (%d)", __func__, dnid, mdb_strerror(rv), rv);
+		return rv;
+	}
+
+	if ((subdn = calloc(1, sizeof(subDN) + dn_len)) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: calloc failed", __func__);
+		abort();
+	}
+	subdn->type = SUBDN_TYPE_NODE;
+	subdn->id = parent;  // backlink
+	memcpy(subdn->data, dn, dn_len + 1);
+	data.mv_size = sizeof(subDN) + dn_len;
+	data.mv_data = subdn;
+	rv = mdb_cursor_put(write_cursor_p, &key, &data, MDB_NODUPDATA);
+	if (rv != MDB_SUCCESS)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: mdb_cursor_put failed for %lu: %s (%d)", __func__, dnid, mdb_strerror(rv), rv);
+	free(subdn);
+	return rv;
+}
+
+/*
+ * Collect the children of @dnid.
+ * @param ids Return variable to receive the DNIDs, to be freed by the caller.
+ * @param rdns Return variable to receive the RDNs, to be freed by the caller
+ *        with each element.
+ * @param count Return variable to receive the number of children.
+ */
+int dntree_children(MDB_cursor *cur, DNID dnid, DNID **ids, char ***rdns, int *count) {
+	int rv, max = 0;
+	MDB_val key, data;
+
+	*ids = NULL;
+	*rdns = NULL;
+	*count = 0;
+	key.mv_size = sizeof(DNID);
+	key.mv_data = &dnid;
+	rv = mdb_cursor_get(cur, &key, &data, MDB_SET);
+	while (rv == MDB_SUCCESS) {
+		subDN *subdn = (subDN *)data.mv_data;
+
+		if (subdn->type == SUBDN_TYPE_LINK) {
+			if (*count == max) {
+				max = max ? max * 2 : 16;
+				if ((*ids = realloc(*ids, max * sizeof(DNID))) == NULL || (*rdns = realloc(*rdns, max * sizeof(char *))) == NULL)
+					abort();
+			}
+			(*ids)[*count] = subdn->id;
+			if (((*rdns)[(*count)++] = strdup(subdn->data)) == NULL)
+				abort();
+		}
+		rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT_DUP);
+	}
+	if (rv != MDB_NOTFOUND) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: mdb_cursor_get failed for %lu: %s (%d)", __func__, dnid, mdb_strerror(rv), rv);
+		return rv;
+	}
+	return MDB_SUCCESS;
+}
+
+/* Store the new DNs of all nodes below @dnid, whose own node already has its
+ * new DN. The links keep their RDNs, so only the nodes are rewritten. */
+static int dntree_rename_children(MDB_cursor *write_cursor_p, DNID dnid) {
+	int rv = MDB_SUCCESS, count, i;
+	MDB_cursor *cur;
+	DNID *stack = NULL, *children = NULL, id, parent;
+	char **rdns = NULL, *dn = NULL, *child_dn;
+	size_t depth = 0, size = 0;
+
+	rv = mdb_cursor_open(mdb_cursor_txn(write_cursor_p), mdb_cursor_dbi(write_cursor_p), &cur);
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: mdb_cursor_open: %s (%d)", __func__, mdb_strerror(rv), rv);
+		return rv;
+	}
+
+	for (id = dnid; rv == MDB_SUCCESS; id = stack[--depth]) {
+		/* collect the links first, as the nodes of the children are replaced */
+		rv = dntree_children(cur, id, &children, &rdns, &count);
+		if (rv == MDB_SUCCESS)
+			rv = dntree_get_node(cur, id, &parent, &dn);
+
+		for (i = 0; i < count; i++) {
+			if (rv == MDB_SUCCESS) {
+				size_t len = strlen(rdns[i]) + 1 + strlen(dn) + 1;
+				if ((child_dn = malloc(len)) == NULL)
+					abort();
+				snprintf(child_dn, len, "%s,%s", rdns[i], dn);
+				rv = dntree_set_node(write_cursor_p, children[i], id, child_dn);
+				free(child_dn);
+				if (depth == size) {
+					size = size ? size * 2 : 64;
+					if ((stack = realloc(stack, size * sizeof(*stack))) == NULL)
+						abort();
+				}
+				stack[depth++] = children[i];
+			}
+			free(rdns[i]);
+		}
+		free(children);
+		free(rdns);
+		free(dn);
+		dn = NULL;
+		if (depth == 0)
+			break;
+	}
+
+	mdb_cursor_close(cur);
+	free(stack);
+	return rv;
+}
+
+/*
+ * Move the node @dnid with everything below it to @new_dn by linking it to
+ * its new parent. The DNIDs stay the same, so the entries stored for them
+ * need not be touched.
+ * @return MDB_KEYEXIST if @new_dn exists already.
+ */
+int dntree_move_id(MDB_cursor *write_cursor_p, DNID dnid, char *new_dn) {
+	int rv;
+	LDAPDN ldapdn = NULL, old_ldapdn = NULL;
+	MDB_val key, data;
+	DNID id, parent, old_parent;
+	char *old_dn = NULL, *rdn = NULL;
+	size_t rdn_len;
+	subDN *subdn;
+
+	rv = ldap_str2dn(new_dn, &ldapdn, LDAP_DN_FORMAT_LDAP);
+	if (rv != LDAP_SUCCESS || ldapdn == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: ldap_str2dn failed: %s (%d): %s", __func__, ldap_err2string(rv), rv, new_dn);
+		return rv ? rv : -1;
+	}
+	rv = dntree_lookup_id4ldapdn(write_cursor_p, ldapdn, &id, NULL);
+	if (rv == MDB_SUCCESS) {
+		rv = MDB_KEYEXIST;
+		goto out;
+	} else if (rv != MDB_NOTFOUND) {
+		goto out;
+	}
+	rv = dntree_get_id4ldapdn(write_cursor_p, ldapdn[1] ? &ldapdn[1] : NULL, &parent);
+	if (rv != MDB_SUCCESS)
+		goto out;
+	/* LDAP does not allow this, but better not loose the subtree */
+	for (id = parent; id != 0; id = old_parent) {
+		if (id == dnid) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: %lu can't be moved below itself: %s", __func__, dnid, new_dn);
+			rv = -1;
+			goto out;
+		}
+		if ((rv = dntree_get_node(write_cursor_p, id, &old_parent, NULL)) != MDB_SUCCESS)
+			goto out;
+	}
+
+	/* unlink from the old parent */
+	rv = dntree_get_node(write_cursor_p, dnid, &old_parent, &old_dn);
+	if (rv != MDB_SUCCESS)
+		goto out;
+	rv = ldap_str2dn(old_dn, &old_ldapdn, LDAP_DN_FORMAT_LDAPV3);
+	if (rv != LDAP_SUCCESS || old_ldapdn == NULL || (rv = ldap_rdn2str(old_ldapdn[0], &rdn, LDAP_DN_FORMAT_LDAPV3)) != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: parsing %s failed: %s (%d)", __func__, old_dn, ldap_err2string(rv), rv);
+		rv = rv ? rv : -1;
+		goto out;
+	}
+	rdn_len = strlen(rdn);
+	if ((subdn = calloc(1, sizeof(subDN) + rdn_len)) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: calloc failed", __func__);
+		abort();
+	}
+	subdn->type = SUBDN_TYPE_LINK;
+	subdn->id = dnid;
+	memcpy(subdn->data, rdn, rdn_len + 1);
+	key.mv_size = sizeof(DNID);
+	key.mv_data = &old_parent;
+	data.mv_size = sizeof(subDN) + rdn_len;
+	data.mv_data = subdn;
+	rv = mdb_cursor_get(write_cursor_p, &key, &data, MDB_GET_BOTH);
+	free(subdn);
+	if (rv == MDB_SUCCESS)
+		rv = mdb_cursor_del(write_cursor_p, 0);
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: unlinking %lu from %lu failed: %s (%d)", __func__, dnid, old_parent, mdb_strerror(rv), rv);
+		goto out;
+	}
+
+	/* and link to the new one */
+	key.mv_data = &dnid;
+	data.mv_size = sizeof(subDN);
+	data.mv_data = &(subDN){0, SUBDN_TYPE_NODE, ""};
+	rv = mdb_cursor_get(write_cursor_p, &key, &data, MDB_GET_BOTH);
+	if (rv == MDB_SUCCESS)
+		rv = mdb_cursor_del(write_cursor_p, 0);
+	if (rv == MDB_SUCCESS)
+		rv = dntree_add_id(write_cursor_p, dnid, ldapdn, parent);
+	if (rv == MDB_SUCCESS)
+		rv = dntree_rename_children(write_cursor_p, dnid);
+
+	/* the cached parents below the old DN are gone */
+	dntree_cache_clear();
+	if (rv == MDB_SUCCESS)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "%s: moved id=%lu from %lu to %lu: %s", __func__, dnid, old_parent, parent, new_dn);
+
+out:
+	ldap_memfree(rdn);
+	ldap_dnfree(old_ldapdn);
+	ldap_dnfree(ldapdn);
+	free(old_dn);
+	return rv;
+}
+
 int dntree_get_id4dn(MDB_cursor *id2dn_cursor_p, char *dn, DNID *dnid, bool create) {
 	int rv;
 	LDAPDN ldapdn;
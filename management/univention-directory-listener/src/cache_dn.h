@@ -55,6 +55,11 @@ typedef struct subDN {
 int dntree_init(MDB_dbi *dbi_ptr, MDB_txn *write_txn_p, int mdb_flags);
 int dntree_get_id4dn(MDB_cursor *cursor, char *dn, DNID *dnid, bool create);
 int dntree_lookup_dn4id(MDB_cursor *cur, DNID dnid, char **dn);
+int dntree_scan_dn4id(MDB_cursor *cur, DNID dnid, char **dn);
 int dntree_del_id(MDB_cursor *cursor, DNID dnid);
+int dntree_has_children(MDB_cursor *cursor, DNID dnid);
+int dntree_children(MDB_cursor *cursor, DNID dnid, DNID **ids, char ***rdns, int *count);
+int dntree_move_id(MDB_cursor *cursor, DNID dnid, char *new_dn);
+void dntree_cache_clear(void);
 
 #endif /* _DNTREE_H_ */
@@ -33,11 +33,14 @@
  * <https://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE /* for strndup */
+
 #include <stdlib.h>
 #include <ctype.h>
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include <pthread.h>
 #include <ldap.h>
 
 #include <univention/debug.h>
@@ -47,18 +50,218 @@
 #include "base64.h"
 #include "common.h"
 #include "utils.h"
+#include "tunables.h"
+#include "arena.h"
+
+/* Distinct attribute names, open addressing with linear probing. */
+static struct {
+	char **slots;
+	size_t size;
+	size_t used;
+} attribute_names;
+/* entries may be parsed by several threads, see cache_iter_begin() */
+static pthread_mutex_t attribute_names_lock = PTHREAD_MUTEX_INITIALIZER;
+
+__thread struct arena *cache_entry_arena;
+
+static size_t hash_name(const char *name, size_t len) {
+	size_t hash = 2166136261u;  // FNV-1a
+
+	while (len-- > 0)
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	return hash;
+}
+
+/*
+ * Return the shared copy of an attribute name.
+ * Each distinct name is allocated once and never freed, so the names of all
+ * cache entries can be compared by pointer and need not be freed with them.
+ * :param name: The attribute name, not necessarily NUL-terminated.
+ * :param len: The length of `name` in bytes.
+ * :returns: The interned, NUL-terminated name.
+ */
+char *cache_entry_intern(const char *name, size_t len) {
+	size_t i, mask;
+	char *slot;
+
+	pthread_mutex_lock(&attribute_names_lock);
+	if ((attribute_names.used + 1) * 2 > attribute_names.size) {
+		size_t size = attribute_names.size ? attribute_names.size * 2 : 512;
+		char **slots = calloc(size, sizeof(char *));
+
+		if (!slots) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "calloc failed");
+			abort();  // FIXME
+		}
+		for (i = 0; i < attribute_names.size; i++) {
+			size_t j;
+
+			slot = attribute_names.slots[i];
+			if (!slot)
+				continue;
+			for (j = hash_name(slot, strlen(slot)) & (size - 1); slots[j]; j = (j + 1) & (size - 1))
+				;
+			slots[j] = slot;
+		}
+		free(attribute_names.slots);
+		attribute_names.slots = slots;
+		attribute_names.size = size;
+	}
+
+	mask = attribute_names.size - 1;
+	for (i = hash_name(name, len) & mask; attribute_names.slots[i]; i = (i + 1) & mask) {
+		slot = attribute_names.slots[i];
+		if (strncmp(slot, name, len) == 0 && slot[len] == '\0') {
+			pthread_mutex_unlock(&attribute_names_lock);
+			return slot;
+		}
+	}
+
+	if (!(attribute_names.slots[i] = strndup(name, len))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "strndup failed");
+		abort();  // FIXME
+	}
+	attribute_names.used++;
+	slot = attribute_names.slots[i];
+	pthread_mutex_unlock(&attribute_names_lock);
+	return slot;
+}
+
+static int compare_attributes(const void *a, const void *b) {
+	return strcmp((*(CacheEntryAttribute *const *)a)->name, (*(CacheEntryAttribute *const *)b)->name);
+}
+
+/*
+ * Sort the attributes of an entry by name, which all lookups rely on.
+ * :param entry: The cache entry.
+ */
+void cache_entry_sort(CacheEntry *entry) {
+	int i;
+
+	for (i = 1; i < entry->attribute_count; i++) {
+		if (compare_attributes(&entry->attributes[i - 1], &entry->attributes[i]) > 0) {
+			qsort(entry->attributes, entry->attribute_count, sizeof(CacheEntryAttribute *), compare_attributes);
+			return;
+		}
+	}
+}
 
-static void cache_free_attribute(CacheEntryAttribute *attr) {
+/* compare attribute name with a not necessarily NUL-terminated name, like strcmp() */
+static inline int compare_name(const char *attribute, const char *name, size_t len) {
+	int cmp = strncmp(attribute, name, len);
+
+	return cmp != 0 ? cmp : attribute[len] != '\0';
+}
+
+/* return the index of the first attribute not less than name */
+static int lower_bound(CacheEntry *entry, const char *name, size_t len) {
+	int low = 0, high = entry->attribute_count;
+
+	while (low < high) {
+		int mid = low + (high - low) / 2;
+
+		if (compare_name(entry->attributes[mid]->name, name, len) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+/*
+ * Find an attribute by name using binary search.
+ * :param entry: The cache entry.
+ * :param name: The attribute name, not necessarily NUL-terminated.
+ * :param len: The length of `name` in bytes.
+ * :returns: The attribute or NULL.
+ */
+CacheEntryAttribute *cache_entry_find_attribute(CacheEntry *entry, const char *name, size_t len) {
+	int i = lower_bound(entry, name, len);
+
+	if (i < entry->attribute_count && compare_name(entry->attributes[i]->name, name, len) == 0)
+		return entry->attributes[i];
+	return NULL;
+}
+
+/* insert attribute at its sorted position; the array must have room for it */
+static void insert_attribute(CacheEntry *entry, CacheEntryAttribute *attr) {
+	int i = lower_bound(entry, attr->name, strlen(attr->name));
+
+	memmove(&entry->attributes[i + 1], &entry->attributes[i], (entry->attribute_count - i) * sizeof(CacheEntryAttribute *));
+	entry->attributes[i] = attr;
+	entry->attributes[++entry->attribute_count] = NULL;
+}
+
+/*
+ * Allocate memory for the data of an entry, from its arena if it has one.
+ * Such memory is not released by cache_free_entry() but by resetting the arena.
+ */
+void *cache_entry_alloc(CacheEntry *entry, size_t size) {
+	return entry->arena ? arena_alloc(entry->arena, size) : malloc(size);
+}
+
+void *cache_entry_realloc(CacheEntry *entry, void *ptr, size_t size) {
+	return entry->arena ? arena_realloc(entry->arena, ptr, size) : realloc(ptr, size);
+}
+
+char *cache_entry_strdup(CacheEntry *entry, const char *str) {
+	return entry->arena ? arena_strdup(entry->arena, str) : strdup(str);
+}
+
+void cache_entry_release(CacheEntry *entry, void *ptr) {
+	if (!entry->arena)
+		free(ptr);
+}
+
+static void cache_free_attribute(CacheEntry *entry, CacheEntryAttribute *attr) {
 	int j;
 
-	free(attr->name);
-	for (j = 0; j < attr->value_count; j++)
-		free(attr->values[j]);
+	if (entry->arena)
+		return;
+	if (!attr->packed) {
+		for (j = 0; j < attr->value_count; j++)
+			free(attr->values[j]);
+		free(attr->length);
+	}
 	free(attr->values);
-	free(attr->length);
 	free(attr);
 }
 
+/* Give a packed attribute separately allocated values before changing them. */
+static int unpack_attribute(CacheEntry *entry, CacheEntryAttribute *attr) {
+	char **values;
+	int *length;
+	int i;
+
+	if (!attr->packed)
+		return 0;
+	values = cache_entry_alloc(entry, (attr->value_count + 1) * sizeof(char *));
+	length = cache_entry_alloc(entry, (attr->value_count + 1) * sizeof(int));
+	if (!values || !length)
+		goto fail;
+	for (i = 0; i < attr->value_count; i++) {
+		if (!(values[i] = cache_entry_alloc(entry, attr->length[i]))) {
+			while (i-- > 0)
+				cache_entry_release(entry, values[i]);
+			goto fail;
+		}
+		memcpy(values[i], attr->values[i], attr->length[i]);
+		length[i] = attr->length[i];
+	}
+	values[i] = NULL;
+	length[i] = 0;
+	cache_entry_release(entry, attr->values);
+	attr->values = values;
+	attr->length = length;
+	attr->packed = false;
+	return 0;
+fail:
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d malloc() failed", __FILE__, __LINE__);
+	cache_entry_release(entry, values);
+	cache_entry_release(entry, length);
+	return 1;
+}
+
 int cache_free_entry(char **dn, CacheEntry *entry) {
 	int i;
 
@@ -67,9 +270,37 @@ int cache_free_entry(char **dn, CacheEntry *entry) {
 		*dn = NULL;
 	}
 
+	/* everything is released with the arena */
+	if (entry->arena) {
+		struct arena *arena = entry->arena;
+
+		memset(entry, 0, sizeof(CacheEntry));
+		entry->arena = arena;
+		return 0;
+	}
+
+	/* only the arrays are allocated, each in one block */
+	if (entry->view) {
+		if (entry->attribute_count > 0) {
+			/* the attributes are sorted, so find the start of the blocks */
+			CacheEntryAttribute *first = entry->attributes[0];
+
+			for (i = 1; i < entry->attribute_count; i++)
+				if (entry->attributes[i] < first)
+					first = entry->attributes[i];
+			free(first->values);
+			free(first->length);
+			free(first);
+		}
+		free(entry->attributes);
+		free(entry->modules);
+		memset(entry, 0, sizeof(CacheEntry));
+		return 0;
+	}
+
 	if (entry->attributes) {
 		for (i = 0; i < entry->attribute_count; i++)
-			cache_free_attribute(entry->attributes[i]);
+			cache_free_attribute(entry, entry->attributes[i]);
 		free(entry->attributes);
 		entry->attributes = NULL;
 		entry->attribute_count = 0;
@@ -125,8 +356,8 @@ int cache_entry_module_add(CacheEntry *entry, char *module) {
 			return 0;
 	}
 
-	entry->modules = realloc(entry->modules, (entry->module_count + 2) * sizeof(char *));
-	entry->modules[entry->module_count] = strdup(module);
+	entry->modules = cache_entry_realloc(entry, entry->modules, (entry->module_count + 2) * sizeof(char *));
+	entry->modules[entry->module_count] = cache_entry_strdup(entry, module);
 	entry->modules[entry->module_count + 1] = NULL;
 	entry->module_count++;
 
@@ -145,12 +376,13 @@ int cache_entry_module_remove(CacheEntry *entry, char *module) {
 		return 0;
 
 	/* replace entry that is to be removed with last entry */
-	free(*cur);
+	if (!entry->view)
+		cache_entry_release(entry, *cur);
 	entry->modules[cur - entry->modules] = entry->modules[entry->module_count - 1];
 	entry->modules[entry->module_count - 1] = NULL;
 	entry->module_count--;
 
-	entry->modules = realloc(entry->modules, (entry->module_count + 1) * sizeof(char *));
+	entry->modules = cache_entry_realloc(entry, entry->modules, (entry->module_count + 1) * sizeof(char *));
 
 	return 0;
 }
@@ -167,20 +399,97 @@ int cache_entry_module_present(CacheEntry *entry, char *module) {
 	return 0;
 }
 
+/* Return if value is already in attr, else reserve its slot for the next value. */
+static bool seen_value(int *slots, size_t mask, CacheEntryAttribute *attr, const char *value, size_t len) {
+	size_t i;
+
+	for (i = hash_name(value, len) & mask; slots[i] >= 0; i = (i + 1) & mask) {
+		int j = slots[i];
+		if (attr->length[j] == len + 1 && !memcmp(attr->values[j], value, len))
+			return true;
+	}
+	slots[i] = attr->value_count;
+	return false;
+}
+
+/*
+ * Copy the values of one LDAP attribute into attr.
+ * The value and length arrays and the NUL-terminated values share one block
+ * starting at attr->values, sized from the number of values up front.
+ * :param unique: Drop duplicate values, found through a temporary hash set.
+ * :returns: 0 on success, 1 on errors.
+ */
+static int attribute_from_ldap(CacheEntry *entry, CacheEntryAttribute *attr, struct berval **val, bool unique, const char *dn) {
+	int count = ldap_count_values_len(val), i;
+	size_t bytes = 0, size, mask = 0;
+	int *slots = NULL;
+	char *data;
+
+	for (i = 0; i < count; i++) {
+		if (val[i]->bv_val == NULL) {
+			// check here, strlen behavior might be undefined in this case
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: ignoring bv_val of NULL with bv_len=%ld, ignoring, check attribute: %s of DN: %s", val[i]->bv_len, attr->name, dn);
+			return 1;
+		}
+		bytes += val[i]->bv_len + 1;
+	}
+
+	size = (count + 1) * (sizeof(char *) + sizeof(int));
+	if ((attr->values = cache_entry_alloc(entry, size + bytes)) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: malloc of values failed");
+		return 1;
+	}
+	attr->length = (int *)(attr->values + count + 1);
+	attr->packed = true;
+	data = (char *)(attr->length + count + 1);
+
+	if (unique && count > 1) {
+		for (mask = 1; mask < 2 * (size_t)count; mask <<= 1)
+			;
+		if ((slots = malloc(mask * sizeof(int))) == NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: malloc of hash set failed");
+			return 1;
+		}
+		memset(slots, 0xff, mask * sizeof(int));  // all -1
+		mask--;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct berval *bv = val[i];
+
+		if (slots && seen_value(slots, mask, attr, bv->bv_val, bv->bv_len)) {
+			/* avoid duplicate memberUid and uniqueMember entries https://forge.univention.org/bugzilla/show_bug.cgi?id=17998 https://forge.univention.org/bugzilla/show_bug.cgi?id=18692 */
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Found a duplicate %s entry:", attr->name);
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "DN: %s", dn);
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s: %s", attr->name, bv->bv_val);
+			continue;
+		}
+		// bv_val may contain a '\0': the legacy approach is to copy bv_len bytes and terminate to be safe
+		memcpy(data, bv->bv_val, bv->bv_len);
+		data[bv->bv_len] = '\0';
+		attr->values[attr->value_count] = data;
+		attr->length[attr->value_count] = bv->bv_len + 1;
+		attr->value_count++;
+		data += bv->bv_len + 1;
+	}
+	attr->values[attr->value_count] = NULL;
+	attr->length[attr->value_count] = 0;
+
+	free(slots);
+	return 0;
+}
+
 int cache_new_entry_from_ldap(char **dn, CacheEntry *cache_entry, LDAP *ld, LDAPMessage *ldap_entry) {
 	BerElement *ber;
 	char *attr;
 	char *_dn;
 	int rv = 0;
-
-	bool memberUidMode = false;
-	bool uniqueMemberMode = false;
-	bool duplicateMemberUid = false;
-	bool duplicateUniqueMember = false;
-	int i;
+	int capacity = 0;
+	const struct tunables *tunables = tunables_get();
 
 	/* convert LDAP entry to cache entry */
 	memset(cache_entry, 0, sizeof(CacheEntry));
+	cache_entry->arena = cache_entry_arena;
 	if (dn != NULL) {
 		_dn = ldap_get_dn(ld, ldap_entry);
 		if (*dn)
@@ -190,132 +499,46 @@ int cache_new_entry_from_ldap(char **dn, CacheEntry *cache_entry, LDAP *ld, LDAP
 	}
 
 	for (attr = ldap_first_attribute(ld, ldap_entry, &ber); attr != NULL; attr = ldap_next_attribute(ld, ldap_entry, ber)) {
-		struct berval **val, **v;
+		CacheEntryAttribute *c_attr;
+		struct berval **val;
+		bool unique;
 
-		if ((cache_entry->attributes = realloc(cache_entry->attributes, (cache_entry->attribute_count + 2) * sizeof(CacheEntryAttribute *))) == NULL) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: realloc of attributes array failed");
-			rv = 1;
-			goto result;
+		if (cache_entry->attribute_count + 1 >= capacity) {
+			CacheEntryAttribute **attributes;
+
+			capacity = capacity ? capacity * 2 : 32;
+			if ((attributes = cache_entry_realloc(cache_entry, cache_entry->attributes, capacity * sizeof(CacheEntryAttribute *))) == NULL) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: realloc of attributes array failed");
+				rv = 1;
+				goto result;
+			}
+			cache_entry->attributes = attributes;
 		}
-		if ((cache_entry->attributes[cache_entry->attribute_count] = malloc(sizeof(CacheEntryAttribute))) == NULL) {
+		if ((c_attr = cache_entry_alloc(cache_entry, sizeof(CacheEntryAttribute))) == NULL) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: malloc for CacheEntryAttribute failed");
 			rv = 1;
 			goto result;
 		}
-		cache_entry->attributes[cache_entry->attribute_count]->name = strdup(attr);
-		cache_entry->attributes[cache_entry->attribute_count]->values = NULL;
-		cache_entry->attributes[cache_entry->attribute_count]->length = NULL;
-		cache_entry->attributes[cache_entry->attribute_count]->value_count = 0;
-		cache_entry->attributes[cache_entry->attribute_count + 1] = NULL;
-
-		memberUidMode = false;
-		if (!strcmp(cache_entry->attributes[cache_entry->attribute_count]->name, "memberUid")) {
-			char *ucrval;
-			ucrval = univention_config_get_string("listener/memberuid/skip");
-
-			if (ucrval) {
-				memberUidMode = !strcmp(ucrval, "yes") || !strcmp(ucrval, "true");
-				free(ucrval);
-			}
-		}
-		uniqueMemberMode = false;
-		if (!strcmp(cache_entry->attributes[cache_entry->attribute_count]->name, "uniqueMember")) {
-			char *ucrval;
-			ucrval = univention_config_get_string("listener/uniquemember/skip");
-
-			if (ucrval) {
-				uniqueMemberMode = !strcmp(ucrval, "yes") || !strcmp(ucrval, "true");
-				free(ucrval);
-			}
-		}
+		memset(c_attr, 0, sizeof(CacheEntryAttribute));
+		c_attr->name = cache_entry_intern(attr, strlen(attr));
+		cache_entry->attributes[cache_entry->attribute_count++] = c_attr;
+		cache_entry->attributes[cache_entry->attribute_count] = NULL;
+
 		if ((val = ldap_get_values_len(ld, ldap_entry, attr)) == NULL) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "ldap_get_values failed");
 			rv = 1;
 			goto result;
 		}
-		for (v = val; *v != NULL; v++) {
-			if ((*v)->bv_val == NULL) {
-				// check here, strlen behavior might be undefined in this case
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: ignoring bv_val of NULL with bv_len=%ld, ignoring, check attribute: %s of DN: %s", (*v)->bv_len,
-				                 cache_entry->attributes[cache_entry->attribute_count]->name, *dn);
-				rv = 1;
-				goto result;
-			}
-
-			if (memberUidMode) {
-				/* avoid duplicate memberUid entries https://forge.univention.org/bugzilla/show_bug.cgi?id=17998 */
-				duplicateMemberUid = 0;
-				for (i = 0; i < cache_entry->attributes[cache_entry->attribute_count]->value_count; i++) {
-					if (!memcmp(cache_entry->attributes[cache_entry->attribute_count]->values[i], (*v)->bv_val, (*v)->bv_len + 1)) {
-						univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Found a duplicate memberUid entry:");
-						univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "DN: %s", *dn);
-						univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "memberUid: %s", cache_entry->attributes[cache_entry->attribute_count]->values[i]);
-						duplicateMemberUid = true;
-						break;
-					}
-				}
-				if (duplicateMemberUid) {
-					continue;
-				}
-			}
-			if (uniqueMemberMode) {
-				/* avoid duplicate uniqueMember entries https://forge.univention.org/bugzilla/show_bug.cgi?id=18692 */
-				duplicateUniqueMember = false;
-				for (i = 0; i < cache_entry->attributes[cache_entry->attribute_count]->value_count; i++) {
-					if (!memcmp(cache_entry->attributes[cache_entry->attribute_count]->values[i], (*v)->bv_val, (*v)->bv_len + 1)) {
-						univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Found a duplicate uniqueMember entry:");
-						univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "DN: %s", *dn);
-						univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "uniqueMember: %s", cache_entry->attributes[cache_entry->attribute_count]->values[i]);
-						duplicateUniqueMember = true;
-						break;
-					}
-				}
-				if (duplicateUniqueMember) {
-					continue;
-				}
-			}
-			if ((cache_entry->attributes[cache_entry->attribute_count]->values =
-			         realloc(cache_entry->attributes[cache_entry->attribute_count]->values, (cache_entry->attributes[cache_entry->attribute_count]->value_count + 2) * sizeof(char *))) == NULL) {
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: realloc of values array failed");
-				rv = 1;
-				goto result;
-			}
-			if ((cache_entry->attributes[cache_entry->attribute_count]->length =
-			         realloc(cache_entry->attributes[cache_entry->attribute_count]->length, (cache_entry->attributes[cache_entry->attribute_count]->value_count + 2) * sizeof(int))) == NULL) {
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: realloc of length array failed");
-				rv = 1;
-				goto result;
-			}
-			if ((*v)->bv_len == strlen((*v)->bv_val)) {
-				if ((cache_entry->attributes[cache_entry->attribute_count]->values[cache_entry->attributes[cache_entry->attribute_count]->value_count] = strdup((*v)->bv_val)) == NULL) {
-					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: strdup of value failed");
-					rv = 1;
-					goto result;
-				}
-				cache_entry->attributes[cache_entry->attribute_count]->length[cache_entry->attributes[cache_entry->attribute_count]->value_count] =
-				    strlen(cache_entry->attributes[cache_entry->attribute_count]->values[cache_entry->attributes[cache_entry->attribute_count]->value_count]) + 1;
-			} else {  // in this case something is strange about the string in bv_val, maybe contains a '\0'
-				// the legacy approach is to copy bv_len bytes, let's stick with this and just terminate to be safe
-				if ((cache_entry->attributes[cache_entry->attribute_count]->values[cache_entry->attributes[cache_entry->attribute_count]->value_count] = malloc(((*v)->bv_len + 1) * sizeof(char))) ==
-				    NULL) {
-					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "cache_new_entry_from_ldap: malloc for value failed");
-					rv = 1;
-					goto result;
-				}
-				memcpy(cache_entry->attributes[cache_entry->attribute_count]->values[cache_entry->attributes[cache_entry->attribute_count]->value_count], (*v)->bv_val, (*v)->bv_len);
-				cache_entry->attributes[cache_entry->attribute_count]->values[cache_entry->attributes[cache_entry->attribute_count]->value_count][(*v)->bv_len] = '\0';  // terminate the string to be safe
-				cache_entry->attributes[cache_entry->attribute_count]->length[cache_entry->attributes[cache_entry->attribute_count]->value_count] = (*v)->bv_len + 1;
-			}
-			cache_entry->attributes[cache_entry->attribute_count]->values[cache_entry->attributes[cache_entry->attribute_count]->value_count + 1] = NULL;
-			cache_entry->attributes[cache_entry->attribute_count]->value_count++;
-		}
-		cache_entry->attribute_count++;
-
+		unique = (tunables->memberuid_skip && !strcmp(c_attr->name, "memberUid")) || (tunables->uniquemember_skip && !strcmp(c_attr->name, "uniqueMember"));
+		rv = attribute_from_ldap(cache_entry, c_attr, val, unique, dn ? *dn : NULL);
 		ldap_value_free_len(val);
 		ldap_memfree(attr);
+		if (rv != 0)
+			goto result;
 	}
 
 	ber_free(ber, 0);
+	cache_entry_sort(cache_entry);
 
 result:
 	if (rv != 0)
@@ -324,47 +547,169 @@ result:
 	return rv;
 }
 
+static bool same_values(CacheEntryAttribute *a, CacheEntryAttribute *b) {
+	int i;
+
+	if (a->value_count != b->value_count)
+		return false;
+	for (i = 0; i < a->value_count; i++)
+		if (a->length[i] != b->length[i] || memcmp(a->values[i], b->values[i], a->length[i]) != 0)
+			return false;
+	return true;
+}
+
+/*
+ * Merge the sorted attributes of two entries.
+ * Calls `func` for each attribute only in one entry or with different values.
+ */
+static void merge_attributes(CacheEntry *new, CacheEntry *old, void (*func)(CacheEntryAttribute *new, CacheEntryAttribute *old, void *data), void *data) {
+	int i = 0, j = 0;
+
+	while (i < new->attribute_count || j < old->attribute_count) {
+		int cmp;
+
+		if (i == new->attribute_count)
+			cmp = 1;
+		else if (j == old->attribute_count)
+			cmp = -1;
+		else if (new->attributes[i]->name == old->attributes[j]->name)
+			cmp = 0;
+		else
+			cmp = strcmp(new->attributes[i]->name, old->attributes[j]->name);
+
+		if (cmp < 0) {
+			func(new->attributes[i++], NULL, data);
+		} else if (cmp > 0) {
+			func(NULL, old->attributes[j++], data);
+		} else {
+			if (!same_values(new->attributes[i], old->attributes[j]))
+				func(new->attributes[i], old->attributes[j], data);
+			i++;
+			j++;
+		}
+	}
+}
+
+static void add_change(CacheEntryAttribute *new, CacheEntryAttribute *old, void *data) {
+	char ***changes = data;
+
+	*(*changes)++ = new ? new->name : old->name;
+}
+
 /* return list of changes attributes between new and old; the caller will
    only need to free the (char**); the strings themselves are stolen from
    the new and old entries */
 char **cache_entry_changed_attributes(CacheEntry *new, CacheEntry *old) {
-	char **changes = NULL;
-	int changes_count = 0;
-	CacheEntryAttribute **cur1, **cur2;
+	char **changes, **cur;
 
-	for (cur1 = new->attributes; cur1 != NULL &&*cur1 != NULL; cur1++) {
-		for (cur2 = old->attributes; cur2 != NULL && *cur2 != NULL; cur2++)
-			if (strcmp((*cur1)->name, (*cur2)->name) == 0)
-				break;
-		if (cur2 != NULL && *cur2 != NULL && (*cur1)->value_count == (*cur2)->value_count) {
-			int i;
-			for (i = 0; i < (*cur1)->value_count; i++)
-				if (memcmp((*cur1)->values[i], (*cur2)->values[i], (*cur1)->length[i]) != 0)
-					break;
-			if (i == (*cur1)->value_count)
-				continue;
-		}
+	if (!(changes = malloc((new->attribute_count + old->attribute_count + 1) * sizeof(char *)))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d malloc() failed", __FILE__, __LINE__);
+		return NULL;
+	}
+	cur = changes;
+	merge_attributes(new, old, add_change, &cur);
+	*cur = NULL;
 
-		changes = realloc(changes, (changes_count + 2) * sizeof(char *));
-		changes[changes_count] = (*cur1)->name;
-		changes[changes_count + 1] = NULL;
-		changes_count++;
+	if (cur == changes) {
+		free(changes);
+		return NULL;
 	}
+	return changes;
+}
 
-	for (cur2 = old->attributes; cur2 != NULL && *cur2 != NULL; cur2++) {
-		for (cur1 = new->attributes; cur1 != NULL &&*cur1 != NULL; cur1++)
-			if (strcmp((*cur1)->name, (*cur2)->name) == 0)
-				break;
-		if (cur1 != NULL && *cur1 != NULL)
-			continue;
+struct value_ref {
+	const char *value;
+	int length;
+	int index;
+};
+
+static int compare_values(const void *a, const void *b) {
+	const struct value_ref *x = a, *y = b;
+
+	if (x->length != y->length)
+		return x->length < y->length ? -1 : 1;
+	return memcmp(x->value, y->value, x->length);
+}
+
+static struct value_ref *sorted_values(CacheEntryAttribute *attr) {
+	struct value_ref *refs;
+	int i, count = attr ? attr->value_count : 0;
+
+	if (!(refs = malloc((count + 1) * sizeof(struct value_ref)))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d malloc() failed", __FILE__, __LINE__);
+		abort();  // FIXME
+	}
+	for (i = 0; i < count; i++) {
+		refs[i].value = attr->values[i];
+		refs[i].length = attr->length[i];
+		refs[i].index = i;
+	}
+	qsort(refs, count, sizeof(struct value_ref), compare_values);
+	return refs;
+}
 
-		changes = realloc(changes, (changes_count + 2) * sizeof(char *));
-		changes[changes_count] = (*cur2)->name;
-		changes[changes_count + 1] = NULL;
-		changes_count++;
+static void add_delta(CacheEntryAttribute *new, CacheEntryAttribute *old, void *data) {
+	CacheEntryAttributeDelta **cur = data, *delta = (*cur)++;
+	struct value_ref *new_refs = sorted_values(new), *old_refs = sorted_values(old);
+	int i = 0, j = 0, new_count = new ? new->value_count : 0, old_count = old ? old->value_count : 0;
+
+	delta->new = new;
+	delta->old = old;
+	delta->added_count = delta->removed_count = 0;
+	if (!(delta->added = malloc((new_count + 1) * sizeof(int))) || !(delta->removed = malloc((old_count + 1) * sizeof(int)))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d malloc() failed", __FILE__, __LINE__);
+		abort();  // FIXME
 	}
 
-	return changes;
+	/* multi-set difference of the sorted values */
+	while (i < new_count || j < old_count) {
+		int cmp = i == new_count ? 1 : j == old_count ? -1 : compare_values(&new_refs[i], &old_refs[j]);
+
+		if (cmp < 0) {
+			delta->added[delta->added_count++] = new_refs[i++].index;
+		} else if (cmp > 0) {
+			delta->removed[delta->removed_count++] = old_refs[j++].index;
+		} else {
+			i++;
+			j++;
+		}
+	}
+
+	free(new_refs);
+	free(old_refs);
+}
+
+/*
+ * Return the changed attributes of two entries with the added and removed values.
+ * Runs in O(n log n) for attributes with n values.
+ * :param new: The new cache entry.
+ * :param old: The old cache entry.
+ * :param count: Return variable to receive the number of changed attributes.
+ * :returns: Array of `count` deltas, to be freed by :c:func:`cache_entry_free_delta`.
+ *   An attribute whose values only changed their order has no added or removed values.
+ *   The deltas point into both entries, which must stay unchanged while the deltas are used.
+ */
+CacheEntryAttributeDelta *cache_entry_delta(CacheEntry *new, CacheEntry *old, int *count) {
+	CacheEntryAttributeDelta *deltas, *cur;
+
+	if (!(deltas = malloc((new->attribute_count + old->attribute_count + 1) * sizeof(CacheEntryAttributeDelta)))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d malloc() failed", __FILE__, __LINE__);
+		abort();  // FIXME
+	}
+	cur = deltas;
+	merge_attributes(new, old, add_delta, &cur);
+	*count = cur - deltas;
+	return deltas;
+}
+
+void cache_entry_free_delta(CacheEntryAttributeDelta *deltas, int count) {
+	int i;
+
+	for (i = 0; i < count; i++) {
+		free(deltas[i].added);
+		free(deltas[i].removed);
+	}
+	free(deltas);
 }
 
 int copy_cache_entry(CacheEntry *cache_entry, CacheEntry *backup_cache_entry) {
@@ -372,44 +717,46 @@ int copy_cache_entry(CacheEntry *cache_entry, CacheEntry *backup_cache_entry) {
 	int i = 0;
 	int rv = 0;
 	memset(backup_cache_entry, 0, sizeof(CacheEntry));
+	backup_cache_entry->arena = cache_entry_arena;
 	for (cur1 = cache_entry->attributes; cur1 != NULL && *cur1 != NULL; cur1++) {
-		if ((backup_cache_entry->attributes = realloc(backup_cache_entry->attributes, (backup_cache_entry->attribute_count + 2) * sizeof(CacheEntryAttribute *))) == NULL) {
+		if ((backup_cache_entry->attributes = cache_entry_realloc(backup_cache_entry, backup_cache_entry->attributes, (backup_cache_entry->attribute_count + 2) * sizeof(CacheEntryAttribute *))) == NULL) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "copy_cache_entry: realloc of attributes array failed");
 			rv = 1;
 			goto result;
 		}
-		if ((backup_cache_entry->attributes[backup_cache_entry->attribute_count] = malloc(sizeof(CacheEntryAttribute))) == NULL) {
+		if ((backup_cache_entry->attributes[backup_cache_entry->attribute_count] = cache_entry_alloc(backup_cache_entry, sizeof(CacheEntryAttribute))) == NULL) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "copy_cache_entry: malloc for CacheEntryAttribute failed");
 			rv = 1;
 			goto result;
 		}
 		cur2 = &backup_cache_entry->attributes[backup_cache_entry->attribute_count];
-		(*cur2)->name = strdup((*cur1)->name);
+		(*cur2)->name = (*cur1)->name;
 		(*cur2)->values = NULL;
 		(*cur2)->length = NULL;
 		(*cur2)->value_count = 0;
+		(*cur2)->packed = false;
 		backup_cache_entry->attributes[backup_cache_entry->attribute_count + 1] = NULL;
 
 		for (i = 0; i < (*cur1)->value_count; i++) {
-			if (((*cur2)->values = realloc((*cur2)->values, ((*cur2)->value_count + 2) * sizeof(char *))) == NULL) {
+			if (((*cur2)->values = cache_entry_realloc(backup_cache_entry, (*cur2)->values, ((*cur2)->value_count + 2) * sizeof(char *))) == NULL) {
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "copy_cache_entry: realloc of values array failed");
 				rv = 1;
 				goto result;
 			}
-			if (((*cur2)->length = realloc((*cur2)->length, ((*cur2)->value_count + 2) * sizeof(int))) == NULL) {
+			if (((*cur2)->length = cache_entry_realloc(backup_cache_entry, (*cur2)->length, ((*cur2)->value_count + 2) * sizeof(int))) == NULL) {
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "copy_cache_entry: realloc of length array failed");
 				rv = 1;
 				goto result;
 			}
 			if ((*cur1)->length[i] == strlen((*cur1)->values[i]) + 1) {
-				if (((*cur2)->values[(*cur2)->value_count] = strdup((*cur1)->values[i])) == NULL) {
+				if (((*cur2)->values[(*cur2)->value_count] = cache_entry_strdup(backup_cache_entry, (*cur1)->values[i])) == NULL) {
 					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "copy_cache_entry: strdup of value failed");
 					rv = 1;
 					goto result;
 				}
 				(*cur2)->length[(*cur2)->value_count] = strlen((*cur2)->values[(*cur2)->value_count]) + 1;
 			} else {
-				if (((*cur2)->values[(*cur2)->value_count] = malloc(((*cur1)->length[i]) * sizeof(char))) == NULL) {
+				if (((*cur2)->values[(*cur2)->value_count] = cache_entry_alloc(backup_cache_entry, ((*cur1)->length[i]) * sizeof(char))) == NULL) {
 					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "copy_cache_entry: malloc for value failed");
 					rv = 1;
 					goto result;
@@ -424,8 +771,8 @@ int copy_cache_entry(CacheEntry *cache_entry, CacheEntry *backup_cache_entry) {
 	}
 	char **module_ptr;
 	for (module_ptr = cache_entry->modules; module_ptr != NULL && *module_ptr != NULL; module_ptr++) {
-		backup_cache_entry->modules = realloc(backup_cache_entry->modules, (backup_cache_entry->module_count + 2) * sizeof(char *));
-		backup_cache_entry->modules[backup_cache_entry->module_count] = strdup(*module_ptr);
+		backup_cache_entry->modules = cache_entry_realloc(backup_cache_entry, backup_cache_entry->modules, (backup_cache_entry->module_count + 2) * sizeof(char *));
+		backup_cache_entry->modules[backup_cache_entry->module_count] = cache_entry_strdup(backup_cache_entry, *module_ptr);
 		backup_cache_entry->modules[backup_cache_entry->module_count + 1] = NULL;
 		backup_cache_entry->module_count++;
 	}
@@ -434,104 +781,90 @@ result:
 }
 
 const char *cache_entry_get1(CacheEntry *entry, const char *key) {
-	int i;
-
-	for (i = 0; i < entry->attribute_count; i++) {
-		CacheEntryAttribute *attr = entry->attributes[i];
+	CacheEntryAttribute *attr = cache_entry_find_attribute(entry, key, strlen(key));
 
-		if (STRNEQ(attr->name, key))
-			continue;
-		assert(attr->value_count == 1);
-		return attr->values[0];
-	}
-	return NULL;
+	if (attr == NULL)
+		return NULL;
+	assert(attr->value_count == 1);
+	return attr->values[0];
 }
 
 void cache_entry_set1(CacheEntry *entry, const char *key, const char *value) {
-	int i;
+	CacheEntryAttribute *attr = cache_entry_find_attribute(entry, key, strlen(key));
 
-	for (i = 0; i < entry->attribute_count; i++) {
-		CacheEntryAttribute *attr = entry->attributes[i];
-
-		if (STRNEQ(attr->name, key))
-			continue;
-		assert(attr->value_count == 1);
-		free(attr->values[0]);
-		attr->values[0] = strdup(value);
-		assert(attr->values[0]);
-		attr->length[0] = strlen(value) + 1;
+	if (attr == NULL) {
+		cache_entry_add1(entry, key, value);
 		return;
 	}
-	cache_entry_add1(entry, key, value);
+	assert(attr->value_count == 1);
+	if (unpack_attribute(entry, attr))
+		abort();
+	cache_entry_release(entry, attr->values[0]);
+	attr->values[0] = cache_entry_strdup(entry, value);
+	assert(attr->values[0]);
+	attr->length[0] = strlen(value) + 1;
 }
 
 static CacheEntryAttribute *_cache_entry_find_attribute(CacheEntry *entry, LDAPAVA *ava) {
-	int att;
-	for (att = 0; att < entry->attribute_count; att++) {
-		CacheEntryAttribute *attr = entry->attributes[att];
-		if (BERSTREQ(&ava->la_attr, attr->name, strlen(attr->name)))
-			return attr;
-	}
-	return NULL;
+	return cache_entry_find_attribute(entry, ava->la_attr.bv_val, ava->la_attr.bv_len);
 }
-static CacheEntryAttribute *_cache_entry_force_value(CacheEntryAttribute *attr, LDAPAVA *ava) {
+static CacheEntryAttribute *_cache_entry_force_value(CacheEntry *entry, CacheEntryAttribute *attr, LDAPAVA *ava) {
 	void *tmp;
 
+	if (unpack_attribute(entry, attr))
+		return NULL;
 	attr->value_count = 0;
 
-	tmp = realloc(attr->values, (attr->value_count + 2) * sizeof(char *));
+	tmp = cache_entry_realloc(entry, attr->values, (attr->value_count + 2) * sizeof(char *));
 	if (!tmp) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d realloc() failed", __FILE__, __LINE__);
 		return NULL;
 	}
 	attr->values = tmp;
 
-	tmp = realloc(attr->length, (attr->value_count + 2) * sizeof(int));
+	tmp = cache_entry_realloc(entry, attr->length, (attr->value_count + 2) * sizeof(int));
 	if (!tmp) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d realloc() failed", __FILE__, __LINE__);
 		return NULL;
 	}
 	attr->length = tmp;
 
-	attr->length[attr->value_count] = BER2STR(&ava->la_value, &attr->values[attr->value_count]) + 1;
-	if (!attr->values[attr->value_count]) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d BER2STR() failed", __FILE__, __LINE__);
+	if (!(attr->values[attr->value_count] = cache_entry_alloc(entry, ava->la_value.bv_len + 1))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d malloc() failed", __FILE__, __LINE__);
 		return NULL;
 	}
+	memcpy(attr->values[attr->value_count], ava->la_value.bv_val, ava->la_value.bv_len);
+	attr->values[attr->value_count][ava->la_value.bv_len] = '\0';
+	attr->length[attr->value_count] = ava->la_value.bv_len + 1;
 	attr->value_count++;
 	attr->length[attr->value_count] = 0;
 	attr->values[attr->value_count] = NULL;
 	return attr;
 }
 static CacheEntryAttribute *_cache_entry_add_new_attribute(CacheEntry *entry, LDAPAVA *ava) {
-	CacheEntryAttribute *attr = malloc(sizeof(CacheEntryAttribute));
+	CacheEntryAttribute *attr = cache_entry_alloc(entry, sizeof(CacheEntryAttribute));
 	if (!attr) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d malloc() failed", __FILE__, __LINE__);
 		return NULL;
 	}
 	memset(attr, 0, sizeof(CacheEntryAttribute));
 
-	void *tmp = realloc(entry->attributes, (entry->attribute_count + 2) * sizeof(CacheEntryAttribute *));
+	void *tmp = cache_entry_realloc(entry, entry->attributes, (entry->attribute_count + 2) * sizeof(CacheEntryAttribute *));
 	if (!tmp) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d realloc() failed", __FILE__, __LINE__);
 		goto error;
 	}
 	entry->attributes = tmp;
 
-	BER2STR(&ava->la_attr, &attr->name);
-	if (!attr->name) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s:%d BER2STR() failed", __FILE__, __LINE__);
-		goto error;
-	}
-	if (!_cache_entry_force_value(attr, ava))
+	attr->name = cache_entry_intern(ava->la_attr.bv_val, ava->la_attr.bv_len);
+	if (!_cache_entry_force_value(entry, attr, ava))
 		goto error;
 
-	entry->attributes[entry->attribute_count++] = attr;
-	entry->attributes[entry->attribute_count] = NULL;
+	insert_attribute(entry, attr);
 
 	return attr;
 error:
-	cache_free_attribute(attr);
+	cache_free_attribute(entry, attr);
 	return NULL;
 }
 CacheEntryAttribute *cache_entry_update_rdn1(CacheEntry *entry, LDAPAVA *ava) {
@@ -539,7 +872,7 @@ CacheEntryAttribute *cache_entry_update_rdn1(CacheEntry *entry, LDAPAVA *ava) {
 	if (attr == NULL)
 		attr = _cache_entry_add_new_attribute(entry, ava);
 	else
-		attr = _cache_entry_force_value(attr, ava);
+		attr = _cache_entry_force_value(entry, attr, ava);
 
 	return attr;
 }
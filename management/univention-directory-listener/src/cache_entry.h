@@ -42,32 +42,50 @@
 #include <univention/ldap.h>
 
 #include "network.h"
+#include "arena.h"
+
+/* all DNs are stored lower-case, see cache_normalize() */
+#define CACHE_NORMALIZED 0x1
 
 typedef struct _CacheMasterEntry {
 	NotifierID id;
 	NotifierID schema_id;
+	NotifierID flags; /* missing in old caches */
 } CacheMasterEntry;
 extern CacheMasterEntry cache_master_entry;
 
 struct _CacheEntryAttribute {
-	char *name;
+	char *name; /* interned, see cache_entry_intern() */
 	char **values;
 	int *length;
 	int value_count;
+	bool packed; /* length and the values share one block with values, see attribute_from_ldap() */
 } typedef CacheEntryAttribute;
 
 struct _CacheEntry {
-	CacheEntryAttribute **attributes;
+	CacheEntryAttribute **attributes; /* sorted by name, see cache_entry_sort() */
 	int attribute_count;
 	char **modules;
 	int module_count;
+	bool view; /* values and module names point into the database, see parse_entry_view() */
+	struct arena *arena; /* owns all data if set, see cache_entry_alloc() */
 } typedef CacheEntry;
 
+/* Changes of one attribute, see cache_entry_delta() */
+struct _CacheEntryAttributeDelta {
+	CacheEntryAttribute *new, *old; /* NULL if the attribute was added or removed */
+	int *added; /* indices into new->values */
+	int added_count;
+	int *removed; /* indices into old->values */
+	int removed_count;
+} typedef CacheEntryAttributeDelta;
+
 struct transaction_op {
 	NotifierEntry notify;
 	CacheEntry cache;
 	char *ldap_dn;
-	char *uuid;
+	char *uuid; /* in arena */
+	struct arena arena; /* data of the entries read for this operation, reset by change_free_transaction_op() */
 };
 struct transaction {
 	univention_ldap_parameters_t *lp;
@@ -76,6 +94,16 @@ struct transaction {
 	struct transaction_op cur, prev;
 };
 
+/* Entries created by this thread while set allocate from this arena, see change_update_dn() */
+extern __thread struct arena *cache_entry_arena;
+
+char *cache_entry_intern(const char *name, size_t len);
+void *cache_entry_alloc(CacheEntry *entry, size_t size);
+void *cache_entry_realloc(CacheEntry *entry, void *ptr, size_t size);
+char *cache_entry_strdup(CacheEntry *entry, const char *str);
+void cache_entry_release(CacheEntry *entry, void *ptr);
+void cache_entry_sort(CacheEntry *entry);
+CacheEntryAttribute *cache_entry_find_attribute(CacheEntry *entry, const char *name, size_t len);
 int cache_free_entry(char **dn, CacheEntry *entry);
 void cache_dump_entry(char *dn, CacheEntry *entry, FILE *fp);
 int cache_new_entry_from_ldap(char **dn, CacheEntry *cache_entry, LDAP *ld, LDAPMessage *ldap_entry);
@@ -83,6 +111,8 @@ int cache_entry_module_add(CacheEntry *entry, char *module);
 int cache_entry_module_remove(CacheEntry *entry, char *module);
 int cache_entry_module_present(CacheEntry *entry, char *module);
 char **cache_entry_changed_attributes(CacheEntry *new, CacheEntry *old);
+CacheEntryAttributeDelta *cache_entry_delta(CacheEntry *new, CacheEntry *old, int *count);
+void cache_entry_free_delta(CacheEntryAttributeDelta *deltas, int count);
 
 int copy_cache_entry(CacheEntry *cache_entry, CacheEntry *backup_cache_entry);
 
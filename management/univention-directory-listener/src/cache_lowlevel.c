@@ -42,18 +42,33 @@
 #include <limits.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <lz4.h>
 
 #include <univention/debug.h>
 
 #include "common.h"
 #include "cache_lowlevel.h"
 
+/* version 1: one record per attribute value or module */
 struct cache_entry_header {
 	u_int16_t type;
 	u_int32_t key_size;
 	u_int32_t data_size;
 };
 
+/* version 2: one record per attribute with all its values */
+#define CACHE_ENTRY_MAGIC_V2 0xCE02 /* never a valid version 1 type */
+#define CACHE_ENTRY_COMPRESSED 0x0001 /* records follow as u_int32_t size and LZ4 block */
+struct cache_entry_header_v2 {
+	u_int16_t magic;
+	u_int16_t flags;
+	u_int32_t attribute_count;
+	u_int32_t module_count;
+};
+
+/* entries of at least this size are compressed, 0 disables compression */
+u_int32_t entry_compress_threshold = 0;
+
 
 /*
  * Print buffer as hex-decimal dump.
@@ -89,6 +104,16 @@ void hex_dump(int level, void *data, u_int32_t start, u_int32_t size) {
 		univention_debug(UV_DEBUG_LISTENER, level, "%s | %s", hex, str);
 }
 
+static inline void put_u32(void *p, u_int32_t v) {
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline u_int32_t get_u32(const void *p) {
+	u_int32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
 /* assumption: enough memory as been allocated for us */
 static int append_buffer(void **data, u_int32_t *pos, void *blob_data, u_int32_t blob_size) {
 	if (blob_size > 0) {
@@ -99,48 +124,80 @@ static int append_buffer(void **data, u_int32_t *pos, void *blob_data, u_int32_t
 	return 0;
 }
 
+static int append_u32(void **data, u_int32_t *pos, u_int32_t value) {
+	put_u32((char *)*data + *pos, value);
+	*pos += sizeof(u_int32_t);
+	return 0;
+}
+
 /*
- * Convert in-memory representation of cache attribute to on-disk representation.
- * :param data: Return variable to receive pointer to buffer with allocated on-disk representation.
- * :param size: Return variable to receive buffer size of `data`.
- * :param type: Typ of entry to add.
- * :param key_data: Key name.
- * :param key_size: Size of `key_data` in bytes.
- * :param data_data: Value data.
- * :param data_size: Size of `data_data` in bytes.
- * :return: 0 on success, 1 otherwise.
- *
- * See :c:func:`unparse_entry` for the reverse.
+ * Compress the records of a serialized version 2 entry in place.
+ * The entry is left unchanged if compression does not make it smaller.
+ * :param data: Pointer to the buffer with the on-disk representation, which may be replaced.
+ * :param pos: Pointer to the used size of `data`, which is updated.
  */
-static int write_header(void **data, u_int32_t *size, u_int32_t *pos, u_int16_t type, void *key_data, u_int32_t key_size, void *data_data, u_int32_t data_size) {
-	struct cache_entry_header h;
-	u_int32_t need_memory;
-
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "write_header key_size=%d data_size=%d", key_size, data_size);
-
-	need_memory = sizeof(struct cache_entry_header) + key_size + data_size;
-	if (*size < *pos + need_memory) {
-		while (*size < *pos + need_memory)
-			*size += BUFSIZ;
-		if ((*data = realloc(*data, *size)) == NULL) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to allocate memory");
-			return 1;
-		}
+static void compress_entry(void **data, u_int32_t *pos) {
+	const u_int32_t header_size = sizeof(struct cache_entry_header_v2) + sizeof(u_int32_t);
+	u_int32_t raw_size = *pos - sizeof(struct cache_entry_header_v2);
+	struct cache_entry_header_v2 *h;
+	char *buf;
+	int bound, len;
+
+	if (raw_size > LZ4_MAX_INPUT_SIZE)
+		return;
+	bound = LZ4_compressBound(raw_size);
+	if ((buf = malloc(header_size + bound)) == NULL)
+		return;
+	len = LZ4_compress_default((char *)*data + sizeof(struct cache_entry_header_v2), buf + header_size, raw_size, bound);
+	if (len <= 0 || header_size + len >= *pos) {
+		free(buf);
+		return;
 	}
 
-	h.type = type;
-	h.key_size = key_size;
-	h.data_size = data_size;
+	memcpy(buf, *data, sizeof(struct cache_entry_header_v2));
+	h = (struct cache_entry_header_v2 *)buf;
+	h->flags |= CACHE_ENTRY_COMPRESSED;
+	put_u32(buf + sizeof(struct cache_entry_header_v2), raw_size);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "compress_entry size=%d compressed=%d", *pos, header_size + len);
 
-	append_buffer(data, pos, (void *)&h, sizeof(struct cache_entry_header));
-	append_buffer(data, pos, key_data, key_size);
-	append_buffer(data, pos, data_data, data_size);
+	free(*data);
+	*data = buf;
+	*pos = header_size + len;
+}
 
-	return 0;
+/*
+ * Decompress a compressed version 2 entry.
+ * :param data: Pointer to the buffer containing the on-disk representation.
+ * :param size: Pointer to the buffer size of `data`, which is updated to the size of the returned buffer.
+ * :returns: A newly allocated uncompressed version 2 entry, or NULL on errors.
+ */
+static void *decompress_entry(void *data, u_int32_t *size) {
+	const u_int32_t header_size = sizeof(struct cache_entry_header_v2) + sizeof(u_int32_t);
+	struct cache_entry_header_v2 *h;
+	u_int32_t raw_size;
+	char *buf;
+
+	if (*size < header_size)
+		return NULL;
+	raw_size = get_u32((char *)data + sizeof(struct cache_entry_header_v2));
+	if (raw_size > LZ4_MAX_INPUT_SIZE || (buf = malloc(sizeof(struct cache_entry_header_v2) + raw_size)) == NULL)
+		return NULL;
+	if (LZ4_decompress_safe((char *)data + header_size, buf + sizeof(struct cache_entry_header_v2), *size - header_size, raw_size) != raw_size) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "decompress_entry: corrupt data");
+		free(buf);
+		return NULL;
+	}
+
+	memcpy(buf, data, sizeof(struct cache_entry_header_v2));
+	h = (struct cache_entry_header_v2 *)buf;
+	h->flags &= ~CACHE_ENTRY_COMPRESSED;
+	*size = sizeof(struct cache_entry_header_v2) + raw_size;
+	return buf;
 }
 
 /*
  * Convert in-memory representation of cache entry to on-disk representation.
+ * Always writes the current format version, see :c:func:`entry_version`.
  * :param data: Return variable to receive pointer to buffer with allocated on-disk representation.
  * :param size: Return variable to receive buffer size of `data`.
  * :param entry: The cache entry to serialize.
@@ -149,28 +206,92 @@ static int write_header(void **data, u_int32_t *size, u_int32_t *pos, u_int16_t
  * See :c:func:`parse_entry` for the reverse.
  */
 int unparse_entry(void **data, u_int32_t *size, CacheEntry *entry) {
+	struct cache_entry_header_v2 h = {
+	    .magic = CACHE_ENTRY_MAGIC_V2,
+	};
 	CacheEntryAttribute **attribute;
 	char **value;
 	char **module;
-	int *length;
+	u_int32_t need_memory = sizeof(struct cache_entry_header_v2);
+	u_int32_t pos = 0, offset;
 	int i;
-	u_int32_t pos = 0;
 
+	/* compute the exact size first, so the buffer is allocated only once */
+	for (attribute = entry->attributes; attribute != NULL && *attribute != NULL; attribute++, h.attribute_count++) {
+		need_memory += 2 * sizeof(u_int32_t) + strlen((*attribute)->name) + 1 + sizeof(u_int32_t);
+		for (value = (*attribute)->values, i = 0; *value != NULL; value++, i++)
+			need_memory += sizeof(u_int32_t) + (*attribute)->length[i];
+	}
+	for (module = entry->modules; module != NULL && *module != NULL; module++, h.module_count++)
+		need_memory += sizeof(u_int32_t) + strlen(*module) + 1;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "unparse_entry attributes=%d modules=%d size=%d", h.attribute_count, h.module_count, need_memory);
+	if (*size < need_memory) {
+		if ((*data = realloc(*data, need_memory)) == NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to allocate memory");
+			return 1;
+		}
+	}
+
+	append_buffer(data, &pos, (void *)&h, sizeof(struct cache_entry_header_v2));
 	for (attribute = entry->attributes; attribute != NULL && *attribute != NULL; attribute++) {
-		for (value = (*attribute)->values, i = 0, length = (*attribute)->length; *value != NULL; value++, i++) {
-			write_header(data, size, &pos, 1, (void *)(*attribute)->name, strlen((*attribute)->name) + 1, (void *)*value, length[i]);
+		u_int32_t name_size = strlen((*attribute)->name) + 1;
+		u_int32_t value_count = 0;
+
+		for (value = (*attribute)->values; *value != NULL; value++)
+			value_count++;
+
+		append_u32(data, &pos, name_size);
+		append_u32(data, &pos, value_count);
+		append_buffer(data, &pos, (*attribute)->name, name_size);
+		for (i = 0, offset = 0; i < value_count; i++) {
+			append_u32(data, &pos, offset);
+			offset += (*attribute)->length[i];
 		}
+		append_u32(data, &pos, offset);
+		for (i = 0; i < value_count; i++)
+			append_buffer(data, &pos, (*attribute)->values[i], (*attribute)->length[i]);
 	}
 	for (module = entry->modules; module != NULL && *module != NULL; module++) {
-		write_header(data, size, &pos, 2, (void *)*module, strlen(*module) + 1, NULL, 0);
+		u_int32_t module_size = strlen(*module) + 1;
+
+		append_u32(data, &pos, module_size);
+		append_buffer(data, &pos, *module, module_size);
 	}
 
+	if (entry_compress_threshold > 0 && pos >= entry_compress_threshold)
+		compress_entry(data, &pos);
+
 	/* allocated memory maybe bigger than size, but doesn't matter anyhow... */
 	*size = pos;
 
 	return 0;
 }
 
+/*
+ * Return the on-disk format version of a serialized entry.
+ * :param data: Pointer to the buffer containing the on-disk representation.
+ * :param size: Buffer size of `data`.
+ * :returns: 1 for the legacy format of one record per value, 2 for the format with one record per attribute.
+ */
+int entry_version(void *data, u_int32_t size) {
+	if (size >= sizeof(struct cache_entry_header_v2) && ((struct cache_entry_header_v2 *)data)->magic == CACHE_ENTRY_MAGIC_V2)
+		return 2;
+	return 1;
+}
+
+/*
+ * Check if a serialized entry would be stored differently when written now.
+ * :param data: Pointer to the buffer containing the on-disk representation.
+ * :param size: Buffer size of `data`.
+ * :returns: true if the entry uses an older format or should be compressed.
+ */
+bool entry_outdated(void *data, u_int32_t size) {
+	if (entry_version(data, size) != CACHE_ENTRY_VERSION)
+		return true;
+	return entry_compress_threshold > 0 && size >= entry_compress_threshold && !(((struct cache_entry_header_v2 *)data)->flags & CACHE_ENTRY_COMPRESSED);
+}
+
 /*
  * De-serialize entry from buffer.
  * :param data: Pointer to the buffer containing the on-disk representation.
@@ -228,68 +349,86 @@ static int read_header(void *data, u_int32_t size, u_int32_t *pos, void **key_da
 }
 
 /*
- * Convert on-disk representation of cache entry to in-memory representation.
+ * Log a corrupt on-disk entry and flag the cache as bad.
  * :param data: Pointer to the buffer containing the on-disk representation.
  * :param size: Buffer size of `data`.
- * :param entry: Return variable to receive parsed cache entry.
- * :returns: 0 on success, 1 otherwise.
- *
- * :See :c:func:`unparse_entry` for the reverse.
+ * :param pos: Offset of the bad data block.
  */
-int parse_entry(void *data, u_int32_t size, CacheEntry *entry) {
+static void bad_entry(void *data, u_int32_t size, u_int32_t pos) {
+	char filename[PATH_MAX];
+	FILE *file;
+	u_int32_t len;
+	int rv;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "bad data block at position %d:", pos);
+	len = pos < 1000 ? pos : 1000;
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "last %d bytes of previous entry:", len);
+	hex_dump(UV_DEBUG_ERROR, data, pos < 1000 ? 0 : pos - 1000, len);
+	len = pos + 1000 > size ? size - pos : 1000;
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "first %d bytes of current entry:", len);
+	hex_dump(UV_DEBUG_ERROR, data, pos, len);
+
+	rv = snprintf(filename, PATH_MAX, "%s/bad_cache", cache_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	if ((file = fopen(filename, "w")) == NULL)
+		abort_io("open", filename);
+	fprintf(file, "Check log file");
+	rv = fclose(file);
+	if (rv != 0)
+		abort_io("close", filename);
+}
+
+static int parse_entry_v1(void *data, u_int32_t size, CacheEntry *entry) {
 	u_int16_t type;
 	void *key_data, *data_data;
 	u_int32_t key_size, data_size;
 	u_int32_t pos = 0;
 
-	entry->attributes = NULL;
-	entry->attribute_count = 0;
-	entry->modules = NULL;
-	entry->module_count = 0;
-
 	while ((type = read_header(data, size, &pos, &key_data, &key_size, &data_data, &data_size)) > 0) {
 		if (type == 1) {
 			CacheEntryAttribute **attribute, *c_attr;
+			char *name = cache_entry_intern(key_data, strnlen(key_data, key_size));
 
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "attribute is \"%s\"", (char *)key_data);
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "attribute is \"%s\"", name);
 
-			for (attribute = entry->attributes, c_attr = NULL; attribute != NULL && *attribute != NULL; attribute++) {
+			/* values of one attribute are normally stored consecutively */
+			c_attr = NULL;
+			if (entry->attribute_count > 0 && entry->attributes[entry->attribute_count - 1]->name == name)
+				c_attr = entry->attributes[entry->attribute_count - 1];
+			for (attribute = entry->attributes; c_attr == NULL && attribute != NULL && *attribute != NULL; attribute++) {
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "current attribute is \"%s\"", (*attribute)->name);
-				if (strcmp((*attribute)->name, (char *)key_data) == 0) {
+				if ((*attribute)->name == name)
 					c_attr = *attribute;
-					break;
-				}
 			}
 			if (!c_attr) {
-				if (!(entry->attributes = realloc(entry->attributes, (entry->attribute_count + 2) * sizeof(CacheEntryAttribute *)))) {
+				if (!(entry->attributes = cache_entry_realloc(entry, entry->attributes, (entry->attribute_count + 2) * sizeof(CacheEntryAttribute *)))) {
 					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "realloc failed");
 					abort();  // FIXME
 				}
-				if (!(c_attr = malloc(sizeof(CacheEntryAttribute)))) {
+				if (!(c_attr = cache_entry_alloc(entry, sizeof(CacheEntryAttribute)))) {
 					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc failed");
 					abort();  // FIXME
 				}
-				if (!(c_attr->name = strndup((char *)key_data, key_size))) {
-					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "strndup failed");
-					abort();  // FIXME
-				}
+				c_attr->name = name;
 				c_attr->values = NULL;
 				c_attr->length = NULL;
 				c_attr->value_count = 0;
+				c_attr->packed = false;
 				entry->attributes[entry->attribute_count++] = c_attr;
 				entry->attributes[entry->attribute_count] = NULL;
 
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "%s is at %p", c_attr->name, c_attr);
 			}
-			if (!(c_attr->values = realloc(c_attr->values, (c_attr->value_count + 2) * sizeof(char *)))) {
+			if (!(c_attr->values = cache_entry_realloc(entry, c_attr->values, (c_attr->value_count + 2) * sizeof(char *)))) {
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "realloc failed");
 				abort();  // FIXME
 			}
-			if (!(c_attr->length = realloc(c_attr->length, (c_attr->value_count + 2) * sizeof(int)))) {
+			if (!(c_attr->length = cache_entry_realloc(entry, c_attr->length, (c_attr->value_count + 2) * sizeof(int)))) {
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "realloc failed");
 				abort();  // FIXME
 			}
-			if (!(c_attr->values[c_attr->value_count] = malloc(data_size))) {
+			if (!(c_attr->values[c_attr->value_count] = cache_entry_alloc(entry, data_size))) {
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc() failed");
 				abort();  // FIXME
 			}
@@ -298,43 +437,390 @@ int parse_entry(void *data, u_int32_t size, CacheEntry *entry) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "value is \"%s\"", c_attr->values[c_attr->value_count]);
 			c_attr->values[++c_attr->value_count] = NULL;
 		} else if (type == 2) {
-			entry->modules = realloc(entry->modules, (entry->module_count + 2) * sizeof(char *));
-			if (!(entry->modules[entry->module_count] = strndup((char *)key_data, key_size))) {
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "strndup failed");
+			size_t len = strnlen(key_data, key_size);
+
+			entry->modules = cache_entry_realloc(entry, entry->modules, (entry->module_count + 2) * sizeof(char *));
+			if (!entry->modules || !(entry->modules[entry->module_count] = cache_entry_alloc(entry, len + 1))) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc failed");
 				abort();  // FIXME
 			}
+			memcpy(entry->modules[entry->module_count], key_data, len);
+			entry->modules[entry->module_count][len] = '\0';
 			entry->modules[++entry->module_count] = NULL;
 		} else {
-			char filename[PATH_MAX];
-			FILE *file;
-			u_int32_t len;
-			int rv;
-
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "bad data block at position %d:", pos);
-			len = pos < 1000 ? pos : 1000;
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "last %d bytes of previous entry:", len);
-			hex_dump(UV_DEBUG_ERROR, data, pos < 1000 ? 0 : pos - 1000, len);
-			len = pos + 1000 > size ? size - pos : 1000;
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "first %d bytes of current entry:", len);
-			hex_dump(UV_DEBUG_ERROR, data, pos, len);
-
-			rv = snprintf(filename, PATH_MAX, "%s/bad_cache", cache_dir);
-			if (rv < 0 || rv >= PATH_MAX)
-				abort();
-			if ((file = fopen(filename, "w")) == NULL)
-				abort_io("open", filename);
-			fprintf(file, "Check log file");
-			rv = fclose(file);
-			if (rv != 0)
-				abort_io("close", filename);
+			bad_entry(data, size, pos);
+			return -1;
+		}
+	}
+	cache_entry_sort(entry);
+
+	return 0;
+}
+
+struct attribute_v2 {
+	char *name;
+	u_int32_t value_count;
+	char *offsets; /* value_count + 1 offsets into values */
+	char *values;
+};
+
+/*
+ * De-serialize one attribute record of a version 2 entry.
+ * :param data: Pointer to the buffer containing the on-disk representation.
+ * :param size: Buffer size of `data`.
+ * :param pos: Pointer to offset into buffer, which is updated past the record.
+ * :param attr: Return variable to receive the attribute record pointing into `data`.
+ * :returns: 0 on success, -1 on errors.
+ */
+static int read_attribute_v2(void *data, u_int32_t size, u_int32_t *pos, struct attribute_v2 *attr) {
+	u_int32_t name_size, i, prev, cur;
 
+	if (size - *pos < 2 * sizeof(u_int32_t))
+		return -1;
+	name_size = get_u32((char *)data + *pos);
+	attr->value_count = get_u32((char *)data + *pos + sizeof(u_int32_t));
+	*pos += 2 * sizeof(u_int32_t);
+
+	if (name_size == 0 || name_size > size - *pos)
+		return -1;
+	attr->name = (char *)data + *pos;
+	if (attr->name[name_size - 1] != '\0')
+		return -1;
+	*pos += name_size;
+
+	if (attr->value_count >= (size - *pos) / sizeof(u_int32_t))
+		return -1;
+	attr->offsets = (char *)data + *pos;
+	*pos += (attr->value_count + 1) * sizeof(u_int32_t);
+	attr->values = (char *)data + *pos;
+
+	for (i = 0, prev = 0; i <= attr->value_count; i++, prev = cur) {
+		cur = get_u32(attr->offsets + i * sizeof(u_int32_t));
+		if (cur < prev || cur > size - *pos)
+			return -1;
+	}
+	*pos += prev;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "read_attribute_v2 pos=%d name=[%s] values=%d", *pos, attr->name, attr->value_count);
+	return 0;
+}
+
+/*
+ * Return the value of an attribute record of a version 2 entry.
+ * :param attr: The attribute record.
+ * :param i: Index of the value.
+ * :param value: Return variable to receive the value pointing into the entry.
+ * :returns: The length of the value.
+ */
+static inline int value_v2(struct attribute_v2 *attr, u_int32_t i, char **value) {
+	u_int32_t start = get_u32(attr->offsets + i * sizeof(u_int32_t));
+	u_int32_t end = get_u32(attr->offsets + (i + 1) * sizeof(u_int32_t));
+
+	*value = attr->values + start;
+	return end - start;
+}
+
+/*
+ * De-serialize one module record of a version 2 entry.
+ * :param data: Pointer to the buffer containing the on-disk representation.
+ * :param size: Buffer size of `data`.
+ * :param pos: Pointer to offset into buffer, which is updated past the record.
+ * :param module: Return variable to receive the module name pointing into `data`.
+ * :returns: 0 on success, -1 on errors.
+ */
+static int read_module_v2(void *data, u_int32_t size, u_int32_t *pos, char **module) {
+	u_int32_t module_size;
+
+	if (size - *pos < sizeof(u_int32_t))
+		return -1;
+	module_size = get_u32((char *)data + *pos);
+	*pos += sizeof(u_int32_t);
+
+	if (module_size == 0 || module_size > size - *pos)
+		return -1;
+	*module = (char *)data + *pos;
+	if ((*module)[module_size - 1] != '\0')
+		return -1;
+	*pos += module_size;
+
+	return 0;
+}
+
+static int parse_entry_v2(void *data, u_int32_t size, CacheEntry *entry) {
+	struct cache_entry_header_v2 *h = data;
+	struct attribute_v2 attr;
+	u_int32_t pos = sizeof(struct cache_entry_header_v2);
+	int i;
+
+	/* each record takes at least a few bytes, so this bounds the allocation below */
+	if (h->attribute_count > size / (3 * sizeof(u_int32_t)) || h->module_count > size / sizeof(u_int32_t)) {
+		bad_entry(data, size, 0);
+		return -1;
+	}
+	if (!(entry->attributes = cache_entry_alloc(entry, (h->attribute_count + 1) * sizeof(CacheEntryAttribute *))) ||
+	    !(entry->modules = cache_entry_alloc(entry, (h->module_count + 1) * sizeof(char *)))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "calloc failed");
+		abort();  // FIXME
+	}
+	memset(entry->attributes, 0, (h->attribute_count + 1) * sizeof(CacheEntryAttribute *));
+	memset(entry->modules, 0, (h->module_count + 1) * sizeof(char *));
+
+	while (entry->attribute_count < h->attribute_count) {
+		CacheEntryAttribute *c_attr;
+
+		if (read_attribute_v2(data, size, &pos, &attr) != 0) {
+			bad_entry(data, size, pos);
+			return -1;
+		}
+		if (!(c_attr = cache_entry_alloc(entry, sizeof(CacheEntryAttribute))) ||
+		    !(c_attr->values = cache_entry_alloc(entry, (attr.value_count + 1) * sizeof(char *))) ||
+		    !(c_attr->length = cache_entry_alloc(entry, (attr.value_count + 1) * sizeof(int)))) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc failed");
+			abort();  // FIXME
+		}
+		c_attr->name = cache_entry_intern(attr.name, strlen(attr.name));
+		for (i = 0; i < attr.value_count; i++) {
+			char *value;
+			int length = value_v2(&attr, i, &value);
+
+			if (!(c_attr->values[i] = cache_entry_alloc(entry, length))) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc() failed");
+				abort();  // FIXME
+			}
+			memcpy(c_attr->values[i], value, length);
+			c_attr->length[i] = length;
+		}
+		c_attr->values[i] = NULL;
+		c_attr->length[i] = 0;
+		c_attr->value_count = attr.value_count;
+		c_attr->packed = false;
+		entry->attributes[entry->attribute_count++] = c_attr;
+	}
+
+	while (entry->module_count < h->module_count) {
+		char *module;
+
+		if (read_module_v2(data, size, &pos, &module) != 0) {
+			bad_entry(data, size, pos);
 			return -1;
 		}
+		if (!(entry->modules[entry->module_count++] = cache_entry_strdup(entry, module))) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "strdup failed");
+			abort();  // FIXME
+		}
 	}
+	cache_entry_sort(entry);
 
 	return 0;
 }
 
+/*
+ * Convert on-disk representation of cache entry to in-memory representation.
+ * Both format versions are supported, see :c:func:`entry_version`.
+ * :param data: Pointer to the buffer containing the on-disk representation.
+ * :param size: Buffer size of `data`.
+ * :param entry: Return variable to receive parsed cache entry.
+ * :returns: 0 on success, 1 otherwise.
+ *
+ * :See :c:func:`unparse_entry` for the reverse.
+ */
+int parse_entry(void *data, u_int32_t size, CacheEntry *entry) {
+	entry->attributes = NULL;
+	entry->attribute_count = 0;
+	entry->modules = NULL;
+	entry->module_count = 0;
+	entry->view = false;
+	entry->arena = cache_entry_arena;
+
+	if (entry_version(data, size) != 2)
+		return parse_entry_v1(data, size, entry);
+	if (((struct cache_entry_header_v2 *)data)->flags & CACHE_ENTRY_COMPRESSED) {
+		void *raw = decompress_entry(data, &size);
+		int rv;
+
+		if (raw == NULL) {
+			bad_entry(data, size, 0);
+			return -1;
+		}
+		rv = parse_entry_v2(raw, size, entry);
+		free(raw);
+		return rv;
+	}
+	return parse_entry_v2(data, size, entry);
+}
+
+static char empty_value[] = "";
+
+/*
+ * Allocate the arrays of a view, each in one block.
+ * Each attribute gets room for its terminating NULL value.
+ */
+static void view_alloc(CacheEntry *entry, int attribute_count, int value_count, int module_count, CacheEntryAttribute **attrs, char ***values, int **lengths) {
+	if (!(entry->attributes = malloc((attribute_count + 1) * sizeof(CacheEntryAttribute *))) ||
+	    !(entry->modules = malloc((module_count + 1) * sizeof(char *))) ||
+	    (attribute_count > 0 && (!(*attrs = malloc(attribute_count * sizeof(CacheEntryAttribute))) ||
+	                             !(*values = malloc((value_count + attribute_count) * sizeof(char *))) ||
+	                             !(*lengths = malloc((value_count + attribute_count) * sizeof(int)))))) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc failed");
+		abort();  // FIXME
+	}
+}
+
+static int parse_entry_view_v1(void *data, u_int32_t size, CacheEntry *entry) {
+	int type, i;
+	void *key_data, *data_data;
+	u_int32_t key_size, data_size;
+	u_int32_t pos = 0;
+	int attribute_count = 0, value_count = 0, module_count = 0;
+	const char *last = NULL;
+	CacheEntryAttribute *attrs = NULL, *c_attr = NULL;
+	char **values = NULL;
+	int *lengths = NULL;
+
+	memset(entry, 0, sizeof(CacheEntry));
+
+	/* count everything first */
+	while ((type = read_header(data, size, &pos, &key_data, &key_size, &data_data, &data_size)) > 0) {
+		if (((char *)key_data)[key_size - 1] != '\0')
+			return 1;
+		if (type == 2) {
+			module_count++;
+			continue;
+		}
+		if (last == NULL || strcmp(last, key_data) != 0) {
+			attribute_count++;
+			last = key_data;
+		}
+		value_count++;
+	}
+	if (type < 0)
+		return 1;
+
+	view_alloc(entry, attribute_count, value_count, module_count, &attrs, &values, &lengths);
+
+	pos = 0;
+	while ((type = read_header(data, size, &pos, &key_data, &key_size, &data_data, &data_size)) > 0) {
+		if (type == 2) {
+			entry->modules[entry->module_count++] = key_data;
+			continue;
+		}
+		char *name = cache_entry_intern(key_data, key_size - 1);
+
+		if (c_attr == NULL || c_attr->name != name) {
+			if (c_attr != NULL) {
+				c_attr->values[c_attr->value_count] = NULL;
+				values += c_attr->value_count + 1;
+				lengths += c_attr->value_count + 1;
+			}
+			c_attr = &attrs[entry->attribute_count];
+			c_attr->name = name;
+			c_attr->values = values;
+			c_attr->length = lengths;
+			c_attr->value_count = 0;
+			c_attr->packed = false;
+			entry->attributes[entry->attribute_count++] = c_attr;
+		}
+		c_attr->values[c_attr->value_count] = data_size ? data_data : empty_value;
+		c_attr->length[c_attr->value_count++] = data_size;
+	}
+	if (c_attr != NULL)
+		c_attr->values[c_attr->value_count] = NULL;
+	entry->attributes[entry->attribute_count] = NULL;
+	entry->modules[entry->module_count] = NULL;
+	entry->view = true;
+	cache_entry_sort(entry);
+
+	/* values of one attribute are expected to be stored consecutively */
+	for (i = 1; i < entry->attribute_count; i++) {
+		if (entry->attributes[i - 1]->name == entry->attributes[i]->name) {
+			cache_free_entry(NULL, entry);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int parse_entry_view_v2(void *data, u_int32_t size, CacheEntry *entry) {
+	struct cache_entry_header_v2 *h = data;
+	struct attribute_v2 attr;
+	u_int32_t pos = sizeof(struct cache_entry_header_v2);
+	u_int32_t i, j, value_count = 0;
+	CacheEntryAttribute *attrs = NULL;
+	char **values = NULL, *module;
+	int *lengths = NULL;
+
+	memset(entry, 0, sizeof(CacheEntry));
+
+	/* compressed entries can only be copied */
+	if (h->flags & CACHE_ENTRY_COMPRESSED)
+		return 1;
+
+	/* validate and count everything first */
+	if (h->attribute_count > size / (3 * sizeof(u_int32_t)) || h->module_count > size / sizeof(u_int32_t))
+		return 1;
+	for (i = 0; i < h->attribute_count; i++) {
+		if (read_attribute_v2(data, size, &pos, &attr) != 0)
+			return 1;
+		value_count += attr.value_count;
+	}
+	for (i = 0; i < h->module_count; i++) {
+		if (read_module_v2(data, size, &pos, &module) != 0)
+			return 1;
+	}
+
+	view_alloc(entry, h->attribute_count, value_count, h->module_count, &attrs, &values, &lengths);
+
+	pos = sizeof(struct cache_entry_header_v2);
+	for (i = 0; i < h->attribute_count; i++) {
+		CacheEntryAttribute *c_attr = &attrs[i];
+
+		read_attribute_v2(data, size, &pos, &attr);
+		c_attr->name = cache_entry_intern(attr.name, strlen(attr.name));
+		c_attr->values = values;
+		c_attr->length = lengths;
+		c_attr->value_count = attr.value_count;
+		c_attr->packed = false;
+		for (j = 0; j < attr.value_count; j++) {
+			lengths[j] = value_v2(&attr, j, &values[j]);
+			if (!lengths[j])
+				values[j] = empty_value;
+		}
+		values[j] = NULL;
+		lengths[j] = 0;
+		values += j + 1;
+		lengths += j + 1;
+		entry->attributes[i] = c_attr;
+	}
+	entry->attributes[i] = NULL;
+	entry->attribute_count = h->attribute_count;
+
+	for (i = 0; i < h->module_count; i++)
+		read_module_v2(data, size, &pos, &entry->modules[i]);
+	entry->modules[i] = NULL;
+	entry->module_count = h->module_count;
+	entry->view = true;
+	cache_entry_sort(entry);
+
+	return 0;
+}
+
+/*
+ * Convert on-disk representation of cache entry to a read-only view.
+ * Values and module names point into `data`, so the view
+ * is only valid as long as `data`, i.e. the database transaction. Only the
+ * arrays are allocated, each exactly once; free with :c:func:`cache_free_entry`.
+ * :param data: Pointer to the buffer containing the on-disk representation.
+ * :param size: Buffer size of `data`.
+ * :param entry: Return variable to receive the view.
+ * :returns: 0 on success, 1 if the entry must be parsed by :c:func:`parse_entry`.
+ */
+int parse_entry_view(void *data, u_int32_t size, CacheEntry *entry) {
+	if (entry_version(data, size) == 2)
+		return parse_entry_view_v2(data, size, entry);
+	return parse_entry_view_v1(data, size, entry);
+}
+
 /*
  * Abort on I/O error.
  * :param func: The name of the function, which failed.
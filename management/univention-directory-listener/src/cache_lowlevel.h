@@ -38,8 +38,15 @@
 
 #include "cache.h"
 
+#define CACHE_ENTRY_VERSION 2
+
+extern u_int32_t entry_compress_threshold;
+
 int unparse_entry(void **data, u_int32_t *size, CacheEntry *entry);
 int parse_entry(void *data, u_int32_t size, CacheEntry *entry);
+int parse_entry_view(void *data, u_int32_t size, CacheEntry *entry);
+int entry_version(void *data, u_int32_t size);
+bool entry_outdated(void *data, u_int32_t size);
 void hex_dump(int level, void *data, u_int32_t start, u_int32_t size);
 void abort_io(const char *func, const char *filename) __attribute__((noreturn));
 
@@ -51,35 +51,401 @@
 #include "common.h"
 #include "change.h"
 #include "cache.h"
+#include "policy_index.h"
 #include "handlers.h"
+#include "filter.h"
+#include "lane.h"
 #include "signals.h"
 #include "network.h"
 #include "utils.h"
+#include "tunables.h"
+#include "metrics.h"
+#include "memory.h"
+#include "probes.h"
 
-extern Handler *handlers;
 
-struct dn_list {
-	char *dn;
-	long size;
+/* number of objects missing in the cache searched at once while initializing a module */
+#define INIT_FETCH_MAX 32
+
+/* key of the progress of module initialization, see struct init_checkpoint */
+#define INIT_CHECKPOINT "init_checkpoint"
+
+/* LDAP search issued in advance for a queued transaction */
+struct prefetch {
+	NotifierID id;
+	LDAP *ld;
+	unsigned long reconnects; /* connection generation of ld */
+	int msgid;
+	int scope;
+	char *base;
+	char filter[64]; /* "(entryUUID=XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX)" */
+};
+static struct prefetch prefetches[PREFETCH_MAX];
+static int prefetch_head, prefetch_count;
+static NotifierID prefetch_last;
+
+/* find the objects for initializing modules in the cache, see change_init_from_cache() */
+static bool init_from_cache = false;
+
+/* DNs found while initializing a module, by their number of RDNs, so
+   parents are processed before their children */
+struct dn_bucket {
+	char **dns;
+	int count;
+	int size;
+};
+
+struct dn_buckets {
+	struct dn_bucket *buckets;
+	int count;
+	size_t bytes; /* of the DNs and their pointers, see memory_account() */
 };
 
-static int dn_size_compare(const void *p1, const void *p2) {
-	const struct dn_list *dn1 = p1, *dn2 = p2;
-	return dn1->size - dn2->size;
+static int dn_depth(const char *dn) {
+	int depth = 1;
+
+	for (; *dn != '\0'; dn++) {
+		if (*dn == '\\' && dn[1] != '\0')
+			dn++;
+		else if (*dn == ',')
+			depth++;
+	}
+	return depth;
+}
+
+static void dn_buckets_add(struct dn_buckets *buckets, char *dn) {
+	struct dn_bucket *bucket;
+	int depth = dn_depth(dn);
+
+	if (depth > buckets->count) {
+		if ((buckets->buckets = realloc(buckets->buckets, depth * sizeof(struct dn_bucket))) == NULL)
+			abort();  // FIXME
+		memset(buckets->buckets + buckets->count, 0, (depth - buckets->count) * sizeof(struct dn_bucket));
+		buckets->count = depth;
+	}
+	bucket = &buckets->buckets[depth - 1];
+	if (bucket->count == bucket->size) {
+		bucket->size = bucket->size ? bucket->size * 2 : 64;
+		if ((bucket->dns = realloc(bucket->dns, bucket->size * sizeof(char *))) == NULL)
+			abort();  // FIXME
+	}
+	bucket->dns[bucket->count++] = dn;
+	buckets->bytes += strlen(dn) + 1 + sizeof(char *);
+	memory_account(MEMORY_DNS, strlen(dn) + 1 + sizeof(char *));
+}
+
+static int compare_strings(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* Sort the DNs of each depth, so initialization can be resumed after the
+   last DN handled, and remove duplicates found by several searches. */
+static void dn_buckets_sort(struct dn_buckets *buckets) {
+	struct dn_bucket *bucket;
+	int i, j, k;
+
+	for (i = 0; i < buckets->count; i++) {
+		bucket = &buckets->buckets[i];
+		if (bucket->count < 2)
+			continue;
+		qsort(bucket->dns, bucket->count, sizeof(char *), compare_strings);
+		for (j = 1, k = 1; j < bucket->count; j++) {
+			if (strcmp(bucket->dns[j], bucket->dns[k - 1]) == 0) {
+				buckets->bytes -= strlen(bucket->dns[j]) + 1 + sizeof(char *);
+				memory_account(MEMORY_DNS, -(long)(strlen(bucket->dns[j]) + 1 + sizeof(char *)));
+				ldap_memfree(bucket->dns[j]);
+			} else
+				bucket->dns[k++] = bucket->dns[j];
+		}
+		bucket->count = k;
+	}
+}
+
+static void dn_buckets_free(struct dn_buckets *buckets) {
+	int i, j;
+
+	for (i = 0; i < buckets->count; i++) {
+		for (j = 0; j < buckets->buckets[i].count; j++)
+			ldap_memfree(buckets->buckets[i].dns[j]);
+		free(buckets->buckets[i].dns);
+	}
+	free(buckets->buckets);
+	memory_account(MEMORY_DNS, -(long)buckets->bytes);
+	buckets->bytes = 0;
+	buckets->buckets = NULL;
+	buckets->count = 0;
 }
 
-/* initialize module */
-static int change_init_module(univention_ldap_parameters_t *lp, Handler *handler) {
+/* Search the DNs matching the filter page by page (RFC 2696), so only one
+   page of results is held at a time. Servers not supporting paging return
+   all results at once. */
+static int init_search_dns(univention_ldap_parameters_t *lp, struct filter *filter, struct dn_buckets *buckets) {
 	LDAPMessage *res, *cur;
-	char *attrs[] = {LDAP_ALL_USER_ATTRIBUTES, LDAP_ALL_OPERATIONAL_ATTRIBUTES, NULL};
-	struct filter **f;
-	int rv;
-	CacheEntry cache_entry, old_cache_entry;
-	MDB_cursor *id2entry_cursor_p = NULL;
-	MDB_cursor *id2dn_cursor_p = NULL;
+	char *attrs[] = {LDAP_NO_ATTRS, NULL};
+	int attrsonly1 = 1;
+	LDAPControl *serverctrls[2] = {NULL, NULL}, **resctrls = NULL, *ctrl;
+	LDAPControl **clientctrls = NULL;
+	struct timeval timeout = {
+	    .tv_sec = ldap_timeout_scans(), .tv_usec = 0,
+	};
+	int sizelimit0 = 0;
+	struct berval cookie = {0, NULL};
+	ber_int_t estimate;
+	int page_size = tunables_get()->init_pagesize;
+	int rv, err;
+
+	do {
+		if ((rv = ldap_create_page_control(lp->ld, page_size, &cookie, 0, &serverctrls[0])) != LDAP_SUCCESS)
+			break;
+		rv = LDAP_RETRY(lp, ldap_search_ext_s(lp->ld, filter->base, filter->scope, filter->filter, attrs, attrsonly1, serverctrls, clientctrls, &timeout, sizelimit0, &res));
+		ldap_control_free(serverctrls[0]);
+		serverctrls[0] = NULL;
+		if (rv != LDAP_SUCCESS)
+			break;
+
+		for (cur = ldap_first_entry(lp->ld, res); cur != NULL; cur = ldap_next_entry(lp->ld, cur))
+			dn_buckets_add(buckets, ldap_get_dn(lp->ld, cur));
+
+		ber_memfree(cookie.bv_val);
+		cookie.bv_val = NULL;
+		cookie.bv_len = 0;
+		if ((rv = ldap_parse_result(lp->ld, res, &err, NULL, NULL, NULL, &resctrls, 1)) == LDAP_SUCCESS)
+			rv = err;
+		if (rv == LDAP_SUCCESS && (ctrl = ldap_control_find(LDAP_CONTROL_PAGEDRESULTS, resctrls, NULL)) != NULL)
+			rv = ldap_parse_pageresponse_control(lp->ld, ctrl, &estimate, &cookie);
+		ldap_controls_free(resctrls);
+		resctrls = NULL;
+	} while (rv == LDAP_SUCCESS && cookie.bv_len > 0);
+	ber_memfree(cookie.bv_val);
+
+	return rv;
+}
+
+/* Find the DNs of the cached objects matching the filters of any of the
+   modules, instead of searching them in LDAP. */
+static int init_cache_dns(Handler **pending, int count, struct dn_buckets *buckets) {
+	MDB_cursor *id2entry_read_cursor_p = NULL;
+	MDB_cursor *id2dn_read_cursor_p = NULL;
 	char *dn = NULL;
+	CacheEntry entry;
+	int h, rv;
+
+	for (rv = cache_first_entry_view(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry); rv != MDB_NOTFOUND; rv = cache_next_entry_view(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry)) {
+		if (rv < -1)
+			break;
+		for (h = 0; rv == 0 && h < count; h++) {
+			if (cache_entry_ldap_filter_match(pending[h]->filters, dn, &entry)) {
+				char *copy = ber_strdup(dn);
+				if (copy == NULL)
+					abort();  // FIXME
+				dn_buckets_add(buckets, copy);
+				break;
+			}
+		}
+		cache_free_entry(&dn, &entry);
+	}
+	cache_free_cursor(id2entry_read_cursor_p, id2dn_read_cursor_p);
+
+	return rv == MDB_NOTFOUND ? LDAP_SUCCESS : LDAP_OTHER;
+}
+
+/* objects of the modules being initialized, which are passed to them at once */
+struct init_batch {
+	Handler **pending;
+	int pending_count;
+	int depth; /* of the batched objects */
+	int count;
+	int size;
+	char **dns;
+	CacheEntry *entries;
+	CacheEntry *old; /* all empty */
+	size_t bytes;    /* of the values of `entries`, see memory_account() */
+};
+
+/* Progress of the initialization of modules, to resume it after a restart
+   with the DNs following the last one handled: the depth on the first line,
+   the names of the modules on the second one and the DN on the third. */
+struct init_checkpoint {
+	int depth;
+	char *dn;
+};
+
+static void init_checkpoint_save(Handler **pending, int count, int depth, const char *dn) {
+	char *value, *pos;
+	size_t size = 32 + strlen(dn);
+	int i;
+
+	for (i = 0; i < count; i++)
+		size += strlen(pending[i]->name) + 1;
+	if ((value = pos = malloc(size)) == NULL)
+		abort();  // FIXME
+	pos += sprintf(pos, "%d\n", depth);
+	for (i = 0; i < count; i++)
+		pos += sprintf(pos, "%s%s", i ? " " : "", pending[i]->name);
+	sprintf(pos, "\n%s\n", dn);
+	if (cache_set_string(INIT_CHECKPOINT, value) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "failed to write initialization checkpoint");
+	free(value);
+}
+
+/* Read the checkpoint, if it is for exactly the modules to initialize. */
+static bool init_checkpoint_load(struct init_checkpoint *checkpoint, Handler **pending, int count) {
+	char *value, *modules, *dn, *end, *name, *save;
+	bool rv = false;
+	int i, found = 0;
+
+	if (cache_get_string(INIT_CHECKPOINT, &value) != 0)
+		return false;
+	if ((modules = strchr(value, '\n')) == NULL || (dn = strchr(++modules, '\n')) == NULL || (end = strchr(++dn, '\n')) == NULL)
+		goto out;
+	dn[-1] = *end = '\0';
+	checkpoint->depth = strtol(value, NULL, 10);
+	for (name = strtok_r(modules, " ", &save); name != NULL; name = strtok_r(NULL, " ", &save), found++) {
+		for (i = 0; i < count && strcmp(pending[i]->name, name); i++)
+			;
+		if (i == count)
+			goto out;
+	}
+	if (found != count || checkpoint->depth < 0 || *dn == '\0')
+		goto out;
+	checkpoint->dn = strdup(dn);
+	rv = checkpoint->dn != NULL;
+out:
+	if (!rv) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "ignoring initialization checkpoint for other modules");
+		checkpoint->depth = -1;
+		cache_set_string(INIT_CHECKPOINT, NULL);
+	}
+	free(value);
+	return rv;
+}
+
+/* run the handlers for the batched objects and store them in the cache */
+static void init_batch_flush(struct init_batch *batch) {
 	int i;
-	bool abort_init = false;
+
+	if (batch->count == 0)
+		return;
+	signals_block();
+	for (i = 0; i < batch->pending_count; i++)
+		handler_update_batch(batch->pending[i], batch->count, batch->dns, batch->entries, batch->old, 'n');
+	for (i = 0; i < batch->count; i++)
+		cache_update_entry_lower(0, batch->dns[i], &batch->entries[i]);
+	init_checkpoint_save(batch->pending, batch->pending_count, batch->depth, batch->dns[batch->count - 1]);
+	signals_unblock();
+	for (i = 0; i < batch->count; i++)
+		cache_free_entry(NULL, &batch->entries[i]);
+	batch->count = 0;
+	memory_account(MEMORY_ENTRIES, -(long)batch->bytes);
+	batch->bytes = 0;
+	handlers_gc();
+}
+
+/* drop the batched objects without running the handler */
+static void init_batch_discard(struct init_batch *batch) {
+	int i;
+
+	for (i = 0; i < batch->count; i++)
+		cache_free_entry(NULL, &batch->entries[i]);
+	batch->count = 0;
+	memory_account(MEMORY_ENTRIES, -(long)batch->bytes);
+	batch->bytes = 0;
+}
+
+/* the memory held by the values of an entry, roughly */
+static size_t entry_bytes(const CacheEntry *entry) {
+	size_t bytes = 0;
+	int i, j;
+
+	for (i = 0; i < entry->attribute_count; i++) {
+		for (j = 0; j < entry->attributes[i]->value_count; j++)
+			bytes += entry->attributes[i]->length[j];
+	}
+	return bytes;
+}
+
+/* Get the entries for the DNs from the cache, or else from LDAP. The searches
+   for all missing entries are started at once, and their results collected
+   in order afterwards, so there's only one round-trip for all of them. */
+static int init_fetch_entries(univention_ldap_parameters_t *lp, char **dns, int count, CacheEntry *entries) {
+	char **attrs = handlers_projection();
+	int attrsonly0 = 0;
+	LDAPControl **serverctrls = NULL;
+	LDAPControl **clientctrls = NULL;
+	struct timeval timeout = {
+	    .tv_sec = ldap_timeout_scans(), .tv_usec = 0,
+	};
+	int sizelimit0 = 0;
+	int msgids[INIT_FETCH_MAX]; /* -1: in the cache, -2: not started */
+	unsigned long reconnects = ldap_reconnects;
+	int i, rv = LDAP_SUCCESS;
+
+	for (i = 0; i < count; i++)
+		msgids[i] = -1;
+	for (i = 0; i < count; i++) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "DN: %s", dns[i]);
+		if ((rv = cache_get_entry_lower_upper(dns[i], &entries[i])) == 0)
+			continue;
+		memset(&entries[i], 0, sizeof(CacheEntry));
+		if (rv != MDB_NOTFOUND) { /* XXX */
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "error while reading from database");
+			for (i++; i < count; i++)
+				memset(&entries[i], 0, sizeof(CacheEntry));
+			i = -1;
+			rv = LDAP_OTHER;
+			goto out;
+		}
+		if (lp->ld == NULL || ldap_search_ext(lp->ld, dns[i], LDAP_SCOPE_BASE, "(objectClass=*)", attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &msgids[i]) != LDAP_SUCCESS)
+			msgids[i] = -2;
+	}
+	rv = LDAP_SUCCESS;
+
+	for (i = 0; i < count; i++) {
+		LDAPMessage *res = NULL;
+		int type = -1;
+
+		if (msgids[i] == -1)
+			continue;
+		if (msgids[i] >= 0 && reconnects == ldap_reconnects)
+			type = ldap_result(lp->ld, msgids[i], LDAP_MSG_ALL, &timeout, &res);
+		if (type != LDAP_RES_SEARCH_RESULT || ldap_parse_result(lp->ld, res, &rv, NULL, NULL, NULL, NULL, 0) != LDAP_SUCCESS) {
+			/* connection problems are handled by the synchronous search */
+			if (type == 0)
+				ldap_abandon_ext(lp->ld, msgids[i], NULL, NULL);
+			if (res != NULL)
+				ldap_msgfree(res);
+			rv = LDAP_RETRY(lp, ldap_search_ext_s(lp->ld, dns[i], LDAP_SCOPE_BASE, "(objectClass=*)", attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res));
+		}
+		if (rv == LDAP_SUCCESS) {
+			cache_new_entry_from_ldap(NULL, &entries[i], lp->ld, ldap_first_entry(lp->ld, res));
+		} else if (rv != LDAP_NO_SUCH_OBJECT) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not get DN %s for initializing modules: %s", dns[i], ldap_err2string(rv));
+			ldap_msgfree(res);
+			goto out;
+		}
+		/* Ignore LDAP_NO_SUCH_OBJECT. An object can be
+		   deleted after we do the ldapsearch. We
+		   shouldn't need to care here. */
+		rv = LDAP_SUCCESS;
+		ldap_msgfree(res);
+	}
+	return rv;
+
+out:
+	/* abandon the searches not collected yet */
+	for (i++; i < count; i++) {
+		if (msgids[i] >= 0 && reconnects == ldap_reconnects)
+			ldap_abandon_ext(lp->ld, msgids[i], NULL, NULL);
+	}
+	for (i = 0; i < count; i++)
+		cache_free_entry(NULL, &entries[i]);
+	return rv;
+}
+
+/* prepare module for initialization */
+static int init_prepare_module(Handler *handler) {
+	CacheEntry cache_entry, old_cache_entry;
+	int i, rv;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "initializing module %s", handler->name);
 
@@ -91,20 +457,11 @@ static int change_init_module(univention_ldap_parameters_t *lp, Handler *handler
 
 	/* remove old entries for module */
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "remove old entries for module %s", handler->name);
-	for (rv = cache_first_entry(&id2entry_cursor_p, &id2dn_cursor_p, &dn, &cache_entry); rv != MDB_NOTFOUND; rv = cache_next_entry(&id2entry_cursor_p, &id2dn_cursor_p, &dn, &cache_entry)) {
-		if (rv == -1)
-			continue;
-		if (rv < 0)
-			break;
-
-		cache_entry_module_remove(&cache_entry, handler->name);
-		cache_update_or_deleteifunused_entry(0, dn, &cache_entry, &id2dn_cursor_p);
-		cache_free_entry(&dn, &cache_entry);
+	if ((rv = cache_remove_module(handler->name, &i)) != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "removing old entries for module %s failed", handler->name);
+		return LDAP_OTHER;
 	}
 
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "call cache_free_cursor for module %s", handler->name);
-	cache_free_cursor(id2entry_cursor_p, id2dn_cursor_p);
-
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "initialize schema for module %s", handler->name);
 	/* initialize schema; if it's not in cache yet (it really should be), it'll
 	   be initialized on the regular schema check after ldapsearches */
@@ -118,125 +475,153 @@ static int change_init_module(univention_ldap_parameters_t *lp, Handler *handler
 		signals_unblock();
 		cache_free_entry(NULL, &cache_entry);
 	}
+	cache_free_entry(NULL, &old_cache_entry);
 
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "module %s for relating objects", handler->name);
-	rv = LDAP_SUCCESS;
-	for (f = handler->filters; !abort_init && f != NULL && *f != NULL; f++) {
-		/* When initializing a module, only search for the DNs. If the
-		   entry for a DN is already in our cache, we use that one,
-		   instead of fetching it from LDAP. It's not only faster, but
-		   more importantly we don't need to care about running all
-		   other handlers that use the entry since it might have changed.
-		   It's not a problem that a newer entry is possibly available;
-		   we'll update it later anyway */
-		char *_attrs[] = {LDAP_NO_ATTRS, NULL};
-		int attrsonly1 = 1;
-		LDAPControl **serverctrls = NULL;
-		LDAPControl **clientctrls = NULL;
-		struct timeval timeout = {
-		    .tv_sec = ldap_timeout_scans(), .tv_usec = 0,
-		};
-		int sizelimit0 = 0;
-		rv = LDAP_RETRY(lp, ldap_search_ext_s(lp->ld, (*f)->base, (*f)->scope, (*f)->filter, _attrs, attrsonly1, serverctrls, clientctrls, &timeout, sizelimit0, &res));
-		if (rv != LDAP_SUCCESS) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not get DNs when initializing %s: %s", handler->name, ldap_err2string(rv));
-			return rv;
-		}
-
-		long dn_count = 0;
-		struct dn_list *dns;
-
-		dn_count = ldap_count_entries(lp->ld, res);
-		if (dn_count <= 0) {
-			ldap_msgfree(res);
-			continue;
-		}
+	return LDAP_SUCCESS;
+}
 
-		if (!(dns = malloc(dn_count * sizeof(struct dn_list)))) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc failed");
-			abort();  // FIXME
+/* Initialize modules. The objects matching the filters of any of them are
+   searched once and passed to every module, which only handles those
+   matching its own filters, so initializing several modules takes only one
+   pass over the directory and the cache. */
+static int change_init_modules(univention_ldap_parameters_t *lp, Handler **pending, int count) {
+	struct filter **f;
+	struct init_batch batch = {.pending = pending, .pending_count = count};
+	struct dn_buckets dns = {};
+	struct init_checkpoint checkpoint = {.depth = -1};
+	int depth, h, i, n;
+	int rv = LDAP_SUCCESS;
+
+	if (init_checkpoint_load(&checkpoint, pending, count)) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "resuming initialization of modules after %s", checkpoint.dn);
+	} else {
+		for (h = 0; h < count; h++) {
+			if ((rv = init_prepare_module(pending[h])) != LDAP_SUCCESS)
+				return rv;
 		}
+	}
 
-		i = 0;
-		for (cur = ldap_first_entry(lp->ld, res); cur != NULL; cur = ldap_next_entry(lp->ld, cur)) {
-			dns[i].dn = ldap_get_dn(lp->ld, cur);
-			dns[i].size = strlen(dns[i].dn);
-			i += 1;
-		}
-		ldap_msgfree(res);
+	batch.size = tunables_get()->init_batch;
+	if ((batch.dns = malloc(batch.size * sizeof(char *))) == NULL || (batch.entries = malloc(batch.size * sizeof(CacheEntry))) == NULL || (batch.old = calloc(batch.size, sizeof(CacheEntry))) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc failed");
+		abort();  // FIXME
+	}
 
-		if (dn_count > 1) {
-			qsort(dns, dn_count, sizeof(struct dn_list), &dn_size_compare);
+	/* When initializing a module, only search for the DNs. If the
+	   entry for a DN is already in our cache, we use that one,
+	   instead of fetching it from LDAP. It's not only faster, but
+	   more importantly we don't need to care about running all
+	   other handlers that use the entry since it might have changed.
+	   It's not a problem that a newer entry is possibly available;
+	   we'll update it later anyway */
+	if (init_from_cache) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "searching the cache for objects relating to the modules");
+		if ((rv = init_cache_dns(pending, count, &dns)) != LDAP_SUCCESS)
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not get DNs from the cache");
+	} else {
+		for (h = 0; rv == LDAP_SUCCESS && h < count; h++) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "module %s for relating objects", pending[h]->name);
+			for (f = pending[h]->filters; f != NULL && *f != NULL; f++) {
+				if ((rv = init_search_dns(lp, *f, &dns)) != LDAP_SUCCESS) {
+					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not get DNs when initializing %s: %s", pending[h]->name, ldap_err2string(rv));
+					break;
+				}
+			}
 		}
+	}
+	if (rv == LDAP_SUCCESS)
+		dn_buckets_sort(&dns);
 
-		if ((rv = change_update_schema(lp)) != LDAP_SUCCESS) {
-			abort_init = true;
-			goto cleanup;
-		}
+	if (rv == LDAP_SUCCESS && dns.count > 0) {
+		change_schema_expire();
+		rv = change_update_schema(lp);
+	}
 
-		for (i = 0; i < dn_count; i++) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "DN: %s", dns[i].dn);
-
-			if ((rv = cache_get_entry_lower_upper(dns[i].dn, &cache_entry)) == MDB_NOTFOUND) { /* XXX */
-				LDAPMessage *res2, *first;
-				int attrsonly0 = 0;
-				rv = LDAP_RETRY(lp, ldap_search_ext_s(lp->ld, dns[i].dn, LDAP_SCOPE_BASE, "(objectClass=*)", attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res2));
-				if (rv == LDAP_SUCCESS) {
-					first = ldap_first_entry(lp->ld, res2);
-					cache_new_entry_from_ldap(NULL, &cache_entry, lp->ld, first);
-					ldap_msgfree(res2);
-				} else if (rv != LDAP_NO_SUCH_OBJECT) {
-					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not get DN %s for handler %s: %s", dns[i].dn, handler->name, ldap_err2string(rv));
-					cache_free_entry(NULL, &cache_entry);
-					abort_init = true;
-					goto cleanup;
-				}
-				/* Ignore LDAP_NO_SUCH_OBJECT. An object can be
-				   deleted after we do the ldapsearch. We
-				   shouldn't need to care here. */
-			} else if (rv != 0) {
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "error while reading from database");
-				rv = LDAP_OTHER;
-				abort_init = true;
-				goto cleanup;
-			}
+	for (depth = checkpoint.depth < 0 ? 0 : checkpoint.depth; rv == LDAP_SUCCESS && depth < dns.count; depth++) {
+		struct dn_bucket *bucket = &dns.buckets[depth];
 
-			signals_block();
-			handler_update(dns[i].dn, &cache_entry, &old_cache_entry, handler, 'n');
-			cache_update_entry_lower(0, dns[i].dn, &cache_entry);
-			signals_unblock();
-			cache_free_entry(NULL, &cache_entry);
+		i = 0;
+		if (depth == checkpoint.depth) {
+			while (i < bucket->count && strcmp(bucket->dns[i], checkpoint.dn) <= 0)
+				i++;
 		}
-	cleanup:
-		for (i = 0; i < dn_count; i++) {
-			ldap_memfree(dns[i].dn);
+		for (; i < bucket->count; i += n) {
+			/* fewer objects at once while the RSS exceeds listener/memory/budget */
+			int limit = memory_limit(batch.size);
+			size_t bytes = 0;
+
+			if (batch.count >= limit)
+				init_batch_flush(&batch);
+			n = limit - batch.count;
+			if (n > bucket->count - i)
+				n = bucket->count - i;
+			if (n > INIT_FETCH_MAX)
+				n = INIT_FETCH_MAX;
+			if ((rv = init_fetch_entries(lp, bucket->dns + i, n, batch.entries + batch.count)) != LDAP_SUCCESS)
+				break;
+			memcpy(batch.dns + batch.count, bucket->dns + i, n * sizeof(char *));
+			for (h = 0; h < n; h++)
+				bytes += entry_bytes(&batch.entries[batch.count + h]);
+			batch.bytes += bytes;
+			memory_account(MEMORY_ENTRIES, bytes);
+			batch.count += n;
+			batch.depth = depth;
+			if (batch.count >= limit)
+				init_batch_flush(&batch);
 		}
-		free(dns);
 	}
-	cache_free_entry(NULL, &old_cache_entry);
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "finished initializing module %s with rv=%d", handler->name, rv);
+	if (rv == LDAP_SUCCESS) {
+		init_batch_flush(&batch);
+		cache_set_string(INIT_CHECKPOINT, NULL);
+	}
+	init_batch_discard(&batch);
+	dn_buckets_free(&dns);
+	free(checkpoint.dn);
+	free(batch.old);
+	free(batch.entries);
+	free(batch.dns);
+	for (h = 0; h < count; h++)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "finished initializing module %s with rv=%d", pending[h]->name, rv);
 	return rv;
 }
 
+/* Initialize the modules from the objects in the cache instead of searching
+   them in LDAP, after the cache has been seeded from a snapshot of another
+   listener, see cache_seed(). */
+void change_init_from_cache(bool enable) {
+	init_from_cache = enable;
+}
+
 /* Check if there are modules not initialized yet, and initialize them. */
 int change_new_modules(univention_ldap_parameters_t *lp) {
-	Handler *handler;
+	Handler *handler, **pending = NULL;
 	int old_init_only = INIT_ONLY;
+	int count = 0, i;
+	bool success;
 
-	INIT_ONLY = 1;
 	for (handler = handlers; handler != NULL; handler = handler->next) {
 		if ((handler->state & HANDLER_READY) != HANDLER_READY) {
+			if ((pending = realloc(pending, (count + 1) * sizeof(Handler *))) == NULL)
+				abort();  // FIXME
+			pending[count++] = handler;
 			handler->state |= HANDLER_READY;
-
-			if (change_init_module(lp, handler) == LDAP_SUCCESS)
-				handler->state |= HANDLER_INITIALIZED;
-			else
-				handler->state ^= HANDLER_READY;
-
-			handler_write_state(handler);
 		}
 	}
+	if (count == 0)
+		return 0;
+
+	INIT_ONLY = 1;
+	success = change_init_modules(lp, pending, count) == LDAP_SUCCESS;
+	for (i = 0; i < count; i++) {
+		if (success)
+			pending[i]->state |= HANDLER_INITIALIZED;
+		else
+			pending[i]->state ^= HANDLER_READY;
+
+		handler_write_state(pending[i]);
+	}
 	INIT_ONLY = old_init_only;
+	free(pending);
 
 	return 0;
 }
@@ -247,6 +632,7 @@ int change_new_modules(univention_ldap_parameters_t *lp) {
 int change_update_entry(univention_ldap_parameters_t *lp, NotifierID id, LDAPMessage *ldap_entry, char command) {
 	char *dn = NULL;
 	CacheEntry cache_entry, old_cache_entry;
+	double start;
 	int rv = 0;
 
 	memset(&cache_entry, 0, sizeof(CacheEntry));
@@ -262,9 +648,12 @@ int change_update_entry(univention_ldap_parameters_t *lp, NotifierID id, LDAPMes
 	} else {
 		signals_block();
 		handlers_update(dn, &cache_entry, &old_cache_entry, command);
+		start = metrics_monotonic();
 		if ((rv = cache_update_entry_lower(id, dn, &cache_entry)) != 0) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "error while writing to database");
 		}
+		metrics_observe(METRICS_CACHE, metrics_monotonic() - start);
+		policy_index_update(dn, &cache_entry, &old_cache_entry);
 		rv = 0;
 		signals_unblock();
 	}
@@ -288,7 +677,10 @@ static void change_delete(struct transaction *trans) {
 	if (cache_entry_valid(&trans->cur.cache)) {
 		if (rv != 0)
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "at least one delete handler failed");
+		double start = metrics_monotonic();
 		cache_delete_entry_lower_upper(trans->cur.notify.id, trans->cur.notify.dn);
+		metrics_observe(METRICS_CACHE, metrics_monotonic() - start);
+		policy_index_delete(trans->cur.notify.dn, &trans->cur.cache);
 		cache_free_entry(NULL, &trans->cur.cache);
 	} else {
 		if (rv != 0)
@@ -298,8 +690,147 @@ static void change_delete(struct transaction *trans) {
 	signals_unblock();
 }
 
+/* Remove several DNs deleted one after the other, e.g. a subtree, at once:
+ * their cache entries are read in one and removed in one transaction, and the
+ * modules defining handler_batch() are called once for all of them. Unlike
+ * change_update_dn() does not ask LDAP, as deleted objects are removed even
+ * if they still exist there. */
+int change_delete_batch(NotifierEntry *entries, int count) {
+	char **dns, **lower, **found;
+	NotifierID *ids;
+	CacheEntry *old;
+	int *results, i, n = 0, rv;
+	double start;
+
+	if ((dns = calloc(count, sizeof(char *))) == NULL || (lower = calloc(count, sizeof(char *))) == NULL || (found = calloc(count, sizeof(char *))) == NULL || (ids = calloc(count, sizeof(NotifierID))) == NULL ||
+	    (old = calloc(count, sizeof(CacheEntry))) == NULL || (results = calloc(count, sizeof(int))) == NULL)
+		abort();  // FIXME
+	for (i = 0; i < count; i++) {
+		dns[i] = entries[i].dn;
+		lower[i] = lower_utf8(entries[i].dn);
+		ids[i] = entries[i].id;
+	}
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "deleting %d objects from '%s' on", count, entries[0].dn);
+	if ((rv = cache_get_entries(lower, count, old, results)) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "error reading database for %s", entries[0].dn);
+		rv = LDAP_OTHER;
+		goto out;
+	}
+	for (i = 0; i < count; i++) {
+		if (results[i] == MDB_NOTFOUND && !(cache_master_entry.flags & CACHE_NORMALIZED) && strcmp(dns[i], lower[i]))
+			results[i] = cache_get_entry(dns[i], &old[i]);
+		if (results[i] == 0)
+			found[n++] = dns[i];
+		else
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "not in cache: %s", dns[i]);
+	}
+
+	signals_block();
+	if (handlers_delete_batch(count, dns, ids, old, 'd') != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "at least one delete handler failed");
+	start = metrics_monotonic();
+	if (n > 0 && cache_delete_entries(ids[count - 1], found, n) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "error while writing to database");
+	metrics_observe(METRICS_CACHE, metrics_monotonic() - start);
+	for (i = 0; i < count; i++) {
+		if (results[i] == 0)
+			policy_index_delete(dns[i], &old[i]);
+	}
+	signals_unblock();
+
+out:
+	for (i = 0; i < count; i++) {
+		cache_free_entry(NULL, &old[i]);
+		free(lower[i]);
+	}
+	free(results);
+	free(old);
+	free(ids);
+	free(found);
+	free(lower);
+	free(dns);
+	return rv;
+}
+
+/* Use the cached schema for matching the filters of the modules */
+static void change_load_schema(void) {
+	CacheEntry cache_entry;
+
+	if (cache_get_entry_lower_upper("cn=Subschema", &cache_entry) != 0)
+		return;
+	filter_set_schema(&cache_entry);
+	cache_free_entry(NULL, &cache_entry);
+}
+
+/* The notifier is only asked for the schema ID again after new transactions
+   were received: a schema change always precedes the transactions relying on
+   it, so the ID queried afterwards covers them. */
+static bool schema_expired = true;
+
+void change_schema_expire(void) {
+	schema_expired = true;
+}
+
+/* Count the values of @name in @a missing in @b. */
+static int schema_count_missing(CacheEntry *a, CacheEntry *b, char *name) {
+	CacheEntryAttribute *attr_a = cache_entry_find_attribute(a, name, strlen(name));
+	CacheEntryAttribute *attr_b = cache_entry_find_attribute(b, name, strlen(name));
+	char **sorted;
+	int i, lo, hi, mid, cmp, count = 0;
+
+	if (attr_a == NULL)
+		return 0;
+	if (attr_b == NULL)
+		return attr_a->value_count;
+	if ((sorted = malloc(attr_b->value_count * sizeof(char *) + 1)) == NULL)
+		abort();  // FIXME
+	memcpy(sorted, attr_b->values, attr_b->value_count * sizeof(char *));
+	qsort(sorted, attr_b->value_count, sizeof(char *), compare_strings);
+	for (i = 0; i < attr_a->value_count; i++) {
+		for (lo = 0, hi = attr_b->value_count, cmp = 1; lo < hi && cmp != 0;) {
+			mid = (lo + hi) / 2;
+			if ((cmp = strcmp(sorted[mid], attr_a->values[i])) < 0)
+				lo = mid + 1;
+			else if (cmp > 0)
+				hi = mid;
+		}
+		if (cmp != 0)
+			count++;
+	}
+	free(sorted);
+	return count;
+}
+
+/* Check if the definitions of the schema differ from the cached ones. */
+static bool schema_changed(univention_ldap_parameters_t *lp, LDAPMessage *ldap_entry) {
+	static char *definitions[] = {"attributeTypes", "objectClasses", "ldapSyntaxes", "matchingRules", "matchingRuleUse", "dITContentRules", NULL};
+	CacheEntry new_entry = {}, old_entry = {};
+	char **name;
+	int added = 0, removed = 0, rv;
+
+	if (cache_new_entry_from_ldap(NULL, &new_entry, lp->ld, ldap_entry) != 0)
+		return true;
+	if ((rv = cache_get_entry_lower_upper("cn=Subschema", &old_entry)) != 0) {
+		cache_free_entry(NULL, &new_entry);
+		return true;
+	}
+	for (name = definitions; *name != NULL; name++) {
+		int a = schema_count_missing(&new_entry, &old_entry, *name);
+		int r = schema_count_missing(&old_entry, &new_entry, *name);
+		if (a || r)
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "schema: %d %s added, %d removed", a, *name, r);
+		added += a;
+		removed += r;
+	}
+	cache_free_entry(NULL, &new_entry);
+	cache_free_entry(NULL, &old_entry);
+	return added > 0 || removed > 0;
+}
+
 /* Make sure schema is up-to-date */
 int change_update_schema(univention_ldap_parameters_t *lp) {
+	static bool schema_loaded;
 	NotifierID new_id = 0;
 	LDAPMessage *res, *cur;
 	char *attrs[] = {LDAP_ALL_USER_ATTRIBUTES, LDAP_ALL_OPERATIONAL_ATTRIBUTES, NULL};
@@ -313,6 +844,11 @@ int change_update_schema(univention_ldap_parameters_t *lp) {
 	int sizelimit0 = 0;
 	char *server_role;
 
+	if (!schema_loaded) {
+		change_load_schema();
+		schema_loaded = true;
+	}
+
 	server_role = univention_config_get_string("server/role");
 	if (server_role && !strcmp(server_role, "domaincontroller_master")) {
 		free(server_role);
@@ -321,10 +857,13 @@ int change_update_schema(univention_ldap_parameters_t *lp) {
 
 	free(server_role);
 
+	if (!schema_expired)
+		return LDAP_SUCCESS;
 	if ((NOTIFIER_RETRY(notifier_get_schema_id_s(NULL, &new_id))) != 0) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to get schema DN");
 		return LDAP_OTHER;
 	}
+	schema_expired = false;
 
 	if (new_id > cache_master_entry.schema_id) {
 		rv = LDAP_RETRY(lp, ldap_search_ext_s(lp->ld, "cn=Subschema", LDAP_SCOPE_BASE, "(objectClass=*)", attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res));
@@ -332,8 +871,13 @@ int change_update_schema(univention_ldap_parameters_t *lp) {
 			if ((cur = ldap_first_entry(lp->ld, res)) == NULL) {
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "got no entry for schema");
 				return LDAP_OTHER;
+			} else if (!schema_changed(lp, cur)) {
+				/* e.g. the ID only changed because the schema files were rewritten */
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "schema %ld has the same definitions", new_id);
 			} else {
 				rv = change_update_entry(lp, new_id, cur, 'n');
+				if (rv == LDAP_SUCCESS)
+					change_load_schema();
 			}
 			ldap_memfree(res);
 		} else {
@@ -501,15 +1045,19 @@ out:
 static void _free_transaction_op(struct transaction_op *op) {
 	ldap_memfree(op->ldap_dn);
 	op->ldap_dn = NULL;
-	free(op->uuid);
 	op->uuid = NULL;
 	cache_free_entry(NULL, &op->cache);
 }
 
+/* Release the operation; its arena keeps one block for the next transaction. */
 void change_free_transaction_op(struct transaction_op *op) {
+	struct arena arena = op->arena;
+
 	_free_transaction_op(op);
 	notifier_entry_free(&op->notify);
 	memset(op, 0, sizeof(struct transaction_op));
+	arena_reset(&arena);
+	op->arena = arena;
 }
 
 
@@ -534,16 +1082,60 @@ static bool same_rdn(LDAPRDN left, LDAPRDN right) {
 	return i == j;
 }
 
+/* The subtree last moved at once by process_move(). The transactions of the
+   entries below it still follow with their old DNs, so those are looked up at
+   their new DNs until another subtree is moved. */
+static char *moved_from, *moved_to;
+
+static void moved_subtree_set(const char *from, const char *to) {
+	free(moved_from);
+	free(moved_to);
+	moved_from = lower_utf8(from);
+	moved_to = lower_utf8(to);
+}
+
+static int moved_subtree_get_entry(const char *dn, CacheEntry *entry) {
+	char *lower, *moved;
+	size_t len, from_len, moved_len;
+	int rv = MDB_NOTFOUND;
+
+	if (moved_from == NULL)
+		return rv;
+	lower = lower_utf8(dn);
+	len = strlen(lower);
+	from_len = strlen(moved_from);
+	if (len > from_len + 1 && lower[len - from_len - 1] == ',' && !strcmp(lower + len - from_len, moved_from)) {
+		moved_len = len - from_len + strlen(moved_to) + 1;
+		if ((moved = malloc(moved_len)) == NULL)
+			abort();
+		snprintf(moved, moved_len, "%.*s%s", (int)(len - from_len), lower, moved_to);
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "'%s' was moved along to '%s'", dn, moved);
+		rv = cache_get_entry(moved, entry);
+		free(moved);
+	}
+	free(lower);
+	return rv;
+}
+
 static int process_move(struct transaction *trans) {
 	LDAPDN old_dn = NULL, new_dn = NULL;
 	CacheEntry dummy = {};
 	int rv;
+	bool moved;
 	bool final = same_dn(trans->cur.notify.dn, trans->cur.ldap_dn);
 	char *current_dn = final ? trans->cur.ldap_dn : trans->cur.notify.dn;
 
-	// 1. remove old cache entry
+	// 1. move the cache entry with everything below it or remove the old one
 	/* run handlers_delete and remove the entry from cache: Bug #26069, Bug #20605, Bug #34355 */
-	rv = cache_delete_entry_lower_upper(trans->prev.notify.id, trans->prev.notify.dn);
+	rv = cache_move_subtree(trans->cur.notify.id, trans->prev.notify.dn, current_dn, &trans->cur.cache);
+	if ((moved = rv == 0)) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "moved subtree '%s' to '%s'", trans->prev.notify.dn, current_dn);
+		moved_subtree_set(trans->prev.notify.dn, current_dn);
+		policy_index_move(trans->prev.notify.dn, current_dn);
+	} else {
+		rv = cache_delete_entry_lower_upper(trans->prev.notify.id, trans->prev.notify.dn);
+		policy_index_delete(trans->prev.notify.dn, &trans->prev.cache);
+	}
 
 	// 2. on rename update cache entry to reflect new RDN
 	rv = ldap_str2dn(trans->prev.notify.dn, &old_dn, 0);
@@ -571,6 +1163,8 @@ static int process_move(struct transaction *trans) {
 	if ((rv = cache_update_entry_lower(trans->cur.notify.id, current_dn, &trans->cur.cache)) != 0) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "error while writing to database");
 	}
+	if (!moved)
+		policy_index_update(current_dn, &trans->cur.cache, &dummy);
 
 	// 6. Check for final destination
 	if (final) {
@@ -584,6 +1178,22 @@ out:
 	return rv;
 }
 
+/* Take the time of the change from the entryCSN of the entry, which is more
+ * precise than the seconds of reqStart, but only belongs to this transaction
+ * if no later one changed the entry already. */
+static void change_written(struct transaction *trans) {
+	struct berval **vals;
+	double written;
+
+	vals = ldap_get_values_len(trans->lp->ld, trans->ldap, "entryCSN");
+	if (vals && vals[0]) {
+		written = metrics_parse_time(vals[0]->bv_val, vals[0]->bv_len);
+		if (written > 0 && (trans->cur.notify.written == 0 || (written >= trans->cur.notify.written && written < trans->cur.notify.written + 1)))
+			trans->cur.notify.written = written;
+	}
+	ldap_value_free_len(vals);
+}
+
 static int change_update_cache(struct transaction *trans) {
 	int rv;
 
@@ -625,8 +1235,12 @@ static int change_update_cache(struct transaction *trans) {
 		break;
 	case 'r':  // move_from
 		// delay this 'r' until the following 'a' to decide if this is really a move or a delete.
+		arena_free(&trans->prev.arena);
 		trans->prev = trans->cur;
+		if (trans->prev.cache.arena == &trans->cur.arena)
+			trans->prev.cache.arena = &trans->prev.arena;
 		memset(&trans->cur, 0, sizeof(struct transaction_op));
+		cache_entry_arena = &trans->cur.arena;
 		rv = 0;
 		break;
 	default:
@@ -641,12 +1255,124 @@ out:
 
 /* Update DN from LDAP; this is a higher level interface for
    change_update_entry  */
+/* Remove oldest prefetch and abandon its search, if still running on @ld. */
+static void change_prefetch_pop(LDAP *ld) {
+	struct prefetch *p = &prefetches[prefetch_head];
+
+	if (ld != NULL && p->ld == ld && p->reconnects == ldap_reconnects)
+		ldap_abandon_ext(ld, p->msgid, NULL, NULL);
+	free(p->base);
+	p->base = NULL;
+	prefetch_head = (prefetch_head + 1) % PREFETCH_MAX;
+	prefetch_count--;
+}
+
+
+/* Discard all prefetches, e.g. before closing the LDAP connection @ld. */
+void change_prefetch_clear(LDAP *ld) {
+	while (prefetch_count > 0)
+		change_prefetch_pop(ld);
+}
+
+
+/* Start LDAP search for a queued transaction in the background.
+ * The search is done like change_update_dn() would do it based on the current
+ * cache; if that differs when the transaction is processed, the result is
+ * discarded. Returns false if no more searches should be started now. */
+bool change_prefetch(struct transaction *trans, NotifierEntry *entry) {
+	char **attrs = handlers_projection();
+	struct timeval timeout = {
+	    .tv_sec = 5 * 60, .tv_usec = 0,
+	};
+	struct prefetch *p;
+	CacheEntry cache;
+	const char *uuid;
+	int rv;
+
+	if (entry->id <= prefetch_last)
+		return true;
+	if (prefetch_count >= memory_limit(tunables_get()->ldap_prefetch) || trans->lp->ld == NULL || entry->dn == NULL)
+		return false;
+
+	p = &prefetches[(prefetch_head + prefetch_count) % PREFETCH_MAX];
+	rv = cache_get_entry_lower_upper(entry->dn, &cache);
+	if (rv == 0 && (uuid = cache_entry_get1(&cache, "entryUUID")) != NULL) {
+		p->base = strdup(trans->lp->base);
+		p->scope = LDAP_SCOPE_SUBTREE;
+		snprintf(p->filter, sizeof(p->filter), "(entryUUID=%s)", uuid);
+	} else {
+		p->base = strdup(entry->dn);
+		p->scope = LDAP_SCOPE_BASE;
+		snprintf(p->filter, sizeof(p->filter), "(objectClass=*)");
+	}
+	if (rv == 0)
+		cache_free_entry(NULL, &cache);
+	if (p->base == NULL)
+		return false;
+
+	rv = ldap_search_ext(trans->lp->ld, p->base, p->scope, p->filter, attrs, 0, NULL, NULL, &timeout, 0, &p->msgid);
+	if (rv != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "prefetching %ld failed: %s", entry->id, ldap_err2string(rv));
+		free(p->base);
+		p->base = NULL;
+		return false;
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "prefetching %ld '%s' msgid %d", entry->id, p->base, p->msgid);
+	p->id = entry->id;
+	p->ld = trans->lp->ld;
+	p->reconnects = ldap_reconnects;
+	prefetch_last = entry->id;
+	prefetch_count++;
+	return true;
+}
+
+
+/* Return result of prefetched search for current transaction, if it was
+ * started on the current connection with the same parameters. */
+static bool change_prefetch_result(struct transaction *trans, const char *base, int scope, const char *filter, LDAPMessage **res, int *rv) {
+	struct timeval timeout = {
+	    .tv_sec = 5 * 60, .tv_usec = 0,
+	};
+
+	while (prefetch_count > 0) {
+		struct prefetch *p = &prefetches[prefetch_head];
+		int type;
+
+		if (p->id > trans->cur.notify.id)
+			break;
+		if (p->id < trans->cur.notify.id || p->ld != trans->lp->ld || p->reconnects != ldap_reconnects || p->scope != scope || strcmp(p->base, base) || strcmp(p->filter, filter)) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "discarding prefetch %ld", p->id);
+			change_prefetch_pop(trans->lp->ld);
+			continue;
+		}
+
+		*res = NULL;
+		type = ldap_result(p->ld, p->msgid, LDAP_MSG_ALL, &timeout, res);
+		if (type == LDAP_RES_SEARCH_RESULT && ldap_parse_result(p->ld, *res, rv, NULL, NULL, NULL, NULL, 0) == LDAP_SUCCESS) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "using prefetch %ld: %d", p->id, *rv);
+			change_prefetch_pop(NULL);
+			return true;
+		}
+
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "prefetch %ld failed: %d", p->id, type);
+		if (*res) {
+			ldap_msgfree(*res);
+			*res = NULL;
+		}
+		/* connection problems are handled by the synchronous search */
+		change_prefetch_pop(type == 0 ? trans->lp->ld : NULL);
+		break;
+	}
+	return false;
+}
+
+
 int change_update_dn(struct transaction *trans) {
 	LDAPMessage *res;
 	char *base;
 	int scope;
 	char filter[64]; /* "(entryUUID=XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX)" */
-	char *attrs[] = {LDAP_ALL_USER_ATTRIBUTES, LDAP_ALL_OPERATIONAL_ATTRIBUTES, NULL};
+	char **attrs = handlers_projection();
 	int attrsonly0 = 0;
 	LDAPControl **serverctrls = NULL;
 	LDAPControl **clientctrls = NULL;
@@ -656,13 +1382,20 @@ int change_update_dn(struct transaction *trans) {
 	int sizelimit0 = 0;
 	int rv;
 	const char *uuid = NULL;
+	double start;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "updating '%s' command %c", trans->cur.notify.dn, trans->cur.notify.command);
 
+	/* all entries of this transaction are released at once with trans->cur */
+	cache_entry_arena = &trans->cur.arena;
+	lane_set_id(trans->cur.notify.id);
 	rv = cache_get_entry_lower_upper(trans->cur.notify.dn, &trans->cur.cache);
+	if (rv == MDB_NOTFOUND && trans->cur.notify.command == 'r')
+		rv = moved_subtree_get_entry(trans->cur.notify.dn, &trans->cur.cache);
 	if (rv != 0 && rv != MDB_NOTFOUND) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "error reading database for %s", trans->cur.notify.dn);
-		return LDAP_OTHER;
+		rv = LDAP_OTHER;
+		goto out;
 	}
 	switch (trans->prev.notify.command) {
 	case '\0':  // no previous pending command
@@ -697,7 +1430,7 @@ int change_update_dn(struct transaction *trans) {
 		base = trans->lp->base;
 		scope = LDAP_SCOPE_SUBTREE;
 		snprintf(filter, sizeof(filter), "(entryUUID=%s)", uuid);
-		trans->cur.uuid = strdup(uuid);
+		trans->cur.uuid = arena_strdup(&trans->cur.arena, uuid);
 	} else {
 	retry_dn:
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "updating by DN %s", trans->cur.notify.dn);
@@ -707,7 +1440,12 @@ int change_update_dn(struct transaction *trans) {
 	}
 
 	bool delete = false;
-	rv = LDAP_RETRY(trans->lp, ldap_search_ext_s(trans->lp->ld, base, scope, filter, attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res));
+	start = metrics_monotonic();
+	PROBE2(ldap_fetch_start, trans->cur.notify.id, base);
+	if (!change_prefetch_result(trans, base, scope, filter, &res, &rv))
+		rv = LDAP_RETRY(trans->lp, ldap_search_ext_s(trans->lp->ld, base, scope, filter, attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res));
+	PROBE2(ldap_fetch_end, trans->cur.notify.id, rv);
+	metrics_observe(METRICS_LDAP, metrics_monotonic() - start);
 	if (rv == LDAP_NO_SUCH_OBJECT) {
 		delete = true;
 	} else if (rv == LDAP_SUCCESS) {
@@ -717,6 +1455,7 @@ int change_update_dn(struct transaction *trans) {
 			* non-existent for us */
 			delete = true;
 		} else {
+			change_written(trans);
 			rv = change_update_cache(trans);
 		}
 		trans->ldap = NULL;
@@ -735,5 +1474,6 @@ int change_update_dn(struct transaction *trans) {
 	}
 
 out:
+	cache_entry_arena = NULL;
 	return rv;
 }
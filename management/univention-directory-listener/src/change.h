@@ -36,6 +36,7 @@
 #ifndef _CHANGE_H_
 #define _CHANGE_H_
 
+#include <stdbool.h>
 #include <ldap.h>
 #include <univention/ldap.h>
 
@@ -43,8 +44,13 @@
 
 int change_new_modules(univention_ldap_parameters_t *lp);
 int change_update_schema(univention_ldap_parameters_t *lp);
+void change_schema_expire(void);
+void change_init_from_cache(bool enable);
 int change_update_entry(univention_ldap_parameters_t *lp, NotifierID id, LDAPMessage *ldap_entry, char command);
+extern bool change_prefetch(struct transaction *, NotifierEntry *);
+extern void change_prefetch_clear(LDAP *);
 extern int change_update_dn(struct transaction *);
+extern int change_delete_batch(NotifierEntry *entries, int count);
 extern void change_free_transaction_op(struct transaction_op *);
 
 #endif /* _CHANGE_H_ */
@@ -35,8 +35,11 @@
  */
 
 #include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <dirent.h>
@@ -47,9 +50,21 @@
 
 #include "cache.h"
 #include "common.h"
+#include "base64.h"
 
 int INIT_ONLY = 0;
 
+/* size of the output buffer */
+#define DUMP_BUFSIZ (1 << 20)
+
+/* how entries are written, see dump_entry() */
+static struct {
+	bool json;
+	bool dn_only;
+	char **attributes; /* only these attributes, or all if NULL */
+	int attribute_count;
+} output;
+
 
 static void usage(void) {
 	fprintf(stderr, "Usage: univention-directory-listener-dump [options]\n");
@@ -59,19 +74,294 @@ static void usage(void) {
 	fprintf(stderr, "   -r   print broken entries only (as far as that's possible)\n");
 	fprintf(stderr, "   -O   dump cache to file (default is stdout)\n");
 	fprintf(stderr, "   -i   ID only\n");
+	fprintf(stderr, "   -u   convert all entries to the current on-disk format\n");
+	fprintf(stderr, "   -m   dump only entries registered with the given module\n");
+	fprintf(stderr, "   -b   dump only entries below or at the given DN\n");
+	fprintf(stderr, "   -j   number of threads reading the cache, in no particular order\n");
+	fprintf(stderr, "   -z   compact the database file\n");
+	fprintf(stderr, "   -f   output format: ldif (default) or json, one object per line\n");
+	fprintf(stderr, "   -a   dump only the given comma-separated attributes\n");
+	fprintf(stderr, "   -n   dump only the DNs\n");
+	fprintf(stderr, "   -s   write a snapshot of the database to the given empty directory, see univention-directory-listener -S\n");
+}
+
+static bool valid_utf8(const unsigned char *s, size_t len) {
+	size_t i = 0;
+	int n;
+
+	while (i < len) {
+		if (s[i] == 0)
+			return false;
+		if (s[i] < 0x80)
+			n = 0;
+		else if (s[i] >= 0xc2 && s[i] <= 0xdf)
+			n = 1;
+		else if ((s[i] & 0xf0) == 0xe0)
+			n = 2;
+		else if (s[i] >= 0xf0 && s[i] <= 0xf4)
+			n = 3;
+		else
+			return false;
+		if (i + n >= len)
+			return false;
+		for (i++; n > 0; n--, i++) {
+			if ((s[i] & 0xc0) != 0x80)
+				return false;
+		}
+	}
+	return true;
+}
+
+
+static void json_string(const char *s, size_t len, FILE *fp) {
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
+
+	putc_unlocked('"', fp);
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+
+		if (c == '"' || c == '\\') {
+			putc_unlocked('\\', fp);
+			putc_unlocked(c, fp);
+		} else if (c < 0x20) {
+			fputs("\\u00", fp);
+			putc_unlocked(hex[c >> 4], fp);
+			putc_unlocked(hex[c & 0xf], fp);
+		} else {
+			putc_unlocked(c, fp);
+		}
+	}
+	putc_unlocked('"', fp);
+}
+
+
+/* Write the values of all attributes which are (not) valid UTF-8 as a JSON object. */
+static void json_attributes(CacheEntry *entry, bool binary, FILE *fp) {
+	int i, j, count = 0;
+
+	putc_unlocked('{', fp);
+	for (i = 0; i < entry->attribute_count; i++) {
+		CacheEntryAttribute *attribute = entry->attributes[i];
+		int values = 0;
+
+		for (j = 0; j < attribute->value_count; j++) {
+			size_t len = attribute->length[j] ? attribute->length[j] - 1 : 0;
+
+			if (valid_utf8((unsigned char *)attribute->values[j], len) == binary)
+				continue;
+			if (values++ == 0) {
+				if (count++ > 0)
+					putc_unlocked(',', fp);
+				json_string(attribute->name, strlen(attribute->name), fp);
+				fputs(":[", fp);
+			} else {
+				putc_unlocked(',', fp);
+			}
+			if (binary) {
+				char *base64_value = malloc(BASE64_ENCODE_LEN(len) + 1);
+
+				if (base64_value == NULL)
+					abort();  // FIXME
+				base64_encode((u_char *)attribute->values[j], len, base64_value, BASE64_ENCODE_LEN(len) + 1);
+				json_string(base64_value, strlen(base64_value), fp);
+				free(base64_value);
+			} else {
+				json_string(attribute->values[j], len, fp);
+			}
+		}
+		if (values > 0)
+			putc_unlocked(']', fp);
+	}
+	putc_unlocked('}', fp);
+}
+
+
+/* Write the entry as one line of JSON:
+   {"dn": ..., "attributes": {name: [value, ...]}, "base64": {name: [base64 value, ...]}, "modules": [...]}
+   Values, which are not valid UTF-8, are only given base64 encoded. */
+static void dump_entry_json(char *dn, CacheEntry *entry, FILE *fp) {
+	int i;
+
+	fputs("{\"dn\":", fp);
+	json_string(dn, strlen(dn), fp);
+	if (!output.dn_only) {
+		fputs(",\"attributes\":", fp);
+		json_attributes(entry, false, fp);
+		fputs(",\"base64\":", fp);
+		json_attributes(entry, true, fp);
+		fputs(",\"modules\":[", fp);
+		for (i = 0; i < entry->module_count; i++) {
+			if (i > 0)
+				putc_unlocked(',', fp);
+			json_string(entry->modules[i], strlen(entry->modules[i]), fp);
+		}
+		putc_unlocked(']', fp);
+	}
+	fputs("}\n", fp);
+}
+
+
+/* Write the entry in the selected format, limited to the selected attributes. */
+static void dump_entry(char *dn, CacheEntry *entry, FILE *fp) {
+	CacheEntryAttribute **attributes = NULL;
+	CacheEntry projected;
+	int i, j;
+
+	if (output.attributes != NULL) {
+		/* shallow copy referring to the attributes of the entry */
+		if ((attributes = malloc((entry->attribute_count + 1) * sizeof(CacheEntryAttribute *))) == NULL)
+			abort();  // FIXME
+		projected = *entry;
+		projected.attributes = attributes;
+		projected.attribute_count = 0;
+		for (i = 0; i < entry->attribute_count; i++) {
+			for (j = 0; j < output.attribute_count; j++) {
+				if (strcasecmp(entry->attributes[i]->name, output.attributes[j]) == 0) {
+					attributes[projected.attribute_count++] = entry->attributes[i];
+					break;
+				}
+			}
+		}
+		attributes[projected.attribute_count] = NULL;
+		entry = &projected;
+	}
+
+	if (output.json) {
+		dump_entry_json(dn, entry, fp);
+	} else if (output.dn_only) {
+		fprintf(fp, "dn: %s\n\n", dn);
+	} else {
+		cache_dump_entry(dn, entry, fp);
+		fprintf(fp, "\n");
+	}
+	free(attributes);
+}
+
+
+static void parse_attributes(char *list) {
+	char *attribute, *save = NULL;
+
+	for (attribute = strtok_r(list, ",", &save); attribute != NULL; attribute = strtok_r(NULL, ",", &save)) {
+		if ((output.attributes = realloc(output.attributes, (output.attribute_count + 1) * sizeof(char *))) == NULL)
+			abort();  // FIXME
+		output.attributes[output.attribute_count++] = attribute;
+	}
+}
+
+
+/* entries dumped by one thread, see dump_part() */
+struct dump_job {
+	pthread_t thread;
+	CacheIterOptions options;
+	FILE *fp;
+	bool broken_only;
+	int rv;
+};
+
+/* serializes writing the chunks of several threads */
+static pthread_mutex_t output_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Write the chunk of whole entries buffered by a thread to the shared output. */
+static void flush_chunk(FILE **chunk, char **buf, size_t *size, FILE *fp) {
+	fclose(*chunk);
+	*chunk = NULL;
+	pthread_mutex_lock(&output_lock);
+	fwrite(*buf, 1, *size, fp);
+	pthread_mutex_unlock(&output_lock);
+	free(*buf);
+	*buf = NULL;
+	*size = 0;
+}
+
+
+/* Dump the entries of a part of the cache. Several threads buffer them in
+   chunks, so the entries of different threads are not interleaved. */
+static int dump_part(const CacheIterOptions *options, FILE *fp, bool broken_only, bool shared) {
+	CacheIter iter;
+	CacheEntry entry;
+	FILE *chunk = NULL, *out = fp;
+	char *dn = NULL, *buf = NULL;
+	size_t size = 0;
+	int rv;
+
+	if ((rv = cache_iter_begin(&iter, options)) != 0)
+		return rv == MDB_NOTFOUND ? 0 : rv;
+	for (;;) {
+		if (shared && chunk == NULL && (out = chunk = open_memstream(&buf, &size)) == NULL)
+			abort();  // FIXME
+		rv = cache_iter_next(&iter, NULL, &dn, &entry);
+		if (rv == MDB_NOTFOUND) {
+			rv = 0;
+			break;
+		}
+		if ((rv == 0 && !broken_only) || (rv == -1 && broken_only))
+			dump_entry(dn, &entry, out);
+		cache_free_entry(NULL, &entry);
+		if (rv < -1)
+			break;
+		if (chunk && ftell(chunk) >= DUMP_BUFSIZ)
+			flush_chunk(&chunk, &buf, &size, fp);
+	}
+	if (chunk)
+		flush_chunk(&chunk, &buf, &size, fp);
+	free(dn);
+	cache_iter_end(&iter);
+
+	return rv < -1 ? rv : 0;
+}
+
+
+static void *dump_worker(void *arg) {
+	struct dump_job *job = arg;
+
+	job->rv = dump_part(&job->options, job->fp, job->broken_only, true);
+	return NULL;
+}
+
+
+/* Dump the cache with a thread for each of `count` ranges of DNIDs. */
+static int dump_parallel(const CacheIterOptions *options, FILE *fp, bool broken_only, int count) {
+	struct dump_job *jobs;
+	DNID first, last, step;
+	int i, rv;
+
+	if ((rv = cache_get_dnid_range(&first, &last)) != 0)
+		return rv;
+	if ((jobs = calloc(count, sizeof(struct dump_job))) == NULL)
+		abort();  // FIXME
+	step = (last - first + count - 1) / count;
+	for (i = 0; i < count; i++) {
+		jobs[i].options = *options;
+		jobs[i].options.first = first + i * step;
+		jobs[i].options.last = i == count - 1 ? last : first + (i + 1) * step;
+		jobs[i].fp = fp;
+		jobs[i].broken_only = broken_only;
+		if (pthread_create(&jobs[i].thread, NULL, dump_worker, &jobs[i]) != 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Couldn't start thread");
+			abort();
+		}
+	}
+	for (i = 0; i < count; i++) {
+		pthread_join(jobs[i].thread, NULL);
+		if (jobs[i].rv != 0)
+			rv = jobs[i].rv;
+	}
+	free(jobs);
+
+	return rv;
 }
 
 
 int main(int argc, char *argv[]) {
 	int debugging = 0, broken_only = 0;
-	int id_only = 0;
-	char *output_file = NULL;
+	int id_only = 0, upgrade = 0, compact = 0;
+	char *output_file = NULL, *module = NULL, *snapshot_dir = NULL;
 	FILE *fp;
 	int rv;
-	MDB_cursor *id2entry_read_cursor_p = NULL;
-	MDB_cursor *id2dn_read_cursor_p = NULL;
-	char *dn = NULL;
-	CacheEntry entry;
+	int threads = 1;
+	CacheIterOptions options = {};
 	char cache_mdb_dir[PATH_MAX];
 
 	univention_debug_init("stderr", 1, 1);
@@ -80,7 +370,7 @@ int main(int argc, char *argv[]) {
 	for (;;) {
 		int c;
 
-		c = getopt(argc, argv, "d:c:O:ri");
+		c = getopt(argc, argv, "d:c:O:m:b:s:f:a:j:nriuz");
 		if (c < 0)
 			break;
 		switch (c) {
@@ -100,6 +390,38 @@ int main(int argc, char *argv[]) {
 		case 'i':
 			id_only = 1;
 			break;
+		case 'u':
+			upgrade = 1;
+			break;
+		case 'm':
+			module = strdup(optarg);
+			break;
+		case 'z':
+			compact = 1;
+			break;
+		case 's':
+			snapshot_dir = strdup(optarg);
+			break;
+		case 'f':
+			if (strcmp(optarg, "json") == 0) {
+				output.json = true;
+			} else if (strcmp(optarg, "ldif") != 0) {
+				usage();
+				exit(1);
+			}
+			break;
+		case 'a':
+			parse_attributes(strdup(optarg));
+			break;
+		case 'n':
+			output.dn_only = true;
+			break;
+		case 'b':
+			options.base = strdup(optarg);
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
 		default:
 			usage();
 			exit(1);
@@ -126,30 +448,60 @@ int main(int argc, char *argv[]) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Couldn't open dump file");
 		exit(1);
 	}
+	setvbuf(fp, NULL, _IOFBF, DUMP_BUFSIZ);
 	rv = snprintf(cache_mdb_dir, PATH_MAX, "%s/cache", cache_dir);
 	if (rv < 0 || rv >= PATH_MAX)
 		abort();
+	if (upgrade) {
+		int count;
+
+		/* exits if the listener is running */
+		cache_lock();
+		if (cache_init(cache_mdb_dir, 0) != 0)
+			exit(1);
+		rv = cache_upgrade_entries(&count);
+		cache_close();
+		if (rv != 0)
+			exit(1);
+		fprintf(fp, "%d entries converted\n", count);
+		return 0;
+	}
+	if (compact) {
+		/* exits if the listener is running */
+		cache_lock();
+		if (cache_init(cache_mdb_dir, 0) != 0)
+			exit(1);
+		rv = cache_compact();
+		cache_close();
+		return rv == 0 ? 0 : 1;
+	}
+
 	if (cache_init(cache_mdb_dir, MDB_RDONLY) != 0)
 		exit(1);
 
+	if (snapshot_dir) {
+		/* consistent with the notifier ID, even if the listener is running */
+		rv = cache_snapshot(snapshot_dir);
+		cache_close();
+		return rv == 0 ? 0 : 1;
+	}
+
+	rv = 0;
 	if (id_only) {
 		cache_get_master_entry(&cache_master_entry);
 
 		printf("%ld %ld\n", cache_master_entry.id, cache_master_entry.schema_id);
 	} else {
-		for (rv = cache_first_entry(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry); rv != MDB_NOTFOUND; rv = cache_next_entry(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry)) {
-			if ((rv == 0 && !broken_only) || (rv == -1 && broken_only)) {
-				cache_dump_entry(dn, &entry, fp);
-				fprintf(fp, "\n");
-			}
-			cache_free_entry(&dn, &entry);
-			if (rv < -1)
-				break;
-		}
-		cache_free_cursor(id2entry_read_cursor_p, id2dn_read_cursor_p);
+		options.module = module;
+		if (output.dn_only)
+			options.flags |= CACHE_ITER_NO_ENTRY;
+		if (threads > 1)
+			rv = dump_parallel(&options, fp, broken_only, threads);
+		else
+			rv = dump_part(&options, fp, broken_only, false);
 	}
 
 	cache_close();
 
-	return 0;
+	return rv == 0 ? 0 : 1;
 }
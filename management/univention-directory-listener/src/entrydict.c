@@ -0,0 +1,325 @@
+/*
+ * Univention Directory Listener
+ *  lazy Python mapping over cache entries
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Handlers receive the new and old entry as a mapping from attribute name to
+   a list of bytes values. Most handlers only look at a few attributes, so
+   instead of converting all of them upfront, EntryDict converts an attribute
+   on first access. Any modification converts the remaining attributes and
+   from then on everything is delegated to a plain dict. */
+
+#define PY_SSIZE_T_CLEAN
+#include <python3.11/Python.h>
+
+#include "cache_entry.h"
+#include "entrydict.h"
+
+typedef struct {
+	PyObject_HEAD
+	CacheEntry *entry; /* NULL once all attributes are in `dict` */
+	PyObject *shared;  /* name -> value list, shared by all handlers of one transaction */
+	PyObject *dict;    /* converted attributes owned by this mapping */
+} EntryDict;
+
+static PyTypeObject EntryDictType;
+
+/* return the shared value list of an attribute, converting it if needed */
+static PyObject *shared_values(EntryDict *self, PyObject *key, CacheEntryAttribute *attribute) {
+	PyObject *values, *value;
+	int i;
+
+	if ((values = PyDict_GetItemWithError(self->shared, key)) != NULL || PyErr_Occurred())
+		return values;
+
+	if ((values = PyList_New(attribute->value_count)) == NULL)
+		return NULL;
+	for (i = 0; i < attribute->value_count; i++) {
+		if ((value = PyBytes_FromStringAndSize(attribute->values[i], attribute->length[i] - 1)) == NULL) {
+			Py_DECREF(values);
+			return NULL;
+		}
+		PyList_SET_ITEM(values, i, value);
+	}
+	if (PyDict_SetItem(self->shared, key, values) != 0) {
+		Py_DECREF(values);
+		return NULL;
+	}
+	Py_DECREF(values);
+	return values;
+}
+
+/* copy an attribute into `dict`; returns a borrowed reference */
+static PyObject *load(EntryDict *self, PyObject *key, CacheEntryAttribute *attribute) {
+	PyObject *values, *copy;
+
+	if ((values = shared_values(self, key, attribute)) == NULL)
+		return NULL;
+	/* handlers may modify their lists, so each gets its own copy */
+	if ((copy = PyList_GetSlice(values, 0, PY_SSIZE_T_MAX)) == NULL)
+		return NULL;
+	if (PyDict_SetItem(self->dict, key, copy) != 0) {
+		Py_DECREF(copy);
+		return NULL;
+	}
+	Py_DECREF(copy);
+	return copy;
+}
+
+static CacheEntryAttribute *find(EntryDict *self, PyObject *key) {
+	const char *name;
+	Py_ssize_t len;
+
+	if (self->entry == NULL || !PyUnicode_Check(key))
+		return NULL;
+	if ((name = PyUnicode_AsUTF8AndSize(key, &len)) == NULL) {
+		PyErr_Clear();
+		return NULL;
+	}
+	return cache_entry_find_attribute(self->entry, name, len);
+}
+
+/* convert all remaining attributes and stop referencing the entry */
+static int materialize(EntryDict *self) {
+	PyObject *key;
+	int i, rv = 0;
+
+	for (i = 0; self->entry != NULL && i < self->entry->attribute_count; i++) {
+		if ((key = PyUnicode_FromString(self->entry->attributes[i]->name)) == NULL)
+			return -1;
+		if (!PyDict_Contains(self->dict, key) && load(self, key, self->entry->attributes[i]) == NULL)
+			rv = -1;
+		Py_DECREF(key);
+		if (rv != 0)
+			return rv;
+	}
+	self->entry = NULL;
+	Py_CLEAR(self->shared);
+	return 0;
+}
+
+PyObject *entrydict_new(CacheEntry *entry, PyObject *shared) {
+	EntryDict *self;
+
+	if ((self = PyObject_GC_New(EntryDict, &EntryDictType)) == NULL)
+		return NULL;
+	self->entry = entry != NULL && entry->attribute_count > 0 && shared != NULL ? entry : NULL;
+	self->shared = self->entry ? shared : NULL;
+	Py_XINCREF(self->shared);
+	if ((self->dict = PyDict_New()) == NULL) {
+		Py_DECREF(self);
+		return NULL;
+	}
+	PyObject_GC_Track(self);
+	return (PyObject *)self;
+}
+
+int entrydict_detach(PyObject *obj) {
+	/* nothing to do if the caller holds the only reference */
+	if (obj == NULL || !PyObject_TypeCheck(obj, &EntryDictType) || Py_REFCNT(obj) <= 1)
+		return 0;
+	return materialize((EntryDict *)obj);
+}
+
+static void entrydict_dealloc(EntryDict *self) {
+	PyObject_GC_UnTrack(self);
+	Py_XDECREF(self->shared);
+	Py_XDECREF(self->dict);
+	PyObject_GC_Del(self);
+}
+
+static int entrydict_traverse(EntryDict *self, visitproc visit, void *arg) {
+	Py_VISIT(self->shared);
+	Py_VISIT(self->dict);
+	return 0;
+}
+
+static int entrydict_clear(EntryDict *self) {
+	self->entry = NULL;
+	Py_CLEAR(self->shared);
+	Py_CLEAR(self->dict);
+	return 0;
+}
+
+static Py_ssize_t entrydict_length(EntryDict *self) {
+	return self->entry ? self->entry->attribute_count : PyDict_Size(self->dict);
+}
+
+static PyObject *entrydict_lookup(EntryDict *self, PyObject *key) {
+	CacheEntryAttribute *attribute;
+	PyObject *values;
+
+	if ((values = PyDict_GetItemWithError(self->dict, key)) != NULL || PyErr_Occurred())
+		return values;
+	if ((attribute = find(self, key)) == NULL)
+		return NULL;
+	return load(self, key, attribute);
+}
+
+static PyObject *entrydict_subscript(EntryDict *self, PyObject *key) {
+	PyObject *values = entrydict_lookup(self, key);
+
+	if (values == NULL) {
+		if (!PyErr_Occurred())
+			PyErr_SetObject(PyExc_KeyError, key);
+		return NULL;
+	}
+	Py_INCREF(values);
+	return values;
+}
+
+static int entrydict_ass_subscript(EntryDict *self, PyObject *key, PyObject *value) {
+	if (materialize(self) != 0)
+		return -1;
+	if (value == NULL)
+		return PyDict_DelItem(self->dict, key);
+	return PyDict_SetItem(self->dict, key, value);
+}
+
+static int entrydict_contains(EntryDict *self, PyObject *key) {
+	int rv = PyDict_Contains(self->dict, key);
+
+	if (rv != 0)
+		return rv;
+	return find(self, key) != NULL;
+}
+
+static PyObject *entrydict_iter(EntryDict *self) {
+	if (materialize(self) != 0)
+		return NULL;
+	return PyObject_GetIter(self->dict);
+}
+
+static PyObject *entrydict_repr(EntryDict *self) {
+	if (materialize(self) != 0)
+		return NULL;
+	return PyObject_Repr(self->dict);
+}
+
+static PyObject *entrydict_richcompare(EntryDict *self, PyObject *other, int op) {
+	if (materialize(self) != 0)
+		return NULL;
+	if (PyObject_TypeCheck(other, &EntryDictType)) {
+		if (materialize((EntryDict *)other) != 0)
+			return NULL;
+		other = ((EntryDict *)other)->dict;
+	}
+	return PyObject_RichCompare(self->dict, other, op);
+}
+
+/* delegate all other dict methods like items(), copy() or pop() */
+static PyObject *entrydict_getattro(EntryDict *self, PyObject *name) {
+	PyObject *attr = PyObject_GenericGetAttr((PyObject *)self, name);
+
+	if (attr != NULL || !PyErr_ExceptionMatches(PyExc_AttributeError))
+		return attr;
+	PyErr_Clear();
+	if (materialize(self) != 0)
+		return NULL;
+	return PyObject_GetAttr(self->dict, name);
+}
+
+static PyObject *entrydict_get(EntryDict *self, PyObject *args) {
+	PyObject *key, *values, *def = Py_None;
+
+	if (!PyArg_UnpackTuple(args, "get", 1, 2, &key, &def))
+		return NULL;
+	if ((values = entrydict_lookup(self, key)) == NULL) {
+		if (PyErr_Occurred())
+			return NULL;
+		values = def;
+	}
+	Py_INCREF(values);
+	return values;
+}
+
+/* pickle and copy as a plain dict */
+static PyObject *entrydict_reduce(EntryDict *self, PyObject *Py_UNUSED(ignored)) {
+	if (materialize(self) != 0)
+		return NULL;
+	return Py_BuildValue("(O(O))", (PyObject *)&PyDict_Type, self->dict);
+}
+
+static PyMethodDef entrydict_methods[] = {
+    {"get", (PyCFunction)entrydict_get, METH_VARARGS, "Return the values of an attribute, or a default."},
+    {"__reduce__", (PyCFunction)entrydict_reduce, METH_NOARGS, NULL},
+    {NULL},
+};
+
+static PyMappingMethods entrydict_as_mapping = {
+    .mp_length = (lenfunc)entrydict_length,
+    .mp_subscript = (binaryfunc)entrydict_subscript,
+    .mp_ass_subscript = (objobjargproc)entrydict_ass_subscript,
+};
+
+static PySequenceMethods entrydict_as_sequence = {
+    .sq_contains = (objobjproc)entrydict_contains,
+};
+
+static PyTypeObject EntryDictType = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "univention.listener.EntryDict",
+    .tp_basicsize = sizeof(EntryDict),
+    .tp_flags = Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC | Py_TPFLAGS_MAPPING,
+    .tp_doc = "Attributes of an LDAP entry, converted on first access.",
+    .tp_dealloc = (destructor)entrydict_dealloc,
+    .tp_traverse = (traverseproc)entrydict_traverse,
+    .tp_clear = (inquiry)entrydict_clear,
+    .tp_repr = (reprfunc)entrydict_repr,
+    .tp_as_mapping = &entrydict_as_mapping,
+    .tp_as_sequence = &entrydict_as_sequence,
+    .tp_iter = (getiterfunc)entrydict_iter,
+    .tp_richcompare = (richcmpfunc)entrydict_richcompare,
+    .tp_getattro = (getattrofunc)entrydict_getattro,
+    .tp_hash = PyObject_HashNotImplemented,
+    .tp_methods = entrydict_methods,
+};
+
+int entrydict_init(void) {
+	PyObject *abc, *mapping, *rv = NULL;
+
+	if (PyType_Ready(&EntryDictType) != 0)
+		return -1;
+
+	/* make isinstance(new, collections.abc.MutableMapping) work */
+	if ((abc = PyImport_ImportModule("collections.abc")) == NULL)
+		return -1;
+	if ((mapping = PyObject_GetAttrString(abc, "MutableMapping")) != NULL) {
+		rv = PyObject_CallMethod(mapping, "register", "O", (PyObject *)&EntryDictType);
+		Py_DECREF(mapping);
+	}
+	Py_DECREF(abc);
+	if (rv == NULL)
+		return -1;
+	Py_DECREF(rv);
+	return 0;
+}
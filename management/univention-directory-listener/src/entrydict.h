@@ -0,0 +1,52 @@
+/*
+ * Univention Directory Listener
+ *  header information for entrydict.c
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ENTRYDICT_H_
+#define _ENTRYDICT_H_
+
+#include <python3.11/Python.h>
+
+#include "cache_entry.h"
+
+int entrydict_init(void);
+/* Create a mapping converting the attributes of `entry` on first access.
+   `shared` caches the converted values for all mappings of the same entry.
+   The entry must stay valid until entrydict_detach() is called. */
+PyObject *entrydict_new(CacheEntry *entry, PyObject *shared);
+/* Convert all remaining attributes if the mapping is still referenced elsewhere,
+   so it no longer needs the entry. */
+int entrydict_detach(PyObject *entrydict);
+
+#endif /* _ENTRYDICT_H_ */
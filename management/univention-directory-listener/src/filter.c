@@ -34,12 +34,21 @@
  */
 
 /*
- * Functions to match LDAP filters to cache entries. Currently, we don't
- * use any schema information. However, to do this properly, we'd need to.
+ * Functions to match LDAP filters to cache entries.
+ *
+ * Filters are parsed once by filter_compile() into a tree, which is then
+ * evaluated for each entry. Equal sub-filters are shared between all trees,
+ * so the filters of all modules form one graph, in which each distinct
+ * predicate is only evaluated once per entry, see filter_memo_begin(). Attribute names are matched case-insensitively
+ * and values by the matching rules of the attribute types of cn=Subschema,
+ * see filter_set_schema(). Until a schema is loaded, a few built-in
+ * definitions for the most commonly filtered attributes are used.
  */
 
 #define _GNU_SOURCE /* for strndup */
 
+#include <ctype.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -47,65 +56,201 @@
 #include "common.h"
 #include "filter.h"
 
+enum filter_type {
+	FILTER_TRUE, /* malformed filters match everything */
+	FILTER_AND,
+	FILTER_OR,
+	FILTER_NOT,
+	FILTER_PRESENT,
+	FILTER_EQUALITY,
+	FILTER_SUBSTRINGS,
+	FILTER_GREATER_OR_EQUAL,
+	FILTER_LESS_OR_EQUAL,
+	FILTER_APPROX,
+};
 
-/* Check if entry matches value of attribute.
- * @param attribute Name of attribute.
- * @param value Expected string value. '*' as a wild-card at the front or end is supported.
- * @param entry Cached LDAP entry to match.
- * @return 1 on match, 0 otherwise.
+enum match_rule {
+	MATCH_NONE, /* not defined by the attribute type */
+	MATCH_OTHER, /* unsupported rule: bytes, numeric ordering for integers */
+	MATCH_EXACT,
+	MATCH_CASE_IGNORE,
+	MATCH_DN,
+	MATCH_INTEGER,
+};
+
+struct filter_node {
+	enum filter_type type;
+	struct filter_node **children; /* of AND, OR and NOT */
+	int child_count;
+	const char *attribute; /* interned, see cache_entry_intern() */
+	size_t attribute_len;
+	/* the assertion value, or for substrings the segments between the wild-cards:
+	   the first one is the initial and the last one the final segment, which
+	   are empty if the value starts or ends with a wild-card */
+	char **segments;
+	size_t *segment_lens;
+	int segment_count;
+	/* resolved through the schema by filter_node_resolve() */
+	unsigned int generation;
+	const char *canonical; /* interned */
+	size_t canonical_len;
+	bool known; /* attribute type is in the schema */
+	enum match_rule rule;
+	char *normalized; /* of the DN assertion value */
+	size_t normalized_len;
+	/* shared by filter_intern() */
+	unsigned int refs;
+	bool shared;
+	char *key;
+	size_t key_len;
+	unsigned int hash;
+	struct filter_node *next; /* in the bucket */
+	/* result for the entry of filter_memo_begin() */
+	unsigned long memo;
+	int memo_result;
+};
+
+#define FILTER_BUCKETS 509
+static struct filter_node *filter_table[FILTER_BUCKETS];
+static CacheEntry *memo_entry;
+static unsigned long memo_generation;
+
+struct schema_type {
+	char *oid;
+	char **names; /* the first one is the primary name */
+	int name_count;
+	char *sup;
+	enum match_rule equality, ordering, substr;
+};
+
+struct schema_name {
+	const char *name;
+	struct schema_type *type;
+};
+
+static struct schema_type *schema_types;
+static int schema_type_count;
+static struct schema_name *schema_names; /* sorted case-insensitively */
+static int schema_name_count;
+static unsigned int schema_generation = 1;
+
+/* used until the schema is loaded from cn=Subschema */
+static const char *builtin_schema[] = {
+    "( 2.5.4.0 NAME 'objectClass' EQUALITY objectIdentifierMatch )",
+    "( 2.5.4.49 NAME 'distinguishedName' EQUALITY distinguishedNameMatch )",
+    "( 2.5.4.31 NAME 'member' SUP distinguishedName )",
+    "( 2.5.4.50 NAME 'uniqueMember' EQUALITY uniqueMemberMatch )",
+    "( 1.2.840.113556.1.2.102 NAME 'memberOf' EQUALITY distinguishedNameMatch )",
+};
+
+
+static struct filter_node *new_node(enum filter_type type) {
+	struct filter_node *node;
+
+	if ((node = calloc(1, sizeof(struct filter_node))) == NULL)
+		abort();  // FIXME
+	node->type = type;
+	node->refs = 1;
+	return node;
+}
+
+
+static void key_append(struct filter_node *node, const void *data, size_t len) {
+	if ((node->key = realloc(node->key, node->key_len + len)) == NULL)
+		abort();  // FIXME
+	memcpy(node->key + node->key_len, data, len);
+	node->key_len += len;
+}
+
+
+/* Replace a node by an equal one already in use by another filter. As the
+ * children are shared already, they are compared by their address.
+ * @param node Filter node, which is consumed.
+ * @return The shared node.
  */
-static int cache_entry_match_attribute_value(char *attribute, char *value, CacheEntry *entry) {
-	CacheEntryAttribute **a;
-	char **v;
-	int len;
-	int rv = 0;
-	char *substr = NULL;
-	int begins = 0, ends = 0;
+static struct filter_node *filter_intern(struct filter_node *node) {
+	struct filter_node *cur;
+	unsigned char type = node->type;
+	unsigned int hash = 2166136261u;
+	size_t i;
+	int j;
 
-	for (a = entry->attributes; a != NULL && *a != NULL; a++) {
-		if (strcmp((*a)->name, attribute) == 0)
-			break;
+	key_append(node, &type, 1);
+	for (i = 0; i < node->attribute_len; i++) {
+		char c = tolower((unsigned char)node->attribute[i]);
+		key_append(node, &c, 1);
 	}
-	if (a == NULL || *a == NULL)
-		return 0;
+	key_append(node, "", 1);
+	for (j = 0; j < node->segment_count; j++) {
+		key_append(node, &node->segment_lens[j], sizeof(size_t));
+		key_append(node, node->segments[j], node->segment_lens[j]);
+	}
+	for (j = 0; j < node->child_count; j++)
+		key_append(node, &node->children[j], sizeof(struct filter_node *));
+	/* FNV-1a */
+	for (i = 0; i < node->key_len; i++)
+		hash = (hash ^ (unsigned char)node->key[i]) * 16777619u;
 
-	if (strcmp(value, "*") == 0)
-		return 1;
+	for (cur = filter_table[hash % FILTER_BUCKETS]; cur != NULL; cur = cur->next) {
+		if (cur->hash == hash && cur->key_len == node->key_len && memcmp(cur->key, node->key, node->key_len) == 0) {
+			cur->refs++;
+			filter_free(node);
+			return cur;
+		}
+	}
+	node->hash = hash;
+	node->shared = true;
+	node->next = filter_table[hash % FILTER_BUCKETS];
+	filter_table[hash % FILTER_BUCKETS] = node;
+	return node;
+}
 
-	len = strlen(value);
-	begins = value[0] == '*';
-	ends = value[len - 1] == '*';
-	if (begins || ends)
-		substr = strndup(value + begins, len - begins - ends);
 
-	for (v = (*a)->values; v != NULL && *v != NULL; v++) {
-		char *match;
-		if (strcmp(*v, value) == 0) {
-			rv = 1;
-			break;
-		} else if (substr != NULL && (match = strstr(*v, substr)) != NULL) {
-			rv = (begins || match == *v) && (ends || strcmp(match, substr) == 0);
-			if (rv)
-				break;
+/* Append an assertion value segment, resolving the escapes of RFC 4515.
+ * @param node Filter node.
+ * @param value Escaped value.
+ * @param len Length of the escaped value.
+ */
+static void add_segment(struct filter_node *node, const char *value, size_t len) {
+	char *segment;
+	size_t i, j;
+
+	if ((segment = malloc(len + 1)) == NULL)
+		abort();  // FIXME
+	for (i = j = 0; i < len; i++) {
+		if (value[i] == '\\' && i + 2 < len && isxdigit(value[i + 1]) && isxdigit(value[i + 2])) {
+			char hex[3] = {value[i + 1], value[i + 2], '\0'};
+			segment[j++] = strtol(hex, NULL, 16);
+			i += 2;
+		} else {
+			segment[j++] = value[i];
 		}
 	}
+	segment[j] = '\0';
 
-	free(substr);
-	return rv;
+	node->segments = realloc(node->segments, (node->segment_count + 1) * sizeof(char *));
+	node->segment_lens = realloc(node->segment_lens, (node->segment_count + 1) * sizeof(size_t));
+	if (node->segments == NULL || node->segment_lens == NULL)
+		abort();  // FIXME
+	node->segments[node->segment_count] = segment;
+	node->segment_lens[node->segment_count++] = j;
 }
 
 
-/* Check if entry matches the LDAP filter.
- * @param filter LDAP search filter supporting. LIMITED.
+static struct filter_node *__filter_compile(const char *filter, int first, int last);
+
+/* Parse an LDAP filter.
+ * @param filter LDAP search filter.
  * @param first Index into filter to specify start character.
  * @param last Index into filter to specify last character.
- * @param entry Cached LDAP entry to match.
- * @return 1 on match, 0 on no match, -1 on errors.
+ * @return The filter tree with shared children.
  */
-static int __cache_entry_ldap_filter_match(char *filter, int first, int last, CacheEntry *entry) {
+static struct filter_node *__filter_parse(const char *filter, int first, int last) {
+	struct filter_node *node;
+
 	/* sanity check */
-	if (filter[first] != '(' || filter[last] != ')')
-		return -1;
+	if (first >= last || filter[first] != '(' || filter[last] != ')')
+		return new_node(FILTER_TRUE);
 
 	if (filter[first + 1] == '&' || filter[first + 1] == '|' || filter[first + 1] == '!') {
 		int i;
@@ -114,72 +259,786 @@ static int __cache_entry_ldap_filter_match(char *filter, int first, int last, Ca
 
 		/* sanity check */
 		if (filter[first + 2] != '(' || filter[last - 1] != ')')
-			return -1;
+			return new_node(FILTER_TRUE);
 
+		node = new_node(filter[first + 1] == '&' ? FILTER_AND : filter[first + 1] == '|' ? FILTER_OR : FILTER_NOT);
 		for (i = first + 2; i <= last - 1; i++) {
 			if (filter[i] == '(') {
 				if (begin == -1)
 					begin = i;
 				++depth;
 			} else if (filter[i] == ')' && begin != -1) {
-				int cond_is_true;
-
 				--depth;
 				if (depth != 0)
 					continue;
 
-				cond_is_true = __cache_entry_ldap_filter_match(filter, begin, i, entry);
-				if (!cond_is_true && filter[first + 1] == '&')
-					return 0;
-				else if (cond_is_true && filter[first + 1] == '|')
-					return 1;
-				else if (filter[first + 1] == '!')
-					return !cond_is_true;
+				node->children = realloc(node->children, (node->child_count + 1) * sizeof(struct filter_node *));
+				if (node->children == NULL)
+					abort();  // FIXME
+				node->children[node->child_count++] = __filter_compile(filter, begin, i);
+				/* only the first condition is negated */
+				if (node->type == FILTER_NOT)
+					break;
 
 				begin = -1;
 			}
 		}
-
-		if (filter[first + 1] == '&')
-			return 1;
-		else if (filter[first + 1] == '|')
-			return 0;
-		else /* '!', we shouldn't get here */
-			return -1;
+		if (node->child_count == 0) {
+			filter_free(node);
+			return new_node(FILTER_TRUE);
+		}
+		return node;
 	} else {
-		int type = -1; /* 0: =; 1: ~=; 2: >=; 3: <= */
-		char *attr, *val;
-		int i;
-		int rv;
+		enum filter_type type = FILTER_TRUE;
+		const char *value, *star;
+		int i, attr_end;
 
 		for (i = first + 1; i <= last - 1; i++) {
 			if (filter[i] == '=' && i > first + 1) {
 				if (filter[i - 1] == '~')
-					type = 1;
+					type = FILTER_APPROX;
 				else if (filter[i - 1] == '>')
-					type = 2;
+					type = FILTER_GREATER_OR_EQUAL;
 				else if (filter[i - 1] == '<')
-					type = 3;
+					type = FILTER_LESS_OR_EQUAL;
 				else
-					type = 0;
+					type = FILTER_EQUALITY;
 				break;
 			}
 		}
-		if (type != 0) /* (type == -1) */
-			return -1;
+		if (type == FILTER_TRUE)
+			return new_node(FILTER_TRUE);
+		attr_end = type == FILTER_EQUALITY ? i : i - 1;
+		if (attr_end == first + 1)
+			return new_node(FILTER_TRUE);
+
+		value = filter + i + 1;
+		if (type == FILTER_EQUALITY) {
+			if (last - i - 1 == 1 && value[0] == '*')
+				type = FILTER_PRESENT;
+			else if (memchr(value, '*', last - i - 1) != NULL)
+				type = FILTER_SUBSTRINGS;
+		}
+
+		node = new_node(type);
+		node->attribute = cache_entry_intern(filter + first + 1, attr_end - first - 1);
+		node->attribute_len = attr_end - first - 1;
+		if (type == FILTER_SUBSTRINGS) {
+			for (; (star = memchr(value, '*', filter + last - value)) != NULL; value = star + 1)
+				add_segment(node, value, star - value);
+			add_segment(node, value, filter + last - value);
+		} else if (type != FILTER_PRESENT) {
+			add_segment(node, value, filter + last - value);
+		}
+		return node;
+	}
+}
+
+
+/* Parse an LDAP filter into a shared node. */
+static struct filter_node *__filter_compile(const char *filter, int first, int last) {
+	return filter_intern(__filter_parse(filter, first, last));
+}
+
+
+/* Parse an LDAP filter once for repeated matching.
+ * @param filter LDAP search filter.
+ * @return The filter tree to be freed with filter_free().
+ */
+struct filter_node *filter_compile(const char *filter) {
+	int len = strlen(filter);
+
+	if (len == 0)
+		return filter_intern(new_node(FILTER_TRUE));
+	return __filter_compile(filter, 0, len - 1);
+}
+
+
+void filter_free(struct filter_node *node) {
+	struct filter_node **cur;
+	int i;
+
+	if (node == NULL || --node->refs > 0)
+		return;
+	if (node->shared) {
+		for (cur = &filter_table[node->hash % FILTER_BUCKETS]; *cur != node; cur = &(*cur)->next)
+			;
+		*cur = node->next;
+	}
+	for (i = 0; i < node->child_count; i++)
+		filter_free(node->children[i]);
+	free(node->children);
+	for (i = 0; i < node->segment_count; i++)
+		free(node->segments[i]);
+	free(node->segments);
+	free(node->segment_lens);
+	free(node->normalized);
+	free(node->key);
+	free(node);
+}
+
+
+/* Remember the result of each filter node while the filters of all modules
+ * are matched against one entry, which must not change until
+ * filter_memo_end().
+ * @param entry Cached LDAP entry to match.
+ */
+void filter_memo_begin(CacheEntry *entry) {
+	memo_entry = entry;
+	memo_generation++;
+}
+
+
+void filter_memo_end(void) {
+	memo_entry = NULL;
+}
+
+
+/* Compare a schema token to a keyword. */
+static bool token_is(const char *token, size_t len, const char *word) {
+	return strlen(word) == len && strncasecmp(token, word, len) == 0;
+}
+
+
+/* Get the next token of an attribute type description of RFC 4512.
+ * @param pos Position in the description, advanced past the token.
+ * @param token Return variable to receive the start of the token.
+ * @param len Return variable to receive the length of the token.
+ * @return '(' or ')' for parentheses, '\'' for quoted strings, 'w' for words
+ *         and 0 at the end.
+ */
+static int schema_token(const char **pos, const char **token, size_t *len) {
+	const char *p = *pos;
+
+	while (isspace((unsigned char)*p))
+		p++;
+	if (*p == '\0')
+		return 0;
+	if (*p == '(' || *p == ')') {
+		*token = p;
+		*len = 1;
+		*pos = p + 1;
+		return *p;
+	}
+	if (*p == '\'') {
+		*token = ++p;
+		while (*p != '\0' && *p != '\'')
+			p++;
+		*len = p - *token;
+		*pos = *p == '\0' ? p : p + 1;
+		return '\'';
+	}
+	*token = p;
+	while (*p != '\0' && !isspace((unsigned char)*p) && *p != '(' && *p != ')')
+		p++;
+	*len = p - *token;
+	*pos = p;
+	return 'w';
+}
+
+
+/* Map the name of a matching rule to how values are compared. */
+static enum match_rule match_rule(const char *name, size_t len) {
+	static const struct {
+		const char *name;
+		enum match_rule rule;
+	} rules[] = {
+	    {"caseExactMatch", MATCH_EXACT},
+	    {"caseExactIA5Match", MATCH_EXACT},
+	    {"caseExactOrderingMatch", MATCH_EXACT},
+	    {"caseExactSubstringsMatch", MATCH_EXACT},
+	    {"caseExactIA5SubstringsMatch", MATCH_EXACT},
+	    {"octetStringMatch", MATCH_EXACT},
+	    {"caseIgnoreMatch", MATCH_CASE_IGNORE},
+	    {"caseIgnoreIA5Match", MATCH_CASE_IGNORE},
+	    {"caseIgnoreListMatch", MATCH_CASE_IGNORE},
+	    {"caseIgnoreOrderingMatch", MATCH_CASE_IGNORE},
+	    {"caseIgnoreSubstringsMatch", MATCH_CASE_IGNORE},
+	    {"caseIgnoreIA5SubstringsMatch", MATCH_CASE_IGNORE},
+	    {"caseIgnoreListSubstringsMatch", MATCH_CASE_IGNORE},
+	    {"objectIdentifierMatch", MATCH_CASE_IGNORE},
+	    {"distinguishedNameMatch", MATCH_DN},
+	    {"uniqueMemberMatch", MATCH_DN},
+	    {"integerMatch", MATCH_INTEGER},
+	    {"integerOrderingMatch", MATCH_INTEGER},
+	};
+	size_t i;
+
+	for (i = 0; i < sizeof(rules) / sizeof(rules[0]); i++) {
+		if (token_is(name, len, rules[i].name))
+			return rules[i].rule;
+	}
+	return MATCH_OTHER;
+}
+
+
+/* Parse an attribute type description and append it to the schema. */
+static void schema_parse_type(const char *description) {
+	struct schema_type type = {};
+	const char *pos = description, *token;
+	size_t len;
+	int t;
+
+	if (schema_token(&pos, &token, &len) != '(' || schema_token(&pos, &token, &len) != 'w')
+		return;
+	type.oid = strndup(token, len);
+	while ((t = schema_token(&pos, &token, &len)) != 0 && t != ')') {
+		enum match_rule *rule = NULL;
+
+		if (t != 'w')
+			continue;
+		if (token_is(token, len, "NAME")) {
+			bool list = (t = schema_token(&pos, &token, &len)) == '(';
+
+			if (list)
+				t = schema_token(&pos, &token, &len);
+			for (; t == '\''; t = list ? schema_token(&pos, &token, &len) : 0) {
+				if ((type.names = realloc(type.names, (type.name_count + 1) * sizeof(char *))) == NULL)
+					abort();  // FIXME
+				type.names[type.name_count++] = strndup(token, len);
+			}
+			continue;
+		} else if (token_is(token, len, "SUP")) {
+			if (schema_token(&pos, &token, &len) == 'w' && type.sup == NULL)
+				type.sup = strndup(token, len);
+			continue;
+		} else if (token_is(token, len, "EQUALITY")) {
+			rule = &type.equality;
+		} else if (token_is(token, len, "ORDERING")) {
+			rule = &type.ordering;
+		} else if (token_is(token, len, "SUBSTR")) {
+			rule = &type.substr;
+		}
+		if (rule != NULL && schema_token(&pos, &token, &len) == 'w')
+			*rule = match_rule(token, len);
+	}
+
+	if (type.name_count == 0) {
+		free(type.oid);
+		free(type.sup);
+		return;
+	}
+	if ((schema_types = realloc(schema_types, (schema_type_count + 1) * sizeof(struct schema_type))) == NULL)
+		abort();  // FIXME
+	schema_types[schema_type_count++] = type;
+}
+
+
+static int schema_name_compare(const void *a, const void *b) {
+	return strcasecmp(((const struct schema_name *)a)->name, ((const struct schema_name *)b)->name);
+}
+
+
+/* Find an attribute type by name or OID. */
+static struct schema_type *schema_find(const char *name) {
+	struct schema_name key = {.name = name}, *found;
+	int i;
+
+	found = bsearch(&key, schema_names, schema_name_count, sizeof(struct schema_name), schema_name_compare);
+	if (found != NULL)
+		return found->type;
+	for (i = 0; i < schema_type_count; i++) {
+		if (strcmp(schema_types[i].oid, name) == 0)
+			return &schema_types[i];
+	}
+	return NULL;
+}
+
+
+static void schema_free(void) {
+	int i, j;
+
+	for (i = 0; i < schema_type_count; i++) {
+		for (j = 0; j < schema_types[i].name_count; j++)
+			free(schema_types[i].names[j]);
+		free(schema_types[i].names);
+		free(schema_types[i].oid);
+		free(schema_types[i].sup);
+	}
+	free(schema_types);
+	free(schema_names);
+	schema_types = NULL;
+	schema_names = NULL;
+	schema_type_count = schema_name_count = 0;
+}
+
+
+/* Build the name index and inherit the matching rules from the super types. */
+static void schema_finish(void) {
+	int i, j, depth;
+
+	for (i = 0; i < schema_type_count; i++)
+		schema_name_count += schema_types[i].name_count;
+	if ((schema_names = malloc((schema_name_count + 1) * sizeof(struct schema_name))) == NULL)
+		abort();  // FIXME
+	schema_name_count = 0;
+	for (i = 0; i < schema_type_count; i++) {
+		for (j = 0; j < schema_types[i].name_count; j++) {
+			schema_names[schema_name_count].name = schema_types[i].names[j];
+			schema_names[schema_name_count++].type = &schema_types[i];
+		}
+	}
+	qsort(schema_names, schema_name_count, sizeof(struct schema_name), schema_name_compare);
+
+	for (i = 0; i < schema_type_count; i++) {
+		struct schema_type *type = &schema_types[i], *sup = type;
+
+		/* bounded, as the super types may be cyclic */
+		for (depth = 0; depth < 16 && sup->sup != NULL; depth++) {
+			if ((sup = schema_find(sup->sup)) == NULL)
+				break;
+			if (type->equality == MATCH_NONE)
+				type->equality = sup->equality;
+			if (type->ordering == MATCH_NONE)
+				type->ordering = sup->ordering;
+			if (type->substr == MATCH_NONE)
+				type->substr = sup->substr;
+		}
+	}
+}
+
+
+static void schema_load_builtin(void) {
+	size_t i;
+
+	for (i = 0; i < sizeof(builtin_schema) / sizeof(builtin_schema[0]); i++)
+		schema_parse_type(builtin_schema[i]);
+	schema_finish();
+}
+
+
+/* Use the attribute types of the schema for matching.
+ * @param subschema Cached cn=Subschema entry, or NULL to use the built-in
+ *        definitions.
+ */
+void filter_set_schema(CacheEntry *subschema) {
+	CacheEntryAttribute *a = NULL;
+	int i;
+
+	schema_free();
+	if (subschema != NULL)
+		a = cache_entry_find_attribute(subschema, "attributeTypes", 14);
+	if (a != NULL && a->value_count > 0) {
+		for (i = 0; i < a->value_count; i++)
+			schema_parse_type(a->values[i]);
+		schema_finish();
+	} else {
+		schema_load_builtin();
+	}
+	schema_generation++;
+}
+
+
+/* Normalize a DN for comparison: lower-case and without the insignificant
+ * spaces around separators.
+ * @param dn The distinguished name.
+ * @param len Length of the distinguished name.
+ * @param out Buffer of at least len + 1 bytes to receive the normalized DN.
+ * @return Length of the normalized DN.
+ */
+static size_t dn_normalize(const char *dn, size_t len, char *out) {
+	bool separator = true;
+	size_t i, j = 0;
+
+	for (i = 0; i < len; i++) {
+		if (dn[i] == '\\' && i + 1 < len) {
+			out[j++] = '\\';
+			out[j++] = tolower((unsigned char)dn[++i]);
+			separator = false;
+		} else if (dn[i] == ' ') {
+			size_t k = i;
+
+			while (k < len && dn[k] == ' ')
+				k++;
+			if (!separator && k < len && dn[k] != ',' && dn[k] != '=' && dn[k] != '+' && dn[k] != ';') {
+				memcpy(out + j, dn + i, k - i);
+				j += k - i;
+			}
+			i = k - 1;
+		} else {
+			separator = dn[i] == ',' || dn[i] == '=' || dn[i] == '+' || dn[i] == ';';
+			out[j++] = separator && dn[i] == ';' ? ',' : tolower((unsigned char)dn[i]);
+		}
+	}
+	out[j] = '\0';
+	return j;
+}
 
-		attr = strndup(filter + first + 1, i - first - 1);
-		val = strndup(filter + i + 1, last - i - 1);
 
-		rv = cache_entry_match_attribute_value(attr, val, entry);
+/* Resolve the attribute type of a filter leaf after the schema changed. */
+static void filter_node_resolve(struct filter_node *node) {
+	struct schema_type *type;
 
-		free(attr);
-		free(val);
+	if (node->generation == schema_generation)
+		return;
+	if (schema_types == NULL)
+		schema_load_builtin();
+	node->generation = schema_generation;
 
+	type = schema_find(node->attribute);
+	node->known = type != NULL;
+	node->canonical = type != NULL ? cache_entry_intern(type->names[0], strlen(type->names[0])) : node->attribute;
+	node->canonical_len = strlen(node->canonical);
+	node->rule = type == NULL ? MATCH_NONE : type->equality;
+	if (type != NULL && (node->type == FILTER_GREATER_OR_EQUAL || node->type == FILTER_LESS_OR_EQUAL)) {
+		if (type->ordering != MATCH_NONE || type->equality != MATCH_INTEGER)
+			node->rule = type->ordering;
+	} else if (type != NULL && node->type == FILTER_SUBSTRINGS) {
+		/* DNs have no substring rule, but compare them case-insensitively */
+		if (type->substr != MATCH_NONE || type->equality != MATCH_DN)
+			node->rule = type->substr;
+		else
+			node->rule = MATCH_CASE_IGNORE;
+	}
+
+	free(node->normalized);
+	node->normalized = NULL;
+	if (node->rule == MATCH_DN && node->type == FILTER_EQUALITY) {
+		if ((node->normalized = malloc(node->segment_lens[0] + 1)) == NULL)
+			abort();  // FIXME
+		node->normalized_len = dn_normalize(node->segments[0], node->segment_lens[0], node->normalized);
+	}
+}
+
+
+/* Parse a value as integer.
+ * @return true if the complete value is an integer.
+ */
+static bool parse_integer(const char *value, size_t len, long long *number) {
+	char *end;
+
+	if (len == 0)
+		return false;
+	*number = strtoll(value, &end, 10);
+	return end == value + len;
+}
+
+
+/* Compare two values by their bytes, case-insensitively if requested. */
+static int compare_bytes(const char *a, size_t a_len, const char *b, size_t b_len, bool ignore_case) {
+	size_t len = a_len < b_len ? a_len : b_len;
+	int rv = ignore_case ? strncasecmp(a, b, len) : memcmp(a, b, len);
+
+	if (rv == 0)
+		rv = (a_len > b_len) - (a_len < b_len);
+	return rv;
+}
+
+
+/* Compare values for ordering. Unless the schema defines the ordering rule,
+ * values which are both integers are compared numerically, others by their
+ * bytes.
+ */
+static int compare_ordering(enum match_rule rule, const char *value, size_t value_len, const char *assertion, size_t assertion_len) {
+	long long a, b;
+
+	if (rule != MATCH_EXACT && rule != MATCH_CASE_IGNORE && parse_integer(value, value_len, &a) && parse_integer(assertion, assertion_len, &b))
+		return (a > b) - (a < b);
+	return compare_bytes(value, value_len, assertion, assertion_len, rule == MATCH_CASE_IGNORE);
+}
+
+
+/* Check if a value equals the assertion value of the node. */
+static bool match_equality(const struct filter_node *node, const char *value, size_t len) {
+	long long a, b;
+	char buffer[BUFSIZ], *normalized;
+	bool rv;
+
+	switch (node->rule) {
+	case MATCH_CASE_IGNORE:
+		return len == node->segment_lens[0] && strncasecmp(value, node->segments[0], len) == 0;
+	case MATCH_INTEGER:
+		if (parse_integer(value, len, &a) && parse_integer(node->segments[0], node->segment_lens[0], &b))
+			return a == b;
+		break;
+	case MATCH_DN:
+		if ((normalized = len < sizeof(buffer) ? buffer : malloc(len + 1)) == NULL)
+			abort();  // FIXME
+		rv = dn_normalize(value, len, normalized) == node->normalized_len && memcmp(normalized, node->normalized, node->normalized_len) == 0;
+		if (normalized != buffer)
+			free(normalized);
 		return rv;
+	default:
+		break;
 	}
+	return len == node->segment_lens[0] && memcmp(value, node->segments[0], len) == 0;
+}
+
+
+/* Find a segment in a value, case-insensitively if requested. */
+static const char *find_segment(const char *value, size_t len, const char *segment, size_t segment_len, bool ignore_case) {
+	const char *pos;
 
-	return -1;
+	if (!ignore_case)
+		return memmem(value, len, segment, segment_len);
+	for (pos = value; pos + segment_len <= value + len; pos++) {
+		if (strncasecmp(pos, segment, segment_len) == 0)
+			return pos;
+	}
+	return NULL;
+}
+
+
+/* Check if a value matches the substring segments of the node. */
+static int match_substrings(const struct filter_node *node, const char *value, size_t len) {
+	size_t initial = node->segment_lens[0], final = node->segment_lens[node->segment_count - 1];
+	const char *pos = value + initial, *end = value + len - final;
+	bool ignore_case = node->rule == MATCH_CASE_IGNORE;
+	int i;
+
+	if (initial + final > len)
+		return 0;
+	if (compare_bytes(value, initial, node->segments[0], initial, ignore_case) ||
+	    compare_bytes(end, final, node->segments[node->segment_count - 1], final, ignore_case))
+		return 0;
+	for (i = 1; i < node->segment_count - 1; i++) {
+		const char *match = find_segment(pos, end - pos, node->segments[i], node->segment_lens[i], ignore_case);
+		if (match == NULL)
+			return 0;
+		pos = match + node->segment_lens[i];
+	}
+	return 1;
+}
+
+
+/* Find the attribute of a filter leaf in the entry. */
+static CacheEntryAttribute *find_attribute(const struct filter_node *node, CacheEntry *entry) {
+	CacheEntryAttribute *a;
+	int i;
+
+	a = cache_entry_find_attribute(entry, node->canonical, node->canonical_len);
+	if (a != NULL || node->known)
+		return a;
+	/* without schema information the spelling in the entry is unknown */
+	for (i = 0; i < entry->attribute_count; i++) {
+		if (strcasecmp(entry->attributes[i]->name, node->attribute) == 0)
+			return entry->attributes[i];
+	}
+	return NULL;
+}
+
+
+/* Check if entry matches a filter leaf.
+ * @param node Filter node of a comparison.
+ * @param entry Cached LDAP entry to match.
+ * @return 1 on match, 0 otherwise.
+ */
+static int cache_entry_match_attribute_value(struct filter_node *node, CacheEntry *entry) {
+	CacheEntryAttribute *a;
+	int i;
+
+	filter_node_resolve(node);
+	a = find_attribute(node, entry);
+	if (a == NULL)
+		return 0;
+	if (node->type == FILTER_PRESENT)
+		return 1;
+
+	for (i = 0; i < a->value_count; i++) {
+		/* the length includes the terminating NUL */
+		size_t len = a->length[i] > 0 ? a->length[i] - 1 : 0;
+		const char *value = a->values[i];
+
+		switch (node->type) {
+		case FILTER_EQUALITY:
+			if (match_equality(node, value, len))
+				return 1;
+			break;
+		case FILTER_APPROX:
+			if (len == node->segment_lens[0] && strncasecmp(value, node->segments[0], len) == 0)
+				return 1;
+			break;
+		case FILTER_SUBSTRINGS:
+			if (match_substrings(node, value, len))
+				return 1;
+			break;
+		case FILTER_GREATER_OR_EQUAL:
+			if (compare_ordering(node->rule, value, len, node->segments[0], node->segment_lens[0]) >= 0)
+				return 1;
+			break;
+		case FILTER_LESS_OR_EQUAL:
+			if (compare_ordering(node->rule, value, len, node->segments[0], node->segment_lens[0]) <= 0)
+				return 1;
+			break;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+
+/* Check if entry matches the filter tree.
+ * @param node Compiled LDAP search filter.
+ * @param entry Cached LDAP entry to match.
+ * @return 1 on match, 0 on no match.
+ */
+static int filter_node_match(struct filter_node *node, CacheEntry *entry) {
+	bool memo = memo_entry != NULL && entry == memo_entry;
+	int i, rv;
+
+	if (memo && node->memo == memo_generation)
+		return node->memo_result;
+
+	switch (node->type) {
+	case FILTER_TRUE:
+		return 1;
+	case FILTER_AND:
+		for (i = 0, rv = 1; rv && i < node->child_count; i++)
+			rv = filter_node_match(node->children[i], entry);
+		break;
+	case FILTER_OR:
+		for (i = 0, rv = 0; !rv && i < node->child_count; i++)
+			rv = filter_node_match(node->children[i], entry);
+		break;
+	case FILTER_NOT:
+		rv = !filter_node_match(node->children[0], entry);
+		break;
+	default:
+		rv = cache_entry_match_attribute_value(node, entry);
+		break;
+	}
+
+	if (memo) {
+		node->memo = memo_generation;
+		node->memo_result = rv;
+	}
+	return rv;
+}
+
+
+/* Add value to a NULL-terminated list, unless it is already in there. */
+static void add_value(char ***values, int *count, char *value) {
+	int i;
+
+	for (i = 0; i < *count; i++) {
+		if (strcmp((*values)[i], value) == 0) {
+			free(value);
+			return;
+		}
+	}
+	if ((*values = realloc(*values, (*count + 2) * sizeof(char *))) == NULL)
+		abort();  // FIXME
+	(*values)[(*count)++] = value;
+	(*values)[*count] = NULL;
+}
+
+
+/* Collect the values of which the entry must have at least one for the filter
+ * to match, following filter_node_match().
+ * @param node Compiled LDAP search filter.
+ * @param attribute Name of the attribute.
+ * @param values Return variable to receive the values.
+ * @param count Return variable to receive the number of values.
+ * @return 1 if the values were collected, 0 if the filter may match without.
+ */
+static int __cache_entry_ldap_filter_required(struct filter_node *node, const char *attribute, char ***values, int *count) {
+	int i;
+
+	switch (node->type) {
+	case FILTER_AND:
+		/* one required child suffices */
+		for (i = 0; i < node->child_count; i++) {
+			if (__cache_entry_ldap_filter_required(node->children[i], attribute, values, count))
+				return 1;
+		}
+		return 0;
+	case FILTER_OR:
+		/* every child must be */
+		for (i = 0; i < node->child_count; i++) {
+			if (!__cache_entry_ldap_filter_required(node->children[i], attribute, values, count))
+				return 0;
+		}
+		return 1;
+	case FILTER_EQUALITY:
+		filter_node_resolve(node);
+		if (strcasecmp(node->canonical, attribute) != 0 || node->segment_lens[0] == 0)
+			return 0;
+		add_value(values, count, strndup(node->segments[0], node->segment_lens[0]));
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+
+/* Return the compiled filter, compiling it on first use. */
+static struct filter_node *filter_node(struct filter *filter) {
+	if (filter->node == NULL)
+		filter->node = filter_compile(filter->filter);
+	return filter->node;
+}
+
+
+/* Collect the values of an attribute of which an entry must have at least one
+ * to match any of the LDAP filters.
+ * @param filter An array of LDAP filters, scopes and bases.
+ * @param attribute Name of the attribute.
+ * @return A NULL-terminated list of values to be freed by the caller, or NULL
+ *         if the filters may match entries with any values.
+ */
+char **cache_entry_ldap_filter_required(struct filter **filter, const char *attribute) {
+	struct filter **f;
+	char **values;
+	int count = 0;
+
+	if ((values = calloc(1, sizeof(char *))) == NULL)
+		abort();  // FIXME
+
+	for (f = filter; f != NULL && *f != NULL; f++) {
+		struct filter_node *node = (*f)->node != NULL ? (*f)->node : filter_compile((*f)->filter);
+		int required = __cache_entry_ldap_filter_required(node, attribute, &values, &count);
+
+		if (node != (*f)->node)
+			filter_free(node);
+		if (!required) {
+			char **v;
+			for (v = values; *v != NULL; v++)
+				free(*v);
+			free(values);
+			return NULL;
+		}
+	}
+
+	return values;
+}
+
+
+/* Collect the attributes tested by a filter, following filter_node_match(). */
+static void __cache_entry_ldap_filter_attributes(struct filter_node *node, char ***names, int *count) {
+	int i;
+
+	switch (node->type) {
+	case FILTER_TRUE:
+		break;
+	case FILTER_AND:
+	case FILTER_OR:
+	case FILTER_NOT:
+		for (i = 0; i < node->child_count; i++)
+			__cache_entry_ldap_filter_attributes(node->children[i], names, count);
+		break;
+	default:
+		add_value(names, count, strndup(node->attribute, node->attribute_len));
+		break;
+	}
+}
+
+
+/* Add the attributes needed to evaluate the LDAP filters to a list.
+ * @param filter An array of LDAP filters, scopes and bases.
+ * @param names NULL-terminated list of names, extended in place.
+ * @param count Number of names in the list, updated in place.
+ */
+void cache_entry_ldap_filter_attributes(struct filter **filter, char ***names, int *count) {
+	struct filter **f;
+
+	for (f = filter; f != NULL && *f != NULL; f++) {
+		struct filter_node *node = (*f)->node != NULL ? (*f)->node : filter_compile((*f)->filter);
+
+		__cache_entry_ldap_filter_attributes(node, names, count);
+		if (node != (*f)->node)
+			filter_free(node);
+	}
 }
 
 
@@ -218,8 +1077,7 @@ int cache_entry_ldap_filter_match(struct filter **filter, const char *dn, CacheE
 			}
 		}
 
-		int len = strlen((*f)->filter);
-		if (__cache_entry_ldap_filter_match((*f)->filter, 0, len - 1, entry))
+		if (filter_node_match(filter_node(*f), entry))
 			return 1;
 	}
 	return 0;
@@ -39,6 +39,13 @@
 #include "cache.h"
 #include "handlers.h"
 
+struct filter_node *filter_compile(const char *filter);
+void filter_free(struct filter_node *node);
+void filter_set_schema(CacheEntry *subschema);
+void filter_memo_begin(CacheEntry *entry);
+void filter_memo_end(void);
 int cache_entry_ldap_filter_match(struct filter **filter, const char *dn, CacheEntry *entry);
+char **cache_entry_ldap_filter_required(struct filter **filter, const char *attribute);
+void cache_entry_ldap_filter_attributes(struct filter **filter, char ***names, int *count);
 
 #endif /* _FILTER_H_ */
@@ -43,19 +43,35 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <time.h>
+#include <endian.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #define PY_SSIZE_T_CLEAN
 #include <python3.11/Python.h>
 #include <python3.11/compile.h>
 #include <python3.11/marshal.h>
+#include <univention/config.h>
 #include <univention/debug.h>
 
 #include "cache_lowlevel.h"
+#include "entrydict.h"
 #include "base64.h"
 #include "common.h"
 #include "filter.h"
 #include "handlers.h"
+#include "lane.h"
+#include "memory.h"
+#include "probes.h"
+#include "tunables.h"
+#include "worker.h"
 
 #if PY_MAJOR_VERSION >= 3
 #define PyString_FromString PyUnicode_FromString
@@ -63,8 +79,19 @@
 #define PyString_AsString PyUnicode_AsUTF8
 #endif
 
-static PyObject *handlers_argtuple(const char *dn, CacheEntry *new, CacheEntry *old);
-static PyObject *handlers_argtuple_command(const char *dn, CacheEntry *new, CacheEntry *old, char *command);
+/* Python values of the entries of one transaction, converted once for all handlers */
+struct entry_dicts {
+	CacheEntry *new, *old;
+	PyObject *new_dict, *old_dict;
+	PyObject *delta; /* see handlers_delta() */
+};
+
+static PyObject *handlers_argtuple(const char *dn, struct entry_dicts *dicts);
+static PyObject *handlers_argtuple_command(const char *dn, struct entry_dicts *dicts, char *command);
+static PyObject *handlers_delta(struct entry_dicts *dicts);
+static void handlers_worker_started(void);
+static int handler_worker_run(const char *module, const char *dn, CacheEntry *new, CacheEntry *old, char command);
+static int handler_worker_postrun(const char *module);
 
 extern char **module_dirs;
 extern int module_dir_count;
@@ -72,10 +99,184 @@ extern int module_dir_count;
 /* Linked list of handlers. */
 Handler *handlers = NULL;
 
+/* The cyclic garbage collector of Python, see handlers_gc(). Collections
+   are accounted to the handler running in the thread, if any. */
+static struct {
+	PyObject *module;
+	bool deferred;
+	int threshold[3];
+	unsigned long collections;
+	double time_total; /* outside of handlers */
+} gc_policy;
+static __thread Handler *handler_running;
+static __thread struct timespec gc_start;
+
+/* tracemalloc of Python, see tracing_begin(). Only calls running one at a
+   time are accounted, as the traced memory is not per thread. */
+static struct {
+	PyObject *get_traced_memory;
+	PyObject *reset_peak;
+} tracing;
+
+
+/* The header of compiled Python files, see PEP 552. The fields are
+   little-endian; for hash-based files, mtime and size hold the hash. */
+struct pyc_header {
+	u_int32_t magic;
+	u_int32_t flags;
+	u_int32_t mtime;
+	u_int32_t size;
+};
+
+enum pyc_flags {
+	PYC_HASH = 1 << 0,
+	PYC_CHECK_SOURCE = 1 << 1,
+};
+
+
+/* :returns: the path of the compiled file importlib uses for the source, or NULL */
+static char *pyc_path(const char *filename) {
+	PyObject *util, *path;
+	char *pyc = NULL;
+
+	if ((util = PyImport_ImportModule("importlib.util")) == NULL)
+		goto out;
+	if ((path = PyObject_CallMethod(util, "cache_from_source", "s", filename)) != NULL) {
+		const char *str = PyUnicode_AsUTF8(path);
+		if (str != NULL)
+			pyc = strdup(str);
+		Py_DECREF(path);
+	}
+	Py_DECREF(util);
+out:
+	PyErr_Clear();
+	return pyc;
+}
+
+
+/* same as importlib.util.source_hash() */
+static int pyc_source_hash(const char *source, size_t size, unsigned char hash[8]) {
+	PyObject *util, *result;
+	int rv = -1;
+
+	if ((util = PyImport_ImportModule("importlib.util")) == NULL)
+		goto out;
+	if ((result = PyObject_CallMethod(util, "source_hash", "y#", source, (Py_ssize_t)size)) != NULL) {
+		if (PyBytes_Check(result) && PyBytes_Size(result) == 8) {
+			memcpy(hash, PyBytes_AsString(result), 8);
+			rv = 0;
+		}
+		Py_DECREF(result);
+	}
+	Py_DECREF(util);
+out:
+	PyErr_Clear();
+	return rv;
+}
+
+
+/* read the whole file; :returns: the malloc()ed content or NULL */
+static char *read_file(const char *filename, size_t *size) {
+	struct stat st;
+	char *buf;
+	FILE *fp;
+
+	if ((fp = fopen(filename, "rb")) == NULL)
+		return NULL;
+	if (fstat(fileno(fp), &st) != 0 || (buf = malloc(st.st_size + 1)) == NULL) {
+		fclose(fp);
+		return NULL;
+	}
+	if (fread(buf, 1, st.st_size, fp) != (size_t)st.st_size) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Reading %s failed", filename);
+		free(buf);
+		buf = NULL;
+	} else {
+		buf[st.st_size] = '\0';
+		*size = st.st_size;
+	}
+	fclose(fp);
+	return buf;
+}
+
+
+/* :returns: the code of the compiled file `pyc`, if it is valid for the source; NULL otherwise */
+static PyObject *pyc_load(const char *pyc, const char *filename, const struct stat *st) {
+	struct pyc_header header;
+	PyObject *co = NULL;
+	char *buf, *source = NULL;
+	size_t size, source_size;
+
+	if ((buf = read_file(pyc, &size)) == NULL)
+		return NULL;
+	if (size < sizeof(header))
+		goto out;
+	memcpy(&header, buf, sizeof(header));
+	if (le32toh(header.magic) != (u_int32_t)PyImport_GetMagicNumber())
+		goto out;
+	if (le32toh(header.flags) & PYC_HASH) {
+		unsigned char hash[8];
+		if (le32toh(header.flags) & PYC_CHECK_SOURCE) {
+			if ((source = read_file(filename, &source_size)) == NULL || pyc_source_hash(source, source_size, hash) != 0 ||
+			    memcmp(hash, &header.mtime, sizeof(hash)))
+				goto out;
+		}
+	} else if (le32toh(header.mtime) != (u_int32_t)st->st_mtime || le32toh(header.size) != (u_int32_t)st->st_size) {
+		goto out;
+	}
+	if ((co = PyMarshal_ReadObjectFromString(buf + sizeof(header), size - sizeof(header))) == NULL)
+		PyErr_Clear();
+out:
+	free(source);
+	free(buf);
+	return co;
+}
+
+
+/* write the code compiled from the source into `pyc` the way importlib does, errors are ignored */
+static void pyc_write(const char *pyc, PyObject *co, const struct stat *st) {
+	struct pyc_header header = {
+	    .magic = htole32(PyImport_GetMagicNumber()),
+	    .mtime = htole32((u_int32_t)st->st_mtime),
+	    .size = htole32((u_int32_t)st->st_size),
+	};
+	char tmp[PATH_MAX], *slash;
+	PyObject *data;
+	FILE *fp;
+	int rv;
+
+	if (Py_DontWriteBytecodeFlag)
+		return;
+	if ((data = PyMarshal_WriteObjectToString(co, Py_MARSHAL_VERSION)) == NULL) {
+		PyErr_Clear();
+		return;
+	}
+	rv = snprintf(tmp, PATH_MAX, "%s.%d", pyc, getpid());
+	if (rv < 0 || rv >= PATH_MAX)
+		goto out;
+	if ((slash = strrchr(tmp, '/')) != NULL) {
+		*slash = '\0';
+		mkdir(tmp, 0755);
+		*slash = '/';
+	}
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "could not write %s: %s", tmp, strerror(errno));
+		goto out;
+	}
+	rv = fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(PyBytes_AsString(data), PyBytes_Size(data), 1, fp) == 1;
+	if (fclose(fp) != 0 || !rv || rename(tmp, pyc) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "could not write %s: %s", pyc, strerror(errno));
+		unlink(tmp);
+	}
+out:
+	Py_DECREF(data);
+}
+
 
 /* Import a Python module (source or compiled) the same way __import__ does.
    Unfortunately there doesn't seem to be any higher level interface for this.
-   I agree this isn't very intuitive. */
+   I agree this isn't very intuitive. Sources are compiled only if the
+   compiled file in __pycache__ is missing or stale, which is then renewed. */
 static PyObject *module_import(char *filename) {
 	/* It is essential that every module is imported under a different name;
 	   This used to be strdup("") which caused the modules to get overwritten,
@@ -85,44 +286,43 @@ static PyObject *module_import(char *filename) {
 	   been imported even in these low-level functions */
 	char *name = strdup(filename);
 	char *namep;
-	char *source_buf;
-	FILE *fp;
-	long size;
-	size_t sizeread;
-	PyObject *co;
+	char *source_buf, *pyc = NULL;
+	struct stat st;
+	size_t size;
+	PyObject *co = NULL;
 	PyObject *m;
 
-	if ((fp = fopen(filename, "rb")) == NULL)
+	if (stat(filename, &st) != 0) {
+		free(name);
 		return NULL;
+	}
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "Load file %s", filename);
 
 	namep = strrchr(filename, '.');
 	if ((namep != NULL) && (strcmp(namep, ".pyo") == 0)) {
-		__attribute__((unused)) long magic;
-
-		magic = PyMarshal_ReadLongFromFile(fp);
-		/* we should probably check the magic here */
-		(void)PyMarshal_ReadLongFromFile(fp);
-
-		co = PyMarshal_ReadLastObjectFromFile(fp);
+		/* a compiled file without source, valid for this interpreter */
+		struct pyc_header header;
+
+		if ((source_buf = read_file(filename, &size)) != NULL && size >= sizeof(header)) {
+			memcpy(&header, source_buf, sizeof(header));
+			if (le32toh(header.magic) == (u_int32_t)PyImport_GetMagicNumber())
+				co = PyMarshal_ReadObjectFromString(source_buf + sizeof(header), size - sizeof(header));
+			else
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "%s was compiled for another Python version", filename);
+		}
+		free(source_buf);
 	} else {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "Read and compile %s", filename);
-		fseek(fp, 0, SEEK_END);
-		size = ftell(fp);
-		fseek(fp, 0, SEEK_SET);
-		source_buf = malloc(size + 1);
-		sizeread = fread(source_buf, size, 1, fp);
-		source_buf[size] = '\0';
-		if (sizeread == (size_t) size) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Reading %s failed: %ld != %ld", filename, sizeread, size);
-			co = NULL;
-		}
-		else {
+		if ((pyc = pyc_path(filename)) != NULL && (co = pyc_load(pyc, filename, &st)) != NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "Loaded %s", pyc);
+		} else if ((source_buf = read_file(filename, &size)) != NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "Read and compile %s", filename);
 			co = Py_CompileString(source_buf, filename, Py_file_input);
+			free(source_buf);
+			if (co != NULL && pyc != NULL)
+				pyc_write(pyc, co, &st);
 		}
-		free(source_buf);
+		free(pyc);
 	}
-	fclose(fp);
 
 	if (co == NULL || !PyCode_Check(co)) {
 		Py_XDECREF(co);
@@ -132,6 +332,7 @@ static PyObject *module_import(char *filename) {
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "execCodeModuleEx %s", filename);
 	m = PyImport_ExecCodeModuleEx(name, co, filename);
+	Py_DECREF(co);
 	free(name);
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "Module done %s", filename);
 
@@ -139,6 +340,177 @@ static PyObject *module_import(char *filename) {
 }
 
 
+/* gc.callbacks entry measuring the pauses of the collector */
+static PyObject *gc_callback(PyObject *self, PyObject *args) {
+	const char *phase;
+	PyObject *info;
+	struct timespec now;
+	double elapsed;
+
+	if (!PyArg_ParseTuple(args, "sO", &phase, &info))
+		return NULL;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!strcmp(phase, "start")) {
+		gc_start = now;
+	} else {
+		elapsed = (now.tv_sec - gc_start.tv_sec) + (now.tv_nsec - gc_start.tv_nsec) / 1e9;
+		if (handler_running != NULL)
+			handler_running->stats.gc_time += elapsed;
+		else
+			gc_policy.time_total += elapsed;
+		gc_policy.collections++;
+	}
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef gc_callback_def = {"listener_gc_callback", gc_callback, METH_VARARGS, NULL};
+
+
+/* call gc.`method`() with the arguments in `format` */
+static void gc_call(const char *method, const char *format, ...) {
+	PyObject *result;
+	va_list ap;
+
+	if (gc_policy.module == NULL)
+		return;
+	va_start(ap, format);
+	if (format != NULL) {
+		PyObject *args = Py_VaBuildValue(format, ap), *func = PyObject_GetAttrString(gc_policy.module, method);
+		result = args != NULL && func != NULL ? PyObject_Call(func, args, NULL) : NULL;
+		Py_XDECREF(func);
+		Py_XDECREF(args);
+	} else {
+		result = PyObject_CallMethod(gc_policy.module, method, NULL);
+	}
+	va_end(ap);
+	if (result == NULL)
+		PyErr_Print();
+	Py_XDECREF(result);
+}
+
+
+/* hook into the collector once */
+static void gc_init(void) {
+	PyObject *callbacks, *callback;
+
+	if ((gc_policy.module = PyImport_ImportModule("gc")) == NULL) {
+		PyErr_Print();
+		return;
+	}
+	if ((callbacks = PyObject_GetAttrString(gc_policy.module, "callbacks")) == NULL || (callback = PyCFunction_New(&gc_callback_def, NULL)) == NULL) {
+		Py_XDECREF(callbacks);
+		PyErr_Print();
+		return;
+	}
+	if (PyList_Append(callbacks, callback) != 0)
+		PyErr_Print();
+	Py_DECREF(callback);
+	Py_DECREF(callbacks);
+}
+
+
+/* apply listener/python/gc/... UCR variables */
+static void gc_configure(void) {
+	const struct tunables *tunables = tunables_get();
+
+	if (gc_policy.module == NULL)
+		return;
+	gc_policy.threshold[0] = tunables->gc_threshold0;
+	gc_policy.threshold[1] = tunables->gc_threshold1;
+	gc_policy.threshold[2] = tunables->gc_threshold2;
+	gc_call("set_threshold", "iii", gc_policy.threshold[0], gc_policy.threshold[1], gc_policy.threshold[2]);
+	gc_policy.deferred = tunables->gc_defer;
+	gc_call(gc_policy.deferred ? "disable" : "enable", NULL);
+}
+
+
+/* start or stop tracemalloc following listener/memory/tracemalloc */
+static void tracing_configure(void) {
+	bool enable = tunables_get()->memory_tracemalloc;
+	PyObject *module, *result;
+
+	if (enable == (tracing.get_traced_memory != NULL))
+		return;
+	if ((module = PyImport_ImportModule("tracemalloc")) == NULL) {
+		PyErr_Print();
+		return;
+	}
+	if ((result = PyObject_CallMethod(module, enable ? "start" : "stop", NULL)) == NULL)
+		PyErr_Print();
+	Py_XDECREF(result);
+	if (enable && result != NULL) {
+		tracing.get_traced_memory = PyObject_GetAttrString(module, "get_traced_memory");
+		tracing.reset_peak = PyObject_GetAttrString(module, "reset_peak");
+		if (tracing.get_traced_memory == NULL || tracing.reset_peak == NULL) {
+			PyErr_Print();
+			Py_CLEAR(tracing.get_traced_memory);
+			Py_CLEAR(tracing.reset_peak);
+		}
+	} else {
+		Py_CLEAR(tracing.get_traced_memory);
+		Py_CLEAR(tracing.reset_peak);
+	}
+	Py_DECREF(module);
+}
+
+/* Return the memory currently traced and restart measuring the peak, before calling a handler. */
+static size_t tracing_begin(void) {
+	PyObject *result;
+	Py_ssize_t current = 0, peak;
+
+	if (tracing.get_traced_memory == NULL)
+		return 0;
+	if ((result = PyObject_CallObject(tracing.get_traced_memory, NULL)) == NULL || !PyArg_ParseTuple(result, "nn", &current, &peak))
+		PyErr_Clear();
+	Py_XDECREF(result);
+	if ((result = PyObject_CallObject(tracing.reset_peak, NULL)) == NULL)
+		PyErr_Clear();
+	Py_XDECREF(result);
+	return current;
+}
+
+/* account the memory allocated by the call of the handler since tracing_begin() returned @before */
+static void tracing_end(Handler *handler, size_t before) {
+	PyObject *result;
+	Py_ssize_t current, peak;
+
+	if (tracing.get_traced_memory == NULL)
+		return;
+	if ((result = PyObject_CallObject(tracing.get_traced_memory, NULL)) == NULL || !PyArg_ParseTuple(result, "nn", &current, &peak)) {
+		Py_XDECREF(result);
+		PyErr_Clear();
+		return;
+	}
+	Py_DECREF(result);
+	handler->stats.py_retained += (long)current - (long)before;
+	if ((size_t)peak > before && (size_t)peak - before > handler->stats.py_peak)
+		handler->stats.py_peak = peak - before;
+}
+
+
+/* Run the collector if it is due, between transactions or batches instead
+   of in the midst of a handler. Only used with listener/python/gc/defer. */
+void handlers_gc(void) {
+	PyObject *count;
+	int c[3], generation;
+
+	if (!gc_policy.deferred || gc_policy.module == NULL)
+		return;
+	if ((count = PyObject_CallMethod(gc_policy.module, "get_count", NULL)) == NULL || !PyArg_ParseTuple(count, "iii", &c[0], &c[1], &c[2])) {
+		Py_XDECREF(count);
+		PyErr_Clear();
+		return;
+	}
+	Py_DECREF(count);
+	if (gc_policy.threshold[0] == 0 || c[0] < gc_policy.threshold[0])
+		return;
+	/* the same choice of the generation as the collector does itself */
+	for (generation = 2; generation > 0 && c[generation] < gc_policy.threshold[generation]; generation--)
+		;
+	gc_call("collect", "(i)", generation);
+}
+
+
 /* Retrieve object from Python module.  */
 static PyObject *module_get_object(PyObject *module, char *name) {
 	if (!PyObject_HasAttrString(module, name))
@@ -209,9 +581,81 @@ error0:
 
 
 /* Insert handler in sorted order */
+/* Dispatch index: maps each objectClass value required by the filters of a
+   handler to that handler, so handlers_update() only needs to evaluate the
+   filters of handlers which can possibly match. Like objectClass values, it
+   is case-insensitive. */
+static struct dispatch {
+	char *object_class;
+	Handler *handler;
+} *dispatch;
+static int dispatch_count = -1; /* -1: needs to be rebuilt */
+static unsigned long dispatch_generation;
+
+static int dispatch_compare(const void *a, const void *b) {
+	return strcasecmp(((const struct dispatch *)a)->object_class, ((const struct dispatch *)b)->object_class);
+}
+
+static void dispatch_build(void) {
+	Handler *cur;
+	char **oc;
+	int count = 0;
+
+	for (cur = handlers; cur != NULL; cur = cur->next) {
+		for (oc = cur->object_classes; oc != NULL && *oc != NULL; oc++)
+			count++;
+	}
+	free(dispatch);
+	if ((dispatch = malloc((count + 1) * sizeof(struct dispatch))) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "malloc failed");
+		abort();  // FIXME
+	}
+	dispatch_count = 0;
+	for (cur = handlers; cur != NULL; cur = cur->next) {
+		for (oc = cur->object_classes; oc != NULL && *oc != NULL; oc++) {
+			dispatch[dispatch_count].object_class = *oc;
+			dispatch[dispatch_count].handler = cur;
+			dispatch_count++;
+		}
+	}
+	qsort(dispatch, dispatch_count, sizeof(struct dispatch), dispatch_compare);
+}
+
+/* mark all handlers whose filters may match the entry */
+static void dispatch_prepare(CacheEntry *entry) {
+	CacheEntryAttribute *attribute;
+	int i, lo, hi, mid;
+
+	if (dispatch_count < 0)
+		dispatch_build();
+	dispatch_generation++;
+	if (entry == NULL || (attribute = cache_entry_find_attribute(entry, "objectClass", 11)) == NULL)
+		return;
+
+	for (i = 0; i < attribute->value_count; i++) {
+		for (lo = 0, hi = dispatch_count; lo < hi;) {
+			mid = (lo + hi) / 2;
+			if (strcasecmp(dispatch[mid].object_class, attribute->values[i]) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; lo < dispatch_count && strcasecmp(dispatch[lo].object_class, attribute->values[i]) == 0; lo++)
+			dispatch[lo].handler->dispatch_mark = dispatch_generation;
+	}
+}
+
+/* return false if the handler neither needs the up-to-date check nor can match */
+static bool dispatch_candidate(Handler *handler, CacheEntry *old) {
+	return handler->object_classes == NULL || handler->dispatch_mark == dispatch_generation || cache_entry_module_present(old, handler->name);
+}
+
+
 static void insert_handler(Handler *handler) {
 	Handler **ptr = &handlers;
 
+	dispatch_count = -1;
+
 	while (*ptr && (*ptr)->priority <= handler->priority)
 		ptr = &((*ptr)->next);
 
@@ -220,9 +664,175 @@ static void insert_handler(Handler *handler) {
 }
 
 
+/* Each attribute any handler is interested in gets a bit, so the
+   up-to-date check of a handler is an AND of its mask with the mask of the
+   changed attributes. Names are interned, so they are compared by pointer. */
+#define MASK_BITS (8 * sizeof(unsigned long))
+static struct {
+	char **names;  /* open addressing by pointer, size is a power of 2 */
+	int *bits;
+	int size;
+	int count;
+} watched;
+
+static unsigned int watched_slot(const char *name) {
+	uintptr_t hash = (uintptr_t)name;
+
+	hash ^= hash >> 17;
+	hash *= 0xed5ad4bbU;
+	hash ^= hash >> 11;
+	return hash & (watched.size - 1);
+}
+
+/* return the bit of an interned attribute name, or -1 if no handler watches it */
+static int watched_bit(const char *name) {
+	unsigned int i;
+
+	if (watched.size == 0)
+		return -1;
+	for (i = watched_slot(name); watched.names[i] != NULL; i = (i + 1) & (watched.size - 1)) {
+		if (watched.names[i] == name)
+			return watched.bits[i];
+	}
+	return -1;
+}
+
+static void watched_insert(char *name, int bit) {
+	unsigned int i;
+
+	for (i = watched_slot(name); watched.names[i] != NULL; i = (i + 1) & (watched.size - 1))
+		;
+	watched.names[i] = name;
+	watched.bits[i] = bit;
+}
+
+static int watched_add(char *name) {
+	char **names;
+	int *bits, size, i, bit;
+
+	if ((bit = watched_bit(name)) >= 0)
+		return bit;
+
+	if (2 * (watched.count + 1) > watched.size) {
+		names = watched.names;
+		bits = watched.bits;
+		size = watched.size;
+		watched.size = size ? 2 * size : 64;
+		watched.names = calloc(watched.size, sizeof(char *));
+		watched.bits = calloc(watched.size, sizeof(int));
+		if (watched.names == NULL || watched.bits == NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "calloc failed");
+			abort();  // FIXME
+		}
+		for (i = 0; i < size; i++) {
+			if (names[i] != NULL)
+				watched_insert(names[i], bits[i]);
+		}
+		free(names);
+		free(bits);
+	}
+	watched_insert(name, watched.count);
+	return watched.count++;
+}
+
+/* precompile the attributes of a handler into a bit mask */
+static void handler_attribute_mask(Handler *handler) {
+	char **cur;
+	int bit;
+
+	for (cur = handler->attributes; cur != NULL && *cur != NULL; cur++) {
+		bit = watched_add(cache_entry_intern(*cur, strlen(*cur)));
+		if (bit / MASK_BITS >= handler->attribute_mask_words) {
+			int words = bit / MASK_BITS + 1;
+			handler->attribute_mask = realloc(handler->attribute_mask, words * sizeof(unsigned long));
+			if (handler->attribute_mask == NULL) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "realloc failed");
+				abort();  // FIXME
+			}
+			memset(handler->attribute_mask + handler->attribute_mask_words, 0, (words - handler->attribute_mask_words) * sizeof(unsigned long));
+			handler->attribute_mask_words = words;
+		}
+		handler->attribute_mask[bit / MASK_BITS] |= 1UL << (bit % MASK_BITS);
+	}
+}
+
+/* return the bit mask of the changed attributes; NULL if nothing changed */
+static unsigned long *changes_mask(char **changes) {
+	unsigned long *mask;
+	char **cur;
+	int bit;
+
+	if (changes == NULL)
+		return NULL;
+	if ((mask = calloc(watched.count / MASK_BITS + 1, sizeof(unsigned long))) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "calloc failed");
+		abort();  // FIXME
+	}
+	for (cur = changes; *cur != NULL; cur++) {
+		if ((bit = watched_bit(*cur)) >= 0)
+			mask[bit / MASK_BITS] |= 1UL << (bit % MASK_BITS);
+	}
+	return mask;
+}
+
+
+/* modifications of these attributes skip the backlog of the lanes, see lane.c;
+   a trailing '*' matches any attribute with the prefix */
+static const char *const urgent_attributes[] = {
+    "userPassword", "sambaNTPassword", "krb5Key", "krb5KDCFlags", "sambaAcctFlags",
+    "shadowExpire", "shadowLastChange", "pwdAccountLockedTime", "univentionLock*",
+};
+
+/* check if the changes lock an account or change its credentials */
+static bool changes_urgent(char **changes, char command) {
+	char **cur;
+	size_t i;
+
+	if (command != 'm' || changes == NULL || !tunables_get()->lane_urgent)
+		return false;
+	for (cur = changes; *cur != NULL; cur++) {
+		for (i = 0; i < sizeof(urgent_attributes) / sizeof(urgent_attributes[0]); i++) {
+			size_t len = strlen(urgent_attributes[i]);
+			if (urgent_attributes[i][len - 1] == '*' ? !strncasecmp(*cur, urgent_attributes[i], len - 1) : !strcasecmp(*cur, urgent_attributes[i]))
+				return true;
+		}
+	}
+	return false;
+}
+
+
 /* load handler and insert it into list of handlers */
+/* The listener/module/... UCR variables, read once for all modules loaded at once. */
+#define OVERRIDE_PREFIX "listener/module/"
+static struct {
+	char **keys;
+	char **values;
+	size_t count;
+} overrides;
+
+/* Return the value of listener/module/<@name>/<@option>, or NULL. */
+static const char *handler_override(const char *name, const char *option) {
+	size_t lo = 0, hi = overrides.count;
+	char key[PATH_MAX];
+
+	snprintf(key, sizeof(key), OVERRIDE_PREFIX "%s/%s", name, option);
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int cmp = strcmp(overrides.keys[mid], key);
+
+		if (cmp == 0)
+			return overrides.values[mid];
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return NULL;
+}
+
 static int handler_import(char *filename) {
-	char *filter, *error_msg = NULL;
+	char *filter, *error_msg = NULL, *end;
+	const char *override;
 	int num_filters = 0;
 	char state_filename[PATH_MAX];
 	FILE *state_fp;
@@ -265,6 +875,15 @@ static int handler_import(char *filename) {
 	} while(0);
 	PyErr_Clear(); // Silent error when attribute is not set
 
+	do { /* optional */
+		PyObject *var = PyObject_GetAttrString(handler->module, "postrun_interval");
+		if (!var)
+			break;
+		handler->postrun_interval = PyFloat_AsDouble(var);
+		Py_XDECREF(var);
+	} while(0);
+	PyErr_Clear(); // Silent error when attribute is not set
+
 	do { /* optional */
 		PyObject *var = PyObject_GetAttrString(handler->module, "handle_every_delete");
 		if (!var)
@@ -274,6 +893,57 @@ static int handler_import(char *filename) {
 	} while(0);
 	PyErr_Clear(); // Silent error when attribute is not set
 
+	do { /* optional */
+		PyObject *var = PyObject_GetAttrString(handler->module, "parallel");
+		if (!var)
+			break;
+		handler->parallel = PyObject_IsTrue(var) > 0;
+		Py_XDECREF(var);
+	} while(0);
+	PyErr_Clear(); // Silent error when attribute is not set
+
+	handler->delta = module_get_bool(handler->module, "delta"); /* optional */
+
+	handler->worker = module_get_string(handler->module, "worker"); /* optional */
+	if (handler->worker == NULL) {
+		PyErr_Clear();  // Silent error when attribute is not set
+	}
+
+	do { /* optional */
+		PyObject *var = PyObject_GetAttrString(handler->module, "lane");
+		if (!var)
+			break;
+		/* True for one lane, or the number of lanes for changes of different objects */
+		long lanes = PyLong_AsLong(var);
+		Py_XDECREF(var);
+		if (lanes == -1 && PyErr_Occurred())
+			break;
+		if (lanes < 0 || lanes > LANE_MAX) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s lane=%ld out of range", handler->name, lanes);
+			lanes = lanes < 0 ? 0 : LANE_MAX;
+		}
+		handler->lane = lanes;
+	} while(0);
+	PyErr_Clear(); // Silent error when attribute is not set
+	if ((override = handler_override(handler->name, "priority")) != NULL) {
+		double priority = strtod(override, &end);
+		if (end != override && !*end)
+			handler->priority = priority;
+		else
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s invalid priority override %s", handler->name, override);
+	}
+	if ((override = handler_override(handler->name, "lane")) != NULL) {
+		long lanes = strtol(override, &end, 10);
+		if (end != override && !*end && lanes >= 0 && lanes <= LANE_MAX)
+			handler->lane = lanes;
+		else
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s invalid lane override %s", handler->name, override);
+	}
+	if (handler->lane && !strcmp(handler->name, "replication")) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s may not use a lane", handler->name);
+		handler->lane = 0;
+	}
+
 	handler->description = module_get_string(handler->module, "description"); /* required */
 	if (handler->description == NULL) {
 		error_msg = "module_get_string(\"description\")";
@@ -294,6 +964,7 @@ static int handler_import(char *filename) {
 		handler->filters[0]->base = NULL;
 		handler->filters[0]->scope = LDAP_SCOPE_SUBTREE;
 		handler->filters[0]->filter = filter;
+		handler->filters[0]->node = filter_compile(filter);
 		num_filters++;
 		handler->filters[num_filters] = NULL;
 	} else {
@@ -304,8 +975,11 @@ static int handler_import(char *filename) {
 	if (handler->attributes == NULL) {
 		PyErr_Clear();  // Silent error when attribute is not set
 	}
+	handler_attribute_mask(handler);
+	handler->object_classes = cache_entry_ldap_filter_required(handler->filters, "objectClass");
 
 	handler->handler = module_get_object(handler->module, "handler");
+	handler->handler_batch = module_get_object(handler->module, "handler_batch");
 	handler->initialize = module_get_object(handler->module, "initialize");
 	handler->clean = module_get_object(handler->module, "clean");
 	handler->prerun = module_get_object(handler->module, "prerun");
@@ -338,6 +1012,7 @@ error:
 	Py_XDECREF(handler->prerun);
 	Py_XDECREF(handler->clean);
 	Py_XDECREF(handler->initialize);
+	Py_XDECREF(handler->handler_batch);
 	Py_XDECREF(handler->handler);
 	if (handler->attributes) {
 		char **c;
@@ -345,12 +1020,15 @@ error:
 			free(*c);
 		free(handler->attributes);
 	}
+	free(handler->attribute_mask);
 	while (num_filters-- > 0) {
 		free(handler->filters[num_filters]->filter);
+		filter_free(handler->filters[num_filters]->node);
 		free(handler->filters[num_filters]->base);
 		free(handler->filters[num_filters]);
 	}
 	free(handler->filters);
+	free(handler->worker);
 	free(handler->description);
 	free(handler->name);
 	free(handler);
@@ -383,7 +1061,9 @@ static int handler_postrun(Handler *handler) {
 	if (!handler->prepared)
 		return 0;
 	if (handler->postrun) {
+		handler_running = handler;
 		PyObject *result = PyObject_CallObject(handler->postrun, NULL);
+		handler_running = NULL;
 		drop_privileges();
 		if (result == NULL) {
 			PyErr_Print();
@@ -397,44 +1077,123 @@ static int handler_postrun(Handler *handler) {
 }
 
 
-/* run all postrun handlers. */
-int handlers_postrun_all(void) {
+/* Run the postrun handlers of the modules run since their last postrun.
+   Modules setting `postrun_interval` are postponed until that many seconds
+   have passed since their last postrun, unless `force` is set.
+   :returns: the seconds until the next postponed one is due, 0 if none is */
+int handlers_postrun_all(bool force) {
+	struct timespec ts;
+	double now, wait, next = 0;
 	Handler *cur;
 
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	now = ts.tv_sec + ts.tv_nsec / 1e9;
 	for (cur = handlers; cur != NULL; cur = cur->next) {
+		/* run by the lane process once it is idle */
+		if (cur->lane || (!cur->prepared && !cur->worker_pending))
+			continue;
+		if (!force && cur->postrun_last > 0 && (wait = cur->postrun_last + cur->postrun_interval - now) > 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "postrun handler: %s (postponed for %.0fs)", cur->name, wait);
+			if (next == 0 || wait < next)
+				next = wait;
+			continue;
+		}
 		handler_postrun(cur);
+		if (cur->worker_pending && worker_running(cur->worker)) {
+			int result;
+			if (worker_send(cur->worker, WORKER_POSTRUN, NULL, NULL, NULL, 0, &cur->name, 1) == 0)
+				worker_receive(cur->worker, &result, 1);
+		}
+		cur->worker_pending = false;
+		cur->postrun_last = now;
 	}
-	return 0;
+	return next > 0 ? (int)next + 1 : 0;
 }
 
 
-/* execute handler with arguments */
-static int handler_exec(Handler *handler, const char *dn, CacheEntry *new, CacheEntry *old, char command) {
-	PyObject *argtuple, *result;
-	int rv = 0;
-	char cmd[2];
+/* start the processes of all lanes, catching up on the changes spooled before */
+void handlers_start_lanes(void) {
+	Handler *cur;
 
+	for (cur = handlers; cur != NULL; cur = cur->next) {
+		if (cur->lane)
+			lane_start(cur->name, cur->lane);
+	}
+}
+
+
+/* check if the handler may be run */
+static bool handler_ready(Handler *handler) {
 	if ((handler->state & HANDLER_READY) != HANDLER_READY) {
 		if (INIT_ONLY) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s (not ready) (ignore)", handler->name);
 		} else {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s (not ready)", handler->name);
-			return 1;
+			return false;
 		}
 	}
+	return true;
+}
+
+
+/* add a call of the handler, which started at `start`, to its statistics */
+static void handler_account(Handler *handler, const struct timespec *start, bool failed) {
+	struct timespec now;
+	double elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	elapsed = (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+	handler->stats.calls++;
+	if (failed)
+		handler->stats.failures++;
+	handler->stats.time_total += elapsed;
+	if (elapsed > handler->stats.time_max)
+		handler->stats.time_max = elapsed;
+	metrics_histogram_observe(&handler->stats.time, elapsed);
+}
+
+
+/* execute handler with arguments */
+static int handler_exec(Handler *handler, const char *dn, struct entry_dicts *dicts, char command) {
+	PyObject *argtuple, *kwargs = NULL, *result;
+	struct timespec start;
+	size_t traced;
+	int rv = 0;
+	char cmd[2];
+
+	if (!handler_ready(handler))
+		return 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	PROBE3(handler_start, handler->name, dn, command);
 
 	if (handler->modrdn) {
 		cmd[0] = command;
 		cmd[1] = '\0';
-		argtuple = handlers_argtuple_command(dn, new, old, cmd);
+		argtuple = handlers_argtuple_command(dn, dicts, cmd);
 	} else {
-		argtuple = handlers_argtuple(dn, new, old);
+		argtuple = handlers_argtuple(dn, dicts);
+	}
+	if (handler->delta && argtuple != NULL) {
+		PyObject *delta = handlers_delta(dicts);
+		if (delta == NULL || (kwargs = PyDict_New()) == NULL || PyDict_SetItemString(kwargs, "delta", delta) != 0)
+			Py_CLEAR(argtuple);
 	}
 	handler_prerun(handler);
 
-	result = PyObject_CallObject(handler->handler, argtuple);
+	traced = tracing_begin();
+	handler_running = handler;
+	result = argtuple != NULL ? PyObject_Call(handler->handler, argtuple, kwargs) : NULL;
+	handler_running = NULL;
 	drop_privileges();
+	tracing_end(handler, traced);
+	if (argtuple != NULL) {
+		/* the handler may keep the mappings beyond the lifetime of the entries */
+		if (entrydict_detach(PyTuple_GetItem(argtuple, 1)) != 0 || entrydict_detach(PyTuple_GetItem(argtuple, 2)) != 0)
+			PyErr_Print();
+	}
 	Py_XDECREF(argtuple);
+	Py_XDECREF(kwargs);
 	if (result == NULL) {
 		PyErr_Print();
 		rv = -1;
@@ -442,6 +1201,8 @@ static int handler_exec(Handler *handler, const char *dn, CacheEntry *new, Cache
 		rv = result == Py_None ? 0 : 1;
 		Py_XDECREF(result);
 	}
+	handler_account(handler, &start, rv != 0);
+	PROBE2(handler_end, handler->name, rv);
 
 	return rv;
 }
@@ -453,6 +1214,12 @@ int handler_clean(Handler *handler) {
 
 	if (handler->clean == NULL)
 		return 0;
+	/* the worker is forked again with the new state of the module */
+	if (handler->worker != NULL)
+		worker_stop(handler->worker);
+	/* the module is set up from scratch, so the changes queued before are obsolete */
+	if (handler->lane)
+		lane_discard(handler->name);
 
 	result = PyObject_CallObject(handler->clean, NULL);
 	drop_privileges();
@@ -482,6 +1249,10 @@ int handler_initialize(Handler *handler) {
 
 	if (handler->initialize == NULL)
 		return 0;
+	if (handler->worker != NULL)
+		worker_stop(handler->worker);
+	if (handler->lane)
+		lane_stop(handler->name);
 	result = PyObject_CallObject(handler->initialize, NULL);
 	drop_privileges();
 	if (result == NULL) {
@@ -509,6 +1280,7 @@ int handlers_load_path(char *path) {
 	struct stat st;
 	int rv = 1;
 
+	overrides.count = univention_config_get_prefix(OVERRIDE_PREFIX, &overrides.keys, &overrides.values);
 	stat(path, &st);
 	if (S_ISDIR(st.st_mode)) {
 		DIR *dir;
@@ -530,13 +1302,80 @@ int handlers_load_path(char *path) {
 	} else if (S_ISREG(st.st_mode)) {
 		handler_import(path);
 	} else {
-		return 1;
+		rv = 1;
 	}
+	univention_config_free_prefix(overrides.keys, overrides.values, overrides.count);
+	memset(&overrides, 0, sizeof(overrides));
 
 	return rv;
 }
 
 
+/* Attributes fetched from LDAP: those of all modules, of their filters and of
+   the cache filter, or all if any module wants everything. */
+static char *all_attributes[] = {LDAP_ALL_USER_ATTRIBUTES, LDAP_ALL_OPERATIONAL_ATTRIBUTES, NULL};
+static const char *const projection_fixed[] = {"objectClass", "entryUUID", "entryCSN", "entryDN"};
+static char **projection;
+
+static void projection_add(char ***names, int *count, const char *name) {
+	int i;
+
+	for (i = 0; i < *count; i++) {
+		if (!strcasecmp((*names)[i], name))
+			return;
+	}
+	if ((*names = realloc(*names, (*count + 2) * sizeof(char *))) == NULL)
+		abort();  // FIXME
+	if (((*names)[(*count)++] = strdup(name)) == NULL)
+		abort();  // FIXME
+	(*names)[*count] = NULL;
+}
+
+static void projection_free(char **names) {
+	char **cur;
+
+	for (cur = names; cur != NULL && *cur != NULL; cur++)
+		free(*cur);
+	free(names);
+}
+
+static void handlers_update_projection(void) {
+	Handler *handler;
+	char **names = NULL, **cur;
+	int count = 0;
+	size_t i;
+
+	projection_free(projection);
+	projection = NULL;
+	if (!tunables_get()->cache_projection)
+		return;
+
+	for (handler = handlers; handler != NULL; handler = handler->next) {
+		if (handler->attributes == NULL || handler->attributes[0] == NULL) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler %s needs all attributes", handler->name);
+			projection_free(names);
+			return;
+		}
+		for (cur = handler->attributes; *cur != NULL; cur++)
+			projection_add(&names, &count, *cur);
+	}
+	for (handler = handlers; handler != NULL; handler = handler->next)
+		cache_entry_ldap_filter_attributes(handler->filters, &names, &count);
+	cache_filter_attributes(&names, &count);
+	for (i = 0; i < sizeof(projection_fixed) / sizeof(projection_fixed[0]); i++)
+		projection_add(&names, &count, projection_fixed[i]);
+
+	projection = names;
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "fetching %d attributes from LDAP", count);
+}
+
+
+/* return the attributes to request from LDAP for the modules */
+char **handlers_projection(void) {
+	return projection != NULL ? projection : all_attributes;
+}
+
+
 /* Load handlers from all directories. */
 static int handlers_load_all_paths(void) {
 	char **module_dir;
@@ -544,6 +1383,12 @@ static int handlers_load_all_paths(void) {
 	for (module_dir = module_dirs; module_dir != NULL && *module_dir != NULL; module_dir++) {
 		handlers_load_path(*module_dir);
 	}
+	handlers_update_projection();
+	/* the modules live until the next reload, so the collector needn't look at them */
+	gc_configure();
+	tracing_configure();
+	gc_call("collect", NULL);
+	gc_call("freeze", NULL);
 
 	return 0;
 }
@@ -568,6 +1413,68 @@ void handler_write_state(Handler *handler) {
 		if (rv != 0)
 			abort_io("close", state_filename);
 	}
+	handler_write_stats(handler);
+}
+
+
+/* write the statistics of the handler next to its state, for monitoring */
+void handler_write_stats(Handler *handler) {
+	char stats_filename[PATH_MAX], tmp_filename[PATH_MAX];
+	struct lane_status lane = {0};
+	FILE *stats_fp;
+	int rv;
+
+	rv = snprintf(stats_filename, PATH_MAX, "%s/handlers/%s.stats", cache_dir, handler->name);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	rv = snprintf(tmp_filename, PATH_MAX, "%s.new", stats_filename);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	stats_fp = fopen(tmp_filename, "w");
+	if (stats_fp == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not open %s", tmp_filename);
+		return;
+	}
+	fprintf(stats_fp,
+	        "calls %lu\n"
+	        "failures %lu\n"
+	        "filter_misses %lu\n"
+	        "time_total %.6f\n"
+	        "time_max %.6f\n"
+	        "gc_time %.6f\n",
+	        handler->stats.calls, handler->stats.failures, handler->stats.filter_misses, handler->stats.time_total, handler->stats.time_max, handler->stats.gc_time);
+	if (tracing.get_traced_memory != NULL)
+		fprintf(stats_fp,
+		        "py_retained %ld\n"
+		        "py_peak %zu\n",
+		        handler->stats.py_retained, handler->stats.py_peak);
+	if (handler->lane && lane_status(handler->name, &lane) == 0) {
+		/* the lag only counts while changes are waiting */
+		fprintf(stats_fp,
+		        "lane_id %lu\n"
+		        "lane_lag %lu\n"
+		        "lane_pending_bytes %lu\n",
+		        lane.id, lane.pending > 0 && cache_master_entry.id > lane.id ? cache_master_entry.id - lane.id : 0, lane.pending);
+	}
+	rv = fclose(stats_fp);
+	if (rv != 0)
+		abort_io("close", tmp_filename);
+	if (rename(tmp_filename, stats_filename) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not rename %s: %s", tmp_filename, strerror(errno));
+}
+
+
+/* log and write the statistics of all handlers */
+void handlers_dump_stats(void) {
+	Handler *handler;
+
+	for (handler = handlers; handler != NULL; handler = handler->next) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s calls=%lu failures=%lu filter_misses=%lu time_total=%.3f time_max=%.3f gc_time=%.3f py_retained=%ld py_peak=%zu",
+		                 handler->name, handler->stats.calls, handler->stats.failures, handler->stats.filter_misses, handler->stats.time_total, handler->stats.time_max, handler->stats.gc_time, handler->stats.py_retained, handler->stats.py_peak);
+		handler_write_stats(handler);
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "gc: collections=%lu time_total=%.3f (outside of handlers)", gc_policy.collections, gc_policy.time_total);
+	memory_log();
 }
 
 
@@ -588,14 +1495,21 @@ int handler_free(Handler *handler) {
 	for (f = handler->filters; f != NULL && *f != NULL; f++) {
 		free((*f)->base);
 		free((*f)->filter);
+		filter_free((*f)->node);
 		free(*f);
 	}
 	free(handler->filters);
 	for (a = handler->attributes; a != NULL && *a != NULL; a++)
 		free(*a);
 	free(handler->attributes);
+	free(handler->attribute_mask);
+	free(handler->worker);
+	for (a = handler->object_classes; a != NULL && *a != NULL; a++)
+		free(*a);
+	free(handler->object_classes);
 	Py_XDECREF(handler->module);
 	Py_XDECREF(handler->handler);
+	Py_XDECREF(handler->handler_batch);
 	Py_XDECREF(handler->initialize);
 	Py_XDECREF(handler->clean);
 	Py_XDECREF(handler->prerun);
@@ -609,6 +1523,10 @@ int handler_free(Handler *handler) {
 int handlers_free_all(void) {
 	Handler *cur;
 
+	dispatch_count = -1;
+	worker_stop_all();
+	lane_stop_all();
+	gc_call("unfreeze", NULL);
 	while (handlers != NULL) {
 		cur = handlers;
 		handlers = handlers->next;
@@ -634,46 +1552,100 @@ int handlers_init(void) {
 	Py_OptimizeFlag++;
 	Py_UnbufferedStdioFlag++;
 	Py_Initialize();
+	if (entrydict_init() != 0)
+		PyErr_Print();
+	gc_init();
+	worker_init(handlers_worker_started, handler_worker_run, handler_worker_postrun);
+	lane_init(handlers_worker_started, handler_worker_run, handler_worker_postrun);
 	handlers_load_all_paths();
 	return 0;
 }
 
 
-/* convert our C entry structure into a Python dictionary */
-static PyObject *handlers_entrydict(CacheEntry *entry) {
-	PyObject *entrydict;
-	PyObject *valuelist, *s;
-	int i, j;
+/* create the dicts caching the converted values for all handlers */
+static void handlers_entrydicts_shared(struct entry_dicts *dicts) {
+	if (dicts->new_dict == NULL)
+		dicts->new_dict = PyDict_New();
+	if (dicts->old_dict == NULL)
+		dicts->old_dict = PyDict_New();
+}
 
-	if ((entrydict = PyDict_New()) == NULL)
-		return NULL;
 
-	if (entry == NULL)
-		return entrydict;
+/* return lazy mappings of the entries, sharing the converted values */
+static void handlers_entrydicts(struct entry_dicts *dicts, PyObject **newdict, PyObject **olddict) {
+	handlers_entrydicts_shared(dicts);
+	*newdict = entrydict_new(dicts->new, dicts->new_dict);
+	*olddict = entrydict_new(dicts->old, dicts->old_dict);
+}
+
 
-	for (i = 0; i < entry->attribute_count; i++) {
-		/* make value list */
-		if ((valuelist = PyList_New(entry->attributes[i]->value_count)) == NULL) {
-			Py_XDECREF(entrydict);
+/* return a list of the values of ATTRIBUTE with the given indices */
+static PyObject *delta_values(CacheEntryAttribute *attribute, int *indices, int count) {
+	PyObject *values, *value;
+	int i;
+
+	if ((values = PyList_New(count)) == NULL)
+		return NULL;
+	for (i = 0; i < count; i++) {
+		if ((value = PyBytes_FromStringAndSize(attribute->values[indices[i]], attribute->length[indices[i]] - 1)) == NULL) {
+			Py_DECREF(values);
 			return NULL;
 		}
-		s = PyString_FromString(entry->attributes[i]->name);
+		PyList_SET_ITEM(values, i, value);
+	}
+	return values;
+}
 
-		for (j = 0; j < entry->attributes[i]->value_count; j++) {
-			PyList_SetItem(valuelist, j, PyString_FromStringAndSize(entry->attributes[i]->values[j], entry->attributes[i]->length[j] - 1));
-		}
 
-		PyDict_SetItem(entrydict, s, valuelist);
-		Py_XDECREF(s);
-		Py_XDECREF(valuelist);
+/* Return the mapping passed as `delta` to the modules setting `delta = True`:
+   the name of each changed attribute maps to a tuple of the lists of its
+   added and removed values, computed once per transaction. Returns a borrowed
+   reference, or NULL with an exception set. */
+static PyObject *handlers_delta(struct entry_dicts *dicts) {
+	static CacheEntry empty;
+	CacheEntryAttributeDelta *deltas;
+	PyObject *delta;
+	int i, count;
+
+	if (dicts->delta != NULL)
+		return dicts->delta;
+
+	if ((delta = PyDict_New()) == NULL)
+		return NULL;
+	deltas = cache_entry_delta(dicts->new ? dicts->new : &empty, dicts->old ? dicts->old : &empty, &count);
+	for (i = 0; i < count; i++) {
+		CacheEntryAttributeDelta *d = &deltas[i];
+		PyObject *added = delta_values(d->new, d->added, d->added_count);
+		PyObject *removed = delta_values(d->old, d->removed, d->removed_count);
+		PyObject *change = added && removed ? PyTuple_Pack(2, added, removed) : NULL;
+		int rv = change ? PyDict_SetItemString(delta, (d->new ? d->new : d->old)->name, change) : -1;
+
+		Py_XDECREF(added);
+		Py_XDECREF(removed);
+		Py_XDECREF(change);
+		if (rv != 0) {
+			Py_CLEAR(delta);
+			break;
+		}
 	}
+	cache_entry_free_delta(deltas, count);
 
-	return entrydict;
+	dicts->delta = delta;
+	return delta;
+}
+
+
+/* release the values shared by the handlers of one transaction */
+static void handlers_entrydicts_free(struct entry_dicts *dicts) {
+	Py_XDECREF(dicts->new_dict);
+	Py_XDECREF(dicts->old_dict);
+	Py_XDECREF(dicts->delta);
+	dicts->new_dict = dicts->old_dict = dicts->delta = NULL;
 }
 
 
 /* build Python argument tuple for handler */
-static PyObject *handlers_argtuple(const char *dn, CacheEntry *new, CacheEntry *old) {
+static PyObject *handlers_argtuple(const char *dn, struct entry_dicts *dicts) {
 	PyObject *argtuple;
 	PyObject *newdict;
 	PyObject *olddict;
@@ -681,8 +1653,7 @@ static PyObject *handlers_argtuple(const char *dn, CacheEntry *new, CacheEntry *
 	/* make argument list */
 	if ((argtuple = PyTuple_New(3)) == NULL)
 		return NULL;
-	newdict = handlers_entrydict(new);
-	olddict = handlers_entrydict(old);
+	handlers_entrydicts(dicts, &newdict, &olddict);
 
 	/* PyTuple_SetItem steals a reference. Thus there's no need to
 	   DECREF the objects */
@@ -695,7 +1666,7 @@ static PyObject *handlers_argtuple(const char *dn, CacheEntry *new, CacheEntry *
 
 
 /* build Python argument tuple for handler with mod_rdn enabled. */
-static PyObject *handlers_argtuple_command(const char *dn, CacheEntry *new, CacheEntry *old, char *command) {
+static PyObject *handlers_argtuple_command(const char *dn, struct entry_dicts *dicts, char *command) {
 	PyObject *argtuple;
 	PyObject *newdict;
 	PyObject *olddict;
@@ -703,8 +1674,7 @@ static PyObject *handlers_argtuple_command(const char *dn, CacheEntry *new, Cach
 	/* make argument list */
 	if ((argtuple = PyTuple_New(4)) == NULL)
 		return NULL;
-	newdict = handlers_entrydict(new);
-	olddict = handlers_entrydict(old);
+	handlers_entrydicts(dicts, &newdict, &olddict);
 
 	/* PyTuple_SetItem steals a reference. Thus there's no need to
 	   DECREF the objects */
@@ -717,25 +1687,248 @@ static PyObject *handlers_argtuple_command(const char *dn, CacheEntry *new, Cach
 }
 
 
-/* return boolean indicating whether attribute has changed */
-static int attribute_has_changed(char **changes, char *attribute) {
-	char **cur;
+/* Handlers declaring `parallel = True` don't depend on the other modules.
+   Instead of running them in turn, they are collected while the others run
+   and are then run concurrently, each in a thread of its own. The GIL is
+   released whenever a handler blocks, e.g. on a sub-process or the network,
+   so that slow modules don't hold up each other. Handlers declaring a
+   `worker` group are collected as well and are run by the worker process of
+   their group meanwhile, see worker.c. All of them are waited for before the
+   next transaction is processed, which keeps the order of the changes per
+   module. */
+struct parallel_job {
+	struct parallel *parallel;
+	Handler *handler;
+	pthread_t thread;
+	bool started; /* in a thread or by a worker process */
+	int rv;
+};
+
+struct parallel {
+	const char *dn;
+	struct entry_dicts *dicts;
+	char command;
+	bool urgent; /* see changes_urgent() */
+	struct timespec start; /* of the worker requests */
+	struct parallel_job *jobs;
+	int count;
+	int size;
+};
+
+
+/* queue handler to be run by handlers_run_parallel() */
+static void handler_queue_parallel(struct parallel *parallel, Handler *handler) {
+	if (parallel->count == parallel->size) {
+		parallel->size = parallel->size ? parallel->size * 2 : 8;
+		parallel->jobs = realloc(parallel->jobs, parallel->size * sizeof(struct parallel_job));
+		if (parallel->jobs == NULL)
+			abort();  // FIXME
+	}
+	memset(&parallel->jobs[parallel->count], 0, sizeof(struct parallel_job));
+	parallel->jobs[parallel->count].parallel = parallel;
+	parallel->jobs[parallel->count++].handler = handler;
+	/* prerun may change privileges, which are shared by all threads */
+	if (handler->worker == NULL)
+		handler_prerun(handler);
+}
 
-	for (cur = changes; cur != NULL && *cur != NULL; cur++) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "%s ? %s", *cur, attribute);
-		if (strcmp(*cur, attribute) == 0)
-			return 1;
+
+static void *handler_thread(void *arg) {
+	struct parallel_job *job = arg;
+	PyGILState_STATE gstate;
+
+	gstate = PyGILState_Ensure();
+	job->rv = handler_exec(job->handler, job->parallel->dn, job->parallel->dicts, job->parallel->command);
+	PyGILState_Release(gstate);
+
+	return NULL;
+}
+
+
+/* return the queued jobs of the worker group of job `first`, if it is the first one of the group */
+static int parallel_group(struct parallel *parallel, int first, struct parallel_job **group) {
+	const char *worker = parallel->jobs[first].handler->worker;
+	int i, count = 0;
+
+	if (worker == NULL)
+		return 0;
+	for (i = 0; i < parallel->count; i++) {
+		if (parallel->jobs[i].handler->worker == NULL || strcmp(parallel->jobs[i].handler->worker, worker))
+			continue;
+		if (i < first)
+			return 0;
+		group[count++] = &parallel->jobs[i];
 	}
+	return count;
+}
 
-	return 0;
+
+/* send one request per worker group */
+static void handlers_send_workers(struct parallel *parallel) {
+	struct parallel_job **group;
+	char **modules;
+	int i, j, count;
+
+	if ((group = malloc(parallel->count * sizeof(struct parallel_job *))) == NULL || (modules = malloc(parallel->count * sizeof(char *))) == NULL)
+		abort();  // FIXME
+	clock_gettime(CLOCK_MONOTONIC, &parallel->start);
+	for (i = 0; i < parallel->count; i++) {
+		if ((count = parallel_group(parallel, i, group)) == 0)
+			continue;
+		for (j = 0; j < count; j++)
+			modules[j] = group[j]->handler->name;
+		if (worker_send(group[0]->handler->worker, WORKER_RUN, parallel->dn, parallel->dicts->new, parallel->dicts->old, parallel->command, modules, count) != 0) {
+			for (j = 0; j < count; j++) {
+				group[j]->rv = -1;
+				group[j]->handler->stats.failures++;
+			}
+			continue;
+		}
+		for (j = 0; j < count; j++) {
+			group[j]->started = true;
+			group[j]->handler->worker_pending = true;
+		}
+	}
+	free(modules);
+	free(group);
 }
 
 
-/* a little more low-level interface than handler_update */
-static int handler__update(Handler *handler, const char *dn, CacheEntry *new, CacheEntry *old, char command, char **changes) {
-	int matched;
-	int rv = 0;
+/* collect the results of handlers_send_workers() */
+static void handlers_receive_workers(struct parallel *parallel) {
+	struct parallel_job **group;
+	int *results;
+	int i, j, count;
+
+	if ((group = malloc(parallel->count * sizeof(struct parallel_job *))) == NULL || (results = malloc(parallel->count * sizeof(int))) == NULL)
+		abort();  // FIXME
+	for (i = 0; i < parallel->count; i++) {
+		if ((count = parallel_group(parallel, i, group)) == 0 || !group[0]->started)
+			continue;
+		if (worker_receive(group[0]->handler->worker, results, count) != 0) {
+			for (j = 0; j < count; j++)
+				results[j] = -1;
+		}
+		/* the time includes waiting for the other modules of the group */
+		for (j = 0; j < count; j++) {
+			group[j]->rv = results[j];
+			handler_account(group[j]->handler, &parallel->start, results[j] != 0);
+		}
+	}
+	free(results);
+	free(group);
+}
+
+
+/* run the queued handlers concurrently and wait for all of them */
+static void handlers_run_parallel(struct parallel *parallel) {
+	sigset_t all, old;
+	int i, threads = 0;
+
+	if (parallel->count == 0)
+		return;
+
+	handlers_send_workers(parallel);
+	for (i = 0; i < parallel->count; i++) {
+		if (parallel->jobs[i].handler->worker == NULL)
+			threads++;
+	}
+
+	if (threads > 1) {
+		/* don't race on creating the shared values */
+		handlers_entrydicts_shared(parallel->dicts);
+		for (i = 0; i < parallel->count; i++) {
+			if (parallel->jobs[i].handler->worker == NULL && parallel->jobs[i].handler->delta && handlers_delta(parallel->dicts) == NULL) {
+				PyErr_Print();
+				break;
+			}
+		}
+		/* signals are handled by the main thread only */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		for (i = 0; i < parallel->count; i++) {
+			if (parallel->jobs[i].handler->worker != NULL)
+				continue;
+			parallel->jobs[i].started = pthread_create(&parallel->jobs[i].thread, NULL, handler_thread, &parallel->jobs[i]) == 0;
+			if (!parallel->jobs[i].started)
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s (no thread, running serially)", parallel->jobs[i].handler->name);
+		}
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+		Py_BEGIN_ALLOW_THREADS;
+		for (i = 0; i < parallel->count; i++) {
+			if (parallel->jobs[i].handler->worker == NULL && parallel->jobs[i].started)
+				pthread_join(parallel->jobs[i].thread, NULL);
+		}
+		Py_END_ALLOW_THREADS;
+	}
+
+	for (i = 0; i < parallel->count; i++) {
+		if (parallel->jobs[i].handler->worker == NULL && !parallel->jobs[i].started)
+			parallel->jobs[i].rv = handler_exec(parallel->jobs[i].handler, parallel->dn, parallel->dicts, parallel->command);
+	}
+	drop_privileges();
+
+	handlers_receive_workers(parallel);
+}
+
+
+/* worker and lane process callbacks, see worker.c and lane.c */
+static void handlers_worker_started(void) {
+	Handler *handler;
+
+	/* prerun and postrun of the listener don't apply to this process */
+	for (handler = handlers; handler != NULL; handler = handler->next)
+		handler->prepared = 0;
+	/* nothing calls handlers_gc() here */
+	if (gc_policy.deferred)
+		gc_call("enable", NULL);
+}
+
+
+static Handler *handler_find(const char *name) {
+	Handler *handler;
+
+	for (handler = handlers; handler != NULL; handler = handler->next) {
+		if (!strcmp(handler->name, name))
+			return handler;
+	}
+	return NULL;
+}
+
+
+static int handler_worker_run(const char *module, const char *dn, CacheEntry *new, CacheEntry *old, char command) {
+	struct entry_dicts dicts = {new, old, NULL, NULL};
+	Handler *handler;
+	int rv;
+
+	if ((handler = handler_find(module)) == NULL)
+		return -1;
+	rv = handler_exec(handler, dn, &dicts, command);
+	handlers_entrydicts_free(&dicts);
+
+	return rv;
+}
+
+
+static int handler_worker_postrun(const char *module) {
+	Handler *handler;
+
+	if ((handler = handler_find(module)) == NULL)
+		return -1;
+	return handler_postrun(handler);
+}
+
+
+enum handler_decision {
+	HANDLER_SKIP,
+	HANDLER_UP_TO_DATE,
+	HANDLER_RUN,
+};
+
 
+/* check if the handler needs to be run for the object */
+static enum handler_decision handler__consider(Handler *handler, const char *dn, CacheEntry *new, CacheEntry *old, unsigned long *changes) {
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "handler: %s considered", handler->name);
 
 	/* check if attributes for handler have changed
@@ -744,18 +1937,19 @@ static int handler__update(Handler *handler, const char *dn, CacheEntry *new, Ca
 	   especially if we have an incomplete cache
 	*/
 	if ((strcmp(handler->name, "replication")) && cache_entry_module_present(old, handler->name)) {
-		char **cur;
+		int i;
 		bool uptodate = false;
 
 		if (changes == NULL) {
 			uptodate = true;
 			goto up_to_date;
 		}
-		for (cur = handler->attributes; cur != NULL && *cur != NULL; cur++) {
-			if (attribute_has_changed(changes, *cur))
+		/* handlers without attributes are interested in all changes */
+		for (i = 0; i < handler->attribute_mask_words; i++) {
+			if (handler->attribute_mask[i] & changes[i])
 				break;
 		}
-		if (cur != NULL && *cur == NULL && handler->attributes != NULL && *handler->attributes != NULL) {
+		if (handler->attribute_mask_words > 0 && i == handler->attribute_mask_words) {
 			uptodate = true;
 			goto up_to_date;
 		}
@@ -763,20 +1957,49 @@ static int handler__update(Handler *handler, const char *dn, CacheEntry *new, Ca
 	up_to_date:
 		if (uptodate) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (up-to-date)", handler->name);
-			cache_entry_module_add(new, handler->name);
-			return 0;
+			return HANDLER_UP_TO_DATE;
 		}
 	}
 
 	/* check if the handler's search filter matches */
-	matched = cache_entry_ldap_filter_match(handler->filters, dn, new);
-	if (!matched) {
+	if (!cache_entry_ldap_filter_match(handler->filters, dn, new)) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "handler: %s (filter doesn't match)", handler->name);
+		handler->stats.filter_misses++;
+		return HANDLER_SKIP;
+	}
+
+	return HANDLER_RUN;
+}
+
+
+/* a little more low-level interface than handler_update */
+static int handler__update(Handler *handler, const char *dn, CacheEntry *new, CacheEntry *old, char command, unsigned long *changes, struct entry_dicts *dicts, struct parallel *parallel) {
+	int rv = 0;
+
+	switch (handler__consider(handler, dn, new, old, changes)) {
+	case HANDLER_UP_TO_DATE:
+		cache_entry_module_add(new, handler->name);
+		return 0;
+	case HANDLER_SKIP:
+		return 0;
+	case HANDLER_RUN:
+		break;
+	}
+
+	if (parallel != NULL && handler->lane) {
+		if (lane_append(handler->name, handler->lane, dn, new, old, command, parallel->urgent) != 0)
+			return 1;
+		cache_entry_module_add(new, handler->name);
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (queued)", handler->name);
+		return 0;
+	}
+	if (parallel != NULL && (handler->parallel || handler->worker != NULL)) {
+		handler_queue_parallel(parallel, handler);
 		return 0;
 	}
 
 	/* run handler */
-	if (handler_exec(handler, dn, new, old, command) == 0) {
+	if (handler_exec(handler, dn, dicts, command) == 0) {
 		cache_entry_module_add(new, handler->name);
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (successful)", handler->name);
 	} else {
@@ -791,24 +2014,48 @@ static int handler__update(Handler *handler, const char *dn, CacheEntry *new, Ca
 /* run all handlers if object has changed */
 int handlers_update(const char *dn, CacheEntry *new, CacheEntry *old, char command) {
 	Handler *handler;
-	char **changes;
-	int rv = 0;
+	char **changed;
+	unsigned long *changes;
+	struct entry_dicts dicts = {new, old, NULL, NULL};
+	struct parallel parallel = {dn, &dicts, command};
+	double start;
+	int i, rv = 0;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "running handlers for %s", dn);
+	start = metrics_monotonic();
 
-	changes = cache_entry_changed_attributes(new, old);
+	changed = cache_entry_changed_attributes(new, old);
+	changes = changes_mask(changed);
+	parallel.urgent = changes_urgent(changed, command);
+	free(changed);
 
+	dispatch_prepare(new);
+	/* the handlers only add themselves to the modules of the entry */
+	filter_memo_begin(new);
 	for (handler = handlers; handler != NULL; handler = handler->next) {
-		if (!strcmp(handler->name, "replication")) {
-			handler__update(handler, dn, new, old, command, changes);
+		if (!strcmp(handler->name, "replication") && dispatch_candidate(handler, old)) {
+			handler__update(handler, dn, new, old, command, changes, &dicts, NULL);
 		}
 	}
 	for (handler = handlers; handler != NULL; handler = handler->next) {
-		if (strcmp(handler->name, "replication")) {
-			handler__update(handler, dn, new, old, command, changes);
+		if (strcmp(handler->name, "replication") && dispatch_candidate(handler, old)) {
+			handler__update(handler, dn, new, old, command, changes, &dicts, &parallel);
+		}
+	}
+	filter_memo_end();
+	handlers_run_parallel(&parallel);
+	for (i = 0; i < parallel.count; i++) {
+		if (parallel.jobs[i].rv == 0) {
+			cache_entry_module_add(new, parallel.jobs[i].handler->name);
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (successful)", parallel.jobs[i].handler->name);
+		} else {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s (failed)", parallel.jobs[i].handler->name);
 		}
 	}
+	free(parallel.jobs);
+	handlers_entrydicts_free(&dicts);
 	free(changes);
+	metrics_observe(METRICS_HANDLERS, metrics_monotonic() - start);
 
 	return rv;
 }
@@ -816,35 +2063,191 @@ int handlers_update(const char *dn, CacheEntry *new, CacheEntry *old, char comma
 
 /* run given handler if object has changed */
 int handler_update(const char *dn, CacheEntry *new, CacheEntry *old, Handler *handler, char command) {
-	char **changes;
+	char **changed;
+	unsigned long *changes;
+	struct entry_dicts dicts = {new, old, NULL, NULL};
 	int rv = 0;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "running handlers [%s] for %s", handler->name, dn);
 
-	changes = cache_entry_changed_attributes(new, old);
+	changed = cache_entry_changed_attributes(new, old);
+	changes = changes_mask(changed);
+	free(changed);
 
-	rv = handler__update(handler, dn, new, old, command, changes);
+	rv = handler__update(handler, dn, new, old, command, changes, &dicts, NULL);
 
+	handlers_entrydicts_free(&dicts);
 	free(changes);
 
 	return rv;
 }
 
 
-/* run handlers if object has been deleted */
-int handlers_delete(const char *dn, CacheEntry *old, char command) {
+/* Run given handler for several objects in order. If the module defines
+   handler_batch(changes), it is called once with a list of the argument
+   tuples `handler` would be called with. It returns None if all changes
+   were handled successfully, or a sequence with one result per change,
+   each None on success. Otherwise handler_update() is run per object. */
+int handler_update_batch(Handler *handler, int count, char **dns, CacheEntry *new, CacheEntry *old, char command) {
+	struct entry_dicts *dicts;
+	PyObject *changes = NULL, *argtuple = NULL, *result = NULL, *results = NULL;
+	struct timespec start;
+	size_t traced;
+	char cmd[2] = {command, '\0'};
+	int *run, i, j, n = 0, rv = 0;
+
+	if (handler->handler_batch == NULL) {
+		for (i = 0; i < count; i++)
+			rv |= handler_update(dns[i], &new[i], &old[i], handler, command);
+		return rv;
+	}
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "running batch handler [%s] for %d objects", handler->name, count);
+
+	if ((dicts = calloc(count, sizeof(struct entry_dicts))) == NULL || (run = malloc(count * sizeof(int))) == NULL)
+		abort();  // FIXME
+	for (i = 0; i < count; i++) {
+		char **changed = cache_entry_changed_attributes(&new[i], &old[i]);
+		unsigned long *changes_i = changes_mask(changed);
+		free(changed);
+		switch (handler__consider(handler, dns[i], &new[i], &old[i], changes_i)) {
+		case HANDLER_UP_TO_DATE:
+			cache_entry_module_add(&new[i], handler->name);
+			break;
+		case HANDLER_RUN:
+			run[n++] = i;
+			break;
+		case HANDLER_SKIP:
+			break;
+		}
+		free(changes_i);
+	}
+	if (n == 0)
+		goto out;
+	if (!handler_ready(handler)) {
+		rv = 1;
+		goto out;
+	}
+
+	if ((changes = PyList_New(n)) == NULL)
+		goto error;
+	for (j = 0; j < n; j++) {
+		PyObject *change;
+
+		i = run[j];
+		dicts[i].new = &new[i];
+		dicts[i].old = &old[i];
+		change = handler->modrdn ? handlers_argtuple_command(dns[i], &dicts[i], cmd) : handlers_argtuple(dns[i], &dicts[i]);
+		if (change == NULL)
+			goto error;
+		PyList_SET_ITEM(changes, j, change);
+	}
+	if ((argtuple = PyTuple_Pack(1, changes)) == NULL)
+		goto error;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	handler_prerun(handler);
+	traced = tracing_begin();
+	handler_running = handler;
+	result = PyObject_CallObject(handler->handler_batch, argtuple);
+	handler_running = NULL;
+	drop_privileges();
+	tracing_end(handler, traced);
+	handler_account(handler, &start, false);
+	for (j = 0; j < n; j++) {
+		/* the handler may keep the mappings beyond the lifetime of the entries */
+		PyObject *change = PyList_GET_ITEM(changes, j);
+		if (entrydict_detach(PyTuple_GetItem(change, 1)) != 0 || entrydict_detach(PyTuple_GetItem(change, 2)) != 0)
+			PyErr_Print();
+	}
+	if (result == NULL)
+		goto error;
+	if (result != Py_None) {
+		if ((results = PySequence_Fast(result, "handler_batch() must return None or a sequence")) == NULL)
+			goto error;
+		if (PySequence_Fast_GET_SIZE(results) != n) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "handler: %s returned %zd results for %d changes", handler->name, PySequence_Fast_GET_SIZE(results), n);
+			goto failed;
+		}
+	}
+
+	for (j = 0; j < n; j++) {
+		i = run[j];
+		if (results == NULL || PySequence_Fast_GET_ITEM(results, j) == Py_None) {
+			cache_entry_module_add(&new[i], handler->name);
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (successful) for %s", handler->name, dns[i]);
+		} else {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s (failed) for %s", handler->name, dns[i]);
+			handler->stats.failures++;
+			rv = 1;
+		}
+	}
+	goto out;
+
+error:
+	PyErr_Print();
+failed:
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s (failed) for %d objects", handler->name, n);
+	handler->stats.failures += n;
+	rv = 1;
+out:
+	Py_XDECREF(results);
+	Py_XDECREF(result);
+	Py_XDECREF(argtuple);
+	Py_XDECREF(changes);
+	for (i = 0; i < count; i++)
+		handlers_entrydicts_free(&dicts[i]);
+	free(run);
+	free(dicts);
+
+	return rv;
+}
+
+
+/* check if the handler is called for the deletion of the object */
+static bool handler_deletes(Handler *handler, CacheEntry *old) {
+	/* run the replication handler in any case, see Bug #29475 */
+	return cache_entry_module_present(old, handler->name) || !strcmp(handler->name, "replication") || handler->handle_every_delete;
+}
+
+
+/* modules called once for many deleted objects, see handlers_delete_batch() */
+static bool handler_deletes_batch(Handler *handler) {
+	return handler->handler_batch != NULL && !handler->lane && !handler->parallel && handler->worker == NULL;
+}
+
+
+static int handlers__delete(const char *dn, CacheEntry *old, char command, bool batch) {
 	Handler *handler;
-	int rv = 0;
+	struct entry_dicts dicts = {NULL, old, NULL, NULL};
+	struct parallel parallel = {dn, &dicts, command};
+	double start;
+	int i, rv = 0;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "delete handlers for %s", dn);
+	start = metrics_monotonic();
 
 	for (handler = handlers; handler != NULL; handler = handler->next) {
-		/* run the replication handler in any case, see Bug #29475 */
-		if (!cache_entry_module_present(old, handler->name) && strcmp(handler->name, "replication") && !handler->handle_every_delete) {
+		if (batch && handler_deletes_batch(handler))
+			continue;
+		if (!handler_deletes(handler, old)) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (skipped)", handler->name);
 			continue;
 		}
-		if (handler_exec(handler, dn, NULL, old, command) == 0) {
+		if (handler->lane) {
+			if (lane_append(handler->name, handler->lane, dn, NULL, old, command, false) == 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (queued)", handler->name);
+				cache_entry_module_remove(old, handler->name);
+			} else {
+				rv = 1;
+			}
+			continue;
+		}
+		if ((handler->parallel || handler->worker != NULL) && strcmp(handler->name, "replication")) {
+			handler_queue_parallel(&parallel, handler);
+			continue;
+		}
+		if (handler_exec(handler, dn, &dicts, command) == 0) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (successful)", handler->name);
 			cache_entry_module_remove(old, handler->name);
 		} else {
@@ -852,6 +2255,148 @@ int handlers_delete(const char *dn, CacheEntry *old, char command) {
 			rv = 1;
 		}
 	}
+	handlers_run_parallel(&parallel);
+	for (i = 0; i < parallel.count; i++) {
+		if (parallel.jobs[i].rv == 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (successful)", parallel.jobs[i].handler->name);
+			cache_entry_module_remove(old, parallel.jobs[i].handler->name);
+		} else {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (failed)", parallel.jobs[i].handler->name);
+			rv = 1;
+		}
+	}
+	free(parallel.jobs);
+	handlers_entrydicts_free(&dicts);
+	metrics_observe(METRICS_HANDLERS, metrics_monotonic() - start);
+
+	return rv;
+}
+
+
+/* run handlers if object has been deleted */
+int handlers_delete(const char *dn, CacheEntry *old, char command) {
+	return handlers__delete(dn, old, command, false);
+}
+
+
+/* Run handler_batch() of the module once for the deleted objects it was
+   called for before, like handler_update_batch(). */
+static int handler_delete_batch(Handler *handler, int count, char **dns, CacheEntry *old, char command) {
+	struct entry_dicts *dicts;
+	PyObject *changes = NULL, *argtuple = NULL, *result = NULL, *results = NULL;
+	struct timespec start;
+	size_t traced;
+	char cmd[2] = {command, '\0'};
+	int *run, i, j, n = 0, rv = 0;
+
+	if ((dicts = calloc(count, sizeof(struct entry_dicts))) == NULL || (run = malloc(count * sizeof(int))) == NULL)
+		abort();  // FIXME
+	for (i = 0; i < count; i++) {
+		if (handler_deletes(handler, &old[i]))
+			run[n++] = i;
+	}
+	if (n == 0)
+		goto out;
+	if (!handler_ready(handler)) {
+		rv = 1;
+		goto out;
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "running batch handler [%s] for %d deleted objects", handler->name, n);
+
+	if ((changes = PyList_New(n)) == NULL)
+		goto error;
+	for (j = 0; j < n; j++) {
+		PyObject *change;
+
+		i = run[j];
+		dicts[i].old = &old[i];
+		change = handler->modrdn ? handlers_argtuple_command(dns[i], &dicts[i], cmd) : handlers_argtuple(dns[i], &dicts[i]);
+		if (change == NULL)
+			goto error;
+		PyList_SET_ITEM(changes, j, change);
+	}
+	if ((argtuple = PyTuple_Pack(1, changes)) == NULL)
+		goto error;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	handler_prerun(handler);
+	traced = tracing_begin();
+	handler_running = handler;
+	result = PyObject_CallObject(handler->handler_batch, argtuple);
+	handler_running = NULL;
+	drop_privileges();
+	tracing_end(handler, traced);
+	handler_account(handler, &start, false);
+	for (j = 0; j < n; j++) {
+		PyObject *change = PyList_GET_ITEM(changes, j);
+		if (entrydict_detach(PyTuple_GetItem(change, 1)) != 0 || entrydict_detach(PyTuple_GetItem(change, 2)) != 0)
+			PyErr_Print();
+	}
+	if (result == NULL)
+		goto error;
+	if (result != Py_None) {
+		if ((results = PySequence_Fast(result, "handler_batch() must return None or a sequence")) == NULL)
+			goto error;
+		if (PySequence_Fast_GET_SIZE(results) != n) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "handler: %s returned %zd results for %d changes", handler->name, PySequence_Fast_GET_SIZE(results), n);
+			goto failed;
+		}
+	}
+
+	for (j = 0; j < n; j++) {
+		i = run[j];
+		if (results == NULL || PySequence_Fast_GET_ITEM(results, j) == Py_None) {
+			cache_entry_module_remove(&old[i], handler->name);
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (successful) for %s", handler->name, dns[i]);
+		} else {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "handler: %s (failed) for %s", handler->name, dns[i]);
+			handler->stats.failures++;
+			rv = 1;
+		}
+	}
+	goto out;
+
+error:
+	PyErr_Print();
+failed:
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "handler: %s (failed) for %d objects", handler->name, n);
+	handler->stats.failures += n;
+	rv = 1;
+out:
+	Py_XDECREF(results);
+	Py_XDECREF(result);
+	Py_XDECREF(argtuple);
+	Py_XDECREF(changes);
+	for (i = 0; i < count; i++)
+		handlers_entrydicts_free(&dicts[i]);
+	free(run);
+	free(dicts);
+
+	return rv;
+}
+
+
+/* Run handlers for several deleted objects, e.g. of a subtree. Modules
+   defining handler_batch() are called once for all of them, the others for
+   each object in order as by handlers_delete().
+   :param ids: The transactions of the objects, for the lanes.
+   :returns: 0 if all handlers succeeded for all objects. */
+int handlers_delete_batch(int count, char **dns, NotifierID *ids, CacheEntry *old, char command) {
+	Handler *handler;
+	double start;
+	int i, rv = 0;
+
+	for (i = 0; i < count; i++) {
+		lane_set_id(ids[i]);
+		rv |= handlers__delete(dns[i], &old[i], command, true);
+	}
+
+	start = metrics_monotonic();
+	for (handler = handlers; handler != NULL; handler = handler->next) {
+		if (handler_deletes_batch(handler))
+			rv |= handler_delete_batch(handler, count, dns, old, command);
+	}
+	metrics_observe(METRICS_HANDLERS, metrics_monotonic() - start);
 
 	return rv;
 }
@@ -873,6 +2418,10 @@ static int handler_set_data(Handler *handler, PyObject *argtuple) {
 
 	if (handler->setdata == NULL)
 		return 0;
+	if (handler->worker != NULL)
+		worker_stop(handler->worker);
+	if (handler->lane)
+		lane_stop(handler->name);
 
 	result = PyObject_CallObject(handler->setdata, argtuple);
 	drop_privileges();
@@ -43,6 +43,7 @@
 #include <univention/ldap.h>
 
 #include "cache.h"
+#include "metrics.h"
 
 /* If HANDLER_INITIALIZED is not set, the module will be initialized.
    If HANDLER_READY is not set, the handler won't be run. Hence, when
@@ -54,10 +55,25 @@ enum state {
 	HANDLER_READY = 1 << 1,
 };
 
+struct filter_node;
 struct filter {
 	char *base;
 	int scope;
 	char *filter;
+	struct filter_node *node; /* compiled `filter`, see filter_compile() */
+};
+
+/* counters for monitoring, see handler_write_stats() */
+struct handler_stats {
+	unsigned long calls;
+	unsigned long failures;
+	unsigned long filter_misses;
+	double time_total; /* wall clock seconds */
+	double time_max;
+	double gc_time; /* seconds spent by the cyclic garbage collector while it ran */
+	long py_retained; /* bytes allocated by calls and still held, with listener/memory/tracemalloc */
+	size_t py_peak;   /* most bytes allocated during one call */
+	struct metrics_histogram time; /* of each call, see metrics_write() */
 };
 
 struct _Handler {
@@ -66,18 +82,31 @@ struct _Handler {
 	char *description;
 	struct filter **filters;
 	char **attributes;
+	unsigned long *attribute_mask; /* bits of `attributes`, see handler_attribute_mask() */
+	int attribute_mask_words;
+	char **object_classes; /* one is required to match, or NULL, see cache_entry_ldap_filter_required() */
+	unsigned long dispatch_mark;
 	bool modrdn;
 	bool handle_every_delete;
+	bool parallel; /* may run concurrently to other modules, see handlers_run_parallel() */
+	bool delta;    /* called with the changed values as `delta`, see handlers_delta() */
+	char *worker;  /* group of modules run by a worker process, see worker.c */
+	bool worker_pending; /* run by the worker since its last postrun */
+	unsigned int lane; /* number of processes the changes are spooled for, see lane.c */
 	PyObject *handler;
+	PyObject *handler_batch; /* optional, see handler_update_batch() */
 	PyObject *initialize;
 	PyObject *clean;
 	PyObject *postrun;
 	PyObject *prerun;
 	PyObject *setdata;
 	double priority;
+	double postrun_interval; /* optional minimum seconds between two postruns */
+	double postrun_last;     /* CLOCK_MONOTONIC of the last postrun */
 	struct _Handler *next;
 
 	enum state state;
+	struct handler_stats stats;
 	int prepared : 1;
 } typedef Handler;
 
@@ -85,20 +114,29 @@ struct _Handler {
 #define PRIORITY_DEFAULT 50.0
 #define PRIORITY_MAXIMUM 100.0
 
+extern Handler *handlers;
+
 int handlers_init(void);
 int handlers_free_all(void);
 void handler_write_state(Handler *handler);
+void handler_write_stats(Handler *handler);
+void handlers_dump_stats(void);
 int handlers_load_path(char *filename);
 int handlers_reload_all_paths(void);
 int handlers_update(const char *dn, CacheEntry *new, CacheEntry *old, char command);
 int handler_update(const char *dn, CacheEntry *new, CacheEntry *old, Handler *handler, char command);
+int handler_update_batch(Handler *handler, int count, char **dns, CacheEntry *new, CacheEntry *old, char command);
 int handlers_delete(const char *dn, CacheEntry *old, char command);
+int handlers_delete_batch(int count, char **dns, NotifierID *ids, CacheEntry *old, char command);
 int handler_clean(Handler *handler);
 int handlers_clean_all(void);
 int handler_initialize(Handler *handler);
 int handlers_initialize_all(void);
-int handlers_postrun_all(void);
+int handlers_postrun_all(bool force);
+void handlers_gc(void);
+void handlers_start_lanes(void);
 int handlers_set_data_all(char *key, char *value);
 char *handlers_filter(void);
+char **handlers_projection(void);
 
 #endif /* _HANDLERS_H_ */
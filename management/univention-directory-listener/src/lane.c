@@ -0,0 +1,854 @@
+/*
+ * Univention Directory Listener
+ *  module lanes processing changes asynchronously
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Modules setting `lane = True` are not waited for. Their changes are
+   appended to a spool of their own, which a long-lived child process
+   consumes in order, remembering its position in a state file of the lane.
+   The listener commits the transaction and goes on with the next one, so a
+   slow module only delays itself. The spool in `<cache_dir>/lanes/<module>/`
+   consists of numbered segments of `struct lane_record`s; the listener starts
+   a new segment whenever it opens the lane, so only the last segment can end
+   in a record torn by a crash. The spool is synced before the notifier ID is
+   written, thus no change is lost, but after a crash the last changes may be
+   passed to the module again.
+
+   A module setting `lane = <n>` with n > 1 declares that changes of different
+   objects may be processed in any order. Its changes are spread over n lanes
+   by a hash of the entryUUID, or the DN if there is none, so all changes of
+   one object, including both halves of a move, stay in order in one lane.
+   The cache is still only written by the listener itself.
+
+   Urgent changes, like a new password, would wait behind the whole backlog
+   of a lane. If the lane has no change of the object pending, they are also
+   appended to the urgent spool of the lane in `<lane>/urgent/`, which a
+   second process runs at once. The regular lane still runs them in order;
+   both processes take the lock of the lane for each change, and the urgent
+   one skips changes the regular lane has got to already. So the module may
+   see an urgent change twice, but never an older state of the object after
+   a newer one. */
+
+#define PY_SSIZE_T_CLEAN
+#include <python3.11/Python.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <univention/debug.h>
+#include <ctype.h>
+
+#include "cache.h"
+#include "cache_lowlevel.h"
+#include "lane.h"
+#include "worker.h"
+
+#define LANE_SEGMENT_SIZE (64 * 1024 * 1024)
+#define LANE_RECORD_MAX (1024 * 1024 * 1024)
+#define LANE_IDLE_TIMEOUT 1000 /* milliseconds */
+#define LANE_ALIGN(size) (((size) + 7) & ~(size_t)7)
+#define LANE_BUCKETS 4096 /* of objects remembered per lane, see lane_quiet() */
+
+enum lane_record_flags {
+	LANE_NEW = 1 << 0,
+	LANE_OLD = 1 << 1,
+};
+
+/* followed by the serialized new and old entry, each padded for alignment, and the DN */
+struct lane_record {
+	NotifierID id;
+	u_int32_t size; /* of everything following this header */
+	u_int32_t new_size;
+	u_int32_t old_size;
+	u_int8_t flags;
+	char command;
+	u_int16_t reserved;
+};
+
+/* position of the lane process, kept in the file `state` of the lane */
+struct lane_state {
+	NotifierID id;
+	unsigned long seq;
+	unsigned long long offset;
+};
+
+struct lane {
+	char *module;
+	unsigned int shard;
+	bool urgent;
+	char dir[PATH_MAX];
+	int log_fd; /* segment appended to, -1 until the first change */
+	unsigned long seq;
+	off_t size;
+	bool dirty; /* appended to since the last lanes_sync() */
+	pid_t pid;  /* of the lane process, 0 if not running */
+	int fd;     /* to wake up the lane process */
+	unsigned long first_seq; /* segment started by this listener */
+	NotifierID *appended; /* last transaction appended per bucket of objects */
+	struct lane *next;
+};
+
+static struct lane *lanes;
+static NotifierID lane_id;
+static lane_started_t lane_started;
+static lane_run_t lane_run;
+static lane_postrun_t lane_postrun;
+
+
+static void lane_dir(char *path, const char *module, unsigned int shard, bool urgent) {
+	int rv = snprintf(path, PATH_MAX, "%s/lanes/%s/%u%s", cache_dir, module, shard, urgent ? "/urgent" : "");
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+}
+
+
+static void lane_path(char *path, const char *dir, const char *name) {
+	int rv = snprintf(path, PATH_MAX, "%s/%s", dir, name);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+}
+
+
+static void segment_path(char *path, const char *dir, unsigned long seq) {
+	int rv = snprintf(path, PATH_MAX, "%s/%lu.log", dir, seq);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+}
+
+
+/* :returns: the number of the segment file `name`, 0 if it is none */
+static unsigned long segment_number(const char *name) {
+	unsigned long seq;
+	char *end;
+
+	if (*name < '1' || *name > '9')
+		return 0;
+	seq = strtoul(name, &end, 10);
+	return strcmp(end, ".log") ? 0 : seq;
+}
+
+
+/* :returns: the first segment after `after`, or the last one if `last` is set; 0 if there is none */
+static unsigned long find_segment(const char *dir, unsigned long after, bool last) {
+	unsigned long seq, found = 0;
+	struct dirent *dirent;
+	DIR *d;
+
+	if ((d = opendir(dir)) == NULL)
+		return 0;
+	while ((dirent = readdir(d)) != NULL) {
+		if ((seq = segment_number(dirent->d_name)) == 0)
+			continue;
+		if (last ? seq > found : seq > after && (found == 0 || seq < found))
+			found = seq;
+	}
+	closedir(d);
+	return found;
+}
+
+
+/* :returns: 0 on success, -1 if the file is missing or damaged */
+static int read_state(const char *dir, struct lane_state *state) {
+	char path[PATH_MAX];
+	FILE *fp;
+	int rv;
+
+	lane_path(path, dir, "state");
+	if ((fp = fopen(path, "r")) == NULL)
+		return -1;
+	rv = fscanf(fp, "%lu %lu %llu", &state->id, &state->seq, &state->offset);
+	fclose(fp);
+	return rv == 3 ? 0 : -1;
+}
+
+
+/* the fixed width lets the record be overwritten in place */
+static void write_state(int fd, const char *module, const struct lane_state *state) {
+	char buf[64];
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%020lu %020lu %020llu\n", state->id, state->seq, state->offset);
+	if (pwrite(fd, buf, len, 0) != len)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: failed to write state: %s", module, strerror(errno));
+}
+
+
+/* :returns: 0 on success, -1 on error or end of file */
+static int pread_full(int fd, void *buf, size_t size, off_t offset) {
+	while (size > 0) {
+		ssize_t rv = pread(fd, buf, size, offset);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			return -1;
+		buf = (char *)buf + rv;
+		size -= rv;
+		offset += rv;
+	}
+	return 0;
+}
+
+
+/* :returns: true if the listener has closed the connection; wake-ups are consumed */
+static bool lane_closed(int fd) {
+	char buf[64];
+	ssize_t rv;
+
+	while ((rv = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0 || (rv < 0 && errno == EINTR))
+		;
+	return rv == 0 || (rv < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+
+/* run the module for the change of one record */
+static void lane_handle(struct lane *lane, const struct lane_record *record, char *data) {
+	size_t new_size = LANE_ALIGN(record->new_size), old_size = LANE_ALIGN(record->old_size);
+	CacheEntry new, old;
+	char *dn;
+
+	if (new_size + old_size >= record->size ||
+	    parse_entry(data, record->new_size, &new) != 0 ||
+	    parse_entry(data + new_size, record->old_size, &old) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: malformed record for %lu", lane->module, record->id);
+		return;
+	}
+	dn = data + new_size + old_size;
+	if (lane_run(lane->module, dn, record->flags & LANE_NEW ? &new : NULL, record->flags & LANE_OLD ? &old : NULL, record->command) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "lane %s: handler failed for %s", lane->module, dn);
+	cache_free_entry(NULL, &new);
+	cache_free_entry(NULL, &old);
+}
+
+
+/* process the spool of the lane until the listener closes the connection */
+static void __attribute__((noreturn)) lane_serve(struct lane *lane) {
+	static const int signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGABRT, SIGUSR1, SIGUSR2, SIGCHLD};
+	struct lane_state state = {0};
+	char path[PATH_MAX], regular[PATH_MAX];
+	bool ran = false, last_read = false;
+	int seg_fd = -1, state_fd, lock_fd;
+	sigset_t none;
+	size_t i;
+
+	/* the handlers of the listener would close its cache and remove its PID file */
+	for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+		signal(signals[i], SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+	/* the arena of the transaction being processed stays with the listener */
+	cache_entry_arena = NULL;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "lane %s/%u%s: started as %d", lane->module, lane->shard, lane->urgent ? " (urgent)" : "", getpid());
+	lane_started();
+
+	if (read_state(lane->dir, &state) != 0)
+		state.seq = find_segment(lane->dir, 0, false);
+	lane_path(path, lane->dir, "state");
+	if ((state_fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: could not open %s: %s", lane->module, path, strerror(errno));
+		_exit(1);
+	}
+	/* shared by the regular and the urgent process of the lane */
+	lane_dir(regular, lane->module, lane->shard, false);
+	lane_path(path, regular, "lock");
+	if ((lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: could not open %s: %s", lane->module, path, strerror(errno));
+		_exit(1);
+	}
+
+	while (!lane_closed(lane->fd)) {
+		struct lane_record record;
+		char *data;
+
+		if (seg_fd < 0 && state.seq != 0) {
+			segment_path(path, lane->dir, state.seq);
+			seg_fd = open(path, O_RDONLY | O_CLOEXEC);
+		}
+		if (seg_fd < 0) {
+			/* the segment is gone, e.g. by lane_discard() */
+			unsigned long next = find_segment(lane->dir, state.seq, false);
+			if (next != 0) {
+				state.seq = next;
+				state.offset = 0;
+				continue;
+			}
+			goto idle;
+		}
+
+		if (pread_full(seg_fd, &record, sizeof(record), state.offset) == 0 && record.size <= LANE_RECORD_MAX) {
+			if ((data = malloc(record.size + 1)) == NULL)
+				abort();  // FIXME
+			if (pread_full(seg_fd, data, record.size, state.offset + sizeof(record)) == 0) {
+				struct lane_state done = {0};
+
+				data[record.size] = '\0';
+				while (flock(lock_fd, LOCK_EX) != 0 && errno == EINTR)
+					;
+				if (!lane->urgent || read_state(regular, &done) != 0 || done.id < record.id)
+					lane_handle(lane, &record, data);
+				free(data);
+				state.id = record.id;
+				state.offset += sizeof(record) + record.size;
+				write_state(state_fd, lane->module, &state);
+				flock(lock_fd, LOCK_UN);
+				ran = true;
+				last_read = false;
+				continue;
+			}
+			free(data);
+		}
+
+		/* At the end of the segment: the listener has moved on once a later
+		   one exists, but may have appended before; only then it is done. */
+		if (find_segment(lane->dir, state.seq, false) != 0) {
+			if (!last_read) {
+				last_read = true;
+				continue;
+			}
+			close(seg_fd);
+			seg_fd = -1;
+			segment_path(path, lane->dir, state.seq);
+			unlink(path);
+			state.seq = find_segment(lane->dir, state.seq, false);
+			state.offset = 0;
+			write_state(state_fd, lane->module, &state);
+			last_read = false;
+			continue;
+		}
+
+	idle:
+		if (ran) {
+			lane_postrun(lane->module);
+			ran = false;
+		}
+		struct pollfd pfd = {.fd = lane->fd, .events = POLLIN};
+		poll(&pfd, 1, LANE_IDLE_TIMEOUT);
+	}
+
+	if (ran)
+		lane_postrun(lane->module);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "lane %s/%u: exiting", lane->module, lane->shard);
+	fflush(NULL);
+	_exit(0);
+}
+
+
+/* like `mkdir -p` for the directory of the lane */
+static int lane_mkdir(const char *dir) {
+	char path[PATH_MAX], *slash;
+
+	strcpy(path, dir);
+	for (slash = path + strlen(cache_dir) + 1; (slash = strchr(slash, '/')) != NULL; *slash++ = '/') {
+		*slash = '\0';
+		if (mkdir(path, 0700) != 0 && errno != EEXIST)
+			return -1;
+	}
+	return mkdir(path, 0700) != 0 && errno != EEXIST ? -1 : 0;
+}
+
+
+static struct lane *lane_find(const char *module, unsigned int shard, bool urgent, bool create) {
+	struct lane *lane;
+
+	for (lane = lanes; lane != NULL; lane = lane->next) {
+		if (!strcmp(lane->module, module) && lane->shard == shard && lane->urgent == urgent)
+			return lane;
+	}
+	if (!create)
+		return NULL;
+
+	if ((lane = calloc(1, sizeof(struct lane))) == NULL || (lane->module = strdup(module)) == NULL)
+		abort();  // FIXME
+	lane->shard = shard;
+	lane->urgent = urgent;
+	lane_dir(lane->dir, module, shard, urgent);
+	if (lane_mkdir(lane->dir) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: could not create %s: %s", module, lane->dir, strerror(errno));
+		free(lane->module);
+		free(lane);
+		return NULL;
+	}
+	lane->log_fd = -1;
+	lane->fd = -1;
+	lane->next = lanes;
+	lanes = lane;
+
+	return lane;
+}
+
+
+/* close the segment appended to, syncing it first if needed */
+static void lane_close_segment(struct lane *lane) {
+	char path[PATH_MAX];
+
+	if (lane->log_fd < 0)
+		return;
+	if (lane->dirty && fdatasync(lane->log_fd) != 0) {
+		segment_path(path, lane->dir, lane->seq);
+		abort_io("fdatasync", path);
+	}
+	close(lane->log_fd);
+	lane->log_fd = -1;
+	lane->dirty = false;
+}
+
+
+/* start appending to a new segment of the lane */
+static int lane_new_segment(struct lane *lane) {
+	char path[PATH_MAX];
+	int dir_fd;
+
+	lane_close_segment(lane);
+	if (lane->seq == 0)
+		lane->seq = find_segment(lane->dir, 0, true);
+	lane->seq++;
+	if (lane->first_seq == 0)
+		lane->first_seq = lane->seq;
+	segment_path(path, lane->dir, lane->seq);
+	if ((lane->log_fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_APPEND | O_CLOEXEC, 0600)) < 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: could not create %s: %s", lane->module, path, strerror(errno));
+		return -1;
+	}
+	lane->size = 0;
+	/* the entry of the segment must be as durable as its content */
+	if ((dir_fd = open(lane->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+		fsync(dir_fd);
+		close(dir_fd);
+	}
+	return 0;
+}
+
+
+/* close the connection and wait for the lane process to finish its current change */
+static void lane_stop_one(struct lane *lane) {
+	int status;
+
+	if (lane->pid == 0)
+		return;
+	close(lane->fd);
+	while (waitpid(lane->pid, &status, 0) < 0 && errno == EINTR)
+		;
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "lane %s/%u: process %d stopped", lane->module, lane->shard, lane->pid);
+	lane->fd = -1;
+	lane->pid = 0;
+}
+
+
+/* :returns: true if the lane process has exited, which is then forgotten */
+static bool lane_reap(struct lane *lane) {
+	int status;
+
+	if (lane->pid == 0)
+		return true;
+	if (waitpid(lane->pid, &status, WNOHANG) != lane->pid)
+		return false;
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s/%u: process %d exited with status %d", lane->module, lane->shard, lane->pid, status);
+	close(lane->fd);
+	lane->fd = -1;
+	lane->pid = 0;
+	return true;
+}
+
+
+/* fork the process of the lane, if it isn't running */
+static int lane_fork(struct lane *lane) {
+	int fds[2];
+	pid_t pid;
+
+	if (!lane_reap(lane))
+		return 0;
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: socketpair() failed: %s", lane->module, strerror(errno));
+		return -1;
+	}
+
+	fflush(NULL);
+	PyOS_BeforeFork();
+	pid = fork();
+	if (pid == 0) {
+		PyOS_AfterFork_Child();
+		close(fds[0]);
+		struct lane self = *lane;
+		self.fd = fds[1];
+		lane_close_all();
+		worker_close_all();
+		lane_serve(&self);
+	}
+	PyOS_AfterFork_Parent();
+	close(fds[1]);
+	if (pid < 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: fork() failed: %s", lane->module, strerror(errno));
+		close(fds[0]);
+		return -1;
+	}
+	lane->pid = pid;
+	lane->fd = fds[0];
+
+	return 0;
+}
+
+
+/* tell the process of the lane about a new record */
+static void lane_wake(struct lane *lane) {
+	if (lane_reap(lane)) {
+		lane_fork(lane);
+		return;
+	}
+	if (send(lane->fd, "", 1, MSG_DONTWAIT | MSG_NOSIGNAL) < 0 && errno == EPIPE) {
+		/* it is exiting, so wait for it and start it again */
+		lane_stop_one(lane);
+		lane_fork(lane);
+	}
+}
+
+
+void lane_init(lane_started_t started, lane_run_t run, lane_postrun_t postrun) {
+	lane_started = started;
+	lane_run = run;
+	lane_postrun = postrun;
+}
+
+
+/* set the transaction of the following lane_append() calls */
+void lane_set_id(NotifierID id) {
+	lane_id = id;
+}
+
+
+/* :returns: the hash of the object, choosing its lane */
+static u_int32_t lane_hash(const char *dn, CacheEntry *new, CacheEntry *old) {
+	const char *key = NULL;
+	u_int32_t hash = 2166136261u; /* FNV-1a */
+
+	if (new != NULL)
+		key = cache_entry_get1(new, "entryUUID");
+	if (key == NULL && old != NULL)
+		key = cache_entry_get1(old, "entryUUID");
+	if (key == NULL)
+		key = dn;
+	for (; *key; key++)
+		hash = (hash ^ (unsigned char)tolower((unsigned char)*key)) * 16777619u;
+	return hash;
+}
+
+
+/* :returns: true if the lane has processed all changes of the object, as far
+   as it is known; the objects of a bucket and the spool of a previous run
+   of the listener count as pending */
+static bool lane_quiet(struct lane *lane, u_int32_t hash) {
+	struct lane_state state;
+
+	if (read_state(lane->dir, &state) != 0)
+		return find_segment(lane->dir, 0, false) == lane->first_seq && lane->appended[hash % LANE_BUCKETS] == 0;
+	return state.seq >= lane->first_seq && lane->appended[hash % LANE_BUCKETS] <= state.id;
+}
+
+
+/* append the record in `data` to the current segment of the lane */
+static int lane_write(struct lane *lane, const char *data, size_t size) {
+	const char *pos;
+
+	if ((lane->log_fd < 0 || lane->size >= LANE_SEGMENT_SIZE) && lane_new_segment(lane) != 0)
+		return -1;
+	for (pos = data; pos < data + size;) {
+		ssize_t n = write(lane->log_fd, pos, data + size - pos);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		pos += n;
+	}
+	if (pos < data + size) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: failed to append %lu: %s", lane->module, lane_id, strerror(errno));
+		/* a torn record would hide the following ones */
+		if (ftruncate(lane->log_fd, lane->size) != 0)
+			lane_close_segment(lane);
+		return -1;
+	}
+	lane->size += size;
+	/* the urgent spool only repeats the regular one, so it needn't be synced */
+	lane->dirty = !lane->urgent;
+	lane_wake(lane);
+	return 0;
+}
+
+
+/* queue the change for the module, in one of its `shards` lanes, and in its
+   urgent spool as well for `urgent` changes */
+int lane_append(const char *module, unsigned int shards, const char *dn, CacheEntry *new, CacheEntry *old, char command, bool urgent) {
+	struct lane_record record = {.id = lane_id, .command = command};
+	void *new_data = NULL, *old_data = NULL;
+	struct lane *lane, *fast;
+	u_int32_t hash = lane_hash(dn, new, old);
+	size_t dn_size, size;
+	char *data, *pos;
+	int rv = -1;
+
+	if ((lane = lane_find(module, shards > 1 ? hash % shards : 0, false, true)) == NULL)
+		return -1;
+	if (lane->appended == NULL && (lane->appended = calloc(LANE_BUCKETS, sizeof(NotifierID))) == NULL)
+		abort();  // FIXME
+
+	if (new != NULL)
+		record.flags |= LANE_NEW;
+	if (old != NULL)
+		record.flags |= LANE_OLD;
+	if (unparse_entry(&new_data, &record.new_size, new != NULL ? new : &(CacheEntry){0}) != 0 ||
+	    unparse_entry(&old_data, &record.old_size, old != NULL ? old : &(CacheEntry){0}) != 0)
+		goto out;
+	dn_size = strlen(dn) + 1;
+	record.size = LANE_ALIGN(record.new_size) + LANE_ALIGN(record.old_size) + dn_size;
+	size = sizeof(record) + record.size;
+
+	if ((data = calloc(1, size)) == NULL)
+		abort();  // FIXME
+	memcpy(data, &record, sizeof(record));
+	pos = data + sizeof(record);
+	memcpy(pos, new_data, record.new_size);
+	pos += LANE_ALIGN(record.new_size);
+	memcpy(pos, old_data, record.old_size);
+	pos += LANE_ALIGN(record.old_size);
+	memcpy(pos, dn, dn_size);
+
+	if (lane->log_fd < 0 && lane_new_segment(lane) != 0)
+		goto out_data;
+	if (urgent && lane_quiet(lane, hash) && (fast = lane_find(module, lane->shard, true, true)) != NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "lane %s/%u: urgent change of %s", module, lane->shard, dn);
+		lane_write(fast, data, size);
+	}
+	if ((rv = lane_write(lane, data, size)) == 0)
+		lane->appended[hash % LANE_BUCKETS] = lane_id;
+out_data:
+	free(data);
+out:
+	free(new_data);
+	free(old_data);
+	return rv;
+}
+
+
+/* :returns: the number of lanes of the module found on disk */
+static unsigned int lane_count(const char *module) {
+	char path[PATH_MAX];
+	struct dirent *dirent;
+	unsigned int count = 0;
+	DIR *d;
+	int rv;
+
+	rv = snprintf(path, PATH_MAX, "%s/lanes/%s", cache_dir, module);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	if ((d = opendir(path)) == NULL)
+		return 0;
+	while ((dirent = readdir(d)) != NULL) {
+		if (isdigit((unsigned char)dirent->d_name[0]) && (unsigned int)atoi(dirent->d_name) >= count)
+			count = atoi(dirent->d_name) + 1;
+	}
+	closedir(d);
+	return count;
+}
+
+
+/* start the processes of the lanes, e.g. to catch up on changes spooled before;
+   lanes left over from a larger number of lanes before are emptied as well */
+int lane_start(const char *module, unsigned int shards) {
+	unsigned int shard, count = lane_count(module);
+	struct lane *lane;
+	int rv = 0;
+
+	char dir[PATH_MAX];
+	struct stat st;
+
+	for (shard = 0; shard < shards || shard < count; shard++) {
+		if ((lane = lane_find(module, shard, false, true)) == NULL || lane_fork(lane) != 0)
+			rv = -1;
+		lane_dir(dir, module, shard, true);
+		if (stat(dir, &st) == 0 && ((lane = lane_find(module, shard, true, true)) == NULL || lane_fork(lane) != 0))
+			rv = -1;
+	}
+	return rv;
+}
+
+
+/* write the changes appended to all lanes to disk */
+void lanes_sync(void) {
+	char path[PATH_MAX];
+	struct lane *lane;
+
+	for (lane = lanes; lane != NULL; lane = lane->next) {
+		if (!lane->dirty)
+			continue;
+		if (fdatasync(lane->log_fd) != 0) {
+			segment_path(path, lane->dir, lane->seq);
+			abort_io("fdatasync", path);
+		}
+		lane->dirty = false;
+	}
+}
+
+
+/* :returns: the bytes not yet processed by the lane in `dir` */
+static unsigned long lane_pending(const char *dir, struct lane_state *state) {
+	char path[PATH_MAX];
+	unsigned long seq, pending = 0;
+	struct stat st;
+
+	if (read_state(dir, state) != 0)
+		state->seq = find_segment(dir, 0, false);
+	for (seq = state->seq; seq != 0; seq = find_segment(dir, seq, false)) {
+		segment_path(path, dir, seq);
+		if (stat(path, &st) != 0)
+			continue;
+		pending += st.st_size;
+		if (seq == state->seq)
+			pending -= (unsigned long long)st.st_size < state->offset ? st.st_size : state->offset;
+	}
+	return pending;
+}
+
+
+/* Sum up the lanes of the module; the ID is the one of the lane furthest
+   behind among those with changes pending, or the latest one if none has.
+   :returns: 0 on success, -1 if the module has no lane */
+int lane_status(const char *module, struct lane_status *status) {
+	unsigned int shard, count = lane_count(module);
+	NotifierID latest = 0, behind = 0;
+	char dir[PATH_MAX];
+
+	if (count == 0)
+		return -1;
+	status->pending = 0;
+	for (shard = 0; shard < count; shard++) {
+		struct lane_state state = {0};
+		unsigned long pending;
+
+		lane_dir(dir, module, shard, false);
+		pending = lane_pending(dir, &state);
+		if (pending > 0 && (behind == 0 || state.id < behind))
+			behind = state.id;
+		if (state.id > latest)
+			latest = state.id;
+		status->pending += pending;
+	}
+	status->id = status->pending > 0 ? behind : latest;
+	return 0;
+}
+
+
+/* drop all changes queued for the module, e.g. before it is initialized again */
+void lane_discard(const char *module) {
+	unsigned int shard, count = lane_count(module);
+	char path[PATH_MAX];
+	struct dirent *dirent;
+	struct lane *lane;
+	DIR *d;
+
+	lane_stop(module);
+	for (lane = lanes; lane != NULL; lane = lane->next) {
+		if (strcmp(lane->module, module))
+			continue;
+		lane_close_segment(lane);
+		lane->seq = 0;
+		lane->first_seq = 0;
+		if (lane->appended != NULL)
+			memset(lane->appended, 0, LANE_BUCKETS * sizeof(NotifierID));
+	}
+	for (shard = 0; shard < 2 * count; shard++) {
+		lane_dir(path, module, shard / 2, shard % 2);
+		if ((d = opendir(path)) == NULL)
+			continue;
+		while ((dirent = readdir(d)) != NULL) {
+			char file[PATH_MAX];
+
+			if (!segment_number(dirent->d_name) && strcmp(dirent->d_name, "state"))
+				continue;
+			lane_path(file, path, dirent->d_name);
+			if (unlink(file) != 0)
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "lane %s: could not remove %s: %s", module, file, strerror(errno));
+		}
+		closedir(d);
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "lane %s: discarded", module);
+}
+
+
+/* stop the processes of all lanes of the module */
+void lane_stop(const char *module) {
+	struct lane *lane;
+
+	for (lane = lanes; lane != NULL; lane = lane->next) {
+		if (!strcmp(lane->module, module))
+			lane_stop_one(lane);
+	}
+}
+
+
+void lane_stop_all(void) {
+	struct lane *lane;
+
+	while ((lane = lanes) != NULL) {
+		lane_stop_one(lane);
+		lane_close_segment(lane);
+		lanes = lane->next;
+		free(lane->appended);
+		free(lane->module);
+		free(lane);
+	}
+}
+
+
+/* release the descriptors inherited by a child process, without touching the lane processes */
+void lane_close_all(void) {
+	struct lane *lane;
+
+	for (lane = lanes; lane != NULL; lane = lane->next) {
+		if (lane->log_fd >= 0)
+			close(lane->log_fd);
+		if (lane->fd >= 0)
+			close(lane->fd);
+	}
+	lanes = NULL;
+}
@@ -0,0 +1,70 @@
+/*
+ * Univention Directory Listener
+ *  module lanes processing changes asynchronously
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _LANE_H_
+#define _LANE_H_
+
+#include <stdbool.h>
+
+#include "cache_entry.h"
+#include "network.h"
+
+#define LANE_MAX 64 /* lanes per module */
+
+/* called in the lane process once after it has been forked, and for each change */
+typedef void (*lane_started_t)(void);
+typedef int (*lane_run_t)(const char *module, const char *dn, CacheEntry *new, CacheEntry *old, char command);
+typedef int (*lane_postrun_t)(const char *module);
+
+/* progress of a lane, see lane_status() */
+struct lane_status {
+	NotifierID id;         /* last transaction processed by all lanes of the module */
+	unsigned long pending; /* bytes queued but not processed yet */
+};
+
+void lane_init(lane_started_t started, lane_run_t run, lane_postrun_t postrun);
+void lane_set_id(NotifierID id);
+/* `shards` is the number of lanes of the module, see lane.c */
+int lane_append(const char *module, unsigned int shards, const char *dn, CacheEntry *new, CacheEntry *old, char command, bool urgent);
+int lane_start(const char *module, unsigned int shards);
+void lanes_sync(void);
+int lane_status(const char *module, struct lane_status *status);
+void lane_discard(const char *module);
+void lane_stop(const char *module);
+void lane_stop_all(void);
+void lane_close_all(void);
+
+#endif /* _LANE_H_ */
@@ -0,0 +1,206 @@
+/*
+ * Univention Directory Listener
+ *  read-only access to the listener cache for other local services
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <lmdb.h>
+
+#include "cache.h"
+#include "cache_dn.h"
+#include "listener_cache.h"
+#include "utils.h"
+
+/* only the programs of the listener set this */
+int INIT_ONLY = 0;
+
+struct univention_listener_cache_entry {
+	CacheEntry entry;
+};
+
+struct univention_listener_cache_iter {
+	CacheIter iter;
+	char *base; /* lower-case, referenced by iter */
+	char *dn;
+	struct univention_listener_cache_entry entry; /* view of the current object */
+};
+
+static bool opened = false;
+
+static int status(int rv) {
+	return rv == MDB_SUCCESS ? 0 : rv == MDB_NOTFOUND ? ENOENT : EIO;
+}
+
+int univention_listener_cache_open(const char *dir) {
+	char cache_mdb_dir[PATH_MAX];
+
+	if (opened)
+		return 0;
+	if (dir == NULL) {
+		snprintf(cache_mdb_dir, PATH_MAX, "%s/cache", cache_dir);
+		dir = cache_mdb_dir;
+	}
+	if (cache_init((char *)dir, MDB_RDONLY) != MDB_SUCCESS)
+		return EIO;
+	opened = true;
+	return 0;
+}
+
+void univention_listener_cache_close(void) {
+	if (!opened)
+		return;
+	cache_close();
+	opened = false;
+}
+
+int univention_listener_cache_id(unsigned long *id) {
+	CacheMasterEntry master_entry;
+	int rv;
+
+	if ((rv = cache_get_master_entry(&master_entry)) != MDB_SUCCESS)
+		return status(rv);
+	*id = master_entry.id;
+	return 0;
+}
+
+int univention_listener_cache_get(const char *dn, univention_listener_cache_entry **entry) {
+	int rv;
+
+	*entry = NULL;
+	/* the listener may have moved or removed any node since the last call */
+	dntree_cache_clear();
+	if ((*entry = calloc(1, sizeof(**entry))) == NULL)
+		return EIO;
+	if ((rv = cache_get_entry_lower_upper((char *)dn, &(*entry)->entry)) != MDB_SUCCESS) {
+		univention_listener_cache_entry_free(*entry);
+		*entry = NULL;
+	}
+	return status(rv);
+}
+
+void univention_listener_cache_entry_free(univention_listener_cache_entry *entry) {
+	if (entry == NULL)
+		return;
+	cache_free_entry(NULL, &entry->entry);
+	free(entry);
+}
+
+int univention_listener_cache_entry_attributes(univention_listener_cache_entry *entry) {
+	return entry->entry.attribute_count;
+}
+
+const char *univention_listener_cache_entry_name(univention_listener_cache_entry *entry, int attribute) {
+	if (attribute < 0 || attribute >= entry->entry.attribute_count)
+		return NULL;
+	return entry->entry.attributes[attribute]->name;
+}
+
+int univention_listener_cache_entry_find(univention_listener_cache_entry *entry, const char *name) {
+	int i;
+
+	for (i = 0; i < entry->entry.attribute_count; i++) {
+		if (strcasecmp(entry->entry.attributes[i]->name, name) == 0)
+			return i;
+	}
+	return -1;
+}
+
+int univention_listener_cache_entry_values(univention_listener_cache_entry *entry, int attribute) {
+	if (attribute < 0 || attribute >= entry->entry.attribute_count)
+		return 0;
+	return entry->entry.attributes[attribute]->value_count;
+}
+
+const char *univention_listener_cache_entry_value(univention_listener_cache_entry *entry, int attribute, int value, size_t *length) {
+	CacheEntryAttribute *attr;
+
+	if (attribute < 0 || attribute >= entry->entry.attribute_count)
+		return NULL;
+	attr = entry->entry.attributes[attribute];
+	if (value < 0 || value >= attr->value_count)
+		return NULL;
+	/* the stored length includes the terminating NUL */
+	if (length)
+		*length = attr->length[value] ? attr->length[value] - 1 : 0;
+	return attr->values[value];
+}
+
+int univention_listener_cache_iter_begin(const char *base, univention_listener_cache_iter **iter, unsigned long *id) {
+	CacheIterOptions options = {0};
+	CacheMasterEntry master_entry;
+	int rv;
+
+	dntree_cache_clear();
+	if ((*iter = calloc(1, sizeof(**iter))) == NULL)
+		return EIO;
+	if (base)
+		options.base = (*iter)->base = lower_utf8(base);
+	rv = cache_iter_begin(&(*iter)->iter, &options);
+	if (rv == MDB_SUCCESS && id != NULL && (rv = cache_iter_master_entry(&(*iter)->iter, &master_entry)) == MDB_SUCCESS)
+		*id = master_entry.id;
+	if (rv != MDB_SUCCESS) {
+		univention_listener_cache_iter_end(*iter);
+		*iter = NULL;
+	}
+	return status(rv);
+}
+
+int univention_listener_cache_iter_next(univention_listener_cache_iter *iter, const char **dn, univention_listener_cache_entry **entry) {
+	int rv;
+
+	cache_free_entry(NULL, &iter->entry.entry);
+	/* skip entries which can't be parsed */
+	while ((rv = cache_iter_next(&iter->iter, NULL, &iter->dn, &iter->entry.entry)) == -1)
+		;
+	if (rv != MDB_SUCCESS)
+		return status(rv);
+	*dn = iter->dn;
+	*entry = &iter->entry;
+	return 0;
+}
+
+void univention_listener_cache_iter_end(univention_listener_cache_iter *iter) {
+	if (iter == NULL)
+		return;
+	cache_free_entry(NULL, &iter->entry.entry);
+	cache_iter_end(&iter->iter);
+	free(iter->base);
+	free(iter->dn);
+	free(iter);
+}
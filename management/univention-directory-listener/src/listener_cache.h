@@ -0,0 +1,84 @@
+/*
+ * Univention Directory Listener
+ *  read-only access to the listener cache for other local services
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LISTENER_CACHE_H_
+#define _LISTENER_CACHE_H_
+
+#include <stddef.h>
+
+/*
+ * The cache holds the replicated objects as seen by the listener modules, so
+ * only the attributes and objects not filtered by listener/cache/filter.
+ * Readers never block the listener nor each other, but the functions are not
+ * thread-safe: use one process per reader, or serialize the calls.
+ *
+ * All functions returning int return 0 on success, ENOENT if the object
+ * does not exist and EIO on other errors.
+ */
+
+typedef struct univention_listener_cache_entry univention_listener_cache_entry;
+typedef struct univention_listener_cache_iter univention_listener_cache_iter;
+
+/* Open the cache in @dir, or the one of the running listener if NULL. */
+int univention_listener_cache_open(const char *dir);
+void univention_listener_cache_close(void);
+
+/* Return the ID of the last transaction in the cache. Read it before a
+   lookup: the objects returned afterwards are at least this recent. */
+int univention_listener_cache_id(unsigned long *id);
+
+/* Look up the object @dn, to be freed by univention_listener_cache_entry_free(). */
+int univention_listener_cache_get(const char *dn, univention_listener_cache_entry **entry);
+void univention_listener_cache_entry_free(univention_listener_cache_entry *entry);
+
+/* The attributes of an object are sorted by name. */
+int univention_listener_cache_entry_attributes(univention_listener_cache_entry *entry);
+const char *univention_listener_cache_entry_name(univention_listener_cache_entry *entry, int attribute);
+/* Return the index of the attribute @name, or -1. */
+int univention_listener_cache_entry_find(univention_listener_cache_entry *entry, const char *name);
+int univention_listener_cache_entry_values(univention_listener_cache_entry *entry, int attribute);
+/* Return a value of @attribute, terminated by NUL, with its length in @length. */
+const char *univention_listener_cache_entry_value(univention_listener_cache_entry *entry, int attribute, int value, size_t *length);
+
+/*
+ * Iterate over all objects below and at @base, or all objects if NULL, in a
+ * consistent snapshot of the cache, whose ID is returned in @id unless NULL.
+ */
+int univention_listener_cache_iter_begin(const char *base, univention_listener_cache_iter **iter, unsigned long *id);
+/* Return the next object, which is valid until the next call, or ENOENT at the end. */
+int univention_listener_cache_iter_next(univention_listener_cache_iter *iter, const char **dn, univention_listener_cache_entry **entry);
+void univention_listener_cache_iter_end(univention_listener_cache_iter *iter);
+
+#endif /* _LISTENER_CACHE_H_ */
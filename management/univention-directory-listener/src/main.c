@@ -41,6 +41,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <fcntl.h>
+#include <getopt.h>
 #include <dirent.h>
 #include <pwd.h>
 #include <sys/types.h>
@@ -55,10 +56,12 @@
 #include "handlers.h"
 #include "signals.h"
 #include "notifier.h"
+#include "policy_index.h"
 #include "network.h"
 #include "select_server.h"
 #include "transfile.h"
 #include "utils.h"
+#include "tunables.h"
 
 int INIT_ONLY = 0;
 
@@ -233,9 +236,11 @@ static void usage(void) {
 	fprintf(stderr, "   -c   Listener cache path\n");
 	fprintf(stderr, "   -l   LDAP schema and transaction path\n");
 	fprintf(stderr, "   -g   start from scratch (remove cache)\n");
+	fprintf(stderr, "   -S   start from scratch with the cache snapshot in the given directory (see univention-directory-listener-dump -s)\n");
 	fprintf(stderr, "   -i   initialize handlers only\n");
 	fprintf(stderr, "   -o   write transaction file\n");
 	fprintf(stderr, "   -P   initialize handlers only, but not from scratch\n");
+	fprintf(stderr, "   --dump-config   print the effective listener settings and exit\n");
 }
 
 
@@ -330,7 +335,8 @@ static int do_connection(univention_ldap_parameters_t *lp) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "can not connect to LDAP server %s:%d", lp->uri ? lp->uri : lp->host ? lp->host : "NULL", lp->port);
 		goto fail;
 	}
-	if (NOTIFIER_CLIENT_NEW_RETRY(notifier_client_new(NULL, lp->host, 1)) != 0)
+	/* select_server() may already have connected to the notifier */
+	if (!notifier_client_connected(NULL, lp->host) && NOTIFIER_CLIENT_NEW_RETRY(notifier_client_new(NULL, lp->host, 1)) != 0)
 		goto fail;
 
 	/* check if we are connected to an OpenLDAP */
@@ -361,6 +367,7 @@ int main(int argc, char *argv[]) {
 	char *server_role;
 	int debugging = 0;
 	bool from_scratch = false;
+	char *snapshot_dir = NULL;
 	bool foreground = false;
 	bool initialize_only = false;
 	bool write_transaction_file = false;
@@ -369,7 +376,13 @@ int main(int argc, char *argv[]) {
 	struct stat stbuf;
 	char cache_mdb_dir[PATH_MAX];
 
-	univention_debug_init("stderr", 1, 1);
+	{
+		char *ucrval = univention_config_get_string("listener/debug/async");
+		bool async = ucrval && (!strcmp(ucrval, "yes") || !strcmp(ucrval, "true"));
+
+		free(ucrval);
+		univention_debug_init("stderr", async ? UV_DEBUG_ASYNC : UV_DEBUG_FLUSH, 1);
+	}
 
 	{
 		struct timeval timeout = {
@@ -406,12 +419,19 @@ int main(int argc, char *argv[]) {
 
 	/* parse arguments */
 	for (;;) {
+		static const struct option long_options[] = {
+		    {"dump-config", no_argument, NULL, 'C'},
+		    {NULL, 0, NULL, 0},
+		};
 		int c;
 
-		c = getopt(argc, argv, "d:FH:h:p:b:D:w:y:xZY:U:R:Km:Bc:giol:P");
+		c = getopt_long(argc, argv, "d:FH:h:p:b:D:w:y:xZY:U:R:Km:Bc:giol:PS:", long_options, NULL);
 		if (c < 0)
 			break;
 		switch (c) {
+		case 'C':
+			tunables_dump(stdout);
+			exit(0);
 		case 'd':
 			debugging = atoi(optarg);
 			break;
@@ -476,6 +496,10 @@ int main(int argc, char *argv[]) {
 		case 'g':
 			from_scratch = true;
 			break;
+		case 'S':
+			snapshot_dir = strdup(optarg);
+			from_scratch = true;
+			break;
 		case 'i':
 			from_scratch = true;
 			/* fallthrough */
@@ -540,6 +564,7 @@ int main(int argc, char *argv[]) {
 	}
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "connection okay to host %s:%d", lp->host, lp->port);
+	select_server_success(lp);
 
 	/* connect to local LDAP server */
 	server_role = univention_config_get_string("server/role");
@@ -559,8 +584,11 @@ int main(int argc, char *argv[]) {
 	rv = snprintf(cache_mdb_dir, PATH_MAX, "%s/cache", cache_dir);
 	if (rv < 0 || rv >= PATH_MAX)
 		abort();
+	if (snapshot_dir != NULL && cache_seed(cache_mdb_dir, snapshot_dir) != 0)
+		exit(1);
 	if (cache_init(cache_mdb_dir, 0) != 0)
 		exit(1);
+	cache_warmup();
 
 	handlers_init();
 
@@ -596,11 +624,25 @@ int main(int argc, char *argv[]) {
 		}
 
 		cache_get_schema_id(&cache_master_entry.schema_id, 0);
+		cache_master_entry.flags = 0;
 
 		rv = cache_update_master_entry(&cache_master_entry);
 	}
 	if (rv != 0)
 		return rv;
+	/* older versions also stored mixed-case DNs */
+	if (!(cache_master_entry.flags & CACHE_NORMALIZED)) {
+		int count;
+
+		if ((rv = cache_normalize(&count)) != 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to normalize the cache");
+			return rv;
+		}
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "normalized %d DNs in the cache", count);
+		cache_master_entry.flags |= CACHE_NORMALIZED;
+		if ((rv = cache_update_master_entry(&cache_master_entry)) != 0)
+			return rv;
+	}
 	/* Legacy file for Nagios et al. */
 	if (cache_set_int("notifier_id", cache_master_entry.id))
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "failed to write notifier ID");
@@ -609,14 +651,19 @@ int main(int argc, char *argv[]) {
 	if ((rv = change_update_schema(lp)) != LDAP_SUCCESS)
 		return rv;
 
-	/* do initial import of entries */
+	/* do initial import of entries, from the seeded cache if given */
+	change_init_from_cache(snapshot_dir != NULL);
 	if ((rv = change_new_modules(lp)) != LDAP_SUCCESS) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "change_new_modules: %s", ldap_err2string(rv));
 		return rv;
 	}
+	change_init_from_cache(false);
+	if (policy_index_init(lp) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "policy index disabled");
 	signals_unblock();
 
 	if (!initialize_only) {
+		handlers_start_lanes();
 		rv = notifier_listen(lp, write_transaction_file, lp_local);
 	}
 
@@ -625,6 +672,7 @@ int main(int argc, char *argv[]) {
 
 	univention_ldap_close(lp);
 	univention_ldap_close(lp_local);
+	univention_ldap_pool_clear();
 
 	exit_handler(0);
 }
@@ -0,0 +1,130 @@
+/*
+ * Univention Directory Listener
+ *  accounting of the memory used by the listener
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <time.h>
+
+#include <univention/debug.h>
+
+#include "memory.h"
+#include "tunables.h"
+
+/* updated by all threads parsing entries, see cache_iter_begin() */
+static size_t counters[MEMORY_KINDS];
+
+static const char *const kind_names[MEMORY_KINDS] = {
+    [MEMORY_ARENAS] = "arenas",
+    [MEMORY_DNS] = "dns",
+    [MEMORY_ENTRIES] = "entries",
+};
+
+/* The sizes passed to memory_limit() are halved `shift` times while the RSS
+ * exceeds listener/memory/budget, and doubled again once it dropped below
+ * three quarters of it. */
+static struct {
+	double checked; /* CLOCK_MONOTONIC of the last reading */
+	size_t rss;
+	int shift;
+} pressure;
+
+void memory_account(enum memory_kind kind, long bytes) {
+	__atomic_add_fetch(&counters[kind], (size_t)bytes, __ATOMIC_RELAXED);
+}
+
+size_t memory_get(enum memory_kind kind) {
+	return __atomic_load_n(&counters[kind], __ATOMIC_RELAXED);
+}
+
+const char *memory_kind_name(enum memory_kind kind) {
+	return kind_names[kind];
+}
+
+/* Return the resident set size of the process in bytes, or 0 if unknown. */
+size_t memory_rss(void) {
+	unsigned long size, resident;
+	FILE *fp;
+	int rv;
+
+	if ((fp = fopen("/proc/self/statm", "r")) == NULL)
+		return 0;
+	rv = fscanf(fp, "%lu %lu", &size, &resident);
+	fclose(fp);
+	return rv == 2 ? resident * sysconf(_SC_PAGESIZE) : 0;
+}
+
+static void memory_check(void) {
+	size_t budget = (size_t)tunables_get()->memory_budget << 20;
+	struct timespec now;
+	double seconds;
+
+	if (budget == 0) {
+		pressure.shift = 0;
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seconds = now.tv_sec + now.tv_nsec / 1e9;
+	if (seconds - pressure.checked < MEMORY_CHECK_INTERVAL)
+		return;
+	pressure.checked = seconds;
+	if ((pressure.rss = memory_rss()) == 0)
+		return;
+	if (pressure.rss > budget && pressure.shift < MEMORY_SHIFT_MAX) {
+		pressure.shift++;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "memory: RSS %zu MiB exceeds budget of %zu MiB, reducing batches to 1/%d", pressure.rss >> 20, budget >> 20, 1 << pressure.shift);
+		/* give the memory freed by the smaller batches back */
+		malloc_trim(0);
+	} else if (pressure.rss < budget / 4 * 3 && pressure.shift > 0) {
+		pressure.shift--;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "memory: RSS %zu MiB below budget of %zu MiB, increasing batches to 1/%d", pressure.rss >> 20, budget >> 20, 1 << pressure.shift);
+	}
+}
+
+/* Return the size of a batch or window of @value objects, reduced while the
+ * RSS exceeds listener/memory/budget, but never to 0 unless @value is 0. */
+int memory_limit(int value) {
+	memory_check();
+	if (value >> pressure.shift > 0)
+		return value >> pressure.shift;
+	return value > 0 ? 1 : value;
+}
+
+/* log the accounted memory, see handlers_dump_stats() */
+void memory_log(void) {
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "memory: rss=%zu budget=%zu arenas=%zu dns=%zu entries=%zu limit=1/%d",
+	                 memory_rss(), (size_t)tunables_get()->memory_budget << 20, memory_get(MEMORY_ARENAS), memory_get(MEMORY_DNS), memory_get(MEMORY_ENTRIES), 1 << pressure.shift);
+}
@@ -0,0 +1,62 @@
+/*
+ * Univention Directory Listener
+ *  accounting of the memory used by the listener
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _MEMORY_H_
+#define _MEMORY_H_
+
+#include <stdio.h>
+#include <stddef.h>
+
+/* the memory held by the larger structures of the listener, see memory_account() */
+enum memory_kind {
+	MEMORY_ARENAS,  /* blocks of the arenas of the transactions, see arena.c */
+	MEMORY_DNS,     /* DNs collected for initializing modules */
+	MEMORY_ENTRIES, /* values of the objects batched for initializing modules */
+	MEMORY_KINDS
+};
+
+/* at most this many halvings of the sizes limited by memory_limit() */
+#define MEMORY_SHIFT_MAX 6
+/* seconds between two readings of the RSS */
+#define MEMORY_CHECK_INTERVAL 1.0
+
+void memory_account(enum memory_kind kind, long bytes);
+size_t memory_get(enum memory_kind kind);
+const char *memory_kind_name(enum memory_kind kind);
+size_t memory_rss(void);
+int memory_limit(int value);
+void memory_log(void);
+
+#endif /* _MEMORY_H_ */
@@ -0,0 +1,246 @@
+/*
+ * Univention Directory Listener
+ *  replication latency metrics
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#define _GNU_SOURCE /* strptime, timegm */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+
+#include <univention/debug.h>
+
+#include "metrics.h"
+#include "cache.h"
+#include "handlers.h"
+#include "memory.h"
+
+#define METRICS_INTERVAL 10 /* seconds between writes of the metrics file */
+
+static const double bounds[METRICS_BUCKETS - 1] = {
+	0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 300, 3600,
+};
+
+static const char *const stage_names[METRICS_STAGES] = {
+	[METRICS_NOTIFIER] = "notifier",
+	[METRICS_FETCH] = "fetch",
+	[METRICS_QUEUE] = "queue",
+	[METRICS_LDAP] = "ldap",
+	[METRICS_HANDLERS] = "handlers",
+	[METRICS_CACHE] = "cache",
+	[METRICS_COMMIT] = "commit",
+	[METRICS_PROCESS] = "process",
+	[METRICS_LAG] = "lag",
+};
+
+static struct metrics_histogram stages[METRICS_STAGES];
+static unsigned long last_id;
+static double last_lag = -1; /* seconds, negative until known */
+static double last_write;
+
+
+double metrics_monotonic(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+double metrics_realtime(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/* Parse the GeneralizedTime of reqStart "YYYYmmddHHMMSSZ" or entryCSN
+ * "YYYYmmddHHMMSS.ffffffZ#..." into seconds since the epoch; 0 if invalid. */
+double metrics_parse_time(const char *value, size_t len) {
+	char buf[32];
+	struct tm tm = {0};
+	double fraction = 0;
+	char *end;
+	time_t t;
+
+	if (len < 15)
+		return 0;
+	if (len >= sizeof(buf))
+		len = sizeof(buf) - 1;
+	memcpy(buf, value, len);
+	buf[len] = '\0';
+	end = strptime(buf, "%Y%m%d%H%M%S", &tm);
+	if (end == NULL)
+		return 0;
+	if (*end == '.' || *end == ',') {
+		*end = '.';
+		fraction = strtod(end, &end);
+	}
+	if (*end != 'Z')
+		return 0;
+	if ((t = timegm(&tm)) == (time_t)-1)
+		return 0;
+	return t + fraction;
+}
+
+
+void metrics_histogram_observe(struct metrics_histogram *histogram, double seconds) {
+	int i;
+
+	if (seconds < 0)
+		seconds = 0;
+	for (i = 0; i < METRICS_BUCKETS - 1 && seconds > bounds[i]; i++)
+		;
+	histogram->buckets[i]++;
+	histogram->count++;
+	histogram->sum += seconds;
+}
+
+
+void metrics_observe(enum metrics_stage stage, double seconds) {
+	metrics_histogram_observe(&stages[stage], seconds);
+}
+
+
+/* Account transaction @id, received at monotonic time @received, as
+ * processed. @written is the time of the change on the Primary, 0 if unknown. */
+void metrics_processed(unsigned long id, double written, double received) {
+	if (received > 0)
+		metrics_observe(METRICS_PROCESS, metrics_monotonic() - received);
+	if (written > 0) {
+		last_lag = metrics_realtime() - written;
+		/* the clocks of the Primary and this system may differ */
+		if (last_lag < 0)
+			last_lag = 0;
+		metrics_observe(METRICS_LAG, last_lag);
+	}
+	last_id = id;
+}
+
+
+static void histogram_write(FILE *fp, const char *name, const char *label, const char *value, const struct metrics_histogram *histogram) {
+	unsigned long cumulative = 0;
+	int i;
+
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		cumulative += histogram->buckets[i];
+		if (i < METRICS_BUCKETS - 1)
+			fprintf(fp, "%s_bucket{%s=\"%s\",le=\"%g\"} %lu\n", name, label, value, bounds[i], cumulative);
+		else
+			fprintf(fp, "%s_bucket{%s=\"%s\",le=\"+Inf\"} %lu\n", name, label, value, cumulative);
+	}
+	fprintf(fp, "%s_sum{%s=\"%s\"} %.6f\n", name, label, value, histogram->sum);
+	fprintf(fp, "%s_count{%s=\"%s\"} %lu\n", name, label, value, histogram->count);
+}
+
+
+/* Write the metrics in the text format of Prometheus to <cache>/metrics, at
+ * most every METRICS_INTERVAL seconds unless @force is set. */
+void metrics_write(bool force) {
+	char filename[PATH_MAX], tmp_filename[PATH_MAX];
+	double now = metrics_monotonic();
+	Handler *handler;
+	FILE *fp;
+	int rv, i;
+
+	if (!force && now - last_write < METRICS_INTERVAL)
+		return;
+	last_write = now;
+
+	rv = snprintf(filename, PATH_MAX, "%s/metrics", cache_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	rv = snprintf(tmp_filename, PATH_MAX, "%s.new", filename);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	fp = fopen(tmp_filename, "w");
+	if (fp == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not open %s", tmp_filename);
+		return;
+	}
+	fprintf(fp,
+	        "# HELP univention_listener_last_id Last processed transaction.\n"
+	        "# TYPE univention_listener_last_id gauge\n"
+	        "univention_listener_last_id %lu\n",
+	        last_id);
+	if (last_lag >= 0)
+		fprintf(fp,
+		        "# HELP univention_listener_replication_lag_seconds Time from the change on the Primary until the last transaction was processed.\n"
+		        "# TYPE univention_listener_replication_lag_seconds gauge\n"
+		        "univention_listener_replication_lag_seconds %.6f\n",
+		        last_lag);
+	fprintf(fp,
+	        "# HELP univention_listener_stage_seconds Time spent by transactions per stage.\n"
+	        "# TYPE univention_listener_stage_seconds histogram\n");
+	for (i = 0; i < METRICS_STAGES; i++)
+		histogram_write(fp, "univention_listener_stage_seconds", "stage", stage_names[i], &stages[i]);
+	fprintf(fp,
+	        "# HELP univention_listener_handler_seconds Run time per call of each module.\n"
+	        "# TYPE univention_listener_handler_seconds histogram\n");
+	for (handler = handlers; handler != NULL; handler = handler->next)
+		histogram_write(fp, "univention_listener_handler_seconds", "module", handler->name, &handler->stats.time);
+	fprintf(fp,
+	        "# HELP univention_listener_memory_bytes Resident set size and memory held by the larger structures.\n"
+	        "# TYPE univention_listener_memory_bytes gauge\n"
+	        "univention_listener_memory_bytes{kind=\"rss\"} %zu\n",
+	        memory_rss());
+	for (i = 0; i < MEMORY_KINDS; i++)
+		fprintf(fp, "univention_listener_memory_bytes{kind=\"%s\"} %zu\n", memory_kind_name(i), memory_get(i));
+	rv = fclose(fp);
+	if (rv != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not write %s: %s", tmp_filename, strerror(errno));
+		return;
+	}
+	if (rename(tmp_filename, filename) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "could not rename %s: %s", tmp_filename, strerror(errno));
+}
+
+
+/* log the mean time per stage and write the metrics file */
+void metrics_log(void) {
+	int i;
+
+	for (i = 0; i < METRICS_STAGES; i++) {
+		if (stages[i].count == 0)
+			continue;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "stage: %s count=%lu time_avg=%.6f", stage_names[i], stages[i].count, stages[i].sum / stages[i].count);
+	}
+	if (last_lag >= 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "replication lag %.3fs at %lu", last_lag, last_id);
+	metrics_write(true);
+}
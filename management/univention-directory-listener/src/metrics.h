@@ -0,0 +1,77 @@
+/*
+ * Univention Directory Listener
+ *  replication latency metrics
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* upper bounds in seconds, the last bucket counts everything */
+#define METRICS_BUCKETS 18
+
+/* The stages a transaction passes through, from being written on the
+ * Primary to being committed to the cache. */
+enum metrics_stage {
+	METRICS_NOTIFIER, /* reqStart in cn=translog until received from the notifier */
+	METRICS_FETCH,    /* searching cn=translog for the transaction */
+	METRICS_QUEUE,    /* received until processing starts */
+	METRICS_LDAP,     /* searching the entry in LDAP */
+	METRICS_HANDLERS, /* running the modules */
+	METRICS_CACHE,    /* updating the cache entry */
+	METRICS_COMMIT,   /* writing a group of transactions to disk */
+	METRICS_PROCESS,  /* received until processed */
+	METRICS_LAG,      /* written on the Primary until processed */
+	METRICS_STAGES
+};
+
+/* cumulative like the histograms of Prometheus */
+struct metrics_histogram {
+	unsigned long buckets[METRICS_BUCKETS];
+	unsigned long count;
+	double sum;
+};
+
+double metrics_monotonic(void);
+double metrics_realtime(void);
+double metrics_parse_time(const char *value, size_t len);
+void metrics_histogram_observe(struct metrics_histogram *histogram, double seconds);
+void metrics_observe(enum metrics_stage stage, double seconds);
+void metrics_processed(unsigned long id, double written, double received);
+void metrics_write(bool force);
+void metrics_log(void);
+
+#endif /* _METRICS_H_ */
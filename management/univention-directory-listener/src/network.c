@@ -40,16 +40,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdbool.h>
 
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <stdio.h>
 #include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <errno.h>
@@ -63,15 +68,34 @@
 
 #define NOTIFIER_PORT_PROTOCOL1 6668
 #define NOTIFIER_PORT_PROTOCOL2 6669
+/* unix socket of a notifier on the same host */
+#define NOTIFIER_SOCKET "/run/univention-directory-notifier.socket"
+
+#define NOTIFIER_RACE_DELAY 250 /* ms until the next address is tried in parallel */
+#define NOTIFIER_RACE_MAX 16    /* servers and connection attempts at once */
 
 static NotifierClient global_client;
 
+/* Commands of the text protocol by opcode */
+static const char *const notifier_commands[] = {
+	[NOTIFIER_OP_GET_DN] = "GET_DN",
+	[NOTIFIER_OP_WAIT_ID] = "WAIT_ID",
+	[NOTIFIER_OP_GET_DN_RANGE] = "GET_DN_RANGE",
+	[NOTIFIER_OP_GET_ID] = "GET_ID",
+	[NOTIFIER_OP_GET_SCHEMA_ID] = "GET_SCHEMA_ID",
+	[NOTIFIER_OP_ALIVE] = "ALIVE",
+	[NOTIFIER_OP_SUBSCRIBE] = "SUBSCRIBE",
+	[NOTIFIER_OP_CREDIT] = "CREDIT",
+};
+
 /* Free notifier entry. */
 void notifier_entry_free(NotifierEntry *entry) {
 	free(entry->dn);
 	entry->dn = NULL;
 	entry->id = 0;
 	entry->command = 0;
+	entry->written = 0;
+	entry->received = 0;
 }
 
 
@@ -130,82 +154,281 @@ static int parse_wait_id(const char *line, NotifierEntry *entry) {
 
 /* Send buffer in blocking mode. */
 static int send_block(NotifierClient *client, const char *buf, size_t len) {
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, ">>>%s", buf);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, ">>>%.*s", (int)len, buf);
 	return write(client->fd, buf, len);
 }
 
 
-/* Receive data in blocking mode. */
-static int recv_block(NotifierClient *client, char **back, time_t timeout) {
-	char buf[BUFSIZ];
-	char *result, *pos;
+/* Return end of first complete message in receive buffer, i.e. the first of
+ * the two terminating newlines. Already scanned data is not scanned again. */
+static char *find_message(NotifierClient *client) {
+	char *pos;
+
+	if (client->buf_tail - client->buf_scan < 2)
+		return NULL;
+
+	pos = memmem(client->buf + client->buf_scan, client->buf_tail - client->buf_scan, "\n\n", 2);
+	if (pos == NULL)
+		client->buf_scan = client->buf_tail - 1;
+	return pos;
+}
+
+
+/* Return length of first complete binary frame in receive buffer including
+ * its header, 0 if incomplete. */
+static size_t find_frame(NotifierClient *client) {
+	struct notifier_frame frame;
 	size_t len;
-	int rv;
 
-	/* receive block containing \n\n */
-	if (client->buf != NULL) {
-		result = client->buf;
-		len = strlen(result);
-	} else {
-		result = NULL;
-		len = 0;
+	if (client->buf_tail - client->buf_head < sizeof(frame))
+		return 0;
+
+	memcpy(&frame, client->buf + client->buf_head, sizeof(frame));
+	len = sizeof(frame) + ntohl(frame.length);
+	if (client->buf_tail - client->buf_head < len)
+		return 0;
+	return len;
+}
+
+
+/* Return if a complete message is buffered. */
+static bool have_message(NotifierClient *client) {
+	if (client->capabilities & NOTIFIER_CAP_BINARY)
+		return find_frame(client) > 0;
+	return find_message(client) != NULL;
+}
+
+
+/* Make room for at least BUFSIZ bytes at the end of the receive buffer. */
+static int reserve_buffer(NotifierClient *client) {
+	char *buf;
+	size_t size;
+
+	if (client->buf_size - client->buf_tail > BUFSIZ)
+		return 0;
+
+	/* move partial message to the front */
+	if (client->buf_head > 0) {
+		memmove(client->buf, client->buf + client->buf_head, client->buf_tail - client->buf_head);
+		client->buf_tail -= client->buf_head;
+		client->buf_scan -= client->buf_head;
+		client->buf_head = 0;
+		if (client->buf_size - client->buf_tail > BUFSIZ)
+			return 0;
 	}
 
-	/* read from network until string contains \n\n;
-	   XXX: we could probably also check that \n\n is at the end of
-	   the buffer; if it isn't, it's probably the beginning of a further
-	   message; */
-	while (result == NULL || (pos = strstr(result, "\n\n")) == NULL) {
+	size = client->buf_size ? client->buf_size * 2 : NOTIFIER_BUFSIZE;
+	if ((buf = realloc(client->buf, size)) == NULL)
+		return -1;
+	client->buf = buf;
+	client->buf_size = size;
+	return 0;
+}
+
+
+/* Return if compressed input is buffered, which may not be decompressed yet. */
+static bool have_compressed(NotifierClient *client) {
+	return (client->capabilities & NOTIFIER_CAP_ZSTD) && (client->zbuf_pos < client->zbuf_len || client->zbuf_more);
+}
+
+
+/* Decompress buffered input into the receive buffer.
+ * @return the number of bytes decompressed, -1 on errors. */
+static ssize_t decompress_more(NotifierClient *client) {
+	ZSTD_inBuffer in = {client->zbuf, client->zbuf_len, client->zbuf_pos};
+	ZSTD_outBuffer out = {client->buf + client->buf_tail, client->buf_size - client->buf_tail - 1, 0};
+	size_t rc;
+
+	rc = ZSTD_decompressStream(client->zstd, &out, &in);
+	if (ZSTD_isError(rc)) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to decompress data from notifier: %s", ZSTD_getErrorName(rc));
+		return -1;
+	}
+	client->zbuf_pos = in.pos;
+	if (client->zbuf_pos == client->zbuf_len)
+		client->zbuf_pos = client->zbuf_len = 0;
+	/* a full output buffer may leave data in the decompressor */
+	client->zbuf_more = out.pos == out.size;
+	return out.pos;
+}
+
+
+/* Read more data from notifier into receive buffer. */
+static int recv_more(NotifierClient *client, time_t timeout) {
+	int rv;
+
+	for (;;) {
 		ssize_t r;
 
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "RESULT: [%s]", result);
+		if (reserve_buffer(client) != 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to allocate receive buffer");
+			return -1;
+		}
+
+		if (have_compressed(client)) {
+			if ((r = decompress_more(client)) < 0)
+				return -1;
+			if (r > 0) {
+				client->buf_tail += r;
+				client->buf[client->buf_tail] = '\0';
+				return 0;
+			}
+			/* incomplete block */
+		}
+
 		if ((rv = notifier_wait(client, timeout)) == 0) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "timeout when receiving data");
-			return 0;
+			return -1;
 		} else if (rv < 0)
-			return 0;
+			return -1;
 
-		r = read(client->fd, buf, BUFSIZ);
+		if (client->capabilities & NOTIFIER_CAP_ZSTD) {
+			memmove(client->zbuf, client->zbuf + client->zbuf_pos, client->zbuf_len - client->zbuf_pos);
+			client->zbuf_len -= client->zbuf_pos;
+			client->zbuf_pos = 0;
+			r = recv(client->fd, client->zbuf + client->zbuf_len, ZSTD_DStreamInSize() - client->zbuf_len, MSG_DONTWAIT);
+		} else {
+			r = recv(client->fd, client->buf + client->buf_tail, client->buf_size - client->buf_tail - 1, MSG_DONTWAIT);
+		}
 		if (r == 0) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "connection to notifier was closed");
-			return 0;
+			return -1;
 		} else if (r < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+				continue;
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "error %d: %s while receiving from notifier", errno, strerror(errno));
-			return 0;
+			return -1;
 		}
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "received %zd bytes", r);
+		if (client->capabilities & NOTIFIER_CAP_ZSTD) {
+			client->zbuf_len += r;
+			continue;
+		}
+		client->buf_tail += r;
+		client->buf[client->buf_tail] = '\0';
+		return 0;
+	}
+}
+
+
+/* Receive message in blocking mode.
+ * @back is set to the message terminated by a single newline, which is
+ * located inside the receive buffer and only valid until the next call.
+ * One read may return several messages, which are returned by later calls
+ * without reading again. */
+static int recv_block(NotifierClient *client, char **back, time_t timeout) {
+	char *pos;
+	size_t len;
 
-		result = realloc(result, len + r + 1);
-		result[len] = '\0';
-		strncat(result, buf, r);
-		len += r;
-		result[len] = '\0';
+	while ((pos = find_message(client)) == NULL) {
+		if (recv_more(client, timeout) != 0)
+			return 0;
 	}
 
 	/* *(pos+1) is the second \n; split string there */
 	*(pos + 1) = '\0';
-	*back = result;
+	*back = client->buf + client->buf_head;
+	len = pos + 1 - *back;
 
-	if (*(pos + 2) != '\0') {
-		client->buf = strdup(pos + 2);
-	} else {
-		client->buf = NULL;
-	}
+	client->buf_head = client->buf_scan = pos + 2 - client->buf;
+	if (client->buf_head == client->buf_tail)
+		client->buf_head = client->buf_tail = client->buf_scan = 0;
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "<<<%s", *back);
-	return strlen(*back);
+	return len;
+}
+
+
+/* Receive binary frame in blocking mode.
+ * @payload is set to the payload of @len bytes inside the receive buffer,
+ * which is only valid until the next call.
+ * @return message ID, 0 on errors. */
+static int recv_frame(NotifierClient *client, char **payload, size_t *len, time_t timeout) {
+	struct notifier_frame frame;
+	size_t size;
+
+	while ((size = find_frame(client)) == 0) {
+		if (client->buf_tail - client->buf_head >= sizeof(frame)) {
+			memcpy(&frame, client->buf + client->buf_head, sizeof(frame));
+			if (ntohl(frame.length) > NOTIFIER_FRAME_MAX) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "frame of %u bytes too large", ntohl(frame.length));
+				return 0;
+			}
+		}
+		if (recv_more(client, timeout) != 0)
+			return 0;
+	}
+
+	memcpy(&frame, client->buf + client->buf_head, sizeof(frame));
+	if (ntohs(frame.opcode) != NOTIFIER_OP_RESULT) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "unexpected opcode %d", ntohs(frame.opcode));
+		return 0;
+	}
+	*payload = client->buf + client->buf_head + sizeof(frame);
+	*len = size - sizeof(frame);
+
+	client->buf_head += size;
+	if (client->buf_head == client->buf_tail)
+		client->buf_head = client->buf_tail = client->buf_scan = 0;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "<<<%u %.*s", ntohl(frame.msgid), (int)*len, *payload);
+	return ntohl(frame.msgid);
+}
+
+
+/* Format request @op with arguments @args (may be NULL) into @buf of @size bytes.
+ * @return length of request. */
+static size_t format_request(NotifierClient *client, char *buf, size_t size, int msgid, enum notifier_op op, const char *args) {
+	struct notifier_frame frame;
+	size_t len;
+
+	if (args == NULL)
+		args = "";
+
+	if (client->capabilities & NOTIFIER_CAP_BINARY) {
+		len = strlen(args);
+		assert(sizeof(frame) + len <= size);
+		frame.length = htonl(len);
+		frame.msgid = htonl(msgid);
+		frame.opcode = htons(op);
+		memcpy(buf, &frame, sizeof(frame));
+		memcpy(buf + sizeof(frame), args, len);
+		return sizeof(frame) + len;
+	}
+
+	len = snprintf(buf, size, "MSGID: %d\n%s%s%s\n\n", msgid, notifier_commands[op], *args ? " " : "", args);
+	assert(len < size);
+	return len;
+}
+
+
+/* Select request to retrieve DN of transaction @id for negotiated protocol. */
+static enum notifier_op get_dn_request(NotifierClient *client, NotifierID id, char *args, size_t size) {
+	switch (client->protocol) {
+	case 2:
+		snprintf(args, size, "%ld", id);
+		return NOTIFIER_OP_GET_DN;
+	case 3:
+		snprintf(args, size, "%ld", id);
+		return NOTIFIER_OP_WAIT_ID;
+	case 4:
+		snprintf(args, size, "%ld %d", id, NOTIFIER_RANGE_COUNT);
+		return NOTIFIER_OP_GET_DN_RANGE;
+	default:
+		abort();
+	}
 }
 
 
 /* Send notifier command. */
-static int notifier_send_command(NotifierClient *client, const char *msg) {
+static int notifier_send_command(NotifierClient *client, enum notifier_op op, const char *args) {
 	char buf[BUFSIZ];
 	int msgid;
-	ssize_t len;
+	size_t len;
 
 	assert(client->fd > -1);
 	msgid = ++client->last_msgid;
-	len = snprintf(buf, BUFSIZ, "MSGID: %d\n%s", msgid, msg);
-	assert(len < BUFSIZ - 1);
+	len = format_request(client, buf, BUFSIZ, msgid, op, args);
 	send_block(client, buf, len);
 	return msgid;
 }
@@ -227,11 +450,27 @@ int notifier_recv_result(NotifierClient *client, time_t timeout) {
 	} else if (rv < 0)
 		return 0;
 
+	if (client->capabilities & NOTIFIER_CAP_BINARY) {
+		size_t len;
+		int msgid;
+
+		if ((msgid = recv_frame(client, &result, &len, NOTIFIER_TIMEOUT)) <= 0)
+			return 0;
+		if ((msg = malloc(sizeof(NotifierMessage))) == NULL)
+			return 0;
+		msg->id = msgid;
+		msg->result = strndup(result, len);
+		msg->next = client->messages;
+		client->messages = msg;
+		return msg->id;
+	}
+
 	if (recv_block(client, &result, NOTIFIER_TIMEOUT) < 10)
 		return 0;
 
 	if ((msg = malloc(sizeof(NotifierMessage))) == NULL)
 		return 0;
+	msg->id = 0;
 
 	/* strip MSGID: %d\n and copy the rest to msg->result */
 	tmp = strchr(result, '\n');
@@ -249,7 +488,6 @@ int notifier_recv_result(NotifierClient *client, time_t timeout) {
 	}
 
 	msg->result = strdup(tmp + 1);
-	free(result);
 
 	/* insert into list */
 	msg->next = client->messages;
@@ -259,23 +497,28 @@ int notifier_recv_result(NotifierClient *client, time_t timeout) {
 }
 
 
-/* Remove message from queue of received messages. */
+/* Remove message from queue of received messages.
+ * Pushed transactions share the message ID of SUBSCRIBE, so the oldest
+ * message, i.e. the last one in the list, is returned. */
 static NotifierMessage *notifier_remove_msg(NotifierClient *client, int msgid) {
-	NotifierMessage *cur, *prev;
+	NotifierMessage *cur, *prev, *found = NULL, *found_prev = NULL;
 
 	if (client == NULL)
 		client = &global_client;
 
 	for (cur = client->messages, prev = NULL; cur != NULL; prev = cur, cur = cur->next) {
 		if (cur->id == msgid) {
-			if (cur == client->messages)
-				client->messages = cur->next;
-			else
-				prev->next = cur->next;
-			return cur;
+			found = cur;
+			found_prev = prev;
 		}
 	}
-	return NULL;
+	if (found == NULL)
+		return NULL;
+	if (found_prev == NULL)
+		client->messages = found->next;
+	else
+		found_prev->next = found->next;
+	return found;
 }
 
 
@@ -319,40 +562,256 @@ NotifierMessage *notifier_get_msg(NotifierClient *client, int msgid) {
 }
 
 
-/* Try to connect to notifier running on @server.
- *
- * @param client client data structure pointer.
- * @param server DNS name of notifier host.
- * @param starttls 0=no encryption, 2=require TLS (not supported)
- * @return 0 on success, 1 on (TLS, DNS, timeout, protocol) errors, 2 on connection-error.
+/* Check if @server with the addresses @addrs is the host itself. */
+static bool notifier_is_local(const char *server, const struct addrinfo *addrs) {
+	const struct addrinfo *res;
+	char *hostname, *domainname, fqdn[256] = "";
+
+	hostname = univention_config_get_string("hostname");
+	domainname = univention_config_get_string("domainname");
+	if (hostname && domainname)
+		snprintf(fqdn, sizeof(fqdn), "%s.%s", hostname, domainname);
+	free(hostname);
+	free(domainname);
+	if (!strcasecmp(server, fqdn))
+		return true;
+
+	for (res = addrs; res != NULL; res = res->ai_next) {
+		switch (res->ai_family) {
+		case AF_INET:
+			if ((ntohl(((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr) >> 24) != IN_LOOPBACKNET)
+				return false;
+			break;
+		case AF_INET6:
+			if (!IN6_IS_ADDR_LOOPBACK(&((struct sockaddr_in6 *)res->ai_addr)->sin6_addr))
+				return false;
+			break;
+		default:
+			return false;
+		}
+	}
+	return addrs != NULL;
+}
+
+
+/* Connect to the unix socket of the notifier on the same host.
+ * @return the socket or -1 if the notifier does not provide one.
  */
-int notifier_client_new(NotifierClient *client, const char *server, int starttls) {
-	struct sockaddr_in address4;
-	struct sockaddr_in6 address6;
-	struct sockaddr *address;
-	socklen_t addrlen;
-	struct addrinfo hints, *res, *result_addrinfo;
-	char *ucrvalue;
-	char addrstr[100];
-	int err;
+static int notifier_connect_local(void) {
+	struct sockaddr_un address = {
+	    .sun_family = AF_UNIX, .sun_path = NOTIFIER_SOCKET,
+	};
+	struct timeval timeout = {
+	    .tv_sec = NOTIFIER_TIMEOUT * 2, .tv_usec = 0,
+	};
+	int fd;
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return -1;
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set SO_RCVTIMEO");
+	if (setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set SO_SNDTIMEO");
+	if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "connection to %s failed with errorcode %d: %s", NOTIFIER_SOCKET, errno, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
 
-	if (client == NULL)
-		client = &global_client;
 
-	if (starttls >= 2) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "This version does not support TLS");
-		return 1;
+/* Set the timeouts and TCP keep-alive of the connection @fd. */
+static void notifier_set_sockopts(int fd) {
+	struct timeval timeout = {
+	    .tv_sec = NOTIFIER_TIMEOUT * 2, .tv_usec = 0,
+	};
+	int ret;
+	ret = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	if (ret < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set SO_RCVTIMEO");
+	ret = setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+	if (ret < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set SO_SNDTIMEO");
+
+	const int enable = 1;
+	ret = setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+	if (ret < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to enable TCP KEEPALIVE");
+	const int idle = 60;
+	ret = setsockopt(fd, SOL_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+	if (ret < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set TCP_KEEPIDLE");
+	const int probes = 12;
+	ret = setsockopt(fd, SOL_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+	if (ret < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set TCP_KEEPCNT");
+	const int interval = 5;
+	ret = setsockopt(fd, SOL_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
+	if (ret < 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set TCP_KEEPINTVL");
+}
+
+
+/* Milliseconds elapsed since @start. */
+static long elapsed_ms(const struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+
+/* Return the next address to try, taking the addresses of the servers in
+ * turns, so a server or address family that does not answer does not delay
+ * the others.
+ */
+static const struct addrinfo *notifier_next_address(struct addrinfo **next, int count, int *turn, int *server) {
+	const struct addrinfo *res;
+	int i, n;
+
+	for (n = 0; n < count; n++) {
+		i = (*turn + n) % count;
+		while ((res = next[i]) != NULL) {
+			next[i] = res->ai_next;
+			if (res->ai_family == AF_INET || res->ai_family == AF_INET6) {
+				*turn = i + 1;
+				*server = i;
+				return res;
+			}
+		}
 	}
+	return NULL;
+}
 
-	if (server != NULL) {
-		client->server = strdup(server);
-		client->protocol = 0;
-		client->starttls = 0;
-		client->messages = NULL;
-		client->last_msgid = 0;
-		client->buf = NULL;
-		client->fd = -1;
+
+/* Connect to the first of the @count servers with the resolved addresses
+ * @addrs to accept a connection. As in RFC 8305 the next address is tried
+ * after NOTIFIER_RACE_DELAY or as soon as an attempt fails, while the earlier
+ * attempts continue. The first connection established wins.
+ * @param winner returns the index of the server connected to.
+ * @param addrstr returns the address connected to.
+ * @return the connected socket or -1.
+ */
+static int notifier_connect_race(struct addrinfo *const *addrs, int count, int *winner, char *addrstr, size_t len) {
+	struct addrinfo *next[NOTIFIER_RACE_MAX];
+	struct pollfd fds[NOTIFIER_RACE_MAX];
+	struct {
+		int server;
+		char addr[INET6_ADDRSTRLEN];
+	} attempts[NOTIFIER_RACE_MAX];
+	const struct addrinfo *res;
+	struct sockaddr_storage address;
+	struct timespec start;
+	long now, last = -NOTIFIER_RACE_DELAY, wait;
+	int i, fd = -1, active = 0, turn = 0, server, err;
+	socklen_t errlen;
+	bool more = true;
+
+	for (i = 0; i < count; i++)
+		next[i] = addrs[i];
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	while (fd == -1 && (now = elapsed_ms(&start)) < NOTIFIER_TIMEOUT * 2 * 1000) {
+		/* start the next attempt if none is pending or the last one is overdue */
+		if (more && active < NOTIFIER_RACE_MAX && (active == 0 || now - last >= NOTIFIER_RACE_DELAY)) {
+			if ((res = notifier_next_address(next, count, &turn, &server)) == NULL) {
+				more = false;
+				continue;
+			}
+			memcpy(&address, res->ai_addr, res->ai_addrlen);
+			if (res->ai_family == AF_INET) {
+				((struct sockaddr_in *)&address)->sin_port = htons(NOTIFIER_PORT_PROTOCOL2);
+				inet_ntop(AF_INET, &((struct sockaddr_in *)&address)->sin_addr, attempts[active].addr, sizeof(attempts[active].addr));
+			} else {
+				((struct sockaddr_in6 *)&address)->sin6_port = htons(NOTIFIER_PORT_PROTOCOL2);
+				inet_ntop(AF_INET6, &((struct sockaddr_in6 *)&address)->sin6_addr, attempts[active].addr, sizeof(attempts[active].addr));
+			}
+			if ((fds[active].fd = socket(res->ai_family, SOCK_STREAM | SOCK_NONBLOCK, 0)) == -1) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "creating socket descriptor failed with errorcode %d: %s", errno, strerror(errno));
+				continue;
+			}
+			last = now;
+			attempts[active].server = server;
+			fds[active].events = POLLOUT;
+			if (connect(fds[active].fd, (struct sockaddr *)&address, res->ai_addrlen) == 0) {
+				fd = fds[active].fd;
+				*winner = server;
+				snprintf(addrstr, len, "%s", attempts[active].addr);
+				break;
+			} else if (errno != EINPROGRESS) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "connection to %s failed with errorcode %d: %s", attempts[active].addr, errno, strerror(errno));
+				close(fds[active].fd);
+				last = -NOTIFIER_RACE_DELAY;
+				continue;
+			}
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "connecting to %s", attempts[active].addr);
+			active++;
+			continue;
+		}
+		if (active == 0)
+			break;
+
+		wait = NOTIFIER_TIMEOUT * 2 * 1000 - now;
+		if (more && active < NOTIFIER_RACE_MAX && wait > NOTIFIER_RACE_DELAY - (now - last))
+			wait = NOTIFIER_RACE_DELAY - (now - last);
+		if (poll(fds, active, wait) == -1) {
+			if (errno == EINTR)
+				continue;
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "poll failed with errorcode %d: %s", errno, strerror(errno));
+			break;
+		}
+		for (i = 0; i < active; i++) {
+			if (!fds[i].revents)
+				continue;
+			errlen = sizeof(err);
+			if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1)
+				err = errno;
+			if (err == 0) {
+				fd = fds[i].fd;
+				*winner = attempts[i].server;
+				snprintf(addrstr, len, "%s", attempts[i].addr);
+				fds[i] = fds[--active];
+				break;
+			}
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "connection to %s failed with errorcode %d: %s", attempts[i].addr, err, strerror(err));
+			close(fds[i].fd);
+			fds[i] = fds[--active];
+			attempts[i] = attempts[active];
+			i--;
+			/* try the next address right away */
+			last = -NOTIFIER_RACE_DELAY;
+		}
+	}
+
+	/* abandon the slower attempts */
+	while (active > 0)
+		close(fds[--active].fd);
+
+	if (fd != -1 && fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK) == -1) {
+		close(fd);
+		fd = -1;
 	}
+	return fd;
+}
+
+
+/* Connect @client to the first of the @count @servers to answer and
+ * negotiate the protocol.
+ * @return 0 on success, 1 on (DNS, timeout, protocol) errors, 2 on connection-error.
+ */
+static int notifier_client_open(NotifierClient *client, const char *const *servers, int count) {
+	struct addrinfo hints, *addrs[NOTIFIER_RACE_MAX];
+	char *ucrvalue;
+	char addrstr[100];
+	int i, err, resolved = 0, winner = -1;
+	bool binary, zstd;
+
+	/* discard partial data from previous connection */
+	client->buf_head = client->buf_tail = client->buf_scan = 0;
+	client->zbuf_pos = client->zbuf_len = 0;
+	client->zbuf_more = false;
+	client->capabilities = 0;
 
 	if (client->fd > -1) {
 		close(client->fd);
@@ -376,124 +835,68 @@ int notifier_client_new(NotifierClient *client, const char *server, int starttls
 		free(ucrvalue);
 	}
 
-	address4.sin_family = AF_INET;
-	address4.sin_port = htons(NOTIFIER_PORT_PROTOCOL2);
-	address6.sin6_family = AF_INET6;
-	address6.sin6_port = htons(NOTIFIER_PORT_PROTOCOL2);
-
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "connecting to notifier %s:%d", client->server, NOTIFIER_PORT_PROTOCOL2);
-
-	err = getaddrinfo(client->server, NULL, &hints, &result_addrinfo);
-	if (err != 0) {
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "address resolution of %s failed with errorcode %d: %s", client->server, err, gai_strerror(err));
-		if (server != NULL) {
-			free(client->server);
-			client->server = NULL;
-		}
-		return 1;
+	/* binary framing is opt-in */
+	binary = false;
+	ucrvalue = univention_config_get_string("listener/notifier/binary");
+	if (ucrvalue) {
+		binary = !strcmp(ucrvalue, "yes") || !strcmp(ucrvalue, "true");
+		free(ucrvalue);
 	}
 
-	/* process all results */
-	for (res = result_addrinfo; res != NULL; res = res->ai_next) {
-		switch (res->ai_family) {
-		case AF_INET:
-			if ((client->fd = socket(AF_INET, SOCK_STREAM, 0)) == -1) {
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "creating IPv4 socket descriptor failed with errorcode %d: %s", errno, strerror(errno));
-				continue;
-			}
-			memcpy(&address4.sin_addr, &((struct sockaddr_in *)res->ai_addr)->sin_addr, sizeof(address4.sin_addr));
-			/* convert IPv4 address to string */
-			inet_ntop(res->ai_family, &((struct sockaddr_in *)res->ai_addr)->sin_addr, addrstr, 100);
-			address = (struct sockaddr *)&address4;
-			addrlen = sizeof(address4);
-			break;
+	/* compression only pays off over slow links */
+	zstd = false;
+	ucrvalue = univention_config_get_string("listener/notifier/compress");
+	if (ucrvalue) {
+		zstd = !strcmp(ucrvalue, "yes") || !strcmp(ucrvalue, "true");
+		free(ucrvalue);
+	}
 
-		case AF_INET6:
-			if ((client->fd = socket(AF_INET6, SOCK_STREAM, 0)) == -1) {
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "creating IPv6 socket descriptor failed with errorcode %d: %s", errno, strerror(errno));
-				continue;
-			}
-			memcpy(&address6.sin6_addr, &((struct sockaddr_in6 *)res->ai_addr)->sin6_addr, sizeof(address6.sin6_addr));
-			/* convert IPv6 address to string */
-			inet_ntop(res->ai_family, &((struct sockaddr_in6 *)res->ai_addr)->sin6_addr, addrstr, 100);
-			address = (struct sockaddr *)&address6;
-			addrlen = sizeof(address6);
-			break;
+	if (count > NOTIFIER_RACE_MAX)
+		count = NOTIFIER_RACE_MAX;
+	for (i = 0; i < count; i++) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "connecting to notifier %s:%d", servers[i], NOTIFIER_PORT_PROTOCOL2);
 
-		default:
-			/* unknown protocol */
+		err = getaddrinfo(servers[i], NULL, &hints, &addrs[i]);
+		if (err != 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "address resolution of %s failed with errorcode %d: %s", servers[i], err, gai_strerror(err));
+			addrs[i] = NULL;
 			continue;
 		}
+		resolved++;
 
-		{
-			struct timeval timeout = {
-			    .tv_sec = NOTIFIER_TIMEOUT * 2, .tv_usec = 0,
-			};
-			int ret;
-			ret = setsockopt(client->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
-			if (ret < 0)
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set SO_RCVTIMEO");
-			ret = setsockopt(client->fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
-			if (ret < 0)
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set SO_SNDTIMEO");
-
-			const int enable = 1;
-			ret = setsockopt(client->fd, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
-			if (ret < 0)
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to enable TCP KEEPALIVE");
-			const int idle = 60;
-			ret = setsockopt(client->fd, SOL_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
-			if (ret < 0)
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set TCP_KEEPIDLE");
-			const int probes = 12;
-			ret = setsockopt(client->fd, SOL_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
-			if (ret < 0)
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set TCP_KEEPCNT");
-			const int interval = 5;
-			ret = setsockopt(client->fd, SOL_TCP, TCP_KEEPINTVL, &interval, sizeof(interval));
-			if (ret < 0)
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Failed to set TCP_KEEPINTVL");
+		/* a notifier on the same host is reached without TCP */
+		if (winner < 0 && notifier_is_local(servers[i], addrs[i]) && (client->fd = notifier_connect_local()) != -1) {
+			snprintf(addrstr, sizeof(addrstr), "%s", NOTIFIER_SOCKET);
+			winner = i;
 		}
+	}
+	if (resolved == 0)
+		return 1;
 
-		if (connect(client->fd, address, addrlen) == -1) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "connection to %s failed with errorcode %d: %s", addrstr, errno, strerror(errno));
-			close(client->fd);
-			client->fd = -1;
-			continue;
-		}
-		break;
+	if (winner < 0 && (client->fd = notifier_connect_race(addrs, count, &winner, addrstr, sizeof(addrstr))) != -1)
+		notifier_set_sockopts(client->fd);
+	for (i = 0; i < count; i++) {
+		if (addrs[i] != NULL)
+			freeaddrinfo(addrs[i]);
 	}
-	freeaddrinfo(result_addrinfo);
 
 	if (client->fd == -1) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to connect to any notifier");
-		if (server != NULL) {
-			free(client->server);
-			client->server = NULL;
-		}
 		return 2;
 	}
 
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "established connection to %s port %d", addrstr, NOTIFIER_PORT_PROTOCOL2);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "established connection to %s (%s) port %d", servers[winner], addrstr, NOTIFIER_PORT_PROTOCOL2);
 
-	const char *header = "Version: 3\nCapabilities: \n\n";
-	const size_t len = strlen(header);
+	char header[64];
+	const size_t len = snprintf(header, sizeof(header), "Version: 4\nCapabilities: GET_DN_RANGE%s%s\n\n", binary ? " BINARY" : "", zstd ? " ZSTD" : "");
 	char *result, *tok;
 
 	if (send_block(client, header, len) != len) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "couldn't send header");
-		if (server != NULL) {
-			free(client->server);
-			client->server = NULL;
-		}
 		return 1;
 	}
 	if (recv_block(client, &result, NOTIFIER_TIMEOUT) < 1) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "couldn't receive header");
-		if (server != NULL) {
-			free(client->server);
-			client->server = NULL;
-		}
 		return 1;
 	}
 
@@ -510,24 +913,120 @@ int notifier_client_new(NotifierClient *client, const char *server, int starttls
 
 		if (strcmp(tok, "Version") == 0) {
 			client->protocol = atoi(val);
+		} else if (strcmp(tok, "Capabilities") == 0) {
+			char *cap, *saveptr;
+			client->capabilities = 0;
+			for (cap = strtok_r(val, " ", &saveptr); cap != NULL; cap = strtok_r(NULL, " ", &saveptr)) {
+				if (strcmp(cap, "GET_DN_RANGE") == 0)
+					client->capabilities |= NOTIFIER_CAP_GET_DN_RANGE;
+				else if (strcmp(cap, "SUBSCRIBE") == 0)
+					client->capabilities |= NOTIFIER_CAP_SUBSCRIBE;
+				else if (strcmp(cap, "BINARY") == 0 && binary)
+					client->capabilities |= NOTIFIER_CAP_BINARY;
+				else if (strcmp(cap, "ZSTD") == 0 && zstd)
+					client->capabilities |= NOTIFIER_CAP_ZSTD;
+			}
 		}
 	}
 
-	free(result);
+	/* the replies following the header are compressed */
+	if (client->capabilities & NOTIFIER_CAP_ZSTD) {
+		if (client->zstd == NULL && (client->zstd = ZSTD_createDCtx()) == NULL)
+			return 1;
+		ZSTD_DCtx_reset(client->zstd, ZSTD_reset_session_only);
+		if (client->zbuf == NULL && (client->zbuf = malloc(ZSTD_DStreamInSize())) == NULL)
+			return 1;
+	}
 
 	if (client->protocol < 2) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Protocol version %d is not supported", client->protocol);
-		if (server != NULL) {
-			free(client->server);
-			client->server = NULL;
-		}
 		return 1;
 	}
 
+	if (client->server != servers[winner]) {
+		free(client->server);
+		client->server = strdup(servers[winner]);
+	}
 	return 0;
 }
 
 
+/* Reset the state of @client for a new server. */
+static void notifier_client_init(NotifierClient *client) {
+	client->server = NULL;
+	client->protocol = 0;
+	client->capabilities = 0;
+	client->starttls = 0;
+	client->messages = NULL;
+	client->last_msgid = 0;
+	client->buf = NULL;
+	client->buf_size = 0;
+	client->fd = -1;
+	client->zstd = NULL;
+	client->zbuf = NULL;
+}
+
+
+/* Try to connect to notifier running on @server.
+ *
+ * @param client client data structure pointer.
+ * @param server DNS name of notifier host.
+ * @param starttls 0=no encryption, 2=require TLS (not supported)
+ * @return 0 on success, 1 on (TLS, DNS, timeout, protocol) errors, 2 on connection-error.
+ */
+int notifier_client_new(NotifierClient *client, const char *server, int starttls) {
+	if (client == NULL)
+		client = &global_client;
+
+	if (starttls >= 2) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "This version does not support TLS");
+		return 1;
+	}
+
+	if (server != NULL) {
+		notifier_client_init(client);
+		return notifier_client_open(client, &server, 1);
+	}
+	return notifier_client_open(client, (const char *const *)&client->server, 1);
+}
+
+
+/* Connect to the notifier of whichever of the @count @servers answers first.
+ * Connecting to several candidates in parallel avoids waiting for the timeout
+ * of each unreachable server in turn, when many listeners reconnect at once.
+ *
+ * @param client client data structure pointer.
+ * @param servers DNS names of notifier hosts in order of preference.
+ * @return the index of the server connected to or -1.
+ */
+int notifier_client_race(NotifierClient *client, const char *const *servers, int count) {
+	int i;
+
+	if (client == NULL)
+		client = &global_client;
+
+	if (client->server != NULL)
+		notifier_client_destroy(client);
+	notifier_client_init(client);
+	if (notifier_client_open(client, servers, count) != 0)
+		return -1;
+	for (i = 0; i < count; i++) {
+		if (!strcmp(servers[i], client->server))
+			return i;
+	}
+	return -1;
+}
+
+
+/* Check if @client is connected to the notifier on @server. */
+bool notifier_client_connected(NotifierClient *client, const char *server) {
+	if (client == NULL)
+		client = &global_client;
+
+	return client->server != NULL && client->fd > -1 && !strcmp(client->server, server);
+}
+
+
 /* Free notifier client data. */
 void notifier_client_destroy(NotifierClient *client) {
 	if (client == NULL)
@@ -540,6 +1039,13 @@ void notifier_client_destroy(NotifierClient *client) {
 		free(client->server);
 		client->server = NULL;
 	}
+	free(client->buf);
+	client->buf = NULL;
+	client->buf_size = client->buf_head = client->buf_tail = client->buf_scan = 0;
+	ZSTD_freeDCtx(client->zstd);
+	client->zstd = NULL;
+	free(client->zbuf);
+	client->zbuf = NULL;
 }
 
 
@@ -553,6 +1059,10 @@ int notifier_wait(NotifierClient *client, time_t timeout) {
 		client = &global_client;
 	assert(client->fd > -1);
 
+	/* a complete message may already be buffered from a previous read */
+	if (have_message(client) || have_compressed(client))
+		return 1;
+
 	FD_ZERO(&fds);
 	FD_SET(client->fd, &fds);
 
@@ -575,45 +1085,63 @@ int notifier_wait(NotifierClient *client, time_t timeout) {
 
 /* Send message to retrieve DN of given transaction from notifier. */
 int notifier_get_dn(NotifierClient *client, NotifierID id) {
-	char request[BUFSIZ];
+	char args[64];
+	enum notifier_op op;
 
 	if (client == NULL)
 		client = &global_client;
 
-	switch (client->protocol) {
-	case 2:
-		snprintf(request, BUFSIZ, "GET_DN %ld\n", id);
-		break;
-	case 3:
-		snprintf(request, BUFSIZ, "WAIT_ID %ld\n", id);
-		break;
-	default:
-		abort();
+	op = get_dn_request(client, id, args, sizeof(args));
+	return notifier_send_command(client, op, args);
+}
+
+
+/* Send messages to retrieve DNs of @count consecutive transactions starting
+ * at @id from notifier. All requests are sent with a single write, so the
+ * notifier receives them as one packet. The message IDs are stored in @msgids.
+ * @return the number of requests sent, 0 on errors.
+ */
+int notifier_get_dn_window(NotifierClient *client, NotifierID id, int count, int *msgids) {
+	char *buf;
+	size_t size, len = 0;
+	int i;
+
+	if (client == NULL)
+		client = &global_client;
+
+	assert(client->fd > -1);
+	size = count * 64;
+	if ((buf = malloc(size)) == NULL)
+		return 0;
+
+	for (i = 0; i < count; i++) {
+		char args[64];
+		enum notifier_op op;
+
+		msgids[i] = ++client->last_msgid;
+		op = get_dn_request(client, id + i, args, sizeof(args));
+		len += format_request(client, buf + len, size - len, msgids[i], op, args);
 	}
-	return notifier_send_command(client, request);
+
+	if (send_block(client, buf, len) != len)
+		count = 0;
+	free(buf);
+	return count;
 }
 
 
 /* Resend message to retrieve DN from notifier. */
 int notifier_resend_get_dn(NotifierClient *client, int msgid, NotifierID id) {
-	char buf[BUFSIZ];
-	ssize_t len;
+	char buf[BUFSIZ], args[64];
+	enum notifier_op op;
+	size_t len;
 
 	if (client == NULL)
 		client = &global_client;
 
 	assert(client->fd > -1);
-	switch (client->protocol) {
-	case 2:
-		len = snprintf(buf, BUFSIZ, "MSGID: %d\nGET_DN %ld\n\n", msgid, id);
-		break;
-	case 3:
-		len = snprintf(buf, BUFSIZ, "MSGID: %d\nWAIT_ID %ld\n\n", msgid, id);
-		break;
-	default:
-		abort();
-	}
-	assert(len < BUFSIZ - 1);
+	op = get_dn_request(client, id, args, sizeof(args));
+	len = format_request(client, buf, BUFSIZ, msgid, op, args);
 	send_block(client, buf, len);
 
 	return 0;
@@ -633,6 +1161,7 @@ int notifier_get_dn_result(NotifierClient *client, int msgid, NotifierEntry *ent
 
 	switch (client->protocol) {
 	case 2:
+	case 4:
 	parse_entry(msg->result, entry);
 		break;
 	case 3:
@@ -646,6 +1175,104 @@ int notifier_get_dn_result(NotifierClient *client, int msgid, NotifierEntry *ent
 }
 
 
+/* Wait for and return up to @size transactions from notifier.
+ * Protocol 4 returns consecutive transactions for GET_DN_RANGE, all others a single one.
+ * @return 0 on success, 1 on errors.
+ */
+int notifier_get_dn_range_result(NotifierClient *client, int msgid, NotifierEntry *entries, int size, int *count) {
+	NotifierMessage *msg;
+	char *line, *saveptr;
+	int rc = 0;
+
+	if (client == NULL)
+		client = &global_client;
+
+	*count = 0;
+	if (client->protocol != 4) {
+		if ((rc = notifier_get_dn_result(client, msgid, &entries[0])) == 0)
+			*count = 1;
+		return rc;
+	}
+
+	if ((msg = notifier_wait_msg(client, msgid, NOTIFIER_TIMEOUT)) == NULL)
+		return 1;
+
+	for (line = strtok_r(msg->result, "\n", &saveptr); line != NULL && *count < size; line = strtok_r(NULL, "\n", &saveptr)) {
+		if (parse_entry(line, &entries[*count]) != 2) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "bad transaction: [%s]", line);
+			rc = 1;
+			break;
+		}
+		++*count;
+	}
+	if (*count == 0)
+		rc = 1;
+	if (rc != 0) {
+		while (*count > 0)
+			notifier_entry_free(&entries[--*count]);
+	}
+
+	notifier_msg_free(msg);
+	return rc;
+}
+
+
+/* Return negotiated protocol version. */
+int notifier_get_protocol(NotifierClient *client) {
+	if (client == NULL)
+		client = &global_client;
+
+	return client->protocol;
+}
+
+
+/* Return if notifier supports GET_DN_RANGE. */
+int notifier_has_dn_range(NotifierClient *client) {
+	if (client == NULL)
+		client = &global_client;
+
+	return client->protocol >= 4 && (client->capabilities & NOTIFIER_CAP_GET_DN_RANGE);
+}
+
+
+/* Return if notifier supports SUBSCRIBE. */
+int notifier_has_subscribe(NotifierClient *client) {
+	if (client == NULL)
+		client = &global_client;
+
+	return client->protocol >= 4 && (client->capabilities & NOTIFIER_CAP_SUBSCRIBE);
+}
+
+
+/* Ask notifier to push all transactions starting at @id, at most @credits
+ * before more are granted by notifier_credit(). The pushed transactions are
+ * received like results of GET_DN_RANGE for the returned message ID. */
+int notifier_subscribe(NotifierClient *client, NotifierID id, int credits) {
+	char args[64];
+
+	if (client == NULL)
+		client = &global_client;
+
+	snprintf(args, sizeof(args), "%ld %d", id, credits);
+	return notifier_send_command(client, NOTIFIER_OP_SUBSCRIBE, args);
+}
+
+
+/* Allow notifier to push @credits more transactions for subscription @msgid. */
+int notifier_credit(NotifierClient *client, int msgid, int credits) {
+	char buf[BUFSIZ], args[32];
+	size_t len;
+
+	if (client == NULL)
+		client = &global_client;
+
+	assert(client->fd > -1);
+	snprintf(args, sizeof(args), "%d", credits);
+	len = format_request(client, buf, BUFSIZ, msgid, NOTIFIER_OP_CREDIT, args);
+	return send_block(client, buf, len) == len ? 0 : 1;
+}
+
+
 /* Retrieve current transaction ID from notifier. */
 int notifier_get_id_s(NotifierClient *client, NotifierID *id) {
 	int msgid;
@@ -654,7 +1281,7 @@ int notifier_get_id_s(NotifierClient *client, NotifierID *id) {
 	if (client == NULL)
 		client = &global_client;
 
-	msgid = notifier_send_command(client, "GET_ID\n");
+	msgid = notifier_send_command(client, NOTIFIER_OP_GET_ID, NULL);
 	if ((msg = notifier_wait_msg(client, msgid, NOTIFIER_TIMEOUT)) == NULL)
 		return 1;
 
@@ -673,7 +1300,7 @@ int notifier_get_schema_id_s(NotifierClient *client, NotifierID *id) {
 	if (client == NULL)
 		client = &global_client;
 
-	msgid = notifier_send_command(client, "GET_SCHEMA_ID\n");
+	msgid = notifier_send_command(client, NOTIFIER_OP_GET_SCHEMA_ID, NULL);
 	if ((msg = notifier_wait_msg(client, msgid, NOTIFIER_TIMEOUT)) == NULL)
 		return 1;
 
@@ -692,7 +1319,7 @@ int notifier_alive_s(NotifierClient *client) {
 	if (client == NULL)
 		client = &global_client;
 
-	msgid = notifier_send_command(client, "ALIVE\n");
+	msgid = notifier_send_command(client, NOTIFIER_OP_ALIVE, NULL);
 	if ((msg = notifier_wait_msg(client, msgid, NOTIFIER_TIMEOUT)) == NULL)
 		return 1;
 
@@ -37,8 +37,40 @@
 #define _NETWORK_H_
 
 #include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <zstd.h>
 
 #define NOTIFIER_TIMEOUT 120
+#define NOTIFIER_BUFSIZE (64 * 1024) /* initial size of receive buffer */
+#define NOTIFIER_RANGE_COUNT 1000 /* maximum number of transactions per GET_DN_RANGE */
+
+#define NOTIFIER_CAP_GET_DN_RANGE 1 /* since protocol 4 */
+#define NOTIFIER_CAP_BINARY 2       /* binary framing since protocol 4 */
+#define NOTIFIER_CAP_SUBSCRIBE 4    /* since protocol 4 */
+#define NOTIFIER_CAP_ZSTD 8         /* compression of the replies since protocol 4 */
+
+#define NOTIFIER_FRAME_MAX (16 * 1024 * 1024) /* maximum payload of binary frame */
+
+/* Opcodes of binary frames; replies use NOTIFIER_OP_RESULT. */
+enum notifier_op {
+	NOTIFIER_OP_RESULT = 0,
+	NOTIFIER_OP_GET_DN,
+	NOTIFIER_OP_WAIT_ID,
+	NOTIFIER_OP_GET_DN_RANGE,
+	NOTIFIER_OP_GET_ID,
+	NOTIFIER_OP_GET_SCHEMA_ID,
+	NOTIFIER_OP_ALIVE,
+	NOTIFIER_OP_SUBSCRIBE,
+	NOTIFIER_OP_CREDIT,
+};
+
+/* Header of binary frame in network byte order, followed by @length bytes of payload. */
+struct notifier_frame {
+	uint32_t length;
+	uint32_t msgid;
+	uint16_t opcode;
+} __attribute__((packed));
 
 typedef unsigned long NotifierID;
 
@@ -46,6 +78,8 @@ struct _NotifierEntry {
 	NotifierID id;
 	char *dn;
 	char command; /* 'd'elete, 'm'odify, 'a'dd, mod'r'dn */
+	double written;  /* seconds since the epoch of the change on the Primary, 0 if unknown */
+	double received; /* monotonic time received from the notifier, see metrics.h */
 } typedef NotifierEntry;
 
 struct _NotifierMessage {
@@ -57,15 +91,27 @@ struct _NotifierMessage {
 struct _NotifierClient {
 	char *server;
 	int protocol;
+	int capabilities;
 	int starttls;
 	int fd;
 	NotifierMessage *messages;
 	int last_msgid;
-	char *buf;
+	char *buf;       /* receive buffer */
+	size_t buf_size; /* allocated size of buf */
+	size_t buf_head; /* start of unprocessed data */
+	size_t buf_tail; /* end of received data */
+	size_t buf_scan; /* position to continue searching for end of message */
+	ZSTD_DCtx *zstd; /* decompresses the replies, if ZSTD was negotiated */
+	char *zbuf;      /* compressed input */
+	size_t zbuf_pos; /* start of compressed input not yet decompressed */
+	size_t zbuf_len; /* end of compressed input */
+	bool zbuf_more;  /* decompressed output may be pending without more input */
 } typedef NotifierClient;
 
 void notifier_entry_free(NotifierEntry *entry);
 int notifier_client_new(NotifierClient *client, const char *server, int starttls);
+int notifier_client_race(NotifierClient *client, const char *const *servers, int count);
+bool notifier_client_connected(NotifierClient *client, const char *server);
 void notifier_client_destroy(NotifierClient *client);
 int notifier_wait(NotifierClient *client, time_t timeout);
 
@@ -73,8 +119,15 @@ int notifier_recv_result(NotifierClient *client, time_t timeout);
 NotifierMessage *notifier_get_msg(NotifierClient *client, int msgid);
 
 int notifier_get_dn(NotifierClient *client, NotifierID id);
+int notifier_get_dn_window(NotifierClient *client, NotifierID id, int count, int *msgids);
 int notifier_resend_get_dn(NotifierClient *client, int msgid, NotifierID id);
 int notifier_get_dn_result(NotifierClient *client, int msgid, NotifierEntry *entry);
+int notifier_get_dn_range_result(NotifierClient *client, int msgid, NotifierEntry *entries, int size, int *count);
+int notifier_get_protocol(NotifierClient *client);
+int notifier_has_dn_range(NotifierClient *client);
+int notifier_has_subscribe(NotifierClient *client);
+int notifier_subscribe(NotifierClient *client, NotifierID id, int credits);
+int notifier_credit(NotifierClient *client, int msgid, int credits);
 int notifier_alive_s(NotifierClient *client);
 int notifier_get_id_s(NotifierClient *client, NotifierID *id);
 int notifier_get_schema_id_s(NotifierClient *client, NotifierID *id);
@@ -58,25 +58,271 @@
 #include "handlers.h"
 #include "cache.h"
 #include "change.h"
+#include "lane.h"
 #include "network.h"
 #include "transfile.h"
 #include "utils.h"
+#include "tunables.h"
+#include "metrics.h"
+#include "memory.h"
+#include "probes.h"
 
 #define DELAY_LDAP_CLOSE 15               /* 15 seconds */
 #define DELAY_ALIVE 5 * 60                /* 5 minutes */
 #define TIMEOUT_NOTIFIER_RECONNECT 5 * 60 /* 5 minutes */
+#define TRANSLOG_BATCH 100
+#define IDLE_WEIGHT 0.125       /* weight of newest sample in moving average */
+#define FREE_SPACE_INTERVAL 5         /* seconds between checks of the free space */
+#define FREE_SPACE_TRANSACTIONS 1000  /* transactions between checks of the free space */
+
+/* Requests sent to the notifier, which are not yet processed.
+ * The notifier only remembers one request per connection for a transaction
+ * which does not exist yet, so more than one request is only sent for
+ * transactions known to exist already. */
+struct window {
+	int size;         /* maximum number of outstanding requests */
+	int count;        /* number of outstanding requests */
+	int head;         /* index of oldest request in msgids */
+	int *msgids;      /* ring buffer of message IDs */
+	NotifierID next;  /* next transaction ID to request */
+	NotifierID known; /* highest transaction ID known to exist */
+	bool refresh;     /* ask notifier for its current ID */
+};
+
+/* Moving average of the time waited for the notifier, i.e. the inter-arrival
+ * time of transactions as seen by the listener. */
+struct idle {
+	double avg; /* seconds, negative until the first sample */
+	int max;    /* longest delay before closing the connections, 0 disables */
+};
+
+/* Transactions whose cache updates are committed together, see
+ * listener/cache/group-commit. */
+struct group_commit {
+	int max;       /* transactions per commit, 1 commits each one */
+	int latency;   /* milliseconds until the first one is committed */
+	int count;     /* processed, but not yet committed transactions */
+	double start;  /* time the first uncommitted transaction was processed */
+};
+
+/* Transactions received from the notifier, which are not yet processed. */
+struct queue {
+	int size;                /* capacity of entries */
+	int count;               /* number of received entries */
+	int pos;                 /* index of next entry to process */
+	NotifierEntry *entries;
+};
+
+
+/* Fetch details of transactions @first to @last from LDAP into @queue.
+ * reqSession has no ORDERING matching rule, so a disjunction of equality
+ * filters is used. On success at least @first is queued, followed by as many
+ * consecutive transactions as found. */
+static int notifier_wait_id_results(struct transaction *trans, NotifierID first, NotifierID last, struct queue *queue) {
+	LDAPMessage *res = NULL, *entry;
+	char *base = "cn=translog";
+	int scope = LDAP_SCOPE_ONELEVEL;
+	char *filter, *pos;
+	char *attrs[] = {"reqSession", "reqType", "reqDN", "reqStart", NULL};
+	int attrsonly0 = 0;
+	LDAPControl **serverctrls = NULL;
+	LDAPControl **clientctrls = NULL;
+	struct timeval timeout = {
+		.tv_sec = 5 * 60, .tv_usec = 0,
+	};
+	int count = last - first + 1;
+	NotifierID i;
+	int rv;
+
+	assert(queue->pos == queue->count);
+	assert(count >= 1 && count <= queue->size);
+	queue->pos = queue->count = 0;
+
+	// strlen("(reqSession=%lu)") + strlen(ULONG_MAX) per transaction
+	if ((pos = filter = malloc(count * 34 + 4)) == NULL)
+		return LDAP_NO_MEMORY;
+	pos += sprintf(pos, "(|");
+	for (i = first; i <= last; i++)
+		pos += sprintf(pos, "(reqSession=%lu)", i);
+	sprintf(pos, ")");
+
+	if ((rv = LDAP_RETRY(trans->lp, ldap_search_ext_s(trans->lp->ld, base, scope, filter, attrs, attrsonly0, serverctrls, clientctrls, &timeout, count, &res))) != LDAP_SUCCESS) {
+		LOG(ERROR, "LDAP failed %s (%d): id:%lu-%lu", ldap_err2string(rv), rv, first, last);
+		goto out;
+	}
+
+	for (entry = ldap_first_entry(trans->lp->ld, res); entry != NULL; entry = ldap_next_entry(trans->lp->ld, entry)) {
+		NotifierEntry *cur;
+		struct berval **vals;
+		char *end;
+
+		vals = ldap_get_values_len(trans->lp->ld, entry, "reqSession");
+		if (!vals || !vals[0]->bv_len) {
+			ldap_value_free_len(vals);
+			continue;
+		}
+		i = strtoul(vals[0]->bv_val, &end, 10);
+		ldap_value_free_len(vals);
+		if (i < first || i > last || *end)
+			continue;
+		cur = &queue->entries[i - first];
+		if (cur->id)
+			continue;
+
+		vals = ldap_get_values_len(trans->lp->ld, entry, "reqDN");
+		if (vals && vals[0]->bv_len > 0)
+			cur->dn = strndup(vals[0]->bv_val, vals[0]->bv_len + 1);
+		ldap_value_free_len(vals);
 
+		vals = ldap_get_values_len(trans->lp->ld, entry, "reqType");
+		if (vals && vals[0]->bv_len == 1)
+			cur->command = vals[0]->bv_val[0];
+		ldap_value_free_len(vals);
+
+		vals = ldap_get_values_len(trans->lp->ld, entry, "reqStart");
+		if (vals && vals[0] && (cur->written = metrics_parse_time(vals[0]->bv_val, vals[0]->bv_len)) > 0)
+			metrics_observe(METRICS_NOTIFIER, metrics_realtime() - cur->written);
+		ldap_value_free_len(vals);
+
+		cur->id = i;
+		LOG(INFO, "LDAP returned: id:%ld\tdn:%s\tcmd:%c", cur->id, cur->dn, cur->command);
+	}
+
+	/* only consecutive transactions can be processed */
+	while (queue->count < count && queue->entries[queue->count].id && queue->entries[queue->count].dn && queue->entries[queue->count].command)
+		queue->count++;
+	for (i = queue->count; i < count; i++)
+		notifier_entry_free(&queue->entries[i]);
+
+	if (queue->count == 0) {
+		LOG(ERROR, "LDAP returned no valid transaction: id:%lu", first);
+		rv = LDAP_NO_SUCH_OBJECT;
+	} else if (queue->count < count) {
+		LOG(WARN, "LDAP returned transactions %lu-%lu only", first, first + queue->count - 1);
+	}
+
+out:
+	ldap_msgfree(res);
+	free(filter);
+	return rv;
+}
+
+
+/* Take ownership of next queued transaction. */
+static void queue_pop(struct queue *queue, NotifierEntry *entry) {
+	assert(queue->pos < queue->count);
+	*entry = queue->entries[queue->pos];
+	memset(&queue->entries[queue->pos++], 0, sizeof(NotifierEntry));
+}
+
+
+/* Remember when the queued transactions were received, see metrics.h */
+static void queue_received(struct queue *queue) {
+	double now = metrics_monotonic();
+	int i;
+
+	for (i = queue->pos; i < queue->count; i++)
+		queue->entries[i].received = now;
+}
 
+
+/* Keep as many requests outstanding as allowed; at least one. */
+static int window_fill(struct window *win, NotifierID id) {
+	int count = 0;
+
+	/* a range result may have covered more than one transaction */
+	if (win->count == 0)
+		win->next = id + 1;
+
+	/* GET_DN does not return the latest ID, so ask for it explicitly */
+	if (win->refresh && win->size > 1 && win->next > win->known) {
+		NotifierID last;
+
+		win->refresh = false;
+		if (NOTIFIER_RETRY(notifier_get_id_s(NULL, &last)) == 0 && last > win->known)
+			win->known = last;
+	}
+
+	if (win->next <= win->known) {
+		count = win->size - win->count;
+		if (win->known - win->next + 1 < count)
+			count = win->known - win->next + 1;
+	} else if (win->count == 0) {
+		count = 1;
+	}
+
+	while (count > 0) {
+		/* split at the end of the ring buffer */
+		int tail = (win->head + win->count) % win->size;
+		int chunk = count < win->size - tail ? count : win->size - tail;
+
+		if (notifier_get_dn_window(NULL, win->next, chunk, &win->msgids[tail]) != chunk)
+			return 0;
+		win->count += chunk;
+		win->next += chunk;
+		count -= chunk;
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "%d requests outstanding up to %lu", win->count, win->next - 1);
+
+	return win->count;
+}
+
+
+/* Remove oldest request after its result has been received. */
+static void window_pop(struct window *win) {
+	assert(win->count > 0);
+	win->head = (win->head + 1) % win->size;
+	win->count--;
+}
+
+
+static double monotonic(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+static void free_space_changed(const char *key, const char *old_value, const char *new_value, void *data) {
+	int64_t *min_mib = data;
+
+	if (!strcmp(key, "listener/freespace")) {
+		*min_mib = new_value ? atoi(new_value) : -1;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "listener/freespace changed to %" PRId64, *min_mib);
+	}
+}
+
+
+/* Check the free space of the file systems only every few seconds or
+ * transactions, unless it is close to the limit. The limit is refreshed
+ * when UCR changes. */
 static void check_free_space() {
+	static struct univention_config_watch *watch;
 	static int64_t min_mib = -2;
+	static double next_time;
+	static int countdown;
 	const char *dirnames[] = {cache_dir, ldap_dir, NULL}, **dirname;
+	int64_t margin_mib = INT64_MAX;
+	double now;
 
-	if (min_mib == -2)
+	if (min_mib == -2) {
+		watch = univention_config_watch_new();
 		min_mib = univention_config_get_int("listener/freespace");
+	}
 
-	if (min_mib <= 0)
+	now = monotonic();
+	if (--countdown > 0 && now < next_time)
 		return;
 
+	if (watch)
+		univention_config_watch_dispatch(watch, free_space_changed, &min_mib);
+	if (min_mib <= 0) {
+		countdown = FREE_SPACE_TRANSACTIONS;
+		next_time = now + FREE_SPACE_INTERVAL;
+		return;
+	}
+
 	for (dirname = dirnames; *dirname; dirname++) {
 		struct statvfs buf;
 		int64_t free_mib;
@@ -85,54 +331,190 @@ static void check_free_space() {
 			continue;
 
 		free_mib = ((int64_t)buf.f_bavail * (int64_t)buf.f_frsize) >> 20;
+		if (free_mib - min_mib < margin_mib)
+			margin_mib = free_mib - min_mib;
 		if (free_mib >= min_mib)
 			continue;
 
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "File system '%s' full: %" PRId64 " < %" PRId64, *dirname, free_mib, min_mib);
 		abort();
 	}
+
+	/* within twice the limit, check before each transaction */
+	if (margin_mib < min_mib) {
+		countdown = 1;
+		next_time = now;
+	} else {
+		countdown = FREE_SPACE_TRANSACTIONS;
+		next_time = now + FREE_SPACE_INTERVAL;
+	}
 }
 
-/* Fetch transaction details from LDAP. */
-int notifier_wait_id_result(struct transaction *trans) {
-	LDAPMessage *res;
-	char base[44];  // strlen("reqSession=%ld,cn=translog") + strlen(ULONG_MAX)
-	int scope = LDAP_SCOPE_BASE;
-	char *filter = NULL;
-	char *attrs[] = {"reqType", "reqDN", NULL};
-	int attrsonly0 = 0;
-	LDAPControl **serverctrls = NULL;
-	LDAPControl **clientctrls = NULL;
-	struct timeval timeout = {
-		.tv_sec = 5 * 60, .tv_usec = 0,
-	};
-	int sizelimit0 = 1;
-	int rv;
 
-	snprintf(base, sizeof(base), "reqSession=%ld,cn=translog", trans->cur.notify.id);
-	if ((rv = LDAP_RETRY(trans->lp, ldap_search_ext_s(trans->lp->ld, base, scope, filter, attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res))) == LDAP_SUCCESS) {
-		LDAPMessage *entry = ldap_first_entry(trans->lp->ld, res);
-		struct berval **vals;
+static void idle_init(struct idle *idle) {
+	idle->avg = -1;
+	idle->max = tunables_get()->idle_max;
+}
 
-		vals = ldap_get_values_len(trans->lp->ld, entry, "reqDN");
-		if (vals && vals[0]->bv_len > 0)
-			trans->cur.notify.dn = strndup(vals[0]->bv_val, vals[0]->bv_len + 1);
-		else
-			rv = LDAP_NO_SUCH_ATTRIBUTE;
-		ldap_value_free_len(vals);
 
-		vals = ldap_get_values_len(trans->lp->ld, entry, "reqType");
-		if (vals && vals[0]->bv_len == 1)
-			trans->cur.notify.command = vals[0]->bv_val[0];
-		else
-			rv = LDAP_NO_SUCH_ATTRIBUTE;
-		ldap_value_free_len(vals);
-		LOG(INFO, "LDAP returned: id:%ld\tdn:%s\tcmd:%c", trans->cur.notify.id, trans->cur.notify.dn, trans->cur.notify.command);
-	} else {
-		LOG(ERROR, "LDAP failed %s (%d): id:%ld", ldap_err2string(rv), rv, trans->cur.notify.id);
+static void idle_update(struct idle *idle, double waited) {
+	if (idle->avg < 0)
+		idle->avg = waited;
+	else
+		idle->avg += IDLE_WEIGHT * (waited - idle->avg);
+}
+
+
+/* Return delay before closing the LDAP connections and running the postrun
+ * handlers. While transactions arrive more often than every @idle->max / 2
+ * seconds, the next one is expected soon and the connections stay open for
+ * twice the average inter-arrival time; otherwise they are closed early. */
+static time_t idle_timeout(const struct idle *idle) {
+	time_t timeout = DELAY_LDAP_CLOSE;
+
+	if (idle->avg >= 0 && 2 * idle->avg <= idle->max && 2 * idle->avg > DELAY_LDAP_CLOSE)
+		timeout = 2 * idle->avg + 0.5;
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ALL, "idle timeout %lds, average inter-arrival time %.1fs", (long)timeout, idle->avg);
+	return timeout;
+}
+
+
+static void group_commit_init(struct group_commit *gc) {
+	const struct tunables *tunables = tunables_get();
+
+	gc->max = tunables->group_commit;
+	gc->latency = tunables->group_commit_latency;
+	gc->count = 0;
+}
+
+
+/* Nest the cache updates of the next transaction into the current group. */
+static void group_commit_begin(struct group_commit *gc) {
+	if (gc->max > 1)
+		cache_batch_begin();
+}
+
+
+/* Write the group to disk. The lines of the transaction file are written
+ * first, so they are never missing for committed transactions, and the
+ * notifier ID file is only updated afterwards, so it never gets ahead of the
+ * master entry. */
+static void group_commit_flush(struct group_commit *gc) {
+	double start;
+
+	if (gc->count == 0)
+		return;
+	start = monotonic();
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "committing %d transactions up to %lu", gc->count, cache_master_entry.id);
+	if (notifier_flush_transaction_file() != 0) {
+		/* the uncommitted transactions are processed again after a restart */
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to write transaction file");
+		abort();
 	}
-	ldap_msgfree(res);
+	/* changes given to the lanes must not be lost with the master entry advanced */
+	lanes_sync();
+	cache_batch_commit();
+	if (cache_set_int("notifier_id", cache_master_entry.id))
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "failed to write notifier ID");
+	gc->count = 0;
+	metrics_observe(METRICS_COMMIT, monotonic() - start);
+}
+
+
+/* Remember transaction @id as processed; on a crash the listener restarts
+ * after the last committed one. */
+static void notifier_update_id(struct group_commit *gc, NotifierID id) {
+	/* without a batch the master entry is written at once */
+	if (gc->max <= 1)
+		lanes_sync();
+	cache_master_entry.id = id;
+	cache_update_master_entry(&cache_master_entry);
+	if (gc->count++ == 0)
+		gc->start = monotonic();
+	if (gc->count >= gc->max || (monotonic() - gc->start) * 1000 >= gc->latency)
+		group_commit_flush(gc);
+}
+
+
+/* Wait for result of request @msgid for transaction @id + 1.
+ * On timeouts, do maintenance stuff such as closing the LDAP connection or
+ * running postrun handlers. Unless @resend is false, the request is sent
+ * again after the notifier answered the keep-alive message. */
+static int notifier_wait_result(struct transaction *trans, int msgid, NotifierID id, bool resend, struct idle *idle) {
+	time_t timeout = idle_timeout(idle);
+	double start = monotonic();
+	bool closed = false;
+	int rv, postponed = 0;
+
+	while (notifier_get_msg(NULL, msgid) == NULL) {
+		/* timeout */
+		if ((rv = notifier_wait(NULL, timeout)) == 0) {
+			if (closed) {
+				if (NOTIFIER_RETRY(notifier_alive_s(NULL)) == 1) {
+					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to get alive answer");
+					return 1;
+				}
+				if (resend)
+					notifier_resend_get_dn(NULL, msgid, id + 1);
+				if (postponed > 0 && (postponed = handlers_postrun_all(false)) > 0 && postponed < DELAY_ALIVE)
+					timeout = postponed;
+				else
+					timeout = DELAY_ALIVE;
+			} else {
+				/* pooled connections are reused without a new bind */
+				if (trans->lp->ld != NULL) {
+					change_prefetch_clear(trans->lp->ld);
+					univention_ldap_release(trans->lp);
+				}
+				univention_ldap_release(trans->lp_local);
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "idle for %lds, running postrun handlers", (long)timeout);
+				postponed = handlers_postrun_all(false);
+				metrics_write(true);
+				closed = true;
+				timeout = postponed > 0 && postponed < DELAY_ALIVE ? postponed : DELAY_ALIVE;
+			}
+			continue;
+		} else if (rv > 0 && notifier_recv_result(NULL, NOTIFIER_TIMEOUT) == 0) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to recv result");
+			return 1;
+		} else if (rv < 0) {
+			return 1;
+		}
+	}
+	idle_update(idle, monotonic() - start);
+	return 0;
+}
+
 
+/* Process the deletions following the current one, e.g. of a subtree, at
+ * once with change_delete_batch(). */
+static int notifier_delete_batch(struct transaction *trans, struct queue *queue, struct group_commit *gc, bool write_transaction_file) {
+	int max = memory_limit(tunables_get()->delete_batch);
+	NotifierEntry *entries;
+	int count = 1, i, rv;
+
+	if ((entries = calloc(max, sizeof(NotifierEntry))) == NULL)
+		return 1;
+	entries[0] = trans->cur.notify;
+	while (count < max && queue->pos < queue->count && queue->entries[queue->pos].command == 'd' && queue->entries[queue->pos].id == entries[count - 1].id + 1) {
+		queue_pop(queue, &entries[count]);
+		PROBE3(transaction_start, entries[count].id, entries[count].dn, entries[count].command);
+		count++;
+	}
+
+	rv = change_delete_batch(entries, count);
+	for (i = 0; i < count && rv == LDAP_SUCCESS; i++) {
+		if (write_transaction_file && (rv = notifier_write_transaction_file(entries[i])) != 0)
+			break;
+		metrics_processed(entries[i].id, entries[i].written, entries[i].received);
+		PROBE1(transaction_end, entries[i].id);
+		notifier_update_id(gc, entries[i].id);
+	}
+
+	/* the first one is still owned by the transaction */
+	for (i = 1; i < count; i++)
+		notifier_entry_free(&entries[i]);
+	free(entries);
 	return rv;
 }
 
@@ -144,56 +526,92 @@ int notifier_listen(univention_ldap_parameters_t *lp, bool write_transaction_fil
 	struct transaction trans = {
 	    .lp = lp, .lp_local = lp_local,
 	};
+	/* GET_DN_RANGE and translog searches return many transactions at once */
+	bool range = notifier_has_dn_range(NULL);
+	bool translog = !range && notifier_get_protocol(NULL) == 3;
+	bool coalesce = tunables_get()->coalesce;
+	/* pushed transactions share the message ID of SUBSCRIBE */
+	bool subscribe = range && notifier_has_subscribe(NULL) && tunables_get()->notifier_subscribe;
+	int sub_msgid = 0;
+	struct idle idle;
+	struct group_commit gc;
+	struct window win = {
+	    .size = range || translog ? 1 : tunables_get()->notifier_window, .next = id + 1, .known = id, .refresh = true,
+	};
+	struct queue queue = {
+	    .size = range ? NOTIFIER_RANGE_COUNT : translog ? TRANSLOG_BATCH : 1,
+	};
+
+	if ((win.msgids = calloc(win.size, sizeof(int))) == NULL)
+		return 1;
+	if ((queue.entries = calloc(queue.size, sizeof(NotifierEntry))) == NULL) {
+		free(win.msgids);
+		return 1;
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "Using window of %d requests for %d transactions each", win.size, queue.size);
+	idle_init(&idle);
+	group_commit_init(&gc);
 
 	for (;;) {
-		int msgid;
-		time_t timeout = DELAY_LDAP_CLOSE;
+		int msgid, i;
+		double start;
 
 		check_free_space();
 
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "Last Notifier ID: %lu", id);
-		if ((msgid = notifier_get_dn(NULL, id + 1)) < 1)
-			break;
+		/* do not keep processed transactions uncommitted while idle */
+		if (queue.pos == queue.count)
+			group_commit_flush(&gc);
+		metrics_write(false);
+		if (queue.pos == queue.count && subscribe) {
+			/* the processed transactions are granted again, so never more
+			 * than fit into the queue are pushed */
+			if (sub_msgid == 0) {
+				sub_msgid = notifier_subscribe(NULL, id + 1, queue.size);
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "Subscribed from %lu", id + 1);
+			} else if (notifier_credit(NULL, sub_msgid, queue.count) != 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to send credit");
+				rv = 1;
+				goto out;
+			}
 
-		/* wait for data; on timeouts, do maintenance stuff
-		   such as closing the LDAP connection or running postrun
-		   handlers */
-		while (notifier_get_msg(NULL, msgid) == NULL) {
-			/* timeout */
-			if ((rv = notifier_wait(NULL, timeout)) == 0) {
-				if (timeout == DELAY_ALIVE) {
-					if (NOTIFIER_RETRY(notifier_alive_s(NULL)) == 1) {
-						univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to get alive answer");
-						return 1;
-					}
-					notifier_resend_get_dn(NULL, msgid, id + 1);
-				} else {
-					if (trans.lp->ld != NULL) {
-						ldap_unbind_ext(trans.lp->ld, NULL, NULL);
-						trans.lp->ld = NULL;
-					}
-					if (trans.lp_local->ld != NULL) {
-						ldap_unbind_ext(trans.lp_local->ld, NULL, NULL);
-						trans.lp_local->ld = NULL;
-					}
-					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "running postrun handlers");
-					handlers_postrun_all();
-					timeout = DELAY_ALIVE;
-				}
-				continue;
-			} else if (rv > 0 && notifier_recv_result(NULL, NOTIFIER_TIMEOUT) == 0) {
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to recv result");
-				return 1;
-			} else if (rv < 0) {
-				return 1;
+			if (notifier_wait_result(&trans, sub_msgid, id, false, &idle) != 0) {
+				rv = 1;
+				goto out;
 			}
-		}
 
-		memset(&trans.cur, 0, sizeof(trans.cur));
-		if (NOTIFIER_RETRY(notifier_get_dn_result(NULL, msgid, &trans.cur.notify)) != 0) {
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to get dn result");
-			return 1;
+			/* no retry, as the subscription is lost with the connection */
+			queue.pos = 0;
+			change_schema_expire();
+			if (notifier_get_dn_range_result(NULL, sub_msgid, queue.entries, queue.size, &queue.count) != 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to get pushed transactions");
+				rv = 1;
+				goto out;
+			}
+			queue_received(&queue);
+		} else if (queue.pos == queue.count) {
+			if (window_fill(&win, id) < 1)
+				break;
+			msgid = win.msgids[win.head];
+
+			if (notifier_wait_result(&trans, msgid, id, true, &idle) != 0) {
+				rv = 1;
+				goto out;
+			}
+
+			queue.pos = 0;
+			change_schema_expire();
+			if (NOTIFIER_RETRY(notifier_get_dn_range_result(NULL, msgid, queue.entries, queue.size, &queue.count)) != 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to get dn result");
+				rv = 1;
+				goto out;
+			}
+			queue_received(&queue);
+			window_pop(&win);
 		}
+
+		change_free_transaction_op(&trans.cur);
+		queue_pop(&queue, &trans.cur.notify);
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "notifier returned = id:%ld\tdn:%s\tcmd:%c", trans.cur.notify.id, trans.cur.notify.dn ? trans.cur.notify.dn : "<LDAP>", trans.cur.notify.command ? trans.cur.notify.command : '*');
 
 		if ((trans.cur.notify.id != id + 1 && trans.cur.notify.command != '\0') || trans.cur.notify.id <= id) {
@@ -201,6 +619,11 @@ int notifier_listen(univention_ldap_parameters_t *lp, bool write_transaction_fil
 			rv = 1;
 			goto out;
 		}
+		/* V3 returns the latest known ID */
+		if (trans.cur.notify.id > win.known)
+			win.known = trans.cur.notify.id;
+		if (trans.cur.notify.command != '\0')
+			win.refresh = true;
 
 		/* ensure that LDAP connection is open */
 		if (trans.lp->ld == NULL) {
@@ -210,13 +633,55 @@ int notifier_listen(univention_ldap_parameters_t *lp, bool write_transaction_fil
 
 		/* Fetch data from LDAP since protocol version 3 */
 		if (trans.cur.notify.command == '\0') {
-			// FIXME: V3 returns the latest known ID, but for now we're only interested in the next one
-			trans.cur.notify.id = id + 1;
-			rv = notifier_wait_id_result(&trans);
+			/* V3 returns the latest known ID: queue everything up to it */
+			NotifierID last = trans.cur.notify.id;
+			if (last > id + queue.size)
+				last = id + queue.size;
+			change_schema_expire();
+			start = monotonic();
+			rv = notifier_wait_id_results(&trans, id + 1, last, &queue);
 			if (rv != LDAP_SUCCESS)
 				goto out;
+			metrics_observe(METRICS_FETCH, monotonic() - start);
+			queue_received(&queue);
+			queue_pop(&queue, &trans.cur.notify);
 		}
+		if (trans.cur.notify.received > 0)
+			metrics_observe(METRICS_QUEUE, monotonic() - trans.cur.notify.received);
 		id = trans.cur.notify.id;
+		PROBE3(transaction_start, id, trans.cur.notify.dn, trans.cur.notify.command);
+		group_commit_begin(&gc);
+
+		/* The next modification of the same object fetches the same final
+		 * state from LDAP, so the handlers only need to run for the last one. */
+		if (coalesce && !trans.prev.notify.command && trans.cur.notify.command == 'm' && queue.pos < queue.count && queue.entries[queue.pos].command == 'm' && same_dn(trans.cur.notify.dn, queue.entries[queue.pos].dn)) {
+			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "coalescing %ld with %ld for %s", id, queue.entries[queue.pos].id, trans.cur.notify.dn);
+			if (write_transaction_file && (rv = notifier_write_transaction_file(trans.cur.notify)) != 0)
+				goto out;
+			metrics_processed(id, trans.cur.notify.written, trans.cur.notify.received);
+			PROBE1(transaction_end, id);
+			notifier_update_id(&gc, id);
+			change_free_transaction_op(&trans.cur);
+			continue;
+		}
+
+		/* consecutive deletions, e.g. of a subtree, are processed at once */
+		if (!trans.prev.notify.command && trans.cur.notify.command == 'd' && tunables_get()->delete_batch > 1 && queue.pos < queue.count && queue.entries[queue.pos].command == 'd') {
+			if ((rv = notifier_delete_batch(&trans, &queue, &gc, write_transaction_file)) != LDAP_SUCCESS) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "change_delete_batch failed: %d", rv);
+				goto out;
+			}
+			id = cache_master_entry.id;
+			change_free_transaction_op(&trans.cur);
+			handlers_gc();
+			continue;
+		}
+
+		/* search LDAP for the following transactions while handlers run */
+		for (i = queue.pos; i < queue.count; i++) {
+			if (!change_prefetch(&trans, &queue.entries[i]))
+				break;
+		}
 
 		if ((rv = change_update_dn(&trans)) != LDAP_SUCCESS) {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "change_update_dn failed: %d", rv);
@@ -241,15 +706,24 @@ int notifier_listen(univention_ldap_parameters_t *lp, bool write_transaction_fil
 		if (write_transaction_file && (rv = notifier_write_transaction_file(trans.cur.notify)) != 0)
 			goto out;
 
-		cache_master_entry.id = id;
-		cache_update_master_entry(&cache_master_entry);
-		if (cache_set_int("notifier_id", id))
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "failed to write notifier ID");
+		metrics_processed(id, trans.cur.notify.written, trans.cur.notify.received);
+		PROBE1(transaction_end, id);
+		notifier_update_id(&gc, id);
 		change_free_transaction_op(&trans.cur);
+		handlers_gc();
 	}
 
 out:
+	group_commit_flush(&gc);
+	cache_batch_commit();
+	metrics_write(true);
 	change_free_transaction_op(&trans.cur);
 	change_free_transaction_op(&trans.prev);
+	arena_free(&trans.cur.arena);
+	arena_free(&trans.prev.arena);
+	while (queue.pos < queue.count)
+		notifier_entry_free(&queue.entries[queue.pos++]);
+	free(queue.entries);
+	free(win.msgids);
 	return rv;
 }
@@ -0,0 +1,474 @@
+/*
+ * Univention Directory Listener
+ *  effective policies of the objects for libunivention-policy
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <lmdb.h>
+
+#include <univention/config.h>
+#include <univention/debug.h>
+#include <univention/ldap.h>
+#include <univention/policy.h>
+
+#include "common.h"
+#include "cache.h"
+#include "filter.h"
+#include "policy_index.h"
+#include "utils.h"
+
+/* sparse, the index only holds the policies of the objects matching the filter */
+#define POLICY_INDEX_MAPSIZE ((size_t)1 << 30)
+/* objects resolved per write transaction while building the index */
+#define POLICY_INDEX_BATCH 1000
+/* remembers the filter the index was built for */
+#define POLICY_INDEX_FILTER "@filter"
+
+/*
+ * The policies of the objects matching listener/policy/index/filter as
+ * resolved by univention_policy_open(), which reads them from here instead of
+ * LDAP, see UNIVENTION_POLICY_INDEX. They are resolved again whenever the
+ * object, a policy it may use or the policy references above it change.
+ */
+static struct {
+	univention_ldap_parameters_t *lp;
+	MDB_env *env;
+	MDB_dbi dbi;
+	struct filter filter;
+	char *base_key;
+} policy_index;
+static struct filter *policy_index_filters[] = {&policy_index.filter, NULL};
+
+static bool has_value(CacheEntry *entry, const char *name, const char *value) {
+	CacheEntryAttribute *attr;
+	int i;
+
+	if (entry == NULL || (attr = cache_entry_find_attribute(entry, name, strlen(name))) == NULL)
+		return false;
+	for (i = 0; i < attr->value_count; i++) {
+		if (strcasecmp(attr->values[i], value) == 0)
+			return true;
+	}
+	return false;
+}
+
+static bool is_policy(CacheEntry *entry) {
+	return has_value(entry, "objectClass", "univentionPolicy");
+}
+
+/* Check if the policies referenced by the object itself changed. */
+static bool references_changed(CacheEntry *new, CacheEntry *old) {
+	CacheEntryAttribute *new_refs, *old_refs;
+	int i;
+
+	new_refs = cache_entry_find_attribute(new, "univentionPolicyReference", strlen("univentionPolicyReference"));
+	old_refs = cache_entry_find_attribute(old, "univentionPolicyReference", strlen("univentionPolicyReference"));
+	if (new_refs == NULL || old_refs == NULL)
+		return new_refs != old_refs;
+	if (new_refs->value_count != old_refs->value_count)
+		return true;
+	for (i = 0; i < new_refs->value_count; i++) {
+		if (!has_value(old, "univentionPolicyReference", new_refs->values[i]))
+			return true;
+	}
+	return false;
+}
+
+/* Check if the index key is @base or below it. */
+static bool is_below(const char *key, const char *base, size_t base_len) {
+	size_t len = strlen(key);
+
+	if (len == base_len)
+		return memcmp(key, base, len) == 0;
+	return len > base_len && key[len - base_len - 1] == ',' && memcmp(key + len - base_len, base, base_len) == 0;
+}
+
+static int put_string(MDB_txn *txn, const char *key, const char *value, size_t size) {
+	MDB_val k = {.mv_size = strlen(key), .mv_data = (void *)key}, v = {.mv_size = size, .mv_data = (void *)value};
+
+	return mdb_put(txn, policy_index.dbi, &k, &v, 0);
+}
+
+static int del_key(MDB_txn *txn, const char *key) {
+	MDB_val k = {.mv_size = strlen(key), .mv_data = (void *)key};
+	int rv;
+
+	rv = mdb_del(txn, policy_index.dbi, &k, NULL);
+	return rv == MDB_NOTFOUND ? MDB_SUCCESS : rv;
+}
+
+static bool equals_string(MDB_txn *txn, const char *key, const char *value) {
+	MDB_val k = {.mv_size = strlen(key), .mv_data = (void *)key}, v;
+
+	return mdb_get(txn, policy_index.dbi, &k, &v) == MDB_SUCCESS && v.mv_size == strlen(value) && memcmp(v.mv_data, value, v.mv_size) == 0;
+}
+
+/* Resolve the policies of the object @key from LDAP and store them, or drop them if that fails. */
+static int store(MDB_txn *txn, const char *key) {
+	univention_policy_handle_t *handle;
+	char *data;
+	size_t size;
+	int rv;
+
+	if ((handle = univention_policy_open(policy_index.lp->ld, policy_index.lp->base, key)) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "policy index: resolving policies of %s failed", key);
+		return del_key(txn, key);
+	}
+	data = univention_policy_dump(handle, &size);
+	univention_policy_close(handle);
+	if (data == NULL)
+		return del_key(txn, key);
+	rv = put_string(txn, key, data, size);
+	free(data);
+	if (rv != MDB_SUCCESS)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "policy index: storing %s failed: %s", key, mdb_strerror(rv));
+	return rv;
+}
+
+/*
+ * Collect the indexed objects at or below @base.
+ * :returns: The NULL-terminated keys, to be freed by the caller.
+ */
+static char **collect_below(MDB_txn *txn, const char *base) {
+	MDB_cursor *cur;
+	MDB_val key, data;
+	char **keys;
+	size_t base_len = strlen(base), count = 0, size = 16;
+	int rv;
+
+	if ((keys = malloc(size * sizeof(char *))) == NULL)
+		abort();  // FIXME
+	if (mdb_cursor_open(txn, policy_index.dbi, &cur) == MDB_SUCCESS) {
+		for (rv = mdb_cursor_get(cur, &key, &data, MDB_FIRST); rv == MDB_SUCCESS; rv = mdb_cursor_get(cur, &key, &data, MDB_NEXT)) {
+			char *k;
+
+			if ((k = strndup(key.mv_data, key.mv_size)) == NULL)
+				abort();  // FIXME
+			if (k[0] == '@' || !is_below(k, base, base_len)) {
+				free(k);
+				continue;
+			}
+			if (count + 1 == size && (keys = realloc(keys, (size *= 2) * sizeof(char *))) == NULL)
+				abort();  // FIXME
+			keys[count++] = k;
+		}
+		mdb_cursor_close(cur);
+	}
+	keys[count] = NULL;
+	return keys;
+}
+
+/* Resolve the policies of the indexed objects at or below @base again. */
+static int refresh_below(MDB_txn *txn, const char *base) {
+	char **keys = collect_below(txn, base), **k;
+	int rv = MDB_SUCCESS;
+
+	for (k = keys; *k; k++) {
+		if (rv == MDB_SUCCESS)
+			rv = store(txn, *k);
+		free(*k);
+	}
+	free(keys);
+	return rv;
+}
+
+/* Resolve the policies of the indexed objects which may use the policy @dn again. */
+static int refresh_referencing(MDB_txn *txn, const char *dn) {
+	struct timeval timeout = {.tv_sec = 5 * 60, .tv_usec = 0};
+	char *attrs[] = {LDAP_NO_ATTRS, NULL}, *filter, *ref, *key;
+	struct berval value = {.bv_len = strlen(dn), .bv_val = (char *)dn}, escaped;
+	LDAPMessage *res = NULL, *entry;
+	size_t len;
+	int rv;
+
+	if (ldap_bv2escaped_filter_value(&value, &escaped) != 0)
+		return LDAP_NO_MEMORY;
+	len = strlen("(univentionPolicyReference=)") + escaped.bv_len + 1;
+	if ((filter = malloc(len)) == NULL)
+		abort();  // FIXME
+	snprintf(filter, len, "(univentionPolicyReference=%s)", escaped.bv_val);
+	ber_memfree(escaped.bv_val);
+
+	rv = ldap_search_ext_s(policy_index.lp->ld, policy_index.lp->base, LDAP_SCOPE_SUBTREE, filter, attrs, 0, NULL, NULL, &timeout, 0, &res);
+	if (rv != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "policy index: searching %s failed: %s", filter, ldap_err2string(rv));
+	} else {
+		for (entry = ldap_first_entry(policy_index.lp->ld, res); entry != NULL && rv == MDB_SUCCESS; entry = ldap_next_entry(policy_index.lp->ld, entry)) {
+			if ((ref = ldap_get_dn(policy_index.lp->ld, entry)) == NULL)
+				continue;
+			if ((key = univention_policy_index_key(ref)) == NULL)
+				abort();  // FIXME
+			rv = refresh_below(txn, key);
+			free(key);
+			ldap_memfree(ref);
+		}
+	}
+	ldap_msgfree(res);
+	free(filter);
+	return rv;
+}
+
+static int begin(MDB_txn **txn) {
+	int rv;
+
+	if ((rv = mdb_txn_begin(policy_index.env, NULL, 0, txn)) != MDB_SUCCESS)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "policy index: mdb_txn_begin: %s", mdb_strerror(rv));
+	return rv;
+}
+
+static void end(MDB_txn *txn, int rv) {
+	if (rv != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "policy index: %s", rv > 0 ? ldap_err2string(rv) : mdb_strerror(rv));
+		mdb_txn_abort(txn);
+	} else if ((rv = mdb_txn_commit(txn)) != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "policy index: mdb_txn_commit: %s", mdb_strerror(rv));
+	}
+}
+
+/* Resolve the policies of all cached objects matching the filter. */
+static int build(void) {
+	CacheIterOptions options = {0};
+	CacheIter iter;
+	CacheEntry entry;
+	MDB_txn *txn;
+	char *dn = NULL, *key;
+	int rv, count = 0;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "policy index: building for %s", policy_index.filter.filter);
+	if ((rv = cache_iter_begin(&iter, &options)) != MDB_SUCCESS)
+		return rv;
+	if ((rv = begin(&txn)) != MDB_SUCCESS) {
+		cache_iter_end(&iter);
+		return rv;
+	}
+	while ((rv = cache_iter_next(&iter, NULL, &dn, &entry)) != MDB_NOTFOUND) {
+		if (rv == -1)
+			continue;
+		if (rv != MDB_SUCCESS)
+			break;
+		if (cache_entry_ldap_filter_match(policy_index_filters, dn, &entry)) {
+			if ((key = univention_policy_index_key(dn)) == NULL)
+				abort();  // FIXME
+			rv = store(txn, key);
+			free(key);
+			if (rv == MDB_SUCCESS && ++count % POLICY_INDEX_BATCH == 0) {
+				if ((rv = mdb_txn_commit(txn)) == MDB_SUCCESS)
+					rv = begin(&txn);
+				else
+					txn = NULL;
+			}
+		}
+		cache_free_entry(NULL, &entry);
+		if (rv != MDB_SUCCESS)
+			break;
+	}
+	cache_iter_end(&iter);
+	free(dn);
+	if (rv == MDB_NOTFOUND)
+		rv = MDB_SUCCESS;
+	if (rv == MDB_SUCCESS)
+		rv = put_string(txn, POLICY_INDEX_FILTER, policy_index.filter.filter, strlen(policy_index.filter.filter));
+	/* only now readers may use the index */
+	if (rv == MDB_SUCCESS)
+		rv = put_string(txn, UNIVENTION_POLICY_INDEX_BASE, policy_index.base_key, strlen(policy_index.base_key));
+	if (txn)
+		end(txn, rv);
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "policy index: resolved the policies of %d objects", count);
+	return rv;
+}
+
+/* Remove a stale index, which readers would use otherwise. */
+static void remove_index(const char *dir) {
+	char file[PATH_MAX];
+
+	snprintf(file, sizeof(file), "%s/data.mdb", dir);
+	if (unlink(file) == 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "policy index: removed %s", dir);
+	snprintf(file, sizeof(file), "%s/lock.mdb", dir);
+	unlink(file);
+	rmdir(dir);
+}
+
+/*
+ * Open the index of the policies, building it if the filter or the LDAP base
+ * changed, or remove it if listener/policy/index/filter is not set.
+ */
+int policy_index_init(univention_ldap_parameters_t *lp) {
+	char dir[PATH_MAX];
+	MDB_txn *txn;
+	int rv;
+
+	/* the policies are resolved from LDAP here, not from the index */
+	univention_policy_index_set(NULL);
+	snprintf(dir, sizeof(dir), "%s/policy", cache_dir);
+	policy_index_close();
+	policy_index.filter.filter = univention_config_get_string("listener/policy/index/filter");
+	if (policy_index.filter.filter == NULL || policy_index.filter.filter[0] == '\0') {
+		remove_index(dir);
+		policy_index_close();
+		return 0;
+	}
+	if ((policy_index.filter.node = filter_compile(policy_index.filter.filter)) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "policy index: invalid listener/policy/index/filter: %s", policy_index.filter.filter);
+		remove_index(dir);
+		policy_index_close();
+		return 1;
+	}
+	policy_index.filter.base = strdup(lp->base);
+	policy_index.filter.scope = LDAP_SCOPE_SUBTREE;
+	policy_index.base_key = univention_policy_index_key(lp->base);
+	policy_index.lp = lp;
+
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "policy index: mkdir %s: %s", dir, strerror(errno));
+		policy_index_close();
+		return 1;
+	}
+	if ((rv = mdb_env_create(&policy_index.env)) != MDB_SUCCESS || (rv = mdb_env_set_mapsize(policy_index.env, POLICY_INDEX_MAPSIZE)) != MDB_SUCCESS ||
+	    (rv = mdb_env_open(policy_index.env, dir, 0, 0600)) != MDB_SUCCESS || (rv = begin(&txn)) != MDB_SUCCESS) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "policy index: opening %s failed: %s", dir, mdb_strerror(rv));
+		policy_index_close();
+		return rv;
+	}
+	if ((rv = mdb_dbi_open(txn, NULL, 0, &policy_index.dbi)) != MDB_SUCCESS) {
+		end(txn, rv);
+		policy_index_close();
+		return rv;
+	}
+	if (equals_string(txn, POLICY_INDEX_FILTER, policy_index.filter.filter) && equals_string(txn, UNIVENTION_POLICY_INDEX_BASE, policy_index.base_key)) {
+		end(txn, MDB_SUCCESS);
+		return 0;
+	}
+	/* start over */
+	rv = mdb_drop(txn, policy_index.dbi, 0);
+	end(txn, rv);
+	if (rv == MDB_SUCCESS)
+		rv = build();
+	if (rv != MDB_SUCCESS)
+		policy_index_close();
+	return rv;
+}
+
+/* Update the index after the object @dn was added or modified. */
+void policy_index_update(const char *dn, CacheEntry *new, CacheEntry *old) {
+	MDB_txn *txn;
+	char *key;
+	int rv;
+
+	if (policy_index.env == NULL || begin(&txn) != MDB_SUCCESS)
+		return;
+	if ((key = univention_policy_index_key(dn)) == NULL)
+		abort();  // FIXME
+	if (cache_entry_ldap_filter_match(policy_index_filters, dn, new))
+		rv = store(txn, key);
+	else
+		rv = del_key(txn, key);
+	/* the policies of the objects below are not affected by the object itself */
+	if (rv == MDB_SUCCESS && references_changed(new, old))
+		rv = refresh_below(txn, key);
+	if (rv == MDB_SUCCESS && (is_policy(new) || is_policy(old)))
+		rv = refresh_referencing(txn, dn);
+	end(txn, rv);
+	free(key);
+}
+
+/* Update the index after the object @dn was removed. */
+void policy_index_delete(const char *dn, CacheEntry *old) {
+	MDB_txn *txn;
+	char *key;
+	int rv;
+
+	if (policy_index.env == NULL || begin(&txn) != MDB_SUCCESS)
+		return;
+	if ((key = univention_policy_index_key(dn)) == NULL)
+		abort();  // FIXME
+	rv = del_key(txn, key);
+	if (rv == MDB_SUCCESS && is_policy(old))
+		rv = refresh_referencing(txn, dn);
+	end(txn, rv);
+	free(key);
+}
+
+/* Update the index after the object @old_dn with everything below it was moved to @new_dn. */
+void policy_index_move(const char *old_dn, const char *new_dn) {
+	MDB_txn *txn;
+	char *old_key, *new_key, **keys, **k, *moved;
+	size_t old_len, new_len, len;
+	int rv = MDB_SUCCESS;
+
+	if (policy_index.env == NULL || begin(&txn) != MDB_SUCCESS)
+		return;
+	if ((old_key = univention_policy_index_key(old_dn)) == NULL || (new_key = univention_policy_index_key(new_dn)) == NULL)
+		abort();  // FIXME
+	old_len = strlen(old_key);
+	new_len = strlen(new_key);
+	keys = collect_below(txn, old_key);
+	for (k = keys; *k; k++) {
+		if (rv == MDB_SUCCESS)
+			rv = del_key(txn, *k);
+		if (rv == MDB_SUCCESS) {
+			/* the policies above may differ at the new place */
+			len = strlen(*k) - old_len;
+			if ((moved = malloc(len + new_len + 1)) == NULL)
+				abort();  // FIXME
+			memcpy(moved, *k, len);
+			memcpy(moved + len, new_key, new_len + 1);
+			rv = store(txn, moved);
+			free(moved);
+		}
+		free(*k);
+	}
+	free(keys);
+	end(txn, rv);
+	free(old_key);
+	free(new_key);
+}
+
+void policy_index_close(void) {
+	if (policy_index.env != NULL)
+		mdb_env_close(policy_index.env);
+	policy_index.env = NULL;
+	FREE(policy_index.filter.filter);
+	FREE(policy_index.filter.base);
+	filter_free(policy_index.filter.node);
+	policy_index.filter.node = NULL;
+	FREE(policy_index.base_key);
+}
@@ -0,0 +1,74 @@
+/*
+ * Univention Directory Listener
+ *  static tracepoints
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef _PROBES_H_
+#define _PROBES_H_
+
+/* USDT probes of the provider "univention_listener" for tracing without debug
+ * logging, e.g. the run time of each module:
+ *   bpftrace -e 'usdt:/usr/sbin/univention-directory-listener:univention_listener:handler_start { @start[tid] = nsecs; }
+ *                usdt:/usr/sbin/univention-directory-listener:univention_listener:handler_end { @[str(arg0)] = hist(nsecs - @start[tid]); }'
+ * Each probe is a single NOP until it is traced. Without <sys/sdt.h> they are
+ * left out.
+ *
+ * transaction_start(id, dn, command) and transaction_end(id): notifier_listen()
+ * ldap_fetch_start(id, base) and ldap_fetch_end(id, rv): change_update_dn()
+ * handler_start(module, dn, command) and handler_end(module, rv): handler_exec()
+ * cache_commit_start(id, dn) and cache_commit_end(id, rv): cache_update_entry()
+ * batch_commit_start() and batch_commit_end(rv): cache_batch_commit()
+ */
+#ifdef __has_include
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SDT 1
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE0(name) DTRACE_PROBE(univention_listener, name)
+#define PROBE1(name, a) DTRACE_PROBE1(univention_listener, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(univention_listener, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(univention_listener, name, a, b, c)
+#else
+#define PROBE0(name) \
+	do {         \
+	} while (0)
+#define PROBE1(name, a) PROBE0(name)
+#define PROBE2(name, a, b) PROBE0(name)
+#define PROBE3(name, a, b, c) PROBE0(name)
+#endif
+
+#endif /* _PROBES_H_ */
@@ -34,25 +34,221 @@
  */
 #include <stdio.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 #include "select_server.h"
+#include "network.h"
 #include <univention/debug.h>
 #include <univention/ldap.h>
 #include <univention/config.h>
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+#define DEFAULT_RACE 3 /* candidates connected to in parallel */
+#define SERVER_BACKOFF 30 /* seconds a failed server is skipped, doubled with each failure */
+#define SERVER_BACKOFF_MAX 3600
+#define SERVER_FRESH 600 /* seconds notifier IDs of different servers remain comparable */
+#define SERVER_LAG 100 /* transactions a notifier may be behind the others */
 static char *current_server_list;
 static struct server_list server_list[128];
 static int server_list_entries = 0;
+static time_t health_now;
+static unsigned long health_max_id;
 extern int backup_notifier;
+extern char *cache_dir;
+
+/* Return the port in @value and free it, or -1 if unset. */
+static int port_value(char *value) {
+	int port = value ? atoi(value) : -1;
+
+	free(value);
+	return port;
+}
+
+/* Seed random() once per process. */
+static void seed_random(void) {
+	static unsigned seed = 0;
+
+	if (!seed) {
+		seed = getpid() * time(NULL);
+		srandom(seed);
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "rands with seed %ud ", seed);
+	}
+}
+
+/* Return the entry of @name in the server list or NULL. */
+static struct server_list *server_find(const char *name) {
+	int i;
+
+	for (i = 0; i < server_list_entries; i++) {
+		if (!strcmp(server_list[i].server_name, name))
+			return &server_list[i];
+	}
+	return NULL;
+}
+
+
+/* Read the health of the servers saved by servers_save(). */
+static void servers_load(void) {
+	char filename[PATH_MAX], name[256];
+	struct server_list *server;
+	double latency;
+	int failures;
+	long retry, seen;
+	unsigned long id;
+	FILE *fp;
+	int rv;
+
+	rv = snprintf(filename, PATH_MAX, "%s/servers", cache_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	if ((fp = fopen(filename, "r")) == NULL)
+		return;
+	while (fscanf(fp, "%255s %lf %d %ld %lu %ld", name, &latency, &failures, &retry, &id, &seen) == 6) {
+		if ((server = server_find(name)) == NULL)
+			continue;
+		server->latency = latency;
+		server->failures = failures;
+		server->retry = retry;
+		server->id = id;
+		server->seen = seen;
+	}
+	fclose(fp);
+}
+
+
+/* Save the health of the servers in the cache directory, so it survives a restart. */
+static void servers_save(void) {
+	char filename[PATH_MAX], tmp_filename[PATH_MAX];
+	FILE *fp;
+	int rv, i;
+
+	rv = snprintf(filename, PATH_MAX, "%s/servers", cache_dir);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	rv = snprintf(tmp_filename, PATH_MAX, "%s.new", filename);
+	if (rv < 0 || rv >= PATH_MAX)
+		abort();
+	if ((fp = fopen(tmp_filename, "w")) == NULL) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "could not open %s", tmp_filename);
+		return;
+	}
+	for (i = 0; i < server_list_entries; i++) {
+		struct server_list *server = &server_list[i];
+		fprintf(fp, "%s %.6f %d %ld %lu %ld\n", server->server_name, server->latency, server->failures, (long)server->retry, server->id, (long)server->seen);
+	}
+	if (fclose(fp) != 0 || rename(tmp_filename, filename) != 0)
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "could not write %s: %s", filename, strerror(errno));
+}
+
+
+/* Record a failed connection to @name and skip it for an exponentially growing time. */
+static void server_failed(const char *name, time_t now) {
+	struct server_list *server = server_find(name);
+	int backoff;
+
+	if (server == NULL)
+		return;
+	server->failures++;
+	backoff = SERVER_BACKOFF << (server->failures < 8 ? server->failures - 1 : 7);
+	if (backoff > SERVER_BACKOFF_MAX)
+		backoff = SERVER_BACKOFF_MAX;
+	server->retry = now + backoff;
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Server %s failed %d time(s), skipping it for %d seconds", name, server->failures, backoff);
+}
+
+
+/* Check if the notifier of @server is behind the other servers. */
+static bool server_lagging(const struct server_list *server) {
+	return server->seen + SERVER_FRESH >= health_now && server->id + SERVER_LAG < health_max_id;
+}
+
+
+/* Order the indexes of servers by health: available before skipped ones,
+ * up-to-date before lagging ones, then by the connect latency weighted by
+ * the recent failures. Unmeasured servers come first, so they get measured.
+ */
+static int server_compare(const void *a, const void *b) {
+	const struct server_list *x = &server_list[*(const int *)a], *y = &server_list[*(const int *)b];
+	double score_x, score_y;
+
+	if ((x->retry > health_now) != (y->retry > health_now))
+		return x->retry > health_now ? 1 : -1;
+	if (server_lagging(x) != server_lagging(y))
+		return server_lagging(x) ? 1 : -1;
+	score_x = x->latency * (1 + x->failures);
+	score_y = y->latency * (1 + y->failures);
+	return score_x < score_y ? -1 : score_x > score_y;
+}
+
+
+/* Seconds elapsed since @start. */
+static double elapsed(const struct timespec *start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+
+/* Select the next relay from listener/notifier/relays. Backups of the own
+ * site relay the transactions of the Primary from their own notifier, so
+ * the Primary only serves one connection per site. Each relay is tried once
+ * starting at a random one, before falling back to the other servers.
+ * @param lp LDAP configuration object.
+ * @return 1 if a relay was selected, 0 otherwise.
+ */
+static int select_relay(univention_ldap_parameters_t *lp) {
+	static const char *const keys[] = {"listener/notifier/relays", "hostname", "domainname", "ldap/backup/port"};
+	static int attempt = 0, start = -1;
+	char *values[ARRAY_SIZE(keys)], *relays, *str, *name, *saveptr = NULL, fqdn[256] = "";
+	char *candidates[ARRAY_SIZE(server_list)];
+	int count = 0, backup_port;
+
+	univention_config_get_many(keys, values, ARRAY_SIZE(keys));
+	relays = values[0];
+	if (values[1] && values[2])
+		snprintf(fqdn, sizeof(fqdn), "%s.%s", values[1], values[2]);
+	free(values[1]);
+	free(values[2]);
+	backup_port = port_value(values[3]);
+	if (relays == NULL)
+		return 0;
+
+	for (str = relays; count < ARRAY_SIZE(candidates) && (name = strtok_r(str, " ", &saveptr)) != NULL; str = NULL) {
+		/* never relay through oneself */
+		if (name[0] && strcmp(name, fqdn))
+			candidates[count++] = name;
+	}
+
+	if (attempt < count) {
+		if (start < 0) {
+			seed_random();
+			start = random() % count;
+		}
+		lp->host = strdup(candidates[(start + attempt++) % count]);
+		if (backup_port > 0)
+			lp->port = backup_port;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "Relay selected: %s", lp->host);
+	}
+	free(relays);
+	return lp->host != NULL;
+}
 
 
 /* Select LDAP server and notifier daemon.
  * 1. notifier/server : notifier/server/port
- * 2. @Primary|Backup: ldap/master : ldap/master/port
- * 2. @*: ldap/backup[?] : ldap/backup/port, fallback: ldap/master : ldap/master/port
+ * 2. @Backup|*: listener/notifier/relays[?] : ldap/backup/port, each once
+ * 3. @Primary|Backup: ldap/master : ldap/master/port
+ * 3. @*: ldap/backup[?] : ldap/backup/port, fallback: ldap/master : ldap/master/port
+ *    Servers are ordered by health: failed servers are skipped for an
+ *    exponentially growing time, notifiers lagging behind the others are
+ *    avoided, then the lowest connect latency wins. The notifiers of the
+ *    first listener/notifier/race candidates are connected to in parallel
+ *    and the first to answer is selected. The health is kept in
+ *    <cache_dir>/servers across restarts.
  * @param lp LDAP configuration object.
  *
  * .. warning::
@@ -62,36 +258,52 @@ extern int backup_notifier;
  *    to the LDAP server. This leads to inconsistencies.
  */
 void select_server(univention_ldap_parameters_t *lp) {
-	static unsigned seed = 0;
+	static const char *const keys[] = {"notifier/server", "notifier/server/port", "server/role", "ldap/master", "ldap/master/port", "ldap/backup", "ldap/backup/port"};
+	char *values[ARRAY_SIZE(keys)];
 	char *server_role = NULL;
 	char *ldap_master = NULL;
-	int ldap_master_port;
+	char *ldap_backups = NULL;
+	int ldap_master_port, backup_port;
 
 	if (lp->host) {
+		/* called again because the last server failed, unless it is skipped already */
+		struct server_list *server = server_find(lp->host);
+		if (server != NULL && server->retry <= time(NULL)) {
+			server_failed(lp->host, time(NULL));
+			servers_save();
+		}
 		free(lp->host);
 		lp->host = NULL;
 	}
 
-	char *notify_master = univention_config_get_string("notifier/server");
+	univention_config_get_many(keys, values, ARRAY_SIZE(keys));
+	server_role = values[2];
+	ldap_master = values[3];
+	ldap_master_port = port_value(values[4]);
+	ldap_backups = values[5];
+	backup_port = port_value(values[6]);
+
+	char *notify_master = values[0];
+	int notify_port = port_value(values[1]);
 	if (notify_master != NULL) {
 		lp->host = notify_master;
-		int notify_port = univention_config_get_int("notifier/server/port");
 		if (notify_port > 0)
 			lp->port = notify_port;
 		goto result;
 	}
 
-	server_role = univention_config_get_string("server/role");
 	if (!server_role) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "UCRV 'server/role' is not set");
 		abort();
 	}
-	ldap_master = univention_config_get_string("ldap/master");
 	if (!ldap_master) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "UCRV 'ldap/master' is not set");
 		abort();
 	}
-	ldap_master_port = univention_config_get_int("ldap/master/port");
+
+	/* prefer a relay of the own site unless this is the Primary */
+	if (strcmp(server_role, "domaincontroller_master") && select_relay(lp))
+		goto result;
 
 	/* if this is a Primary or Backup return ldap/master */
 	if (!strcmp(server_role, "domaincontroller_master") || !strcmp(server_role, "domaincontroller_backup")) {
@@ -100,8 +312,6 @@ void select_server(univention_ldap_parameters_t *lp) {
 			lp->port = ldap_master_port;
 		goto result;
 	} else {
-		char *ldap_backups = univention_config_get_string("ldap/backup");
-
 		/* list of Backups and Primary still up-to-date? */
 		if (current_server_list && ldap_backups && (strcmp(ldap_backups, current_server_list) != 0)) {
 			free(current_server_list);
@@ -129,32 +339,67 @@ void select_server(univention_ldap_parameters_t *lp) {
 			/* Append notifier on Primary Directory Node unless explicitly disabled */
 			if (server_list_entries < ARRAY_SIZE(server_list) && !backup_notifier)
 				server_list[server_list_entries++].server_name = strdup(ldap_master);
+			servers_load();
 		}
-		free(ldap_backups);
 
 		if (server_list_entries) {
+			int i, order[ARRAY_SIZE(server_list)];
 			/* dump server list */
-			int i;
 			for (i = 0; i < server_list_entries; i++) {
 				fprintf(stderr, "%d: %s\n", i, server_list[i].server_name);
 			}
-			/* randomize start point of server search */
-			if (!seed) {
-				seed = getpid() * time(NULL);
-				srandom(seed);
-				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "rands with seed %ud ", seed);
+			/* shuffle, so servers of equal health share the load */
+			seed_random();
+			for (i = 0; i < server_list_entries; i++) {
+				int j = random() % (i + 1);
+				order[i] = order[j];
+				order[j] = i;
+			}
+			health_now = time(NULL);
+			health_max_id = 0;
+			for (i = 0; i < server_list_entries; i++) {
+				if (server_list[i].seen + SERVER_FRESH >= health_now && server_list[i].id > health_max_id)
+					health_max_id = server_list[i].id;
 			}
-			int randval = random() % server_list_entries;
-			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "randval = %d ", randval);
+			qsort(order, server_list_entries, sizeof(*order), server_compare);
 
-			lp->host = strdup(server_list[randval].server_name);
+			/* connect to the notifiers of the healthiest servers in parallel and take the first to answer */
+			int race = univention_config_get_int("listener/notifier/race");
+			if (race < 0)
+				race = DEFAULT_RACE;
+			if (race > server_list_entries)
+				race = server_list_entries;
+			if (race < 1)
+				race = 1;
+			const char *candidates[ARRAY_SIZE(server_list)];
+			for (i = 0; i < race; i++)
+				candidates[i] = server_list[order[i]].server_name;
+			struct timespec start;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			int winner = notifier_client_race(NULL, candidates, race);
+			if (winner >= 0) {
+				struct server_list *server = &server_list[order[winner]];
+				NotifierID id;
+				server->latency = server->latency ? 0.7 * server->latency + 0.3 * elapsed(&start) : elapsed(&start);
+				if (notifier_get_id_s(NULL, &id) == 0) {
+					server->id = id;
+					server->seen = health_now;
+				}
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "Server %s answered in %.3f s, notifier ID %lu", server->server_name, server->latency, server->id);
+			} else {
+				for (i = 0; i < race; i++)
+					server_failed(candidates[i], health_now);
+				winner = 0;
+			}
+			servers_save();
+			int selected = order[winner];
+
+			lp->host = strdup(server_list[selected].server_name);
 			if (!strcmp(lp->host, ldap_master)) {
 				if (ldap_master_port > 0)
 					lp->port = ldap_master_port;
-			} else {
-				int backup_port = univention_config_get_int("ldap/backup/port");
-				if (backup_port > 0)
-					lp->port = backup_port;
+			} else if (backup_port > 0) {
+				lp->port = backup_port;
 			}
 		} else {
 			univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "No Backup found, server is ldap/master");
@@ -165,8 +410,23 @@ void select_server(univention_ldap_parameters_t *lp) {
 	}
 
 result:
+	free(ldap_backups);
 	free(ldap_master);
 	free(server_role);
 
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "Notifier/LDAP server is %s:%d", lp->uri ? lp->uri : lp->host ? lp->host : "NULL", lp->port);
 }
+
+
+/* Record that the connection to the server selected by select_server() works. */
+void select_server_success(univention_ldap_parameters_t *lp) {
+	struct server_list *server;
+
+	if (lp->host == NULL || (server = server_find(lp->host)) == NULL)
+		return;
+	if (server->failures || server->retry) {
+		server->failures = 0;
+		server->retry = 0;
+		servers_save();
+	}
+}
@@ -38,10 +38,18 @@
 
 #include <univention/ldap.h>
 
+#include <time.h>
+
 struct server_list {
 	char *server_name;
+	double latency;   /* moving average of the connect time in seconds, 0 if not measured */
+	int failures;     /* consecutive failures */
+	time_t retry;     /* skipped until then after a failure */
+	unsigned long id; /* last notifier ID seen */
+	time_t seen;      /* time @id was seen */
 };
 
 void select_server(univention_ldap_parameters_t *lp);
+void select_server_success(univention_ldap_parameters_t *lp);
 
 #endif
@@ -45,7 +45,10 @@
 
 #include "handlers.h"
 #include "cache.h"
+#include "policy_index.h"
 #include "common.h"
+#include "tunables.h"
+#include "metrics.h"
 extern char **module_dirs;
 extern char *pidfile;
 
@@ -102,6 +105,12 @@ void sig_usr2_handler(int sig) {
 	}
 }
 
+void stats_handler(int sig) {
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "received signal %d", sig);
+	handlers_dump_stats();
+	metrics_log();
+}
+
 void exit_handler(int sig) {
 	char **c;
 	static bool exit_handler_running = false;
@@ -115,6 +124,7 @@ void exit_handler(int sig) {
 	if (sig)
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "received signal %d", sig);
 
+	policy_index_close();
 	cache_close();
 	unlink(pidfile);
 
@@ -122,7 +132,7 @@ void exit_handler(int sig) {
 		free(*c);
 	free(module_dirs);
 
-	handlers_postrun_all();
+	handlers_postrun_all(true);
 	handlers_free_all();
 
 	if (sig) {
@@ -135,6 +145,7 @@ void exit_handler(int sig) {
 
 void reload_handler(int sig) {
 	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN, "received signal %d", sig);
+	tunables_reload();
 	handlers_reload_all_paths();
 }
 
@@ -157,17 +168,17 @@ static void install_handler(int sig, void (*handler)(int sig)) {
 }
 
 #ifdef NEW_SIGNALS
-int pending_signals[16];
+int pending_signals[32];
 
 void signal_handler(int signal) {
-	if (signal >= 0 && signal < 16)
+	if (signal >= 0 && signal < 32)
 		pending_signals[signal] = 1;
 }
 
 void process_signals(void) {
 	int signal;
 
-	for (signal = 0; signal < 16; signal++) {
+	for (signal = 0; signal < 32; signal++) {
 		if (!pending_signals[signal])
 			continue;
 		switch (signal) {
@@ -187,6 +198,9 @@ void process_signals(void) {
 		case SIGUSR2:
 			sig_usr2_handler(signal);
 			break;
+		case SIGWINCH:
+			stats_handler(signal);
+			break;
 		}
 		pending_signals[signal] = 0;
 	}
@@ -195,7 +209,7 @@ void process_signals(void) {
 void signals_init(void) {
 	int signal;
 
-	for (signal = 0; signal < 16; signal++)
+	for (signal = 0; signal < 32; signal++)
 		pending_signals[signal] = 0;
 
 	install_handler(SIGPIPE, &signal_handler);
@@ -206,6 +220,7 @@ void signals_init(void) {
 	install_handler(SIGHUP, &signal_handler);
 	install_handler(SIGUSR1, &signal_handler);
 	install_handler(SIGUSR2, &signal_handler);
+	install_handler(SIGWINCH, &signal_handler);
 }
 #else
 /* initialize signal handling */
@@ -218,5 +233,6 @@ void signals_init(void) {
 	install_handler(SIGHUP, &reload_handler);
 	install_handler(SIGUSR1, &sig_usr1_handler);
 	install_handler(SIGUSR2, &sig_usr2_handler);
+	install_handler(SIGWINCH, &stats_handler);
 }
 #endif
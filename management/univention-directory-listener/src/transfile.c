@@ -40,6 +40,7 @@
 #include <errno.h>
 #include <limits.h>
 #include <assert.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -53,23 +54,34 @@ static const char *failed_ldif_file = "/var/lib/univention-directory-replication
 extern long long listener_lock_count;
 
 
-/* Open file exclusively. */
-static FILE *fopen_lock(const char *name, const char *type, FILE **l_file) {
+/* Transactions not yet written to the transaction file, see notifier_flush_transaction_file(). */
+static struct {
+	char *data;
+	size_t len;
+	size_t size;
+	int count;
+} pending;
+
+/* The lock file is kept open. The transaction file is renamed by the notifier
+   while it holds the lock, so it is opened again once that has happened. */
+static int lock_fd = -1;
+static int file_fd = -1;
+
+
+/* Lock the transaction file exclusively. */
+static int transfile_lock(void) {
 	char buf[PATH_MAX];
-	FILE *file;
 	int count = 0;
-	int l_fd;
 
-	snprintf(buf, sizeof(buf), "%s.lock", name);
+	snprintf(buf, sizeof(buf), "%s.lock", transaction_file);
 
-	if ((*l_file = fopen(buf, "a")) == NULL) {
+	if (lock_fd < 0 && (lock_fd = open(buf, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
 		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Could not open lock file [%s]", buf);
-		return NULL;
+		return -1;
 	}
 
-	l_fd = fileno(*l_file);
 	for (;;) {
-		int rc = lockf(l_fd, F_TLOCK, 0);
+		int rc = lockf(lock_fd, F_TLOCK, 0);
 		if (!rc)
 			break;
 		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_INFO, "Could not get lock for file [%s]; count=%d", buf, count);
@@ -80,40 +92,31 @@ static FILE *fopen_lock(const char *name, const char *type, FILE **l_file) {
 		}
 		usleep(1000);
 	}
+	return 0;
+}
 
-	if ((file = fopen(name, type)) == NULL) {
-		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Could not open file [%s]", name);
-
-		int rc = lockf(l_fd, F_ULOCK, 0);
-		if (rc)
-			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Failed to unlock %s: %s", buf, strerror(errno));
-		fclose(*l_file);
-		*l_file = NULL;
-	}
 
-	return file;
+static void transfile_unlock(void) {
+	int rc = lockf(lock_fd, F_ULOCK, 0);
+	if (rc)
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ALL, "unlockf(): %d", rc);
 }
 
 
-/* Close file and lock file. */
-static int fclose_lock(FILE **file, FILE **l_file) {
-	int rv = 0;
+/* Open the transaction file, unless the open one is still in place. The lock must be held. */
+static int transfile_open(void) {
+	struct stat open_buf, name_buf;
 
-	if (*file != NULL) {
-		rv |= fclose(*file);
-		*file = NULL;
+	if (file_fd >= 0) {
+		if (fstat(file_fd, &open_buf) == 0 && stat(transaction_file, &name_buf) == 0 && open_buf.st_dev == name_buf.st_dev && open_buf.st_ino == name_buf.st_ino)
+			return 0;
+		close(file_fd);
 	}
-
-	if (*l_file != NULL) {
-		int l_fd = fileno(*l_file);
-		int rc = lockf(l_fd, F_ULOCK, 0);
-		if (rc)
-			univention_debug(UV_DEBUG_LDAP, UV_DEBUG_ALL, "unlockf(): %d", rc);
-		rv |= fclose(*l_file);
-		*l_file = NULL;
+	if ((file_fd = open(transaction_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) < 0) {
+		univention_debug(UV_DEBUG_LDAP, UV_DEBUG_WARN, "Could not open file [%s]", transaction_file);
+		return -1;
 	}
-
-	return rv;
+	return 0;
 }
 
 
@@ -127,10 +130,9 @@ bool notifier_has_failed_ldif(void) {
 }
 
 
-/* Write entry to transaction file. */
+/* Queue entry for the transaction file. */
 int notifier_write_transaction_file(NotifierEntry entry) {
-	FILE *file, *l_file;
-	int res = -1;
+	int len;
 
 	/* Check for failed ldif, if exists don't write the transaction file,
 	 * otherwise the notifier notifies the other listeners and nothing changed
@@ -138,16 +140,62 @@ int notifier_write_transaction_file(NotifierEntry entry) {
 	 */
 	assert(!notifier_has_failed_ldif());
 
-	if ((file = fopen_lock(transaction_file, "a+", &l_file)) == NULL) {
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "write to transaction file dn=[%s], command=[%c]", entry.dn, entry.command);
+	for (;;) {
+		len = snprintf(pending.data + pending.len, pending.size - pending.len, "%ld %s %c\n", entry.id, entry.dn, entry.command);
+		if (len < 0)
+			return -1;
+		if ((size_t)len < pending.size - pending.len)
+			break;
+		pending.size = pending.size * 2 > pending.len + len + 1 ? pending.size * 2 : pending.len + len + 1;
+		if ((pending.data = realloc(pending.data, pending.size)) == NULL)
+			abort();  // FIXME
+	}
+	pending.len += len;
+	pending.count++;
+
+	return 0;
+}
+
+
+/* Write the queued entries to the transaction file at once and sync them,
+ * before the cache commits the transactions. The notifier sees either all
+ * or none of them. */
+int notifier_flush_transaction_file(void) {
+	size_t pos = 0;
+	ssize_t n;
+	int res = 0;
+
+	if (pending.count == 0)
+		return 0;
+
+	if (transfile_lock() != 0 || transfile_open() != 0) {
 		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "Could not open %s", transaction_file);
-		return res;
+		if (lock_fd >= 0)
+			transfile_unlock();
+		return -1;
 	}
 
-	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "write to transaction file dn=[%s], command=[%c]", entry.dn, entry.command);
-	fprintf(file, "%ld %s %c\n", entry.id, entry.dn, entry.command);
-	res = fclose_lock(&file, &l_file);
-	if (res != 0)
-		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to write to transaction file %s: %d", transaction_file, res);
+	while (pos < pending.len) {
+		if ((n = write(file_fd, pending.data + pos, pending.len - pos)) < 0) {
+			if (errno == EINTR)
+				continue;
+			res = errno;
+			break;
+		}
+		pos += n;
+	}
+	if (res == 0 && fdatasync(file_fd) != 0)
+		res = errno;
+	transfile_unlock();
+
+	if (res != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "failed to write to transaction file %s: %s", transaction_file, strerror(res));
+		return -1;
+	}
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_INFO, "wrote %d transactions to %s", pending.count, transaction_file);
+	pending.len = 0;
+	pending.count = 0;
 
-	return res;
+	return 0;
 }
@@ -42,5 +42,6 @@
 extern char *transaction_file;
 bool notifier_has_failed_ldif(void);
 int notifier_write_transaction_file(NotifierEntry entry);
+int notifier_flush_transaction_file(void);
 
 #endif /* _TRANSFILE_H_ */
@@ -0,0 +1,131 @@
+/*
+ * Univention Directory Listener
+ *  listener tunables read from UCR
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <univention/config.h>
+
+#include "tunables.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+static const struct tunable {
+	const char *key;
+	size_t offset;
+	bool boolean;
+	int def, min, max; /* values below min and invalid ones are replaced by def */
+} table[] = {
+    {"listener/memberuid/skip", offsetof(struct tunables, memberuid_skip), true},
+    {"listener/uniquemember/skip", offsetof(struct tunables, uniquemember_skip), true},
+    {"listener/coalesce", offsetof(struct tunables, coalesce), true},
+    {"listener/notifier/subscribe", offsetof(struct tunables, notifier_subscribe), true},
+    {"listener/lane/urgent", offsetof(struct tunables, lane_urgent), true},
+    {"listener/notifier/window", offsetof(struct tunables, notifier_window), false, WINDOW_DEFAULT, 1, WINDOW_MAX},
+    {"listener/idle/max", offsetof(struct tunables, idle_max), false, IDLE_MAX_DEFAULT, 0, IDLE_MAX_MAX},
+    {"listener/cache/projection", offsetof(struct tunables, cache_projection), true},
+    {"listener/cache/group-commit", offsetof(struct tunables, group_commit), false, 1, 1, INT_MAX},
+    {"listener/cache/group-commit/latency", offsetof(struct tunables, group_commit_latency), false, GROUP_COMMIT_LATENCY, 0, INT_MAX},
+    {"listener/module/init/pagesize", offsetof(struct tunables, init_pagesize), false, INIT_PAGE_SIZE_DEFAULT, 1, INIT_PAGE_SIZE_MAX},
+    {"listener/module/init/batch", offsetof(struct tunables, init_batch), false, INIT_BATCH_DEFAULT, 1, INIT_BATCH_MAX},
+    {"listener/ldap/prefetch", offsetof(struct tunables, ldap_prefetch), false, PREFETCH_DEFAULT, 0, PREFETCH_MAX},
+    {"listener/delete/batch", offsetof(struct tunables, delete_batch), false, DELETE_BATCH_DEFAULT, 1, DELETE_BATCH_MAX},
+    {"listener/python/gc/defer", offsetof(struct tunables, gc_defer), true},
+    {"listener/python/gc/threshold0", offsetof(struct tunables, gc_threshold0), false, GC_THRESHOLD0_DEFAULT, 0, INT_MAX},
+    {"listener/python/gc/threshold1", offsetof(struct tunables, gc_threshold1), false, GC_THRESHOLD1_DEFAULT, 0, INT_MAX},
+    {"listener/python/gc/threshold2", offsetof(struct tunables, gc_threshold2), false, GC_THRESHOLD2_DEFAULT, 0, INT_MAX},
+    {"listener/memory/budget", offsetof(struct tunables, memory_budget), false, 0, 0, INT_MAX},
+    {"listener/memory/tracemalloc", offsetof(struct tunables, memory_tracemalloc), true},
+};
+
+static struct tunables current;
+static pthread_once_t loaded = PTHREAD_ONCE_INIT;
+
+static void tunables_load(void) {
+	const char *keys[ARRAY_SIZE(table)];
+	char *values[ARRAY_SIZE(table)];
+	struct tunables fresh;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(table); i++)
+		keys[i] = table[i].key;
+	univention_config_get_many(keys, values, ARRAY_SIZE(table));
+
+	for (i = 0; i < ARRAY_SIZE(table); i++) {
+		const struct tunable *t = &table[i];
+		void *field = (char *)&fresh + t->offset;
+		const char *value = values[i];
+
+		if (t->boolean) {
+			*(bool *)field = value && (!strcmp(value, "yes") || !strcmp(value, "true"));
+		} else {
+			char *end;
+			long number = value ? strtol(value, &end, 10) : -1;
+			if (!value || end == value || *end || number < t->min)
+				number = t->def;
+			else if (number > t->max)
+				number = t->max;
+			*(int *)field = number;
+		}
+		free(values[i]);
+	}
+	current = fresh;
+}
+
+const struct tunables *tunables_get(void) {
+	pthread_once(&loaded, tunables_load);
+	return &current;
+}
+
+void tunables_reload(void) {
+	pthread_once(&loaded, tunables_load);
+	tunables_load();
+}
+
+void tunables_dump(FILE *out) {
+	const struct tunables *tunables = tunables_get();
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(table); i++) {
+		const void *field = (const char *)tunables + table[i].offset;
+		if (table[i].boolean)
+			fprintf(out, "%s: %s\n", table[i].key, *(const bool *)field ? "yes" : "no");
+		else
+			fprintf(out, "%s: %d\n", table[i].key, *(const int *)field);
+	}
+}
@@ -0,0 +1,99 @@
+/*
+ * Univention Directory Listener
+ *  listener tunables read from UCR
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TUNABLES_H_
+#define _TUNABLES_H_
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* number of objects prefetched from LDAP ahead of the current transaction, see listener/ldap/prefetch */
+#define PREFETCH_DEFAULT 8
+#define PREFETCH_MAX 64
+
+/* number of objects passed to a module at once while initializing it, see handler_update_batch() */
+#define INIT_BATCH_DEFAULT 100
+#define INIT_BATCH_MAX 1000
+
+/* number of consecutive deletions processed at once, see change_delete_batch() */
+#define DELETE_BATCH_DEFAULT 100
+#define DELETE_BATCH_MAX 1000
+
+/* number of DNs requested per page while initializing a module */
+#define INIT_PAGE_SIZE_DEFAULT 1000
+#define INIT_PAGE_SIZE_MAX 100000
+
+#define WINDOW_DEFAULT 32
+#define WINDOW_MAX 128 /* the notifier drops packets larger than 8 KiB */
+#define IDLE_MAX_DEFAULT 2 * 60 /* 2 minutes */
+#define IDLE_MAX_MAX 5 * 60     /* DELAY_ALIVE */
+#define GROUP_COMMIT_LATENCY 1000 /* milliseconds */
+
+/* the defaults of Python, see gc.set_threshold() */
+#define GC_THRESHOLD0_DEFAULT 700
+#define GC_THRESHOLD1_DEFAULT 10
+#define GC_THRESHOLD2_DEFAULT 10
+
+/* The listener/... UCR variables consulted while running, with defaults
+ * applied and clamped to their limits. They are read once on first use and
+ * again on SIGHUP, so the hot paths never go to UCR. */
+struct tunables {
+	bool memberuid_skip;       /* listener/memberuid/skip */
+	bool uniquemember_skip;    /* listener/uniquemember/skip */
+	bool coalesce;             /* listener/coalesce */
+	bool notifier_subscribe;   /* listener/notifier/subscribe */
+	bool lane_urgent;          /* listener/lane/urgent */
+	int notifier_window;       /* listener/notifier/window */
+	int idle_max;              /* listener/idle/max */
+	bool cache_projection;     /* listener/cache/projection */
+	int group_commit;          /* listener/cache/group-commit */
+	int group_commit_latency;  /* listener/cache/group-commit/latency */
+	int init_pagesize;         /* listener/module/init/pagesize */
+	int init_batch;            /* listener/module/init/batch */
+	int ldap_prefetch;         /* listener/ldap/prefetch */
+	int delete_batch;          /* listener/delete/batch */
+	bool gc_defer;             /* listener/python/gc/defer */
+	int gc_threshold0;         /* listener/python/gc/threshold0 */
+	int gc_threshold1;         /* listener/python/gc/threshold1 */
+	int gc_threshold2;         /* listener/python/gc/threshold2 */
+	int memory_budget;         /* listener/memory/budget, in MiB */
+	bool memory_tracemalloc;   /* listener/memory/tracemalloc */
+};
+
+const struct tunables *tunables_get(void);
+void tunables_reload(void);
+void tunables_dump(FILE *out);
+
+#endif /* _TUNABLES_H_ */
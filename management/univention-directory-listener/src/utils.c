@@ -37,11 +37,13 @@
 #include <stdio.h>
 #endif
 #include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
 #include "utils.h"
 #define U_CHARSET_IS_UTF8 1
 #include <unicode/uchar.h>
 #include <unicode/ucnv.h>
+#include <unicode/utf8.h>
 
 
 #define BUFSIZE(len) (((len)+1) * sizeof(*out))
@@ -107,8 +109,38 @@ static inline char *_to_utf8(const UChar *in, size_t len) {
 }
 
 
+static inline char ascii_tolower(char c) {
+	return c >= 'A' && c <= 'Z' ? c | 0x20 : c;
+}
+
+
+/* Return the length of the pure ASCII prefix of str, checking a word at a time. */
+static size_t ascii_span(const char *str, size_t len) {
+	const uint64_t high = 0x8080808080808080ULL;
+	uint64_t word;
+	size_t i;
+
+	for (i = 0; i + sizeof(word) <= len; i += sizeof(word)) {
+		memcpy(&word, str + i, sizeof(word));
+		if (word & high)
+			break;
+	}
+	while (i < len && !(str[i] & 0x80))
+		i++;
+	return i;
+}
+
+
 char *lower_utf8(const char *str) {
 	size_t len = strlen(str);
+	if (ascii_span(str, len) == len) {
+		char *out = malloc(len + 1);
+		size_t i;
+		assert(out);
+		for (i = 0; i <= len; i++)
+			out[i] = ascii_tolower(str[i]);
+		return out;
+	}
 	/* convert from UTF-8 to internal UChar */
 	UChar *tmp = _from_utf8(str, len);
 	/* convert to lower case */
@@ -122,24 +154,48 @@ char *lower_utf8(const char *str) {
 }
 
 
+/* Compare the non-ASCII remainder code point by code point, folding like lower_utf8() does. */
+static bool same_utf8(const char *left, const char *right) {
+	int32_t llen = strlen(left), rlen = strlen(right), i = 0, j = 0;
+	UChar32 a, b;
+
+	while (i < llen && j < rlen) {
+		U8_NEXT(left, i, llen, a);
+		U8_NEXT(right, j, rlen, b);
+		if (a < 0)
+			a = 0xFFFD;
+		if (b < 0)
+			b = 0xFFFD;
+		/* lower_utf8() folds UTF-16 units, which leaves supplementary characters alone */
+		if (a <= 0xFFFF)
+			a = u_tolower(a);
+		if (b <= 0xFFFF)
+			b = u_tolower(b);
+		if (a != b)
+			return false;
+	}
+	return i == llen && j == rlen;
+}
+
+
 bool same_dn(const char *left, const char *right) {
 	/* BUG: A DN is a sequence of RDNs. An RDN is a sequence of Attribute-value
 	   pairs. Each attribute has its own schema definition with its own
 	   governing rules. Some attributes are case-sensitive, some are not. As
 	   such, a complete DN may have components that are case-sensitive as well
 	   as case-insensitive. */
-	char *lbuf = lower_utf8(left);
-	char *rbuf = lower_utf8(right);
-	int result = strcmp(lbuf, rbuf);
-
-	free(lbuf);
-	free(rbuf);
-
-	return 0 == result;
+	for (; !(*left & 0x80) && !(*right & 0x80); left++, right++) {
+		if (ascii_tolower(*left) != ascii_tolower(*right))
+			return false;
+		if (!*left)
+			return true;
+	}
+	return same_utf8(left, right);
 }
 
 
 int ldap_retries = -1;
+unsigned long ldap_reconnects;
 
 int get_ldap_retries() {
 	const int DEFAULT_RETRIES = 5;
@@ -33,6 +33,7 @@ static inline int ldap_timeout_scans() {
 }
 
 extern int ldap_retries;
+extern unsigned long ldap_reconnects;
 extern int get_ldap_retries();
 extern int notifier_retries;
 extern int get_notifier_retries();
@@ -52,7 +53,7 @@ extern int get_notifier_retries();
 			else                                                                        \
 				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN,                  \
 					"communication with LDAP failed (%d)", _rv);                \
-			while (_retry < ldap_retries && univention_ldap_open(lp) != LDAP_SUCCESS) { \
+			while (_retry < ldap_retries && (++ldap_reconnects, univention_ldap_open(lp)) != LDAP_SUCCESS) { \
 				_delay = 1 << (_retry < 5 ? _retry : 5);                            \
 				if (++_retry < ldap_retries) {                                      \
 					univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_WARN,          \
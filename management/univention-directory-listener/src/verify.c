@@ -40,6 +40,9 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <pwd.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
 #include <sys/types.h>
 #include <ldap.h>
 
@@ -51,24 +54,93 @@
 
 int INIT_ONLY = 0;
 
+/* verified DNs, a chained hash table */
 struct dn {
 	char *dn;
 	struct dn *next;
 };
-static struct dn *dns = NULL;
+static struct {
+	struct dn **buckets;
+	size_t size;
+	size_t count;
+} dns;
+
+/* checks lookups of cache entries in LDAP, each with a connection of its own */
+#define VERIFY_WORKERS_MAX 64
+/* cache entries queued per worker */
+#define VERIFY_QUEUE_PER_WORKER 16
+
+struct verify_job {
+	char *dn;
+	CacheEntry entry;
+	struct verify_job *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+	struct verify_job *head, *tail;
+	int count;
+	int size;
+	bool done;
+} queue = {
+    .lock = PTHREAD_MUTEX_INITIALIZER, .not_empty = PTHREAD_COND_INITIALIZER, .not_full = PTHREAD_COND_INITIALIZER,
+};
+
+/* serializes comparing, which is not thread-safe, and its output */
+static pthread_mutex_t compare_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+static size_t hash_dn(const char *dn) {
+	size_t hash = 2166136261u;  // FNV-1a
+
+	while (*dn)
+		hash = (hash ^ (unsigned char)*dn++) * 16777619u;
+	return hash;
+}
 
 
 static void add_dn(char *dn) {
-	struct dn *new = malloc(sizeof(struct dn));
-	new->dn = strdup(dn);
-	new->next = dns;
-	dns = new;
+	struct dn *new;
+	size_t i;
+
+	if (dns.count >= dns.size) {
+		size_t size = dns.size ? dns.size * 2 : 1024;
+		struct dn **buckets = calloc(size, sizeof(struct dn *));
+
+		if (buckets == NULL)
+			abort();  // FIXME
+		for (i = 0; i < dns.size; i++) {
+			while (dns.buckets[i] != NULL) {
+				struct dn *cur = dns.buckets[i];
+				size_t j = hash_dn(cur->dn) & (size - 1);
+
+				dns.buckets[i] = cur->next;
+				cur->next = buckets[j];
+				buckets[j] = cur;
+			}
+		}
+		free(dns.buckets);
+		dns.buckets = buckets;
+		dns.size = size;
+	}
+
+	if ((new = malloc(sizeof(struct dn))) == NULL || (new->dn = strdup(dn)) == NULL)
+		abort();  // FIXME
+	i = hash_dn(dn) & (dns.size - 1);
+	new->next = dns.buckets[i];
+	dns.buckets[i] = new;
+	dns.count++;
 }
 
 
 static int has_dn(char *dn) {
 	struct dn *cur;
-	for (cur = dns; cur != NULL; cur = cur->next) {
+
+	if (dns.size == 0)
+		return 0;
+	for (cur = dns.buckets[hash_dn(dn) & (dns.size - 1)]; cur != NULL; cur = cur->next) {
 		if (strcmp(dn, cur->dn) == 0) {
 			return 1;
 		}
@@ -153,6 +225,113 @@ static void usage(void) {
 	fprintf(stderr, "   -w   LDAP bind password\n");
 	fprintf(stderr, "   -y   LDAP bind password file\n");
 	fprintf(stderr, "   -b   LDAP base dn\n");
+	fprintf(stderr, "   -j   number of concurrent LDAP connections (default: number of CPUs)\n");
+	fprintf(stderr, "   -s   only verify the given random fraction of entries, e.g. 0.1\n");
+}
+
+
+static LDAP *connect_ldap(char *binddn, char *bindpw) {
+	LDAP *ld;
+	struct berval cred;
+
+	if (ldap_initialize(&ld, "ldapi:///") != LDAP_SUCCESS) {
+		fprintf(stderr, "E: Could not connect to ldapi:///\n");
+		ldap_unbind_ext(ld, NULL, NULL);
+		exit(1);
+	}
+
+	if (bindpw == NULL) {
+		cred.bv_val = NULL;
+		cred.bv_len = 0;
+	} else {
+		cred.bv_val = bindpw;
+		cred.bv_len = strlen(bindpw);
+	}
+	if (ldap_sasl_bind_s(ld, binddn, LDAP_SASL_SIMPLE, &cred, NULL, NULL, NULL) != LDAP_SUCCESS) {
+		fprintf(stderr, "E: Could not bind to LDAP server\n");
+		exit(1);
+	}
+	return ld;
+}
+
+
+static void queue_push(struct verify_job *job) {
+	pthread_mutex_lock(&queue.lock);
+	while (queue.count >= queue.size)
+		pthread_cond_wait(&queue.not_full, &queue.lock);
+	if (queue.tail)
+		queue.tail->next = job;
+	else
+		queue.head = job;
+	queue.tail = job;
+	queue.count++;
+	pthread_cond_signal(&queue.not_empty);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+
+/* :returns: the next job, or NULL when all cache entries have been queued */
+static struct verify_job *queue_pop(void) {
+	struct verify_job *job;
+
+	pthread_mutex_lock(&queue.lock);
+	while (queue.head == NULL && !queue.done)
+		pthread_cond_wait(&queue.not_empty, &queue.lock);
+	if ((job = queue.head) != NULL) {
+		if ((queue.head = job->next) == NULL)
+			queue.tail = NULL;
+		queue.count--;
+		pthread_cond_signal(&queue.not_full);
+	}
+	pthread_mutex_unlock(&queue.lock);
+	return job;
+}
+
+
+static void queue_finish(void) {
+	pthread_mutex_lock(&queue.lock);
+	queue.done = true;
+	pthread_cond_broadcast(&queue.not_empty);
+	pthread_mutex_unlock(&queue.lock);
+}
+
+
+/* Look up the queued cache entries in LDAP and compare them. */
+static void *verify_worker(void *arg) {
+	LDAP *ld = arg;
+	struct verify_job *job;
+	LDAPMessage *res;
+	char *attrs[] = {LDAP_ALL_USER_ATTRIBUTES, LDAP_ALL_OPERATIONAL_ATTRIBUTES, NULL};
+	int attrsonly0 = 0;
+	struct timeval timeout = {
+	    .tv_sec = ldap_timeout_scans(), .tv_usec = 0,
+	};
+	int sizelimit0 = 0;
+	int rv;
+
+	while ((job = queue_pop()) != NULL) {
+		res = NULL;
+		rv = ldap_search_ext_s(ld, job->dn, LDAP_SCOPE_BASE, "(objectClass=*)", attrs, attrsonly0, NULL, NULL, &timeout, sizelimit0, &res);
+
+		pthread_mutex_lock(&compare_lock);
+		if (has_dn(job->dn)) {
+			printf("E: duplicate entry: %s\n", job->dn);
+		}
+		if (rv == LDAP_NO_SUCH_OBJECT) {
+			printf("W: %s only in cache\n", job->dn);
+		} else if (rv != LDAP_SUCCESS) {
+			printf("E: could not receive %s from LDAP\n", job->dn);
+		} else {
+			compare_entries(job->dn, &job->entry, ld, ldap_first_entry(ld, res));
+		}
+		add_dn(job->dn);
+		pthread_mutex_unlock(&compare_lock);
+
+		ldap_msgfree(res);
+		cache_free_entry(&job->dn, &job->entry);
+		free(job);
+	}
+	return NULL;
 }
 
 
@@ -161,14 +340,19 @@ int main(int argc, char *argv[]) {
 	char *binddn = NULL;
 	char *bindpw = NULL;
 	char *basedn = NULL;
-	int rv;
+	int workers = sysconf(_SC_NPROCESSORS_ONLN);
+	double fraction = 1.0;
+	pthread_t threads[VERIFY_WORKERS_MAX];
+	LDAP *lds[VERIFY_WORKERS_MAX];
+	int i, rv;
 	MDB_cursor *id2entry_read_cursor_p = NULL;
 	MDB_cursor *id2dn_read_cursor_p = NULL;
-	char *dn;
+	char *dn = NULL;
 	CacheEntry entry;
 	LDAP *ld;
 	LDAPMessage *res;
 	char *attrs[] = {LDAP_ALL_USER_ATTRIBUTES, LDAP_ALL_OPERATIONAL_ATTRIBUTES, NULL};
+	char *no_attrs[] = {LDAP_NO_ATTRS, NULL};
 	int attrsonly0 = 0;
 	LDAPControl **serverctrls = NULL;
 	LDAPControl **clientctrls = NULL;
@@ -176,7 +360,6 @@ int main(int argc, char *argv[]) {
 	    .tv_sec = ldap_timeout_scans(), .tv_usec = 0,
 	};
 	int sizelimit0 = 0;
-	struct berval cred;
 	char cache_mdb_dir[PATH_MAX];
 
 	univention_debug_init("stderr", 1, 1);
@@ -185,7 +368,7 @@ int main(int argc, char *argv[]) {
 	for (;;) {
 		int c;
 
-		c = getopt(argc, argv, "d:c:D:w:y:b:");
+		c = getopt(argc, argv, "d:c:D:w:y:b:j:s:");
 		if (c < 0)
 			break;
 		switch (c) {
@@ -211,6 +394,16 @@ int main(int argc, char *argv[]) {
 		case 'b':
 			basedn = strdup(optarg);
 			break;
+		case 'j':
+			workers = atoi(optarg);
+			break;
+		case 's':
+			fraction = atof(optarg);
+			if (fraction <= 0 || fraction > 1) {
+				fprintf(stderr, "E: The fraction must be greater than 0 and at most 1\n");
+				exit(1);
+			}
+			break;
 		default:
 			usage();
 			exit(1);
@@ -220,6 +413,10 @@ int main(int argc, char *argv[]) {
 		usage();
 		exit(1);
 	}
+	if (workers < 1)
+		workers = 1;
+	else if (workers > VERIFY_WORKERS_MAX)
+		workers = VERIFY_WORKERS_MAX;
 
 	if (debugging > 1) {
 		univention_debug_set_level(UV_DEBUG_LISTENER, UV_DEBUG_ALL);
@@ -232,72 +429,78 @@ int main(int argc, char *argv[]) {
 		univention_debug_set_level(UV_DEBUG_LDAP, UV_DEBUG_ERROR);
 	}
 
-	if (ldap_initialize(&ld, "ldapi:///") != LDAP_SUCCESS) {
-		fprintf(stderr, "E: Could not connect to ldapi:///\n");
-		ldap_unbind_ext(ld, NULL, NULL);
-		exit(1);
-	}
-
-	if (bindpw == NULL) {
-		cred.bv_val = NULL;
-		cred.bv_len = 0;
-	} else {
-		cred.bv_val = bindpw;
-		cred.bv_len = strlen(bindpw);
-	}
-	if (ldap_sasl_bind_s(ld, binddn, LDAP_SASL_SIMPLE, &cred, serverctrls, clientctrls, NULL) != LDAP_SUCCESS) {
-		fprintf(stderr, "E: Could not bind to LDAP server\n");
-		exit(1);
-	}
-
+	ld = connect_ldap(binddn, bindpw);
+	for (i = 0; i < workers; i++)
+		lds[i] = connect_ldap(binddn, bindpw);
+	srand48(time(NULL) ^ getpid());
 
 	rv = snprintf(cache_mdb_dir, PATH_MAX, "%s/cache", cache_dir);
 	if (rv < 0 || rv >= PATH_MAX)
 		abort();
 	if (cache_init(cache_mdb_dir, MDB_RDONLY) != 0)
 		exit(1);
+	cache_warmup();
+
+	/* The cache is read sequentially here, while the workers look up the
+	   entries in LDAP concurrently. The entries are views, which remain
+	   valid until the cursor is freed after all workers have finished. */
+	queue.size = workers * VERIFY_QUEUE_PER_WORKER;
+	for (i = 0; i < workers; i++) {
+		if (pthread_create(&threads[i], NULL, verify_worker, lds[i]) != 0) {
+			fprintf(stderr, "E: Could not start worker thread\n");
+			exit(1);
+		}
+	}
+	for (rv = cache_first_entry_view(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry); rv != MDB_NOTFOUND; rv = cache_next_entry_view(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry)) {
+		struct verify_job *job;
 
-	for (rv = cache_first_entry(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry); rv != MDB_NOTFOUND; rv = cache_next_entry(&id2entry_read_cursor_p, &id2dn_read_cursor_p, &dn, &entry)) {
 		if (rv < -1)
 			break;
-
-		if (has_dn(dn)) {
-			printf("E: duplicate entry: %s\n", dn);
+		if (fraction < 1 && drand48() >= fraction) {
+			cache_free_entry(NULL, &entry);
+			continue;
 		}
 
-		if ((rv = ldap_search_ext_s(ld, dn, LDAP_SCOPE_BASE, "(objectClass=*)", attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res)) == LDAP_NO_SUCH_OBJECT) {
-			printf("W: %s only in cache\n", dn);
-		} else if (rv != LDAP_SUCCESS) {
-			printf("E: could not receive %s from LDAP\n", dn);
-		} else {
-			LDAPMessage *first;
-			first = ldap_first_entry(ld, res);
-			compare_entries(dn, &entry, ld, first);
-			ldap_msgfree(res);
-		}
-		add_dn(dn);
+		if ((job = malloc(sizeof(struct verify_job))) == NULL)
+			abort();  // FIXME
+		job->dn = dn;
+		job->entry = entry;
+		job->next = NULL;
+		dn = NULL;
+		queue_push(job);
+	}
+	queue_finish();
+	for (i = 0; i < workers; i++) {
+		pthread_join(threads[i], NULL);
+		ldap_unbind_ext(lds[i], NULL, NULL);
 	}
 	cache_free_cursor(id2entry_read_cursor_p, id2dn_read_cursor_p);
+	free(dn);
 
-	if ((rv = ldap_search_ext_s(ld, basedn, LDAP_SCOPE_SUBTREE, "(objectClass=*)", attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res)) != LDAP_SUCCESS) {
+	/* only search the DNs when sampling, as only objects missing in the cache are reported */
+	if ((rv = ldap_search_ext_s(ld, basedn, LDAP_SCOPE_SUBTREE, "(objectClass=*)", fraction < 1 ? no_attrs : attrs, attrsonly0, serverctrls, clientctrls, &timeout, sizelimit0, &res)) != LDAP_SUCCESS) {
 		printf("E: ldapsearch failed\n");
 		exit(1);
 	} else {
 		LDAPMessage *cur;
 		for (cur = ldap_first_entry(ld, res); cur != NULL; cur = ldap_next_entry(ld, cur)) {
 			char *dn = ldap_get_dn(ld, cur);
-			if (has_dn(dn))
+			if (has_dn(dn) || (fraction < 1 && drand48() >= fraction)) {
+				ldap_memfree(dn);
 				continue;
+			}
 
 			if ((rv = cache_get_entry(dn, &entry)) == MDB_NOTFOUND) {
 				printf("E: %s only in LDAP\n", dn);
 			} else if (rv != 0) {
 				printf("E: error reading %s from cache", dn);
 				exit(1);
+			} else {
+				if (fraction == 1)
+					compare_entries(dn, &entry, ld, cur);
+				cache_free_entry(NULL, &entry);
 			}
-			compare_entries(dn, &entry, ld, cur);
 			ldap_memfree(dn);
-			cache_free_entry(NULL, &entry);
 		}
 		ldap_msgfree(res);
 	}
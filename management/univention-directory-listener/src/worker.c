@@ -0,0 +1,371 @@
+/*
+ * Univention Directory Listener
+ *  worker processes running handlers out of process
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Modules setting `worker = "<group>"` are not run by the listener itself,
+   but by a long-lived child process shared by all modules of the group.
+   The child is forked on first use, so it has the same modules imported.
+   For each change the listener sends one request to every group involved,
+   containing the entries in their cache format, and collects the results
+   before the change is committed and the notifier ID advances. All groups
+   work on the same change at once, which isolates heavy modules from each
+   other and spreads their work over the available cores. */
+
+#define PY_SSIZE_T_CLEAN
+#include <python3.11/Python.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <univention/debug.h>
+
+#include "cache_lowlevel.h"
+#include "lane.h"
+#include "worker.h"
+
+enum worker_request_flags {
+	WORKER_NEW = 1 << 0,
+	WORKER_OLD = 1 << 1,
+};
+
+/* followed by `module_count` module names, the DN, and the serialized new and old entry;
+   answered by one int32_t result per module */
+struct worker_request {
+	u_int32_t size; /* of everything following this header */
+	u_int8_t type;
+	u_int8_t flags;
+	char command;
+	u_int16_t module_count;
+	u_int32_t new_size;
+	u_int32_t old_size;
+};
+
+struct worker {
+	char *group;
+	pid_t pid;
+	int fd;
+	struct worker *next;
+};
+
+static struct worker *workers;
+static worker_started_t worker_started;
+static worker_run_t worker_run;
+static worker_postrun_t worker_postrun;
+
+
+/* :returns: 0 on success, -1 on error or end of file */
+static int read_full(int fd, void *buf, size_t size) {
+	while (size > 0) {
+		ssize_t rv = read(fd, buf, size);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			return -1;
+		buf = (char *)buf + rv;
+		size -= rv;
+	}
+	return 0;
+}
+
+
+static int write_full(int fd, const void *buf, size_t size) {
+	while (size > 0) {
+		ssize_t rv = send(fd, buf, size, MSG_NOSIGNAL);
+		if (rv < 0 && errno == EINTR)
+			continue;
+		if (rv <= 0)
+			return -1;
+		buf = (const char *)buf + rv;
+		size -= rv;
+	}
+	return 0;
+}
+
+
+/* serve requests of the listener until it closes the connection */
+static void __attribute__((noreturn)) worker_serve(struct worker *worker) {
+	static const int signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGABRT, SIGUSR1, SIGUSR2, SIGCHLD};
+	struct worker_request request;
+	sigset_t none;
+	size_t i;
+
+	/* the handlers of the listener would close its cache and remove its PID file */
+	for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++)
+		signal(signals[i], SIG_DFL);
+	signal(SIGPIPE, SIG_IGN);
+	sigemptyset(&none);
+	sigprocmask(SIG_SETMASK, &none, NULL);
+	/* the arena of the transaction being processed stays with the listener */
+	cache_entry_arena = NULL;
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "worker %s: started as %d", worker->group, getpid());
+	worker_started();
+
+	while (read_full(worker->fd, &request, sizeof(request)) == 0) {
+		CacheEntry new, old;
+		char *data, *pos, *dn = NULL;
+		int32_t *results;
+
+		if ((data = malloc(request.size + 1)) == NULL || (results = calloc(request.module_count, sizeof(int32_t))) == NULL)
+			abort();  // FIXME
+		if (read_full(worker->fd, data, request.size) != 0) {
+			free(results);
+			free(data);
+			break;
+		}
+		data[request.size] = '\0';
+
+		pos = data;
+		for (i = 0; i < request.module_count; i++)
+			pos += strlen(pos) + 1;
+		if (request.type == WORKER_RUN) {
+			dn = pos;
+			pos += strlen(pos) + 1;
+			if (parse_entry(pos, request.new_size, &new) != 0 || parse_entry(pos + request.new_size, request.old_size, &old) != 0) {
+				univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "worker %s: malformed request for %s", worker->group, dn);
+				abort();
+			}
+		}
+
+		for (i = 0, pos = data; i < request.module_count; i++, pos += strlen(pos) + 1) {
+			switch (request.type) {
+			case WORKER_RUN:
+				results[i] = worker_run(pos, dn, request.flags & WORKER_NEW ? &new : NULL, request.flags & WORKER_OLD ? &old : NULL, request.command);
+				break;
+			case WORKER_POSTRUN:
+				results[i] = worker_postrun(pos);
+				break;
+			default:
+				results[i] = -1;
+			}
+		}
+
+		if (request.type == WORKER_RUN) {
+			cache_free_entry(NULL, &new);
+			cache_free_entry(NULL, &old);
+		}
+		free(data);
+		if (write_full(worker->fd, results, request.module_count * sizeof(int32_t)) != 0) {
+			free(results);
+			break;
+		}
+		free(results);
+	}
+
+	univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "worker %s: exiting", worker->group);
+	fflush(NULL);
+	_exit(0);
+}
+
+
+static struct worker *worker_find(const char *group) {
+	struct worker *worker;
+
+	for (worker = workers; worker != NULL; worker = worker->next) {
+		if (!strcmp(worker->group, group))
+			return worker;
+	}
+	return NULL;
+}
+
+
+/* fork a new worker process for the group */
+static struct worker *worker_start(const char *group) {
+	struct worker *worker;
+	int fds[2];
+	pid_t pid;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "worker %s: socketpair() failed: %s", group, strerror(errno));
+		return NULL;
+	}
+
+	fflush(NULL);
+	PyOS_BeforeFork();
+	pid = fork();
+	if (pid == 0) {
+		PyOS_AfterFork_Child();
+		close(fds[0]);
+		worker_close_all();
+		lane_close_all();
+		struct worker self = {.group = (char *)group, .pid = 0, .fd = fds[1]};
+		worker_serve(&self);
+	}
+	PyOS_AfterFork_Parent();
+	close(fds[1]);
+	if (pid < 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "worker %s: fork() failed: %s", group, strerror(errno));
+		close(fds[0]);
+		return NULL;
+	}
+
+	if ((worker = malloc(sizeof(struct worker))) == NULL || (worker->group = strdup(group)) == NULL)
+		abort();  // FIXME
+	worker->pid = pid;
+	worker->fd = fds[0];
+	worker->next = workers;
+	workers = worker;
+
+	return worker;
+}
+
+
+void worker_init(worker_started_t started, worker_run_t run, worker_postrun_t postrun) {
+	worker_started = started;
+	worker_run = run;
+	worker_postrun = postrun;
+}
+
+
+bool worker_running(const char *group) {
+	return worker_find(group) != NULL;
+}
+
+
+/* send a request to the worker of the group, starting it if needed */
+int worker_send(const char *group, char type, const char *dn, CacheEntry *new, CacheEntry *old, char command, char **modules, int count) {
+	struct worker_request request = {
+	    .type = type, .command = command, .module_count = count,
+	};
+	void *new_data = NULL, *old_data = NULL;
+	struct worker *worker;
+	char *data, *pos;
+	size_t size = 0;
+	int i, rv = -1;
+
+	if ((worker = worker_find(group)) == NULL && (worker = worker_start(group)) == NULL)
+		return -1;
+
+	for (i = 0; i < count; i++)
+		size += strlen(modules[i]) + 1;
+	if (type == WORKER_RUN) {
+		if (new != NULL)
+			request.flags |= WORKER_NEW;
+		if (old != NULL)
+			request.flags |= WORKER_OLD;
+		if (unparse_entry(&new_data, &request.new_size, new != NULL ? new : &(CacheEntry){0}) != 0 ||
+		    unparse_entry(&old_data, &request.old_size, old != NULL ? old : &(CacheEntry){0}) != 0)
+			goto out;
+		size += strlen(dn) + 1 + request.new_size + request.old_size;
+	}
+	request.size = size;
+
+	if ((data = malloc(sizeof(request) + size)) == NULL)
+		abort();  // FIXME
+	memcpy(data, &request, sizeof(request));
+	pos = data + sizeof(request);
+	for (i = 0; i < count; i++)
+		pos = stpcpy(pos, modules[i]) + 1;
+	if (type == WORKER_RUN) {
+		pos = stpcpy(pos, dn) + 1;
+		memcpy(pos, new_data, request.new_size);
+		memcpy(pos + request.new_size, old_data, request.old_size);
+	}
+
+	rv = write_full(worker->fd, data, sizeof(request) + size);
+	free(data);
+	if (rv != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "worker %s: failed to send request: %s", group, strerror(errno));
+		worker_stop(group);
+	}
+out:
+	free(new_data);
+	free(old_data);
+	return rv;
+}
+
+
+/* collect the results of the last request sent to the worker of the group */
+int worker_receive(const char *group, int *results, int count) {
+	struct worker *worker;
+	int32_t *buf;
+	int i;
+
+	if ((worker = worker_find(group)) == NULL)
+		return -1;
+	if ((buf = malloc(count * sizeof(int32_t))) == NULL)
+		abort();  // FIXME
+	if (read_full(worker->fd, buf, count * sizeof(int32_t)) != 0) {
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_ERROR, "worker %s: no result from process %d", group, worker->pid);
+		free(buf);
+		worker_stop(group);
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+		results[i] = buf[i];
+	free(buf);
+	return 0;
+}
+
+
+/* close the connection and wait for the worker to finish its current request */
+void worker_stop(const char *group) {
+	struct worker **prev, *worker;
+	int status;
+
+	for (prev = &workers; (worker = *prev) != NULL; prev = &worker->next) {
+		if (strcmp(worker->group, group))
+			continue;
+		*prev = worker->next;
+		close(worker->fd);
+		while (waitpid(worker->pid, &status, 0) < 0 && errno == EINTR)
+			;
+		univention_debug(UV_DEBUG_LISTENER, UV_DEBUG_PROCESS, "worker %s: process %d stopped", worker->group, worker->pid);
+		free(worker->group);
+		free(worker);
+		return;
+	}
+}
+
+
+void worker_stop_all(void) {
+	while (workers != NULL)
+		worker_stop(workers->group);
+}
+
+
+/* release the connections inherited by a child process, without touching the workers */
+void worker_close_all(void) {
+	struct worker *worker;
+
+	for (worker = workers; worker != NULL; worker = worker->next)
+		close(worker->fd);
+	workers = NULL;
+}
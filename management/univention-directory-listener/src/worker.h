@@ -0,0 +1,62 @@
+/*
+ * Univention Directory Listener
+ *  header information for worker.c
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include <stdbool.h>
+
+#include "cache_entry.h"
+
+enum worker_request_type {
+	WORKER_RUN = 'r',
+	WORKER_POSTRUN = 'p',
+};
+
+/* called in the worker process once after it has been forked, and for each module of a request */
+typedef void (*worker_started_t)(void);
+typedef int (*worker_run_t)(const char *module, const char *dn, CacheEntry *new, CacheEntry *old, char command);
+typedef int (*worker_postrun_t)(const char *module);
+
+void worker_init(worker_started_t started, worker_run_t run, worker_postrun_t postrun);
+bool worker_running(const char *group);
+/* Each request must be answered by worker_receive() before the next one is sent. */
+int worker_send(const char *group, char type, const char *dn, CacheEntry *new, CacheEntry *old, char command, char **modules, int count);
+int worker_receive(const char *group, int *results, int count);
+void worker_stop(const char *group);
+void worker_stop_all(void);
+void worker_close_all(void);
+
+#endif /* _WORKER_H_ */
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include "bench.h"
+
+/*
+ * Each benchmark is run with a doubling number of iterations until one run
+ * takes BENCH_TIME seconds (default 0.5), whose time and allocations per
+ * iteration are reported. Allocations are counted by wrapping malloc() and
+ * friends at link time, so they only cover the code linked into the
+ * benchmark, not that of shared libraries or the Python allocator.
+ */
+
+extern struct bench_info __start_my_benchmarks;
+extern struct bench_info __stop_my_benchmarks;
+
+static unsigned long bench_allocs;
+static double bench_start;
+static double bench_elapsed;
+static bool bench_running;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+void *__wrap_malloc(size_t size) {
+	bench_allocs += bench_running;
+	return __real_malloc(size);
+}
+void *__wrap_calloc(size_t nmemb, size_t size) {
+	bench_allocs += bench_running;
+	return __real_calloc(nmemb, size);
+}
+void *__wrap_realloc(void *ptr, size_t size) {
+	bench_allocs += bench_running;
+	return __real_realloc(ptr, size);
+}
+char *__wrap_strdup(const char *s) {
+	bench_allocs += bench_running;
+	return __real_strdup(s);
+}
+char *__wrap_strndup(const char *s, size_t n) {
+	bench_allocs += bench_running;
+	return __real_strndup(s, n);
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void bench_pause(void) {
+	bench_running = false;
+	bench_elapsed += now() - bench_start;
+}
+
+void bench_resume(void) {
+	bench_start = now();
+	bench_running = true;
+}
+
+static char *format(const char *fmt, ...) {
+	va_list ap;
+	char *s;
+
+	va_start(ap, fmt);
+	if (vasprintf(&s, fmt, ap) < 0)
+		abort();
+	va_end(ap);
+	return s;
+}
+
+static CacheEntryAttribute *add_attribute(CacheEntry *entry, const char *name, int count) {
+	CacheEntryAttribute *attr;
+
+	if ((entry->attributes = realloc(entry->attributes, (entry->attribute_count + 2) * sizeof(CacheEntryAttribute *))) == NULL || (attr = calloc(1, sizeof(CacheEntryAttribute))) == NULL)
+		abort();
+	attr->name = cache_entry_intern(name, strlen(name));
+	if ((attr->values = calloc(count + 1, sizeof(char *))) == NULL || (attr->length = calloc(count + 1, sizeof(int))) == NULL)
+		abort();
+	attr->value_count = count;
+	entry->attributes[entry->attribute_count++] = attr;
+	entry->attributes[entry->attribute_count] = NULL;
+	return attr;
+}
+
+/* add COUNT values to the attribute NAME, formatted with the entry number N and the index */
+static void add_values(CacheEntry *entry, const char *name, int count, const char *fmt, int n) {
+	CacheEntryAttribute *attr = add_attribute(entry, name, count);
+	int i;
+
+	for (i = 0; i < count; i++) {
+		attr->values[i] = format(fmt, n, i);
+		attr->length[i] = strlen(attr->values[i]) + 1;
+	}
+}
+
+static void add_list(CacheEntry *entry, const char *name, const char **values) {
+	CacheEntryAttribute *attr;
+	int i;
+
+	for (i = 0; values[i] != NULL; i++)
+		;
+	attr = add_attribute(entry, name, i);
+	for (i = 0; i < attr->value_count; i++) {
+		attr->values[i] = format("%s", values[i]);
+		attr->length[i] = strlen(values[i]) + 1;
+	}
+}
+
+static CacheEntry *new_entry(void) {
+	CacheEntry *entry;
+
+	if ((entry = calloc(1, sizeof(CacheEntry))) == NULL)
+		abort();
+	return entry;
+}
+
+static void add_common(CacheEntry *entry, int n) {
+	add_values(entry, "entryUUID", 1, "%1$08x-0f3e-103c-8f4a-%1$012d", n);
+	add_values(entry, "entryCSN", 1, "20250101000000.%06dZ#000000#000#000000", n);
+	add_values(entry, "createTimestamp", 1, "20250101000000Z", n);
+	add_values(entry, "modifyTimestamp", 1, "20250101000000Z", n);
+	add_values(entry, "creatorsName", 1, "cn=admin,dc=example,dc=com", n);
+	add_values(entry, "modifiersName", 1, "cn=admin,dc=example,dc=com", n);
+}
+
+char *bench_user_dn(int n) {
+	return format("uid=user%d,cn=users,dc=example,dc=com", n);
+}
+
+CacheEntry *bench_user(int n) {
+	static const char *object_classes[] = {"top", "person", "univentionPWHistory", "posixAccount", "shadowAccount", "sambaSamAccount", "univentionMail", "krb5Principal", "krb5KDCEntry", "univentionPerson", "inetOrgPerson", "organizationalPerson", "univentionObject", "automount", NULL};
+	CacheEntry *entry = new_entry();
+
+	add_common(entry, n);
+	add_list(entry, "objectClass", object_classes);
+	add_values(entry, "uid", 1, "user%d", n);
+	add_values(entry, "cn", 1, "Test User%d", n);
+	add_values(entry, "sn", 1, "User%d", n);
+	add_values(entry, "givenName", 1, "Test", n);
+	add_values(entry, "displayName", 1, "Test User%d", n);
+	add_values(entry, "uidNumber", 1, "%d", 2000 + n);
+	add_values(entry, "gidNumber", 1, "5001", n);
+	add_values(entry, "homeDirectory", 1, "/home/user%d", n);
+	add_values(entry, "loginShell", 1, "/bin/bash", n);
+	add_values(entry, "mailPrimaryAddress", 1, "user%d@example.com", n);
+	add_values(entry, "userPassword", 1, "{crypt}$6$%08d$0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789abcdefghijklmnopqrst", n);
+	add_values(entry, "pwhistory", 1, "$6$%08d$0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", n);
+	add_values(entry, "krb5PrincipalName", 1, "user%d@EXAMPLE.COM", n);
+	add_values(entry, "krb5Key", 6, "0\\x81\\xa1\\xa0\\x03\\x02\\x01\\x01\\xa1\\x81\\x99%d-%d-0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", n);
+	add_values(entry, "krb5KDCFlags", 1, "126", n);
+	add_values(entry, "krb5KeyVersionNumber", 1, "1", n);
+	add_values(entry, "krb5MaxLife", 1, "86400", n);
+	add_values(entry, "krb5MaxRenew", 1, "604800", n);
+	add_values(entry, "sambaSID", 1, "S-1-5-21-1234567890-1234567890-1234567890-%d", 1000 + n);
+	add_values(entry, "sambaNTPassword", 1, "%032d", n);
+	add_values(entry, "sambaAcctFlags", 1, "[U          ]", n);
+	add_values(entry, "sambaPwdLastSet", 1, "1735689600", n);
+	add_values(entry, "sambaPrimaryGroupSID", 1, "S-1-5-21-1234567890-1234567890-1234567890-513", n);
+	add_values(entry, "shadowLastChange", 1, "20089", n);
+	add_values(entry, "univentionObjectType", 1, "users/user", n);
+	add_values(entry, "univentionObjectIdentifier", 1, "%1$08x-1234-4321-abcd-%1$012d", n);
+	add_values(entry, "memberOf", 5, "cn=group%2$d,cn=groups,dc=example,dc=com", n);
+	cache_entry_sort(entry);
+	return entry;
+}
+
+CacheEntry *bench_host(int n) {
+	static const char *object_classes[] = {"top", "person", "univentionHost", "univentionMemberServer", "posixAccount", "shadowAccount", "sambaSamAccount", "krb5Principal", "krb5KDCEntry", "univentionObject", "univentionPolicyReference", NULL};
+	CacheEntry *entry = new_entry();
+
+	add_common(entry, n);
+	add_list(entry, "objectClass", object_classes);
+	add_values(entry, "cn", 1, "host%d", n);
+	add_values(entry, "uid", 1, "host%d$", n);
+	add_values(entry, "uidNumber", 1, "%d", 100000 + n);
+	add_values(entry, "gidNumber", 1, "5007", n);
+	add_values(entry, "homeDirectory", 1, "/dev/null", n);
+	add_values(entry, "associatedDomain", 1, "example.com", n);
+	add_values(entry, "aRecord", 1, "10.200.0.%d", n % 250 + 1);
+	add_values(entry, "macAddress", 1, "52:54:00:00:%02x:01", n % 256);
+	add_values(entry, "univentionService", 10, "Service %2$d", n);
+	add_values(entry, "univentionOperatingSystem", 1, "Univention Corporate Server", n);
+	add_values(entry, "univentionOperatingSystemVersion", 1, "5.2-0", n);
+	add_values(entry, "univentionPolicyReference", 2, "cn=policy%2$d,cn=policies,dc=example,dc=com", n);
+	add_values(entry, "krb5PrincipalName", 1, "host/host%d.example.com@EXAMPLE.COM", n);
+	add_values(entry, "krb5Key", 6, "0\\x81\\xa1\\xa0\\x03\\x02\\x01\\x01\\xa1\\x81\\x99%d-%d-0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ", n);
+	add_values(entry, "sambaSID", 1, "S-1-5-21-1234567890-1234567890-1234567890-%d", 100000 + n);
+	add_values(entry, "sambaAcctFlags", 1, "[S          ]", n);
+	add_values(entry, "univentionObjectType", 1, "computers/memberserver", n);
+	cache_entry_sort(entry);
+	return entry;
+}
+
+CacheEntry *bench_group(int n, int members) {
+	static const char *object_classes[] = {"top", "posixGroup", "univentionGroup", "sambaGroupMapping", "univentionObject", NULL};
+	CacheEntry *entry = new_entry();
+
+	add_common(entry, n);
+	add_list(entry, "objectClass", object_classes);
+	add_values(entry, "cn", 1, "group%d", n);
+	add_values(entry, "gidNumber", 1, "%d", 5000 + n);
+	add_values(entry, "sambaSID", 1, "S-1-5-21-1234567890-1234567890-1234567890-%d", 2000 + n);
+	add_values(entry, "sambaGroupType", 1, "2", n);
+	add_values(entry, "univentionGroupType", 1, "-2147483646", n);
+	add_values(entry, "univentionObjectType", 1, "groups/group", n);
+	add_values(entry, "uniqueMember", members, "uid=user%2$d,cn=users,dc=example,dc=com", n);
+	add_values(entry, "memberUid", members, "user%2$d", n);
+	cache_entry_sort(entry);
+	return entry;
+}
+
+int main(int argc, char *argv[]) {
+	struct bench_info *iter;
+	const char *env = getenv("BENCH_TIME");
+	double limit = env ? atof(env) : 0.5;
+
+	for (iter = &__start_my_benchmarks; iter < &__stop_my_benchmarks; iter++) {
+		unsigned long n;
+
+		if (argc > 1 && strstr(iter->name, argv[1]) == NULL)
+			continue;
+		for (n = 1;; n *= 2) {
+			bench_allocs = 0;
+			bench_elapsed = 0;
+			bench_resume();
+			iter->func(n);
+			bench_pause();
+			if (bench_elapsed >= limit || n >= 1UL << 30)
+				break;
+		}
+		fprintf(stdout, "%-40s %10lu %14.1f ns/op %10.1f allocs/op\n", iter->name, n, bench_elapsed * 1e9 / n, (double)bench_allocs / n);
+	}
+	return 0;
+}
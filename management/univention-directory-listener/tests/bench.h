@@ -0,0 +1,30 @@
+#include <stdbool.h>
+#include <ldap.h>
+
+#include "../src/cache_entry.h"
+
+struct bench_info {
+	const char *name;
+	void (*func)(unsigned long iterations);
+};
+#define _BENCH(n)                                                                                               \
+	static void bench_##n(unsigned long iterations);                                                            \
+	static struct bench_info __bench_##n __attribute((__section__("my_benchmarks"))) __attribute((__used__)) = { \
+	    .name = "bench_" #n, .func = bench_##n,                                                                 \
+	}
+#define BENCH(n)   \
+	_BENCH(n); \
+	static void bench_##n(unsigned long iterations)
+
+/* keep the compiler from optimizing away a result */
+#define BENCH_USE(x) __asm__ volatile("" : : "g"(x) : "memory")
+
+/* set up outside of the measurement, e.g. a copy of the entry to work on */
+void bench_pause(void);
+void bench_resume(void);
+
+/* synthetic entries shaped like those of a UCS domain */
+CacheEntry *bench_user(int n);
+CacheEntry *bench_host(int n);
+CacheEntry *bench_group(int n, int members);
+char *bench_user_dn(int n);
@@ -0,0 +1,74 @@
+#include "bench.c"
+#include <unistd.h>
+#include "../src/cache_dn.h"
+
+#define USERS 10000
+
+static char dir[] = "/tmp/bench_cache_dn.XXXXXX";
+static MDB_env *env;
+static MDB_txn *txn;
+static MDB_cursor *cursor;
+static char *dns[USERS];
+
+static void cleanup(void) {
+	char path[sizeof(dir) + 16];
+
+	mdb_cursor_close(cursor);
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+	snprintf(path, sizeof(path), "%s/data.mdb", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/lock.mdb", dir);
+	unlink(path);
+	rmdir(dir);
+}
+
+__attribute__((constructor)) static void setup(void) {
+	MDB_dbi dbi;
+	DNID dnid;
+	int i;
+
+	if (mkdtemp(dir) == NULL || mdb_env_create(&env) || mdb_env_set_mapsize(env, 1UL << 30) || mdb_env_set_maxdbs(env, 3) || mdb_env_open(env, dir, MDB_NOSYNC, 0600))
+		abort();
+	atexit(cleanup);
+	if (mdb_txn_begin(env, NULL, 0, &txn) || dntree_init(&dbi, txn, 0) || mdb_cursor_open(txn, dbi, &cursor))
+		abort();
+	for (i = 0; i < USERS; i++) {
+		dns[i] = bench_user_dn(i);
+		if (dntree_get_id4dn(cursor, dns[i], &dnid, true))
+			abort();
+	}
+}
+
+BENCH(get_id4dn) {
+	unsigned long i;
+	DNID dnid;
+
+	for (i = 0; i < iterations; i++) {
+		dntree_get_id4dn(cursor, dns[i % USERS], &dnid, false);
+		BENCH_USE(dnid);
+	}
+}
+BENCH(get_id4dn_uncached) {
+	unsigned long i;
+	DNID dnid;
+
+	for (i = 0; i < iterations; i++) {
+		dntree_cache_clear();
+		dntree_get_id4dn(cursor, dns[i % USERS], &dnid, false);
+		BENCH_USE(dnid);
+	}
+}
+BENCH(get_id4dn_create) {
+	static unsigned long hosts; /* new ones in each run */
+	unsigned long i;
+	DNID dnid;
+
+	for (i = 0; i < iterations; i++) {
+		char dn[64];
+
+		snprintf(dn, sizeof(dn), "cn=host%lu,cn=computers,dc=example,dc=com", hosts++);
+		dntree_get_id4dn(cursor, dn, &dnid, true);
+		BENCH_USE(dnid);
+	}
+}
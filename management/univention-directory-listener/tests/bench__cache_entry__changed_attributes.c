@@ -0,0 +1,47 @@
+#include "bench.c"
+
+static CacheEntry *user_old, *user_new, *group_old, *group_new;
+
+__attribute__((constructor)) static void setup(void) {
+	/* a password change and one more member */
+	user_old = bench_user(1);
+	user_new = bench_user(1);
+	cache_entry_set1(user_new, "userPassword", "{crypt}$6$changed$");
+	cache_entry_set1(user_new, "modifyTimestamp", "20250102000000Z");
+	group_old = bench_group(1, 50000);
+	group_new = bench_group(1, 50001);
+}
+
+static void bench_changed(unsigned long iterations, CacheEntry *new, CacheEntry *old) {
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		char **changed = cache_entry_changed_attributes(new, old);
+		BENCH_USE(changed);
+		free(changed);
+	}
+}
+
+static void bench_delta(unsigned long iterations, CacheEntry *new, CacheEntry *old) {
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		int count;
+		CacheEntryAttributeDelta *deltas = cache_entry_delta(new, old, &count);
+		BENCH_USE(deltas);
+		cache_entry_free_delta(deltas, count);
+	}
+}
+
+BENCH(changed_attributes_user) {
+	bench_changed(iterations, user_new, user_old);
+}
+BENCH(changed_attributes_group) {
+	bench_changed(iterations, group_new, group_old);
+}
+BENCH(delta_user) {
+	bench_delta(iterations, user_new, user_old);
+}
+BENCH(delta_group) {
+	bench_delta(iterations, group_new, group_old);
+}
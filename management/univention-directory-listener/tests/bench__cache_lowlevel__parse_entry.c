@@ -0,0 +1,60 @@
+#include "bench.c"
+#include "../src/cache_lowlevel.h"
+
+char *cache_dir = "/tmp";
+
+static void bench_unparse(unsigned long iterations, CacheEntry *entry) {
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		void *data = NULL;
+		u_int32_t size = 0;
+
+		unparse_entry(&data, &size, entry);
+		BENCH_USE(data);
+		free(data);
+	}
+}
+
+static void bench_parse(unsigned long iterations, CacheEntry *entry, int (*parse)(void *, u_int32_t, CacheEntry *)) {
+	CacheEntry parsed;
+	void *data = NULL;
+	u_int32_t size = 0;
+	unsigned long i;
+
+	bench_pause();
+	unparse_entry(&data, &size, entry);
+	bench_resume();
+	for (i = 0; i < iterations; i++) {
+		memset(&parsed, 0, sizeof(parsed));
+		parse(data, size, &parsed);
+		BENCH_USE(parsed.attributes);
+		cache_free_entry(NULL, &parsed);
+	}
+	bench_pause();
+	free(data);
+	bench_resume();
+}
+
+#define BENCH_SHAPE(shape, entry)                                 \
+	BENCH(unparse_entry_##shape) {                            \
+		bench_unparse(iterations, entry);                 \
+	}                                                         \
+	BENCH(parse_entry_##shape) {                              \
+		bench_parse(iterations, entry, parse_entry);      \
+	}                                                         \
+	BENCH(parse_entry_view_##shape) {                         \
+		bench_parse(iterations, entry, parse_entry_view); \
+	}
+
+static CacheEntry *user, *host, *group;
+
+__attribute__((constructor)) static void setup(void) {
+	user = bench_user(1);
+	host = bench_host(1);
+	group = bench_group(1, 50000);
+}
+
+BENCH_SHAPE(user, user)
+BENCH_SHAPE(host, host)
+BENCH_SHAPE(group, group)
@@ -0,0 +1,55 @@
+#include "bench.c"
+#include "../src/entrydict.h"
+
+static CacheEntry *user, *group;
+
+__attribute__((constructor)) static void setup(void) {
+	Py_Initialize();
+	if (entrydict_init() != 0)
+		abort();
+	user = bench_user(1);
+	group = bench_group(1, 50000);
+}
+
+/* what a handler typically does: look at a few attributes of the entry */
+static void bench_access(unsigned long iterations, CacheEntry *entry, const char **keys, bool keep) {
+	unsigned long i;
+	int j;
+
+	for (i = 0; i < iterations; i++) {
+		PyObject *shared = PyDict_New();
+		PyObject *dict = entrydict_new(entry, shared);
+
+		for (j = 0; keys[j] != NULL; j++) {
+			PyObject *values = PyMapping_GetItemString(dict, keys[j]);
+			BENCH_USE(values);
+			Py_XDECREF(values);
+		}
+		PyErr_Clear();
+		/* a handler keeping the mapping makes it convert all attributes */
+		if (keep)
+			Py_INCREF(dict);
+		entrydict_detach(dict);
+		if (keep)
+			Py_DECREF(dict);
+		Py_DECREF(dict);
+		Py_DECREF(shared);
+	}
+}
+
+static const char *user_keys[] = {"uid", "objectClass", "mailPrimaryAddress", NULL};
+static const char *group_keys[] = {"cn", "uniqueMember", NULL};
+static const char *no_keys[] = {NULL};
+
+BENCH(entrydict_user) {
+	bench_access(iterations, user, user_keys, false);
+}
+BENCH(entrydict_user_kept) {
+	bench_access(iterations, user, no_keys, true);
+}
+BENCH(entrydict_group) {
+	bench_access(iterations, group, group_keys, false);
+}
+BENCH(entrydict_group_kept) {
+	bench_access(iterations, group, no_keys, true);
+}
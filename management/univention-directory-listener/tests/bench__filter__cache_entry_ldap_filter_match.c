@@ -0,0 +1,55 @@
+#include "bench.c"
+#include "filter.h"
+
+/* filters as used by the modules of a Primary Directory Node */
+static struct filter filter_users = {
+    .base = "dc=example,dc=com",
+    .scope = 2,  // LDAP.SCOPE_SUBTREE
+    .filter = "(&(objectClass=posixAccount)(!(uid=*$))(|(objectClass=univentionMail)(objectClass=sambaSamAccount)))",
+};
+static struct filter filter_hosts = {
+    .base = "dc=example,dc=com",
+    .scope = 2,
+    .filter = "(&(objectClass=univentionHost)(univentionService=Service 7))",
+};
+static struct filter filter_groups = {
+    .base = "cn=groups,dc=example,dc=com",
+    .scope = 1,  // LDAP.SCOPE_ONELEVEL
+    .filter = "(&(objectClass=univentionGroup)(cn=group*))",
+};
+static struct filter *filters[4] = {
+    &filter_users, &filter_hosts, &filter_groups, NULL,
+};
+
+static CacheEntry *user, *host, *group;
+
+__attribute__((constructor)) static void setup(void) {
+	user = bench_user(1);
+	host = bench_host(1);
+	group = bench_group(1, 50000);
+}
+
+static void bench_match(unsigned long iterations, const char *dn, CacheEntry *entry) {
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++)
+		BENCH_USE(cache_entry_ldap_filter_match(filters, dn, entry));
+}
+
+BENCH(match_user) {
+	bench_match(iterations, "uid=user1,cn=users,dc=example,dc=com", user);
+}
+BENCH(match_host) {
+	bench_match(iterations, "cn=host1,cn=memberserver,cn=computers,dc=example,dc=com", host);
+}
+BENCH(match_group) {
+	bench_match(iterations, "cn=group1,cn=groups,dc=example,dc=com", group);
+}
+BENCH(match_group_memo) {
+	unsigned long i;
+
+	filter_memo_begin(group);
+	for (i = 0; i < iterations; i++)
+		BENCH_USE(cache_entry_ldap_filter_match(filters, "cn=group1,cn=groups,dc=example,dc=com", group));
+	filter_memo_end();
+}
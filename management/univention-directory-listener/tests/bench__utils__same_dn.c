@@ -0,0 +1,35 @@
+#include "bench.c"
+#include "../src/utils.h"
+
+static void bench_lower(unsigned long iterations, const char *str) {
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++) {
+		char *lower = lower_utf8(str);
+		BENCH_USE(lower);
+		free(lower);
+	}
+}
+
+static void bench_same(unsigned long iterations, const char *left, const char *right) {
+	unsigned long i;
+
+	for (i = 0; i < iterations; i++)
+		BENCH_USE(same_dn(left, right));
+}
+
+BENCH(lower_utf8_ascii) {
+	bench_lower(iterations, "uid=User1,cn=Users,dc=Example,dc=COM");
+}
+BENCH(lower_utf8_umlaut) {
+	bench_lower(iterations, "uid=Jürgen.Größ,ou=Bürogebäude,dc=Example,dc=COM");
+}
+BENCH(same_dn_equal) {
+	bench_same(iterations, "uid=user1,cn=users,dc=example,dc=com", "uid=user1,cn=users,dc=example,dc=com");
+}
+BENCH(same_dn_case) {
+	bench_same(iterations, "uid=user1,cn=users,dc=example,dc=com", "uid=User1,cn=Users,dc=Example,dc=COM");
+}
+BENCH(same_dn_different) {
+	bench_same(iterations, "uid=user1,cn=users,dc=example,dc=com", "uid=user2,cn=users,dc=example,dc=com");
+}
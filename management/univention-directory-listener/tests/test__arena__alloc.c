@@ -0,0 +1,72 @@
+#include "test.c"
+#include <string.h>
+#include <stdint.h>
+
+#include "../src/arena.h"
+
+#define TEST(n)   \
+	_TEST(n); \
+	static bool test_##n(void)
+
+#define ASSERT(cond)                                      \
+	do {                                              \
+		if (!(cond)) {                            \
+			fprintf(stderr, "! " #cond "\n"); \
+			return false;                     \
+		}                                         \
+	} while (0)
+
+TEST(alloc_aligned) {
+	struct arena arena = {};
+	char *a = arena_alloc(&arena, 1), *b = arena_alloc(&arena, 3);
+	ASSERT(a && b && a != b);
+	ASSERT(((uintptr_t)b & (sizeof(void *) - 1)) == 0);
+	arena_free(&arena);
+	return true;
+}
+
+TEST(realloc_in_place) {
+	struct arena arena = {};
+	char *a = arena_alloc(&arena, 8);
+	memcpy(a, "1234567", 8);
+	ASSERT(arena_realloc(&arena, a, 100) == a);
+	ASSERT(!strcmp(a, "1234567"));
+	arena_free(&arena);
+	return true;
+}
+
+TEST(realloc_copy) {
+	struct arena arena = {};
+	char *a = arena_strdup(&arena, "value"), *b = arena_alloc(&arena, 4), *c;
+	c = arena_realloc(&arena, a, 100);
+	ASSERT(c && c != a && c != b);
+	ASSERT(!strcmp(c, "value"));
+	ASSERT(arena_realloc(&arena, c, 2) == c);
+	arena_free(&arena);
+	return true;
+}
+
+TEST(large) {
+	struct arena arena = {};
+	char *a = arena_alloc(&arena, 16), *b = arena_alloc(&arena, 1 << 20), *c = arena_alloc(&arena, 16);
+	ASSERT(a && b && c);
+	memset(b, 'x', 1 << 20);
+	ASSERT(c + 16 <= b || c >= b + (1 << 20));
+	arena_free(&arena);
+	return true;
+}
+
+TEST(reset) {
+	struct arena arena = {};
+	char *a = arena_alloc(&arena, 16);
+	int i;
+	for (i = 0; i < 10000; i++)
+		ASSERT(arena_strdup(&arena, "some attribute value"));
+	arena_reset(&arena);
+	ASSERT(arena.blocks != NULL);
+	ASSERT(arena_alloc(&arena, 16) == a);
+	arena_reset(&arena);
+	arena_free(&arena);
+	ASSERT(arena.blocks == NULL);
+	return true;
+}
@@ -0,0 +1,69 @@
+#include "test.c"
+#include <string.h>
+
+#include "../src/base64.h"
+
+static inline bool _test(const char *input, const char *expected) {
+	size_t len = strlen(input);
+	char output[BASE64_ENCODE_LEN(len) + 1];
+	int ret = base64_encode((u_char *)input, len, output, sizeof(output));
+	if (ret != (int)strlen(expected) || strcmp(output, expected)) {
+		fprintf(stderr, " i=%s\n o=%s\n e=%s\n", input, output, expected);
+		return false;
+	}
+	return true;
+}
+#define TEST(n, i, e)                \
+	static bool test_##n(void) { \
+		return _test(i, e);  \
+	}                            \
+	_TEST(n)
+
+/* RFC 4648 section 10 */
+TEST(empty, "", "");
+TEST(f, "f", "Zg==");
+TEST(fo, "fo", "Zm8=");
+TEST(foo, "foo", "Zm9v");
+TEST(foob, "foob", "Zm9vYg==");
+TEST(fooba, "fooba", "Zm9vYmE=");
+TEST(foobar, "foobar", "Zm9vYmFy");
+TEST(long, "The quick brown fox jumps over the lazy dog", "VGhlIHF1aWNrIGJyb3duIGZveCBqdW1wcyBvdmVyIHRoZSBsYXp5IGRvZw==");
+
+/* Compare every length against the byte-at-a-time definition, so both the
+ * vectorised blocks and the scalar tail are covered. */
+static bool test_roundtrip(void) {
+	static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	u_char input[300], decoded[300];
+	char output[BASE64_ENCODE_LEN(sizeof(input)) + 1], expected[sizeof(output)];
+	size_t len, i;
+
+	for (i = 0; i < sizeof(input); i++)
+		input[i] = (i * 151 + 17) ^ (i >> 3);
+	for (len = 0; len <= sizeof(input); len++) {
+		size_t o = 0;
+		for (i = 0; i < len; i += 3) {
+			unsigned int group = input[i] << 16 | (i + 1 < len ? input[i + 1] << 8 : 0) | (i + 2 < len ? input[i + 2] : 0);
+			expected[o++] = digits[group >> 18];
+			expected[o++] = digits[(group >> 12) & 0x3f];
+			expected[o++] = i + 1 < len ? digits[(group >> 6) & 0x3f] : '=';
+			expected[o++] = i + 2 < len ? digits[group & 0x3f] : '=';
+		}
+		expected[o] = '\0';
+		if (base64_encode(input, len, output, BASE64_ENCODE_LEN(len) + 1) != (int)o || strcmp(output, expected)) {
+			fprintf(stderr, " len=%zu\n o=%s\n e=%s\n", len, output, expected);
+			return false;
+		}
+		if (base64_decode(output, decoded, sizeof(decoded)) != (int)len || memcmp(decoded, input, len)) {
+			fprintf(stderr, " decode len=%zu\n", len);
+			return false;
+		}
+	}
+	return true;
+}
+_TEST(roundtrip);
+
+static bool test_short_target(void) {
+	char output[9];
+	return base64_encode((u_char *)"foobar", 6, output, 8) == -1 && base64_encode((u_char *)"foobar", 6, output, 9) == 8;
+}
+_TEST(short_target);
@@ -0,0 +1,110 @@
+#include "test.c"
+#include <sys/wait.h>
+#include "../src/cache.c"
+
+int INIT_ONLY = 0;
+
+#define TEST(n)   \
+	_TEST(n); \
+	static bool test_##n(void)
+
+#define ASSERT(cond)                                      \
+	do {                                              \
+		if (!(cond)) {                            \
+			fprintf(stderr, "! " #cond "\n"); \
+			return false;                     \
+		}                                         \
+	} while (0)
+
+static char dir[] = "/tmp/test_cache_map_resized.XXXXXX";
+static size_t grow_size;
+
+/* the reader maps only 1 MiB, see determine_mapsize_from_ucr() */
+char *univention_config_get_string(const char *key) {
+	return strcmp(key, "listener/cache/mdb/maxsize") ? NULL : strdup("1048576");
+}
+
+static int create(void) {
+	CacheMasterEntry master_entry = {.id = 42, .schema_id = 1};
+	int rv;
+
+	if ((rv = cache_init(dir, 0)) == MDB_SUCCESS) {
+		rv = cache_update_master_entry(&master_entry);
+		cache_close();
+	}
+	return rv != MDB_SUCCESS;
+}
+
+/* write grow_size bytes into a larger map, like the listener after grow_mapsize() */
+static int grow(void) {
+	MDB_env *writer;
+	MDB_txn *txn;
+	MDB_dbi dbi;
+	MDB_val key = {.mv_size = 4, .mv_data = "test"}, data = {.mv_size = grow_size};
+	int rv;
+
+	if ((data.mv_data = calloc(1, grow_size)) == NULL)
+		return 1;
+	if ((rv = mdb_env_create(&writer)) != MDB_SUCCESS)
+		return 1;
+	if ((rv = mdb_env_set_mapsize(writer, grow_size * 4)) == MDB_SUCCESS && (rv = mdb_env_set_maxdbs(writer, 4)) == MDB_SUCCESS && (rv = mdb_env_open(writer, dir, 0, 0600)) == MDB_SUCCESS && (rv = mdb_txn_begin(writer, NULL, 0, &txn)) == MDB_SUCCESS) {
+		if ((rv = mdb_dbi_open(txn, "test", MDB_CREATE, &dbi)) == MDB_SUCCESS && (rv = mdb_put(txn, dbi, &key, &data, 0)) == MDB_SUCCESS)
+			rv = mdb_txn_commit(txn);
+		else
+			mdb_txn_abort(txn);
+	}
+	mdb_env_close(writer);
+	free(data.mv_data);
+	return rv != MDB_SUCCESS;
+}
+
+/* run @func in another process, as LMDB allows only one environment per file and process */
+static bool in_child(int (*func)(void)) {
+	pid_t pid;
+	int status;
+
+	if ((pid = fork()) == 0)
+		_exit(func());
+	return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void cleanup(void) {
+	char path[sizeof(dir) + 16];
+
+	snprintf(path, sizeof(path), "%s/data.mdb", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/lock.mdb", dir);
+	unlink(path);
+	rmdir(dir);
+}
+
+TEST(reader_after_growth) {
+	CacheMasterEntry master_entry;
+	CacheIterOptions options = {0};
+	CacheIter iter;
+
+	ASSERT(mkdtemp(dir) != NULL);
+	atexit(cleanup);
+	ASSERT(in_child(create));
+	ASSERT(cache_init(dir, MDB_RDONLY) == MDB_SUCCESS);
+	ASSERT(cache_get_master_entry(&master_entry) == MDB_SUCCESS);
+
+	/* the reset reader_txn is renewed */
+	grow_size = 4 << 20;
+	ASSERT(in_child(grow));
+	ASSERT(cache_get_master_entry(&master_entry) == MDB_SUCCESS);
+	ASSERT(master_entry.id == 42);
+
+	/* a new transaction is begun */
+	grow_size = 32 << 20;
+	ASSERT(in_child(grow));
+	ASSERT(cache_iter_begin(&iter, &options) == MDB_SUCCESS);
+	ASSERT(cache_iter_master_entry(&iter, &master_entry) == MDB_SUCCESS);
+	ASSERT(master_entry.id == 42);
+	ASSERT(readers_open == 1);
+	cache_iter_end(&iter);
+	ASSERT(readers_open == 0);
+
+	cache_close();
+	return true;
+}
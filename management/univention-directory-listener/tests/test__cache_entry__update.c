@@ -55,7 +55,7 @@ TEST(force_attribute_empty) {
 	                           };
 	init.values[0] = NULL;
 	init.length[0] = 0;
-	attr = _cache_entry_force_value(&init, &ava_dc_test);
+	attr = _cache_entry_force_value(&entry_empty, &init, &ava_dc_test);
 	ASSERT(attr == &init);
 	ASSERT(!strcmp(attr->name, "dc"));
 	ASSERT(attr->value_count == 1);
@@ -77,7 +77,7 @@ TEST(force_attribute_replace) {
 	init.values[1] = NULL;
 	init.length[0] = 4;
 	init.length[1] = 0;
-	attr = _cache_entry_force_value(&init, &ava_dc_test);
+	attr = _cache_entry_force_value(&entry_empty, &init, &ava_dc_test);
 	ASSERT(attr == &init);
 	ASSERT(!strcmp(attr->name, "dc"));
 	ASSERT(attr->value_count == 1);
@@ -104,3 +104,185 @@ TEST(add_attribute) {
 	cache_free_entry(NULL, &entry);
 	return true;
 }
+
+TEST(attribute_from_ldap_packed) {
+	struct berval a = {.bv_val = "a", .bv_len = 1}, b = {.bv_val = "b\0c", .bv_len = 3}, *val[] = {&a, &b, &a, NULL};
+	CacheEntryAttribute *attr = calloc(1, sizeof(CacheEntryAttribute));
+	attr->name = "description";
+	ASSERT(attribute_from_ldap(&entry_empty, attr, val, false, "dc=test") == 0);
+	ASSERT(attr->packed);
+	ASSERT(attr->value_count == 3);
+	ASSERT(attr->length[0] == 2 && !strcmp(attr->values[0], "a"));
+	ASSERT(attr->length[1] == 4 && !memcmp(attr->values[1], "b\0c", 4));
+	ASSERT(attr->values[3] == NULL);
+	ASSERT(unpack_attribute(&entry_empty, attr) == 0);
+	ASSERT(!attr->packed);
+	ASSERT(attr->value_count == 3);
+	ASSERT(attr->length[1] == 4 && !memcmp(attr->values[1], "b\0c", 4));
+	ASSERT(attr->values[3] == NULL);
+	cache_free_attribute(&entry_empty, attr);
+	return true;
+}
+
+TEST(attribute_from_ldap_unique) {
+	char names[100][8];
+	struct berval bv[100], *val[201];
+	CacheEntryAttribute attr = {.name = "memberUid"};
+	int i;
+	for (i = 0; i < 100; i++) {
+		bv[i].bv_len = snprintf(names[i], sizeof(names[i]), "u%d", i);
+		bv[i].bv_val = names[i];
+		val[i] = val[100 + i] = &bv[i];
+	}
+	val[200] = NULL;
+	ASSERT(attribute_from_ldap(&entry_empty, &attr, val, true, "cn=group") == 0);
+	ASSERT(attr.value_count == 100);
+	for (i = 0; i < 100; i++)
+		ASSERT(!strcmp(attr.values[i], names[i]));
+	ASSERT(attr.values[100] == NULL);
+	free(attr.values);
+	return true;
+}
+
+TEST(arena_copy) {
+	struct arena arena = {};
+	CacheEntry copy;
+	cache_entry_arena = &arena;
+	ASSERT(copy_cache_entry(&entry_dc_test, &copy) == 0);
+	cache_entry_arena = NULL;
+	ASSERT(copy.arena == &arena);
+	ASSERT(!strcmp(cache_entry_get1(&copy, "dc"), "test"));
+	cache_entry_set1(&copy, "dc", "other");
+	cache_entry_module_add(&copy, "module");
+	ASSERT(cache_entry_add1(&copy, "cn", "name") != NULL);
+	ASSERT(copy.attribute_count == 2);
+	ASSERT(!strcmp(cache_entry_get1(&copy, "dc"), "other"));
+	ASSERT(cache_entry_module_present(&copy, "module"));
+	cache_free_entry(NULL, &copy);
+	ASSERT(copy.attribute_count == 0 && copy.arena == &arena);
+	arena_free(&arena);
+	return true;
+}
+
+TEST(intern) {
+	char name[16];
+	char *names[2000];
+	int i;
+	ASSERT(cache_entry_intern("dc", 2) == cache_entry_intern("dcx", 2));
+	ASSERT(cache_entry_intern("dc", 2) != cache_entry_intern("cn", 2));
+	ASSERT(!strcmp(cache_entry_intern("objectClass", 6), "object"));
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "attr%d", i);
+		names[i] = cache_entry_intern(name, strlen(name));
+	}
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "attr%d", i);
+		ASSERT(names[i] == cache_entry_intern(name, strlen(name)));
+		ASSERT(!strcmp(names[i], name));
+	}
+	return true;
+}
+
+TEST(sorted_insert) {
+	CacheEntry entry = {};
+	int i;
+	ASSERT(cache_entry_add1(&entry, "uid", "test"));
+	ASSERT(cache_entry_add1(&entry, "cn", "test"));
+	ASSERT(cache_entry_add1(&entry, "sn", "test"));
+	ASSERT(cache_entry_add1(&entry, "c", "de"));
+	ASSERT(entry.attribute_count == 4);
+	for (i = 1; i < entry.attribute_count; i++)
+		ASSERT(strcmp(entry.attributes[i - 1]->name, entry.attributes[i]->name) < 0);
+	ASSERT(entry.attributes[entry.attribute_count] == NULL);
+	ASSERT(cache_entry_find_attribute(&entry, "cn", 2) == entry.attributes[1]);
+	ASSERT(cache_entry_find_attribute(&entry, "cnx", 2) == entry.attributes[1]);
+	ASSERT(cache_entry_find_attribute(&entry, "cn", 1) == entry.attributes[0]);
+	ASSERT(cache_entry_find_attribute(&entry, "d", 1) == NULL);
+	ASSERT(cache_entry_find_attribute(&entry, "uidNumber", 9) == NULL);
+	ASSERT(!strcmp(cache_entry_get1(&entry, "sn"), "test"));
+	cache_entry_set1(&entry, "sn", "other");
+	ASSERT(!strcmp(cache_entry_get1(&entry, "sn"), "other"));
+	ASSERT(cache_entry_get1(&entry, "givenName") == NULL);
+	cache_free_entry(NULL, &entry);
+	return true;
+}
+
+TEST(sort) {
+	static CacheEntryAttribute attr_sn = {
+	    .name = "sn", .values = attr_test, .length = len_test, .value_count = 1,
+	};
+	CacheEntryAttribute *unsorted[] = {
+	    &attr_sn, &attr_dc_test, NULL,
+	};
+	CacheEntry entry = {
+	    .attributes = unsorted, .attribute_count = 2,
+	};
+	cache_entry_sort(&entry);
+	ASSERT(entry.attributes[0] == &attr_dc_test);
+	ASSERT(entry.attributes[1] == &attr_sn);
+	ASSERT(entry.attributes[2] == NULL);
+	return true;
+}
+
+TEST(changed_attributes) {
+	CacheEntry new = {}, old = {};
+	char **changes;
+	ASSERT(cache_entry_add1(&new, "cn", "test"));
+	ASSERT(cache_entry_add1(&new, "sn", "new"));
+	ASSERT(cache_entry_add1(&new, "uid", "test"));
+	ASSERT(cache_entry_add1(&old, "cn", "test"));
+	ASSERT(cache_entry_add1(&old, "sn", "old"));
+	ASSERT(cache_entry_add1(&old, "description", "test"));
+	changes = cache_entry_changed_attributes(&new, &old);
+	ASSERT(changes);
+	ASSERT(!strcmp(changes[0], "description"));
+	ASSERT(!strcmp(changes[1], "sn"));
+	ASSERT(!strcmp(changes[2], "uid"));
+	ASSERT(changes[3] == NULL);
+	free(changes);
+	ASSERT(cache_entry_changed_attributes(&new, &new) == NULL);
+	cache_free_entry(NULL, &new);
+	cache_free_entry(NULL, &old);
+	return true;
+}
+
+TEST(delta) {
+	char *new_values[] = {"a", "c", "d", "d", NULL}, *old_values[] = {"d", "b", "a", NULL};
+	int new_length[] = {2, 2, 2, 2, 0}, old_length[] = {2, 2, 2, 0};
+	CacheEntryAttribute new_attr = {
+	    .name = cache_entry_intern("memberUid", 9), .values = new_values, .length = new_length, .value_count = 4,
+	};
+	CacheEntryAttribute old_attr = {
+	    .name = cache_entry_intern("memberUid", 9), .values = old_values, .length = old_length, .value_count = 3,
+	};
+	CacheEntryAttribute *new_attrs[] = {&new_attr, NULL}, *old_attrs[] = {&old_attr, NULL};
+	CacheEntry new = {
+	    .attributes = new_attrs, .attribute_count = 1,
+	};
+	CacheEntry old = {
+	    .attributes = old_attrs, .attribute_count = 1,
+	};
+	CacheEntry empty = {};
+	CacheEntryAttributeDelta *delta;
+	int count;
+
+	delta = cache_entry_delta(&new, &old, &count);
+	ASSERT(count == 1);
+	ASSERT(delta[0].new == &new_attr && delta[0].old == &old_attr);
+	ASSERT(delta[0].added_count == 2);
+	ASSERT(!strcmp(new_values[delta[0].added[0]], "c"));
+	ASSERT(!strcmp(new_values[delta[0].added[1]], "d"));
+	ASSERT(delta[0].removed_count == 1);
+	ASSERT(!strcmp(old_values[delta[0].removed[0]], "b"));
+	cache_entry_free_delta(delta, count);
+
+	delta = cache_entry_delta(&empty, &old, &count);
+	ASSERT(count == 1);
+	ASSERT(delta[0].new == NULL && delta[0].removed_count == 3 && delta[0].added_count == 0);
+	cache_entry_free_delta(delta, count);
+
+	delta = cache_entry_delta(&new, &new, &count);
+	ASSERT(count == 0);
+	cache_entry_free_delta(delta, count);
+	return true;
+}
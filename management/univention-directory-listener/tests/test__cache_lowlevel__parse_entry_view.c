@@ -0,0 +1,251 @@
+#include "test.c"
+#include "../src/cache_entry.c"
+#include "../src/cache_lowlevel.c"
+
+char *cache_dir = "/tmp";
+
+#define TEST(n)   \
+	_TEST(n); \
+	static bool test_##n(void)
+
+#define ASSERT(cond)                                      \
+	do {                                              \
+		if (!(cond)) {                            \
+			fprintf(stderr, "! " #cond "\n"); \
+			return false;                     \
+		}                                         \
+	} while (0)
+
+static char *values_dc[] = {
+    "test", NULL,
+};
+static int length_dc[] = {
+    5, 0,
+};
+static char *values_oc[] = {
+    "top", "domain", "", NULL,
+};
+static int length_oc[] = {
+    4, 7, 0, 0,
+};
+static CacheEntryAttribute attr_dc = {
+    .name = "dc", .values = values_dc, .length = length_dc, .value_count = 1,
+};
+static CacheEntryAttribute attr_oc = {
+    .name = "objectClass", .values = values_oc, .length = length_oc, .value_count = 3,
+};
+static CacheEntryAttribute *attrs[] = {
+    &attr_dc, &attr_oc, NULL,
+};
+static char *modules[] = {
+    "foo", "bar", NULL,
+};
+static CacheEntry entry_test = {
+    .attributes = attrs, .attribute_count = 2, .modules = modules, .module_count = 2,
+};
+
+static bool same_entry(CacheEntry *a, CacheEntry *b) {
+	int i, j;
+	ASSERT(a->attribute_count == b->attribute_count);
+	ASSERT(a->module_count == b->module_count);
+	for (i = 0; i < a->attribute_count; i++) {
+		ASSERT(!strcmp(a->attributes[i]->name, b->attributes[i]->name));
+		ASSERT(a->attributes[i]->value_count == b->attributes[i]->value_count);
+		for (j = 0; j < a->attributes[i]->value_count; j++) {
+			ASSERT(a->attributes[i]->length[j] == b->attributes[i]->length[j]);
+			ASSERT(!memcmp(a->attributes[i]->values[j], b->attributes[i]->values[j], a->attributes[i]->length[j]));
+		}
+		ASSERT(b->attributes[i]->values[j] == NULL);
+	}
+	ASSERT(b->attributes[i] == NULL);
+	for (i = 0; i < a->module_count; i++)
+		ASSERT(!strcmp(a->modules[i], b->modules[i]));
+	ASSERT(b->modules[i] == NULL);
+	return true;
+}
+
+/* serialize in the legacy format of one record per value */
+static void unparse_entry_v1(void **data, u_int32_t *size, CacheEntry *entry) {
+	CacheEntryAttribute **attribute;
+	char **module;
+	int i;
+	u_int32_t pos = 0;
+
+	*data = malloc(BUFSIZ);
+	for (attribute = entry->attributes; attribute != NULL && *attribute != NULL; attribute++) {
+		for (i = 0; (*attribute)->values[i] != NULL; i++) {
+			struct cache_entry_header h = {
+			    .type = 1, .key_size = strlen((*attribute)->name) + 1, .data_size = (*attribute)->length[i],
+			};
+			append_buffer(data, &pos, &h, sizeof(h));
+			append_buffer(data, &pos, (*attribute)->name, h.key_size);
+			append_buffer(data, &pos, (*attribute)->values[i], h.data_size);
+		}
+	}
+	for (module = entry->modules; module != NULL && *module != NULL; module++) {
+		struct cache_entry_header h = {
+		    .type = 2, .key_size = strlen(*module) + 1,
+		};
+		append_buffer(data, &pos, &h, sizeof(h));
+		append_buffer(data, &pos, *module, h.key_size);
+	}
+	*size = pos;
+}
+
+TEST(roundtrip) {
+	void *data = NULL;
+	u_int32_t size = 0;
+	CacheEntry entry;
+	unparse_entry(&data, &size, &entry_test);
+	ASSERT(entry_version(data, size) == CACHE_ENTRY_VERSION);
+	ASSERT(parse_entry(data, size, &entry) == 0);
+	ASSERT(!entry.view);
+	ASSERT(same_entry(&entry_test, &entry));
+	cache_free_entry(NULL, &entry);
+	free(data);
+	return true;
+}
+
+TEST(roundtrip_v1) {
+	void *data = NULL;
+	u_int32_t size = 0;
+	CacheEntry entry;
+	unparse_entry_v1(&data, &size, &entry_test);
+	ASSERT(entry_version(data, size) == 1);
+	ASSERT(parse_entry(data, size, &entry) == 0);
+	ASSERT(same_entry(&entry_test, &entry));
+	cache_free_entry(NULL, &entry);
+	free(data);
+	return true;
+}
+
+TEST(truncated) {
+	void *data = NULL;
+	u_int32_t size = 0;
+	CacheEntry entry;
+	unparse_entry(&data, &size, &entry_test);
+	ASSERT(parse_entry_view(data, size - 1, &entry) == 1);
+	ASSERT(parse_entry(data, size - 1, &entry) == -1);
+	cache_free_entry(NULL, &entry);
+	free(data);
+	return true;
+}
+
+TEST(view_roundtrip_v1) {
+	void *data = NULL;
+	u_int32_t size = 0;
+	CacheEntry view;
+	unparse_entry_v1(&data, &size, &entry_test);
+	ASSERT(parse_entry_view(data, size, &view) == 0);
+	ASSERT(view.view);
+	ASSERT(same_entry(&entry_test, &view));
+	cache_free_entry(NULL, &view);
+	free(data);
+	return true;
+}
+
+TEST(view_roundtrip) {
+	void *data = NULL;
+	u_int32_t size = 0;
+	CacheEntry view;
+	unparse_entry(&data, &size, &entry_test);
+	ASSERT(parse_entry_view(data, size, &view) == 0);
+	ASSERT(view.view);
+	ASSERT(same_entry(&entry_test, &view));
+	ASSERT(view.attributes[0]->name == cache_entry_intern("dc", 2));
+	ASSERT(view.modules[0] >= (char *)data && view.modules[0] < (char *)data + size);
+	cache_free_entry(NULL, &view);
+	free(data);
+	return true;
+}
+
+TEST(view_module_remove) {
+	void *data = NULL;
+	u_int32_t size = 0;
+	CacheEntry view;
+	unparse_entry(&data, &size, &entry_test);
+	ASSERT(parse_entry_view(data, size, &view) == 0);
+	ASSERT(cache_entry_module_remove(&view, "foo") == 0);
+	ASSERT(view.module_count == 1);
+	ASSERT(!strcmp(view.modules[0], "bar"));
+	cache_free_entry(NULL, &view);
+	free(data);
+	return true;
+}
+
+TEST(view_empty) {
+	CacheEntry empty = {}, view;
+	ASSERT(parse_entry_view(NULL, 0, &view) == 0);
+	ASSERT(same_entry(&empty, &view));
+	cache_free_entry(NULL, &view);
+	return true;
+}
+
+TEST(view_split_attribute) {
+	static CacheEntryAttribute *split[] = {
+	    &attr_dc, &attr_oc, &attr_dc, NULL,
+	};
+	CacheEntry entry = {
+	    .attributes = split, .attribute_count = 3,
+	};
+	void *data = NULL;
+	u_int32_t size = 0;
+	CacheEntry view;
+	unparse_entry_v1(&data, &size, &entry);
+	ASSERT(parse_entry_view(data, size, &view) == 1);
+	ASSERT(!view.attributes);
+	ASSERT(parse_entry(data, size, &view) == 0);
+	ASSERT(!view.view);
+	ASSERT(view.attribute_count == 2);
+	ASSERT(view.attributes[0]->value_count == 2);
+	cache_free_entry(NULL, &view);
+	free(data);
+	return true;
+}
+
+TEST(compressed) {
+	char *members[201];
+	int lengths[201], i;
+	CacheEntryAttribute attr_member = {
+	    .name = "uniqueMember", .values = members, .length = lengths, .value_count = 200,
+	};
+	CacheEntryAttribute *group_attrs[] = {
+	    &attr_dc, &attr_member, NULL,
+	};
+	CacheEntry group = {
+	    .attributes = group_attrs, .attribute_count = 2, .modules = modules, .module_count = 2,
+	};
+	void *data = NULL;
+	u_int32_t size = 0, plain_size = 0;
+	CacheEntry entry;
+
+	for (i = 0; i < 200; i++) {
+		char member[64];
+		snprintf(member, sizeof(member), "uid=user%d,cn=users,dc=univention,dc=de", i);
+		members[i] = strdup(member);
+		lengths[i] = strlen(member) + 1;
+	}
+	members[i] = NULL;
+	lengths[i] = 0;
+
+	unparse_entry(&data, &plain_size, &group);
+	free(data);
+	data = NULL;
+
+	entry_compress_threshold = 1024;
+	unparse_entry(&data, &size, &group);
+	entry_compress_threshold = 0;
+	ASSERT(size < plain_size);
+	ASSERT(entry_version(data, size) == CACHE_ENTRY_VERSION);
+	ASSERT(parse_entry_view(data, size, &entry) == 1);
+	ASSERT(parse_entry(data, size, &entry) == 0);
+	ASSERT(same_entry(&group, &entry));
+	cache_free_entry(NULL, &entry);
+	ASSERT(parse_entry(data, size - 1, &entry) == -1);
+	cache_free_entry(NULL, &entry);
+
+	free(data);
+	for (i = 0; i < 200; i++)
+		free(members[i]);
+	return true;
+}
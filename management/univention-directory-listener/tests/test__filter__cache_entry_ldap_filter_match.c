@@ -113,3 +113,240 @@ TEST(match_infix_sub) {
 	int r = cache_entry_ldap_filter_match(filters_sub, dn, &entry);
 	return r == 0;
 }
+
+static bool required(char *filter, char *expected[]) {
+	struct filter f = {.filter = filter};
+	struct filter *filters[2] = {&f, NULL};
+	char **values = cache_entry_ldap_filter_required(filters, "objectClass");
+	bool rv = true;
+	int i;
+
+	if (values == NULL || expected == NULL)
+		return values == NULL && expected == NULL;
+	for (i = 0; expected[i] != NULL; i++)
+		rv &= values[i] != NULL && !strcmp(values[i], expected[i]);
+	rv &= values[i] == NULL;
+	for (i = 0; values[i] != NULL; i++)
+		free(values[i]);
+	free(values);
+	return rv;
+}
+
+TEST(required_equal) {
+	return required("(objectClass=posixAccount)", (char *[]){"posixAccount", NULL});
+}
+
+TEST(required_and) {
+	return required("(&(uid=*)(objectClass=posixAccount)(!(objectClass=shadowAccount)))", (char *[]){"posixAccount", NULL});
+}
+
+TEST(required_or) {
+	return required("(|(objectClass=univentionGroup)(&(objectClass=posixAccount)(uid=foo)))", (char *[]){"univentionGroup", "posixAccount", NULL});
+}
+
+TEST(required_or_unconstrained) {
+	return required("(|(objectClass=univentionGroup)(cn=foo))", NULL);
+}
+
+TEST(required_wildcard) {
+	return required("(objectClass=*)", NULL) && required("(objectClass=posix*)", NULL);
+}
+
+TEST(required_not) {
+	return required("(!(objectClass=posixAccount))", NULL);
+}
+
+TEST(required_malformed) {
+	return required("objectClass=posixAccount", NULL) && required("(&objectClass=posixAccount)", NULL);
+}
+
+TEST(required_no_filter) {
+	char **values = cache_entry_ldap_filter_required(NULL, "objectClass");
+	bool rv = values != NULL && values[0] == NULL;
+	free(values);
+	return rv;
+}
+
+static char *values_cn[] = {"Administrator", NULL};
+static int length_cn[] = {14, 0};
+static char *values_uid[] = {"2001", NULL};
+static int length_uid[] = {5, 0};
+static char *values_desc[] = {"a (b) *c*", NULL};
+static int length_desc[] = {10, 0};
+static CacheEntryAttribute attr_cn = {
+    .name = "cn", .values = values_cn, .length = length_cn, .value_count = 1,
+};
+static CacheEntryAttribute attr_desc = {
+    .name = "description", .values = values_desc, .length = length_desc, .value_count = 1,
+};
+static CacheEntryAttribute attr_uid = {
+    .name = "uidNumber", .values = values_uid, .length = length_uid, .value_count = 1,
+};
+static CacheEntryAttribute *attrs_user[] = {
+    &attr_cn, &attr_desc, &attr_uid, NULL,
+};
+static CacheEntry entry_user = {
+    .attributes = attrs_user, .attribute_count = 3,
+};
+
+static bool matches(char *filter) {
+	struct filter f = {.filter = filter};
+	struct filter *filters[2] = {&f, NULL};
+	int r;
+
+	attr_cn.name = cache_entry_intern("cn", 2);
+	attr_desc.name = cache_entry_intern("description", 11);
+	attr_uid.name = cache_entry_intern("uidNumber", 9);
+	r = cache_entry_ldap_filter_match(filters, "cn=Administrator", &entry_user);
+	filter_free(f.node);
+	return r == 1;
+}
+
+TEST(leaf_equality) {
+	return matches("(cn=Administrator)") && !matches("(cn=Admin)") && !matches("(sn=Administrator)");
+}
+
+TEST(leaf_present) {
+	return matches("(cn=*)") && !matches("(sn=*)");
+}
+
+TEST(leaf_substrings) {
+	return matches("(cn=Admin*)") && matches("(cn=*strator)") && matches("(cn=*min*)") && matches("(cn=A*m*r)") &&
+	       !matches("(cn=A*x*r)") && !matches("(cn=Administrator*r)") && !matches("(cn=*admin*)");
+}
+
+TEST(leaf_ordering) {
+	return matches("(uidNumber>=2000)") && matches("(uidNumber<=10000)") && !matches("(uidNumber>=10000)") &&
+	       matches("(cn>=A)") && !matches("(cn<=A)");
+}
+
+TEST(leaf_approx) {
+	return matches("(cn~=administrator)") && !matches("(cn~=admin)");
+}
+
+TEST(leaf_escaped) {
+	return matches("(description=a \\28b\\29 \\2ac\\2a)") && matches("(description=*\\2a)") && !matches("(description=a*\\2ax)");
+}
+
+TEST(composite) {
+	return matches("(&(cn=Administrator)(!(uidNumber=0))(|(sn=*)(uidNumber>=1000)))") && !matches("(!(cn=*))");
+}
+
+TEST(malformed) {
+	return matches("cn=foo") && matches("(cn)") && matches("(&cn=foo)");
+}
+
+static char *values_oc[] = {"top", "posixAccount", NULL};
+static int length_oc[] = {4, 13, 0};
+static char *values_member[] = {"cn=Domain Users,cn=groups,dc=base", NULL};
+static int length_member[] = {34, 0};
+static char *values_title[] = {"Dr.", NULL};
+static int length_title[] = {4, 0};
+static CacheEntryAttribute attr_member = {
+    .name = "memberOf", .values = values_member, .length = length_member, .value_count = 1,
+};
+static CacheEntryAttribute attr_oc = {
+    .name = "objectClass", .values = values_oc, .length = length_oc, .value_count = 2,
+};
+static CacheEntryAttribute attr_title = {
+    .name = "title", .values = values_title, .length = length_title, .value_count = 1,
+};
+static CacheEntryAttribute *attrs_member[] = {
+    &attr_cn, &attr_member, &attr_oc, &attr_title, &attr_uid, NULL,
+};
+static CacheEntry entry_member = {
+    .attributes = attrs_member, .attribute_count = 5,
+};
+
+static bool matches_member(char *filter) {
+	struct filter f = {.filter = filter};
+	struct filter *filters[2] = {&f, NULL};
+	int r;
+
+	attr_cn.name = cache_entry_intern("cn", 2);
+	attr_member.name = cache_entry_intern("memberOf", 8);
+	attr_oc.name = cache_entry_intern("objectClass", 11);
+	attr_title.name = cache_entry_intern("title", 5);
+	attr_uid.name = cache_entry_intern("uidNumber", 9);
+	r = cache_entry_ldap_filter_match(filters, "cn=Administrator", &entry_member);
+	filter_free(f.node);
+	return r == 1;
+}
+
+TEST(attribute_case) {
+	return matches_member("(CN=Administrator)") && matches_member("(objectclass=*)") && matches_member("(UIDNUMBER>=2000)") && !matches_member("(SN=*)");
+}
+
+TEST(object_class_case) {
+	return matches_member("(objectClass=POSIXACCOUNT)") && matches_member("(objectClass=posix*)") && !matches_member("(objectClass=posix)");
+}
+
+TEST(member_of_dn) {
+	return matches_member("(memberOf=CN=domain users, cn=Groups,DC=base)") && matches_member("(memberof=cn=domain users,cn=groups,dc=base)") &&
+	       matches_member("(memberOf=*,CN=GROUPS,*)") && !matches_member("(memberOf=cn=domainusers,cn=groups,dc=base)");
+}
+
+TEST(required_case) {
+	return required("(OBJECTCLASS=posixAccount)", (char *[]){"posixAccount", NULL});
+}
+
+TEST(schema) {
+	static char *types[] = {
+	    "( 2.5.4.41 NAME 'name' EQUALITY caseIgnoreMatch SUBSTR caseIgnoreSubstringsMatch SYNTAX 1.3.6.1.4.1.1466.115.121.1.15{32768} )",
+	    "( 2.5.4.3 NAME ( 'cn' 'commonName' ) DESC 'RFC4519: common name(s) for which the entity is known by' SUP name )",
+	    "( 2.5.4.12 NAME 'title' DESC 'RFC2256: title associated with the entity' SUP name )",
+	    "( 1.3.6.1.1.1.1.0 NAME 'uidNumber' DESC 'RFC2307: An integer uniquely identifying a user' EQUALITY integerMatch ORDERING integerOrderingMatch SYNTAX 1.3.6.1.4.1.1466.115.121.1.27 SINGLE-VALUE )",
+	    NULL,
+	};
+	static int lengths[] = {0, 0, 0, 0, 0};
+	CacheEntryAttribute attr_types = {
+	    .name = cache_entry_intern("attributeTypes", 14), .values = types, .length = lengths, .value_count = 4,
+	};
+	CacheEntryAttribute *attrs[] = {&attr_types, NULL};
+	CacheEntry subschema = {
+	    .attributes = attrs, .attribute_count = 1,
+	};
+	bool rv;
+
+	filter_set_schema(&subschema);
+	rv = matches_member("(commonName=administrator)") && matches_member("(cn=*MIN*)") && matches_member("(title=dr.)") &&
+	     matches_member("(uidNumber=02001)") && !matches_member("(uidNumber<=300)") &&
+	     /* memberOf is not in this schema anymore */
+	     !matches_member("(memberOf=CN=domain users,cn=groups,dc=base)");
+	filter_set_schema(NULL);
+	return rv && matches_member("(memberOf=CN=domain users,cn=groups,dc=base)") && !matches_member("(cn=administrator)");
+}
+
+TEST(shared) {
+	struct filter_node *a = filter_compile("(&(objectClass=posixAccount)(uid=*))");
+	struct filter_node *b = filter_compile("(&(objectclass=posixAccount)(uid=*))");
+	struct filter_node *c = filter_compile("(&(objectClass=posixAccount)(uid=x))");
+	bool rv = a == b && a != c;
+
+	filter_free(a);
+	filter_free(c);
+	c = filter_compile("(&(objectClass=posixAccount)(uid=*))");
+	rv &= b == c;
+	filter_free(b);
+	filter_free(c);
+	return rv;
+}
+
+TEST(memo) {
+	struct filter f1 = {.filter = "(title=Dr.)"}, f2 = {.filter = "(|(cn=x)(title=Dr.))"};
+	struct filter *filters1[2] = {&f1, NULL}, *filters2[2] = {&f2, NULL};
+	bool rv;
+
+	attr_title.name = cache_entry_intern("title", 5);
+	filter_memo_begin(&entry_member);
+	rv = cache_entry_ldap_filter_match(filters1, "cn=Administrator", &entry_member);
+	/* the shared leaf is not evaluated again */
+	values_title[0] = "Prof.";
+	rv &= cache_entry_ldap_filter_match(filters2, "cn=Administrator", &entry_member);
+	filter_memo_end();
+	rv &= !cache_entry_ldap_filter_match(filters2, "cn=Administrator", &entry_member);
+	values_title[0] = "Dr.";
+	filter_free(f1.node);
+	filter_free(f2.node);
+	return rv;
+}
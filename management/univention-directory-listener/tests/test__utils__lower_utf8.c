@@ -20,6 +20,8 @@ static inline bool _test(const char *input, const char *expected) {
 TEST(same, "cn=foo,dc=univention,dc=de", "cn=foo,dc=univention,dc=de");
 TEST(mixed, "cn=Foo,dc=univention,dc=de", "cn=foo,dc=univention,dc=de");
 TEST(german, "cn=FÄÖÜß,dc=univention,dc=de", "cn=fäöüß,dc=univention,dc=de");
+TEST(long_ascii, "CN=ABCDEFGHIJKLMNOPQRSTUVWXYZ,DC=Univention,DC=DE", "cn=abcdefghijklmnopqrstuvwxyz,dc=univention,dc=de");
+TEST(late_utf8, "CN=ABCDEFGHIJKLMNOPQRSTUVWXYZ,DC=ÜNIVENTION,DC=DE", "cn=abcdefghijklmnopqrstuvwxyz,dc=ünivention,dc=de");
 TEST(greek, "cn=FΩ,dc=univention,dc=de", "cn=fω,dc=univention,dc=de");
 TEST(turkish, "cn=âÇçĞğİiIıîŞş,dc=univention,dc=de", "cn=âççğğiiiıîşş,dc=univention,dc=de");
 /* not: "cn=âççğği̇iııîşş,dc=univention,dc=de"); */
@@ -40,6 +40,12 @@ TEST(germansz, "cn=fuß,dc=univention,dc=de", "cn=fuss,dc=univention,dc=de", fal
 
 TEST(turkishi, "cn=iIıİ,dc=univention,dc=de", "cn=Iiıi,dc=univention,dc=de", true);
 
+TEST(umlaut_length, "cn=föö,dc=univention,dc=de", "cn=fö,dc=univention,dc=de", false);
+
+TEST(prefix, "cn=foo,dc=univention,dc=de", "cn=foo,dc=univention", false);
+
+TEST(kelvin, "cn=\u212A,dc=univention,dc=de", "cn=k,dc=univention,dc=de", true);
+
 TEST(greek, "cn=ωΩ,dc=univention,dc=de", "cn=Ωω,dc=univention,dc=de", true);
 
 #if 0
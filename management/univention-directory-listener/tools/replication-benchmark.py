@@ -0,0 +1,965 @@
+#!/usr/bin/python3
+#
+# Univention Directory Listener
+#
+# Like what you see? Join us!
+# https://www.univention.com/about-us/careers/vacancies/
+#
+# Copyright 2004-2025 Univention GmbH
+#
+# https://www.univention.de/
+#
+# All rights reserved.
+#
+# The source code of this program is made available
+# under the terms of the GNU Affero General Public License version 3
+# (GNU AGPL V3) as published by the Free Software Foundation.
+#
+# Binary versions of this program provided by Univention to you as
+# well as other copyrighted, protected or trademarked materials like
+# Logos, graphics, fonts, specific documentations and configurations,
+# cryptographic keys etc. are subject to a license agreement between
+# you and Univention and not subject to the GNU AGPL V3.
+#
+# In the case you use this program under the terms of the GNU AGPL V3,
+# the program is provided in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+# GNU Affero General Public License for more details.
+#
+# You should have received a copy of the GNU Affero General Public
+# License with the Debian GNU/Linux or Univention distribution in file
+# /usr/share/common-licenses/AGPL-3; if not, see
+# <https://www.gnu.org/licenses/>.
+
+"""
+Measure the throughput and latency of the listener without a UCS domain.
+
+A synthetic stream of transactions (adds, modifies, moves as "r" followed
+by "a", and deletes) is played through a fake notifier speaking protocol
+2, 3 or 4 on port 6669. The entries are served by a minimal LDAP server
+holding the directory in memory, seeded with synthetic users, hosts and
+groups or from an LDIF file. For protocol 3, it also serves the
+transactions below cn=translog.
+
+The real listener is run against both with the sample modules of this
+script and any given module directories: first with -i to initialize the
+modules, then to process the stream. A transaction counts as done once
+the listener has committed it to the notifier_id file of its cache, which
+gives the latency from publishing it.
+
+Port 6669 must be free and no notifier socket may exist, so run this on a
+test system without a notifier. As root, the cache is handed to the
+listener user, which the listener drops its privileges to.
+"""
+
+import argparse
+import base64
+import json
+import os
+import pwd
+import random
+import re
+import shutil
+import signal
+import socket
+import socketserver
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+
+NOTIFIER_PORT = 6669
+NOTIFIER_SOCKET = '/run/univention-directory-notifier.socket'
+LDAP_CONTROL_PAGEDRESULTS = b'1.2.840.113556.1.4.319'
+OPERATIONAL = {
+    'entryuuid', 'entrycsn', 'createtimestamp', 'modifytimestamp', 'creatorsname', 'modifiersname',
+    'entrydn', 'hassubordinates', 'structuralobjectclass', 'subschemasubentry',
+}
+
+MODULES = {
+    'users': '''
+name = 'bench_users'
+description = 'replication benchmark: users'
+filter = '(&(objectClass=posixAccount)(!(uid=*$)))'
+attributes = ['uid', 'userPassword', 'description', 'krb5Key']
+
+
+def handler(dn, new, old):
+    new.get('uid'), old.get('uid')
+''',
+    'groups': '''
+name = 'bench_groups'
+description = 'replication benchmark: groups'
+filter = '(objectClass=univentionGroup)'
+attributes = ['uniqueMember']
+
+
+def handler(dn, new, old):
+    added = set(new.get('uniqueMember', [])) - set(old.get('uniqueMember', []))
+    removed = set(old.get('uniqueMember', [])) - set(new.get('uniqueMember', []))
+    len(added), len(removed)
+''',
+    'hosts': '''
+name = 'bench_hosts'
+description = 'replication benchmark: hosts'
+filter = '(objectClass=univentionHost)'
+modrdn = '1'
+
+
+def handler(dn, new, old, command):
+    new.get('aRecord')
+''',
+    'all': '''
+name = 'bench_all'
+description = 'replication benchmark: all objects'
+filter = '(objectClass=*)'
+
+
+def handler(dn, new, old):
+    pass
+''',
+    'slow': '''
+import time
+
+name = 'bench_slow'
+description = 'replication benchmark: %(slow)g ms per user'
+filter = '(objectClass=posixAccount)'
+
+
+def handler(dn, new, old):
+    time.sleep(%(slow)g / 1000.0)
+''',
+}
+
+
+# BER encoding of the LDAP messages, see RFC 4511
+
+def ber_length(length):
+    if length < 0x80:
+        return bytes((length,))
+    raw = length.to_bytes((length.bit_length() + 7) // 8, 'big')
+    return bytes((0x80 | len(raw),)) + raw
+
+
+def ber(tag, value):
+    return bytes((tag,)) + ber_length(len(value)) + value
+
+
+def ber_int(value, tag=0x02):
+    return ber(tag, value.to_bytes(max(1, (value.bit_length() + 8) // 8), 'big', signed=True))
+
+
+def ber_str(value, tag=0x04):
+    return ber(tag, value if isinstance(value, bytes) else value.encode('utf-8'))
+
+
+def ber_seq(items, tag=0x30):
+    return ber(tag, b''.join(items))
+
+
+def ber_decode(data, pos=0):
+    """Return tag, value and the position after the element at pos."""
+    tag = data[pos]
+    length = data[pos + 1]
+    pos += 2
+    if length & 0x80:
+        n = length & 0x7f
+        length = int.from_bytes(data[pos:pos + n], 'big')
+        pos += n
+    if pos + length > len(data):
+        raise IndexError('truncated')
+    return tag, data[pos:pos + length], pos + length
+
+
+def ber_items(data):
+    pos = 0
+    while pos < len(data):
+        tag, value, pos = ber_decode(data, pos)
+        yield tag, value
+
+
+# the directory
+
+def normalize_dn(dn):
+    return ','.join(rdn.strip().lower() for rdn in re.split(r'(?<!\\),', dn))
+
+
+def parent_dn(dn):
+    parts = re.split(r'(?<!\\),', dn, 1)
+    return parts[1] if len(parts) > 1 else ''
+
+
+class Directory:
+    """The entries by normalized DN, each as DN and dict of value lists."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.entries = {}
+        self.children = {}  # normalized DNs by the one of their parent
+        self.csn = 0
+
+    def stamp(self, attrs):
+        self.csn += 1
+        now = time.strftime('%Y%m%d%H%M%SZ', time.gmtime()).encode()
+        attrs['entryCSN'] = [b'%s.%06d#000000#000#000000' % (now[:-1], self.csn % 1000000)]
+        attrs['modifyTimestamp'] = [now]
+        attrs.setdefault('createTimestamp', [now])
+        attrs.setdefault('creatorsName', [b'cn=admin'])
+        attrs['modifiersName'] = [b'cn=admin']
+        attrs.setdefault('entryUUID', [b'%08x-0f3e-103c-8f4a-%012d' % (self.csn, self.csn)])
+
+    def add(self, dn, attrs, stamp=True):
+        if stamp:
+            self.stamp(attrs)
+        key = normalize_dn(dn)
+        self.entries[key] = (dn, attrs)
+        self.children.setdefault(parent_dn(key), {})[key] = None
+
+    def get(self, dn):
+        return self.entries.get(normalize_dn(dn))
+
+    def modify(self, dn, changes):
+        attrs = self.entries[normalize_dn(dn)][1]
+        for name, values in changes.items():
+            if values:
+                attrs[name] = values
+            else:
+                attrs.pop(name, None)
+        self.stamp(attrs)
+
+    def move(self, dn, new_dn):
+        _, attrs = self.entries[normalize_dn(dn)]
+        self.delete(dn)
+        rdn_attr, rdn_value = re.split(r'(?<!\\),', new_dn, 1)[0].split('=', 1)
+        attrs[rdn_attr] = [rdn_value.encode()]
+        self.add(new_dn, attrs)
+
+    def delete(self, dn):
+        key = normalize_dn(dn)
+        del self.entries[key]
+        del self.children[parent_dn(key)][key]
+
+    def search(self, base, scope, flt):
+        base = normalize_dn(base)
+        if scope == 0:
+            keys = [base]
+        elif scope == 1 and base == 'cn=translog':
+            # the listener asks for (|(reqSession=ID)...), look them up by RDN
+            keys = [normalize_dn('%s=%s,%s' % (name.decode(), value.decode(), base)) for name, value in equalities(flt)]
+        elif scope == 1:
+            keys = list(self.children.get(base, ()))
+        else:
+            keys = sorted((key for key in self.entries if key == base or key.endswith(',' + base) or not base), key=lambda key: key[::-1])
+        candidates = [self.entries[key] for key in keys if key in self.entries]
+        return [entry for entry in candidates if match(flt, entry[1])]
+
+    def exists(self, dn):
+        return normalize_dn(dn) in self.entries
+
+
+def equalities(flt):
+    """Yield attribute and value of the filter (a=v) or (|(a=v)...)."""
+    tag, value = flt
+    if tag == 0xa3:
+        (_, name), (_, assertion) = ber_items(value)
+        yield name, assertion
+    elif tag == 0xa1:
+        for child in ber_items(value):
+            yield from equalities(child)
+
+
+def lookup(attrs, name):
+    name = name.lower()
+    for key, values in attrs.items():
+        if key.lower() == name:
+            return values
+    return []
+
+
+def match(flt, attrs):
+    """Match the BER encoded filter against the attributes."""
+    tag, value = flt
+    if tag == 0xa0:
+        return all(match(child, attrs) for child in ber_items(value))
+    if tag == 0xa1:
+        return any(match(child, attrs) for child in ber_items(value))
+    if tag == 0xa2:
+        return not match(next(ber_items(value)), attrs)
+    if tag == 0x87:
+        return bool(lookup(attrs, value.decode())) or value.lower() == b'objectclass'
+    if tag in (0xa3, 0xa5, 0xa6, 0xa8):
+        (_, name), (_, assertion) = ber_items(value)
+        values = [v.lower() for v in lookup(attrs, name.decode())]
+        assertion = assertion.lower()
+        if tag in (0xa3, 0xa8):
+            return assertion in values
+        if tag == 0xa5:
+            return any(compare(v, assertion) >= 0 for v in values)
+        return any(compare(v, assertion) <= 0 for v in values)
+    if tag == 0xa4:
+        (_, name), (_, substrings) = ber_items(value)
+        parts = [(t, s.lower()) for t, s in ber_items(substrings)]
+        return any(match_substrings(v.lower(), parts) for v in lookup(attrs, name.decode()))
+    return False
+
+
+def compare(value, assertion):
+    try:
+        a, b = int(value), int(assertion)
+    except ValueError:
+        a, b = value, assertion
+    return (a > b) - (a < b)
+
+
+def match_substrings(value, parts):
+    pos = 0
+    for tag, part in parts:
+        if tag == 0x80:
+            if not value.startswith(part):
+                return False
+            pos = len(part)
+        elif tag == 0x81:
+            pos = value.find(part, pos)
+            if pos < 0:
+                return False
+            pos += len(part)
+        elif tag == 0x82:
+            return len(value) - len(part) >= pos and value.endswith(part)
+    return True
+
+
+def read_ldif(filename):
+    """Yield DN and attributes of the records of an LDIF file."""
+    with open(filename, 'rb') as fd:
+        lines = []
+        for line in fd.read().replace(b'\r\n', b'\n').split(b'\n'):
+            if line.startswith(b' ') and lines:
+                lines[-1] += line[1:]
+            else:
+                lines.append(line)
+    dn, attrs = None, {}
+    for line in lines + [b'']:
+        if not line.strip():
+            if dn is not None:
+                yield dn, attrs
+            dn, attrs = None, {}
+            continue
+        if line.startswith(b'#'):
+            continue
+        name, _, value = line.partition(b':')
+        if value.startswith(b':'):
+            value = base64.b64decode(value[1:].strip())
+        else:
+            value = value.strip()
+        if name.lower() == b'dn':
+            dn = value.decode('utf-8')
+        elif name.lower() != b'changetype':
+            attrs.setdefault(name.decode(), []).append(value)
+
+
+# the synthetic directory and transactions
+
+class Workload:
+    """Generates the seed entries and a random stream of transactions."""
+
+    def __init__(self, directory, options):
+        self.directory = directory
+        self.options = options
+        self.base = options.base
+        self.random = random.Random(options.seed)
+        self.users = []
+        self.hosts = []
+        self.groups = []
+        self.serial = 0
+        self.mix = []
+        for item in options.mix.split(','):
+            kind, _, weight = item.partition('=')
+            self.mix += [kind] * int(weight or 1)
+
+    def seed(self):
+        d = self.directory
+        d.add(self.base, {
+            'objectClass': [b'top', b'domain', b'univentionBase', b'univentionObject'],
+            'dc': [self.base.split(',')[0].split('=', 1)[1].encode()],
+            'univentionObjectType': [b'container/dc'],
+        })
+        d.add('cn=Subschema', {'objectClass': [b'top', b'subentry', b'subschema'], 'cn': [b'Subschema']}, stamp=False)
+        d.add('cn=translog', {'objectClass': [b'top', b'organizationalRole'], 'cn': [b'translog']}, stamp=False)
+        if self.options.ldif:
+            for dn, attrs in read_ldif(self.options.ldif):
+                if d.exists(dn) and normalize_dn(dn) == normalize_dn(self.base):
+                    continue
+                d.add(dn, attrs, stamp='entryUUID' not in attrs)
+                classes = {v.lower() for v in lookup(attrs, 'objectClass')}
+                if b'univentionhost' in classes:
+                    self.hosts.append(dn)
+                elif b'posixaccount' in classes:
+                    self.users.append(dn)
+                elif b'univentiongroup' in classes or b'posixgroup' in classes:
+                    self.groups.append(dn)
+            return
+        for container in ('users', 'groups', 'computers', 'people'):
+            d.add('cn=%s,%s' % (container, self.base), {
+                'objectClass': [b'top', b'organizationalRole', b'univentionObject'],
+                'cn': [container.encode()],
+                'univentionObjectType': [b'container/cn'],
+            })
+        for _ in range(self.options.users):
+            self.add_user()
+        for _ in range(self.options.hosts):
+            self.add_host()
+        # the first group has all users as members, like Domain Users
+        for i in range(self.options.groups):
+            members = self.users if i == 0 else self.random.sample(self.users, min(len(self.users), self.options.members))
+            self.add_group(members)
+
+    def user(self, n):
+        password = b'{crypt}$6$%08d$%s' % (n, base64.b64encode(os.urandom(48)))
+        return {
+            'objectClass': [b'top', b'person', b'univentionPWHistory', b'posixAccount', b'shadowAccount', b'sambaSamAccount', b'univentionMail', b'krb5Principal', b'krb5KDCEntry', b'univentionPerson', b'inetOrgPerson', b'organizationalPerson', b'univentionObject'],
+            'uid': [b'user%d' % n], 'cn': [b'Test User%d' % n], 'sn': [b'User%d' % n], 'givenName': [b'Test'],
+            'displayName': [b'Test User%d' % n], 'uidNumber': [b'%d' % (2000 + n)], 'gidNumber': [b'5001'],
+            'homeDirectory': [b'/home/user%d' % n], 'loginShell': [b'/bin/bash'],
+            'mailPrimaryAddress': [b'user%d@example.com' % n], 'userPassword': [password],
+            'krb5PrincipalName': [b'user%d@EXAMPLE.COM' % n],
+            'krb5Key': [os.urandom(80) for _ in range(6)], 'krb5KDCFlags': [b'126'],
+            'sambaSID': [b'S-1-5-21-1234567890-1234567890-1234567890-%d' % (1000 + n)],
+            'sambaNTPassword': [os.urandom(16).hex().upper().encode()], 'sambaAcctFlags': [b'[U          ]'],
+            'univentionObjectType': [b'users/user'],
+        }
+
+    def add_user(self):
+        self.serial += 1
+        dn = 'uid=user%d,cn=users,%s' % (self.serial, self.base)
+        self.directory.add(dn, self.user(self.serial))
+        self.users.append(dn)
+        return dn
+
+    def add_host(self):
+        self.serial += 1
+        n = self.serial
+        dn = 'cn=host%d,cn=computers,%s' % (n, self.base)
+        self.directory.add(dn, {
+            'objectClass': [b'top', b'person', b'univentionHost', b'univentionMemberServer', b'posixAccount', b'sambaSamAccount', b'krb5Principal', b'krb5KDCEntry', b'univentionObject'],
+            'cn': [b'host%d' % n], 'uid': [b'host%d$' % n], 'uidNumber': [b'%d' % (100000 + n)], 'gidNumber': [b'5007'],
+            'homeDirectory': [b'/dev/null'], 'aRecord': [b'10.%d.%d.%d' % (n >> 16 & 255, n >> 8 & 255, n & 255)],
+            'univentionService': [b'Service %d' % i for i in range(10)],
+            'krb5Key': [os.urandom(80) for _ in range(6)],
+            'univentionObjectType': [b'computers/memberserver'],
+        })
+        self.hosts.append(dn)
+        return dn
+
+    def add_group(self, members):
+        self.serial += 1
+        n = self.serial
+        dn = 'cn=group%d,cn=groups,%s' % (n, self.base)
+        self.directory.add(dn, {
+            'objectClass': [b'top', b'posixGroup', b'univentionGroup', b'sambaGroupMapping', b'univentionObject'],
+            'cn': [b'group%d' % n], 'gidNumber': [b'%d' % (5000 + n)],
+            'sambaSID': [b'S-1-5-21-1234567890-1234567890-1234567890-%d' % (2000 + n)],
+            'univentionObjectType': [b'groups/group'],
+            'uniqueMember': [m.encode() for m in members],
+            'memberUid': [m.split(',')[0].split('=', 1)[1].encode() for m in members],
+        })
+        self.groups.append(dn)
+        return dn
+
+    def next(self):
+        """Change the directory; return the transactions as (command, DN)."""
+        for _ in range(100):
+            kind = self.random.choice(self.mix)
+            changes = getattr(self, 'op_' + kind)()
+            if changes:
+                return kind, changes
+        raise SystemExit('no objects left for %s' % (self.options.mix,))
+
+    def op_add(self):
+        return [('a', self.add_user() if self.random.random() < 0.9 or not self.groups else self.add_group([]))]
+
+    def op_modify(self):
+        objects = self.users + self.hosts
+        if not objects:
+            return None
+        dn = self.random.choice(objects)
+        if self.random.random() < 0.2:
+            changes = {'userPassword': [b'{crypt}$6$%s' % base64.b64encode(os.urandom(48))], 'krb5Key': [os.urandom(80) for _ in range(6)]}
+        else:
+            changes = {'description': [b'changed %d' % self.random.randrange(1 << 30)]}
+        self.directory.modify(dn, changes)
+        return [('m', dn)]
+
+    def op_member(self):
+        if not self.groups or not self.users:
+            return None
+        dn = self.random.choice(self.groups)
+        attrs = self.directory.get(dn)[1]
+        members = list(attrs.get('uniqueMember', []))
+        user = self.random.choice(self.users).encode()
+        if user in members:
+            members.remove(user)
+        else:
+            members.append(user)
+        self.directory.modify(dn, {'uniqueMember': members, 'memberUid': [m.split(b',')[0].split(b'=', 1)[1] for m in members]})
+        return [('m', dn)]
+
+    def op_move(self):
+        objects = self.users + self.hosts
+        if not objects:
+            return None
+        dn = self.random.choice(objects)
+        rdn, parent = re.split(r'(?<!\\),', dn, 1)
+        container = 'cn=people,%s' % self.base if not parent.lower().startswith('cn=people,') else 'cn=users,%s' % self.base
+        if not self.directory.exists(container):
+            container = self.base
+        new_dn = '%s,%s' % (rdn, container)
+        if self.directory.exists(new_dn):
+            return None
+        self.directory.move(dn, new_dn)
+        for objects in (self.users, self.hosts):
+            if dn in objects:
+                objects[objects.index(dn)] = new_dn
+        return [('r', dn), ('a', new_dn)]
+
+    def op_delete(self):
+        objects = self.users + self.hosts
+        if not objects:
+            return None
+        dn = self.random.choice(objects)
+        self.directory.delete(dn)
+        for objects in (self.users, self.hosts):
+            if dn in objects:
+                objects.remove(dn)
+        return [('d', dn)]
+
+
+# the fake notifier
+
+class Transactions:
+    """The published transactions; notifies the connections waiting for them."""
+
+    def __init__(self):
+        self.cond = threading.Condition()
+        self.entries = [None]  # by ID
+        self.published = [0.0]
+
+    @property
+    def last_id(self):
+        return len(self.entries) - 1
+
+    def publish(self, directory, changes):
+        with self.cond:
+            for command, dn in changes:
+                id = len(self.entries)
+                self.entries.append((command, dn))
+                self.published.append(time.monotonic())
+                directory.add('reqSession=%d,cn=translog' % (id,), {
+                    'objectClass': [b'auditObject'],
+                    'reqSession': [b'%d' % (id,)], 'reqType': [command.encode()], 'reqDN': [dn.encode()],
+                }, stamp=False)
+            self.cond.notify_all()
+
+
+class NotifierHandler(socketserver.BaseRequestHandler):
+
+    def setup(self):
+        self.transactions = self.server.transactions
+        self.protocol = None
+        self.queue = []  # (msgid, command, args), answered in order
+        self.closed = False
+
+    def handle(self):
+        sender = threading.Thread(target=self.send_loop, daemon=True)
+        sender.start()
+        buf = b''
+        try:
+            while True:
+                data = self.request.recv(65536)
+                if not data:
+                    break
+                buf += data
+                while b'\n\n' in buf:
+                    block, buf = buf.split(b'\n\n', 1)
+                    self.receive(block.decode('utf-8', 'replace').split('\n'))
+        except OSError:
+            pass
+        finally:
+            with self.transactions.cond:
+                self.closed = True
+                self.transactions.cond.notify_all()
+            sender.join()
+
+    def receive(self, lines):
+        if self.protocol is None:
+            headers = dict(line.split(': ', 1) for line in lines if ': ' in line)
+            self.protocol = min(int(headers.get('Version', 2)), self.server.protocol)
+            capabilities = 'GET_DN_RANGE' if self.protocol >= 4 else ''
+            self.request.sendall(('Version: %d\nCapabilities: %s\n\n' % (self.protocol, capabilities)).encode())
+            return
+        msgid = int(lines[0].split(': ', 1)[1])
+        command, _, args = lines[1].partition(' ')
+        with self.transactions.cond:
+            self.queue.append((msgid, command, args))
+            self.transactions.cond.notify_all()
+
+    def ready(self):
+        if not self.queue:
+            return False
+        _, command, args = self.queue[0]
+        if command in ('GET_DN', 'WAIT_ID', 'GET_DN_RANGE'):
+            return int(args.split()[0]) <= self.transactions.last_id
+        return True
+
+    def reply(self, msgid, command, args):
+        t = self.transactions
+        if command == 'GET_ID':
+            result = '%d' % (t.last_id,)
+        elif command == 'GET_SCHEMA_ID':
+            result = '0'
+        elif command == 'ALIVE':
+            result = 'OKAY'
+        elif command == 'WAIT_ID':
+            result = '%d' % (t.last_id,)
+        elif command == 'GET_DN':
+            id = int(args)
+            result = '%d %s %s' % (id, t.entries[id][1], t.entries[id][0])
+        elif command == 'GET_DN_RANGE':
+            first, count = (int(arg) for arg in args.split())
+            result = '\n'.join('%d %s %s' % (id, t.entries[id][1], t.entries[id][0]) for id in range(first, min(first + count, t.last_id + 1)))
+        else:
+            result = ''
+        return ('MSGID: %d\n%s\n\n' % (msgid, result)).encode()
+
+    def send_loop(self):
+        t = self.transactions
+        while True:
+            with t.cond:
+                t.cond.wait_for(lambda: self.closed or self.ready())
+                if self.closed:
+                    return
+                replies = []
+                while self.ready():
+                    replies.append(self.reply(*self.queue.pop(0)))
+            try:
+                self.request.sendall(b''.join(replies))
+            except OSError:
+                return
+
+
+# the LDAP server
+
+class LDAPHandler(socketserver.BaseRequestHandler):
+
+    def handle(self):
+        buf = b''
+        try:
+            while True:
+                data = self.request.recv(65536)
+                if not data:
+                    return
+                buf += data
+                while buf:
+                    try:
+                        _, message, end = ber_decode(buf)
+                    except IndexError:
+                        break
+                    buf = buf[end:]
+                    if not self.receive(message):
+                        return
+        except OSError:
+            pass
+
+    def receive(self, message):
+        items = list(ber_items(message))
+        msgid = int.from_bytes(items[0][1], 'big', signed=True)
+        tag, op = items[1]
+        controls = items[2][1] if len(items) > 2 and items[2][0] == 0xa0 else b''
+        if tag == 0x60:  # bind
+            self.send(msgid, ber_seq([ber_int(0, 0x0a), ber_str(''), ber_str('')], 0x61))
+        elif tag == 0x42:  # unbind
+            return False
+        elif tag == 0x63:
+            self.search(msgid, op, controls)
+        elif tag == 0x77:  # extended, e.g. StartTLS
+            self.send(msgid, ber_seq([ber_int(53, 0x0a), ber_str(''), ber_str('not supported')], 0x78))
+        elif tag in (0x66, 0x68, 0x6a, 0x6c, 0x6e):  # modify, add, delete, modrdn, compare
+            self.send(msgid, ber_seq([ber_int(53, 0x0a), ber_str(''), ber_str('read-only')], tag + 1 if tag != 0x6a else 0x6b))
+        return True
+
+    def send(self, msgid, op, controls=b''):
+        self.request.sendall(ber_seq([ber_int(msgid), op, controls]))
+
+    def search(self, msgid, op, controls):
+        items = list(ber_items(op))
+        base = items[0][1].decode('utf-8')
+        scope = int.from_bytes(items[1][1], 'big')
+        size_limit = int.from_bytes(items[3][1], 'big')
+        types_only = items[5][1] != b'\x00'
+        flt = items[6]
+        wanted = [name.decode().lower() for _, name in ber_items(items[7][1])]
+        page = None
+        for _, control in ber_items(controls):
+            fields = list(ber_items(control))
+            if fields[0][1] == LDAP_CONTROL_PAGEDRESULTS:
+                (_, size), (_, cookie) = ber_items(ber_decode(fields[-1][1])[1])
+                page = (int.from_bytes(size, 'big'), int(cookie or b'0'))
+
+        directory = self.server.directory
+        with directory.lock:
+            if scope == 0 and base and not directory.exists(base):
+                result = 32  # noSuchObject
+                entries = []
+            else:
+                result = 0
+                entries = directory.search(base, scope, flt)
+            if size_limit and len(entries) > size_limit:
+                entries = entries[:size_limit]
+                result = 4  # sizeLimitExceeded
+            done_controls = b''
+            if page is not None and page[0] > 0:
+                size, offset = page
+                cookie = b'%d' % (offset + size,) if offset + size < len(entries) else b''
+                entries = entries[offset:offset + size]
+                value = ber_seq([ber_int(len(entries)), ber_str(cookie)])
+                done_controls = ber_seq([ber_seq([ber_str(LDAP_CONTROL_PAGEDRESULTS), ber_str(value)])], 0xa0)
+            replies = [self.entry(dn, attrs, wanted, types_only) for dn, attrs in entries]
+
+        replies = [ber_seq([ber_int(msgid), reply]) for reply in replies]
+        replies.append(ber_seq([ber_int(msgid), ber_seq([ber_int(result, 0x0a), ber_str(''), ber_str('')], 0x65), done_controls]))
+        self.request.sendall(b''.join(replies))
+
+    def entry(self, dn, attrs, wanted, types_only):
+        user = not wanted or '*' in wanted
+        operational = '+' in wanted
+        items = []
+        for name, values in attrs.items():
+            lower = name.lower()
+            if not (lower in wanted or (operational if lower in OPERATIONAL else user)):
+                continue
+            items.append(ber_seq([ber_str(name), ber_seq([] if types_only else [ber_str(v) for v in values], 0x31)]))
+        return ber_seq([ber_str(dn), ber_seq(items)], 0x64)
+
+
+class Server(socketserver.ThreadingTCPServer):
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def get_request(self):
+        request, address = super().get_request()
+        request.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        return request, address
+
+
+# running the listener
+
+def percentile(values, p):
+    if not values:
+        return float('nan')
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * p / 100.0))]
+
+
+def read_id(filename):
+    try:
+        with open(filename) as fd:
+            return int(fd.read() or 0)
+    except (OSError, ValueError):
+        return 0
+
+
+def write_modules(options, directory):
+    os.mkdir(directory)
+    for name in options.sample_modules.split(','):
+        if not name:
+            continue
+        if name not in MODULES:
+            raise SystemExit('unknown sample module %r, choose from %s' % (name, ', '.join(sorted(MODULES))))
+        with open(os.path.join(directory, 'bench_%s.py' % (name,)), 'w') as fd:
+            fd.write(MODULES[name] % {'slow': options.slow})
+
+
+def listener_command(options, workdir, ldap_port, init):
+    cmd = [
+        options.listener, '-F', '-d', str(options.debug),
+        '-b', options.base,
+        '-m', os.path.join(workdir, 'modules'),
+        '-c', os.path.join(workdir, 'cache'),
+        '-H', 'ldap://127.0.0.1:%d' % (ldap_port,), '-h', '127.0.0.1',
+        '-x', '-D', 'cn=admin,%s' % (options.base,), '-w', 'benchmark',
+    ]
+    for module_dir in options.modules:
+        cmd += ['-m', module_dir]
+    if init:
+        cmd.append('-i')
+    return cmd + options.listener_args
+
+
+def run(options):
+    if os.path.exists(NOTIFIER_SOCKET):
+        raise SystemExit('%s exists; stop the notifier first' % (NOTIFIER_SOCKET,))
+
+    directory = Directory()
+    workload = Workload(directory, options)
+    workload.seed()
+    transactions = Transactions()
+
+    notifier = Server(('127.0.0.1', NOTIFIER_PORT), NotifierHandler)
+    notifier.transactions = transactions
+    notifier.protocol = options.protocol
+    ldap = Server(('127.0.0.1', options.ldap_port), LDAPHandler)
+    ldap.directory = directory
+    for server in (notifier, ldap):
+        threading.Thread(target=server.serve_forever, daemon=True).start()
+    ldap_port = ldap.server_address[1]
+
+    workdir = tempfile.mkdtemp(prefix='replication-benchmark.')
+    try:
+        write_modules(options, os.path.join(workdir, 'modules'))
+        os.mkdir(os.path.join(workdir, 'cache'))
+        if os.geteuid() == 0:
+            try:
+                user = pwd.getpwnam('listener')
+            except KeyError:
+                pass
+            else:
+                os.chown(os.path.join(workdir, 'cache'), user.pw_uid, user.pw_gid)
+        log = open(os.path.join(options.log or workdir, 'listener.log'), 'w')
+        report = {'objects': len(directory.entries), 'protocol': options.protocol}
+
+        if options.serve_only:
+            print('serving %d objects; run the listener like this:' % (report['objects'],))
+            print(' '.join(listener_command(options, workdir, ldap_port, True)))
+            print(' '.join(listener_command(options, workdir, ldap_port, False)))
+            input('press enter to publish %d transactions ' % (options.transactions,))
+        else:
+            start = time.monotonic()
+            rv = subprocess.call(listener_command(options, workdir, ldap_port, True), stdout=log, stderr=log)
+            if rv != 0:
+                raise SystemExit('initializing the listener failed (%d), see %s' % (rv, log.name))
+            report['init_seconds'] = time.monotonic() - start
+            proc = subprocess.Popen(listener_command(options, workdir, ldap_port, False), stdout=log, stderr=log)
+
+        id_file = os.path.join(workdir, 'cache', 'notifier_id')
+        done = [0.0]
+        kinds = [None]
+
+        def publish():
+            interval = 1.0 / options.rate if options.rate else 0
+            start = time.monotonic()
+            count = 0
+            while count < options.transactions:
+                with directory.lock:
+                    kind, changes = workload.next()
+                    transactions.publish(directory, changes)
+                kinds.extend([kind] * len(changes))
+                done.extend([0.0] * len(changes))
+                count += len(changes)
+                if interval:
+                    delay = start + count * interval - time.monotonic()
+                    if delay > 0:
+                        time.sleep(delay)
+
+        publisher = threading.Thread(target=publish, daemon=True)
+        publisher.start()
+
+        # the transactions are committed in order, so the ID tells all done
+        committed = 0
+        deadline = time.monotonic() + options.timeout
+        while publisher.is_alive() or committed < transactions.last_id:
+            if time.monotonic() > deadline:
+                print('timeout after %d of %d transactions' % (committed, transactions.last_id), file=sys.stderr)
+                break
+            if not options.serve_only and proc.poll() is not None:
+                print('listener exited with %d, see %s' % (proc.returncode, log.name), file=sys.stderr)
+                break
+            current = min(read_id(id_file), len(done) - 1)
+            if current > committed:
+                now = time.monotonic()
+                for id in range(committed + 1, current + 1):
+                    done[id] = now
+                committed = current
+            time.sleep(options.poll / 1000.0)
+
+        if not options.serve_only and proc.poll() is None:
+            proc.send_signal(signal.SIGTERM)
+            proc.wait()
+
+        latencies = {}
+        for id in range(1, committed + 1):
+            latency = (done[id] - transactions.published[id]) * 1000.0
+            latencies.setdefault('all', []).append(latency)
+            latencies.setdefault(kinds[id], []).append(latency)
+        elapsed = (done[committed] - transactions.published[1]) if committed else 0.0
+        report.update({
+            'transactions': committed,
+            'seconds': elapsed,
+            'tps': committed / elapsed if elapsed else 0.0,
+            'latency_ms': {
+                kind: {
+                    'count': len(values),
+                    'p50': percentile(values, 50), 'p90': percentile(values, 90),
+                    'p99': percentile(values, 99), 'p99.9': percentile(values, 99.9),
+                    'max': max(values),
+                } for kind, values in sorted(latencies.items())
+            },
+        })
+        if options.json:
+            json.dump(report, sys.stdout, indent=2)
+            print()
+        else:
+            if 'init_seconds' in report:
+                print('initialized %(objects)d objects in %(init_seconds).2f s' % report)
+            print('%(transactions)d transactions in %(seconds).2f s: %(tps).1f transactions/s (protocol %(protocol)d)' % report)
+            print('%-8s %8s %10s %10s %10s %10s %10s' % ('latency', 'count', 'p50 ms', 'p90 ms', 'p99 ms', 'p99.9 ms', 'max ms'))
+            for kind, stats in report['latency_ms'].items():
+                print('%-8s %8d %10.2f %10.2f %10.2f %10.2f %10.2f' % (kind, stats['count'], stats['p50'], stats['p90'], stats['p99'], stats['p99.9'], stats['max']))
+        return 0 if committed >= options.transactions else 1
+    finally:
+        notifier.shutdown()
+        ldap.shutdown()
+        if options.keep:
+            print('kept %s' % (workdir,), file=sys.stderr)
+        else:
+            shutil.rmtree(workdir, ignore_errors=True)
+
+
+def parse_args():
+    # type: () -> argparse.Namespace
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--listener', default='/usr/sbin/univention-directory-listener', help='listener binary [%(default)s]')
+    parser.add_argument('--listener-arg', dest='listener_args', action='append', default=[], help='additional argument for the listener')
+    parser.add_argument('-d', '--debug', type=int, default=1, help='debug level of the listener [%(default)s]')
+    parser.add_argument('-m', '--modules', action='append', default=[], help='additional directory of listener modules')
+    parser.add_argument('--sample-modules', default='users,groups,hosts,all', help='sample modules to run, of %s [%%(default)s]' % (', '.join(sorted(MODULES)),))
+    parser.add_argument('--slow', type=float, default=1.0, help='milliseconds spent by the slow sample module per user [%(default)s]')
+    parser.add_argument('-p', '--protocol', type=int, choices=(2, 3, 4), default=3, help='notifier protocol version [%(default)s]')
+    parser.add_argument('-b', '--base', default='dc=bench,dc=test', help='LDAP base [%(default)s]')
+    parser.add_argument('--ldap-port', type=int, default=0, help='port of the LDAP server, any free one by default')
+    parser.add_argument('--ldif', help='seed the directory from this LDIF file instead of synthetic objects')
+    parser.add_argument('--users', type=int, default=1000, help='synthetic users [%(default)s]')
+    parser.add_argument('--hosts', type=int, default=100, help='synthetic hosts [%(default)s]')
+    parser.add_argument('--groups', type=int, default=20, help='synthetic groups, the first one with all users [%(default)s]')
+    parser.add_argument('--members', type=int, default=50, help='members of the other groups [%(default)s]')
+    parser.add_argument('-n', '--transactions', type=int, default=10000, help='transactions to play [%(default)s]')
+    parser.add_argument('--mix', default='add=10,modify=60,member=15,move=5,delete=10', help='weights of the operations [%(default)s]')
+    parser.add_argument('-r', '--rate', type=float, default=0, help='transactions per second to publish, all at once by default')
+    parser.add_argument('--seed', type=int, default=0, help='seed of the random stream [%(default)s]')
+    parser.add_argument('--poll', type=float, default=0.5, help='milliseconds between checks for committed transactions [%(default)s]')
+    parser.add_argument('--timeout', type=float, default=3600, help='seconds to wait for the listener [%(default)s]')
+    parser.add_argument('--serve-only', action='store_true', help='print the listener command lines and wait instead of running it')
+    parser.add_argument('--log', help='directory for listener.log, the temporary one by default')
+    parser.add_argument('--keep', action='store_true', help='keep the temporary directory with the cache')
+    parser.add_argument('--json', action='store_true', help='print the results as JSON')
+    return parser.parse_args()
+
+
+def main():
+    # type: () -> None
+    sys.exit(run(parse_args()))
+
+
+if __name__ == '__main__':
+    main()
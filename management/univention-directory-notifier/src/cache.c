@@ -36,123 +36,271 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
 #include <univention/debug.h>
 
 #include "cache.h"
 #include "notify.h"
+#include "stats.h"
 
 
 extern unsigned long long notifier_cache_size;
+extern unsigned long long notifier_cache_bytes;
+extern int notifier_cache_fixed;
 
-static notify_cache_t *cache;
-static int entry_min_pos = 0;
-static int max_filled = 0;
+/* the cache never shrinks below this */
+#define CACHE_MIN_BYTES (64 * 1024)
+/* the size is adapted at most this often, and only after this many lookups */
+#define CACHE_ADAPT_SECONDS 60
+#define CACHE_ADAPT_LOOKUPS 1024
+/* the share of lookups in per mille which should be answered from the cache */
+#define CACHE_ADAPT_PERMILLE 990
 
-#define MIN(x,y) (((x)<(y))?(x):(y))
+/* The lines of the transactions first_id..last_id are stored in this order in
+   a circular arena of @size bytes; a line never wraps, the remainder is left
+   unused. */
+struct notify_cache {
+	char *arena;
+	size_t size;
+	size_t head;
+	notify_cache_t *slots;  // by id % slot_count
+	unsigned long slot_count;
+	unsigned long first_id, last_id;
+	size_t stored;  // bytes of the lines first_id..last_id
+};
 
-int notifier_cache_init ( unsigned long max_id)
+/* added to by the main thread, read by the reactor threads */
+static struct notify_cache cache = {.first_id = 1, .last_id = 0};
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+/* Lookups by the distance of the requested ID to the last cached one, in
+   buckets of powers of two: bucket i counts distances below 2^i. */
+static unsigned long lag_counts[sizeof(unsigned long) * 8 + 1];
+static time_t adapted;
+static unsigned long resizes;
+
+static notify_cache_t *cache_slot(struct notify_cache *c, unsigned long id)
 {
-	unsigned int i;
-	int size;
-	int count = 0;
-	char *buffer;
-
-	cache = malloc( sizeof(notify_cache_t) * notifier_cache_size);
-	entry_min_pos=0;
-
-	for ( i = 0; i<notifier_cache_size; i++) {
-		cache[i].dn=NULL;
-		cache[i].id=0;
-		cache[i].command='n';
-	}
+	return &c->slots[id % c->slot_count];
+}
 
-	for ( i=max_id - MIN(max_id, notifier_cache_size) + 1; i <= max_id; i++) {
-		char *p, *pp;
+/* Append the transaction line @line of @len bytes for @id, dropping the
+   oldest lines as needed. A NULL @line leaves a hole for @id. */
+static void cache_store(struct notify_cache *c, unsigned long id, const char *line, size_t len)
+{
+	size_t head = c->head;
 
-		buffer=notify_transcation_get_one_dn ( i );
-		if ( buffer == NULL ) {
-			max_filled=count;
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "max_filled = %d", max_filled);
-			return 1;
+	if (line == NULL || len > c->size)
+		len = 0;
+	if (c->first_id <= c->last_id && id != c->last_id + 1) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "Resetting cache for id %ld after %ld", id, c->last_id);
+		c->first_id = id;
+		c->last_id = id - 1;
+		c->stored = 0;
+	}
+	if (c->first_id > c->last_id) {
+		c->first_id = id;
+		c->stored = 0;
+		head = 0;
+	}
+	if (head + len > c->size)
+		head = 0;
+
+	/* evict the oldest lines overlapping the new one, holes and beyond the slots */
+	while (c->first_id <= c->last_id) {
+		notify_cache_t *oldest = cache_slot(c, c->first_id);
+		if (oldest->len == 0 || (oldest->offset < head + len && head < oldest->offset + oldest->len) || c->last_id - c->first_id + 1 >= c->slot_count) {
+			c->stored -= oldest->len;
+			c->first_id++;
+		} else {
+			break;
 		}
+	}
+	if (c->first_id > c->last_id)
+		c->first_id = id;
 
-		sscanf(buffer, "%ld", &(cache[count].id));
-		cache[count].command=buffer[strlen(buffer)-1];
-		p=index(buffer, ' ');
-		pp=rindex(buffer, ' ');
-		size=pp-p;
-		cache[count].dn=malloc((size)*sizeof(char));
-		memcpy( cache[count].dn, p+1, pp-p);
-		cache[count].dn[size-1]='\0';
+	if (len > 0)
+		memcpy(c->arena + head, line, len);
+	cache_slot(c, id)->offset = head;
+	cache_slot(c, id)->len = len;
+	c->stored += len;
+	c->head = head + len;
+	c->last_id = id;
+}
 
-		free(buffer);
-		count+=1;
+/* Set up @c with @size bytes, filled with a single read of the end of the
+   transaction file up to @max_id. */
+static int cache_fill(struct notify_cache *c, size_t size, unsigned long max_id)
+{
+	char *buffer, *line, *nl;
+	size_t len;
+	unsigned long id;
 
+	memset(c, 0, sizeof(*c));
+	c->first_id = 1;
+	c->size = size;
+	/* transaction lines with a DN below the LDAP base are rarely shorter */
+	c->slot_count = size / 32 + 1;
+	if (notifier_cache_size && notifier_cache_size < c->slot_count)
+		c->slot_count = notifier_cache_size;
+	if ((c->arena = malloc(size)) == NULL || (c->slots = calloc(c->slot_count, sizeof(notify_cache_t))) == NULL)
+		abort();  // FIXME
+
+	if (notify_transaction_get_tail(size, &buffer, &len) != 0)
+		return 1;
+	for (line = buffer; line < buffer + len; line = nl + 1) {
+		nl = memchr(line, '\n', buffer + len - line);
+		if (sscanf(line, "%lu", &id) != 1 || id > max_id)
+			break;
+		cache_store(c, id, line, nl - line);
 	}
+	free(buffer);
+	return 0;
+}
 
-	max_filled=count;
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "max_filled = %d", max_filled);
+int notifier_cache_init ( unsigned long max_id)
+{
+	int rv;
 
-	return 0;
+	if (notifier_cache_bytes > UINT32_MAX)
+		notifier_cache_bytes = UINT32_MAX;
+	/* start with the whole budget, as all clients may lag behind after a restart */
+	rv = cache_fill(&cache, notifier_cache_bytes, max_id);
+	adapted = time(NULL);
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "cache filled with %ld..%ld", cache.first_id, cache.last_id);
+
+	return rv;
 }
 
 void notifier_cache_free() {
-	int i;
-	for (i = 0; i < notifier_cache_size; i++)
-		free(cache[i].dn);
-	free(cache);
-	cache = NULL;
+	free(cache.arena);
+	free(cache.slots);
+	memset(&cache, 0, sizeof(cache));
+	cache.first_id = 1;
 }
 
-int notifier_cache_add(unsigned long id, char *dn, char cmd)
+/* Return the size in bytes needed to answer CACHE_ADAPT_PERMILLE of the
+   lookups seen since the last call, or 0 if there were too few. */
+static size_t cache_wanted(void)
 {
-	if ( dn == NULL ) {
+	unsigned long counts[sizeof(lag_counts) / sizeof(*lag_counts)], total = 0, sum = 0, lag;
+	size_t i, line;
+
+	for (i = 0; i < sizeof(lag_counts) / sizeof(*lag_counts); i++)
+		total += counts[i] = __atomic_exchange_n(&lag_counts[i], 0, __ATOMIC_RELAXED);
+	if (total < CACHE_ADAPT_LOOKUPS)
 		return 0;
+	for (i = 0; i < sizeof(counts) / sizeof(*counts) - 1; i++) {
+		sum += counts[i];
+		if (sum * 1000 >= total * CACHE_ADAPT_PERMILLE)
+			break;
 	}
+	if (i >= 32)
+		return UINT32_MAX;
+	lag = 1UL << i;
+	/* average length of the cached lines including some slack at the end of the arena */
+	line = cache.last_id >= cache.first_id ? cache.stored / (cache.last_id - cache.first_id + 1) + 1 : 64;
+	if (lag > UINT32_MAX / line)
+		return UINT32_MAX;
+	return lag * line * 5 / 4;
+}
 
-	if ( max_filled < (notifier_cache_size-1) ) {
-		max_filled += 1;
-
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Added to cache pos %d, id %ld", max_filled, id);
+/* Grow the cache if too many lookups missed it, or shrink it if most
+   lookups are for much fewer transactions than it holds, within
+   notifier_cache_bytes. Must only be called by the thread adding. */
+static void cache_adapt(void)
+{
+	struct notify_cache c, old;
+	time_t now = time(NULL);
+	size_t size;
 
-		cache[max_filled].id = id;
-		cache[max_filled].dn = malloc ( ( strlen(dn) + 1 ) * sizeof(char) );
-		strcpy ( cache[max_filled].dn, dn );
+	if (notifier_cache_fixed || now - adapted < CACHE_ADAPT_SECONDS)
+		return;
+	if ((size = cache_wanted()) == 0)
+		return;
+	adapted = now;
+	if (size < CACHE_MIN_BYTES)
+		size = CACHE_MIN_BYTES;
+	if (size > notifier_cache_bytes)
+		size = notifier_cache_bytes;
+	/* only shrink to a quarter to avoid thrashing */
+	if (size <= cache.size && size > cache.size / 4)
+		return;
 
-		cache[max_filled].command = cmd;
-	} else {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Added to cache pos %d, id %ld", entry_min_pos, id);
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "resizing cache from %zu to %zu bytes", cache.size, size);
+	/* the transaction file holds all transactions added so far */
+	if (cache_fill(&c, size, cache.last_id) != 0) {
+		free(c.arena);
+		free(c.slots);
+		return;
+	}
+	pthread_rwlock_wrlock(&cache_lock);
+	old = cache;
+	cache = c;
+	pthread_rwlock_unlock(&cache_lock);
+	free(old.arena);
+	free(old.slots);
+	__atomic_fetch_add(&resizes, 1, __ATOMIC_RELAXED);
+}
 
-		cache[entry_min_pos].id = id;
-		free(cache[entry_min_pos].dn);
-		cache[entry_min_pos].dn = malloc ( ( strlen(dn) + 1 ) * sizeof(char) );
-		strcpy ( cache[entry_min_pos].dn, dn );
-		cache[entry_min_pos].command = cmd;
+int notifier_cache_add(unsigned long id, char *dn, char cmd)
+{
+	char line[2048];
+	int len;
 
-		if ( entry_min_pos < (notifier_cache_size-1) ) {
-			entry_min_pos += 1;
-		} else {
-			entry_min_pos = 0;
-		}
+	if ( dn == NULL ) {
+		return 0;
 	}
 
+	cache_adapt();
+	len = snprintf(line, sizeof(line), "%ld %s %c", id, dn, cmd);
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Added to cache id %ld", id);
+	pthread_rwlock_wrlock(&cache_lock);
+	/* too long lines are served from the transaction file */
+	cache_store(&cache, id, len < 0 || len >= sizeof(line) ? NULL : line, len);
+	pthread_rwlock_unlock(&cache_lock);
+
 	return 0;
 }
 
-char* notifier_cache_get(unsigned long id)
+/* Copy the transaction line "<id> <dn> <cmd>" of @id to @buf of @size bytes,
+   if it fits including the terminating NUL. Returns the length of the line,
+   or 0 if @id is not cached. */
+size_t notifier_cache_get(unsigned long id, char *buf, size_t size)
 {
-	char *str;
-	int i;
+	size_t len = 0, bucket = 0;
+	unsigned long lag = 0;
 
 	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "searching cache id = %ld", id);
-	for(i = 0; i < max_filled; i++ ) {
-		if ( cache[i].id == id ) {
-			str= malloc(8192); /* FIXME */
-			sprintf(str, "%ld %s %c", cache[i].id, cache[i].dn, cache[i].command);
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "string: [%s]", str);
-			return str;
+	pthread_rwlock_rdlock(&cache_lock);
+	if (id <= cache.last_id)
+		lag = cache.last_id - id + 1;
+	if (cache.first_id <= id && id <= cache.last_id && cache.slots != NULL) {
+		notify_cache_t *slot = cache_slot(&cache, id);
+		len = slot->len;
+		if (len < size) {
+			memcpy(buf, cache.arena + slot->offset, len);
+			buf[len] = '\0';
 		}
 	}
+	pthread_rwlock_unlock(&cache_lock);
+	stats_cache_lookup(len > 0 && len < size);
+	if (lag > 0) {
+		while (lag >> bucket)
+			bucket++;
+		__atomic_fetch_add(&lag_counts[bucket], 1, __ATOMIC_RELAXED);
+	}
 
-	return NULL;
+	return len;
+}
+
+void notifier_cache_stats(size_t *bytes, unsigned long *count, unsigned long *resized)
+{
+	pthread_rwlock_rdlock(&cache_lock);
+	*bytes = cache.size;
+	*count = cache.last_id >= cache.first_id ? cache.last_id - cache.first_id + 1 : 0;
+	pthread_rwlock_unlock(&cache_lock);
+	*resized = __atomic_load_n(&resizes, __ATOMIC_RELAXED);
 }
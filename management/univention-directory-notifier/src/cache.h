@@ -37,16 +37,22 @@
 #define __CACHE_H__
 
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* transaction line "<id> <dn> <cmd>" in the arena, len 0 if not cached */
 typedef struct {
-	unsigned long id;
-	char *dn;
-	char command;
+	uint32_t offset;
+	uint32_t len;
 } notify_cache_t;
 
 int	notifier_cache_init ( unsigned long max_id);
 void notifier_cache_free();
 int notifier_cache_add(unsigned long id, char *dn, char cmd);
 
-char* notifier_cache_get(unsigned long id);
+size_t notifier_cache_get(unsigned long id, char *buf, size_t size);
+/* Return the current size of the cache, the number of transactions it holds
+   and how often it was resized. */
+void notifier_cache_stats(size_t *bytes, unsigned long *count, unsigned long *resized);
 
 #endif
@@ -36,10 +36,12 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <netinet/in.h>
 #include <sys/time.h>
-#include <sys/ioctl.h>
 #include <sys/un.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -54,266 +56,722 @@
 #include "notify.h"
 #include "network.h"
 #include "cache.h"
+#include "callback.h"
+#include "stats.h"
+#include "reader.h"
+
+#define GET_DN_RANGE_MAX_COUNT 1000
+#define GET_DN_RANGE_MAX_BYTES (64 * 1024)
+#define NETWORK_LINE_MAX 8192  // longest text protocol line
 
-extern fd_set readfds;
 
 extern NotifyId_t notify_last_id;
 
 extern unsigned long SCHEMA_ID;
 
 
-/* read one line from network packages*/
+static int client_parse(NetworkClient_t *client);
 
-int get_network_line(char *packet, char *network_line)
+/* Append "<id> <dn> <cmd>\n" lines of up to @count cached transactions
+   starting at @id to @buf of @size bytes. Returns the number of transactions
+   appended. */
+static unsigned long cache_range(unsigned long id, unsigned long count, char *buf, size_t size)
 {
-	int i=0;
+	unsigned long found = 0;
+	size_t len = strlen(buf);
+
+	while (found < count && len + 1 < size) {
+		size_t l = notifier_cache_get(id + found, buf + len, size - len - 1);
+		if (l == 0)
+			break;
+		if (l >= size - len - 1) {
+			buf[len] = '\0';
+			break;
+		}
+		len += l;
+		buf[len++] = '\n';
+		buf[len] = '\0';
+		found++;
+	}
+	return found;
+}
 
-	memset(network_line, 0, 8192);
+/* Append "<id> <dn> <cmd>\n" lines of up to @count transactions starting at @id
+   to @buf of @size bytes. Returns the number of transactions appended. */
+static unsigned long get_dn_range(unsigned long id, unsigned long count, char *buf, size_t size)
+{
+	unsigned long found;
+	size_t len;
+	char *dn_string;
+
+	if (id + count - 1 > notify_last_id.id)
+		count = notify_last_id.id - id + 1;
+
+	/* recent transactions are in the cache */
+	found = cache_range(id, count, buf, size);
+	len = strlen(buf);
+	if (found == count || len + 1 >= size)
+		return found;
+
+	/* read the rest sequentially from the transaction file */
+	found += notify_transaction_get_dn_range(id + found, count - found, buf, size);
+	if (found > 0)
+		return found;
+
+	/* rebuild the index on the way */
+	if ((dn_string = notify_transcation_get_one_dn(id)) == NULL)
+		return 0;
+	if (len + strlen(dn_string) + 1 < size) {
+		strcat(buf, dn_string);
+		strcat(buf, "\n");
+		found++;
+	}
+	free(dn_string);
+	return found;
+}
 
-	while ( packet[i] != '\0' && packet[i] != '\n' ) {
-		network_line[i]=packet[i];
-		i+=1;
+/* Read the transactions missing in the cache in a reader thread. */
+static void read_run(struct reader_job *job)
+{
+	char *dn_string;
+
+	if (job->kind == READER_GET_DN) {
+		if ((dn_string = notify_transcation_get_one_dn(job->id)) == NULL)
+			return;
+		if ((job->buf = malloc(strlen(dn_string) + 2)) != NULL)
+			sprintf(job->buf, "%s\n", dn_string);
+		free(dn_string);
+		job->found = job->buf != NULL;
+		return;
 	}
 
-	if ( packet[i] == '\0' ) {
+	if ((job->buf = malloc(GET_DN_RANGE_MAX_BYTES)) == NULL)
+		return;
+	job->buf[0] = '\0';
+	if ((job->found = get_dn_range(job->id, job->count, job->buf, GET_DN_RANGE_MAX_BYTES)) == 0) {
+		free(job->buf);
+		job->buf = NULL;
+	}
+}
+
+/* Read @count transactions starting at @id for @client in a reader thread,
+   as they are not cached. The reply is sent by read_complete(). */
+static int cold_read(NetworkClient_t *client, enum reader_kind kind, unsigned long msg_id, unsigned long id, unsigned long count)
+{
+	struct reader_job *job;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%d reading %ld+%ld from file", client->fd, id, count);
+	if ((job = calloc(1, sizeof(*job))) == NULL)
+		return -1;
+	job->run = read_run;
+	job->kind = kind;
+	job->msg_id = msg_id;
+	job->id = id;
+	job->count = count;
+	network_client_read(client, job);
+	return 0;
+}
+
+/* Send the result of @job to its client, then handle the requests received
+   meanwhile. Called by the reactor of the client. Returns -1 if the
+   connection is to be closed. */
+int read_complete(struct reader_job *job)
+{
+	NetworkClient_t *client = job->client;
+	int rc = 0;
+
+	if (job->buf == NULL) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d failed to read %ld, close connection to listener ", client->fd, job->id);
+		return -1;
+	}
+
+	switch (job->kind) {
+	case READER_GET_DN:
+	case READER_DN_RANGE:
+		rc = network_client_reply(client, job->msg_id, job->buf, strlen(job->buf));
+		network_client_served(client, job->id + job->found - 1);
+		break;
+	case READER_SUBSCRIPTION:
+		rc = network_client_reply(client, job->msg_id, job->buf, strlen(job->buf));
+		client->sub_next += job->found;
+		client->credits -= job->found;
+		network_client_served(client, client->sub_next - 1);
+		break;
+	}
+	if (rc < 0 || client_parse(client) < 0)
+		return -1;
+	return subscription_push(client) < 0 ? -1 : 0;
+}
+
+/* Reply to GET_DN_RANGE @msg_id for up to @count transactions starting at @id
+   or register the client as waiting for @id. Returns 0 on success. */
+static int reply_dn_range(NetworkClient_t *client, unsigned long msg_id, unsigned long id, unsigned long count)
+{
+	unsigned long found;
+	char *range;
+	int rc;
+
+	if (client == NULL)
+		return -1;
+	if (count > GET_DN_RANGE_MAX_COUNT)
+		count = GET_DN_RANGE_MAX_COUNT;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "id: %ld count: %ld", id, count);
+
+	if (id > notify_last_id.id) {
+		/* set wanted id; answered like GET_DN with a single transaction */
+		network_client_set_next_id(client->fd, id);
+		network_client_set_msg_id(client->fd, msg_id);
 		return 0;
 	}
 
-	if ( i == 0 ) {
-		network_line[i]='\0';
+	if (id + count - 1 > notify_last_id.id)
+		count = notify_last_id.id - id + 1;
+	if ((range = malloc(GET_DN_RANGE_MAX_BYTES)) == NULL)
+		return -1;
+	range[0] = '\0';
+	/* older transactions are read without blocking the other clients */
+	if ((found = cache_range(id, count, range, GET_DN_RANGE_MAX_BYTES)) == 0) {
+		free(range);
+		return cold_read(client, READER_DN_RANGE, msg_id, id, count);
+	}
+	rc = network_client_reply(client, msg_id, range, strlen(range));
+	network_client_served(client, id + found - 1);
+	free(range);
+	return rc;
+}
+
+/* Push transactions to the subscribed @client as far as its credits allow.
+   Returns 0 on success. */
+int subscription_push(NetworkClient_t *client)
+{
+	char *range;
+	int rc = 0;
+
+	/* continued by read_complete() */
+	if (!client->subscribed || client->reading || client->credits == 0 || client->sub_next > notify_last_id.id) {
+		network_client_update_waiting(client);
+		return 0;
 	}
 
-	network_line[i+1]='\0';
+	if ((range = malloc(GET_DN_RANGE_MAX_BYTES)) == NULL)
+		return -1;
+	while (client->credits > 0 && client->sub_next <= notify_last_id.id) {
+		unsigned long count = client->credits < GET_DN_RANGE_MAX_COUNT ? client->credits : GET_DN_RANGE_MAX_COUNT;
+		unsigned long found;
 
-	return 1;
+		range[0] = '\0';
+		if ((found = cache_range(client->sub_next, count, range, GET_DN_RANGE_MAX_BYTES)) == 0) {
+			rc = cold_read(client, READER_SUBSCRIPTION, client->sub_msg_id, client->sub_next, count);
+			break;
+		}
+		if ((rc = network_client_reply(client, client->sub_msg_id, range, strlen(range))) != 0)
+			break;
+		client->sub_next += found;
+		client->credits -= found;
+	}
+	network_client_served(client, client->sub_next - 1);
+	free(range);
+	network_client_update_waiting(client);
+	return rc;
 }
 
-int data_on_connection(int fd, callback_remove_handler remove)
+/* Start pushing transactions from @id to @client with @credits. */
+static int subscribe(NetworkClient_t *client, unsigned long msg_id, unsigned long id, unsigned long credits)
 {
-	int nread;
+	if (client == NULL || id == 0)
+		return -1;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "%d subscribed from %ld with %ld credits", client->fd, id, credits);
+	client->subscribed = 1;
+	client->sub_msg_id = msg_id;
+	client->sub_next = id;
+	client->credits = credits;
+	return subscription_push(client);
+}
+
+/* Grant @credits more transactions to the subscribed @client. */
+static int credit(NetworkClient_t *client, unsigned long credits)
+{
+	if (client == NULL || !client->subscribed)
+		return -1;
+	client->credits += credits;
+	return subscription_push(client);
+}
+
+/* Reply to STATS @msg_id with the metrics of the notifier. */
+static int reply_stats(NetworkClient_t *client, unsigned long msg_id)
+{
+	char *report = NULL;
+	size_t len = 0;
+	FILE *out;
 	int rc;
-	char *network_packet;
-	char network_line[8192];
-	char *p;
+
+	if ((out = open_memstream(&report, &len)) == NULL)
+		return -1;
+	stats_write(out);
+	fclose(out);
+	rc = network_client_reply(client, msg_id, report, len);
+	free(report);
+	return rc;
+}
+
+/* Parse "<number> <number>" arguments of GET_DN_RANGE and SUBSCRIBE. */
+static int parse_two_numbers(const char *args, unsigned long *a, unsigned long *b)
+{
+	char *end;
+
+	*a = strtoul(args, &end, 10);
+	if (!*args || *end != ' ')
+		return -1;
+	args = end + 1;
+	*b = strtoul(args, &end, 10);
+	if (!*args || *end)
+		return -1;
+	return 0;
+}
+
+/* Handle one binary request frame of @client. Returns 0 on success. */
+static int binary_request(NetworkClient_t *client, unsigned long msg_id, enum network_opcode opcode, const char *payload, size_t len)
+{
+	char args[64], string[64], *end;
+	unsigned long id, count;
+
+	if (len >= sizeof(args))
+		return -1;
+	memcpy(args, payload, len);
+	args[len] = '\0';
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: op=%d msgid=%ld [%s]", opcode, msg_id, args);
+
+	switch (opcode) {
+	case OP_GET_DN_RANGE:
+		if (parse_two_numbers(args, &id, &count) || count < 1)
+			return -1;
+		return reply_dn_range(client, msg_id, id, count);
+	case OP_SUBSCRIBE:
+		if (parse_two_numbers(args, &id, &count))
+			return -1;
+		return subscribe(client, msg_id, id, count);
+	case OP_CREDIT:
+		count = strtoul(args, &end, 10);
+		if (!*args || *end)
+			return -1;
+		return credit(client, count);
+	case OP_GET_ID:
+		snprintf(string, sizeof(string), "%ld\n", notify_last_id.id);
+		break;
+	case OP_GET_SCHEMA_ID:
+		snprintf(string, sizeof(string), "%ld\n", SCHEMA_ID);
+		break;
+	case OP_ALIVE:
+		snprintf(string, sizeof(string), "OKAY\n");
+		break;
+	case OP_STATS:
+		return reply_stats(client, msg_id);
+	default:
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d unsupported binary opcode %d", client->fd, opcode);
+		return -1;
+	}
+	return network_client_reply(client, msg_id, string, strlen(string));
+}
+
+/* Text protocol requests are "MSGID: <id>" followed by a command line;
+   handlers return 0 on success, 1 on malformed arguments and -1 to close. */
+static int cmd_msgid(NetworkClient_t *client, const char *args)
+{
+	client->req_msg_id = strtoul(args, NULL, 10);
+	return 0;
+}
+
+static int cmd_version(NetworkClient_t *client, const char *args)
+{
+	enum network_protocol version;
+	char *end;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: VERSION");
+	version = strtoul(args, &end, 10);
+	if (!*args || *end)
+		return 1;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "VERSION=%d", version);
+	if (version < network_procotol_version) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Forbidden VERSION=%d < %d, close connection to listener", version, network_procotol_version);
+		return -1;
+	} else if (version >= PROTOCOL_LAST) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Future VERSION=%d", version);
+		version = PROTOCOL_LAST - 1;
+	}
+	client->version = version;
+
+	/* reset message id */
+	client->req_msg_id = UINT32_MAX;
+	return 0;
+}
+
+static int cmd_capabilities(NetworkClient_t *client, const char *args)
+{
+	char string[128], caps[128], *cap, *save;
+	bool binary = false, zstd = false;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: Capabilities");
+	if (client->version == PROTOCOL_UNKNOWN) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Capabilities recv, but no version line");
+		return 0;
+	}
+
+	/* the listener waits for this reply before sending framed requests */
+	snprintf(caps, sizeof(caps), "%s", args);
+	for (cap = strtok_r(caps, " ", &save); cap; cap = strtok_r(NULL, " ", &save)) {
+		if (!strcmp(cap, "BINARY"))
+			binary = client->version >= PROTOCOL_4;
+		else if (!strcmp(cap, "ZSTD"))
+			zstd = client->version >= PROTOCOL_4;
+	}
+
+	snprintf(string, sizeof(string), "Version: %d\nCapabilities: %s%s%s\n\n", client->version, client->version >= PROTOCOL_4 ? "GET_DN_RANGE SUBSCRIBE" : "", binary ? " BINARY" : "", zstd ? " ZSTD" : "");
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "SEND: %s", string);
+	if (network_client_send(client, string, strlen(string)) < 0)
+		return -1;
+	client->binary_next = binary;
+	/* all later output is compressed */
+	if (zstd && network_client_compress(client) < 0)
+		return -1;
+	return 0;
+}
+
+static int cmd_get_dn(NetworkClient_t *client, const char *args)
+{
+	char string[2048 + 64], cached[2048];
 	unsigned long id;
+	size_t l;
+	int rc;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: GET_DN");
+	id = strtoul(args, NULL, 10);
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "id: %ld", id);
+
+	if (id > notify_last_id.id) {
+		/* set wanted id */
+		network_client_set_next_id(client->fd, id);
+		network_client_set_msg_id(client->fd, client->req_msg_id);
+		return 0;
+	}
 
-	char string[1024];
-	unsigned long msg_id = UINT32_MAX;
-	enum network_protocol version = network_client_get_version(fd);
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "try to read %ld from cache", id);
+	if ((l = notifier_cache_get(id, cached, sizeof(cached))) == 0 || l >= sizeof(cached)) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld not found in cache", id);
 
-	ioctl(fd, FIONREAD, &nread);
+		/* read from transaction file, because not in cache */
+		return cold_read(client, READER_GET_DN, client->req_msg_id, id, 1);
+	}
 
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "new connection data = %d", nread);
+	snprintf(string, sizeof(string), "MSGID: %ld\n%s\n\n", client->req_msg_id, cached);
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "--> %d: [%s]", client->fd, string);
+	rc = network_client_send(client, string, strlen(string));
+	network_client_served(client, id);
+	return rc < 0 ? -1 : 0;
+}
 
-	if(nread == 0)
-	{
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "%d failed, got 0 close connection to listener ", fd);
-		close(fd);
-		FD_CLR(fd, &readfds);
-		remove(fd);
-		network_client_dump ();
+static int cmd_wait_id(NetworkClient_t *client, const char *args)
+{
+	char string[64], *end;
+	unsigned long id;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: WAIT_ID");
+	id = strtoul(args, &end, 10);
+	if (!*args || *end)
+		return 1;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "id: %ld", id);
+
+	if (id > notify_last_id.id) {
+		/* set wanted id */
+		network_client_set_next_id(client->fd, id);
+		network_client_set_msg_id(client->fd, client->req_msg_id);
 		return 0;
 	}
+	snprintf(string, sizeof(string), "MSGID: %ld\n%ld\n\n", client->req_msg_id, notify_last_id.id);
+	return network_client_send(client, string, strlen(string)) < 0 ? -1 : 0;
+}
 
-	if ( nread >= 8192 ) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d failed, more than 8192 close connection to listener ", fd);
-		close(fd);
-		FD_CLR(fd, &readfds);
-		remove(fd);
+static int cmd_get_dn_range(NetworkClient_t *client, const char *args)
+{
+	unsigned long id, count;
 
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: GET_DN_RANGE");
+	if (parse_two_numbers(args, &id, &count) || count < 1)
+		return 1;
+	return reply_dn_range(client, client->req_msg_id, id, count) ? -1 : 0;
+}
+
+static int cmd_subscribe(NetworkClient_t *client, const char *args)
+{
+	unsigned long id, count;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: SUBSCRIBE");
+	if (parse_two_numbers(args, &id, &count))
+		return 1;
+	return subscribe(client, client->req_msg_id, id, count) ? -1 : 0;
+}
+
+static int cmd_credit(NetworkClient_t *client, const char *args)
+{
+	unsigned long count;
+	char *end;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: CREDIT");
+	count = strtoul(args, &end, 10);
+	if (!*args || *end)
+		return 1;
+	return credit(client, count) ? -1 : 0;
+}
+
+static int cmd_get_id(NetworkClient_t *client, const char *args)
+{
+	char string[64];
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: GET_ID");
+	snprintf(string, sizeof(string), "MSGID: %ld\n%ld\n\n", client->req_msg_id, notify_last_id.id);
+	return network_client_send(client, string, strlen(string)) < 0 ? -1 : 0;
+}
+
+static int cmd_get_schema_id(NetworkClient_t *client, const char *args)
+{
+	char string[64];
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: GET_SCHEMA_ID");
+	snprintf(string, sizeof(string), "MSGID: %ld\n%ld\n\n", client->req_msg_id, SCHEMA_ID);
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "--> %d: [%s]", client->fd, string);
+	return network_client_send(client, string, strlen(string)) < 0 ? -1 : 0;
+}
+
+static int cmd_alive(NetworkClient_t *client, const char *args)
+{
+	char string[64];
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: ALIVE");
+	snprintf(string, sizeof(string), "MSGID: %ld\nOKAY\n\n", client->req_msg_id);
+	return network_client_send(client, string, strlen(string)) < 0 ? -1 : 0;
+}
+
+static int cmd_stats(NetworkClient_t *client, const char *args)
+{
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: STATS");
+	return reply_stats(client, client->req_msg_id) ? -1 : 0;
+}
+
+struct command {
+	const char *word;
+	size_t len;
+	enum network_protocol min, max;  // accepted protocol versions
+	bool request;  // needs a preceding MSGID line, which it consumes
+	int (*handler)(NetworkClient_t *client, const char *args);
+};
+
+#define COMMAND(word, min, max, request, handler) { word, sizeof(word) - 1, min, max, request, handler }
+#define ANY PROTOCOL_LAST - 1
+
+/* indexed by the length of the command word */
+static const struct command commands_5[] = {
+	COMMAND("ALIVE", PROTOCOL_1, ANY, true, cmd_alive),
+	COMMAND("STATS", PROTOCOL_1, ANY, true, cmd_stats),
+	{NULL},
+};
+static const struct command commands_6[] = {
+	COMMAND("MSGID:", PROTOCOL_UNKNOWN, ANY, false, cmd_msgid),
+	COMMAND("GET_DN", PROTOCOL_1, PROTOCOL_2, true, cmd_get_dn),
+	COMMAND("GET_ID", PROTOCOL_1, ANY, true, cmd_get_id),
+	COMMAND("CREDIT", PROTOCOL_4, ANY, true, cmd_credit),
+	{NULL},
+};
+static const struct command commands_7[] = {
+	COMMAND("WAIT_ID", PROTOCOL_3, PROTOCOL_3, true, cmd_wait_id),
+	{NULL},
+};
+static const struct command commands_8[] = {
+	COMMAND("Version:", PROTOCOL_UNKNOWN, ANY, false, cmd_version),
+	{NULL},
+};
+static const struct command commands_9[] = {
+	COMMAND("SUBSCRIBE", PROTOCOL_4, ANY, true, cmd_subscribe),
+	{NULL},
+};
+static const struct command commands_12[] = {
+	COMMAND("GET_DN_RANGE", PROTOCOL_4, ANY, true, cmd_get_dn_range),
+	{NULL},
+};
+static const struct command commands_13[] = {
+	COMMAND("Capabilities:", PROTOCOL_UNKNOWN, ANY, false, cmd_capabilities),
+	COMMAND("GET_SCHEMA_ID", PROTOCOL_1, ANY, true, cmd_get_schema_id),
+	{NULL},
+};
+static const struct command *const commands[] = {
+	[5] = commands_5,
+	[6] = commands_6,
+	[7] = commands_7,
+	[8] = commands_8,
+	[9] = commands_9,
+	[12] = commands_12,
+	[13] = commands_13,
+};
+
+#undef ANY
+#undef COMMAND
+
+/* Dispatch the text protocol @line of @len bytes, which is terminated in
+   place. Returns -1 if the connection is to be closed. */
+static int text_request(NetworkClient_t *client, char *line, size_t len)
+{
+	const struct command *cmd = NULL;
+	const char *args;
+	size_t word;
+	int rc;
+
+	if (len == 0) {
+		/* the empty line ends the negotiation */
+		if (client->binary_next)
+			client->binary = 1;
+		client->binary_next = 0;
 		return 0;
 	}
+	line[len] = '\0';
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "line = [%s]", line);
+
+	word = strcspn(line, " ");
+	args = line[word] ? line + word + 1 : line + word;
+	if (word < sizeof(commands) / sizeof(commands[0]) && commands[word] != NULL)
+		for (cmd = commands[word]; cmd->word != NULL && memcmp(cmd->word, line, word); cmd++)
+			;
+	if (cmd == NULL || cmd->word == NULL || client->version < cmd->min || client->version > cmd->max || (cmd->request && client->req_msg_id == UINT32_MAX)) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "Drop package [%s]", line);
+		return 0;
+	}
+
+	rc = cmd->handler(client, args);
+	if (cmd->request)
+		client->req_msg_id = UINT32_MAX;
+	if (rc > 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Failed parsing [%s]", line);
+		return -1;
+	}
+	return rc;
+}
 
-	/* read the whole package */
-	network_packet=malloc((nread+1) * sizeof(char));
-	read(fd, network_packet, nread);
-	network_packet[nread]='\0';
+/* Dispatch the complete lines buffered from @pos on; stops early when the
+   client switched to binary framing. Returns -1 if the connection is to be closed. */
+static int text_parse(NetworkClient_t *client, size_t *pos)
+{
+	char *line, *nl;
 
-	memset(network_line, 0, 8192);
-	p=network_packet;
+	while (!client->binary && !client->reading && (nl = memchr(client->buf + *pos, '\n', client->buf_len - *pos)) != NULL) {
+		line = client->buf + *pos;
+		*pos = nl - client->buf + 1;
+		if (text_request(client, line, nl - line) < 0)
+			return -1;
+	}
+	return 0;
+}
 
-	while ( get_network_line(p, network_line) ) {
-		if ( strlen(network_line) > 0 ) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "line = [%s]", network_line);
-		}
+/* Dispatch the complete binary frames buffered from @pos on.
+   Returns -1 if the connection is to be closed. */
+static int binary_parse(NetworkClient_t *client, size_t *pos)
+{
+	struct network_frame frame;
+
+	while (!client->reading && client->buf_len - *pos >= sizeof(frame)) {
+		size_t len;
 
-		if ( !strncmp(network_line, "MSGID: ", strlen("MSGID: ")) ) {
-			/* read message id  */
-			msg_id=strtoul(&(network_line[strlen("MSGID: ")]), NULL, 10);
-
-			p+=strlen(network_line);
-		} else if ( !strncmp(network_line, "Version: ", strlen("Version: ")) ) {
-			char *head = network_line, *end;
-
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: VERSION");
-
-			version = strtoul(head + 9, &end, 10);
-			if (!head[9] || *end)
-				goto failed;
-
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "VERSION=%d", version);
-
-			if (version < network_procotol_version) {
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Forbidden VERSION=%d < %d, close connection to listener", version, network_procotol_version);
-				goto close;
-			} else if (version >= PROTOCOL_LAST) {
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Future VERSION=%d", version);
-				version = PROTOCOL_LAST - 1;
-			}
-			network_client_set_version(fd, version);
-
-			/* reset message id */
-			msg_id = UINT32_MAX;
-
-			p+=strlen(network_line);
-		} else if ( !strncmp(network_line, "Capabilities: ", strlen("Capabilities: ")) ) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: Capabilities");
-
-			if ( version > PROTOCOL_UNKNOWN ) {
-				memset(string, 0, sizeof(string));
-
-				snprintf(string, sizeof(string), "Version: %d\nCapabilities: \n\n", version);
-
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "SEND: %s", string);
-				rc = send(fd, string, strlen(string), 0);
-				if (rc < 0)
-					goto failed;
-			} else {
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Capabilities recv, but no version line");
-			}
-
-			p+=strlen(network_line);
-		} else if ( !strncmp(network_line, "GET_DN ", strlen("GET_DN ")) && msg_id != UINT32_MAX && version > PROTOCOL_UNKNOWN && version < PROTOCOL_3) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: GET_DN");
-
-			id=strtoul(&(network_line[strlen("GET_DN ")]), NULL, 10);
-
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "id: %ld", id);
-
-			if ( id <= notify_last_id.id) {
-				char *dn_string = NULL;
-
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "try to read %ld from cache", id);
-
-				/* try to read from cache */
-				if ( (dn_string = notifier_cache_get(id)) == NULL ) {
-					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld not found in cache", id);
-
-					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld get one dn", id);
-
-					/* read from transaction file, because not in cache */
-					if( (dn_string=notify_transcation_get_one_dn ( id )) == NULL ) {
-						univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld failed ", id);
-						/* TODO: maybe close connection? */
-
-						univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d failed, close connection to listener ", fd);
-						close(fd);
-						FD_CLR(fd, &readfds);
-						remove(fd);
-						free(network_packet);
-
-						return 0;
-					}
-				}
-
-				if ( dn_string != NULL ) {
-					snprintf(string, sizeof(string), "MSGID: %ld\n%s\n\n",msg_id,dn_string);
-
-					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "--> %d: [%s]", fd, string);
-					rc = send(fd, string, strlen(string), 0);
-					free(dn_string);
-					if (rc < 0)
-						goto failed;
-				}
-			} else {
-				/* set wanted id */
-				network_client_set_next_id(fd, id);
-				network_client_set_msg_id(fd, msg_id);
-			}
-
-			p+=strlen(network_line)+1;
-			msg_id = UINT32_MAX;
-		} else if (!strncmp(p, "WAIT_ID ", 8) && msg_id != UINT32_MAX && version >= PROTOCOL_3) {
-			char *head = network_line, *end;
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: WAIT_ID");
-			id = strtoul(head + 8, &end, 10);
-			if (!head[8] || *end)
-				goto failed;
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "id: %ld", id);
-
-			if (id <= notify_last_id.id) {
-				snprintf(string, sizeof(string), "MSGID: %ld\n%ld\n\n", msg_id, notify_last_id.id);
-				rc = send(fd, string, strlen(string), 0);
-				if (rc < 0)
-					goto failed;
-			} else {
-				/* set wanted id */
-				network_client_set_next_id(fd, id);
-				network_client_set_msg_id(fd, msg_id);
-			}
-
-			p += strlen(network_line) + 1;
-			msg_id = UINT32_MAX;
-		} else if ( !strncmp(network_line, "GET_ID", strlen("GET_ID")) && msg_id != UINT32_MAX  && network_client_get_version(fd) > 0) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: GET_ID");
-
-			memset(string, 0, sizeof(string));
-
-			snprintf(string, sizeof(string), "MSGID: %ld\n%ld\n\n",msg_id,notify_last_id.id);
-			rc = send(fd, string, strlen(string), 0);
-			if (rc < 0)
-				goto failed;
-
-			p+=strlen(network_line)+1;
-			msg_id = UINT32_MAX;
-		} else if ( !strncmp(network_line, "GET_SCHEMA_ID", strlen("GET_SCHEMA_ID")) && msg_id != UINT32_MAX  && network_client_get_version(fd) > 0) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: GET_SCHEMA_ID");
-
-			memset(string, 0, sizeof(string));
-
-			snprintf(string, sizeof(string), "MSGID: %ld\n%ld\n\n",msg_id,SCHEMA_ID);
-
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "--> %d: [%s]", fd, string);
-			rc = send(fd, string, strlen(string), 0);
-			if (rc < 0)
-				goto failed;
-
-			p+=strlen(network_line)+1;
-			msg_id = UINT32_MAX;
-		} else if ( !strncmp(network_line, "ALIVE", strlen("ALIVE")) && msg_id != UINT32_MAX  && network_client_get_version(fd) > 0) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "RECV: ALIVE");
-
-			snprintf(string, sizeof(string), "MSGID: %ld\nOKAY\n\n",msg_id);
-			rc = send(fd, string, strlen(string), 0);
-			if (rc < 0)
-				goto failed;
-
-			p+=strlen(network_line)+1;
-			msg_id = UINT32_MAX;
-		} else {
-			p+=strlen(network_line);
-
-			if (strlen(network_line) == 0 ) {
-				p+=1;
-			} else {
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "Drop package [%s]", network_line);
-			}
+		memcpy(&frame, client->buf + *pos, sizeof(frame));
+		len = ntohl(frame.length);
+		if (len > NETWORK_FRAME_MAX) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d failed, frame too large, close connection to listener ", client->fd);
+			return -1;
 		}
+		if (client->buf_len - *pos - sizeof(frame) < len)
+			break;
+		if (binary_request(client, ntohl(frame.msg_id), ntohs(frame.opcode), client->buf + *pos + sizeof(frame), len))
+			return -1;
+		*pos += sizeof(frame) + len;
+	}
+	return 0;
+}
+
+/* Dispatch the buffered requests of @client until a read for one of them
+   is pending. Returns -1 if the connection is to be closed. */
+static int client_parse(NetworkClient_t *client)
+{
+	size_t pos = 0;
+
+	if (!client->binary && text_parse(client, &pos))
+		return -1;
+	/* requests pipelined behind the capability negotiation are framed */
+	if (client->binary && binary_parse(client, &pos))
+		return -1;
+	if (pos > 0) {
+		memmove(client->buf, client->buf + pos, client->buf_len - pos);
+		client->buf_len -= pos;
 	}
+	return 0;
+}
 
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "END Package");
-	free(network_packet);
+/* Append pending data to the input buffer of @client, which may grow up to
+   @max bytes. Returns the number of bytes read, 0 if there was nothing to
+   read and -1 if the connection is to be closed. */
+static ssize_t client_read(NetworkClient_t *client, size_t max)
+{
+	ssize_t r;
+
+	if (client->buf_size - client->buf_len < BUFSIZ && client->buf_size < max) {
+		size_t size = client->buf_size ? client->buf_size : BUFSIZ;
+		char *buf;
+
+		while (size - client->buf_len < BUFSIZ && size < max)
+			size *= 2;
+		if (size > max)
+			size = max;
+		if ((buf = realloc(client->buf, size)) == NULL)
+			abort();  // FIXME
+		client->buf = buf;
+		client->buf_size = size;
+	}
+	if (client->buf_len == client->buf_size) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d failed, more than %zu bytes pending, close connection to listener ", client->fd, max);
+		return -1;
+	}
 
-	network_client_dump ();
+	r = read(client->fd, client->buf + client->buf_len, client->buf_size - client->buf_len);
+	if (r < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	if (r == 0)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "%d failed, got 0 close connection to listener ", client->fd);
+	if (r <= 0)
+		return -1;
+	client->buf_len += r;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "new connection data = %zd", r);
+	return r;
+}
 
+/* Read requests of a listener. Incomplete lines or frames are kept in the
+   input buffer of the client until the rest arrives. */
+int data_on_connection(int fd, callback_remove_handler remove)
+{
+	NetworkClient_t *client = network_client_get(fd);
+	ssize_t r;
+
+	if (client == NULL)
+		goto close;
+	r = client_read(client, client->binary ? NETWORK_FRAME_MAX + sizeof(struct network_frame) : NETWORK_LINE_MAX);
+	if (r < 0)
+		goto close;
+	if (r == 0)
+		return 0;
+
+	if (client_parse(client))
+		goto close;
+
+	network_client_dump ();
 	return 0;
 
-failed:
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Failed parsing [%s]", p);
 close:
 	close(fd);
-	FD_CLR(fd, &readfds);
 	remove(fd);
-	free(network_packet);
+	network_client_dump ();
 	return 0;
 }
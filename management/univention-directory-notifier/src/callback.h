@@ -36,5 +36,8 @@
 #define __CALLBACK_H__
 
 int data_on_connection(int fd, callback_remove_handler remove);
+int subscription_push(NetworkClient_t *client);
+struct reader_job;
+int read_complete(struct reader_job *job);
 
 #endif
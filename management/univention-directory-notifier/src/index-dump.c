@@ -50,7 +50,7 @@ int main(int argc, char *argv[])
 
 	if (fread(&header, sizeof(header), 1, fp) != 1)
 		perror("Failed fread()");
-	printf("MAGIC: 0x%lx %s\n", header.magic, header.magic == MAGIC ? "VALID" : "INVALID");
+	printf("MAGIC: 0x%llx %s\n", (unsigned long long)le64toh(header.magic), le64toh(header.magic) == MAGIC ? "VALID" : "INVALID");
 
 	for (index = 0; !feof(fp); index++) {
 		struct index_entry entry;
@@ -60,7 +60,8 @@ int main(int argc, char *argv[])
 			break;
 		}
 
-		printf("%8d[%c]: %zd\n", index, entry.valid == 1 ? 'x' : ' ', entry.offset);
+		off_t offset = index_entry_offset(&entry);
+		printf("%8d[%c]: %lld\n", index, offset >= 0 ? 'x' : ' ', (long long)(offset >= 0 ? offset : 0));
 	}
 
 	fclose(fp);
@@ -0,0 +1,134 @@
+/*
+ * Univention Directory Notifier
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "index.h"
+#include "notify.h"
+
+/* Rebuild the transaction index in one sequential pass over the transaction
+   file. The index is written to a temporary file and renamed into place. */
+int main(int argc, char *argv[])
+{
+	char *tf_name = argc > 1 ? argv[1] : FILE_NAME_TF;
+	char *idx_name = argc > 2 ? argv[2] : FILE_NAME_TF_IDX;
+	char tmp_name[PATH_MAX];
+	struct index_header header = {
+		.magic = htole64(MAGIC),
+	};
+	struct stat st;
+	const char *data, *pos, *end;
+	unsigned long count = 0;
+	FILE *fp;
+	int fd;
+
+	if ((fd = open(tf_name, O_RDONLY)) < 0) {
+		perror("Failed open(tf)");
+		return 1;
+	}
+	if (fstat(fd, &st) < 0) {
+		perror("Failed fstat(tf)");
+		return 1;
+	}
+	data = NULL;
+	if (st.st_size > 0 && (data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		perror("Failed mmap(tf)");
+		return 1;
+	}
+	close(fd);
+	if (data)
+		madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+	snprintf(tmp_name, sizeof(tmp_name), "%s.tmp", idx_name);
+	if ((fp = fopen(tmp_name, "w")) == NULL) {
+		perror("Failed fopen(idx)");
+		return 1;
+	}
+	if (fwrite(&header, sizeof(header), 1, fp) != 1)
+		goto error;
+
+	/* entries are appended in transaction order; gaps are filled with invalid entries */
+	unsigned long next = 0;
+	for (pos = data, end = data + st.st_size; pos && pos < end; pos++) {
+		const char *eol = memchr(pos, '\n', end - pos);
+		unsigned long id = 0;
+		const char *c;
+
+		if (eol == NULL)
+			break;
+		for (c = pos; c < eol && *c >= '0' && *c <= '9'; c++)
+			id = id * 10 + (*c - '0');
+		if (c > pos && c < eol && *c == ' ') {
+			struct index_entry entry = { 0 };
+			if (id < next) {
+				/* out of order: patch the already written entry */
+				entry.offset = htole64((uint64_t)(pos - data) + 1);
+				if (fflush(fp) || pwrite(fileno(fp), &entry, sizeof(entry), index_entry_pos(id)) != sizeof(entry))
+					goto error;
+			} else {
+				for (; next < id; next++)
+					if (fwrite(&entry, sizeof(entry), 1, fp) != 1)
+						goto error;
+				entry.offset = htole64((uint64_t)(pos - data) + 1);
+				if (fwrite(&entry, sizeof(entry), 1, fp) != 1)
+					goto error;
+				next = id + 1;
+			}
+			count++;
+		}
+		pos = eol;
+	}
+
+	if (fflush(fp) || fsync(fileno(fp)) || fclose(fp)) {
+		perror("Failed fclose(idx)");
+		return 1;
+	}
+	if (rename(tmp_name, idx_name)) {
+		perror("Failed rename(idx)");
+		return 1;
+	}
+	printf("%lu transactions indexed in %s\n", count, idx_name);
+	return 0;
+
+error:
+	perror("Failed fwrite(idx)");
+	fclose(fp);
+	unlink(tmp_name);
+	return 1;
+}
@@ -38,58 +38,71 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <sys/types.h>
 #include "index.h"
 
-FILE* index_open(const char *filename)
+int index_open(const char *filename)
 {
-	FILE* fp;
 	struct index_header header;
+	int fd;
 
-	if ((fp = fopen(filename, "r+")) != NULL) {
-		if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == MAGIC)
-			return fp;
-		fclose(fp);
+	if ((fd = open(filename, O_RDWR | O_CLOEXEC)) >= 0) {
+		if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && le64toh(header.magic) == MAGIC)
+			return fd;
+		close(fd);
 	}
-	if ((fp = fopen(filename, "w+")) != NULL) {
-		header.magic = MAGIC;
-		if (fwrite(&header, sizeof(header), 1, fp) == 1)
-			return fp;
-		fclose(fp);
+	/* a missing or old index is rebuilt on the fly */
+	if ((fd = open(filename, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) >= 0) {
+		header.magic = htole64(MAGIC);
+		if (pwrite(fd, &header, sizeof(header), 0) == sizeof(header))
+			return fd;
+		close(fd);
 	}
-	perror("Failed fopen(idx)");
+	perror("Failed open(idx)");
 	abort();
 }
 
-static unsigned long index_seek(FILE *fp, unsigned long id) {
-	unsigned long offset = sizeof(struct index_header) + id * sizeof(struct index_entry);
-	fseek(fp, offset, SEEK_SET);
-	return offset;
-}
-
-size_t index_get(FILE *fp, unsigned long id)
+size_t index_get(int fd, unsigned long id)
 {
 	struct index_entry entry;
 
-	index_seek(fp, id);
-	if (fread(&entry, sizeof(entry), 1, fp) != 1)
-		return -1;
-	if (entry.valid != 1)
+	if (pread(fd, &entry, sizeof(entry), index_entry_pos(id)) != sizeof(entry))
 		return -1;
-	return entry.offset;
+	return index_entry_offset(&entry);
 }
 
-void index_set(FILE *fp, unsigned long id, size_t offset)
+void index_set(int fd, unsigned long id, size_t offset)
 {
 	struct index_entry entry = {
-		.valid = 1, .offset = offset,
+		.offset = htole64((uint64_t)offset + 1),
 	};
-	unsigned long index_offset = index_seek(fp, id);
-	if (fallocate(fileno(fp), FALLOC_FL_KEEP_SIZE, index_offset, sizeof(entry)) == -1 && (errno != ENOSYS) && (errno != EOPNOTSUPP)) {
+	off_t index_offset = index_entry_pos(id);
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, index_offset, sizeof(entry)) == -1 && (errno != ENOSYS) && (errno != EOPNOTSUPP)) {
+		perror("Failed fallocate(idx)");
+		abort();
+	}
+	if (pwrite(fd, &entry, sizeof(entry), index_offset) != sizeof(entry)) {
+		perror("Failed pwrite(idx)");
+		abort();
+	}
+}
+
+/* Set the entries of the @count transactions starting with @id at once.
+   An offset of -1 marks a transaction as unknown. */
+void index_set_range(int fd, unsigned long id, size_t count, const size_t *offsets)
+{
+	struct index_entry entries[count];
+	off_t index_offset = index_entry_pos(id);
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		entries[i].offset = offsets[i] == (size_t)-1 ? 0 : htole64((uint64_t)offsets[i] + 1);
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, index_offset, sizeof(entries)) == -1 && (errno != ENOSYS) && (errno != EOPNOTSUPP)) {
 		perror("Failed fallocate(idx)");
 		abort();
 	}
-	if (fwrite(&entry, sizeof(entry), 1, fp) != 1) {
-		perror("Failed fwrite(idx)");
+	if (pwrite(fd, entries, sizeof(entries), index_offset) != sizeof(entries)) {
+		perror("Failed pwrite(idx)");
 		abort();
 	}
 }
@@ -34,20 +34,38 @@
 #ifndef __NOTIFIER_INDEX_H__
 #define __NOTIFIER_INDEX_H__
 
-#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <endian.h>
 
-static const unsigned long MAGIC = 0x3395e0d4;
+/* Version 2 of the index: all fields are 64 bit little endian and aligned to
+   8 bytes, so the layout is the same on all architectures. Version 1 used
+   the native unsigned long for the magic and an unaligned size_t offset. */
+#define MAGIC 0x3395e0d400000002ULL
 
 struct index_header {
-	unsigned long magic;
-} __attribute__((__packed__));
+	uint64_t magic;
+};
+/* offset of the transaction line plus 1, 0 if unknown */
 struct index_entry {
-	char valid;
-	size_t offset;  // BUG: should have been off_t as size_t is 32 bit even with _FILE_OFFSET_BITS=64 on i386
-} __attribute__((__packed__));
+	uint64_t offset;
+};
 
-FILE* index_open(const char *filename);
-size_t index_get(FILE *fp, unsigned long id);
-void index_set(FILE *fp, unsigned long id, size_t offset);
+static inline off_t index_entry_offset(const struct index_entry *entry)
+{
+	uint64_t offset = le64toh(entry->offset);
+	return offset ? (off_t)(offset - 1) : -1;
+}
+
+static inline size_t index_entry_pos(unsigned long id)
+{
+	return sizeof(struct index_header) + id * sizeof(struct index_entry);
+}
+
+int index_open(const char *filename);
+size_t index_get(int fd, unsigned long id);
+void index_set(int fd, unsigned long id, size_t offset);
+void index_set_range(int fd, unsigned long id, size_t count, const size_t *offsets);
 
 #endif /* __NOTIFIER_INDEX_H__ */
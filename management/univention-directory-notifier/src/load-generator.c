@@ -0,0 +1,664 @@
+/*
+ * Univention Directory Notifier
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <netdb.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "notify.h"
+
+/* Simulate many listeners connected to a notifier. Each client does the
+   Version/Capabilities handshake, asks for the last ID with GET_ID and then
+   follows the transactions with GET_DN, WAIT_ID or GET_DN_RANGE, depending
+   on the protocol, one request at a time. Some clients may start behind
+   the last ID to model listeners catching up.
+
+   Requests for transactions already published are measured from sending
+   to the reply. Requests waiting for a new transaction are measured from
+   its publication to the reply: with -T, the load generator appends the
+   transactions to the listener file itself and knows when; otherwise the
+   first client woken for a transaction serves as the reference, which
+   gives the spread of the wakeups. */
+
+#define EVENTS_MAX 256
+#define CONNECTING_MAX 64  // the notifier listens with a backlog of 5
+
+enum client_state {
+	CLIENT_CONNECTING,
+	CLIENT_HANDSHAKE,
+	CLIENT_GET_ID,
+	CLIENT_READY,
+	CLIENT_BUSY,
+	CLIENT_CLOSED,
+};
+
+struct client {
+	int fd;
+	enum client_state state;
+	int protocol;
+	unsigned long next_id;  // next transaction to request
+	unsigned long msg_id;
+	bool waiting;  // the pending request is for a transaction not yet published
+	double sent;  // time of the pending request
+	double next_send;  // earliest time of the next request
+	char *buf;  // received, not yet complete reply
+	size_t len;
+	size_t size;
+};
+
+struct samples {
+	uint32_t *values;  // microseconds
+	size_t count;
+	size_t size;
+};
+
+enum lag_distribution {
+	LAG_FIXED,
+	LAG_UNIFORM,
+	LAG_EXPONENTIAL,
+};
+
+static const char *host = "localhost";
+static const char *port = "6669";
+static int client_count = 100;
+static int protocol = 3;
+static double duration = 60;
+static double rate = 0;  // requests per second and client, unlimited by default
+static double lag_fraction = 0;
+static double lag_mean = 1000;
+static enum lag_distribution lag_distribution = LAG_EXPONENTIAL;
+static unsigned long range_count = 1000;
+static double inject_rate = 0;
+static const char *listener_file = FILE_NAME_LISTENER;
+
+static struct client *clients;
+static int epoll_fd;
+static struct addrinfo *address;
+static volatile sig_atomic_t terminate = 0;
+
+static unsigned long last_id = 0;  // highest transaction known to be published
+static unsigned long first_id = 0;  // first transaction published during the run
+static double *published;  // by ID from first_id on, 0 while unknown
+static size_t published_size = 0;
+static unsigned long injected = 0;
+static double inject_start = 0;  // once first_id is known
+
+static struct samples request_latency, wakeup_latency;
+static unsigned long replies = 0, transactions = 0;
+static int connected = 0, connecting = 0, started = 0, failed = 0, closed = 0, waiting = 0;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void samples_add(struct samples *samples, double seconds)
+{
+	if (samples->count == samples->size) {
+		samples->size = samples->size ? samples->size * 2 : 4096;
+		if ((samples->values = realloc(samples->values, samples->size * sizeof(uint32_t))) == NULL)
+			abort();
+	}
+	samples->values[samples->count++] = seconds <= 0 ? 0 : seconds >= 4294 ? UINT32_MAX : (uint32_t)(seconds * 1e6);
+}
+
+static int compare_values(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void samples_print(const char *name, struct samples *samples)
+{
+	static const double percentiles[] = {50, 90, 99, 99.9};
+	size_t i;
+
+	printf("%-8s %10zu", name, samples->count);
+	if (samples->count == 0) {
+		printf("\n");
+		return;
+	}
+	qsort(samples->values, samples->count, sizeof(uint32_t), compare_values);
+	for (i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++) {
+		size_t pos = samples->count * percentiles[i] / 100;
+		printf(" %10.3f", samples->values[pos < samples->count ? pos : samples->count - 1] / 1e3);
+	}
+	printf(" %10.3f\n", samples->values[samples->count - 1] / 1e3);
+}
+
+/* Return the time transaction @id was published, recording @time if it is
+   not known yet. */
+static double published_at(unsigned long id, double time)
+{
+	size_t pos;
+
+	if (first_id == 0 || id < first_id)
+		return time;
+	pos = id - first_id;
+	if (pos >= published_size) {
+		size_t size = published_size ? published_size : 4096;
+
+		while (size <= pos)
+			size *= 2;
+		if ((published = realloc(published, size * sizeof(double))) == NULL)
+			abort();
+		memset(published + published_size, 0, (size - published_size) * sizeof(double));
+		published_size = size;
+	}
+	if (published[pos] == 0)
+		published[pos] = time;
+	return published[pos];
+}
+
+static void seen(unsigned long id, double time)
+{
+	if (id > last_id)
+		last_id = id;
+	published_at(id, time);
+}
+
+static unsigned long draw_lag(void)
+{
+	double u = drand48();
+
+	if (drand48() >= lag_fraction)
+		return 0;
+	switch (lag_distribution) {
+	case LAG_FIXED:
+		return lag_mean;
+	case LAG_UNIFORM:
+		return u * 2 * lag_mean;
+	case LAG_EXPONENTIAL:
+		return -log(1 - u) * lag_mean;
+	}
+	return 0;
+}
+
+static void client_close(struct client *client, bool error)
+{
+	if (client->state == CLIENT_CONNECTING)
+		connecting--;
+	else if (client->state != CLIENT_CLOSED)
+		connected--;
+	if (client->state == CLIENT_BUSY && client->waiting)
+		waiting--;
+	if (error)
+		failed++;
+	else
+		closed++;
+	close(client->fd);
+	client->fd = -1;
+	client->state = CLIENT_CLOSED;
+	free(client->buf);
+	client->buf = NULL;
+}
+
+static int client_send(struct client *client, const char *buf, size_t len)
+{
+	/* one small request at a time always fits into the send buffer */
+	return send(client->fd, buf, len, MSG_NOSIGNAL) == (ssize_t)len ? 0 : -1;
+}
+
+static void client_connect(struct client *client)
+{
+	struct epoll_event event = {
+		.events = EPOLLOUT,
+		.data.ptr = client,
+	};
+	int one = 1;
+
+	started++;
+	if ((client->fd = socket(address->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+		perror("Failed socket()");
+		failed++;
+		client->state = CLIENT_CLOSED;
+		return;
+	}
+	setsockopt(client->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	client->state = CLIENT_CONNECTING;
+	connecting++;
+	if ((connect(client->fd, address->ai_addr, address->ai_addrlen) < 0 && errno != EINPROGRESS) ||
+			epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client->fd, &event) < 0)
+		client_close(client, true);
+}
+
+static void client_connected(struct client *client)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = client,
+	};
+	char buf[64];
+	socklen_t len = sizeof(int);
+	int error = 0;
+
+	if (getsockopt(client->fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0 ||
+			epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &event) < 0) {
+		client_close(client, true);
+		return;
+	}
+	connecting--;
+	connected++;
+	client->state = CLIENT_HANDSHAKE;
+	snprintf(buf, sizeof(buf), "Version: %d\nCapabilities: %s\n\n", protocol, protocol >= 4 ? "GET_DN_RANGE" : "");
+	if (client_send(client, buf, strlen(buf)) < 0)
+		client_close(client, true);
+}
+
+static void client_request(struct client *client, double time)
+{
+	char buf[128];
+
+	client->msg_id++;
+	switch (client->protocol) {
+	case 2:
+		snprintf(buf, sizeof(buf), "MSGID: %lu\nGET_DN %lu\n\n", client->msg_id, client->next_id);
+		break;
+	case 3:
+		snprintf(buf, sizeof(buf), "MSGID: %lu\nWAIT_ID %lu\n\n", client->msg_id, client->next_id);
+		break;
+	default:
+		snprintf(buf, sizeof(buf), "MSGID: %lu\nGET_DN_RANGE %lu %lu\n\n", client->msg_id, client->next_id, range_count);
+		break;
+	}
+	client->waiting = client->next_id > last_id;
+	if (client->waiting)
+		waiting++;
+	client->sent = time;
+	client->state = CLIENT_BUSY;
+	if (client_send(client, buf, strlen(buf)) < 0)
+		client_close(client, true);
+}
+
+/* Handle the reply @body of the pending request of @client. */
+static void client_reply(struct client *client, char *body, double time)
+{
+	unsigned long id = 0, count = 0;
+	char *line, *save, buf[64];
+
+	switch (client->state) {
+	case CLIENT_HANDSHAKE:
+		for (line = strtok_r(body, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+			if (!strncmp(line, "Version: ", 9) && atoi(line + 9) < client->protocol)
+				client->protocol = atoi(line + 9);
+		if (client->protocol < 2) {
+			fprintf(stderr, "Protocol %d is not supported\n", client->protocol);
+			client_close(client, true);
+			return;
+		}
+		client->msg_id++;
+		snprintf(buf, sizeof(buf), "MSGID: %lu\nGET_ID\n\n", client->msg_id);
+		client->state = CLIENT_GET_ID;
+		if (client_send(client, buf, strlen(buf)) < 0)
+			client_close(client, true);
+		return;
+
+	case CLIENT_GET_ID:
+		id = strtoul(body, NULL, 10);
+		if (first_id == 0)
+			first_id = id + 1;
+		if (id > last_id)
+			last_id = id;
+		count = draw_lag();
+		client->next_id = id + 1 > count ? id + 1 - count : 1;
+		client->state = CLIENT_READY;
+		client->next_send = time;
+		return;
+
+	case CLIENT_BUSY:
+		break;
+
+	default:
+		return;
+	}
+
+	/* protocol 3 replies with the last ID, the others with "<id> <dn> <command>" lines */
+	if (client->protocol == 3) {
+		id = strtoul(body, NULL, 10);
+		if (id >= client->next_id) {
+			count = id - client->next_id + 1;
+			seen(id, time);
+		}
+	} else {
+		for (line = strtok_r(body, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+			id = strtoul(line, NULL, 10);
+			seen(id, time);
+			count++;
+		}
+	}
+
+	replies++;
+	transactions += count;
+	if (client->waiting) {
+		waiting--;
+		samples_add(&wakeup_latency, time - published_at(client->next_id, time));
+	} else {
+		samples_add(&request_latency, time - client->sent);
+	}
+	if (count > 0 && id >= client->next_id)
+		client->next_id = id + 1;
+	client->state = CLIENT_READY;
+	client->next_send = rate > 0 ? client->sent + 1 / rate : time;
+}
+
+static void client_read(struct client *client)
+{
+	char *end;
+	ssize_t rc;
+
+	for (;;) {
+		if (client->size - client->len < BUFSIZ) {
+			client->size = client->size ? client->size * 2 : 4 * BUFSIZ;
+			if ((client->buf = realloc(client->buf, client->size)) == NULL)
+				abort();
+		}
+		rc = recv(client->fd, client->buf + client->len, client->size - client->len - 1, 0);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (rc <= 0) {
+			client_close(client, rc < 0);
+			return;
+		}
+		client->len += rc;
+	}
+	client->buf[client->len] = '\0';
+
+	/* replies end with an empty line */
+	while (client->state != CLIENT_CLOSED && (end = strstr(client->buf, "\n\n")) != NULL) {
+		char *body = client->buf;
+		size_t used = end + 2 - client->buf;
+		double time = now();
+
+		*end = '\0';
+		if (!strncmp(body, "MSGID: ", 7) && (body = strchr(body, '\n')) != NULL)
+			body++;
+		else if (client->state != CLIENT_HANDSHAKE)
+			body = end;
+		client_reply(client, body, time);
+		if (client->state == CLIENT_CLOSED)
+			return;
+		memmove(client->buf, client->buf + used, client->len - used + 1);
+		client->len -= used;
+	}
+}
+
+/* Append the transactions due at @time to the listener file like slapd does,
+   which wakes the notifier through inotify. Returns the time of the next one. */
+static double inject(double time)
+{
+	unsigned long due;
+	char name[4096], line[128];
+	FILE *lock;
+	int fd;
+
+	if (first_id == 0)
+		return time + 0.001;
+	if (inject_start == 0)
+		inject_start = time;
+	if (injected >= (due = (time - inject_start) * inject_rate))
+		return inject_start + (injected + 1) / inject_rate;
+	snprintf(name, sizeof(name), "%s.lock", listener_file);
+	if ((lock = fopen(name, "a")) == NULL || lockf(fileno(lock), F_LOCK, 0) != 0) {
+		perror("Failed to lock the listener file");
+		exit(1);
+	}
+	if ((fd = open(listener_file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600)) < 0) {
+		perror("Failed open(listener)");
+		exit(1);
+	}
+	time = now();
+	for (; injected < due; injected++) {
+		unsigned long id = first_id + injected;
+
+		snprintf(line, sizeof(line), "%lu cn=load-generator-%lu m\n", id, id);
+		if (write(fd, line, strlen(line)) != (ssize_t)strlen(line)) {
+			perror("Failed write(listener)");
+			exit(1);
+		}
+		published_at(id, time);
+	}
+	close(fd);
+	fclose(lock);
+	return inject_start + (injected + 1) / inject_rate;
+}
+
+static void sig_stop(int sig)
+{
+	terminate = sig;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: univention-directory-notifier-load-generator [options]\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "   -h <host>    Notifier to connect to (default: %s)\n", host);
+	fprintf(stderr, "   -p <port>    Port of the notifier (default: %s)\n", port);
+	fprintf(stderr, "   -n <count>   Number of simulated listeners (default: %d)\n", client_count);
+	fprintf(stderr, "   -P <version> Protocol: 2 for GET_DN, 3 for WAIT_ID, 4 for GET_DN_RANGE (default: %d)\n", protocol);
+	fprintf(stderr, "   -c <count>   Transactions per GET_DN_RANGE (default: %lu)\n", range_count);
+	fprintf(stderr, "   -d <seconds> Duration of the run (default: %g)\n", duration);
+	fprintf(stderr, "   -r <rate>    Requests per second and listener (default: unlimited)\n");
+	fprintf(stderr, "   -f <share>   Share of listeners starting behind the last ID, 0 to 1 (default: %g)\n", lag_fraction);
+	fprintf(stderr, "   -l <count>   Mean number of transactions they are behind (default: %g)\n", lag_mean);
+	fprintf(stderr, "   -L <dist>    Distribution of that lag: fixed, uniform or exponential (default: exponential)\n");
+	fprintf(stderr, "   -T <rate>    Append transactions per second to the listener file (default: none)\n");
+	fprintf(stderr, "   -W <file>    Listener file (default: %s)\n", FILE_NAME_LISTENER);
+	fprintf(stderr, "\n-T changes the domain: only use it on test systems without other LDAP changes.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct epoll_event events[EVENTS_MAX];
+	struct sigaction action = {
+		.sa_handler = sig_stop,
+	};
+	double start, end, report;
+	unsigned long last_replies = 0;
+	int c, i, rc;
+
+	while ((c = getopt(argc, argv, "h:p:n:P:c:d:r:f:l:L:T:W:")) != -1) {
+		switch (c) {
+		case 'h':
+			host = optarg;
+			break;
+		case 'p':
+			port = optarg;
+			break;
+		case 'n':
+			client_count = atoi(optarg);
+			break;
+		case 'P':
+			protocol = atoi(optarg);
+			break;
+		case 'c':
+			range_count = strtoul(optarg, NULL, 10);
+			break;
+		case 'd':
+			duration = atof(optarg);
+			break;
+		case 'r':
+			rate = atof(optarg);
+			break;
+		case 'f':
+			lag_fraction = atof(optarg);
+			break;
+		case 'l':
+			lag_mean = atof(optarg);
+			break;
+		case 'L':
+			if (!strcmp(optarg, "fixed"))
+				lag_distribution = LAG_FIXED;
+			else if (!strcmp(optarg, "uniform"))
+				lag_distribution = LAG_UNIFORM;
+			else if (!strcmp(optarg, "exponential"))
+				lag_distribution = LAG_EXPONENTIAL;
+			else {
+				usage();
+				return 1;
+			}
+			break;
+		case 'T':
+			inject_rate = atof(optarg);
+			break;
+		case 'W':
+			listener_file = optarg;
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (optind != argc || client_count < 1 || protocol < 2 || protocol > 4 || range_count < 1) {
+		usage();
+		return 1;
+	}
+
+	if ((rc = getaddrinfo(host, port, &hints, &address)) != 0) {
+		fprintf(stderr, "Failed getaddrinfo(%s): %s\n", host, gai_strerror(rc));
+		return 1;
+	}
+	if ((clients = calloc(client_count, sizeof(struct client))) == NULL || (epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+		perror("Failed to set up");
+		return 1;
+	}
+	for (i = 0; i < client_count; i++) {
+		clients[i].fd = -1;
+		clients[i].protocol = protocol;
+	}
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+	srand48(getpid());
+
+	start = report = now();
+	end = start + duration;
+	while (!terminate) {
+		double time = now(), next = end;
+		int n, timeout;
+
+		if (time >= end)
+			break;
+
+		while (started < client_count && connecting < CONNECTING_MAX)
+			client_connect(&clients[started]);
+
+		if (inject_rate > 0) {
+			double due = inject(time);
+			if (due < next)
+				next = due;
+		}
+
+		for (i = 0; i < client_count; i++) {
+			struct client *client = &clients[i];
+
+			if (client->state != CLIENT_READY)
+				continue;
+			if (client->next_send <= time)
+				client_request(client, time);
+			else if (client->next_send < next)
+				next = client->next_send;
+		}
+
+		if (time >= report + 1) {
+			fprintf(stderr, "%6.1f s: %d connected, %d connecting, %d waiting, %.0f replies/s, last ID %lu\n",
+			        time - start, connected, connecting, waiting, (replies - last_replies) / (time - report), last_id);
+			last_replies = replies;
+			report = time;
+		}
+		if (report + 1 < next)
+			next = report + 1;
+
+		timeout = next > time ? (int)ceil((next - time) * 1e3) : 0;
+		if ((n = epoll_wait(epoll_fd, events, EVENTS_MAX, timeout)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed epoll_wait()");
+			return 1;
+		}
+		for (i = 0; i < n; i++) {
+			struct client *client = events[i].data.ptr;
+
+			if (client->state == CLIENT_CONNECTING)
+				client_connected(client);
+			else if (client->state != CLIENT_CLOSED)
+				client_read(client);
+		}
+	}
+	end = now();
+
+	printf("%d listeners, protocol %d: %d connected, %d failed, %d closed by the notifier\n", client_count, protocol, connected, failed, closed);
+	printf("%lu replies with %lu transactions in %.2f s: %.1f replies/s\n", replies, transactions, end - start, replies / (end - start));
+	if (inject_rate > 0)
+		printf("%lu transactions appended to %s\n", injected, listener_file);
+	printf("%-8s %10s %10s %10s %10s %10s %10s\n", "latency", "count", "p50 ms", "p90 ms", "p99 ms", "p99.9 ms", "max ms");
+	samples_print("request", &request_latency);
+	samples_print(inject_rate > 0 ? "wakeup" : "spread", &wakeup_latency);
+
+	for (i = 0; i < client_count; i++) {
+		if (clients[i].fd >= 0)
+			close(clients[i].fd);
+		free(clients[i].buf);
+	}
+	free(clients);
+	free(published);
+	free(request_latency.values);
+	free(wakeup_latency.values);
+	freeaddrinfo(address);
+	close(epoll_fd);
+
+	return 0;
+}
@@ -41,13 +41,20 @@
 #include <sys/time.h>
 #include <sys/ioctl.h>
 #include <sys/un.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <string.h>
 #include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include <errno.h>
 #include <univention/debug.h>
@@ -56,18 +63,75 @@
 #include "cache.h"
 #include "notify.h"
 #include "callback.h"
-
-static NetworkClient_t *network_client_first = NULL;
+#include "probes.h"
+#include "reader.h"
+
+#define NETWORK_EVENTS_MAX 64
+#define NETWORK_REACTORS_MAX 64
+#define NETWORK_RING_SIZE 1024
+
+/* A new transaction, shared by all reactors. */
+struct network_transaction {
+	int refs;
+	unsigned long id;
+	long len;
+	char buf[];
+};
+
+/* Single producer, single consumer queue from the main thread to a reactor.
+   The producer only writes head, the consumer only writes tail. */
+struct network_ring {
+	struct network_transaction *slots[NETWORK_RING_SIZE];
+	unsigned long head;
+	unsigned long tail;
+	int overflow;  // transactions were dropped, check all waiting clients
+};
+
+/* A thread serving its own shard of the client connections. */
+struct network_reactor {
+	pthread_t thread;
+	int epoll_fd;
+	int event_fd;
+	int stop;
+	/* clients by file descriptor */
+	NetworkClient_t **index;
+	int index_size;
+	/* min-heap of clients waiting for a transaction, ordered by wait_id */
+	NetworkClient_t **wait_heap;
+	int wait_count;
+	int wait_size;
+	NetworkClient_t **woken;
+	int woken_size;
+	/* removed clients, which are only freed after all events of a wakeup are handled */
+	NetworkClient_t *removed;
+	struct network_ring ring;
+	/* reads finished by the reader threads */
+	int done_fd;
+	pthread_mutex_t done_lock;
+	struct reader_job *done;
+};
+
+static struct network_reactor *reactors = NULL;
+static int reactor_count = 0;
+static __thread struct network_reactor *reactor = NULL;
 static int server_socketfd_listener;
-fd_set readfds;
+static int server_socketfd_local = -1;
+/* listener connections of all reactors for STATS */
+static pthread_mutex_t all_clients_lock = PTHREAD_MUTEX_INITIALIZER;
+static NetworkClient_t *all_clients = NULL;
+static const char *server_socket_path;
 
 extern int get_schema_callback ();
 extern int get_listener_callback ();
 extern void unset_schema_callback ();
+extern int get_callback_fd ();
+extern void read_callback_fd ();
 
 extern NotifyId_t notify_last_id;
 
 enum network_protocol network_procotol_version = PROTOCOL_2;
+/* clients with more output queued are disconnected */
+unsigned long long network_client_output_max = 16 * 1024 * 1024;
 
 int network_create_socket( int port )
 {
@@ -110,78 +174,142 @@ int network_create_socket( int port )
 	return server_socketfd;
 }
 
-int network_client_add ( int fd, callback_handler handler, int notify)
+/* Listen on the unix socket @path for listeners on the same host. */
+int network_create_local_socket( const char *path )
 {
-	NetworkClient_t *tmp = network_client_first;
+	int server_socketfd;
+	struct sockaddr_un server_address = {
+		.sun_family = AF_UNIX,
+	};
 
-	if ( tmp == NULL ) {
-		tmp = malloc ( sizeof(NetworkClient_t) );
-		tmp->fd = fd;
-		tmp->handler = handler;
-		tmp->notify = notify;
-		tmp->next_id = 0;
-		tmp->next = NULL;
-		network_client_first = tmp;
-	} else {
-		while(tmp->next != NULL) tmp = tmp->next;
+	if (strlen(path) >= sizeof(server_address.sun_path)) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "socket path %s too long", path);
+		return -1;
+	}
+	strcpy(server_address.sun_path, path);
+
+	if ((server_socketfd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+		return -1;
+	unlink(path);
+	if (bind(server_socketfd, (struct sockaddr *)&server_address, sizeof(server_address)) == -1 ||
+			chmod(path, 0666) == -1 ||
+			listen(server_socketfd, 5) == -1) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "listen on %s failed: %s", path, strerror(errno));
+		close(server_socketfd);
+		return -1;
+	}
+
+	return server_socketfd;
+}
+
+static int network_client_register ( int fd, callback_handler handler, int notify, uint32_t events)
+{
+	NetworkClient_t *client;
+	struct epoll_event event = {.events = events};
+
+	if ( fd >= reactor->index_size ) {
+		int size = reactor->index_size ? reactor->index_size : 64;
+		while (size <= fd)
+			size *= 2;
+		if ((reactor->index = realloc(reactor->index, size * sizeof(NetworkClient_t *))) == NULL)
+			abort();  // FIXME
+		memset(reactor->index + reactor->index_size, 0, (size - reactor->index_size) * sizeof(NetworkClient_t *));
+		reactor->index_size = size;
+	}
 
-		tmp->next = malloc ( sizeof(NetworkClient_t) );
-		tmp = tmp->next;
-		tmp->fd = fd;
-		tmp->handler = handler;
-		tmp->notify = notify;
-		tmp->next_id = 0;
-		tmp->next = NULL;
+	if ((client = calloc(1, sizeof(NetworkClient_t))) == NULL)
+		abort();  // FIXME
+	client->fd = fd;
+	client->handler = handler;
+	client->notify = notify;
+	client->version = PROTOCOL_UNKNOWN;
+	client->wait_pos = -1;
+	client->req_msg_id = UINT32_MAX;
+	reactor->index[fd] = client;
+	if (handler == data_on_connection) {
+		pthread_mutex_lock(&all_clients_lock);
+		client->all_next = all_clients;
+		if (all_clients != NULL)
+			all_clients->all_prev = client;
+		all_clients = client;
+		pthread_mutex_unlock(&all_clients_lock);
+	}
+
+	event.data.ptr = client;
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "epoll_ctl(%d) failed: %s", fd, strerror(errno));
+		return -1;
 	}
-	tmp->version = PROTOCOL_UNKNOWN;
 
 	return 0;
 }
 
+int network_client_add ( int fd, callback_handler handler, int notify)
+{
+	return network_client_register(fd, handler, notify, EPOLLIN);
+}
+
 int network_client_del ( int fd )
 {
-	NetworkClient_t *tmp = network_client_first;
-	NetworkClient_t *tmp1;
+	NetworkClient_t *client = network_client_get(fd);
 
+	/* callers mostly closed the descriptor already, which dropped it from the epoll set */
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 	shutdown(fd,2);
 
-	if( tmp->fd == fd )
-	{
-		network_client_first=tmp->next;
-		free(tmp);
-	}
-	else
-	{
-		while(tmp->next != NULL )
-		{
-			tmp1 = tmp->next;
-			if ( tmp1->fd == fd )
-			{
-				tmp->next=tmp1->next;
-				free(tmp1);
-				break;
-			}
-			tmp=tmp1;
-		}
+	if (client == NULL)
+		return 0;
+
+	client->notify = client->subscribed = 0;
+	network_client_update_waiting(client);
+	reactor->index[fd] = NULL;
+	if (client->handler == data_on_connection) {
+		pthread_mutex_lock(&all_clients_lock);
+		if (client->all_prev != NULL)
+			client->all_prev->all_next = client->all_next;
+		else
+			all_clients = client->all_next;
+		if (client->all_next != NULL)
+			client->all_next->all_prev = client->all_prev;
+		pthread_mutex_unlock(&all_clients_lock);
 	}
 
+	/* pending events may still refer to the client */
+	client->fd = -1;
+	client->next = reactor->removed;
+	reactor->removed = client;
+
 	return 0;
 }
 
+static void network_client_free_removed(void)
+{
+	NetworkClient_t **prev = &reactor->removed, *tmp;
+
+	while ((tmp = *prev) != NULL) {
+		/* a reader thread still refers to it */
+		if (tmp->reading) {
+			prev = &tmp->next;
+			continue;
+		}
+		*prev = tmp->next;
+		ZSTD_freeCCtx(tmp->zstd);
+		free(tmp->buf);
+		free(tmp->out);
+		free(tmp);
+	}
+}
+
 int network_client_set_next_id( int fd, unsigned long id )
 {
-	NetworkClient_t *tmp = network_client_first;
+	NetworkClient_t *tmp = network_client_get(fd);
 
-	while(tmp != NULL )
+	if ( tmp != NULL )
 	{
-		if ( tmp->fd == fd )
-		{
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Set next ID for fd %d to %ld", fd, id);
-			tmp->next_id=id;
-			tmp->notify=1;
-			break;
-		}
-		tmp = tmp->next;
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Set next ID for fd %d to %ld", fd, id);
+		tmp->next_id=id;
+		tmp->notify=1;
+		network_client_update_waiting(tmp);
 	}
 
 	return 0;
@@ -189,17 +317,12 @@ int network_client_set_next_id( int fd, unsigned long id )
 
 int network_client_set_msg_id( int fd, unsigned long msg_id )
 {
-	NetworkClient_t *tmp = network_client_first;
+	NetworkClient_t *tmp = network_client_get(fd);
 
-	while(tmp != NULL )
+	if ( tmp != NULL )
 	{
-		if ( tmp->fd == fd )
-		{
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Set msg ID for fd %d to %ld", fd, msg_id);
-			tmp->msg_id=msg_id;
-			break;
-		}
-		tmp = tmp->next;
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Set msg ID for fd %d to %ld", fd, msg_id);
+		tmp->msg_id=msg_id;
 	}
 
 	return 0;
@@ -207,17 +330,12 @@ int network_client_set_msg_id( int fd, unsigned long msg_id )
 
 int network_client_set_version( int fd, int version )
 {
-	NetworkClient_t *tmp = network_client_first;
+	NetworkClient_t *tmp = network_client_get(fd);
 
-	while(tmp != NULL )
+	if ( tmp != NULL )
 	{
-		if ( tmp->fd == fd )
-		{
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Set version for fd %d to %d", fd,version);
-			tmp->version=version;
-			break;
-		}
-		tmp = tmp->next;
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Set version for fd %d to %d", fd,version);
+		tmp->version=version;
 	}
 
 	return 0;
@@ -225,23 +343,337 @@ int network_client_set_version( int fd, int version )
 
 int network_client_get_version( int fd )
 {
-	NetworkClient_t *tmp = network_client_first;
+	NetworkClient_t *tmp = network_client_get(fd);
 
-	while(tmp != NULL )
+	if ( tmp != NULL )
 	{
-		if ( tmp->fd == fd )
-		{
-			return tmp->version;
-		}
-		tmp = tmp->next;
+		return tmp->version;
 	}
 
 	return -1;
 }
 
+NetworkClient_t *network_client_get( int fd )
+{
+	if (fd < 0 || fd >= reactor->index_size)
+		return NULL;
+
+	return reactor->index[fd];
+}
+
+static void wait_heap_set(int pos, NetworkClient_t *client)
+{
+	reactor->wait_heap[pos] = client;
+	client->wait_pos = pos;
+}
+
+/* Restore the heap order around @pos after its key changed. */
+static void wait_heap_fix(int pos)
+{
+	NetworkClient_t *client = reactor->wait_heap[pos];
+
+	while (pos > 0 && reactor->wait_heap[(pos - 1) / 2]->wait_id > client->wait_id) {
+		wait_heap_set(pos, reactor->wait_heap[(pos - 1) / 2]);
+		pos = (pos - 1) / 2;
+	}
+	for (;;) {
+		int child = 2 * pos + 1;
+		if (child >= reactor->wait_count)
+			break;
+		if (child + 1 < reactor->wait_count && reactor->wait_heap[child + 1]->wait_id < reactor->wait_heap[child]->wait_id)
+			child++;
+		if (reactor->wait_heap[child]->wait_id >= client->wait_id)
+			break;
+		wait_heap_set(pos, reactor->wait_heap[child]);
+		pos = child;
+	}
+	wait_heap_set(pos, client);
+}
+
+static void wait_heap_remove(NetworkClient_t *client)
+{
+	int pos = client->wait_pos;
+
+	client->wait_pos = -1;
+	if (pos != --reactor->wait_count) {
+		wait_heap_set(pos, reactor->wait_heap[reactor->wait_count]);
+		wait_heap_fix(pos);
+	}
+}
+
+/* Put @client into the waiter heap keyed by the lowest transaction ID it
+   waits for, or take it out if it waits for none. */
+void network_client_update_waiting( NetworkClient_t *client )
+{
+	unsigned long wait_id = ULONG_MAX;
+	int pos = client->wait_pos;
+
+	if ( client->notify )
+		wait_id = client->next_id;
+	if ( client->subscribed && !client->reading && client->credits > 0 && client->sub_next < wait_id )
+		wait_id = client->sub_next;
+
+	if ( wait_id != ULONG_MAX ) {
+		client->wait_id = wait_id;
+		if (pos < 0) {
+			if (reactor->wait_count == reactor->wait_size) {
+				reactor->wait_size = reactor->wait_size ? reactor->wait_size * 2 : 64;
+				if ((reactor->wait_heap = realloc(reactor->wait_heap, reactor->wait_size * sizeof(NetworkClient_t *))) == NULL)
+					abort();  // FIXME
+			}
+			pos = reactor->wait_count++;
+			wait_heap_set(pos, client);
+		}
+		wait_heap_fix(pos);
+	} else if (pos >= 0) {
+		wait_heap_remove(client);
+	}
+}
+
+/* Watch @client for writability while it has output queued. */
+static int network_client_watch(NetworkClient_t *client)
+{
+	struct epoll_event event = {
+		.events = EPOLLIN | (client->out_len ? EPOLLOUT : 0),
+		.data.ptr = client,
+	};
+
+	if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, client->fd, &event) != 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "epoll_ctl(%d) failed: %s", client->fd, strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+/* Make room for @len more bytes in the output queue of @client. */
+static void network_client_reserve(NetworkClient_t *client, size_t len)
+{
+	if (client->out_pos > 0 && client->out_pos + client->out_len + len > client->out_size) {
+		memmove(client->out, client->out + client->out_pos, client->out_len);
+		client->out_pos = 0;
+	}
+	if (client->out_len + len > client->out_size) {
+		size_t size = client->out_size ? client->out_size : BUFSIZ;
+		char *out;
+
+		while (size < client->out_len + len)
+			size *= 2;
+		if ((out = realloc(client->out, size)) == NULL)
+			abort();  // FIXME
+		client->out = out;
+		client->out_size = size;
+	}
+}
+
+/* Append @iov to the output queue of @client. Returns -1 if that would exceed
+   network_client_output_max. */
+static int network_client_queue(NetworkClient_t *client, const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0;
+	int i, was_empty = client->out_len == 0;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (client->out_len + len > network_client_output_max) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "%d cannot keep up, more than %llu bytes queued", client->fd, network_client_output_max);
+		return -1;
+	}
+
+	network_client_reserve(client, len);
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(client->out + client->out_pos + client->out_len, iov[i].iov_base, iov[i].iov_len);
+		client->out_len += iov[i].iov_len;
+	}
+
+	return was_empty ? network_client_watch(client) : 0;
+}
+
+/* Send queued output of @client once its socket is writable.
+   Returns -1 on errors. */
+static int network_client_flush(NetworkClient_t *client)
+{
+	while (client->out_len > 0) {
+		ssize_t rc = send(client->fd, client->out + client->out_pos, client->out_len, MSG_NOSIGNAL);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			return -1;
+		}
+		client->out_pos += rc;
+		client->out_len -= rc;
+	}
+	client->out_pos = 0;
+	/* do not keep large buffers of clients, which fell behind once */
+	if (client->out_size > BUFSIZ * 16) {
+		free(client->out);
+		client->out = NULL;
+		client->out_size = 0;
+	}
+	return network_client_watch(client);
+}
+
+/* Compress @in into the output queue of @client until @mode is done. */
+static int compress_step(NetworkClient_t *client, ZSTD_inBuffer *in, ZSTD_EndDirective mode)
+{
+	size_t rc;
+
+	do {
+		ZSTD_outBuffer out;
+
+		if (client->out_size - client->out_pos - client->out_len < 64)
+			network_client_reserve(client, BUFSIZ);
+		out.dst = client->out + client->out_pos + client->out_len;
+		out.size = client->out_size - client->out_pos - client->out_len;
+		out.pos = 0;
+		rc = ZSTD_compressStream2(client->zstd, &out, in, mode);
+		if (ZSTD_isError(rc)) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d compression failed: %s", client->fd, ZSTD_getErrorName(rc));
+			return -1;
+		}
+		client->out_len += out.pos;
+	} while (mode == ZSTD_e_continue ? in->pos < in->size : rc != 0);
+	return 0;
+}
+
+/* Compress @iov as one flushed block of the stream of @client and send as
+   much of it as the socket takes. */
+static int send_compressed(NetworkClient_t *client, const struct iovec *iov, int iovcnt)
+{
+	ZSTD_inBuffer in = {NULL, 0, 0};
+	size_t len = 0;
+	int i, was_empty = client->out_len == 0;
+
+	for (i = 0; i < iovcnt; i++)
+		len += iov[i].iov_len;
+	if (client->out_len + len > network_client_output_max) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "%d cannot keep up, more than %llu bytes queued", client->fd, network_client_output_max);
+		return -1;
+	}
+
+	network_client_reserve(client, ZSTD_compressBound(len) + 64);
+	for (i = 0; i < iovcnt; i++) {
+		ZSTD_inBuffer part = {iov[i].iov_base, iov[i].iov_len, 0};
+		if (compress_step(client, &part, ZSTD_e_continue) < 0)
+			return -1;
+	}
+	if (compress_step(client, &in, ZSTD_e_flush) < 0)
+		return -1;
+	if (!was_empty)
+		return 0;
+
+	while (client->out_len > 0) {
+		ssize_t rc = send(client->fd, client->out + client->out_pos, client->out_len, MSG_NOSIGNAL);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return network_client_watch(client);
+			return -1;
+		}
+		client->out_pos += rc;
+		client->out_len -= rc;
+	}
+	client->out_pos = 0;
+	if (client->out_size > BUFSIZ * 16) {
+		free(client->out);
+		client->out = NULL;
+		client->out_size = 0;
+	}
+	return 0;
+}
+
+/* Start compressing the output of @client. */
+int network_client_compress( NetworkClient_t *client )
+{
+	if ((client->zstd = ZSTD_createCCtx()) == NULL)
+		return -1;
+	ZSTD_CCtx_setParameter(client->zstd, ZSTD_c_compressionLevel, NETWORK_ZSTD_LEVEL);
+	ZSTD_CCtx_setParameter(client->zstd, ZSTD_c_windowLog, NETWORK_ZSTD_WINDOW_LOG);
+	return 0;
+}
+
+/* Write @iov to the non-blocking socket of @client, queueing what does not
+   fit into the send buffer. The output keeps its order. */
+static int send_iov(NetworkClient_t *client, struct iovec *iov, int iovcnt)
+{
+	if (client->zstd)
+		return send_compressed(client, iov, iovcnt);
+	while (iovcnt > 0 && client->out_len == 0) {
+		struct msghdr msg = {
+			.msg_iov = iov,
+			.msg_iovlen = iovcnt,
+		};
+		/* a client closing its connection must not kill the notifier */
+		ssize_t rc = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				return -1;
+			break;
+		}
+		while (iovcnt > 0 && (size_t)rc >= iov->iov_len) {
+			rc -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + rc;
+			iov->iov_len -= rc;
+		}
+	}
+	return iovcnt > 0 ? network_client_queue(client, iov, iovcnt) : 0;
+}
+
+/* Send @len bytes of @buf to @client. */
+int network_client_send( NetworkClient_t *client, const char *buf, size_t len )
+{
+	struct iovec iov = {
+		.iov_base = (void *)buf,
+		.iov_len = len,
+	};
+
+	if (client == NULL)
+		return -1;
+	return send_iov(client, &iov, 1);
+}
+
+/* Send the reply @body of @len bytes for request @msg_id framed as negotiated:
+   "MSGID: <msg_id>\n<body>\n" or a binary OP_RESULT frame. */
+int network_client_reply( NetworkClient_t *client, unsigned long msg_id, const char *body, size_t len )
+{
+	struct network_frame frame;
+	char head[32];
+	struct iovec iov[3];
+	int iovcnt = 0;
+
+	if (client->binary) {
+		frame.length = htonl(len);
+		frame.msg_id = htonl(msg_id);
+		frame.opcode = htons(OP_RESULT);
+		iov[iovcnt].iov_base = &frame;
+		iov[iovcnt++].iov_len = sizeof(frame);
+		iov[iovcnt].iov_base = (void *)body;
+		iov[iovcnt++].iov_len = len;
+	} else {
+		iov[iovcnt].iov_base = head;
+		iov[iovcnt++].iov_len = snprintf(head, sizeof(head), "MSGID: %ld\n", msg_id);
+		iov[iovcnt].iov_base = (void *)body;
+		iov[iovcnt++].iov_len = len;
+		iov[iovcnt].iov_base = "\n";
+		iov[iovcnt++].iov_len = 1;
+	}
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "--> %d: %ld [%.*s]", client->fd, msg_id, (int)len, body);
+	PROBE3(client_send, client->fd, msg_id, len);
+	return send_iov(client, iov, iovcnt);
+}
+
 static int new_connection(int fd, callback_remove_handler remove)
 {
-	struct sockaddr_in client_address;
+	struct sockaddr_storage client_address;
 	int client_socketfd;
 	socklen_t client_l;
 	int flags;
@@ -256,22 +688,232 @@ static int new_connection(int fd, callback_remove_handler remove)
 	flags |= O_NONBLOCK;
 	fcntl(client_socketfd, F_SETFL, flags);
 
-	FD_SET(client_socketfd, &readfds);
-
-	network_client_add(client_socketfd, data_on_connection, 0);
+	if (network_client_add(client_socketfd, data_on_connection, 0) != 0) {
+		network_client_del(client_socketfd);
+		close(client_socketfd);
+		return 1;
+	}
 
 	return 0;
 }
 
 
-int network_client_init ( int port )
+int network_client_init ( int port, const char *path, int threads )
 {
+	int i, flags;
+
+	if (threads < 1)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	if (threads > NETWORK_REACTORS_MAX)
+		threads = NETWORK_REACTORS_MAX;
+
 	server_socketfd_listener = network_create_socket(port);
-	network_client_add(server_socketfd_listener, new_connection, 0);
+	/* all reactors accept, so a wakeup may find the queue empty already */
+	flags = fcntl(server_socketfd_listener, F_GETFL);
+	fcntl(server_socketfd_listener, F_SETFL, flags | O_NONBLOCK);
+	if (path != NULL && (server_socketfd_local = network_create_local_socket(path)) >= 0) {
+		server_socket_path = path;
+		flags = fcntl(server_socketfd_local, F_GETFL);
+		fcntl(server_socketfd_local, F_SETFL, flags | O_NONBLOCK);
+	}
+
+	if ((reactors = calloc(threads, sizeof(struct network_reactor))) == NULL)
+		abort();  // FIXME
+	reactor_count = threads;
+	for (i = 0; i < reactor_count; i++) {
+		if ((reactors[i].epoll_fd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+				(reactors[i].event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0 ||
+				(reactors[i].done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "epoll_create1 failed, exit");
+			exit(1);
+		}
+		pthread_mutex_init(&reactors[i].done_lock, NULL);
+	}
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Using %d reactor threads", reactor_count);
 
 	return 0;
 }
 
+static void network_transaction_release(struct network_transaction *transaction)
+{
+	if (__atomic_sub_fetch(&transaction->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		free(transaction);
+}
+
+/* Hand @transaction to @reactor, or flag an overflow if its queue is full. */
+static void network_ring_push(struct network_reactor *r, struct network_transaction *transaction)
+{
+	struct network_ring *ring = &r->ring;
+	unsigned long head = ring->head;
+	uint64_t one = 1;
+
+	if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < NETWORK_RING_SIZE) {
+		ring->slots[head % NETWORK_RING_SIZE] = transaction;
+		__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+	} else {
+		__atomic_store_n(&ring->overflow, 1, __ATOMIC_RELEASE);
+		network_transaction_release(transaction);
+	}
+	if (write(r->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "eventfd write failed: %s", strerror(errno));
+}
+
+static int network_client_wake_all ( unsigned long id, char *buf, long l_buf);
+
+/* Wake the clients of this reactor for all queued transactions. */
+static int new_transactions(int fd, callback_remove_handler remove)
+{
+	struct network_ring *ring = &reactor->ring;
+	unsigned long tail = ring->tail;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return 1;
+
+	while (tail != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+		struct network_transaction *transaction = ring->slots[tail % NETWORK_RING_SIZE];
+
+		network_client_wake_all(transaction->id, transaction->buf, transaction->len);
+		network_transaction_release(transaction);
+		__atomic_store_n(&ring->tail, ++tail, __ATOMIC_RELEASE);
+	}
+	if (__atomic_exchange_n(&ring->overflow, 0, __ATOMIC_ACQ_REL))
+		network_client_wake_all(__atomic_load_n(&notify_last_id.id, __ATOMIC_ACQUIRE), NULL, 0);
+
+	return 0;
+}
+
+/* Hand @job back to the reactor, which submitted it. Called by the reader threads. */
+static void network_read_done(struct reader_job *job)
+{
+	struct network_reactor *r = job->reactor;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&r->done_lock);
+	job->next = r->done;
+	r->done = job;
+	pthread_mutex_unlock(&r->done_lock);
+	if (write(r->done_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "eventfd write failed: %s", strerror(errno));
+}
+
+/* Read transactions for @client by @job in a reader thread. The following
+   requests of the client are only handled after the reply was sent. */
+void network_client_read( NetworkClient_t *client, struct reader_job *job )
+{
+	job->client = client;
+	job->reactor = reactor;
+	job->done = network_read_done;
+	client->reading = 1;
+	network_client_update_waiting(client);
+	reader_submit(job);
+}
+
+/* Send the replies of the finished reads of this reactor. */
+static int reads_done(int fd, callback_remove_handler remove)
+{
+	struct reader_job *job, *next;
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		return 1;
+
+	pthread_mutex_lock(&reactor->done_lock);
+	job = reactor->done;
+	reactor->done = NULL;
+	pthread_mutex_unlock(&reactor->done_lock);
+
+	for (; job != NULL; job = next) {
+		NetworkClient_t *client = job->client;
+
+		next = job->next;
+		client->reading = 0;
+		/* closed while reading, freed with the other removed clients */
+		if (client->fd >= 0 && read_complete(job) < 0) {
+			int client_fd = client->fd;
+			network_client_del(client_fd);
+			close(client_fd);
+		}
+		reader_job_free(job);
+	}
+
+	return 0;
+}
+
+static void *network_reactor_main(void *arg)
+{
+	struct epoll_event events[NETWORK_EVENTS_MAX];
+	int i;
+
+	reactor = arg;
+	/* the listening socket is shared, wake only one reactor per connection */
+	if (network_client_register(server_socketfd_listener, new_connection, 0, EPOLLIN | EPOLLEXCLUSIVE) != 0 ||
+			(server_socketfd_local >= 0 && network_client_register(server_socketfd_local, new_connection, 0, EPOLLIN | EPOLLEXCLUSIVE) != 0) ||
+			network_client_add(reactor->event_fd, new_transactions, 0) != 0 ||
+			network_client_add(reactor->done_fd, reads_done, 0) != 0)
+		exit(1);
+
+	while (!__atomic_load_n(&reactor->stop, __ATOMIC_ACQUIRE)) {
+		int n;
+
+		if ((n = epoll_wait(reactor->epoll_fd, events, NETWORK_EVENTS_MAX, -1)) < 0) {
+			if ( errno == EINTR )
+				continue;
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "unknown epoll error, exit");
+			exit(1);
+		}
+
+		for (i = 0; i < n; i++) {
+			NetworkClient_t *tmp = events[i].data.ptr;
+			/* removed while handling an earlier event */
+			if (tmp->fd >= 0 && (events[i].events & EPOLLOUT) && network_client_flush(tmp) < 0) {
+				int fd = tmp->fd;
+				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Failed send(%d), closing.", fd);
+				network_client_del(fd);
+				close(fd);
+			}
+			if (tmp->fd >= 0 && (events[i].events & ~EPOLLOUT))
+				tmp->handler(tmp->fd, network_client_del);
+		}
+		network_client_free_removed();
+	}
+
+	/* the listening socket is shared and must not be shut down */
+	epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, server_socketfd_listener, NULL);
+	free(reactor->index[server_socketfd_listener]);
+	reactor->index[server_socketfd_listener] = NULL;
+	if (server_socketfd_local >= 0) {
+		epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, server_socketfd_local, NULL);
+		free(reactor->index[server_socketfd_local]);
+		reactor->index[server_socketfd_local] = NULL;
+	}
+
+	for (i = 0; i < reactor->index_size; i++) {
+		if (reactor->index[i]) {
+			network_client_del(i);
+			close(i);
+		}
+	}
+	network_client_free_removed();
+	while (reactor->done != NULL) {
+		struct reader_job *job = reactor->done;
+
+		reactor->done = job->next;
+		reader_job_free(job);
+	}
+	while (reactor->ring.tail != reactor->ring.head)
+		network_transaction_release(reactor->ring.slots[reactor->ring.tail++ % NETWORK_RING_SIZE]);
+	free(reactor->index);
+	free(reactor->wait_heap);
+	free(reactor->woken);
+	close(reactor->epoll_fd);
+	close(reactor->done_fd);
+
+	return NULL;
+}
+
 void check_callbacks()
 {
 	if ( get_schema_callback () ) {
@@ -300,165 +942,266 @@ static void setup_signal_handler() {
 
 int network_client_main_loop ( )
 {
-	fd_set testfds;
+	sigset_t block, unblocked;
+	int i;
 
 	univention_debug( UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Starting main loop");
-	/* create listener socket */
-
-	FD_ZERO(&readfds);
-	FD_SET(server_socketfd_listener, &readfds);
 
 	setup_signal_handler();
 
-	/* main loop */
-	while (!terminate) {
-		int fd;
-
-		testfds = readfds;
-		if( ((select (FD_SETSIZE, &testfds, (fd_set*)0, (fd_set*)0, (struct timeval *) 0))) < 1) {
-								  /*FIXME */
-			if ( errno == EINTR || errno == 29) {
-				/* Ignore signal */
-				check_callbacks();
-				continue;
-			}
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "unknown select error, exit");
+	/* signals are handled by the main thread only, which also ingests new transactions */
+	sigemptyset(&block);
+	sigaddset(&block, SIGINT);
+	sigaddset(&block, SIGQUIT);
+	sigaddset(&block, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &block, &unblocked);
+
+	for (i = 0; i < reactor_count; i++) {
+		if (pthread_create(&reactors[i].thread, NULL, network_reactor_main, &reactors[i]) != 0) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "pthread_create failed, exit");
 			exit(1);
 		}
+	}
+
+	/* main loop */
+	while (!terminate) {
+		/* retry pending callbacks, which failed to get the lock */
+		struct timespec retry = {.tv_sec = 0, .tv_nsec = 100 * 1000 * 1000};
+		struct pollfd pfd = {
+			.fd = get_callback_fd(),
+			.events = POLLIN,
+		};
 
-		for(fd=0; fd < FD_SETSIZE; fd++) {
-			if( FD_ISSET(fd,&testfds)) {
-				NetworkClient_t *tmp;
-				for ( tmp = network_client_first; tmp != NULL; tmp = tmp->next) {
-					if ( tmp->fd == fd ) {
-						tmp->handler(fd, network_client_del);
-						break;
-					}
-				}
-			}
-		}
 		check_callbacks();
+		if (terminate)
+			break;
+		if (ppoll(&pfd, 1, get_schema_callback() || get_listener_callback() ? &retry : NULL, &unblocked) > 0)
+			read_callback_fd();
 	}
 
 	univention_debug( UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Ending main loop");
 
-	network_client_del(server_socketfd_listener);
-	close(server_socketfd_listener);
+	/* the reader threads hand finished reads to the reactors */
+	reader_stop();
 
-	while (network_client_first)
-		network_client_del(network_client_first->fd);
+	for (i = 0; i < reactor_count; i++) {
+		uint64_t one = 1;
+
+		__atomic_store_n(&reactors[i].stop, 1, __ATOMIC_RELEASE);
+		if (write(reactors[i].event_fd, &one, sizeof(one)) < 0)
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "eventfd write failed: %s", strerror(errno));
+	}
+	for (i = 0; i < reactor_count; i++)
+		pthread_join(reactors[i].thread, NULL);
+	free(reactors);
+	reactors = NULL;
+	reactor_count = 0;
+
+	close(server_socketfd_listener);
+	if (server_socketfd_local >= 0) {
+		close(server_socketfd_local);
+		unlink(server_socket_path);
+		server_socketfd_local = -1;
+	}
 
 	return terminate;
 }
 
 int network_client_dump ( )
 {
-	NetworkClient_t *tmp = network_client_first;
+	int fd;
 
 	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "------------------------------");
-	while ( tmp != NULL ) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Listener fd = %d", tmp->fd);
-		tmp = tmp->next;
+	for (fd = 0; fd < reactor->index_size; fd++) {
+		if (reactor->index[fd])
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Listener fd = %d", fd);
 	}
 	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "------------------------------");
 	return 0;
 }
 
-int network_client_check_clients ( unsigned long last_known_id )
+/* Write the metrics of the listener connections of all reactors to @out. */
+void network_client_stats( FILE *out )
+{
+	unsigned long last_id = __atomic_load_n(&notify_last_id.id, __ATOMIC_ACQUIRE);
+	unsigned long versions[PROTOCOL_LAST] = {0};
+	unsigned long waiting = 0;
+	NetworkClient_t *client;
+	int i;
+
+	fprintf(out, "# HELP univention_notifier_client_lag Transactions not yet sent to the client.\n");
+	fprintf(out, "# TYPE univention_notifier_client_lag gauge\n");
+	pthread_mutex_lock(&all_clients_lock);
+	for (client = all_clients; client != NULL; client = client->all_next) {
+		enum network_protocol version = __atomic_load_n(&client->version, __ATOMIC_RELAXED);
+		unsigned long served = __atomic_load_n(&client->served_id, __ATOMIC_RELAXED);
+
+		versions[version < PROTOCOL_LAST ? version : PROTOCOL_UNKNOWN]++;
+		if (__atomic_load_n(&client->wait_pos, __ATOMIC_RELAXED) >= 0)
+			waiting++;
+		if (served > 0)
+			fprintf(out, "univention_notifier_client_lag{fd=\"%d\"} %lu\n", client->fd, served < last_id ? last_id - served : 0);
+	}
+	pthread_mutex_unlock(&all_clients_lock);
+
+	fprintf(out, "# TYPE univention_notifier_clients gauge\n");
+	for (i = PROTOCOL_UNKNOWN; i < PROTOCOL_LAST; i++)
+		fprintf(out, "univention_notifier_clients{protocol=\"%d\"} %lu\n", i, versions[i]);
+	fprintf(out, "# TYPE univention_notifier_clients_waiting gauge\n");
+	fprintf(out, "univention_notifier_clients_waiting %lu\n", waiting);
+}
+
+/* Answer everything @client waits for up to transaction @id. @buf holds
+   transaction @id itself, or is NULL to read it from the cache. Returns
+   -1 if the client was closed. */
+static int network_client_wake ( NetworkClient_t *client, unsigned long id, char *buf, long l_buf)
 {
-	NetworkClient_t *tmp = network_client_first;
 	int rc;
 	char string[8192];
-	while ( tmp != NULL ) {
-		if ( tmp->notify ) {
-			if ( tmp->next_id <= last_known_id ) {
-				char *dn_string = NULL;
-
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "try to read %ld from cache", tmp->next_id);
-
-				/* try to read from cache */
-				if ( (dn_string = notifier_cache_get(tmp->next_id)) == NULL ) {
-					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld not found in cache", tmp->next_id);
-					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld get one dn", tmp->next_id);
-
-					/* read from transaction file, because not in cache */
-					if( (dn_string=notify_transcation_get_one_dn ( tmp->next_id )) == NULL ) {
-						univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld failed ", tmp->next_id);
-						univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d closed, read from transaction file failed ", tmp->fd);
-						/* TODO: maybe close connection? */
-					}
-				}
 
-				if ( dn_string != NULL ) {
-					snprintf(string, sizeof(string), "MSGID: %ld\n%s\n\n",tmp->msg_id,dn_string);
-
-					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "--> %d: [%s]", tmp->fd, string);
-					rc = send(tmp->fd, string, strlen(string), 0);
-					free(dn_string);
-					if (rc < 0) {
-						univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Failed send(%d), closing.", tmp->fd);
-						int fd = tmp->fd;
-						tmp = tmp->next;
-						network_client_del(fd);
-						continue;
-					}
+	PROBE3(client_wake, client->fd, id, client->version);
+	if ( client->subscribed ) {
+		/* the common case is a client waiting for exactly this transaction */
+		if ( buf != NULL && client->sub_next == id && client->credits > 0 ) {
+			rc = network_client_reply(client, client->sub_msg_id, buf, l_buf);
+			network_client_served(client, client->sub_next);
+			client->sub_next++;
+			client->credits--;
+		} else {
+			rc = subscription_push(client);
+		}
+		if (rc < 0)
+			goto failed;
+	}
+
+	if ( client->notify && client->next_id <= id ) {
+		if ( (buf != NULL && client->next_id == id) || client->version == PROTOCOL_3 ) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Wrote to Listener fd = %d", client->fd);
+			switch (client->version) {
+				case PROTOCOL_2:
+				case PROTOCOL_4:
+					rc = network_client_reply(client, client->msg_id, buf, l_buf);
+					break;
+				case PROTOCOL_3:
+					snprintf(string, sizeof(string), "%ld\n", notify_last_id.id);
+					rc = network_client_reply(client, client->msg_id, string, strlen(string));
+					break;
+				default:
+					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "v%d not implemented fd=%d", client->version, client->fd);
+					rc = 0;
+					break;
+			}
+			if (rc < 0)
+				goto failed;
+		} else {
+			char *dn_string = NULL;
+			size_t l;
+
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "try to read %ld from cache", client->next_id);
+
+			/* try to read from cache */
+			if ( (l = notifier_cache_get(client->next_id, string, sizeof(string) - 1)) > 0 && l < sizeof(string) - 1 ) {
+				string[l++] = '\n';
+				if (network_client_reply(client, client->msg_id, string, l) < 0)
+					goto failed;
+			} else {
+				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld not found in cache", client->next_id);
+				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld get one dn", client->next_id);
+
+				/* read from transaction file, because not in cache */
+				if( (dn_string=notify_transcation_get_one_dn ( client->next_id )) == NULL ) {
+					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "%ld failed ", client->next_id);
+					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%d closed, read from transaction file failed ", client->fd);
+					/* TODO: maybe close connection? */
 				}
-				tmp->notify=0;
-				tmp->msg_id=0;
+			}
+
+			if ( dn_string != NULL ) {
+				snprintf(string, sizeof(string), "%s\n", dn_string);
+				rc = network_client_reply(client, client->msg_id, string, strlen(string));
+				free(dn_string);
+				if (rc < 0)
+					goto failed;
 			}
 		}
-		tmp=tmp->next;
+		if (client->version != PROTOCOL_3)
+			network_client_served(client, client->next_id);
+		client->notify=0;
+		client->msg_id=0;
+	}
+
+	network_client_update_waiting(client);
+	return 0;
+
+failed:
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Failed send(%d), closing.", client->fd);
+	rc = client->fd;
+	network_client_del(rc);
+	close(rc);
+	return -1;
+}
+
+/* Wake all clients waiting for a transaction up to @id. They are taken
+   from the heap first, as waking puts them back with their next wait_id. */
+static int network_client_wake_all ( unsigned long id, char *buf, long l_buf)
+{
+	int i, count = 0, rc = 0;
+
+	while ( reactor->wait_count > 0 && reactor->wait_heap[0]->wait_id <= id ) {
+		if (count == reactor->woken_size) {
+			reactor->woken_size = reactor->woken_size ? reactor->woken_size * 2 : 64;
+			if ((reactor->woken = realloc(reactor->woken, reactor->woken_size * sizeof(NetworkClient_t *))) == NULL)
+				abort();  // FIXME
+		}
+		reactor->woken[count++] = reactor->wait_heap[0];
+		wait_heap_remove(reactor->wait_heap[0]);
+	}
+
+	for (i = 0; i < count; i++) {
+		if (network_client_wake(reactor->woken[i], id, buf, l_buf) < 0)
+			rc = -1;
+	}
+
+	return rc;
+}
+
+/* Make all reactors answer their clients waiting up to @last_known_id. */
+int network_client_check_clients ( unsigned long last_known_id )
+{
+	int i;
+
+	for (i = 0; i < reactor_count; i++) {
+		uint64_t one = 1;
+
+		__atomic_store_n(&reactors[i].ring.overflow, 1, __ATOMIC_RELEASE);
+		if (write(reactors[i].event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "eventfd write failed: %s", strerror(errno));
 	}
 	return 0;
 }
 
+/* Publish transaction @id to all reactors. Called by the main thread after
+   notify_last_id and the cache were updated. */
 int network_client_all_write ( unsigned long id, char *buf, long l_buf)
 {
-	NetworkClient_t *tmp = network_client_first;
-	int rc;
-	char string[8192];
+	struct network_transaction *transaction;
+	int i;
 
-	if ( l_buf == 0 ) {
+	if ( l_buf == 0 || reactor_count == 0 ) {
 		return 0;
 	}
 
 	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "l=%ld, --> [%s]", l_buf, buf);
+	PROBE2(transaction_publish, id, l_buf);
 
-	while ( tmp != NULL ) {
-		if ( tmp->notify ) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Wrote to Listener fd = %d", tmp->fd);
-			if ( tmp->next_id == id ) {
-				memset(string, 0, 8192 );
-				switch (tmp->version) {
-					case PROTOCOL_2:
-				sprintf(string,"MSGID: %ld\n",tmp->msg_id);
-				strncat(string,buf, l_buf);
-				strcat(string,"\n");
-						break;
-					case PROTOCOL_3:
-						snprintf(string, sizeof(string), "MSGID: %ld\n%ld\n\n", tmp->msg_id, notify_last_id.id);
-						break;
-					default:
-						univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "v%d not implemented fd=%d", tmp->version, tmp->fd);
-						continue;
-				}
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Wrote to Listener fd = %d[%s]", tmp->fd, string);
-				rc = send(tmp->fd, string, strlen(string), 0);
-				if (rc < 0) {
-					univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Failed send(%d), closing.", tmp->fd);
-					int fd = tmp->fd;
-					tmp = tmp->next;
-					network_client_del(fd);
-					continue;
-				}
-				tmp->notify=0;
-				tmp->msg_id=0;
-			}
-		} else {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "Ignore Listener fd = %d", tmp->fd);
-		}
-		tmp = tmp->next;
-	}
+	if ((transaction = malloc(sizeof(*transaction) + l_buf)) == NULL)
+		abort();  // FIXME
+	transaction->refs = reactor_count;
+	transaction->id = id;
+	transaction->len = l_buf;
+	memcpy(transaction->buf, buf, l_buf);
+	for (i = 0; i < reactor_count; i++)
+		network_ring_push(&reactors[i], transaction);
 
-	return rc;
+	return 0;
 }
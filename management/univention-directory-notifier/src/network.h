@@ -35,6 +35,11 @@
 #ifndef __NETWORK_H__
 #define __NETWORK_H__
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <zstd.h>
+
 typedef int (*callback_remove_handler)(int fd);
 typedef int (*callback_handler)(int fd, callback_remove_handler);
 
@@ -43,9 +48,44 @@ enum network_protocol {
 	PROTOCOL_1,
 	PROTOCOL_2,
 	PROTOCOL_3,
+	PROTOCOL_4,  // GET_DN_RANGE
 	PROTOCOL_LAST  // must always be last entry
 };
 
+/* Binary framing, negotiated by capability BINARY since protocol 4.
+   Each frame is a header in network byte order followed by @length bytes
+   of payload: the request arguments or the reply body of the text protocol. */
+enum network_opcode {
+	OP_RESULT = 0,
+	OP_GET_DN,
+	OP_WAIT_ID,
+	OP_GET_DN_RANGE,
+	OP_GET_ID,
+	OP_GET_SCHEMA_ID,
+	OP_ALIVE,
+	OP_SUBSCRIBE,
+	OP_CREDIT,
+	OP_STATS,
+};
+
+struct network_frame {
+	uint32_t length;
+	uint32_t msg_id;
+	uint16_t opcode;
+} __attribute__((packed));
+
+#define NETWORK_FRAME_MAX (16 * 1024 * 1024)
+
+/* Stream compression, negotiated by capability ZSTD since protocol 4.
+   Everything sent to the listener after the reply to Capabilities is one
+   zstd stream, flushed after each reply, so a range or a batch of pushed
+   transactions is compressed together with the history of the earlier ones. */
+#define NETWORK_ZSTD_LEVEL 3
+#define NETWORK_ZSTD_WINDOW_LOG 17  // 128 KiB of history per listener
+
+/* unix socket for listeners on the same host */
+#define NETWORK_SOCKET "/run/univention-directory-notifier.socket"
+
 typedef struct network_client {
 	int fd;
 	callback_handler handler;
@@ -53,15 +93,36 @@ typedef struct network_client {
 	enum network_protocol version;
 	unsigned long next_id;
 	unsigned long msg_id;
-	struct network_client *next;
+	unsigned long req_msg_id;  // MSGID of the text request being read
+	int binary;
+	int binary_next;  // BINARY negotiated, framing starts after the empty line
+	ZSTD_CCtx *zstd;  // ZSTD negotiated, compresses the output
+	int subscribed;  // SUBSCRIBE: push transactions from sub_next on
+	unsigned long sub_msg_id;
+	unsigned long sub_next;
+	unsigned long credits;  // transactions which may be pushed
+	char *buf;  // input, partial lines or binary frames
+	size_t buf_len;
+	size_t buf_size;
+	char *out;  // queued output, unsent from out_pos on
+	size_t out_pos;
+	size_t out_len;
+	size_t out_size;
+	unsigned long wait_id;  // lowest transaction ID waited for
+	int wait_pos;  // index in the waiter heap or -1
+	unsigned long served_id;  // highest transaction ID sent, read by STATS
+	int reading;  // a reader thread reads for a request, the later ones wait
+	struct network_client *all_prev, *all_next;  // listener connections of all reactors
+	struct network_client *next;  // removed clients
 } NetworkClient_t;
 
 int network_create_socket( int port );
+int network_create_local_socket( const char *path );
 
 int network_client_del ( int fd );
 
 int network_client_main_loop ( );
-int network_client_init ( int port );
+int network_client_init ( int port, const char *path, int threads );
 
 int network_client_dump ( );
 
@@ -70,8 +131,24 @@ int network_client_set_next_id( int fd, unsigned long id );
 int network_client_set_msg_id( int fd, unsigned long msg_id );
 int network_client_set_version( int fd, int version );
 int network_client_get_version( int fd );
+NetworkClient_t *network_client_get( int fd );
+void network_client_update_waiting( NetworkClient_t *client );
+int network_client_reply( NetworkClient_t *client, unsigned long msg_id, const char *body, size_t len );
+int network_client_send( NetworkClient_t *client, const char *buf, size_t len );
+int network_client_compress( NetworkClient_t *client );
 int network_client_check_clients ( unsigned long last_known_id ) ;
+void network_client_stats( FILE *out );
+struct reader_job;
+void network_client_read( NetworkClient_t *client, struct reader_job *job );
+
+/* Record that transactions up to @id were sent to @client. */
+static inline void network_client_served( NetworkClient_t *client, unsigned long id )
+{
+	if (id > client->served_id)
+		__atomic_store_n(&client->served_id, id, __ATOMIC_RELAXED);
+}
 
 extern enum network_protocol network_procotol_version;
+extern unsigned long long network_client_output_max;
 
 #endif
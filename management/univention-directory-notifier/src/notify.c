@@ -42,16 +42,22 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <limits.h>
 #include <time.h>
 #include <ldap.h>
 #include <sasl/sasl.h>
 #include <assert.h>
+#include <pthread.h>
 #include <univention/debug.h>
 
 #include "notify.h"
 #include "network.h"
 #include "cache.h"
 #include "index.h"
+#include "segment.h"
+#include "stats.h"
 
 #define MAX_PATH_LEN 4096
 #define MAX_LINE 4096
@@ -60,22 +66,21 @@ extern NotifyId_t notify_last_id;
 extern Notify_t notify;
 extern long long notifier_lock_count;
 extern long long notifier_lock_time;
-extern void set_listener_callback(int sig, siginfo_t *si, void *data);
+extern unsigned long long notifier_segment_bytes;
 extern void unset_listener_callback ();
 
 extern unsigned long SCHEMA_ID;
 
-static FILE* fopen_lock(const char *name, const char *type)
+/* lockf() does not exclude the reactor threads from each other, and all of
+   them share the FILE pointers in notify */
+static pthread_mutex_t transaction_file_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Lock @file named @name, retrying notifier_lock_count times. */
+static void lock_file(FILE *file, const char *name)
 {
-	FILE *file;
 	int count = 0;
 	int fd;
 
-	if ((file = fopen(name, type)) == NULL) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "ERROR Could not open file [%s]", name);
-		return NULL;
-	}
-
 	fd = fileno(file);
 	for (;;) {
 		int rc = lockf(fd, F_TLOCK, 0);
@@ -89,6 +94,18 @@ static FILE* fopen_lock(const char *name, const char *type)
 		}
 		usleep(notifier_lock_time);
 	}
+}
+
+static FILE* fopen_lock(const char *name, const char *type)
+{
+	FILE *file;
+
+	if ((file = fopen(name, type)) == NULL) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "ERROR Could not open file [%s]", name);
+		return NULL;
+	}
+
+	lock_file(file, name);
 
 	return file;
 }
@@ -119,7 +136,9 @@ static FILE* fopen_with_lockfile(const char *name, const char *type, FILE **l_fi
 		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK %s", FILE_NAME_TF_IDX);
 	}
 
+	pthread_mutex_lock(&transaction_file_lock);
 	if ((*l_file = fopen_dotlockfile(name)) == NULL) {
+		pthread_mutex_unlock(&transaction_file_lock);
 		return NULL;
 	}
 
@@ -130,6 +149,7 @@ static FILE* fopen_with_lockfile(const char *name, const char *type, FILE **l_fi
 		lockf(l_fd, F_ULOCK, 0);
 		fclose(*l_file);
 		*l_file = NULL;
+		pthread_mutex_unlock(&transaction_file_lock);
 	}
 
 	return file;
@@ -157,7 +177,11 @@ static int fclose_with_lockfile(const char *name, FILE **file, FILE **l_file)
 		*file = NULL;
 	}
 
-	fclose_lock(l_file);
+	/* the mutex was already released if fopen_with_lockfile() failed */
+	if (*l_file != NULL) {
+		fclose_lock(l_file);
+		pthread_mutex_unlock(&transaction_file_lock);
+	}
 
 	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "FCLOSE end");
 
@@ -182,43 +206,86 @@ static int parse_transaction_line(NotifyEntry_t* entry, char* line)
 	return sscanf(line, "%ld", &(entry->notify_id.id)) == 1 && entry->notify_id.id > 0 && entry->dn;
 }
 
-static void notify_dump_to_files( Notify_t *notify, NotifyEntry_t *entry)
+/* Append the @count > 0 transactions in @entries to the transaction file
+   and the index with one write each. */
+static void notify_dump_to_files(Notify_t *notify, NotifyEntry_t *entries, size_t count)
 {
-	char buffer[2048];
-	FILE *index = NULL;
+	char ids[count][24], cmds[count][4];
+	struct iovec iov[count * 3], *v = iov;
+	size_t offsets[count], len = 0, i, span;
+	int index = -1, fd, iovcnt = count * 3;
+	off_t offset;
+	ssize_t l;
 
 	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from dump_to_files");
 	if ((notify->tf = fopen_with_lockfile(FILE_NAME_TF, "a", &(notify->l_tf))) == NULL) {
 		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "ERROR on open tf");
 		goto error;
 	}
-	if ((index = index_open(FILE_NAME_TF_IDX)) == NULL) {
+	if ((index = index_open(FILE_NAME_TF_IDX)) < 0) {
 		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "unable to open index");
 		goto error;
 	}
-
-	long offset = ftell(notify->tf);
-	int len = snprintf(buffer, sizeof(buffer), "%ld %s %c\n", entry->notify_id.id, entry->dn, entry->command);
-	if (len >= sizeof(buffer)) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "buffer too small");
+	fd = fileno(notify->tf);
+	if ((offset = lseek(fd, 0, SEEK_END)) < 0) {
+		perror("Failed lseek(tf)");
 		abort();
 	}
 
-	index_set(index, entry->notify_id.id, offset);
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "want to write to transaction file; id=%ld", entry->notify_id.id);
-	if (fallocate(fileno(notify->tf), FALLOC_FL_KEEP_SIZE, offset, len) == -1 && (errno != ENOSYS) && (errno != EOPNOTSUPP)) {
+	/* "<id> " "<dn>" " <cmd>\n" */
+	for (i = 0; i < count; i++) {
+		offsets[i] = offset + len;
+		iov[i * 3].iov_base = ids[i];
+		iov[i * 3].iov_len = snprintf(ids[i], sizeof(ids[i]), "%ld ", entries[i].notify_id.id);
+		iov[i * 3 + 1].iov_base = entries[i].dn;
+		iov[i * 3 + 1].iov_len = strlen(entries[i].dn);
+		iov[i * 3 + 2].iov_base = cmds[i];
+		iov[i * 3 + 2].iov_len = snprintf(cmds[i], sizeof(cmds[i]), " %c\n", entries[i].command);
+		len += iov[i * 3].iov_len + iov[i * 3 + 1].iov_len + iov[i * 3 + 2].iov_len;
+	}
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "want to write to transaction file; id=%ld-%ld", entries[0].notify_id.id, entries[count - 1].notify_id.id);
+	if (fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, len) == -1 && (errno != ENOSYS) && (errno != EOPNOTSUPP)) {
 		perror("Failed fallocate(tf)");
 		abort();
 	}
-	if (fprintf(notify->tf, "%s", buffer) != len) {
-		perror("Failed fprintf(tf)");
+	while (iovcnt > 0) {
+		if ((l = writev(fd, v, iovcnt > IOV_MAX ? IOV_MAX : iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("Failed writev(tf)");
+			abort();
+		}
+		/* continue after a short write */
+		for (; iovcnt > 0 && l >= v->iov_len; v++, iovcnt--)
+			l -= v->iov_len;
+		if (iovcnt > 0) {
+			v->iov_base = (char *)v->iov_base + l;
+			v->iov_len -= l;
+		}
+	}
+	if (fdatasync(fd) == -1) {
+		perror("Failed fdatasync(tf)");
 		abort();
 	}
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "wrote to transaction file; id=%ld; dn=%s, cmd=%c", entry->notify_id.id, entry->dn, entry->command);
+	/* the IDs are usually consecutive, so the index entries are written at
+	   once unless there are large gaps */
+	span = entries[count - 1].notify_id.id - entries[0].notify_id.id + 1;
+	if (span <= 2 * count) {
+		size_t range[span];
+		memset(range, 0xff, sizeof(range));
+		for (i = 0; i < count; i++)
+			range[entries[i].notify_id.id - entries[0].notify_id.id] = offsets[i];
+		index_set_range(index, entries[0].notify_id.id, span, range);
+	} else {
+		for (i = 0; i < count; i++)
+			index_set(index, entries[i].notify_id.id, offsets[i]);
+	}
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "wrote %zu transactions to transaction file", count);
 
 error:
-	if (index)
-		fclose(index);
+	if (index >= 0)
+		close(index);
 	fclose_with_lockfile(FILE_NAME_TF, &notify->tf, &notify->l_tf);
 }
 
@@ -247,45 +314,65 @@ static int sasl_proc(LDAP *ld, unsigned flags, void *defaults, void *in) {
 	}
 }
 
+static LDAP *ld = NULL;
+
+/* Transactions sent to cn=translog, whose results are still outstanding.
+   They are completed together in order. */
+#define TRANSLOG_PENDING 64
+static NotifyEntry_t translog_entries[TRANSLOG_PENDING];
+static char *translog_lines[TRANSLOG_PENDING];
+static int translog_msgids[TRANSLOG_PENDING];
+static struct timespec translog_sent[TRANSLOG_PENDING];
+static size_t translog_count;
+
 /*
- * Write entries to cn=translog.
- * :param trans: Linked list of entries to write.
+ * (Re-)Connect to the LDAP server for writing to cn=translog.
  */
-static void notify_dump_to_ldap(NotifyEntry_t *trans) {
-	static LDAP *ld = NULL;
+static void translog_open(void) {
 	LDAPControl **serverctrls = NULL;
 	LDAPControl **clientctrls = NULL;
 	int rc;
-	struct sigaction oldact, act = {
-		.sa_handler = SIG_IGN,
-		.sa_flags = 0,
-	};
 
-	// libldap uses liblber uses write() on the SOCKET to slapd, which raises SIGPIPE when slapd closes the socket due to a timeout.
-	sigaction(SIGPIPE, &act, &oldact);
+	if (ld) {
+		if ((rc = ldap_unbind_ext_s(ld, serverctrls, clientctrls)) != LDAP_SUCCESS)
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "ldap_unbind_ext_s(): %s", ldap_err2string(rc));
+		ld = NULL;
+	}
 
-reopen:
-	if (!ld) {
-		if ((rc = ldap_initialize(&ld, "ldapi:///")) != LDAP_SUCCESS) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ldap_initialize(): %s", ldap_err2string(rc));
-			abort();
-		}
+	if ((rc = ldap_initialize(&ld, "ldapi:///")) != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ldap_initialize(): %s", ldap_err2string(rc));
+		abort();
+	}
 
-		unsigned long version = LDAP_VERSION3;
-		if ((rc = ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &version)) != LDAP_SUCCESS) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ldap_set_option(): %s", ldap_err2string(rc));
-			abort();
-		}
+	unsigned long version = LDAP_VERSION3;
+	if ((rc = ldap_set_option(ld, LDAP_OPT_PROTOCOL_VERSION, &version)) != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ldap_set_option(): %s", ldap_err2string(rc));
+		abort();
+	}
 
-		const char *who = NULL;
-		const char mechanism[] = "EXTERNAL";
-		unsigned flags = LDAP_SASL_QUIET;
-		void *defaults = NULL;
-		if ((rc = ldap_sasl_interactive_bind_s(ld, who, mechanism, serverctrls, clientctrls, flags, sasl_proc, defaults)) != LDAP_SUCCESS) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ldap_sasl_interactive_bind_s(): %s", ldap_err2string(rc));
-			abort();
-		}
+	const char *who = NULL;
+	const char mechanism[] = "EXTERNAL";
+	unsigned flags = LDAP_SASL_QUIET;
+	void *defaults = NULL;
+	if ((rc = ldap_sasl_interactive_bind_s(ld, who, mechanism, serverctrls, clientctrls, flags, sasl_proc, defaults)) != LDAP_SUCCESS) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ldap_sasl_interactive_bind_s(): %s", ldap_err2string(rc));
+		abort();
 	}
+}
+
+/*
+ * Send an entry to cn=translog without waiting for the result.
+ * :param trans: The entry to write.
+ * :param msgid: Returns the message ID of the request.
+ * :returns: LDAP_SUCCESS or LDAP_SERVER_DOWN.
+ */
+static int notify_dump_to_ldap(NotifyEntry_t *trans, int *msgid) {
+	LDAPControl **serverctrls = NULL;
+	LDAPControl **clientctrls = NULL;
+	int rc;
+
+	if (!ld)
+		translog_open();
 
 	char dn[44]; // strlen("reqSession=%ld,cn=translog") + strlen(ULONG_MAX)
 	snprintf(dn, sizeof(dn), "reqSession=%ld,cn=translog", trans->notify_id.id);
@@ -348,24 +435,99 @@ reopen:
 	for (rc = 0; attrs[rc]; rc++)
 		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LDIF %s: %s", attrs[rc]->mod_type, attrs[rc]->mod_values[0]);
 
-	rc = ldap_add_ext_s(ld, dn, attrs, serverctrls, clientctrls);
+	rc = ldap_add_ext(ld, dn, attrs, serverctrls, clientctrls, msgid);
 	switch (rc) {
 		case LDAP_SUCCESS:
-			break;
 		case LDAP_SERVER_DOWN:
-			if ((rc = ldap_unbind_ext_s(ld, serverctrls, clientctrls)) != LDAP_SUCCESS)
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "%ld ldap_unbind_ext_s(): %s", trans->notify_id.id, ldap_err2string(rc));
-			ld = NULL;
-			goto reopen;
-		case LDAP_ALREADY_EXISTS:
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "%ld ldap_add() already exists", trans->notify_id.id);
-			break;
+			return rc;
 		default:
 			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%ld ldap_add(): %s", trans->notify_id.id, ldap_err2string(rc));
 			abort();
 	}
+}
 
-	sigaction(SIGPIPE, &oldact, NULL);
+/* Reconnect and send all outstanding transactions again. */
+static void translog_resend(void)
+{
+	size_t i;
+
+retry:
+	translog_open();
+	for (i = 0; i < translog_count; i++)
+		if (notify_dump_to_ldap(&translog_entries[i], &translog_msgids[i]) != LDAP_SUCCESS)
+			goto retry;
+}
+
+/* Queue the transaction @entry read from @line for cn=translog. Takes
+   ownership of entry->dn. */
+static void translog_send(NotifyEntry_t *entry, const char *line)
+{
+	size_t i = translog_count;
+
+	assert(translog_count < TRANSLOG_PENDING);
+	translog_entries[i] = *entry;
+	if ((translog_lines[i] = strdup(line)) == NULL)
+		abort();  // FIXME
+	translog_count++;
+	clock_gettime(CLOCK_MONOTONIC, &translog_sent[i]);
+	if (notify_dump_to_ldap(&translog_entries[i], &translog_msgids[i]) != LDAP_SUCCESS)
+		translog_resend();
+}
+
+/* Wait for the outstanding transaction @i to be written to cn=translog. */
+static void translog_wait(size_t i)
+{
+	NotifyEntry_t *entry = &translog_entries[i];
+	LDAPMessage *res;
+	int rc, err;
+
+	for (;;) {
+		if (ldap_result(ld, translog_msgids[i], LDAP_MSG_ALL, NULL, &res) > 0) {
+			if ((rc = ldap_parse_result(ld, res, &err, NULL, NULL, NULL, NULL, 1)) == LDAP_SUCCESS)
+				rc = err;
+		} else if (ldap_get_option(ld, LDAP_OPT_RESULT_CODE, &rc) != LDAP_OPT_SUCCESS) {
+			rc = LDAP_SERVER_DOWN;
+		}
+		switch (rc) {
+			case LDAP_SUCCESS:
+				stats_ldap_write(&translog_sent[i]);
+				return;
+			case LDAP_SERVER_DOWN:
+				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "%ld ldap_result(): %s", entry->notify_id.id, ldap_err2string(rc));
+				translog_resend();
+				continue;
+			case LDAP_ALREADY_EXISTS:
+				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "%ld ldap_add() already exists", entry->notify_id.id);
+				return;
+			default:
+				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "%ld ldap_add(): %s", entry->notify_id.id, ldap_err2string(rc));
+				abort();
+		}
+	}
+}
+
+/* Wait for all outstanding transactions to be written to cn=translog, then
+   append them to the transaction file and notify the clients. */
+static void translog_flush(void)
+{
+	size_t i;
+
+	if (translog_count == 0)
+		return;
+	for (i = 0; i < translog_count; i++)
+		translog_wait(i);
+
+	notify_dump_to_files(&notify, translog_entries, translog_count);
+	for (i = 0; i < translog_count; i++) {
+		NotifyEntry_t *entry = &translog_entries[i];
+		notifier_cache_add(entry->notify_id.id, entry->dn, entry->command);
+		/* read by the reactor threads */
+		__atomic_store_n(&notify_last_id.id, entry->notify_id.id, __ATOMIC_RELEASE);
+		network_client_all_write(entry->notify_id.id, translog_lines[i], strlen(translog_lines[i]));
+		free(entry->dn);
+		free(translog_lines[i]);
+	}
+	translog_count = 0;
 }
 
 void notify_init ( Notify_t *notify )
@@ -375,117 +537,372 @@ void notify_init ( Notify_t *notify )
 }
 
 
-int notify_transaction_get_last_notify_id ( Notify_t *notify, NotifyId_t *notify_id )
+/* Read-only mapping of a file, which is remapped when it was replaced or
+   has changed its size. */
+struct file_map {
+	const char *name;
+	char *data;
+	size_t size;
+	dev_t dev;
+	ino_t ino;
+};
+
+static struct file_map tf_map = {.name = FILE_NAME_TF};
+static struct file_map idx_map = {.name = FILE_NAME_TF_IDX};
+/* kept open to lock the transaction file for the readers */
+static FILE *tf_lock_file;
+
+static void file_map_release(struct file_map *map)
 {
-	int i = 2;
-	char c;
+	if (map->data)
+		munmap(map->data, map->size);
+	map->data = NULL;
+	map->size = 0;
+}
 
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from notify_transaction_get_last_notify_id");
-	if ((notify->tf = fopen_with_lockfile(FILE_NAME_TF, "r", &(notify->l_tf))) == NULL) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "unable to lock notify_id");
-		notify_id->id = 0;
+static int file_map_update(struct file_map *map)
+{
+	struct stat st;
+	int fd;
+
+	if (stat(map->name, &st) != 0) {
+		file_map_release(map);
 		return -1;
 	}
+	if (map->data && st.st_dev == map->dev && st.st_ino == map->ino && st.st_size == map->size)
+		return 0;
 
-	do {
-		i++;
-		fseek( notify->tf, -i, SEEK_END);
-		c = fgetc ( notify->tf ) ;
-	} while ( c != '\n' && c != -1 && c != 255 && ftell(notify->tf) != 1);
+	file_map_release(map);
+	if ((fd = open(map->name, O_RDONLY | O_CLOEXEC)) < 0)
+		return -1;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return -1;
+	}
+	/* an empty file is not mapped, e.g. right after sealing a segment */
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+	map->data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map->data == MAP_FAILED) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "mmap(%s) failed: %s", map->name, strerror(errno));
+		map->data = NULL;
+		return -1;
+	}
+	map->size = st.st_size;
+	map->dev = st.st_dev;
+	map->ino = st.st_ino;
+	return 0;
+}
 
-	if ( c == -1 || c == 255 ) {
-		/* empty file */
-		notify_id->id = 0;
-	} else if ( ftell(notify->tf) == 1) {
-		/* only one entry */
-		fseek( notify->tf, 0, SEEK_SET);
-		fscanf(notify->tf, "%ld",& (notify_id->id));
-	} else {
-		fscanf(notify->tf, "%ld",& (notify_id->id));
+/* Lock and map the transaction file for reading. Returns 0 on success,
+   after which tf_unlock() must be called. */
+static int tf_lock(void)
+{
+	char name[MAX_PATH_LEN];
+
+	pthread_mutex_lock(&transaction_file_lock);
+	if (tf_lock_file == NULL) {
+		snprintf(name, sizeof(name), "%s.lock", FILE_NAME_TF);
+		if ((tf_lock_file = fopen(name, "a")) == NULL) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "ERROR Could not open lock file [%s]", name);
+			pthread_mutex_unlock(&transaction_file_lock);
+			return -1;
+		}
 	}
+	lock_file(tf_lock_file, FILE_NAME_TF);
 
-	fclose_with_lockfile(FILE_NAME_TF, &notify->tf, &notify->l_tf);
+	if (file_map_update(&tf_map) != 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "unable to map tf");
+		lockf(fileno(tf_lock_file), F_ULOCK, 0);
+		pthread_mutex_unlock(&transaction_file_lock);
+		return -1;
+	}
+	/* a missing index is rebuilt by the lookups */
+	file_map_update(&idx_map);
 
 	return 0;
 }
 
+static void tf_unlock(void)
+{
+	lockf(fileno(tf_lock_file), F_ULOCK, 0);
+	pthread_mutex_unlock(&transaction_file_lock);
+}
 
-char* notify_transcation_get_one_dn ( unsigned long last_known_id )
+/* Parse the transaction ID at the start of the mapped line @line. */
+unsigned long notify_line_id(const char *line, const char *end)
 {
-	char buffer[2048];
-	int i;
-	char c;
-	unsigned long id;
-	bool found = false;
-	FILE *index = NULL;
-	size_t pos;
+	unsigned long id = 0;
 
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from notify_transcation_get_one_dn");
-	if ((notify.tf = fopen_with_lockfile(FILE_NAME_TF, "r", &(notify.l_tf))) == NULL) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "unable to lock tf");
+	while (line < end && *line >= '0' && *line <= '9')
+		id = id * 10 + (*line++ - '0');
+	return line < end && *line == ' ' ? id : 0;
+}
+
+/* Return the end of the complete line at @pos of the mapped transaction
+   file, or NULL. */
+static const char *tf_line_end(size_t pos)
+{
+	if (pos >= tf_map.size)
 		return NULL;
+	return memchr(tf_map.data + pos, '\n', tf_map.size - pos);
+}
+
+static size_t idx_map_get(unsigned long id)
+{
+	size_t offset = index_entry_pos(id);
+	const struct index_header *header = (const struct index_header *)idx_map.data;
+
+	if (idx_map.data == NULL || offset + sizeof(struct index_entry) > idx_map.size || le64toh(header->magic) != MAGIC)
+		return -1;
+	return index_entry_offset((const struct index_entry *)(idx_map.data + offset));
+}
+
+/* Find the line of transaction @id by bisecting the transaction file, whose
+   lines are ordered by ID. Returns its offset or -1. */
+static size_t tf_bisect(unsigned long id)
+{
+	size_t lo = 0, hi = tf_map.size;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2, start = lo;
+		const char *p, *end;
+		unsigned long tid;
+
+		/* the first line starting at or after mid, or the first one */
+		if (mid > lo && (p = memchr(tf_map.data + mid - 1, '\n', hi - mid)) != NULL)
+			start = p + 1 - tf_map.data;
+		if ((end = tf_line_end(start)) == NULL)
+			return -1;
+		tid = notify_line_id(tf_map.data + start, end);
+		if (tid == id)
+			return start;
+		if (tid == 0)
+			return -1;
+		if (tid < id)
+			lo = end + 1 - tf_map.data;
+		else
+			hi = start;
 	}
-	if ( ( index = index_open(FILE_NAME_TF_IDX) ) == NULL ) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "unable to open index");
-		goto error;
+	return -1;
+}
+
+/* Rebuild the index by scanning all lines for the newlines up to transaction
+   @id. Returns the offset of its line or -1. */
+static size_t tf_rebuild_index(int index, unsigned long id)
+{
+	size_t pos = 0;
+	const char *end;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Rebuilding index for %ld", id);
+	while ((end = tf_line_end(pos)) != NULL) {
+		unsigned long tid = notify_line_id(tf_map.data + pos, end);
+
+		if (tid != 0)
+			index_set(index, tid, pos);
+		if (tid == id)
+			return pos;
+		pos = end + 1 - tf_map.data;
 	}
+	return -1;
+}
 
-	i=0;
-	memset(buffer, 0, sizeof(buffer));
-
-	if ((pos = index_get(index, last_known_id)) != -1) {
-		fseek(notify.tf, pos, SEEK_SET);
-		if (fgets(buffer, sizeof(buffer), notify.tf) != NULL) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "BUFFER=%s", buffer);
-			if ( buffer[strlen(buffer)-1] == '\n' ) {
-				buffer[strlen(buffer)-1] = '\0';
-			}
-			sscanf(buffer, "%ld", &id);
-			if (id == last_known_id) {
-				found = true;
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Found (get_one_dn, index) %ld", id);
-			}
-		}
+/* Return the offset of the line of transaction @id, with the lock held. */
+static size_t tf_find(unsigned long id)
+{
+	size_t pos;
+	const char *end;
+	int index;
+
+	if ((pos = idx_map_get(id)) != -1 && (end = tf_line_end(pos)) != NULL && notify_line_id(tf_map.data + pos, end) == id) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Found (index) %ld", id);
+		return pos;
 	}
 
-	fseek(notify.tf, 0, SEEK_SET);
-	pos = 0;
-	while (!found && (c=fgetc(notify.tf)) != EOF ) {
-		if ( c == 255 ) {
-			break;
-		}
+	if ((index = index_open(FILE_NAME_TF_IDX)) < 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "unable to open index");
+		return -1;
+	}
+	if ((pos = tf_bisect(id)) != -1) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Found (bisect) %ld", id);
+		index_set(index, id, pos);
+	} else {
+		pos = tf_rebuild_index(index, id);
+	}
+	close(index);
+	return pos;
+}
 
-		if ( c == '\n' ) {
-			sscanf(buffer, "%ld", &id) ;
+/* Return the line of transaction @id in the sealed segments or the
+   transaction file, with the lock held. @limit is set to the end of the lines
+   of the same file. */
+static const char *tf_lookup(unsigned long id, const char **limit)
+{
+	size_t pos;
 
-			index_set(index, id, pos);
+	if (id <= segment_last_id())
+		return segment_find(id, limit);
+	if ((pos = tf_find(id)) == -1)
+		return NULL;
+	*limit = tf_map.data + tf_map.size;
+	return tf_map.data + pos;
+}
 
-			if ( id == last_known_id ) {
-				found = true;
-				univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Found (get_one_dn) %ld", id);
-				break;
-			}
+/* Move the transaction file into a new sealed segment once it has grown
+   beyond notifier_segment_bytes. */
+static void tf_seal(void)
+{
+	FILE *tf, *l_tf;
+	struct stat st;
 
-			i=0;
-			pos=ftell(notify.tf);
-			memset(buffer, 0, 2048);
-		} else {
-			buffer[i] = c;
-			i++;
-		}
+	if (notifier_segment_bytes == 0)
+		return;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from tf_seal");
+	if ((tf = fopen_with_lockfile(FILE_NAME_TF, "r+", &l_tf)) == NULL)
+		return;
+	if (fstat(fileno(tf), &st) != 0 || st.st_size < notifier_segment_bytes)
+		goto out;
+
+	if (file_map_update(&tf_map) != 0 || tf_map.data == NULL || segment_seal(tf_map.data, tf_map.size) != 0)
+		goto out;
+	if (ftruncate(fileno(tf), 0) != 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ftruncate(tf) failed: %s", strerror(errno));
+		goto out;
 	}
+	unlink(FILE_NAME_TF_IDX);
+	file_map_release(&tf_map);
+	file_map_release(&idx_map);
 
-error:
-	if (index)
-		fclose(index);
-	fclose_with_lockfile(FILE_NAME_TF, &notify.tf, &notify.l_tf);
+out:
+	fclose_with_lockfile(FILE_NAME_TF, &tf, &l_tf);
+}
 
-	if (found && strlen(buffer) > 0) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Return str [%s]", buffer);
-		return strdup(buffer);
-	} else {
+char* notify_transcation_get_one_dn ( unsigned long last_known_id )
+{
+	char *line = NULL;
+	const char *pos, *end, *limit;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from notify_transcation_get_one_dn");
+	stats_file_read();
+	if (tf_lock() != 0)
 		return NULL;
+
+	if ((pos = tf_lookup(last_known_id, &limit)) != NULL && (end = memchr(pos, '\n', limit - pos)) != NULL)
+		line = strndup(pos, end - pos);
+
+	tf_unlock();
+
+	if (line)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Return str [%s]", line);
+	return line;
+}
+
+/* Read the ID of the last complete line of the transaction file. The file
+   is mapped, so only its last pages are read while searching backwards. */
+int notify_transaction_get_last_notify_id ( Notify_t *notify, NotifyId_t *notify_id )
+{
+	const char *line, *end;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from notify_transaction_get_last_notify_id");
+	if (tf_lock() != 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "unable to lock notify_id");
+		notify_id->id = 0;
+		return -1;
+	}
+
+	if (tf_map.data == NULL || (end = memrchr(tf_map.data, '\n', tf_map.size)) == NULL) {
+		/* empty file, possibly after sealing it into a segment */
+		notify_id->id = segment_last_id();
+	} else {
+		line = memrchr(tf_map.data, '\n', end - tf_map.data);
+		line = line ? line + 1 : tf_map.data;
+		notify_id->id = notify_line_id(line, end);
 	}
+
+	tf_unlock();
+
+	return 0;
+}
+
+/* Read the complete lines within the last @size bytes of the transaction file
+   into a new buffer returned in @buf with its length in @len.
+   Returns 0 on success. */
+int notify_transaction_get_tail(size_t size, char **buf, size_t *len)
+{
+	size_t start, end;
+	const char *nl;
+
+	*buf = NULL;
+	*len = 0;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from notify_transaction_get_tail");
+	if (tf_lock() != 0)
+		return -1;
+
+	if (tf_map.data == NULL) {
+		tf_unlock();
+		*buf = strdup("");
+		return *buf ? 0 : -1;
+	}
+
+	/* only complete lines at both ends */
+	start = tf_map.size > size ? tf_map.size - size : 0;
+	if (start > 0)
+		start = (nl = memchr(tf_map.data + start - 1, '\n', tf_map.size - start + 1)) ? nl + 1 - tf_map.data : tf_map.size;
+	for (end = tf_map.size; end > start && tf_map.data[end - 1] != '\n'; end--)
+		;
+	if ((*buf = malloc(end - start + 1)) == NULL)
+		abort();  // FIXME
+	memcpy(*buf, tf_map.data + start, end - start);
+	(*buf)[end - start] = '\0';
+	*len = end - start;
+
+	tf_unlock();
+
+	return 0;
+}
+
+/* Append consecutive transactions starting with @id to @buf.
+   At most @count lines are appended as long as they fit into @size bytes
+   including the terminating NUL. Returns the number of transactions appended. */
+unsigned long notify_transaction_get_dn_range(unsigned long id, unsigned long count, char *buf, size_t size)
+{
+	unsigned long found = 0;
+	size_t len = strlen(buf), l;
+	const char *pos, *end, *limit;
+	bool sealed;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from notify_transaction_get_dn_range");
+	stats_file_read();
+	if (tf_lock() != 0)
+		return 0;
+
+	/* a range may continue from one sealed segment into the next file */
+	do {
+		sealed = id + found <= segment_last_id();
+		if ((pos = tf_lookup(id + found, &limit)) == NULL)
+			break;
+		while (found < count && (end = memchr(pos, '\n', limit - pos)) != NULL) {
+			if (notify_line_id(pos, end) != id + found)
+				goto out;
+			l = end + 1 - pos;
+			if (len + l >= size)
+				goto out;
+			memcpy(buf + len, pos, l);
+			len += l;
+			buf[len] = '\0';
+			pos += l;
+			found++;
+		}
+	} while (sealed && found < count && pos == limit);
+
+out:
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Found (get_dn_range) %lu from %lu", found, id);
+	tf_unlock();
+
+	return found;
 }
 
 void notify_schema_change_callback(int sig, siginfo_t *si, void *data)
@@ -504,71 +921,147 @@ void notify_schema_change_callback(int sig, siginfo_t *si, void *data)
 	fclose(file);
 }
 
-void notify_listener_change_callback(int sig, siginfo_t *si, void *data)
+/* Process the complete transaction lines in @buf read from @name. */
+static void notify_process_lines(const char *buf, size_t size, const char *name)
 {
 	NotifyEntry_t entry = {0,};
-	FILE *file, *l_file;
-	int fd;
-	int rc;
-	struct stat stat_buf;
+	unsigned long last_id = notify_last_id.id;
+	const char *pos, *end;
+	struct sigaction oldact, act = {
+		.sa_handler = SIG_IGN,
+		.sa_flags = 0,
+	};
 
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "NOTIFY Listener" );
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "... go");
-
-	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from notify_listener_change_callback");
-	rc = stat(FILE_NAME_NOTIFIER_PRIV, &stat_buf);
-	if ( (rc == -1) || (stat_buf.st_size == 0) ) {
-		rc = stat(FILE_NAME_LISTENER, &stat_buf);
-		if ( (rc == -1) || (stat_buf.st_size == 0) ) {
-			return;
-		}
+	// libldap uses liblber uses write() on the SOCKET to slapd, which raises SIGPIPE when slapd closes the socket due to a timeout.
+	sigaction(SIGPIPE, &act, &oldact);
 
-		if ( ( l_file = fopen_dotlockfile ( FILE_NAME_LISTENER ) ) == NULL ) {
-			exit(0);
+	for (pos = buf; pos < buf + size && (end = memchr(pos, '\n', buf + size - pos)) != NULL; pos = end + 1) {
+		char *line = strndup(pos, end + 1 - pos);
+		if (line == NULL)
+			abort();  // FIXME
+		if (!parse_transaction_line(&entry, line)) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ABORTING EXECUTION: Invalid transaction line %s of file %s", line, name);
+			abort();
 		}
+		if (entry.notify_id.id <= last_id) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Skipping old Transaction ID %ld before %ld from %s", entry.notify_id.id, last_id, name);
+			free(entry.dn);
+			free(line);
+			continue;
+		}
+		last_id = entry.notify_id.id;
+		/* the adds to cn=translog are pipelined and the files are written in batches */
+		if (translog_count == TRANSLOG_PENDING)
+			translog_flush();
+		translog_send(&entry, line);
+		free(line);
+	}
+	translog_flush();
 
-		rename(FILE_NAME_LISTENER, FILE_NAME_NOTIFIER_PRIV);
+	sigaction(SIGPIPE, &oldact, NULL);
+}
 
-		// Some tools expect the file to exist
-		fd = open(FILE_NAME_LISTENER, O_RDWR | O_CREAT, stat_buf.st_mode);
-		if (fd != -1) {
-			fchown(fd, stat_buf.st_uid, stat_buf.st_gid);
-			close(fd);
-		}
+/* Read the file @name into a new buffer returned with its size in @size, or
+   NULL if it is empty or missing. */
+static char *read_file(const char *name, size_t *size)
+{
+	struct stat st;
+	char *buf = NULL;
+	FILE *file;
 
-		unset_listener_callback();
-		fclose_lock(&l_file);
-	} else {
-		set_listener_callback(0, NULL, NULL);
+	*size = 0;
+	if (access(name, F_OK) != 0 || (file = fopen_lock(name, "r+")) == NULL)
+		return NULL;
+	if (fstat(fileno(file), &st) == 0 && st.st_size > 0) {
+		if ((buf = malloc(st.st_size)) == NULL)
+			abort();  // FIXME
+		*size = fread(buf, 1, st.st_size, file);
 	}
+	fclose_lock(&file);
+	return buf;
+}
 
-	if ( ( file = fopen_lock (FILE_NAME_NOTIFIER_PRIV, "r+") ) == NULL ) {
-		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "Could not open %s", FILE_NAME_NOTIFIER_PRIV);
-	}
+/* Offset up to which the listener file has been processed. */
+static off_t listener_offset;
 
-	char *line = NULL;
+/* Read the complete lines appended to the listener file since the last call
+   into a new buffer returned with its size in @size, or NULL if there are
+   none. Once everything has been processed, the file is truncated. */
+static char *listener_read(size_t *size)
+{
+	struct stat st;
+	char *buf = NULL, *nl;
+	FILE *l_file;
+	ssize_t l;
 	size_t len = 0;
-	while (getline(&line, &len, file) != -1) {
-		if (!parse_transaction_line(&entry, line)) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "ABORTING EXECUTION: Invalid transaction line %s of file %s", line, FILE_NAME_NOTIFIER_PRIV);
-			free(entry.dn);
-			free(line);
-			fclose_lock(&file);
-			abort();
-		}
-		if (entry.notify_id.id <= notify_last_id.id) {
-			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "Skipping old Transaction ID %ld before %ld from %s", entry.notify_id.id, notify_last_id.id, FILE_NAME_NOTIFIER_PRIV);
-			continue;
+	int fd;
+
+	*size = 0;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "LOCK from listener_read");
+	if ((l_file = fopen_dotlockfile(FILE_NAME_LISTENER)) == NULL)
+		exit(0);
+	/* read-only, as closing a writable file would trigger the inotify watch */
+	if ((fd = open(FILE_NAME_LISTENER, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) != 0)
+		goto out;
+
+	/* replaced or truncated by someone else */
+	if (st.st_size < listener_offset)
+		listener_offset = 0;
+	if (st.st_size == listener_offset) {
+		/* the writers append and keep the file in place */
+		if (listener_offset > 0 && truncate(FILE_NAME_LISTENER, 0) == 0)
+			listener_offset = 0;
+		goto out;
+	}
+
+	if ((buf = malloc(st.st_size - listener_offset)) == NULL)
+		abort();  // FIXME
+	while (len < st.st_size - listener_offset) {
+		if ((l = pread(fd, buf + len, st.st_size - listener_offset - len, listener_offset + len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "pread(%s) failed: %s", FILE_NAME_LISTENER, strerror(errno));
+			break;
 		}
-		notify_dump_to_ldap(&entry);
-		notify_dump_to_files(&notify, &entry);
-		notifier_cache_add(entry.notify_id.id, entry.dn, entry.command);
-		notify_last_id.id = entry.notify_id.id;
-		network_client_all_write(entry.notify_id.id, line, strlen(line));
-		free(entry.dn);
+		if (l == 0)
+			break;
+		len += l;
+	}
+	/* a partially written line is read again next time */
+	if ((nl = memrchr(buf, '\n', len)) == NULL) {
+		free(buf);
+		buf = NULL;
+		goto out;
 	}
+	*size = nl + 1 - buf;
+	listener_offset += *size;
+
+out:
+	if (fd >= 0)
+		close(fd);
+	fclose_lock(&l_file);
+	return buf;
+}
+
+void notify_listener_change_callback(int sig, siginfo_t *si, void *data)
+{
+	char *buf;
+	size_t size;
 
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ALL, "NOTIFY Listener" );
+	unset_listener_callback();
+
+	/* left over by an older version, which renamed the listener file */
+	if ((buf = read_file(FILE_NAME_NOTIFIER_PRIV, &size)) != NULL) {
+		notify_process_lines(buf, size, FILE_NAME_NOTIFIER_PRIV);
+		free(buf);
+	}
 	unlink(FILE_NAME_NOTIFIER_PRIV);
-	free(line);
-	fclose_lock(&file);
+
+	while ((buf = listener_read(&size)) != NULL) {
+		notify_process_lines(buf, size, FILE_NAME_LISTENER);
+		free(buf);
+	}
+
+	tf_seal();
 }
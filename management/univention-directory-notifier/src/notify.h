@@ -45,6 +45,8 @@
 /* transaction file, for notifier action */
 #define FILE_NAME_TF "/var/lib/univention-ldap/notify/transaction"
 #define FILE_NAME_TF_IDX "/var/lib/univention-ldap/notify/transaction.index"
+/* list of sealed transaction file segments: "<first id> <last id> <file>" */
+#define FILE_NAME_TF_MANIFEST "/var/lib/univention-ldap/notify/transaction.manifest"
 
 typedef struct {
 	unsigned long id;
@@ -64,6 +66,9 @@ typedef struct {
 void notify_init ( Notify_t *notify );
 int  notify_transaction_get_last_notify_id ( Notify_t *notify, NotifyId_t *notify_id );
 char* notify_transcation_get_one_dn ( unsigned long last_known_id );
+unsigned long notify_transaction_get_dn_range(unsigned long id, unsigned long count, char *buf, size_t size);
+int notify_transaction_get_tail(size_t size, char **buf, size_t *len);
+unsigned long notify_line_id(const char *line, const char *end);
 
 void notify_schema_change_callback(int sig, siginfo_t *si, void *data);
 void notify_listener_change_callback(int sig, siginfo_t *si, void *data);
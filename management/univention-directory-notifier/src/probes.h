@@ -0,0 +1,65 @@
+/*
+ * Univention Directory Notifier
+ *  probes.h
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __PROBES_H__
+#define __PROBES_H__
+
+/* USDT probes of the provider "univention_notifier", which are a single NOP
+   until traced, e.g. the delay from publishing a transaction until it is
+   sent to the listeners:
+     bpftrace -e 'usdt:/usr/sbin/univention-directory-notifier:univention_notifier:transaction_publish { @pub[arg0] = nsecs; }
+                  usdt:/usr/sbin/univention-directory-notifier:univention_notifier:client_wake { @[arg2] = hist(nsecs - @pub[arg1]); }'
+   Without <sys/sdt.h> they are left out.
+
+   transaction_publish(id, len): network_client_all_write()
+   client_wake(fd, id, version): a reactor wakes a client waiting for id
+   client_send(fd, msg_id, len): a reply is sent to the client */
+#ifdef __has_include
+#if __has_include(<sys/sdt.h>)
+#define HAVE_SDT 1
+#endif
+#endif
+
+#ifdef HAVE_SDT
+#include <sys/sdt.h>
+#define PROBE2(name, a, b) DTRACE_PROBE2(univention_notifier, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(univention_notifier, name, a, b, c)
+#else
+#define PROBE2(name, a, b) do { } while (0)
+#define PROBE3(name, a, b, c) do { } while (0)
+#endif
+
+#endif
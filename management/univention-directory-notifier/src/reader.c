@@ -0,0 +1,139 @@
+/*
+ * Univention Directory Notifier
+ *  reader.c
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <univention/debug.h>
+
+#include "reader.h"
+
+#define READER_THREADS_MAX 64
+
+/* Transactions older than the cache are read from the transaction file or
+   its segments by these threads, so a listener catching up does not stall
+   the other clients of its reactor. */
+static pthread_t threads[READER_THREADS_MAX];
+static int thread_count;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static struct reader_job *queue_head, *queue_tail;
+static int stop;
+
+static void *reader_main(void *arg)
+{
+	struct reader_job *job;
+
+	for (;;) {
+		pthread_mutex_lock(&queue_lock);
+		while (queue_head == NULL && !stop)
+			pthread_cond_wait(&queue_cond, &queue_lock);
+		if (stop) {
+			pthread_mutex_unlock(&queue_lock);
+			return NULL;
+		}
+		job = queue_head;
+		if ((queue_head = job->next) == NULL)
+			queue_tail = NULL;
+		pthread_mutex_unlock(&queue_lock);
+
+		job->next = NULL;
+		job->run(job);
+		job->done(job);
+	}
+}
+
+int reader_init(int count)
+{
+	int i;
+
+	if (count > READER_THREADS_MAX)
+		count = READER_THREADS_MAX;
+	for (i = 0; i < count; i++) {
+		if (pthread_create(&threads[i], NULL, reader_main, NULL) != 0) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "pthread_create failed for reader %d", i);
+			break;
+		}
+	}
+	thread_count = i;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Using %d reader threads", thread_count);
+	return thread_count == count ? 0 : -1;
+}
+
+void reader_submit(struct reader_job *job)
+{
+	if (thread_count == 0) {
+		job->run(job);
+		job->done(job);
+		return;
+	}
+
+	job->next = NULL;
+	pthread_mutex_lock(&queue_lock);
+	if (queue_tail != NULL)
+		queue_tail->next = job;
+	else
+		queue_head = job;
+	queue_tail = job;
+	pthread_cond_signal(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+}
+
+void reader_stop(void)
+{
+	struct reader_job *job;
+	int i;
+
+	pthread_mutex_lock(&queue_lock);
+	stop = 1;
+	pthread_cond_broadcast(&queue_cond);
+	pthread_mutex_unlock(&queue_lock);
+	for (i = 0; i < thread_count; i++)
+		pthread_join(threads[i], NULL);
+	thread_count = 0;
+
+	while ((job = queue_head) != NULL) {
+		queue_head = job->next;
+		reader_job_free(job);
+	}
+	queue_tail = NULL;
+}
+
+void reader_job_free(struct reader_job *job)
+{
+	free(job->buf);
+	free(job);
+}
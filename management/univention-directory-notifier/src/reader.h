@@ -0,0 +1,72 @@
+/*
+ * Univention Directory Notifier
+ *  reader.h
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+
+#ifndef __READER_H__
+#define __READER_H__
+
+#include "network.h"
+
+enum reader_kind {
+	READER_GET_DN,  // GET_DN of protocol 1 and 2
+	READER_DN_RANGE,  // GET_DN_RANGE
+	READER_SUBSCRIPTION,  // transactions pushed to a subscribed client
+};
+
+/* A read of transactions missing in the cache. @run reads them into @buf in
+   a worker thread, then @done hands the job back to the reactor of @client,
+   which sends the reply. */
+struct reader_job {
+	struct reader_job *next;
+	void (*run)(struct reader_job *job);
+	void (*done)(struct reader_job *job);
+	void *reactor;
+	NetworkClient_t *client;
+	enum reader_kind kind;
+	unsigned long msg_id;
+	unsigned long id;
+	unsigned long count;
+	unsigned long found;  // transactions read into buf
+	char *buf;  // reply body, NULL if reading failed
+};
+
+/* Start @threads workers; with none, the jobs are run by the submitting thread. */
+int reader_init(int threads);
+void reader_submit(struct reader_job *job);
+/* Wait for the running jobs and drop the queued ones. */
+void reader_stop(void);
+void reader_job_free(struct reader_job *job);
+
+#endif
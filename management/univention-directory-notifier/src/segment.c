@@ -0,0 +1,329 @@
+/*
+ * Univention Directory Notifier
+ *  segment.c
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <endian.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <univention/debug.h>
+
+#include "notify.h"
+#include "segment.h"
+
+#define MAX_PATH_LEN 4096
+
+struct segment {
+	unsigned long first;
+	unsigned long last;
+	char *name;
+};
+
+/* the manifest as last read */
+static struct segment *segments;
+static size_t segment_count;
+static struct stat manifest_st;
+
+/* the mapping of the last used segment */
+static struct {
+	const struct segment *segment;
+	char *data;
+	size_t size;
+	const struct segment_entry *entries;
+	size_t count;
+	size_t lines;
+} segment_map;
+
+static void segment_unmap(void)
+{
+	if (segment_map.data)
+		munmap(segment_map.data, segment_map.size);
+	memset(&segment_map, 0, sizeof(segment_map));
+}
+
+static void segment_free(void)
+{
+	size_t i;
+
+	segment_unmap();
+	for (i = 0; i < segment_count; i++)
+		free(segments[i].name);
+	free(segments);
+	segments = NULL;
+	segment_count = 0;
+}
+
+/* (Re-)read the manifest if it has changed since the last call. */
+static void segment_load(void)
+{
+	char line[MAX_PATH_LEN + 64], name[MAX_PATH_LEN];
+	unsigned long first, last;
+	struct stat st;
+	size_t size = 0;
+	FILE *fp;
+
+	if (stat(FILE_NAME_TF_MANIFEST, &st) != 0) {
+		segment_free();
+		memset(&manifest_st, 0, sizeof(manifest_st));
+		return;
+	}
+	if (st.st_dev == manifest_st.st_dev && st.st_ino == manifest_st.st_ino && st.st_size == manifest_st.st_size && st.st_mtim.tv_sec == manifest_st.st_mtim.tv_sec && st.st_mtim.tv_nsec == manifest_st.st_mtim.tv_nsec)
+		return;
+
+	segment_free();
+	if ((fp = fopen(FILE_NAME_TF_MANIFEST, "r")) == NULL) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "unable to read %s: %s", FILE_NAME_TF_MANIFEST, strerror(errno));
+		return;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (sscanf(line, "%lu %lu %4095s", &first, &last, name) != 3 || first > last || (segment_count && first <= segments[segment_count - 1].last)) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "invalid line in %s: %s", FILE_NAME_TF_MANIFEST, line);
+			continue;
+		}
+		if (segment_count == size) {
+			size = size ? size * 2 : 16;
+			if ((segments = realloc(segments, size * sizeof(*segments))) == NULL)
+				abort();  // FIXME
+		}
+		segments[segment_count].first = first;
+		segments[segment_count].last = last;
+		if ((segments[segment_count].name = strdup(name)) == NULL)
+			abort();  // FIXME
+		segment_count++;
+	}
+	fclose(fp);
+	manifest_st = st;
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "%zu segments in manifest", segment_count);
+}
+
+/* Map @segment and check its footer. Returns 0 on success. */
+static int segment_open(const struct segment *segment)
+{
+	const struct segment_footer *footer;
+	uint64_t size, count;
+	struct stat st;
+	int fd;
+
+	if (segment_map.segment == segment)
+		return 0;
+	segment_unmap();
+
+	if ((fd = open(segment->name, O_RDONLY | O_CLOEXEC)) < 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "unable to open segment %s: %s", segment->name, strerror(errno));
+		return -1;
+	}
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(*footer)) {
+		close(fd);
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "invalid segment %s", segment->name);
+		return -1;
+	}
+	segment_map.data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (segment_map.data == MAP_FAILED) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "mmap(%s) failed: %s", segment->name, strerror(errno));
+		segment_map.data = NULL;
+		return -1;
+	}
+	segment_map.size = st.st_size;
+
+	footer = (const struct segment_footer *)(segment_map.data + st.st_size - sizeof(*footer));
+	size = le64toh(footer->size);
+	count = le64toh(footer->count);
+	if (le64toh(footer->magic) != SEGMENT_MAGIC || size % sizeof(uint64_t) || size + count * sizeof(struct segment_entry) + sizeof(*footer) != st.st_size) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "invalid footer in segment %s", segment->name);
+		segment_unmap();
+		return -1;
+	}
+	segment_map.segment = segment;
+	segment_map.entries = (const struct segment_entry *)(segment_map.data + size);
+	segment_map.count = count;
+	/* without the padding */
+	for (segment_map.lines = size; segment_map.lines > 0 && segment_map.data[segment_map.lines - 1] == '\0'; segment_map.lines--)
+		;
+	return 0;
+}
+
+unsigned long segment_last_id(void)
+{
+	segment_load();
+	return segment_count ? segments[segment_count - 1].last : 0;
+}
+
+/* Return the line of transaction @id in the sealed segments, or NULL.
+   @limit is set to the end of the lines of its segment. The result is valid
+   until the next call. */
+const char *segment_find(unsigned long id, const char **limit)
+{
+	size_t lo = 0, hi;
+	const char *pos, *end;
+
+	segment_load();
+	for (hi = segment_count; lo < hi;) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (segments[mid].last < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == segment_count || segments[lo].first > id || segment_open(&segments[lo]) != 0)
+		return NULL;
+
+	/* the last sparse entry not after @id */
+	for (lo = 0, hi = segment_map.count; lo < hi;) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (le64toh(segment_map.entries[mid].id) <= id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	pos = segment_map.data + (lo ? le64toh(segment_map.entries[lo - 1].offset) : 0);
+	*limit = segment_map.data + segment_map.lines;
+
+	for (; pos < *limit && (end = memchr(pos, '\n', *limit - pos)) != NULL; pos = end + 1) {
+		unsigned long tid = notify_line_id(pos, end);
+		if (tid == id) {
+			univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "Found (segment) %ld", id);
+			return pos;
+		}
+		if (tid == 0 || tid > id)
+			break;
+	}
+	return NULL;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t l = write(fd, buf, len);
+		if (l < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf = (const char *)buf + l;
+		len -= l;
+	}
+	return 0;
+}
+
+/* Write the complete transaction lines in @data to a new sealed segment and
+   append it to the manifest. Returns 0 on success. */
+int segment_seal(const char *data, size_t size)
+{
+	char name[MAX_PATH_LEN], tmp[MAX_PATH_LEN + sizeof(".tmp")];
+	struct segment_entry *entries = NULL;
+	struct segment_footer footer;
+	unsigned long first = 0, last = segment_last_id(), lines = 0;
+	size_t count = 0, entries_size = 0, i;
+	const char *start = NULL, *pos, *end;
+	static const char pad[sizeof(uint64_t)];
+	size_t aligned;
+	FILE *fp;
+	int fd;
+
+	for (pos = data; pos < data + size && (end = memchr(pos, '\n', data + size - pos)) != NULL; pos = end + 1) {
+		unsigned long id = notify_line_id(pos, end);
+		/* lines already sealed before a crash are skipped */
+		if (id == 0 || id <= last)
+			continue;
+		if (start == NULL)
+			start = pos;
+		if (lines++ % SEGMENT_SPARSE == 0) {
+			if (count == entries_size) {
+				entries_size = entries_size ? entries_size * 2 : 64;
+				if ((entries = realloc(entries, entries_size * sizeof(*entries))) == NULL)
+					abort();  // FIXME
+			}
+			entries[count].id = htole64(id);
+			entries[count].offset = htole64(pos - start);
+			count++;
+		}
+		if (first == 0)
+			first = id;
+		last = id;
+	}
+	if (first == 0) {
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "no transactions to seal");
+		free(entries);
+		return 0;
+	}
+	size = pos - start;
+	aligned = (size + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1);
+
+	snprintf(name, sizeof(name), "%s.%020lu", FILE_NAME_TF, first);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0)
+		goto error;
+	footer.magic = htole64(SEGMENT_MAGIC);
+	footer.size = htole64(aligned);
+	footer.count = htole64(count);
+	if (write_all(fd, start, size) || write_all(fd, pad, aligned - size) || write_all(fd, entries, count * sizeof(*entries)) || write_all(fd, &footer, sizeof(footer)) || fsync(fd)) {
+		close(fd);
+		goto error;
+	}
+	close(fd);
+	if (rename(tmp, name))
+		goto error;
+	free(entries);
+	entries = NULL;
+
+	/* the manifest is replaced atomically */
+	snprintf(tmp, sizeof(tmp), "%s.tmp", FILE_NAME_TF_MANIFEST);
+	if ((fp = fopen(tmp, "w")) == NULL)
+		goto error;
+	for (i = 0; i < segment_count; i++)
+		fprintf(fp, "%lu %lu %s\n", segments[i].first, segments[i].last, segments[i].name);
+	fprintf(fp, "%lu %lu %s\n", first, last, name);
+	if (fflush(fp) || fsync(fileno(fp))) {
+		fclose(fp);
+		goto error;
+	}
+	if (fclose(fp) || rename(tmp, FILE_NAME_TF_MANIFEST))
+		goto error;
+
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_PROCESS, "sealed transactions %lu-%lu into %s", first, last, name);
+	return 0;
+
+error:
+	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "unable to write %s: %s", tmp, strerror(errno));
+	unlink(tmp);
+	free(entries);
+	return -1;
+}
@@ -0,0 +1,64 @@
+/*
+ * Univention Directory Notifier
+ *  segment.h
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef __SEGMENT_H__
+#define __SEGMENT_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sealed segments of the transaction file. Each segment contains the
+   transaction lines of a closed ID range followed by a sparse index of every
+   SEGMENT_SPARSE-th line and a footer, all 64 bit little endian. */
+#define SEGMENT_MAGIC 0x3395e0d553470001ULL
+#define SEGMENT_SPARSE 256
+
+struct segment_entry {
+	uint64_t id;
+	uint64_t offset;
+};
+
+struct segment_footer {
+	uint64_t magic;
+	uint64_t size;  /* bytes of transaction lines */
+	uint64_t count;  /* number of sparse index entries */
+};
+
+/* All functions must be called with the transaction file lock held. */
+unsigned long segment_last_id(void);
+const char *segment_find(unsigned long id, const char **limit);
+int segment_seal(const char *data, size_t size);
+
+#endif
@@ -0,0 +1,123 @@
+/*
+ * Univention Directory Notifier
+ *  stats.c
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "cache.h"
+#include "notify.h"
+#include "network.h"
+#include "stats.h"
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*(x)))
+
+extern NotifyId_t notify_last_id;
+
+static unsigned long cache_hits;
+static unsigned long cache_misses;
+static unsigned long file_reads;
+
+/* latency of cn=translog writes in microseconds */
+static const unsigned long ldap_buckets[] = {
+	500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000,
+};
+static unsigned long ldap_counts[ARRAY_SIZE(ldap_buckets) + 1];
+static unsigned long long ldap_sum;
+
+void stats_cache_lookup(int hit)
+{
+	__atomic_fetch_add(hit ? &cache_hits : &cache_misses, 1, __ATOMIC_RELAXED);
+}
+
+void stats_file_read(void)
+{
+	__atomic_fetch_add(&file_reads, 1, __ATOMIC_RELAXED);
+}
+
+/* Account a cn=translog write sent at @start, which just completed. */
+void stats_ldap_write(const struct timespec *start)
+{
+	struct timespec now;
+	unsigned long us;
+	size_t i;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - start->tv_sec) * 1000000 + (now.tv_nsec - start->tv_nsec) / 1000;
+	for (i = 0; i < ARRAY_SIZE(ldap_buckets) && us > ldap_buckets[i]; i++)
+		;
+	__atomic_fetch_add(&ldap_counts[i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&ldap_sum, us, __ATOMIC_RELAXED);
+}
+
+void stats_write(FILE *out)
+{
+	unsigned long count = 0, hits, misses, cached, resized;
+	size_t i, bytes;
+
+	fprintf(out, "# TYPE univention_notifier_last_id gauge\n");
+	fprintf(out, "univention_notifier_last_id %lu\n", __atomic_load_n(&notify_last_id.id, __ATOMIC_ACQUIRE));
+
+	network_client_stats(out);
+
+	hits = __atomic_load_n(&cache_hits, __ATOMIC_RELAXED);
+	misses = __atomic_load_n(&cache_misses, __ATOMIC_RELAXED);
+	fprintf(out, "# TYPE univention_notifier_cache_lookups_total counter\n");
+	fprintf(out, "univention_notifier_cache_lookups_total{result=\"hit\"} %lu\n", hits);
+	fprintf(out, "univention_notifier_cache_lookups_total{result=\"miss\"} %lu\n", misses);
+	fprintf(out, "# TYPE univention_notifier_cache_hit_ratio gauge\n");
+	fprintf(out, "univention_notifier_cache_hit_ratio %g\n", hits + misses ? (double)hits / (hits + misses) : 1.0);
+	notifier_cache_stats(&bytes, &cached, &resized);
+	fprintf(out, "# HELP univention_notifier_cache_bytes Size of the transaction cache as adapted to the lag of the clients.\n");
+	fprintf(out, "# TYPE univention_notifier_cache_bytes gauge\n");
+	fprintf(out, "univention_notifier_cache_bytes %zu\n", bytes);
+	fprintf(out, "# TYPE univention_notifier_cache_transactions gauge\n");
+	fprintf(out, "univention_notifier_cache_transactions %lu\n", cached);
+	fprintf(out, "# TYPE univention_notifier_cache_resizes_total counter\n");
+	fprintf(out, "univention_notifier_cache_resizes_total %lu\n", resized);
+	fprintf(out, "# HELP univention_notifier_file_reads_total Requests answered from the transaction file.\n");
+	fprintf(out, "# TYPE univention_notifier_file_reads_total counter\n");
+	fprintf(out, "univention_notifier_file_reads_total %lu\n", __atomic_load_n(&file_reads, __ATOMIC_RELAXED));
+
+	fprintf(out, "# TYPE univention_notifier_ldap_write_seconds histogram\n");
+	for (i = 0; i <= ARRAY_SIZE(ldap_buckets); i++) {
+		count += __atomic_load_n(&ldap_counts[i], __ATOMIC_RELAXED);
+		if (i < ARRAY_SIZE(ldap_buckets))
+			fprintf(out, "univention_notifier_ldap_write_seconds_bucket{le=\"%g\"} %lu\n", ldap_buckets[i] / 1e6, count);
+		else
+			fprintf(out, "univention_notifier_ldap_write_seconds_bucket{le=\"+Inf\"} %lu\n", count);
+	}
+	fprintf(out, "univention_notifier_ldap_write_seconds_sum %g\n", __atomic_load_n(&ldap_sum, __ATOMIC_RELAXED) / 1e6);
+	fprintf(out, "univention_notifier_ldap_write_seconds_count %lu\n", count);
+}
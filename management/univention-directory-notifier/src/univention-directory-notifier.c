@@ -43,6 +43,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/inotify.h>
 #include <fcntl.h>
 
 #include <unistd.h>
@@ -53,13 +54,17 @@
 #include "notify.h"
 #include "network.h"
 #include "cache.h"
+#include "reader.h"
 
 Notify_t notify;
 NotifyId_t notify_last_id;
 
 long SCHEMA_ID;
 
-unsigned long long notifier_cache_size=1000;
+unsigned long long notifier_cache_size=0;
+unsigned long long notifier_cache_bytes=4 * 1024 * 1024;
+int notifier_cache_fixed=0;
+unsigned long long notifier_segment_bytes=0;
 long long notifier_lock_count=100;
 long long notifier_lock_time=100;
 
@@ -74,20 +79,19 @@ void usage(void)
 	fprintf(stderr, "   -d   added debug output\n");
 	fprintf(stderr, "   -S   DEPRECATED\n");
 	fprintf(stderr, "   -v <version> Minimum supported protocol\n");
+	fprintf(stderr, "   -t <threads> Number of threads serving clients (default: number of CPUs)\n");
+	fprintf(stderr, "   -I <threads> Number of threads reading transactions not cached (default: 2, 0 reads in the serving threads)\n");
+	fprintf(stderr, "   -B <bytes>   Maximum size of the transaction cache (default: 4 MiB)\n");
+	fprintf(stderr, "   -A           Do not adapt the size of the transaction cache to the lag of the clients\n");
+	fprintf(stderr, "   -C <count>   Maximum number of cached transactions (default: unlimited)\n");
+	fprintf(stderr, "   -R <bytes>   Seal the transaction file into a segment at this size (default: never)\n");
+	fprintf(stderr, "   -Q <bytes>   Disconnect clients with more output queued (default: 16 MiB)\n");
+	fprintf(stderr, "   -N           Do not listen on %s for local listeners\n", NETWORK_SOCKET);
 }
 
 static int SCHEMA_CALLBACK = 0;
 static int LISTENER_CALLBACK = 0;
 
-void set_schema_callback ( int sig, siginfo_t *si, void *data)
-{
-	SCHEMA_CALLBACK = 1;
-}
-void set_listener_callback ( int sig, siginfo_t *si, void *data)
-{
-	LISTENER_CALLBACK = 1;
-}
-
 int get_schema_callback ()
 {
 	return SCHEMA_CALLBACK;
@@ -106,34 +110,48 @@ void unset_listener_callback ()
 	LISTENER_CALLBACK = 0;
 }
 
-void create_callback_schema()
-{
-	int fd;
-	struct sigaction act;
+/* inotify watches on the directories of the schema ID and the listener file */
+static int callback_fd = -1;
+static int schema_wd = -1;
+static int listener_wd = -1;
 
-	act.sa_sigaction = set_schema_callback;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = SA_SIGINFO;
-	sigaction(SIGUSR1, &act, NULL);
-
-	fd = open("/var/lib/univention-ldap/schema/id/", O_RDONLY);
-	fcntl(fd, F_SETSIG, SIGUSR1);
-	fcntl(fd, F_NOTIFY, DN_MODIFY|DN_MULTISHOT);
+void create_callbacks()
+{
+	if ((callback_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) < 0)
+		error(EXIT_FAILURE, errno, "inotify_init1() failed");
+	if ((listener_wd = inotify_add_watch(callback_fd, "/var/lib/univention-ldap/listener/", IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE)) < 0)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "inotify_add_watch(listener) failed: %s", strerror(errno));
+	if ((schema_wd = inotify_add_watch(callback_fd, "/var/lib/univention-ldap/schema/id/", IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE)) < 0)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_ERROR, "inotify_add_watch(schema) failed: %s", strerror(errno));
 }
 
-void create_callback_listener()
+int get_callback_fd()
 {
-	int fd;
-	struct sigaction act;
-
-	act.sa_sigaction = set_listener_callback;
-	sigemptyset(&act.sa_mask);
-	act.sa_flags = SA_SIGINFO;
-	sigaction(SIGRTMIN, &act, NULL);
+	return callback_fd;
+}
 
-	fd = open("/var/lib/univention-ldap/listener/", O_RDONLY);
-	fcntl(fd, F_SETSIG, SIGRTMIN);
-	fcntl(fd, F_NOTIFY, DN_MODIFY|DN_MULTISHOT);
+/* Drain the pending inotify events, coalescing them into the callbacks. */
+void read_callback_fd()
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	const char *listener = strrchr(FILE_NAME_LISTENER, '/') + 1;
+	const struct inotify_event *event;
+	ssize_t len;
+	char *pos;
+
+	while ((len = read(callback_fd, buf, sizeof(buf))) > 0) {
+		for (pos = buf; pos < buf + len; pos += sizeof(*event) + event->len) {
+			event = (const struct inotify_event *)pos;
+			if (event->mask & IN_Q_OVERFLOW) {
+				LISTENER_CALLBACK = 1;
+				SCHEMA_CALLBACK = 1;
+			} else if (event->wd == listener_wd && event->len && !strcmp(event->name, listener)) {
+				LISTENER_CALLBACK = 1;
+			} else if (event->wd == schema_wd) {
+				SCHEMA_CALLBACK = 1;
+			}
+		}
+	}
 }
 
 int creating_pidfile(char *file)
@@ -151,34 +169,38 @@ int creating_pidfile(char *file)
 	return 0;
 }
 
-unsigned long long parse_ullong(char *str) {
+unsigned long long parse_ullong(int opt, char *str) {
+	unsigned long long value;
 	char *endptr;
 
-	notifier_cache_size = strtoull(str, &endptr, 10);
+	value = strtoull(str, &endptr, 10);
 	if (strtoll(str, NULL, 10) > 0) { // can legitimately return 0, LONG_MAX, or LONG_MIN
 		errno = 0;
-		if ((errno == ERANGE && notifier_cache_size == ULLONG_MAX)
-				|| (errno != 0 && notifier_cache_size == 0)) {
+		if ((errno == ERANGE && value == ULLONG_MAX)
+				|| (errno != 0 && value == 0)) {
 			perror("strtol");
 			exit(EXIT_FAILURE);
 		} else if (endptr != str + strlen(str)) {
-			fprintf(stderr, "Not all characters of the value given for option -C could be converted: %s\n", str);
+			fprintf(stderr, "Not all characters of the value given for option -%c could be converted: %s\n", opt, str);
 			exit(EXIT_FAILURE);
 		}
 	} else if (endptr == str) {
 			fprintf(stderr, "No digits were found: %s\n", str);
 			exit(EXIT_FAILURE);
 	} else {
-		printf("Error: Argument of -C can only be a positive number: %s\n", str);
+		printf("Error: Argument of -%c can only be a positive number: %s\n", opt, str);
 		exit(EXIT_FAILURE);
 	};
-	return notifier_cache_size;
+	return value;
 }
 
 int main(int argc, char* argv[])
 {
 	int foreground = 0;
 	int debug = 0;
+	int threads = 0;
+	int readers = 2;
+	const char *socket_path = NETWORK_SOCKET;
 
 	SCHEMA_ID=0;
 
@@ -186,7 +208,7 @@ int main(int argc, char* argv[])
 		int c;
 		char *end;
 
-		c = getopt(argc, argv, "Fosrd:S:C:L:T:v:");
+		c = getopt(argc, argv, "FosrNAd:S:B:C:R:Q:L:T:v:t:I:");
 		if (c < 0)
 			break;
 
@@ -204,7 +226,22 @@ int main(int argc, char* argv[])
 				fprintf(stderr, "Ignoring deprecated option -%c\n", c);
 				break;
 			case 'C':
-				notifier_cache_size=parse_ullong(optarg);
+				notifier_cache_size=parse_ullong(c, optarg);
+				break;
+			case 'B':
+				notifier_cache_bytes=parse_ullong(c, optarg);
+				break;
+			case 'A':
+				notifier_cache_fixed=1;
+				break;
+			case 'R':
+				notifier_segment_bytes=parse_ullong(c, optarg);
+				break;
+			case 'Q':
+				network_client_output_max=parse_ullong(c, optarg);
+				break;
+			case 'N':
+				socket_path = NULL;
 				break;
 			case 'L':
 				notifier_lock_count=atoll(optarg);
@@ -217,6 +254,16 @@ int main(int argc, char* argv[])
 				if (!*optarg || *end || network_procotol_version < PROTOCOL_1 || network_procotol_version >= PROTOCOL_LAST)
 					error(EXIT_FAILURE, errno, "Invalid argument '-%c %s'", c, optarg);
 				break;
+			case 't':
+				threads = strtol(optarg, &end, 10);
+				if (!*optarg || *end || threads < 1)
+					error(EXIT_FAILURE, errno, "Invalid argument '-%c %s'", c, optarg);
+				break;
+			case 'I':
+				readers = strtol(optarg, &end, 10);
+				if (!*optarg || *end || readers < 0)
+					error(EXIT_FAILURE, errno, "Invalid argument '-%c %s'", c, optarg);
+				break;
 			default:
 				usage();
 				exit(1);
@@ -249,10 +296,11 @@ int main(int argc, char* argv[])
 	notifier_cache_init(notify_last_id.id);
 	univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_INFO, "   done");
 
-	network_client_init( 6669 );
+	network_client_init( 6669, socket_path, threads );
+	if (reader_init(readers) != 0)
+		univention_debug(UV_DEBUG_TRANSFILE, UV_DEBUG_WARN, "Not all reader threads started");
 
-	create_callback_listener ();
-	create_callback_schema ();
+	create_callbacks ();
 
 	notify_listener_change_callback ( 0, NULL, NULL);
 	notify_schema_change_callback ( 0, NULL, NULL);
@@ -0,0 +1,130 @@
+/*
+ * Univention Nagios
+ *  client side of univention-nagios-check-agent for the suid wrappers
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHECK_AGENT_H
+#define CHECK_AGENT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#ifndef CHECK_AGENT_SOCKET
+#define CHECK_AGENT_SOCKET "/run/univention-nagios/check-agent.sock"
+#endif
+#define CHECK_AGENT_TIMEOUT 60
+#define CHECK_AGENT_MAX_REPLY (64 * 1024)
+
+static inline int check_agent_send(int fd, const char *s)
+{
+	size_t len = strlen(s) + 1;
+
+	while (len > 0) {
+		ssize_t n = write(fd, s, len);
+		if (n <= 0)
+			return -1;
+		s += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Ask the check agent for the result of check NAME, run with the NULL
+ * terminated ARGS. The plugin output is copied to stdout and its exit
+ * status returned. -1 means the agent could not answer and the caller
+ * should exec the plugin itself; nothing has been printed in that case.
+ */
+static inline int check_agent_run(const char *name, char *const args[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timeval tv = { .tv_sec = CHECK_AGENT_TIMEOUT };
+	static char reply[CHECK_AGENT_MAX_REPLY + 16];
+	size_t len = 0;
+	char *out, *end;
+	long status;
+	int fd, i;
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	strncpy(addr.sun_path, CHECK_AGENT_SOCKET, sizeof(addr.sun_path) - 1);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto fail;
+
+	/* request: NUL terminated name and arguments, end marked by EOF */
+	if (check_agent_send(fd, name))
+		goto fail;
+	for (i = 0; args && args[i]; i++)
+		if (check_agent_send(fd, args[i]))
+			goto fail;
+	shutdown(fd, SHUT_WR);
+
+	/* reply: "<status>\n<output>", complete once the agent closes */
+	for (;;) {
+		ssize_t n = read(fd, reply + len, sizeof(reply) - 1 - len);
+		if (n < 0)
+			goto fail;
+		if (n == 0)
+			break;
+		len += n;
+		if (len == sizeof(reply) - 1)
+			goto fail;
+	}
+	close(fd);
+	reply[len] = '\0';
+
+	out = strchr(reply, '\n');
+	if (!out)
+		return -1;
+	*out++ = '\0';
+	status = strtol(reply, &end, 10);
+	if (end == reply || *end || status < 0 || status > 255)
+		return -1;
+	fwrite(out, 1, len - (out - reply), stdout);
+	fflush(stdout);
+	return status;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+#endif
@@ -2,6 +2,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include "check_agent.h"
+
 static const char COMMAND[] = "/usr/lib/nagios/plugins/check_univention_ldap";
 
 static char *const suid_envp[] = {
@@ -11,6 +13,8 @@ static char *const suid_envp[] = {
 
 int main(int argc, char **argv, char **envp)
 {
+	int status;
+
 	if (setgid(getegid())) {
 		perror("setgid");
 		return EXIT_FAILURE;
@@ -19,6 +23,9 @@ int main(int argc, char **argv, char **envp)
 		perror("setuid");
 		return EXIT_FAILURE;
 	}
+	status = check_agent_run("ldap", NULL);
+	if (status >= 0)
+		return status;
 	execle(COMMAND, COMMAND, NULL, suid_envp);
 	perror("execle");
 	return EXIT_FAILURE;
@@ -7,6 +7,8 @@
 #include <string.h>
 #include <stdlib.h>
 
+#include "check_agent.h"
+
 #define COMMAND "/usr/lib/nagios/plugins/check_univention_nscd"
 
 static char *const suid_envp[] = {
@@ -17,6 +19,8 @@ static char *const suid_envp[] = {
 int main( int argc, char ** argv, char ** envp )
 {
 	int i = 0;
+	int status;
+	char *args[3] = { NULL };
 	if (setgid(getegid())) {
 		perror("setgid");
 		return EXIT_FAILURE;
@@ -27,9 +31,17 @@ int main( int argc, char ** argv, char ** envp )
 	}
 	for(i=0; i<argc; i++) {
 	  if (( strcmp("-L", argv[i]) == 0 ) && (i+1 < argc)) {
-		execle(COMMAND, COMMAND, "-L", argv[i+1], NULL, &suid_envp);
+		args[0] = "-L";
+		args[1] = argv[i+1];
+		break;
 	  }
 	}
+	status = check_agent_run("nscd", args);
+	if (status >= 0)
+		return status;
+	if (args[0]) {
+		execle(COMMAND, COMMAND, "-L", argv[i+1], NULL, &suid_envp);
+	}
 	execle(COMMAND, COMMAND, NULL, &suid_envp);
 	perror("execle");
 	return EXIT_FAILURE;
@@ -1,6 +1,6 @@
 //
 // Univention Nagios Plugin
-//  wrapper to call script for checking slapd_mdb_maxsize
+//  check how full the mdb databases of slapd and the listener are
 //
 // Copyright 2015-2025 Univention GmbH
 //
@@ -34,30 +34,153 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
 #include <getopt.h>
+#include <sys/stat.h>
+#include <lmdb.h>
 
-#define COMMAND "/usr/lib/nagios/plugins/check_univention_slapd_mdb_maxsize"
+#define STATE_OK 0
+#define STATE_WARNING 1
+#define STATE_CRITICAL 2
 
-static char *const suid_envp[] = {
-	"PATH=/usr/sbin:/usr/bin:/sbin:/bin",
-	NULL
+#ifndef SLAPD_CONF
+#define SLAPD_CONF "/etc/ldap/slapd.conf"
+#endif
+#define LISTENER_CACHE "/var/lib/univention-directory-listener/cache"
+#define MAX_DATABASES 16
+
+struct database {
+	char dir[256];
+	const char *variable;
+	const char *service;
 };
 
+static struct database databases[MAX_DATABASES];
+static int ndatabases;
+
+static const char *const state_names[] = { "MDB OK", "MDB WARNING", "MDB CRITICAL" };
+
+static void add_database(const char *dir, const char *variable, const char *service)
+{
+	char path[sizeof(databases[0].dir) + 16];
+	struct stat st;
+	struct database *db;
+
+	if (ndatabases == MAX_DATABASES)
+		return;
+	snprintf(path, sizeof(path), "%s/data.mdb", dir);
+	if (stat(path, &st))
+		return;
+	db = &databases[ndatabases++];
+	snprintf(db->dir, sizeof(db->dir), "%s", dir);
+	db->variable = variable;
+	db->service = service;
+}
+
+/* every "directory" of a "database mdb" section in slapd.conf */
+static int add_slapd_databases(void)
+{
+	char line[1024], *p, *end;
+	int mdb = 0;
+	FILE *f;
+
+	f = fopen(SLAPD_CONF, "r");
+	if (!f)
+		return -1;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "database", 8) && isspace((unsigned char)line[8])) {
+			for (p = line + 8; isspace((unsigned char)*p); p++)
+				;
+			mdb = !strncmp(p, "mdb", 3) && (!p[3] || isspace((unsigned char)p[3]));
+			continue;
+		}
+		if (!mdb || strncmp(line, "directory", 9) || !isspace((unsigned char)line[9]))
+			continue;
+		for (p = line + 9; isspace((unsigned char)*p); p++)
+			;
+		if (*p == '"')
+			p++;
+		for (end = p; *end && *end != '"' && !isspace((unsigned char)*end); end++)
+			;
+		*end = '\0';
+		add_database(p, "ldap/database/mdb/maxsize", "slapd");
+	}
+	fclose(f);
+	return 0;
+}
+
+/* percentage of the map in use, as "mdb_stat -ef" reports it */
+static int mdb_in_use(const char *dir, int *in_use, char *error, size_t errlen)
+{
+	MDB_env *env = NULL;
+	MDB_txn *txn = NULL;
+	MDB_cursor *cursor = NULL;
+	MDB_envinfo info;
+	MDB_stat stat;
+	MDB_val key, data;
+	size_t free_pages = 0, used_pages, max_pages;
+	int rv;
+
+	if ((rv = mdb_env_create(&env)) != MDB_SUCCESS)
+		goto fail;
+	if ((rv = mdb_env_open(env, dir, MDB_RDONLY, 0600)) != MDB_SUCCESS)
+		goto fail;
+	if ((rv = mdb_env_info(env, &info)) != MDB_SUCCESS)
+		goto fail;
+	if ((rv = mdb_env_stat(env, &stat)) != MDB_SUCCESS)
+		goto fail;
+	if ((rv = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn)) != MDB_SUCCESS)
+		goto fail;
+	/* DBI 0 is the freelist: each record is a page number list led by its length */
+	if ((rv = mdb_cursor_open(txn, 0, &cursor)) != MDB_SUCCESS)
+		goto fail;
+	while ((rv = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == MDB_SUCCESS)
+		free_pages += *(size_t *)data.mv_data;
+	if (rv != MDB_NOTFOUND)
+		goto fail;
+	mdb_cursor_close(cursor);
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+
+	used_pages = info.me_last_pgno + 1;
+	max_pages = info.me_mapsize / stat.ms_psize;
+	*in_use = (int)((used_pages - free_pages) * 100 / max_pages);
+	return 0;
+
+fail:
+	snprintf(error, errlen, "%s", mdb_strerror(rv));
+	if (cursor)
+		mdb_cursor_close(cursor);
+	if (txn)
+		mdb_txn_abort(txn);
+	if (env)
+		mdb_env_close(env);
+	return -1;
+}
+
 int main(int argc, char ** argv, char ** envp) {
-	int i = 0;
-	int listener = 0;
-	char warning[] = "75";
-	char critical[] = "90";
-	while ((i = getopt(argc, argv, "lc:w:")) != -1) {
+	int i = 0, s;
+	int slapd = 1, listener = 0;
+	int warning = 75;
+	int critical = 90;
+	int state = STATE_OK, printed = 0;
+	int in_use[MAX_DATABASES], states[MAX_DATABASES];
+	char error[256];
+	const char *prefix;
+	while ((i = getopt(argc, argv, "alc:w:")) != -1) {
 		switch (i) {
+			case 'a':
+				listener = 1;
+				break;
 			case 'l':
+				slapd = 0;
 				listener = 1;
 				break;
 			case 'w':
-				strncpy(warning, optarg, 2);
+				warning = atoi(optarg);
 				break;
 			case 'c':
-				strncpy(critical, optarg, 2);
+				critical = atoi(optarg);
 				break;
 			default:
 				exit(EXIT_FAILURE);
@@ -72,11 +195,51 @@ int main(int argc, char ** argv, char ** envp) {
 		return EXIT_FAILURE;
 	}
 
-	if (listener) {
-		execle(COMMAND, COMMAND, "-l", "-w", warning, "-c", critical, NULL, &suid_envp);
-	} else {
-		execle(COMMAND, COMMAND, "-w", warning, "-c", critical, NULL, &suid_envp);
+	prefix = !slapd ? "LISTENER" : listener ? "SLAPD/LISTENER" : "SLAPD";
+	if (slapd && add_slapd_databases()) {
+		add_database("/var/lib/univention-ldap/ldap", "ldap/database/mdb/maxsize", "slapd");
+		if (sizeof(void *) > 4)
+			add_database("/var/lib/univention-ldap/translog", "ldap/database/mdb/maxsize", "slapd");
+	}
+	if (listener)
+		add_database(LISTENER_CACHE, "listener/cache/mdb/maxsize", "univention-directory-listener");
+
+	if (!ndatabases) {
+		printf("%s %s: OpenLDAP backend is not mdb\n", prefix, state_names[STATE_OK]);
+		return STATE_OK;
+	}
+
+	for (i = 0; i < ndatabases; i++) {
+		if (mdb_in_use(databases[i].dir, &in_use[i], error, sizeof(error))) {
+			printf("%s %s: reading mdb environment %s failed: %s\n", prefix, state_names[STATE_CRITICAL], databases[i].dir, error);
+			return STATE_CRITICAL;
+		}
+		states[i] = in_use[i] >= critical ? STATE_CRITICAL : in_use[i] >= warning ? STATE_WARNING : STATE_OK;
+		if (states[i] > state)
+			state = states[i];
+	}
+
+	/* critical first, then warnings, then the operational ones */
+	printf("%s %s: ", prefix, state_names[state]);
+	for (s = STATE_CRITICAL; s >= STATE_OK; s--) {
+		for (i = 0; i < ndatabases; i++) {
+			struct database *db = &databases[i];
+			if (states[i] != s)
+				continue;
+			if (printed++)
+				putchar('\n');
+			if (s == STATE_CRITICAL)
+				printf("More than %d%% (in fact %d%%) of mdb database %s is use, please increase %s (and restart %s)", critical, in_use[i], db->dir, db->variable, db->service);
+			else if (s == STATE_WARNING)
+				printf("More than %d%% (in fact %d%%) of mdb database %s is use, consider increasing %s (and restart %s)", warning, in_use[i], db->dir, db->variable, db->service);
+			else
+				printf("Database %s operational (in fact %d%%)", db->dir, in_use[i]);
+		}
 	}
-	perror("execle");
-	return EXIT_FAILURE;
+	/* performance data: map usage per database */
+	printf(" |");
+	for (i = 0; i < ndatabases; i++)
+		printf(" '%s'=%d%%;%d;%d;0;100", databases[i].dir, in_use[i], warning, critical);
+	putchar('\n');
+	return state;
 }
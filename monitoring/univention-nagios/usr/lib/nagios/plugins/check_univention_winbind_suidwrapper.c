@@ -6,6 +6,8 @@
 #include <errno.h>
 #include <stdlib.h>
 
+#include "check_agent.h"
+
 #define COMMAND "/usr/lib/nagios/plugins/check_univention_winbind"
 
 static char *const suid_envp[] = {
@@ -15,6 +17,8 @@ static char *const suid_envp[] = {
 
 int main ( int argc, char ** argv, char ** envp )
 {
+	int status;
+
 	if (setgid(getegid())) {
 		perror("setgid");
 		return EXIT_FAILURE;
@@ -23,6 +27,9 @@ int main ( int argc, char ** argv, char ** envp )
 		perror("setuid");
 		return EXIT_FAILURE;
 	}
+	status = check_agent_run("winbind", NULL);
+	if (status >= 0)
+		return status;
 	execle(COMMAND, COMMAND, NULL, &suid_envp);
 	perror("execle");
 	return EXIT_FAILURE;
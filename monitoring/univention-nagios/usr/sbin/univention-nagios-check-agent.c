@@ -0,0 +1,470 @@
+/*
+ * Univention Nagios
+ *  privileged agent running the checks behind the suid wrappers
+ *
+ * Like what you see? Join us!
+ * https://www.univention.com/about-us/careers/vacancies/
+ *
+ * Copyright 2004-2025 Univention GmbH
+ *
+ * https://www.univention.de/
+ *
+ * All rights reserved.
+ *
+ * The source code of this program is made available
+ * under the terms of the GNU Affero General Public License version 3
+ * (GNU AGPL V3) as published by the Free Software Foundation.
+ *
+ * Binary versions of this program provided by Univention to you as
+ * well as other copyrighted, protected or trademarked materials like
+ * Logos, graphics, fonts, specific documentations and configurations,
+ * cryptographic keys etc. are subject to a license agreement between
+ * you and Univention and not subject to the GNU AGPL V3.
+ *
+ * In the case you use this program under the terms of the GNU AGPL V3,
+ * the program is provided in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public
+ * License with the Debian GNU/Linux or Univention distribution in file
+ * /usr/share/common-licenses/AGPL-3; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The agent listens on a unix socket only root can connect to and runs
+ * the plugins the suid wrappers would otherwise exec. Results are kept
+ * for a few seconds, and requests for a check that is already running
+ * wait for that run instead of starting another interpreter.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "../lib/nagios/plugins/check_agent.h"
+
+#ifndef PLUGIN_DIR
+#define PLUGIN_DIR "/usr/lib/nagios/plugins/check_univention_"
+#endif
+#define MAX_REQUEST 1024
+#define MAX_ARGS 8
+#define MAX_CLIENTS 64
+#define MAX_RESULTS 32
+#define RUN_TIMEOUT 50
+#define STATE_UNKNOWN 3
+
+static const char *const checks[] = {
+	"joinstatus",
+	"ldap",
+	"nscd",
+	"winbind",
+	NULL
+};
+
+static char *const suid_envp[] = {
+	"PATH=/usr/sbin:/usr/bin:/sbin:/bin",
+	NULL
+};
+
+struct result {
+	char key[MAX_REQUEST];
+	size_t keylen;
+	time_t stamp;      /* when the last run finished, 0 if never */
+	int status;
+	char *out;
+	size_t outlen;
+	/* a run in progress */
+	pid_t pid;
+	int fd;
+	time_t started;
+	char *buf;
+	size_t buflen;
+};
+
+struct client {
+	int fd;
+	char req[MAX_REQUEST];
+	size_t len;
+	time_t since;
+	struct result *result;  /* waiting for this run */
+};
+
+static struct result results[MAX_RESULTS];
+static struct client clients[MAX_CLIENTS];
+static int cache_ttl = 30;
+static volatile sig_atomic_t stop;
+
+static void on_signal(int sig)
+{
+	stop = 1;
+}
+
+static void client_close(struct client *c)
+{
+	close(c->fd);
+	c->fd = -1;
+	c->len = 0;
+	c->result = NULL;
+}
+
+static void client_reply(struct client *c, int status, const char *out, size_t outlen)
+{
+	char head[16];
+	const char *p;
+	size_t len;
+	int n, part;
+
+	/* the reply is small and the peer only reads, so block for it */
+	fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) & ~O_NONBLOCK);
+	n = snprintf(head, sizeof(head), "%d\n", status);
+	for (part = 0; part < 2; part++) {
+		p = part ? out : head;
+		len = part ? outlen : (size_t)n;
+		while (len > 0) {
+			ssize_t w = write(c->fd, p, len);
+			if (w <= 0)
+				goto out;
+			p += w;
+			len -= w;
+		}
+	}
+out:
+	client_close(c);
+}
+
+static struct result *result_find(const char *key, size_t keylen)
+{
+	struct result *r, *free_slot = NULL, *oldest = NULL;
+	int i;
+
+	for (i = 0; i < MAX_RESULTS; i++) {
+		r = &results[i];
+		if (r->keylen == keylen && !memcmp(r->key, key, keylen))
+			return r;
+		if (!r->keylen) {
+			if (!free_slot)
+				free_slot = r;
+		} else if (!r->pid && (!oldest || r->stamp < oldest->stamp)) {
+			oldest = r;
+		}
+	}
+	r = free_slot ? free_slot : oldest;
+	if (!r)
+		return NULL;
+	free(r->out);
+	memset(r, 0, sizeof(*r));
+	r->fd = -1;
+	memcpy(r->key, key, keylen);
+	r->keylen = keylen;
+	return r;
+}
+
+static int result_start(struct result *r, time_t now)
+{
+	char path[sizeof(PLUGIN_DIR) + MAX_REQUEST];
+	char *argv[MAX_ARGS + 2];
+	const char *p = r->key, *end = r->key + r->keylen;
+	int pfd[2], argc = 0;
+	pid_t pid;
+
+	snprintf(path, sizeof(path), PLUGIN_DIR "%s", p);
+	argv[argc++] = path;
+	for (p += strlen(p) + 1; p < end; p += strlen(p) + 1)
+		argv[argc++] = (char *)p;
+	argv[argc] = NULL;
+
+	if (pipe2(pfd, O_CLOEXEC))
+		return -1;
+	pid = fork();
+	if (pid < 0) {
+		close(pfd[0]);
+		close(pfd[1]);
+		return -1;
+	}
+	if (pid == 0) {
+		signal(SIGPIPE, SIG_DFL);
+		dup2(pfd[1], STDOUT_FILENO);
+		execve(path, argv, suid_envp);
+		perror("execve");
+		_exit(STATE_UNKNOWN);
+	}
+	close(pfd[1]);
+	fcntl(pfd[0], F_SETFL, O_NONBLOCK);
+	r->pid = pid;
+	r->fd = pfd[0];
+	r->started = now;
+	r->buf = NULL;
+	r->buflen = 0;
+	return 0;
+}
+
+static void result_finish(struct result *r, int status, time_t now)
+{
+	int i;
+
+	free(r->out);
+	r->out = r->buf;
+	r->outlen = r->buflen;
+	r->buf = NULL;
+	r->buflen = 0;
+	r->status = status;
+	r->stamp = now;
+	r->pid = 0;
+	for (i = 0; i < MAX_CLIENTS; i++)
+		if (clients[i].fd >= 0 && clients[i].result == r)
+			client_reply(&clients[i], r->status, r->out, r->outlen);
+}
+
+static void result_read(struct result *r)
+{
+	char tmp[4096];
+	ssize_t n;
+
+	while ((n = read(r->fd, tmp, sizeof(tmp))) > 0) {
+		size_t keep = n;
+		char *buf;
+
+		if (r->buflen + keep > CHECK_AGENT_MAX_REPLY)
+			keep = CHECK_AGENT_MAX_REPLY - r->buflen;
+		if (!keep)
+			continue;
+		buf = realloc(r->buf, r->buflen + keep);
+		if (!buf)
+			break;
+		memcpy(buf + r->buflen, tmp, keep);
+		r->buf = buf;
+		r->buflen += keep;
+	}
+	if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+		close(r->fd);
+		r->fd = -1;
+	}
+}
+
+static void reap_children(time_t now)
+{
+	int i, wstatus;
+	pid_t pid;
+
+	while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+		for (i = 0; i < MAX_RESULTS; i++) {
+			struct result *r = &results[i];
+			if (r->pid != pid)
+				continue;
+			if (r->fd >= 0) {
+				result_read(r);
+				if (r->fd >= 0) {
+					close(r->fd);
+					r->fd = -1;
+				}
+			}
+			result_finish(r, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : STATE_UNKNOWN, now);
+		}
+	}
+
+	for (i = 0; i < MAX_RESULTS; i++) {
+		struct result *r = &results[i];
+		if (r->pid && now - r->started > RUN_TIMEOUT) {
+			fprintf(stderr, "check %s timed out\n", r->key);
+			kill(r->pid, SIGKILL);
+			r->started = now;
+		}
+	}
+}
+
+static int request_valid(const char *req, size_t len)
+{
+	size_t i, args = 0;
+	int c;
+
+	if (len == 0 || req[len - 1] != '\0')
+		return 0;
+	for (i = 0; i < len; i++)
+		if (req[i] == '\0')
+			args++;
+	if (args > MAX_ARGS + 1)
+		return 0;
+	for (c = 0; checks[c]; c++)
+		if (!strcmp(req, checks[c]))
+			return 1;
+	return 0;
+}
+
+static void client_request(struct client *c, time_t now)
+{
+	struct result *r;
+
+	if (!request_valid(c->req, c->len)) {
+		client_close(c);
+		return;
+	}
+	r = result_find(c->req, c->len);
+	if (!r) {
+		client_close(c);
+		return;
+	}
+	if (!r->pid && r->stamp && now - r->stamp < cache_ttl) {
+		client_reply(c, r->status, r->out, r->outlen);
+		return;
+	}
+	if (!r->pid && result_start(r, now)) {
+		perror("fork");
+		client_close(c);
+		return;
+	}
+	c->result = r;
+}
+
+static void client_read(struct client *c, time_t now)
+{
+	ssize_t n;
+
+	n = read(c->fd, c->req + c->len, sizeof(c->req) - c->len);
+	if (n < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+	if (n < 0 || (n > 0 && c->len + n == sizeof(c->req))) {
+		client_close(c);
+		return;
+	}
+	if (n > 0) {
+		c->len += n;
+		return;
+	}
+	client_request(c, now);
+}
+
+static int listen_socket(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	mode_t mask;
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "socket path too long: %s\n", path);
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	unlink(path);
+	mask = umask(077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		perror("bind");
+		umask(mask);
+		close(fd);
+		return -1;
+	}
+	umask(mask);
+	if (listen(fd, MAX_CLIENTS)) {
+		perror("listen");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-s SOCKET] [-t CACHE_SECONDS]\n", name);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd pfds[1 + MAX_RESULTS + MAX_CLIENTS];
+	const char *path = CHECK_AGENT_SOCKET;
+	struct sigaction sa = { .sa_handler = on_signal };
+	int i, n, opt, lfd;
+	time_t now;
+
+	while ((opt = getopt(argc, argv, "s:t:")) != -1) {
+		switch (opt) {
+		case 's':
+			path = optarg;
+			break;
+		case 't':
+			cache_ttl = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	sigaction(SIGTERM, &sa, NULL);
+	sigaction(SIGINT, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	lfd = listen_socket(path);
+	if (lfd < 0)
+		return EXIT_FAILURE;
+	for (i = 0; i < MAX_CLIENTS; i++)
+		clients[i].fd = -1;
+	for (i = 0; i < MAX_RESULTS; i++)
+		results[i].fd = -1;
+
+	while (!stop) {
+		n = 0;
+		pfds[n++] = (struct pollfd){ .fd = lfd, .events = POLLIN };
+		for (i = 0; i < MAX_RESULTS; i++)
+			pfds[n++] = (struct pollfd){ .fd = results[i].fd, .events = POLLIN };
+		for (i = 0; i < MAX_CLIENTS; i++)
+			pfds[n++] = (struct pollfd){ .fd = clients[i].result ? -1 : clients[i].fd, .events = POLLIN };
+
+		/* wake up regularly to reap children and enforce RUN_TIMEOUT */
+		if (poll(pfds, n, 1000) < 0 && errno != EINTR) {
+			perror("poll");
+			break;
+		}
+		now = time(NULL);
+
+		for (i = 0; i < MAX_RESULTS; i++)
+			if (pfds[1 + i].revents && results[i].fd >= 0)
+				result_read(&results[i]);
+		reap_children(now);
+
+		for (i = 0; i < MAX_CLIENTS; i++) {
+			struct client *c = &clients[i];
+			if (c->fd < 0)
+				continue;
+			if (pfds[1 + MAX_RESULTS + i].revents)
+				client_read(c, now);
+			else if (!c->result && now - c->since > CHECK_AGENT_TIMEOUT)
+				client_close(c);
+		}
+
+		if (pfds[0].revents & POLLIN) {
+			int cfd;
+			while ((cfd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK)) >= 0) {
+				for (i = 0; i < MAX_CLIENTS && clients[i].fd >= 0; i++)
+					;
+				if (i == MAX_CLIENTS) {
+					close(cfd);
+					continue;
+				}
+				clients[i].fd = cfd;
+				clients[i].since = now;
+			}
+		}
+	}
+
+	unlink(path);
+	return EXIT_SUCCESS;
+}
@@ -42,14 +42,21 @@
 #include <ctype.h>
 #include <syslog.h>
 #include <errno.h>
+#include <strings.h>
 //#include <zlib.h>
 #include <sys/stat.h>
 #include <sys/queue.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "oauthbearer.h"
 
 #include <rhonabwy.h>
+#include <jansson.h>
+#include <gnutls/gnutls.h>
+#include <gnutls/abstract.h>
+#include <gnutls/crypto.h>
+#include <curl/curl.h>
 
 #define AUTOPTR_FUNC_NAME(type) type##AutoPtrFree
 #define DEFINE_AUTOPTR_FUNC(type, func) \
@@ -62,7 +69,6 @@
 #define AUTOPTR(type) \
   __attribute__((cleanup(AUTOPTR_FUNC_NAME(type)))) type *
 DEFINE_AUTOPTR_FUNC(char, r_free);
-DEFINE_AUTOPTR_FUNC(jwks_t, r_jwks_free);
 DEFINE_AUTOPTR_FUNC(jwk_t, r_jwk_free);
 DEFINE_AUTOPTR_FUNC(jwt_t, r_jwt_free);
 
@@ -115,6 +121,954 @@ int oauth_strdup(
 }
 #endif /*HACK*/
 
+/*
+ * Cache of recently verified tokens.
+ *
+ * IMAP clients reconnect constantly with the same bearer token. A token which
+ * already passed all checks is accepted again without parsing it and verifying
+ * its signature, until its expiry minus the grace period. Entries are keyed by
+ * a SHA-256 digest over the token and the configuration it was checked against,
+ * and are dropped whenever a JWKS is (re)loaded.
+ */
+#define TOKEN_CACHE_SIZE 128
+#define TOKEN_DIGEST_LEN 32
+
+struct oauth_token_cache_entry {
+	unsigned char digest[TOKEN_DIGEST_LEN];
+	char *user;
+	time_t valid_until;
+	unsigned long used;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	unsigned long clock;
+	struct oauth_token_cache_entry entries[TOKEN_CACHE_SIZE];
+} token_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void oauth_token_cache_clear(void) {
+	int i;
+
+	pthread_mutex_lock(&token_cache.lock);
+	for (i = 0; i < TOKEN_CACHE_SIZE; i++) {
+		struct oauth_token_cache_entry *entry = &token_cache.entries[i];
+		free(entry->user);
+		memset(entry, 0, sizeof(*entry));
+	}
+	pthread_mutex_unlock(&token_cache.lock);
+}
+
+static int token_digest_list(
+	gnutls_hash_hd_t hash,
+	struct oauth_list *item
+) {
+	for (; item != NULL; item = SLIST_NEXT(item, next))
+		if (gnutls_hash(hash, item->name, strlen(item->name) + 1) < 0)
+			return -1;
+	return gnutls_hash(hash, "", 1);
+}
+
+static int token_digest(
+	oauth_glob_context_t *gctx,
+	const jwks_t *jwks,
+	const char *msg,
+	size_t msg_len,
+	unsigned char *digest
+) {
+	gnutls_hash_hd_t hash;
+	int rc = 0;
+
+	if (gnutls_hash_init(&hash, GNUTLS_DIG_SHA256) < 0)
+		return -1;
+
+	if (gnutls_hash(hash, msg, msg_len) < 0 ||
+	    gnutls_hash(hash, "", 1) < 0 ||
+	    gnutls_hash(hash, &jwks, sizeof(jwks)) < 0 ||
+	    gnutls_hash(hash, &gctx->grace, sizeof(gctx->grace)) < 0 ||
+	    gnutls_hash(hash, gctx->trusted_iss, strlen(gctx->trusted_iss) + 1) < 0 ||
+	    gnutls_hash(hash, gctx->uid_attr, strlen(gctx->uid_attr) + 1) < 0 ||
+	    token_digest_list(hash, SLIST_FIRST(&gctx->trusted_aud)) < 0 ||
+	    token_digest_list(hash, SLIST_FIRST(&gctx->trusted_azp)) < 0 ||
+	    token_digest_list(hash, SLIST_FIRST(&gctx->required_scope)) < 0)
+		rc = -1;
+
+	gnutls_hash_deinit(hash, digest);
+	return rc;
+}
+
+static bool token_cache_lookup(
+	oauth_serv_context_t *ctx,
+	const void *utils,
+	const unsigned char *digest
+) {
+	time_t now = time(NULL);
+	bool found = false;
+	int i;
+
+	pthread_mutex_lock(&token_cache.lock);
+	for (i = 0; i < TOKEN_CACHE_SIZE; i++) {
+		struct oauth_token_cache_entry *entry = &token_cache.entries[i];
+
+		if (entry->user == NULL || memcmp(entry->digest, digest, TOKEN_DIGEST_LEN) != 0)
+			continue;
+
+		if (entry->valid_until > now && oauth_strdup(utils, entry->user, &ctx->authcid, NULL) == 0) {
+			entry->used = ++token_cache.clock;
+			found = true;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&token_cache.lock);
+
+	return found;
+}
+
+static void token_cache_store(
+	oauth_serv_context_t *ctx,
+	const unsigned char *digest,
+	jwt_t *jwt
+) {
+	struct oauth_token_cache_entry *entry, *lru;
+	time_t valid_until;
+	char *user;
+	int i;
+
+	if (r_jwt_validate_claims(jwt, R_JWT_CLAIM_EXP, R_JWT_CLAIM_PRESENT, R_JWT_CLAIM_NOP) != RHN_OK)
+		return;
+
+	valid_until = (time_t)r_jwt_get_claim_int_value(jwt, "exp") - ctx->glob_context->grace;
+	if (valid_until <= time(NULL))
+		return;
+
+	if ((user = strdup(ctx->authcid)) == NULL)
+		return;
+
+	pthread_mutex_lock(&token_cache.lock);
+	lru = &token_cache.entries[0];
+	for (i = 0; i < TOKEN_CACHE_SIZE; i++) {
+		entry = &token_cache.entries[i];
+		if (memcmp(entry->digest, digest, TOKEN_DIGEST_LEN) == 0 || entry->user == NULL) {
+			lru = entry;
+			break;
+		}
+		if (entry->used < lru->used)
+			lru = entry;
+	}
+
+	free(lru->user);
+	memcpy(lru->digest, digest, TOKEN_DIGEST_LEN);
+	lru->user = user;
+	lru->valid_until = valid_until;
+	lru->used = ++token_cache.clock;
+	pthread_mutex_unlock(&token_cache.lock);
+}
+
+/*
+ * Index of the keys of all loaded JWKS by kid.
+ *
+ * r_jwks_get_by_kid() searches linearly and returns a copy of the key, from
+ * which r_jwt_verify_signature() derives the public key again for every token.
+ * oauth_get_jwks() therefore imports each key once as GnuTLS public key, so
+ * signatures can be verified directly. Keys or algorithms GnuTLS can not
+ * handle here are still verified by rhonabwy with the indexed JWK.
+ */
+#define KEY_INDEX_BUCKETS 64
+
+struct oauth_key {
+	const jwks_t *jwks;
+	char *kid;
+	jwk_t *jwk;
+	gnutls_pubkey_t pubkey;
+	gnutls_ecc_curve_t curve;
+	jwa_alg alg;
+	unsigned refs;  /* the index holds one reference, see key_release() */
+	struct oauth_key *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct oauth_key *buckets[KEY_INDEX_BUCKETS];
+} key_index = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+static unsigned key_index_hash(
+	const char *kid
+) {
+	unsigned hash = 5381;
+
+	while (*kid)
+		hash = hash * 33 + (unsigned char)*kid++;
+	return hash % KEY_INDEX_BUCKETS;
+}
+
+/* Must be called with key_index.lock held */
+static struct oauth_key * key_index_find(
+	const jwks_t *jwks,
+	const char *kid
+) {
+	struct oauth_key *key;
+
+	for (key = key_index.buckets[key_index_hash(kid)]; key != NULL; key = key->next)
+		if (key->jwks == jwks && strcmp(key->kid, kid) == 0)
+			return key;
+	return NULL;
+}
+
+/* Takes over jwk */
+static int key_index_add(
+	const jwks_t *jwks,
+	jwk_t *jwk
+) {
+	const char *kid = r_jwk_get_property_str(jwk, "kid");
+	const char *alg = r_jwk_get_property_str(jwk, "alg");
+	struct oauth_key *key;
+	unsigned bucket;
+
+	if (kid == NULL) {
+		r_jwk_free(jwk);
+		return 0;
+	}
+
+	pthread_mutex_lock(&key_index.lock);
+
+	/* like r_jwks_get_by_kid() the first key with this kid wins */
+	if (key_index_find(jwks, kid) != NULL) {
+		pthread_mutex_unlock(&key_index.lock);
+		r_jwk_free(jwk);
+		return 0;
+	}
+
+	if ((key = calloc(1, sizeof(*key))) == NULL || (key->kid = strdup(kid)) == NULL) {
+		pthread_mutex_unlock(&key_index.lock);
+		free(key);
+		r_jwk_free(jwk);
+		return -1;
+	}
+
+	key->jwks = jwks;
+	key->jwk = jwk;
+	key->refs = 1;
+	key->alg = alg != NULL ? r_str_to_jwa_alg(alg) : R_JWA_ALG_UNKNOWN;
+	key->curve = GNUTLS_ECC_CURVE_INVALID;
+	key->pubkey = r_jwk_export_to_gnutls_pubkey(jwk, 0);
+	if (key->pubkey != NULL && gnutls_pubkey_get_pk_algorithm(key->pubkey, NULL) == GNUTLS_PK_ECDSA)
+		gnutls_pubkey_export_ecc_raw2(key->pubkey, &key->curve, NULL, NULL, 0);
+
+	bucket = key_index_hash(kid);
+	key->next = key_index.buckets[bucket];
+	key_index.buckets[bucket] = key;
+
+	pthread_mutex_unlock(&key_index.lock);
+	return 0;
+}
+
+static void key_free(
+	struct oauth_key *key
+) {
+	if (key->pubkey != NULL)
+		gnutls_pubkey_deinit(key->pubkey);
+	r_jwk_free(key->jwk);
+	free(key->kid);
+	free(key);
+}
+
+/* Keys found by key_index_find() are used after dropping key_index.lock and may be removed meanwhile */
+static void key_release(
+	struct oauth_key *key
+) {
+	bool last;
+
+	pthread_mutex_lock(&key_index.lock);
+	last = --key->refs == 0;
+	pthread_mutex_unlock(&key_index.lock);
+	if (last)
+		key_free(key);
+}
+
+static void key_index_remove(
+	const jwks_t *jwks
+) {
+	struct oauth_key *unused = NULL;
+	int i;
+
+	pthread_mutex_lock(&key_index.lock);
+	for (i = 0; i < KEY_INDEX_BUCKETS; i++) {
+		struct oauth_key **pkey = &key_index.buckets[i];
+
+		while (*pkey != NULL) {
+			struct oauth_key *key = *pkey;
+
+			if (key->jwks != jwks) {
+				pkey = &key->next;
+				continue;
+			}
+
+			*pkey = key->next;
+			if (--key->refs == 0) {
+				key->next = unused;
+				unused = key;
+			}
+		}
+	}
+	pthread_mutex_unlock(&key_index.lock);
+
+	while (unused != NULL) {
+		struct oauth_key *key = unused;
+		unused = key->next;
+		key_free(key);
+	}
+}
+
+static gnutls_sign_algorithm_t key_sign_algorithm(
+	struct oauth_key *key,
+	jwa_alg alg,
+	unsigned *ec_len
+) {
+	*ec_len = 0;
+
+	switch (alg) {
+	case R_JWA_ALG_RS256:
+		return GNUTLS_SIGN_RSA_SHA256;
+	case R_JWA_ALG_RS384:
+		return GNUTLS_SIGN_RSA_SHA384;
+	case R_JWA_ALG_RS512:
+		return GNUTLS_SIGN_RSA_SHA512;
+	case R_JWA_ALG_PS256:
+		return GNUTLS_SIGN_RSA_PSS_RSAE_SHA256;
+	case R_JWA_ALG_PS384:
+		return GNUTLS_SIGN_RSA_PSS_RSAE_SHA384;
+	case R_JWA_ALG_PS512:
+		return GNUTLS_SIGN_RSA_PSS_RSAE_SHA512;
+	case R_JWA_ALG_ES256:
+		*ec_len = 32;
+		return key->curve == GNUTLS_ECC_CURVE_SECP256R1 ? GNUTLS_SIGN_ECDSA_SHA256 : GNUTLS_SIGN_UNKNOWN;
+	case R_JWA_ALG_ES384:
+		*ec_len = 48;
+		return key->curve == GNUTLS_ECC_CURVE_SECP384R1 ? GNUTLS_SIGN_ECDSA_SHA384 : GNUTLS_SIGN_UNKNOWN;
+	case R_JWA_ALG_ES512:
+		*ec_len = 66;
+		return key->curve == GNUTLS_ECC_CURVE_SECP521R1 ? GNUTLS_SIGN_ECDSA_SHA512 : GNUTLS_SIGN_UNKNOWN;
+	case R_JWA_ALG_EDDSA:
+		switch (gnutls_pubkey_get_pk_algorithm(key->pubkey, NULL)) {
+		case GNUTLS_PK_EDDSA_ED25519:
+			return GNUTLS_SIGN_EDDSA_ED25519;
+		case GNUTLS_PK_EDDSA_ED448:
+			return GNUTLS_SIGN_EDDSA_ED448;
+		default:
+			return GNUTLS_SIGN_UNKNOWN;
+		}
+	default:
+		return GNUTLS_SIGN_UNKNOWN;
+	}
+}
+
+static int base64url_decode(
+	const char *src,
+	size_t len,
+	gnutls_datum_t *out
+) {
+	gnutls_datum_t in;
+	char *buf;
+	size_t i;
+	int rc;
+
+	if ((buf = malloc(len + 3)) == NULL)
+		return -1;
+
+	for (i = 0; i < len; i++) {
+		switch (src[i]) {
+		case '-':
+			buf[i] = '+';
+			break;
+		case '_':
+			buf[i] = '/';
+			break;
+		case '+':
+		case '/':
+		case '=':
+			free(buf);
+			return -1;
+		default:
+			buf[i] = src[i];
+		}
+	}
+	while (i % 4)
+		buf[i++] = '=';
+
+	in.data = (unsigned char *)buf;
+	in.size = i;
+	rc = gnutls_base64_decode2(&in, out);
+	free(buf);
+	return rc < 0 ? -1 : 0;
+}
+
+/*
+ * Verify the compact JWS msg with the GnuTLS public key of key.
+ * Returns 1 if the signature is valid, 0 if not and -1 if the key or the
+ * algorithm is not supported here.
+ */
+static int key_verify(
+	struct oauth_key *key,
+	jwa_alg alg,
+	const char *msg,
+	size_t msg_len
+) {
+	gnutls_sign_algorithm_t sign_alg;
+	gnutls_datum_t data, sig, der;
+	const char *dot, *end = msg + msg_len;
+	unsigned ec_len;
+	int rc;
+
+	if (key->pubkey == NULL)
+		return -1;
+	if ((sign_alg = key_sign_algorithm(key, alg, &ec_len)) == GNUTLS_SIGN_UNKNOWN)
+		return -1;
+
+	/* header.payload.signature, the signature covers header.payload */
+	if ((dot = memchr(msg, '.', msg_len)) == NULL || (dot = memchr(dot + 1, '.', end - dot - 1)) == NULL || memchr(dot + 1, '.', end - dot - 1) != NULL)
+		return -1;
+
+	if (base64url_decode(dot + 1, end - dot - 1, &sig) != 0)
+		return 0;
+
+	data.data = (unsigned char *)msg;
+	data.size = dot - msg;
+
+	if (ec_len > 0) {
+		/* JWS uses the raw R || S values, GnuTLS expects them DER encoded */
+		gnutls_datum_t r = { sig.data, ec_len };
+		gnutls_datum_t s = { sig.data + ec_len, ec_len };
+
+		if (sig.size != 2 * ec_len || gnutls_encode_rs_value(&der, &r, &s) < 0) {
+			gnutls_free(sig.data);
+			return 0;
+		}
+		gnutls_free(sig.data);
+		sig = der;
+	}
+
+	rc = gnutls_pubkey_verify_data2(key->pubkey, sign_alg, 0, &data, &sig);
+	gnutls_free(sig.data);
+	return rc >= 0 ? 1 : 0;
+}
+
+void oauth_free_jwks(
+	jwks_t *jwks
+) {
+	if (jwks == NULL)
+		return;
+	key_index_remove(jwks);
+	r_jwks_free(jwks);
+}
+
+/* Parse and index a JWKS, see oauth_get_jwks() */
+static jwks_t * jwks_import(
+	const char *str,
+	const char **errstr
+) {
+	jwks_t *jwks = NULL;
+
+	if (r_jwks_init(&jwks) != RHN_OK) {
+		*errstr = "Error in r_jwks_init";
+		goto out;
+	}
+
+	if (r_jwks_import_from_json_str(jwks, str) != RHN_OK) {
+		*errstr = "Error in r_jwks_import_from_str";
+		goto out;
+	}
+
+	for (int i=0; i<r_jwks_size(jwks); i++) {
+		jwk_t *jwk = r_jwks_get_at(jwks, i);
+		if(r_jwk_is_valid(jwk) != RHN_OK) {
+			*errstr = "Error: JWK is not valid";
+			r_jwk_free(jwk);
+			goto out;
+		}
+
+		if (key_index_add(jwks, jwk) != 0) {
+			*errstr = "Error indexing JWK";
+			goto out;
+		}
+	}
+
+	return jwks;
+
+out:
+	oauth_free_jwks(jwks);
+	return NULL;
+}
+
+/*
+ * JWKS fetched from the IdP.
+ *
+ * All contexts configured with the same URI share one feed. Its thread is only
+ * started on first use, so it survives slapd daemonizing after loading the
+ * plugin. It fetches the URI in the background, honouring Cache-Control,
+ * Expires, ETag and Last-Modified, indexes the new keys and then swaps them in
+ * under key_index.lock, so authentication never waits on HTTP. Until the first
+ * fetch succeeds the JWKS file of the context is used.
+ *
+ * A token with an unknown kid wakes the thread early. The kid is remembered for
+ * JWKS_REFRESH_MIN seconds, so a flood of such tokens does not cause a fetch each.
+ */
+#define JWKS_REFRESH_MIN 60
+#define JWKS_REFRESH_DEFAULT 3600
+#define JWKS_REFRESH_MAX 86400
+#define JWKS_FETCH_TIMEOUT 30
+#define JWKS_MAX_SIZE (1024 * 1024)
+#define JWKS_UNKNOWN_KIDS 16
+
+struct oauth_jwks_feed {
+	char *uri;
+	unsigned refs;  /* protected by jwks_feeds.lock */
+	jwks_t *jwks;  /* protected by key_index.lock */
+	pthread_mutex_t lock;  /* protects the members below */
+	pthread_cond_t cond;
+	pthread_t thread;
+	pid_t pid;  /* process the thread runs in, 0 if not started */
+	bool stop;
+	bool wakeup;
+	time_t last_fetch;
+	struct {
+		char *kid;
+		time_t until;
+	} unknown[JWKS_UNKNOWN_KIDS];
+	/* only used by the thread */
+	char *etag;
+	char *last_modified;
+	struct oauth_jwks_feed *next;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	struct oauth_jwks_feed *head;
+} jwks_feeds = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+struct jwks_response {
+	char *body;
+	size_t len;
+	char *etag;
+	char *last_modified;
+	long max_age;  /* -1 if not given */
+	time_t expires;  /* 0 if not given */
+	time_t date;  /* 0 if not given */
+};
+
+static void jwks_response_reset(
+	struct jwks_response *resp
+) {
+	free(resp->body);
+	free(resp->etag);
+	free(resp->last_modified);
+	memset(resp, 0, sizeof(*resp));
+	resp->max_age = -1;
+}
+
+static size_t jwks_response_write(
+	char *data,
+	size_t size,
+	size_t nmemb,
+	void *arg
+) {
+	struct jwks_response *resp = arg;
+	size_t len = size * nmemb;
+	char *body;
+
+	if (resp->len + len > JWKS_MAX_SIZE || (body = realloc(resp->body, resp->len + len + 1)) == NULL)
+		return 0;
+
+	memcpy(body + resp->len, data, len);
+	resp->len += len;
+	body[resp->len] = '\0';
+	resp->body = body;
+	return len;
+}
+
+static void jwks_parse_cache_control(
+	struct jwks_response *resp,
+	const char *value
+) {
+	while (*value != '\0') {
+		size_t len = strcspn(value, ",");
+
+		if (strncasecmp(value, "max-age=", 8) == 0) {
+			long max_age = strtol(value + 8, NULL, 10);
+			if (resp->max_age < 0 || max_age < resp->max_age)
+				resp->max_age = max_age;
+		} else if (strncasecmp(value, "no-cache", 8) == 0 || strncasecmp(value, "no-store", 8) == 0) {
+			resp->max_age = 0;
+		}
+
+		value += len;
+		value += strspn(value, ", \t");
+	}
+}
+
+static size_t jwks_response_header(
+	char *data,
+	size_t size,
+	size_t nitems,
+	void *arg
+) {
+	struct jwks_response *resp = arg;
+	size_t len = size * nitems;
+	char *line, *value, *end;
+
+	if ((line = strndup(data, len)) == NULL)
+		return 0;
+	for (end = line + strlen(line); end > line && isspace((unsigned char)end[-1]); )
+		*--end = '\0';
+
+	if (strncmp(line, "HTTP/", 5) == 0) {
+		/* status line of a new response, e.g. after 100 Continue */
+		jwks_response_reset(resp);
+	} else if ((value = strchr(line, ':')) != NULL) {
+		*value++ = '\0';
+		value += strspn(value, " \t");
+
+		if (strcasecmp(line, "ETag") == 0) {
+			free(resp->etag);
+			resp->etag = strdup(value);
+		} else if (strcasecmp(line, "Last-Modified") == 0) {
+			free(resp->last_modified);
+			resp->last_modified = strdup(value);
+		} else if (strcasecmp(line, "Cache-Control") == 0) {
+			jwks_parse_cache_control(resp, value);
+		} else if (strcasecmp(line, "Expires") == 0) {
+			/* an invalid date means already expired */
+			resp->expires = curl_getdate(value, NULL);
+			if (resp->expires <= 0)
+				resp->expires = 1;
+		} else if (strcasecmp(line, "Date") == 0) {
+			resp->date = curl_getdate(value, NULL);
+			if (resp->date < 0)
+				resp->date = 0;
+		}
+	}
+
+	free(line);
+	return len;
+}
+
+static time_t jwks_response_interval(
+	const struct jwks_response *resp
+) {
+	time_t interval = JWKS_REFRESH_DEFAULT;
+
+	if (resp->max_age >= 0)
+		interval = (time_t)resp->max_age;
+	else if (resp->expires != 0)
+		interval = resp->expires - (resp->date != 0 ? resp->date : time(NULL));
+
+	if (interval < JWKS_REFRESH_MIN)
+		return JWKS_REFRESH_MIN;
+	if (interval > JWKS_REFRESH_MAX)
+		return JWKS_REFRESH_MAX;
+	return interval;
+}
+
+static int jwks_feed_progress(
+	void *arg,
+	curl_off_t dltotal,
+	curl_off_t dlnow,
+	curl_off_t ultotal,
+	curl_off_t ulnow
+) {
+	struct oauth_jwks_feed *feed = arg;
+	bool stop;
+
+	pthread_mutex_lock(&feed->lock);
+	stop = feed->stop;
+	pthread_mutex_unlock(&feed->lock);
+	return stop;
+}
+
+static struct curl_slist * jwks_request_header(
+	struct curl_slist *headers,
+	const char *name,
+	const char *value
+) {
+	struct curl_slist *list;
+	char *header;
+
+	if (value == NULL || (header = malloc(strlen(name) + strlen(value) + 3)) == NULL)
+		return headers;
+	sprintf(header, "%s: %s", name, value);
+	if ((list = curl_slist_append(headers, header)) != NULL)
+		headers = list;
+	free(header);
+	return headers;
+}
+
+static void jwks_feed_swap(
+	struct oauth_jwks_feed *feed,
+	jwks_t *jwks
+) {
+	jwks_t *old;
+	int i;
+
+	pthread_mutex_lock(&key_index.lock);
+	old = feed->jwks;
+	feed->jwks = jwks;
+	pthread_mutex_unlock(&key_index.lock);
+
+	oauth_free_jwks(old);
+	oauth_token_cache_clear();
+
+	pthread_mutex_lock(&feed->lock);
+	for (i = 0; i < JWKS_UNKNOWN_KIDS; i++) {
+		free(feed->unknown[i].kid);
+		feed->unknown[i].kid = NULL;
+		feed->unknown[i].until = 0;
+	}
+	pthread_mutex_unlock(&feed->lock);
+}
+
+/* Returns the number of seconds until the next fetch */
+static time_t jwks_feed_fetch(
+	struct oauth_jwks_feed *feed
+) {
+	struct jwks_response resp = { .max_age = -1 };
+	struct curl_slist *headers = NULL;
+	time_t interval = JWKS_REFRESH_MIN;
+	const char *errstr = NULL;
+	long status = 0;
+	jwks_t *jwks;
+	CURLcode rc;
+	CURL *curl;
+
+	if ((curl = curl_easy_init()) == NULL) {
+		syslog(LOG_ERR, "Error in curl_easy_init");
+		return interval;
+	}
+
+	headers = jwks_request_header(headers, "If-None-Match", feed->etag);
+	headers = jwks_request_header(headers, "If-Modified-Since", feed->last_modified);
+
+	curl_easy_setopt(curl, CURLOPT_URL, feed->uri);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, 10L);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, (long)JWKS_FETCH_TIMEOUT);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, jwks_response_write);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &resp);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, jwks_response_header);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, &resp);
+	curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+	curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, jwks_feed_progress);
+	curl_easy_setopt(curl, CURLOPT_XFERINFODATA, feed);
+
+	if ((rc = curl_easy_perform(curl)) != CURLE_OK) {
+		syslog(LOG_ERR, "Failed to fetch JWKS from %s: %s", feed->uri, curl_easy_strerror(rc));
+		goto out;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+	if (status == 304) {
+		syslog(LOG_DEBUG, "JWKS from %s not modified", feed->uri);
+		if (resp.etag != NULL) {
+			free(feed->etag);
+			feed->etag = resp.etag;
+			resp.etag = NULL;
+		}
+		interval = jwks_response_interval(&resp);
+		goto out;
+	}
+
+	if (status != 200 || resp.body == NULL) {
+		syslog(LOG_ERR, "Failed to fetch JWKS from %s: HTTP status %ld", feed->uri, status);
+		goto out;
+	}
+
+	if ((jwks = jwks_import(resp.body, &errstr)) == NULL) {
+		syslog(LOG_ERR, "Failed to load JWKS from %s: %s", feed->uri, errstr);
+		goto out;
+	}
+
+	jwks_feed_swap(feed, jwks);
+	syslog(LOG_NOTICE, "Loaded JWKS from %s", feed->uri);
+
+	free(feed->etag);
+	free(feed->last_modified);
+	feed->etag = resp.etag;
+	feed->last_modified = resp.last_modified;
+	resp.etag = resp.last_modified = NULL;
+	interval = jwks_response_interval(&resp);
+
+out:
+	jwks_response_reset(&resp);
+	curl_slist_free_all(headers);
+	curl_easy_cleanup(curl);
+	return interval;
+}
+
+static void * jwks_feed_run(
+	void *arg
+) {
+	struct oauth_jwks_feed *feed = arg;
+	struct timespec ts = { 0, 0 };
+	time_t interval;
+
+	pthread_mutex_lock(&feed->lock);
+	while (!feed->stop) {
+		if (!feed->wakeup && time(NULL) < ts.tv_sec) {
+			pthread_cond_timedwait(&feed->cond, &feed->lock, &ts);
+			continue;
+		}
+		feed->wakeup = false;
+		pthread_mutex_unlock(&feed->lock);
+
+		interval = jwks_feed_fetch(feed);
+
+		pthread_mutex_lock(&feed->lock);
+		feed->last_fetch = time(NULL);
+		ts.tv_sec = feed->last_fetch + interval;
+	}
+	pthread_mutex_unlock(&feed->lock);
+	return NULL;
+}
+
+static void jwks_curl_init(void) {
+	curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+/* Start the thread if it is not yet running in this process */
+static void jwks_feed_start(
+	struct oauth_jwks_feed *feed
+) {
+	static pthread_once_t curl_once = PTHREAD_ONCE_INIT;
+	pid_t pid = getpid();
+	int rc;
+
+	pthread_mutex_lock(&feed->lock);
+	if (feed->pid != pid && !feed->stop) {
+		pthread_once(&curl_once, jwks_curl_init);
+		if ((rc = pthread_create(&feed->thread, NULL, jwks_feed_run, feed)) == 0)
+			feed->pid = pid;
+		else
+			syslog(LOG_ERR, "Failed to start JWKS refresh for %s: %s", feed->uri, strerror(rc));
+	}
+	pthread_mutex_unlock(&feed->lock);
+}
+
+static bool jwks_feed_unknown_kid(
+	struct oauth_jwks_feed *feed,
+	const char *kid
+) {
+	time_t now = time(NULL);
+	int i, slot = 0;
+
+	pthread_mutex_lock(&feed->lock);
+	for (i = 0; i < JWKS_UNKNOWN_KIDS; i++) {
+		if (feed->unknown[i].kid != NULL && strcmp(feed->unknown[i].kid, kid) == 0) {
+			slot = i;
+			break;
+		}
+		if (feed->unknown[i].until < feed->unknown[slot].until)
+			slot = i;
+	}
+
+	if (i < JWKS_UNKNOWN_KIDS && feed->unknown[slot].until > now) {
+		pthread_mutex_unlock(&feed->lock);
+		return false;
+	}
+
+	free(feed->unknown[slot].kid);
+	feed->unknown[slot].kid = strdup(kid);
+	feed->unknown[slot].until = now + JWKS_REFRESH_MIN;
+
+	if (now - feed->last_fetch >= JWKS_REFRESH_MIN) {
+		feed->wakeup = true;
+		pthread_cond_signal(&feed->cond);
+	}
+	pthread_mutex_unlock(&feed->lock);
+	return true;
+}
+
+struct oauth_jwks_feed * oauth_jwks_feed_get(
+	const char *uri
+) {
+	struct oauth_jwks_feed *feed;
+
+	pthread_mutex_lock(&jwks_feeds.lock);
+	for (feed = jwks_feeds.head; feed != NULL; feed = feed->next) {
+		if (strcmp(feed->uri, uri) == 0) {
+			feed->refs++;
+			goto out;
+		}
+	}
+
+	if ((feed = calloc(1, sizeof(*feed))) == NULL || (feed->uri = strdup(uri)) == NULL) {
+		free(feed);
+		feed = NULL;
+		goto out;
+	}
+	pthread_mutex_init(&feed->lock, NULL);
+	pthread_cond_init(&feed->cond, NULL);
+	feed->refs = 1;
+	feed->next = jwks_feeds.head;
+	jwks_feeds.head = feed;
+
+out:
+	pthread_mutex_unlock(&jwks_feeds.lock);
+	return feed;
+}
+
+void oauth_jwks_feed_release(
+	struct oauth_jwks_feed *feed
+) {
+	struct oauth_jwks_feed **pfeed;
+	bool joinable;
+	jwks_t *jwks;
+	int i;
+
+	if (feed == NULL)
+		return;
+
+	pthread_mutex_lock(&jwks_feeds.lock);
+	if (--feed->refs > 0) {
+		pthread_mutex_unlock(&jwks_feeds.lock);
+		return;
+	}
+	for (pfeed = &jwks_feeds.head; *pfeed != feed; pfeed = &(*pfeed)->next)
+		;
+	*pfeed = feed->next;
+	pthread_mutex_unlock(&jwks_feeds.lock);
+
+	/* after fork() the thread only exists in the parent */
+	pthread_mutex_lock(&feed->lock);
+	feed->stop = true;
+	joinable = feed->pid == getpid();
+	pthread_cond_signal(&feed->cond);
+	pthread_mutex_unlock(&feed->lock);
+	if (joinable)
+		pthread_join(feed->thread, NULL);
+
+	pthread_mutex_lock(&key_index.lock);
+	jwks = feed->jwks;
+	feed->jwks = NULL;
+	pthread_mutex_unlock(&key_index.lock);
+	oauth_free_jwks(jwks);
+
+	for (i = 0; i < JWKS_UNKNOWN_KIDS; i++)
+		free(feed->unknown[i].kid);
+	free(feed->etag);
+	free(feed->last_modified);
+	free(feed->uri);
+	pthread_cond_destroy(&feed->cond);
+	pthread_mutex_destroy(&feed->lock);
+	free(feed);
+}
+
+/* Must be called with key_index.lock held */
+static const jwks_t * current_jwks(
+	const oauth_glob_context_t *gctx
+) {
+	if (gctx->jwks_feed != NULL && gctx->jwks_feed->jwks != NULL)
+		return gctx->jwks_feed->jwks;
+	return gctx->jwks;
+}
+
 const char* oauth_enum_error_string(enum OAuthError code) {
 	switch(code) {
 		case OK:
@@ -155,22 +1109,130 @@ enum OAuthError oauth_check_token_issuer(
 	return INVALID_ISSUER;
 }
 
+static unsigned set_hash(
+	const char *name,
+	size_t len
+) {
+	unsigned hash = 5381;
+
+	while (len--)
+		hash = hash * 33 + (unsigned char)*name++;
+	return hash;
+}
+
+/* Returns the slot holding name, or -1 */
+static long set_find(
+	const struct oauth_set *set,
+	const char *name,
+	size_t len
+) {
+	unsigned hash = set_hash(name, len);
+	size_t i;
+
+	if (set->count == 0)
+		return -1;
+	for (i = hash & set->mask; set->entries[i].name != NULL; i = (i + 1) & set->mask) {
+		const struct oauth_set_entry *entry = &set->entries[i];
+		if (entry->hash == hash && entry->len == len && memcmp(entry->name, name, len) == 0)
+			return (long)i;
+	}
+	return -1;
+}
+
+static void set_free(
+	struct oauth_set *set
+) {
+	free(set->entries);
+	memset(set, 0, sizeof(*set));
+}
+
+/* The set only references the names, so the list must outlive it */
+static int set_init(
+	struct oauth_set *set,
+	struct oauth_list *first
+) {
+	struct oauth_list *item;
+	size_t n = 0, size = 8;
+
+	memset(set, 0, sizeof(*set));
+	for (item = first; item != NULL; item = SLIST_NEXT(item, next))
+		n++;
+	while (size < 2 * n)
+		size *= 2;
+	if ((set->entries = calloc(size, sizeof(*set->entries))) == NULL)
+		return -1;
+	set->mask = size - 1;
+
+	for (item = first; item != NULL; item = SLIST_NEXT(item, next)) {
+		size_t len = strlen(item->name);
+		unsigned hash = set_hash(item->name, len);
+		size_t i;
+
+		if (set_find(set, item->name, len) >= 0)
+			continue;
+		for (i = hash & set->mask; set->entries[i].name != NULL; i = (i + 1) & set->mask)
+			;
+		set->entries[i].name = item->name;
+		set->entries[i].len = len;
+		set->entries[i].hash = hash;
+		set->count++;
+	}
+	return 0;
+}
+
+/* Build the lookup sets once the trusted_aud, trusted_azp and required_scope lists are complete */
+int oauth_init_sets(
+	oauth_glob_context_t *gctx
+) {
+	if (set_init(&gctx->trusted_aud_set, SLIST_FIRST(&gctx->trusted_aud)) != 0 ||
+	    set_init(&gctx->trusted_azp_set, SLIST_FIRST(&gctx->trusted_azp)) != 0 ||
+	    set_init(&gctx->required_scope_set, SLIST_FIRST(&gctx->required_scope)) != 0) {
+		oauth_free_sets(gctx);
+		return -1;
+	}
+	return 0;
+}
+
+void oauth_free_sets(
+	oauth_glob_context_t *gctx
+) {
+	set_free(&gctx->trusted_aud_set);
+	set_free(&gctx->trusted_azp_set);
+	set_free(&gctx->required_scope_set);
+}
+
 enum OAuthError oauth_check_token_audience(
 	oauth_serv_context_t *ctx,
 	const void *utils,
 	jwt_t *jwt
 ) {
-	enum OAuthError ret = OK;
-	struct oauth_list *rp;
+	const struct oauth_set *set = &ctx->glob_context->trusted_aud_set;
+	const char *aud;
+	json_t *j_aud, *j_value;
+	size_t index;
+	bool found = false;
+
+	if (set->count == 0)
+		return OK;
 
-	SLIST_FOREACH(rp, &ctx->glob_context->trusted_aud, next) {
-		if (r_jwt_validate_claims(jwt, R_JWT_CLAIM_AUD, rp->name, R_JWT_CLAIM_NOP) == RHN_OK)
+	/* "aud" is either a single string or an array of strings */
+	if ((aud = r_jwt_get_claim_str_value(jwt, "aud")) != NULL) {
+		if (set_find(set, aud, strlen(aud)) >= 0)
+			return OK;
+	} else if ((j_aud = r_jwt_get_claim_json_t_value(jwt, "aud")) != NULL) {
+		json_array_foreach(j_aud, index, j_value) {
+			if (json_is_string(j_value) && set_find(set, json_string_value(j_value), json_string_length(j_value)) >= 0) {
+				found = true;
+				break;
+			}
+		}
+		json_decref(j_aud);
+		if (found)
 			return OK;
-		ret = INVALID_AUDIENCE;
 	}
 
-	if (ret != OK) oauth_error(utils, 0, "invalid or not given audience: %s", r_jwt_get_claim_str_value(jwt, "aud"));
-	return ret;
+	oauth_error(utils, 0, "invalid or not given audience: %s", aud);
+	return INVALID_AUDIENCE;
 }
 
 enum OAuthError oidc_check_token_authorized_party(
@@ -178,19 +1240,17 @@ enum OAuthError oidc_check_token_authorized_party(
 	const void *utils,
 	jwt_t *jwt
 ) {
-	enum OAuthError ret = OK;
-	struct oauth_list *rp;
+	const struct oauth_set *set = &ctx->glob_context->trusted_azp_set;
+	const char *azp;
 
-	if (r_jwt_validate_claims(jwt, R_JWT_CLAIM_STR, "azp", NULL, R_JWT_CLAIM_NOP) != RHN_OK)
+	if ((azp = r_jwt_get_claim_str_value(jwt, "azp")) == NULL)
 		return OK;
 
-	SLIST_FOREACH(rp, &ctx->glob_context->trusted_azp, next) {
-		if (r_jwt_validate_claims(jwt, R_JWT_CLAIM_STR, "azp", rp->name, R_JWT_CLAIM_NOP) == RHN_OK)
-			return OK;
-		ret = INVALID_AUTHORIZED_PARTY;
-	}
-	if (ret != OK) oauth_error(utils, 0, "token contains no or invalid azp: %s", r_jwt_get_claim_str_value(jwt, "azp"));
-	return ret;
+	if (set->count == 0 || set_find(set, azp, strlen(azp)) >= 0)
+		return OK;
+
+	oauth_error(utils, 0, "token contains no or invalid azp: %s", azp);
+	return INVALID_AUTHORIZED_PARTY;
 }
 
 enum OAuthError oauth_check_token_validity_dates(
@@ -220,13 +1280,38 @@ enum OAuthError oauth_check_required_scopes(
 	const void *utils,
 	jwt_t *jwt
 ) {
-	struct oauth_list *scope;
+	const struct oauth_set *set = &ctx->glob_context->required_scope_set;
+	const char *scope, *p;
+	size_t found = 0;
+	char *seen;
+
+	if (set->count == 0)
+		return OK;
 
-	SLIST_FOREACH(scope, &ctx->glob_context->required_scope, next) {
-		if (r_jwt_validate_claims(jwt, R_JWT_CLAIM_STR, "scope", scope->name, R_JWT_CLAIM_NOP) != RHN_OK)
-			return MISSING_SCOPE;
+	if ((scope = r_jwt_get_claim_str_value(jwt, "scope")) == NULL)
+		goto err;
+
+	/* "scope" is a space separated list; mark each required scope it names once */
+	if ((seen = calloc(set->mask + 1, 1)) == NULL)
+		return CONFIG_ERROR;
+	for (p = scope; *p != '\0' && found < set->count; ) {
+		size_t len = strcspn(p, " ");
+		long slot;
+
+		if (len > 0 && (slot = set_find(set, p, len)) >= 0 && !seen[slot]) {
+			seen[slot] = 1;
+			found++;
+		}
+		p += len;
+		p += strspn(p, " ");
 	}
-	return OK;
+	free(seen);
+	if (found == set->count)
+		return OK;
+
+err:
+	oauth_error(utils, 0, "token is missing a required scope: %s", scope);
+	return MISSING_SCOPE;
 }
 
 enum OAuthError oauth_check_token_uid(
@@ -246,46 +1331,49 @@ enum OAuthError oauth_check_token_uid(
 }
 
 
-jwk_t * oauth_get_jwk_for_jwt(
-	oauth_glob_context_t *gctx,
+enum OAuthError oauth_check_jwt_signature(
+	oauth_serv_context_t *ctx,
 	const void *utils,
-	jwt_t *jwt
+	jwt_t *jwt,
+	const char *msg,
+	size_t msg_len
 ) {
+	AUTOPTR(char) claims = NULL;
+	struct oauth_jwks_feed *feed = ctx->glob_context->jwks_feed;
+	struct oauth_key *key;
+	jwa_alg alg;
 	const char *kid;
-	jwk_t *jwk;
+	int rc;
 
 	if ((kid = r_jwt_get_sig_kid(jwt)) == NULL) {
 		oauth_error(utils, 0, "Error in r_jwt_get_sig_kid");
-		goto out;
+		return UNKNOWN_SIGNING_KEY;
 	}
 
-	jwk = r_jwks_get_by_kid(gctx->jwks, kid);
-	if (!jwk) {
+	pthread_mutex_lock(&key_index.lock);
+	if ((key = key_index_find(current_jwks(ctx->glob_context), kid)) != NULL)
+		key->refs++;
+	pthread_mutex_unlock(&key_index.lock);
+	if (!key) {
+		if (feed != NULL && jwks_feed_unknown_kid(feed, kid))
+			oauth_log(utils, LOG_NOTICE, "Unknown kid %s, refreshing JWKS", kid);
 		oauth_error(utils, 0, "Could not get kid %s from JWKS", kid);
-		goto out;
+		return UNKNOWN_SIGNING_KEY;
 	}
 
-	return jwk;
-
-out:
-	return NULL;
-}
-
-
-enum OAuthError oauth_check_jwt_signature(
-	oauth_serv_context_t *ctx,
-	const void *utils,
-	jwt_t *jwt
-) {
-	AUTOPTR(char) claims = NULL;
-	AUTOPTR(jwk_t) jwk = NULL;
-
-	jwk = oauth_get_jwk_for_jwt(ctx->glob_context, utils, jwt);
-	if (!jwk) {
-		return UNKNOWN_SIGNING_KEY;
+	alg = r_jwt_get_sig_alg(jwt);
+	if (key->alg != R_JWA_ALG_UNKNOWN && key->alg != alg) {
+		key_release(key);
+		oauth_error(utils, 0, "Algorithm of token does not match key %s", kid);
+		return INVALID_SIGNATURE;
 	}
 
-	if (r_jwt_verify_signature(jwt, jwk, 0) != RHN_OK) {
+	if ((rc = key_verify(key, alg, msg, msg_len)) < 0) {
+		/* not supported by key_verify(), let rhonabwy handle it */
+		rc = r_jwt_verify_signature(jwt, key->jwk, 0) == RHN_OK;
+	}
+	key_release(key);
+	if (!rc) {
 		oauth_error(utils, 0, "Error in r_jwt_verify_signature");
 		return INVALID_SIGNATURE;
 	}
@@ -300,53 +1388,15 @@ jwks_t * oauth_get_jwks(
 	oauth_glob_context_t *gctx,
 	const void *utils
 ) {
+	const char *errstr = NULL;
 	jwks_t *jwks;
 
-	if (r_jwks_init(&jwks) != RHN_OK) {
-		oauth_error(utils, 0, "Error in r_jwks_init");
-		goto out;
-	}
-
-	if (r_jwks_import_from_json_str(jwks, gctx->trusted_jwks_str) != RHN_OK) {
-		oauth_error(utils, 0, "Error in r_jwks_import_from_str");
-		goto out;
-	}
-
-	for (int i=0; i<r_jwks_size(jwks); i++) {
-		jwk_t *jwk = r_jwks_get_at(jwks, i);
-		if(r_jwk_is_valid(jwk) != RHN_OK) {
-			oauth_error(utils, 0, "Error: JWK is not valid");
-			r_jwk_free(jwk);
-			goto out;
-		}
-
-		/*
-		int rc;
-		unsigned char *output;
-		size_t output_len = 4096 * 4;
-
-		output = malloc(output_len);
-		rc = r_jwk_export_to_pem_der(jwk, R_FORMAT_PEM, output, &output_len, 0);
-		if (rc == RHN_ERROR_PARAM) {
-			output = realloc(output, output_len);
-			rc = r_jwk_export_to_pem_der(jwk, R_FORMAT_PEM, output, &output_len, 0);
-		}
-
-		if (rc != RHN_OK) {
-			oauth_error(utils, 0, "Error in r_jwk_export_to_pem_der");
-			free(output);
-			goto out;
-		}
-		oauth_log(utils, LOG_DEBUG, "Exported key:\n%.*s\n", (int)output_len, output);
-		free(output);
-		*/
-		r_jwk_free(jwk);
-	}
+	/* tokens verified with the old keys must be checked again */
+	oauth_token_cache_clear();
 
+	if ((jwks = jwks_import(gctx->trusted_jwks_str, &errstr)) == NULL)
+		oauth_error(utils, 0, "%s", errstr);
 	return jwks;
-
-out:
-	return NULL;
 }
 
 
@@ -354,11 +1404,14 @@ enum OAuthError oauth_check_jwt(
 	oauth_serv_context_t *ctx,
 	const void *utils,
 	const char **oauth_user,
-	char *msg
+	const char *msg,
+	size_t msg_len
 ) {
-	unsigned int msg_len;
 	enum OAuthError error = PARSE_ERROR;
 	AUTOPTR(jwt_t) jwt = NULL;
+	unsigned char digest[TOKEN_DIGEST_LEN];
+	const jwks_t *jwks;
+	bool cacheable;
 
 	if (msg == NULL) {
 		oauth_error(utils, 0, "No token");
@@ -366,26 +1419,40 @@ enum OAuthError oauth_check_jwt(
 	}
 
 	/*
-	 * The message must be long enough to hold an JWT
+	 * The message must be long enough to hold an JWT; it need not be
+	 * terminated, so it can be passed from the client response in place
 	 */
-	msg_len = strlen(msg);
 	if (msg_len < JWT_MINLEN) {
 		oauth_error(utils, 0, "Token too short");
 		return PARSE_ERROR;
 	}
 
+	if (ctx->glob_context->jwks_feed != NULL)
+		jwks_feed_start(ctx->glob_context->jwks_feed);
+
+	pthread_mutex_lock(&key_index.lock);
+	jwks = current_jwks(ctx->glob_context);
+	pthread_mutex_unlock(&key_index.lock);
+
+	cacheable = token_digest(ctx->glob_context, jwks, msg, msg_len, digest) == 0;
+	if (cacheable && token_cache_lookup(ctx, utils, digest)) {
+		oauth_log(utils, LOG_DEBUG, "Token verified before for %s", ctx->authcid);
+		*oauth_user = ctx->authcid;
+		return OK;
+	}
+
 	// parse the token
 	if (r_jwt_init(&jwt) != RHN_OK) {
 		oauth_error(utils, 0, "Error in r_jwt_init");
 		return CONFIG_ERROR;
 	}
 
-	if (r_jwt_parse(jwt, msg, 0) != RHN_OK) {
-		oauth_error(utils, 0, "Error in r_jwt_parse");
+	if (r_jwt_parsen(jwt, msg, msg_len, 0) != RHN_OK) {
+		oauth_error(utils, 0, "Error in r_jwt_parsen");
 		return PARSE_ERROR;
 	}
 
-	if ((error = oauth_check_jwt_signature(ctx, utils, jwt)) != OK)
+	if ((error = oauth_check_jwt_signature(ctx, utils, jwt, msg, msg_len)) != OK)
 		return error;
 	if ((error = oauth_check_token_issuer(ctx, utils, jwt)) != OK)
 		return error;
@@ -400,12 +1467,15 @@ enum OAuthError oauth_check_jwt(
 	if ((error = oauth_check_token_uid(ctx, utils, jwt)) != OK)
 		return error;
 
+	if (cacheable)
+		token_cache_store(ctx, digest, jwt);
+
 	*oauth_user = ctx->authcid;
 	return error;
 }
 
 #ifdef HACK
-/* To compile with gcc oauthbearer.c -lrhonabwy -lsasl2 -lorcania -lyder -ljansson -DHACK */
+/* To compile with gcc oauthbearer.c -lrhonabwy -lgnutls -lcurl -lsasl2 -lorcania -lyder -ljansson -DHACK */
 
 // curl https://ucs-sso-ng.$(hostname -d)/realms/master/protocol/openid-connect/certs | python -c 'import json, sys; print(json.dumps(json.load(sys.stdin)["keys"][0]))'
 // static const char jwk_str[] = ...;
@@ -445,6 +1515,8 @@ int main() {
 	SLIST_INIT(&gctx->required_scope);
 	SLIST_INSERT_HEAD(&gctx->required_scope, &required_scope, next);
 
+	oauth_init_sets(gctx);
+
 	oauth_serv_context_t ctx;
 	ctx.glob_context = gctx;
 
@@ -453,7 +1525,7 @@ int main() {
 
 	y_init_logs("Rhonabwy", Y_LOG_MODE_CONSOLE, Y_LOG_LEVEL_DEBUG, NULL, "Starting Rhonabwy JWS tests");
 
-	rc = oauth_check_jwt(&ctx, utils, oauth_user, test_token_str);
+	rc = oauth_check_jwt(&ctx, utils, oauth_user, test_token_str, strlen(test_token_str));
 	if (rc != OK) {
 		printf("Got user: %s\n", ctx.authcid);
 	} else {
@@ -53,15 +53,34 @@ struct oauth_list {
 	SLIST_ENTRY(oauth_list) next;
 };
 
+/* Open addressing hash set over the names of an oauth_list, see oauth_init_sets() */
+struct oauth_set_entry {
+	const char *name;
+	size_t len;
+	unsigned hash;
+};
+
+struct oauth_set {
+	struct oauth_set_entry *entries;
+	size_t mask;
+	size_t count;
+};
+
+struct oauth_jwks_feed;
+
 typedef struct {
 	const char *uid_attr;
 	time_t grace;
 	SLIST_HEAD(oauth_trusted_aud_list_head, oauth_list) trusted_aud;
 	SLIST_HEAD(oauth_trusted_azp_list_head, oauth_list) trusted_azp;
 	SLIST_HEAD(oauth_required_scope_list_head, oauth_list) required_scope;
+	struct oauth_set trusted_aud_set;
+	struct oauth_set trusted_azp_set;
+	struct oauth_set required_scope_set;
 	const char *trusted_iss;
 	char *trusted_jwks_str;
 	jwks_t *jwks;
+	struct oauth_jwks_feed *jwks_feed;
 	bool tls_required;
 } oauth_glob_context_t;
 
@@ -79,5 +98,11 @@ int oauth_strdup(const void *, const char *, char **, int *);
 int oauth_retcode(enum OAuthError);
 
 jwks_t * oauth_get_jwks(oauth_glob_context_t *, const void *);
-enum OAuthError oauth_check_jwt(oauth_serv_context_t *, const void *, const char **, char *);
+void oauth_free_jwks(jwks_t *);
+struct oauth_jwks_feed * oauth_jwks_feed_get(const char *);
+void oauth_jwks_feed_release(struct oauth_jwks_feed *);
+int oauth_init_sets(oauth_glob_context_t *);
+void oauth_free_sets(oauth_glob_context_t *);
+enum OAuthError oauth_check_jwt(oauth_serv_context_t *, const void *, const char **, const char *, size_t);
+void oauth_token_cache_clear(void);
 const char* oauth_enum_error_string(enum OAuthError);
@@ -39,8 +39,10 @@
 #include <syslog.h>
 #include <errno.h>
 #include <pwd.h>
+#include <pthread.h>
 #include <sys/param.h>
 #include <sys/queue.h>
+#include <sys/stat.h>
 
 #include <security/pam_modules.h>
 #include <security/pam_appl.h>
@@ -119,6 +121,172 @@ int oauth_retcode(
 	}
 }
 
+/*
+ * Process-wide cache of the parsed JWKS files.
+ *
+ * The global context only lives as long as one PAM handle, but long-lived
+ * services like Dovecot open a new handle for every login. The keys are
+ * therefore shared by all handles and only parsed again when the file
+ * changes. An entry replaced by a newer version of its file is marked stale
+ * and freed once the last context using it is gone.
+ */
+struct jwks_cache_entry {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	jwks_t *jwks;
+	unsigned refs;
+	bool stale;
+	SLIST_ENTRY(jwks_cache_entry) next;
+};
+
+static SLIST_HEAD(jwks_cache_head, jwks_cache_entry) jwks_cache = SLIST_HEAD_INITIALIZER(jwks_cache);
+static pthread_mutex_t jwks_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Must be called with jwks_cache_lock held */
+static void jwks_cache_unref(
+	struct jwks_cache_entry *entry
+) {
+	if (--entry->refs > 0)
+		return;
+
+	SLIST_REMOVE(&jwks_cache, entry, jwks_cache_entry, next);
+	oauth_free_jwks(entry->jwks);
+	free(entry->path);
+	free(entry);
+}
+
+static void jwks_cache_release(
+	jwks_t *jwks
+) {
+	struct jwks_cache_entry *entry;
+
+	pthread_mutex_lock(&jwks_cache_lock);
+	SLIST_FOREACH(entry, &jwks_cache, next) {
+		if (entry->jwks == jwks) {
+			jwks_cache_unref(entry);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&jwks_cache_lock);
+}
+
+static char *jwks_read(
+	FILE *jwks_fp
+) {
+	char *jwks_str;
+
+	if (fseek(jwks_fp, 0, SEEK_END) != 0) {
+		syslog(LOG_ERR, "Failed to seek JWKS");
+		return NULL;
+	}
+
+	long fsize = ftell(jwks_fp);
+	if (fsize < 0) {
+		syslog(LOG_ERR, "Failed to determine JWKS size");
+		return NULL;
+	}
+
+	rewind(jwks_fp);
+
+	jwks_str = malloc(fsize + 1);
+	if (!jwks_str) {
+		syslog(LOG_ERR, "Out of memory reading JWKS");
+		return NULL;
+	}
+
+	if (fread(jwks_str, 1, fsize, jwks_fp) != (size_t)fsize) {
+		syslog(LOG_ERR, "Failed to read full JWKS");
+		free(jwks_str);
+		return NULL;
+	}
+
+	jwks_str[fsize] = '\0';
+	return jwks_str;
+}
+
+/*
+ * Return the keys of the JWKS file at path, parsing it only if it is not
+ * cached yet or has changed since. The reference must be dropped with
+ * jwks_cache_release().
+ */
+static jwks_t * jwks_cache_get(
+	const char *path
+) {
+	struct jwks_cache_entry *entry;
+	oauth_glob_context_t tmp;
+	jwks_t *jwks = NULL;
+	struct stat st;
+	FILE *jwks_fp;
+
+	jwks_fp = fopen(path, "r");
+	if (!jwks_fp) {
+		syslog(LOG_ERR, "Failed to open JWKS");
+		return NULL;
+	}
+
+	if (fstat(fileno(jwks_fp), &st) != 0) {
+		syslog(LOG_ERR, "Failed to stat JWKS");
+		fclose(jwks_fp);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&jwks_cache_lock);
+
+	SLIST_FOREACH(entry, &jwks_cache, next) {
+		if (!entry->stale && strcmp(entry->path, path) == 0)
+			break;
+	}
+
+	if (entry != NULL) {
+		if (entry->dev == st.st_dev && entry->ino == st.st_ino && entry->size == st.st_size &&
+		    entry->mtime.tv_sec == st.st_mtim.tv_sec && entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			entry->refs++;
+			jwks = entry->jwks;
+			goto out;
+		}
+
+		syslog(LOG_DEBUG, "JWKS \"%s\" has changed", path);
+		entry->stale = true;
+		jwks_cache_unref(entry);
+	}
+
+	if ((entry = calloc(1, sizeof(*entry))) == NULL || (entry->path = strdup(path)) == NULL) {
+		syslog(LOG_ERR, "malloc() failed: %s", strerror(errno));
+		free(entry);
+		goto out;
+	}
+
+	memset(&tmp, 0, sizeof(tmp));
+	if ((tmp.trusted_jwks_str = jwks_read(jwks_fp)) != NULL) {
+		entry->jwks = oauth_get_jwks(&tmp, NULL);
+		free(tmp.trusted_jwks_str);
+	}
+
+	if (!entry->jwks) {
+		syslog(LOG_ERR, "Failed to load JWKS from \"%s\"", path);
+		free(entry->path);
+		free(entry);
+		goto out;
+	}
+
+	entry->dev = st.st_dev;
+	entry->ino = st.st_ino;
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtim;
+	entry->refs = 2; /* the cache and the caller */
+	SLIST_INSERT_HEAD(&jwks_cache, entry, next);
+	jwks = entry->jwks;
+	syslog(LOG_DEBUG, "Read JWKS from \"%s\"", path);
+
+out:
+	pthread_mutex_unlock(&jwks_cache_lock);
+	fclose(jwks_fp);
+	return jwks;
+}
+
 static void gctx_cleanup(
 	pam_handle_t *pamh,
 	void *data,
@@ -134,11 +302,18 @@ static void gctx_cleanup(
 			gctx->uid_attr = NULL;
 		}
 
+		if (gctx->jwks_feed != NULL) {
+			oauth_jwks_feed_release(gctx->jwks_feed);
+			gctx->jwks_feed = NULL;
+		}
+
 		if (gctx->jwks != NULL) {
-			r_jwks_free(gctx->jwks);
+			jwks_cache_release(gctx->jwks);
 			gctx->jwks = NULL;
 		}
 
+		oauth_free_sets(gctx);
+
 		while ((item = SLIST_FIRST(&gctx->trusted_aud)) != NULL) {
 			SLIST_REMOVE_HEAD(&gctx->trusted_aud, next);
 			free(item);
@@ -207,6 +382,8 @@ static oauth_glob_context_t * pam_global_context_init(
 
 	int num_of_iss = 0;
 	int num_of_jwks = 0;
+	const char *jwks_path = NULL;
+	const char *jwks_uri = NULL;
 	for (i = 0; i < ac; i++) {
 		const char *data;
 
@@ -309,51 +486,13 @@ static oauth_glob_context_t * pam_global_context_init(
 				continue;
 			}
 
-			FILE *jwks_fp = fopen(data, "r");
-			if (!jwks_fp) {
-				syslog(LOG_ERR, "Failed to open JWKS");
-				goto cleanup;
-			}
-
-			if (fseek(jwks_fp, 0, SEEK_END) != 0) {
-				syslog(LOG_ERR, "Failed to seek JWKS");
-				fclose(jwks_fp);
-				goto cleanup;
-			}
-
-			long fsize = ftell(jwks_fp);
-			if (fsize < 0) {
-				syslog(LOG_ERR, "Failed to determine JWKS size");
-				fclose(jwks_fp);
-				goto cleanup;
-			}
-
-			rewind(jwks_fp);
-
-			gctx->trusted_jwks_str = malloc(fsize + 1);
-			if (!gctx->trusted_jwks_str) {
-				syslog(LOG_ERR, "Out of memory reading JWKS");
-				fclose(jwks_fp);
-				goto cleanup;
-			}
-
-			if (fread(gctx->trusted_jwks_str, 1, fsize, jwks_fp) != (size_t)fsize) {
-				syslog(LOG_ERR, "Failed to read full JWKS");
-				fclose(jwks_fp);
-				goto cleanup;
-			}
-
-			gctx->trusted_jwks_str[fsize] = '\0';
-			fclose(jwks_fp);
-
-			if (!gctx->trusted_jwks_str) {
-				error = PAM_SYSTEM_ERR;
-				syslog(LOG_ERR, "Failed to load JWKS from \"%s\"", data);
-				goto cleanup;
-			}
-
+			jwks_path = data;
 			num_of_jwks++;
-			syslog(LOG_DEBUG, "Read JWKS from \"%s\"", data);
+			continue;
+		}
+
+		if ((data = SETARG(av[i], "jwks_uri")) != NULL) {
+			jwks_uri = data;
 			continue;
 		}
 	}
@@ -370,13 +509,25 @@ static oauth_glob_context_t * pam_global_context_init(
 		goto cleanup;
 	}
 
-	gctx->jwks = oauth_get_jwks(gctx, NULL);
+	if (oauth_init_sets(gctx) != 0) {
+		error = PAM_SYSTEM_ERR;
+		syslog(LOG_ERR, "malloc() failed: %s", strerror(errno));
+		goto cleanup;
+	}
+
+	gctx->jwks = jwks_cache_get(jwks_path);
 	if (!gctx->jwks) {
 		error = PAM_SYSTEM_ERR;
 		syslog(LOG_ERR, "Error in oauth_get_jwks");
 		goto cleanup;
 	}
 
+	if (jwks_uri != NULL && (gctx->jwks_feed = oauth_jwks_feed_get(jwks_uri)) == NULL) {
+		error = PAM_SYSTEM_ERR;
+		syslog(LOG_ERR, "malloc() failed: %s", strerror(errno));
+		goto cleanup;
+	}
+
 	error = pam_set_data(pamh, GCTX_DATA, (void *)gctx, gctx_cleanup);
 	if (error != PAM_SUCCESS) {
 		syslog(LOG_ERR, "pam_set_data() failed: %s", pam_strerror(pamh, error));
@@ -503,7 +654,7 @@ PAM_EXTERN int pam_sm_authenticate(
 	if (ctx.glob_context == NULL)
 		return PAM_SYSTEM_ERR;
 
-	error = oauth_retcode(oauth_check_jwt(&ctx, NULL, &oauth_user, (char *)jwt_msg));
+	error = oauth_retcode(oauth_check_jwt(&ctx, NULL, &oauth_user, jwt_msg, strlen(jwt_msg)));
 
 	if ((error != 0) || (oauth_user == NULL)) {
 		error = PAM_AUTH_ERR;
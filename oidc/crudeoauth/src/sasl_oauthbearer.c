@@ -150,39 +150,35 @@ int oauth_retcode(
 	}
 }
 
-/* Convert saslname = 1*(value-safe-char / "=2C" / "=3D") in place.
+/* Convert saslname = 1*(value-safe-char / "=2C" / "=3D") of len bytes
+   into out, which must hold len + 1 bytes, and terminate it.
    Returns SASL_FAIL if the encoding is invalid, otherwise SASL_OK */
 static int decode_saslname(
-	char *buf
+	const char *in,
+	size_t len,
+	char *out
 ) {
-	char *inp;
-	char *outp;
+	const char *end = in + len;
 
-	inp = outp = buf;
-
-	while (*inp) {
-		if (*inp == '=') {
-			inp++;
-			if (*inp == '\0') {
+	while (in < end) {
+		if (*in == '=') {
+			if (end - in < 3) {
 				return SASL_FAIL;
 			}
-			if (inp[0] == '2' && inp[1] == 'C') {
-				*outp = ',';
-				inp += 2;
-			} else if (inp[0] == '3' && inp[1] == 'D') {
-				*outp = '=';
-				inp += 2;
+			if (in[1] == '2' && in[2] == 'C') {
+				*out++ = ',';
+			} else if (in[1] == '3' && in[2] == 'D') {
+				*out++ = '=';
 			} else {
 				return SASL_FAIL;
 			}
+			in += 3;
 		} else {
-			*outp = *inp;
-			inp++;
+			*out++ = *in++;
 		}
-		outp++;
 	}
 
-	*outp = '\0';
+	*out = '\0';
 
 	return SASL_OK;
 }
@@ -289,12 +285,18 @@ static int oauth_server_mech_new(
 	return SASL_OK;
 }
 
+/* A part of the client response, which is not terminated */
+struct oauth_slice {
+	const char *data;
+	size_t len;
+};
+
 static int get_client_response_key(
-	const sasl_utils_t *utils,
 	const char *searchkey,
 	const char *client_response,
-	char **authzid,
-	char **value
+	size_t client_response_len,
+	struct oauth_slice *authzid,
+	struct oauth_slice *value
 ) {
 	/* GS2 header rule ABNF:
 
@@ -305,71 +307,57 @@ static int get_client_response_key(
 	;;gs2-header   = See RFC 5801
 	client-resp    = (gs2-header kvsep *kvpair kvsep) / kvsep
 	*/
-	const int kvsep = 0x01; // client_response separator
-	const size_t kvsep_length = 1;
+	const char kvsep = 0x01; // client_response separator
 	const size_t searchkey_length = strlen(searchkey);
-	const char *current_pos = NULL;
-	int result;
+	const char *end = client_response + client_response_len;
+	const char *current_pos;
+	const char *header_end;
 
 	// Note: This algorithm is not ensuring that the client_response
 	//       ends with two kvsep characters.
 
+	// The gs2-header ends with the first kvsep
+	header_end = memchr(client_response, kvsep, client_response_len);
+	if (!header_end) {
+		return SASL_BADPROT;
+	}
+
 	if (authzid) {
-		// Try to extract an authzid from the gs2-header
-		if (!strncmp(client_response, "n,a=", 4)) {
-			current_pos = client_response + 4;
-			const char *authzid_end = strstr(current_pos, ",\1");
-			if (authzid_end) {
-				if (authzid_end > strchr(current_pos, kvsep)) {
-					return SASL_BADPROT;
-				}
-				unsigned int len = authzid_end - current_pos;
-				unsigned int authzid_len;
-				result = _plug_buf_alloc(utils, authzid, &authzid_len, len + 1);
-				if (result != SASL_OK) {
-					return result;
-				}
-				memcpy(*authzid, current_pos, len);
-				(*authzid)[len] = '\0';
-				decode_saslname(*authzid);
-			} else {
+		authzid->data = NULL;
+		authzid->len = 0;
+		// Try to extract an authzid from the gs2-header "n,a=<saslname>,"
+		if (header_end - client_response > 4 && !memcmp(client_response, "n,a=", 4)) {
+			if (header_end[-1] != ',') {
 				return SASL_BADPROT;
 			}
+			authzid->data = client_response + 4;
+			authzid->len = header_end - 1 - authzid->data;
 		}
 	}
 
-	// Skip the gs2-header
-	current_pos = strchr(client_response, kvsep);
-	if (!current_pos) {
-		return SASL_BADPROT;
-	}
-
-	while (current_pos != NULL && *current_pos != '\0') {
-		const char *key_start = current_pos + kvsep_length;
-		const char *key_end = strchr(current_pos, '=');
+	current_pos = header_end + 1;
+	while (current_pos < end && *current_pos != kvsep) {
+		const char *key_end = memchr(current_pos, '=', end - current_pos);
+		const char *val_start;
+		const char *next_sep;
 
 		if (!key_end) {
 			return SASL_BADPROT;
 		}
-
-		size_t key_length = key_end - key_start;
-		const char *val_start = key_end + 1;  // skip "="
-		const char *next_sep = strchr(val_start, kvsep);
+		val_start = key_end + 1;  // skip "="
+		next_sep = memchr(val_start, kvsep, end - val_start);
 		if (!next_sep) {
 			// no terminating kvsep
 			return SASL_BADPROT;
 		}
 
-		if (key_length == searchkey_length && strncmp(key_start, searchkey, key_length) == 0) {
-			size_t val_length = next_sep - val_start;
-			*value = (char *)utils->malloc(val_length + 1);
-			strncpy(*value, val_start, val_length);
-			(*value)[val_length] = '\0';
-
+		if ((size_t)(key_end - current_pos) == searchkey_length && memcmp(current_pos, searchkey, searchkey_length) == 0) {
+			value->data = val_start;
+			value->len = next_sep - val_start;
 			return SASL_OK;
 		}
 
-		current_pos = next_sep + kvsep_length;
+		current_pos = next_sep + 1;
 	}
 
 	return SASL_BADPROT;
@@ -387,9 +375,10 @@ static int oauth_server_mech_step(
 ) {
 	oauth_serv_context_t *ctx = (oauth_serv_context_t *)conn_context;
 	oauth_glob_context_t *gctx;
+	struct oauth_slice authzid_slice = { NULL, 0 };
+	struct oauth_slice auth_msg = { NULL, 0 };
 	char *authzid = NULL;
 	const char *authcid = NULL;
-	char *auth_msg = NULL;
 	const sasl_ssf_t *ssfp = NULL;
 	int error = SASL_OK;
 	enum OAuthError oauth_errno;
@@ -439,24 +428,37 @@ static int oauth_server_mech_step(
 		return SASL_BADPROT;
 	}
 
-	error = get_client_response_key(params->utils, "auth", clientin, &authzid, &auth_msg);
+	/* parse the message in place, only the authzid is copied if it is encoded */
+	error = get_client_response_key("auth", clientin, clientinlen, &authzid_slice, &auth_msg);
 	if (error != SASL_OK) {
 		params->utils->seterror(params->utils->conn, 0, "No auth found in client response (error=%d)", error);
 		goto out;
 	}
 
-	if (strncasecmp(auth_msg, BEARER_PREFIX, BEARER_LEN) != 0) {
+	if (auth_msg.len < BEARER_LEN || strncasecmp(auth_msg.data, BEARER_PREFIX, BEARER_LEN) != 0) {
 		params->utils->seterror(params->utils->conn, 0, "No bearer token given.");
 		error = SASL_BADPARAM;
 		goto out;
 	}
 
-	char *jwt_msg = auth_msg + BEARER_LEN;
+	if (authzid_slice.len > 0 && memchr(authzid_slice.data, '=', authzid_slice.len) != NULL) {
+		if ((authzid = params->utils->malloc(authzid_slice.len + 1)) == NULL) {
+			error = SASL_NOMEM;
+			goto out;
+		}
+		if (decode_saslname(authzid_slice.data, authzid_slice.len, authzid) != SASL_OK) {
+			params->utils->seterror(params->utils->conn, 0, "Invalid authzid");
+			error = SASL_BADPROT;
+			goto out;
+		}
+		authzid_slice.data = authzid;
+		authzid_slice.len = strlen(authzid);
+	}
 
 	/*
 	 * Validate JWT signature, retreive authcid
 	 */
-	if ((oauth_errno = oauth_check_jwt(ctx, params->utils, &authcid, jwt_msg)) != OK) {
+	if ((oauth_errno = oauth_check_jwt(ctx, params->utils, &authcid, auth_msg.data + BEARER_LEN, auth_msg.len - BEARER_LEN)) != OK) {
 		ctx->serverout_buf = oauthbearer_error_as_json(oauth_errno);
 		*serverout = ctx->serverout_buf;
 		*serveroutlen = (unsigned int) strlen(*serverout);
@@ -470,8 +472,8 @@ static int oauth_server_mech_step(
 	}
 
 	/* Canonicalize Userid if we have one */
-	if ((authzid != NULL) && (*authzid != '\0')) {
-		if ((error = params->canon_user(params->utils->conn, authzid, 0, SASL_CU_AUTHZID, oparams)) != SASL_OK) {
+	if (authzid_slice.len > 0) {
+		if ((error = params->canon_user(params->utils->conn, authzid_slice.data, authzid_slice.len, SASL_CU_AUTHZID, oparams)) != SASL_OK) {
 			params->utils->seterror(params->utils->conn, 0, "canon_user failed for authzid (error=%d)", error);
 			goto out;
 		}
@@ -497,10 +499,6 @@ doneout:
 	oparams->param_version = 0;
 
 out:
-	if (auth_msg != NULL) {
-		params->utils->erasebuffer(auth_msg, strlen(auth_msg));
-		params->utils->free(auth_msg);
-	}
 	if (authzid != NULL) {
 		params->utils->erasebuffer(authzid, strlen(authzid));
 		params->utils->free(authzid);
@@ -542,8 +540,13 @@ static void oauth_server_mech_free(
 		gctx->uid_attr = NULL;
 	}
 
+	if (gctx->jwks_feed != NULL) {
+		oauth_jwks_feed_release(gctx->jwks_feed);
+		gctx->jwks_feed = NULL;
+	}
+
 	if (gctx->jwks != NULL) {
-		r_jwks_free(gctx->jwks);
+		oauth_free_jwks(gctx->jwks);
 		gctx->jwks = NULL;
 	}
 
@@ -552,6 +555,8 @@ static void oauth_server_mech_free(
 		gctx->trusted_jwks_str = NULL;
 	}
 
+	oauth_free_sets(gctx);
+
 	while ((item = SLIST_FIRST(&gctx->trusted_aud)) != NULL) {
 		SLIST_REMOVE_HEAD(&gctx->trusted_aud, next);
 		free(item);
@@ -605,6 +610,7 @@ int sasl_server_plug_init(
 	const char *val;
 	const char *no_tls;
 	const char *grace;
+	const char *jwks_uri;
 	char propname[1024];
 	int propnum = 0;
 	FILE *jwks_fp;
@@ -740,6 +746,11 @@ int sasl_server_plug_init(
 		SLIST_INSERT_HEAD(&gctx->required_scope, item, next);
 	} while (1 /*CONSTCOND*/);
 
+	if (oauth_init_sets(gctx) != 0) {
+		utils->log(NULL, SASL_LOG_ERR, "cannot allocate memory");
+		return SASL_NOMEM;
+	}
+
 	/*
 	 * Load the trusted iss names
 	 */
@@ -845,6 +856,17 @@ int sasl_server_plug_init(
 		return SASL_CONFIGERR;
 	}
 
+	/*
+	 * Refresh the JWKS from the IdP
+	 */
+	if (utils->getopt(utils->getopt_context, "OAUTHBEARER", "oauthbearer_trusted_jwks_uri0", &jwks_uri, NULL) == 0 && (jwks_uri != NULL) && (*jwks_uri != '\0')) {
+		if ((gctx->jwks_feed = oauth_jwks_feed_get(jwks_uri)) == NULL) {
+			utils->log(NULL, SASL_LOG_ERR, "cannot allocate memory");
+			return SASL_NOMEM;
+		}
+		utils->log(NULL, SASL_LOG_NOTE, "Refreshing JWKS from \"%s\"", jwks_uri);
+	}
+
 	return SASL_OK;
 }
 
@@ -58,94 +58,367 @@
 */
 
 #include "ldb_module.h"
+#include <univention/config.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
-static char *LOGFILENAME = "/tmp/univention_ldb_log_module.log";
+#define DEFAULT_LOGFILENAME "/tmp/univention_ldb_log_module.log"
+#define DEFAULT_OPERATIONS "add modify delete rename"
+/* Records are handed to the writer thread, which flushes at least this often */
+#define FLUSH_INTERVAL 1
+/* Wake the writer early once this much is pending */
+#define FLUSH_THRESHOLD (64 * 1024)
+/* Requests wait for the writer instead of growing the buffer without bounds */
+#define BUFFER_LIMIT (4 * 1024 * 1024)
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_mutex_t file_lock;	/* protects filename, fd and st; taken after lock */
+	pthread_cond_t wakeup;	/* signalled for the writer */
+	pthread_cond_t drained;	/* signalled by the writer after each flush */
+	char *filename;
+	unsigned int operations;	/* bit mask of enum ldb_request_type */
+	unsigned long sample;	/* only log every n-th selected request */
+	unsigned long counter;
+	char *buf;
+	size_t len, size;
+	bool running;
+	bool hooks;
+	pid_t pid;
+	int fd;
+	struct stat st;
+} logger = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.file_lock = PTHREAD_MUTEX_INITIALIZER,
+	.wakeup = PTHREAD_COND_INITIALIZER,
+	.drained = PTHREAD_COND_INITIALIZER,
+	.sample = 1,
+	.fd = -1,
+};
+
+static const struct {
+	const char *name;
+	enum ldb_request_type operation;
+} operation_names[] = {
+	{"search", LDB_SEARCH},
+	{"add", LDB_ADD},
+	{"modify", LDB_MODIFY},
+	{"delete", LDB_DELETE},
+	{"rename", LDB_RENAME},
+	{"extended", LDB_EXTENDED},
+};
+
+static unsigned int parse_operations(const char *value)
+{
+	unsigned int mask = 0;
+	char *copy = strdup(value), *saveptr = NULL, *token;
+	int i;
+
+	if (copy == NULL)
+		return 0;
+	for (token = strtok_r(copy, ", ", &saveptr); token != NULL; token = strtok_r(NULL, ", ", &saveptr)) {
+		if (!strcasecmp(token, "all")) {
+			mask = ~0U;
+			continue;
+		}
+		for (i = 0; i < sizeof(operation_names) / sizeof(operation_names[0]); i++) {
+			if (!strcasecmp(token, operation_names[i].name))
+				mask |= 1U << operation_names[i].operation;
+		}
+	}
+	free(copy);
+	return mask;
+}
+
+/* (Re-)open the log file when it is not open yet or has been rotated away. */
+static void log_open(void)
+{
+	struct stat st;
+
+	if (logger.filename == NULL)
+		return;
+	if (logger.fd >= 0 && stat(logger.filename, &st) == 0 && st.st_dev == logger.st.st_dev && st.st_ino == logger.st.st_ino)
+		return;
+	if (logger.fd >= 0)
+		close(logger.fd);
+	logger.fd = open(logger.filename, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+	if (logger.fd >= 0 && fstat(logger.fd, &logger.st) != 0)
+		memset(&logger.st, 0, sizeof(logger.st));
+}
+
+static void log_write_unlocked(const char *buf, size_t len)
+{
+	log_open();
+	while (logger.fd >= 0 && len > 0) {
+		ssize_t r = write(logger.fd, buf, len);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		buf += r;
+		len -= r;
+	}
+}
+
+static void log_write(const char *buf, size_t len)
+{
+	pthread_mutex_lock(&logger.file_lock);
+	log_write_unlocked(buf, len);
+	pthread_mutex_unlock(&logger.file_lock);
+}
+
+/* Takes the pending records and writes them outside of the lock, so requests
+ * are only ever blocked for a memcpy. The file lock is taken first to keep
+ * the records in order. */
+static void log_flush_locked(void)
+{
+	char *buf = logger.buf;
+	size_t len = logger.len;
+
+	if (len == 0)
+		return;
+	logger.buf = NULL;
+	logger.len = logger.size = 0;
+	pthread_mutex_lock(&logger.file_lock);
+	pthread_mutex_unlock(&logger.lock);
+	log_write_unlocked(buf, len);
+	pthread_mutex_unlock(&logger.file_lock);
+	free(buf);
+	pthread_mutex_lock(&logger.lock);
+	pthread_cond_broadcast(&logger.drained);
+}
+
+static void *log_writer(void *arg)
+{
+	struct timespec deadline;
+
+	pthread_mutex_lock(&logger.lock);
+	for (;;) {
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += FLUSH_INTERVAL;
+		while (logger.len < FLUSH_THRESHOLD) {
+			if (pthread_cond_timedwait(&logger.wakeup, &logger.lock, &deadline) == ETIMEDOUT)
+				break;
+		}
+		log_flush_locked();
+	}
+	return NULL;
+}
+
+static void log_atexit(void)
+{
+	pthread_mutex_lock(&logger.lock);
+	if (logger.pid == getpid())
+		log_flush_locked();
+	pthread_mutex_unlock(&logger.lock);
+}
+
+static void log_atfork_prepare(void)
+{
+	pthread_mutex_lock(&logger.lock);
+	pthread_mutex_lock(&logger.file_lock);
+}
+
+static void log_atfork_parent(void)
+{
+	pthread_mutex_unlock(&logger.file_lock);
+	pthread_mutex_unlock(&logger.lock);
+}
+
+/* The writer thread does not survive fork() and the pending records belong to
+ * the parent, which is still going to write them. */
+static void log_atfork_child(void)
+{
+	free(logger.buf);
+	logger.buf = NULL;
+	logger.len = logger.size = 0;
+	logger.running = false;
+	pthread_mutex_init(&logger.lock, NULL);
+	pthread_mutex_init(&logger.file_lock, NULL);
+	pthread_cond_init(&logger.wakeup, NULL);
+	pthread_cond_init(&logger.drained, NULL);
+}
+
+static void log_start_locked(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	sigset_t all, old;
+
+	if (logger.running && logger.pid == getpid())
+		return;
+	logger.pid = getpid();
+	if (!logger.hooks) {
+		pthread_atfork(log_atfork_prepare, log_atfork_parent, log_atfork_child);
+		atexit(log_atexit);
+		logger.hooks = true;
+	}
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	logger.running = pthread_create(&thread, &attr, log_writer, NULL) == 0;
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	pthread_attr_destroy(&attr);
+}
+
+static void log_append(const char *record, size_t len)
+{
+	pthread_mutex_lock(&logger.lock);
+	log_start_locked();
+	if (!logger.running) {
+		// Without a writer thread fall back to writing synchronously
+		log_write(record, len);
+		pthread_mutex_unlock(&logger.lock);
+		return;
+	}
+	while (logger.len > 0 && logger.len + len > BUFFER_LIMIT)
+		pthread_cond_wait(&logger.drained, &logger.lock);
+	if (logger.len + len > logger.size) {
+		size_t size = logger.size ? logger.size : FLUSH_THRESHOLD;
+		while (size < logger.len + len)
+			size *= 2;
+		char *buf = realloc(logger.buf, size);
+		if (buf == NULL) {
+			pthread_mutex_unlock(&logger.lock);
+			return;
+		}
+		logger.buf = buf;
+		logger.size = size;
+	}
+	memcpy(logger.buf + logger.len, record, len);
+	logger.len += len;
+	if (logger.len >= FLUSH_THRESHOLD)
+		pthread_cond_signal(&logger.wakeup);
+	pthread_mutex_unlock(&logger.lock);
+}
+
+static bool univention_ldb_log_selected(enum ldb_request_type operation)
+{
+	bool selected;
+
+	if (operation >= 32 || !(logger.operations & (1U << operation)))
+		return false;
+	if (logger.sample == 1)
+		return true;
+	pthread_mutex_lock(&logger.lock);
+	selected = logger.counter++ % logger.sample == 0;
+	pthread_mutex_unlock(&logger.lock);
+	return selected;
+}
 
 static int univention_ldb_log(struct ldb_module *module, struct ldb_request *req)
 {
 	struct ldb_context *ldb;
 	ldb = ldb_module_get_ctx(module);
-	int i, j;
+	int i;
 
-	FILE *fp;
-	fp=fopen(LOGFILENAME, "a");
+	if (!univention_ldb_log_selected(req->operation))
+		return ldb_next_request(module, req);
 
 	// code copied from ldb.c
 	TALLOC_CTX *tmp_ctx = talloc_new(req);
+	char *s = NULL;
 	switch (req->operation) {
 	case LDB_SEARCH:
-		fprintf(fp, "ldb_trace_request: SEARCH\n");
-		fprintf(fp, " dn: %s\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: SEARCH\n");
+		s = talloc_asprintf_append(s, " dn: %s\n",
 			      ldb_dn_is_null(req->op.search.base)?"<rootDSE>":
 			      ldb_dn_get_linearized(req->op.search.base));
-		fprintf(fp, " scope: %s\n",
+		s = talloc_asprintf_append(s, " scope: %s\n",
 			  req->op.search.scope==LDB_SCOPE_BASE?"base":
 			  req->op.search.scope==LDB_SCOPE_ONELEVEL?"one":
 			  req->op.search.scope==LDB_SCOPE_SUBTREE?"sub":"UNKNOWN");
-		fprintf(fp, " expr: %s\n",
+		s = talloc_asprintf_append(s, " expr: %s\n",
 			  ldb_filter_from_tree(tmp_ctx, req->op.search.tree));
 		if (req->op.search.attrs == NULL) {
-			fprintf(fp, " attr: <ALL>\n");
+			s = talloc_asprintf_append(s, " attr: <ALL>\n");
 		} else {
 			for (i=0; req->op.search.attrs[i]; i++) {
-				fprintf(fp, " attr: %s\n", req->op.search.attrs[i]);
+				s = talloc_asprintf_append(s, " attr: %s\n", req->op.search.attrs[i]);
 			}
 		}
 		break;
 	case LDB_DELETE:
-		fprintf(fp, "ldb_trace_request: DELETE\n");
-		fprintf(fp, " dn: %s\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: DELETE\n");
+		s = talloc_asprintf_append(s, " dn: %s\n",
 			      ldb_dn_get_linearized(req->op.del.dn));
 		break;
 	case LDB_RENAME:
-		fprintf(fp, "ldb_trace_request: RENAME\n");
-		fprintf(fp, " olddn: %s\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: RENAME\n");
+		s = talloc_asprintf_append(s, " olddn: %s\n",
 			      ldb_dn_get_linearized(req->op.rename.olddn));
-		fprintf(fp, " newdn: %s\n",
+		s = talloc_asprintf_append(s, " newdn: %s\n",
 			      ldb_dn_get_linearized(req->op.rename.newdn));
 		break;
 	case LDB_EXTENDED:
-		fprintf(fp, "ldb_trace_request: EXTENDED\n");
-		fprintf(fp, " oid: %s\n", req->op.extended.oid);
-		fprintf(fp, " data: %s\n", req->op.extended.data?"yes":"no");
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: EXTENDED\n");
+		s = talloc_asprintf_append(s, " oid: %s\n", req->op.extended.oid);
+		s = talloc_asprintf_append(s, " data: %s\n", req->op.extended.data?"yes":"no");
 		break;
 	case LDB_ADD:
-		fprintf(fp, "ldb_trace_request: ADD\n");
-		fprintf(fp, "%s\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: ADD\n");
+		s = talloc_asprintf_append(s, "%s\n",
 			      ldb_ldif_message_string(ldb, tmp_ctx,
 						      LDB_CHANGETYPE_ADD,
 						      req->op.add.message));
 		break;
 	case LDB_MODIFY:
-		fprintf(fp, "ldb_trace_request: MODIFY\n");
-		fprintf(fp, "%s\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: MODIFY\n");
+		s = talloc_asprintf_append(s, "%s\n",
 			      ldb_ldif_message_string(ldb, tmp_ctx,
 						      LDB_CHANGETYPE_ADD,
 						      req->op.mod.message));
 		break;
 	case LDB_REQ_REGISTER_CONTROL:
-		fprintf(fp, "ldb_trace_request: REGISTER_CONTROL\n");
-		fprintf(fp, "%s\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: REGISTER_CONTROL\n");
+		s = talloc_asprintf_append(s, "%s\n",
 			      req->op.reg_control.oid);
 		break;
 	case LDB_REQ_REGISTER_PARTITION:
-		fprintf(fp, "ldb_trace_request: REGISTER_PARTITION\n");
-		fprintf(fp, "%s\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: REGISTER_PARTITION\n");
+		s = talloc_asprintf_append(s, "%s\n",
 			      ldb_dn_get_linearized(req->op.reg_partition.dn));
 		break;
 	default:
-		fprintf(fp, "ldb_trace_request: UNKNOWN(%u)\n",
+		s = talloc_asprintf(tmp_ctx, "ldb_trace_request: UNKNOWN(%u)\n",
 			      req->operation);
 		break;
 	}
 
-	fclose(fp);
+	if (s != NULL)
+		log_append(s, strlen(s));
 	talloc_free(tmp_ctx);
 
 	return ldb_next_request(module, req);
 }
 
+static int univention_ldb_log_search(struct ldb_module *module, struct ldb_request *req)
+{
+	return univention_ldb_log(module, req);
+}
+
+static int univention_ldb_log_rename(struct ldb_module *module, struct ldb_request *req)
+{
+	return univention_ldb_log(module, req);
+}
+
+static int univention_ldb_log_extended(struct ldb_module *module, struct ldb_request *req)
+{
+	return univention_ldb_log(module, req);
+}
+
 static int univention_ldb_log_add(struct ldb_module *module, struct ldb_request *req)
 {
 	return univention_ldb_log(module, req);
@@ -163,14 +436,36 @@ static int univention_ldb_log_delete(struct ldb_module *module, struct ldb_reque
 
 static int univention_ldb_log_init_context(struct ldb_module *module)
 {
+	char *filename = univention_config_get_string("samba4/ldb/log/file");
+	char *operations = univention_config_get_string("samba4/ldb/log/operations");
+	long sample = univention_config_get_long("samba4/ldb/log/sample");
+
+	pthread_mutex_lock(&logger.lock);
+	logger.operations = parse_operations(operations ? operations : DEFAULT_OPERATIONS);
+	logger.sample = sample > 0 ? sample : 1;
+	pthread_mutex_lock(&logger.file_lock);
+	free(logger.filename);
+	logger.filename = strdup(filename && *filename ? filename : DEFAULT_LOGFILENAME);
+	if (logger.fd >= 0) {
+		close(logger.fd);
+		logger.fd = -1;
+	}
+	pthread_mutex_unlock(&logger.file_lock);
+	pthread_mutex_unlock(&logger.lock);
+	free(filename);
+	free(operations);
+
 	return ldb_next_init(module);
 }
 
 static struct ldb_module_ops ldb_univention_ldb_log_module_ops = {
 	.name	= "univention_ldb_log",
+	.search	= univention_ldb_log_search,
 	.add	= univention_ldb_log_add,
 	.modify	= univention_ldb_log_modify,
 	.del	= univention_ldb_log_delete,
+	.rename	= univention_ldb_log_rename,
+	.extended	= univention_ldb_log_extended,
 	.init_context	= univention_ldb_log_init_context,
 };
 
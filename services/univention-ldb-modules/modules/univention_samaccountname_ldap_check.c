@@ -65,6 +65,10 @@
 #include <errno.h>
 #include <string.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <util/data_blob.h>
 #include <core/werror.h>
 
@@ -78,6 +82,12 @@
 #define SLAP_LDAPDN_MAXLEN 8192
 #define UF_SERVER_TRUST_ACCOUNT 0x00002000
 
+#define MACHINE_SECRET "/etc/machine.secret"
+#define CREATE_WINDOWS_COMPUTER "/usr/sbin/ucs-school-create_windows_computer"
+#define HELPER_SOCKET "/run/univention-ldb-modules/create_windows_computer.sock"
+#define HELPER_TIMEOUT 120
+#define HELPER_UNAVAILABLE (-2)
+
 #define AUTOPTR_FUNC_NAME(type) type##AutoPtrFree
 #define DEFINE_AUTOPTR_FUNC(type, func) \
     static inline void AUTOPTR_FUNC_NAME(type)(type **_ptr) \
@@ -118,7 +128,7 @@ char *sid_to_string(const struct dom_sid *sid)
    return strdup(buf);
 }
 
-static char* read_pwd_from_file(char *filename)
+static char* read_pwd_from_file(const char *filename)
 {
 	AUTOPTR(FILE) fp = NULL;
 	char line[1024];
@@ -136,6 +146,205 @@ static char* read_pwd_from_file(char *filename)
 	return strdup(line);
 }
 
+/* The machine secret only changes on password rotation, so keep the last copy
+ * and re-read the file only when it has been replaced or modified. */
+static const char *machine_secret(void)
+{
+	static char *secret;
+	static struct stat secret_st;
+	struct stat st;
+
+	if (stat(MACHINE_SECRET, &st) != 0)
+		return NULL;
+	if (secret != NULL && st.st_ino == secret_st.st_ino && st.st_dev == secret_st.st_dev && st.st_mtime == secret_st.st_mtime && st.st_size == secret_st.st_size)
+		return secret;
+
+	char *new_secret = read_pwd_from_file(MACHINE_SECRET);
+	if (new_secret == NULL)
+		return NULL;
+	free(secret);
+	secret = new_secret;
+	secret_st = st;
+	return secret;
+}
+
+static bool write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t r = send(fd, buf, len, MSG_NOSIGNAL);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		buf += r;
+		len -= r;
+	}
+	return true;
+}
+
+static bool send_line(int fd, const char *key, const char *value)
+{
+	if (strchr(value, '\n') != NULL)
+		return false;
+	return write_all(fd, key, strlen(key)) && write_all(fd, "=", 1) && write_all(fd, value, strlen(value)) && write_all(fd, "\n", 1);
+}
+
+/* Ask the persistent helper, which keeps its UMC session open between calls.
+ * Returns the status the script would have exited with, HELPER_UNAVAILABLE if
+ * the helper is not running and -1 if the request failed after it was sent.
+ * On success the DN is stored in target_dn (nbytes long, possibly empty). */
+static int helper_create_windows_computer(struct ldb_context *ldb, struct ldb_module *module, const char *server, const char *username, const char **options, char *target_dn, size_t target_dn_size, int *nbytes)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timeval tv = { .tv_sec = HELPER_TIMEOUT };
+	char buf[SLAP_LDAPDN_MAXLEN + 16];
+	size_t len = 0;
+	int fd, i;
+
+	if (strlen(HELPER_SOCKET) >= sizeof(addr.sun_path))
+		return HELPER_UNAVAILABLE;
+	strcpy(addr.sun_path, HELPER_SOCKET);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return HELPER_UNAVAILABLE;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		ldb_debug(ldb, LDB_DEBUG_TRACE, ("%s: helper not available: %s\n"), ldb_module_get_name(module), strerror(errno));
+		close(fd);
+		return HELPER_UNAVAILABLE;
+	}
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	bool sent = send_line(fd, "server", server ? server : "") && send_line(fd, "username", username) && send_line(fd, "command", "selectiveudm/create_windows_computer");
+	for (i = 0; sent && options[i] != NULL; i++)
+		sent = send_line(fd, "option", options[i]);
+	if (!sent || !write_all(fd, "\n", 1)) {
+		// Nothing has been created yet, the script can still do the job
+		ldb_debug(ldb, LDB_DEBUG_WARNING, ("%s: sending request to helper failed: %s\n"), ldb_module_get_name(module), strerror(errno));
+		close(fd);
+		return HELPER_UNAVAILABLE;
+	}
+
+	ldb_debug(ldb, LDB_DEBUG_TRACE, ("%s: request sent to %s\n"), ldb_module_get_name(module), HELPER_SOCKET);
+	while (len < sizeof(buf) - 1) {
+		ssize_t r = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0) {
+			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: reading reply from helper failed: %s\n"), ldb_module_get_name(module), strerror(errno));
+			close(fd);
+			return -1;
+		}
+		if (r == 0)
+			break;
+		len += r;
+	}
+	close(fd);
+	buf[len] = '\0';
+
+	char *end;
+	char *dn = strchr(buf, '\n');
+	long status = strtol(buf, &end, 10);
+	if (dn == NULL || end == buf || end != dn || status < 0 || status > 255) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: invalid reply from helper\n"), ldb_module_get_name(module));
+		return -1;
+	}
+	dn++;
+	*nbytes = snprintf(target_dn, target_dn_size, "%s", dn);
+	if ((size_t)*nbytes >= target_dn_size)
+		*nbytes = target_dn_size - 1;
+	return status;
+}
+
+/* Run ucs-school-create_windows_computer and collect its exit status and the DN
+ * it prints. Returns -1 if the status cannot be determined. */
+static int exec_create_windows_computer(struct ldb_context *ldb, struct ldb_module *module, const char *server, const char *username, const char **options, char *target_dn, size_t target_dn_size, int *nbytes)
+{
+	const char *argv[8 + 2 * 4 + 1];
+	int argc = 0, i, fd[2], status;
+	int errno_wait = 0;
+	sighandler_t sh;
+
+	const char *machine_pass = machine_secret();
+	if (machine_pass == NULL) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: Error reading %s\n"), ldb_module_get_name(module), MACHINE_SECRET);
+		return -1;
+	}
+
+	argv[argc++] = CREATE_WINDOWS_COMPUTER;
+	argv[argc++] = "-s";
+	argv[argc++] = server;
+	argv[argc++] = "-P";
+	argv[argc++] = machine_pass;
+	argv[argc++] = "-U";
+	argv[argc++] = username;
+	argv[argc++] = "selectiveudm/create_windows_computer";
+	for (i = 0; i < 4 && options[i] != NULL; i++) {
+		argv[argc++] = "-o";
+		argv[argc++] = options[i];
+	}
+	argv[argc] = NULL;
+
+	sh = signal(SIGCHLD, SIG_DFL);
+
+	if (pipe(fd)) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: pipe failed\n"), ldb_module_get_name(module));
+		signal(SIGCHLD, sh);
+		return -1;
+	}
+
+	int pid=fork();
+	if ( pid < 0 ) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: fork failed\n"), ldb_module_get_name(module));
+		close(fd[0]);
+		close(fd[1]);
+		signal(SIGCHLD, sh);
+		return -1;
+
+	} else if ( pid == 0 ) {
+		close(fd[0]);   // close reading end
+		if (fd[1] != STDOUT_FILENO) {
+			dup2(fd[1], STDOUT_FILENO);
+			close(fd[1]);
+		}
+
+		ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: calling ucs-school-create_windows_computer\n"), ldb_module_get_name(module));
+		status = execv(CREATE_WINDOWS_COMPUTER, (char *const *)argv);
+
+		if (status == -1) {     // otherwise es wouldn't be here
+			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: exec of %s failed: %s\n"), ldb_module_get_name(module), CREATE_WINDOWS_COMPUTER, strerror(errno));
+		}
+
+		_exit(status);
+	}
+
+	close(fd[1]);   // close writing end
+
+	if ( waitpid(pid, &status, 0) == -1 ) {
+		errno_wait = errno;
+	}
+
+	signal(SIGCHLD, sh);
+
+	if( ! WIFEXITED(status) ) {
+		ldb_debug(ldb, LDB_DEBUG_ERROR, "%s: Cannot determine return status of ucs-school-create_windows_computer: %s (%d)\n", ldb_module_get_name(module), strerror(errno_wait), errno_wait);
+		close(fd[0]);   // close reading end
+		return -1;
+	}
+
+	if (WEXITSTATUS(status) == 0) {
+		*nbytes = read(fd[0], target_dn, target_dn_size - 1);
+		if (*nbytes < 0)
+			*nbytes = 0;
+		target_dn[*nbytes] = '\0';
+	}
+	close(fd[0]);   // close reading end
+
+	return WEXITSTATUS(status);
+}
+
 static int univention_samaccountname_ldap_check_add_callback(struct ldb_request *down_req,
 			       struct ldb_reply *ares)
 {
@@ -157,7 +366,7 @@ static int univention_samaccountname_ldap_check_add(struct ldb_module *module, s
 	bool is_computer = false;
 	bool is_group = false;
 	bool is_user = false;
-	int i, fd[2], nbytes, ret;
+	int i, nbytes = 0, ret;
 	char target_dn_str[SLAP_LDAPDN_MAXLEN+1] = "";	// initialize with NULs
 
 	/* check if there's a bypass_samaccountname_ldap_check control */
@@ -232,12 +441,6 @@ static int univention_samaccountname_ldap_check_add(struct ldb_module *module, s
 		}
 
 		AUTOPTR(char) ldap_master = univention_config_get_string("ldap/master");
-		AUTOPTR(char) machine_pass = read_pwd_from_file("/etc/machine.secret");
-		if (machine_pass == NULL) {
-			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: Error reading /etc/machine.secret\n"), ldb_module_get_name(module));
-			return LDB_ERR_OPERATIONS_ERROR;
-		}
-
 		AUTOPTR(char) my_hostname = univention_config_get_string("hostname");
 		AUTOPTR(char) opt_my_samaccoutname = malloc(strlen(my_hostname) + 2);
 		if (opt_my_samaccoutname == NULL) {
@@ -251,75 +454,37 @@ static int univention_samaccountname_ldap_check_add(struct ldb_module *module, s
 		}
 		sprintf(opt_usersid, "usersid=%s", usersid);
 
-		int errno_wait = 0;
-		sighandler_t sh;
-		sh = signal(SIGCHLD, SIG_DFL);
-
-		if (pipe(fd)) {
-			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: pipe failed\n"), ldb_module_get_name(module));
-			return LDB_ERR_UNWILLING_TO_PERFORM;
+		const char *options[5];
+		int n = 0;
+		options[n++] = opt_name;
+		if (opt_unicodePwd != NULL) {
+			options[n++] = opt_unicodePwd;
+			options[n++] = "decode_password=yes";
 		}
+		options[n++] = opt_usersid;
+		options[n] = NULL;
 
-		int status;
-		int pid=fork();
-		if ( pid < 0 ) {
-			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: fork failed\n"), ldb_module_get_name(module));
-			return LDB_ERR_UNWILLING_TO_PERFORM;
-
-		} else if ( pid == 0 ) {
-			close(fd[0]);   // close reading end
-			if (fd[1] != STDOUT_FILENO) {
-				dup2(fd[1], STDOUT_FILENO);
-				close(fd[1]);
-			}
-
-			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: calling ucs-school-create_windows_computer\n"), ldb_module_get_name(module));
-			if (opt_unicodePwd != NULL) {
-				status = execl("/usr/sbin/ucs-school-create_windows_computer", "/usr/sbin/ucs-school-create_windows_computer", "-s", ldap_master, "-P", machine_pass, "-U", opt_my_samaccoutname, "selectiveudm/create_windows_computer", "-o", opt_name, "-o", opt_unicodePwd, "-o", "decode_password=yes", "-o", opt_usersid, NULL);
-			} else {
-				status = execl("/usr/sbin/ucs-school-create_windows_computer", "/usr/sbin/ucs-school-create_windows_computer", "-s", ldap_master, "-P", machine_pass, "-U", opt_my_samaccoutname, "selectiveudm/create_windows_computer", "-o", opt_name, "-o", opt_usersid, NULL);
-			}
-
-			if (status == -1) {     // otherwise es wouldn't be here
-				ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: exec of /usr/sbin/ucs-school-create_windows_computer failed: %s\n"), ldb_module_get_name(module), strerror(errno));
-			}
-
-			_exit(status);
-		} else {
-			close(fd[1]);   // close writing end
-
-			if ( waitpid(pid, &status, 0) == -1 ) {
-				errno_wait = errno;
-			}
-
-			signal(SIGCHLD, sh);
+		int status = helper_create_windows_computer(ldb, module, ldap_master, opt_my_samaccoutname, options, target_dn_str, sizeof(target_dn_str), &nbytes);
+		if (status == HELPER_UNAVAILABLE) {
+			status = exec_create_windows_computer(ldb, module, ldap_master, opt_my_samaccoutname, options, target_dn_str, sizeof(target_dn_str), &nbytes);
 		}
 
-		if( ! WIFEXITED(status) ) {
-			ldb_debug(ldb, LDB_DEBUG_ERROR, "%s: Cannot determine return status of ucs-school-create_windows_computer: %s (%d)\n", ldb_module_get_name(module), strerror(errno_wait), errno_wait);
-			close(fd[0]);   // close reading end
+		if (status < 0) {
 			return LDB_ERR_UNWILLING_TO_PERFORM;
-		} else if( WEXITSTATUS(status) == 2 ) {
+		} else if (status == 2) {
 			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: ldb_add of machine object is disabled\n"), ldb_module_get_name(module));
-			close(fd[0]);   // close reading end
 			return LDB_ERR_UNWILLING_TO_PERFORM;
-		} else if( WEXITSTATUS(status) == 3 ) {
+		} else if (status == 3) {
 			ldb_debug(ldb, LDB_DEBUG_TRACE, ("%s: ldb_add of machine object ignored in dummy mode\n"), ldb_module_get_name(module));
-			close(fd[0]);   // close reading end
 			return LDB_SUCCESS;
-		} else if( WEXITSTATUS(status) == 4 ) {
+		} else if (status == 4) {
 			ldb_debug(ldb, LDB_DEBUG_ERROR, "%s: LDB_ERR_ENTRY_ALREADY_EXISTS\n", ldb_module_get_name(module));
-			close(fd[0]);   // close reading end
 			return LDB_ERR_ENTRY_ALREADY_EXISTS;
-		} else if( WEXITSTATUS(status) ) {
-			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: unknown error code from ucs-school-create_windows_computer: %d\n"), ldb_module_get_name(module), WEXITSTATUS(status));
-			close(fd[0]);   // close reading end
+		} else if (status) {
+			ldb_debug(ldb, LDB_DEBUG_ERROR, ("%s: unknown error code from ucs-school-create_windows_computer: %d\n"), ldb_module_get_name(module), status);
 			return LDB_ERR_UNWILLING_TO_PERFORM;
 		}
 
-		nbytes = read(fd[0], target_dn_str, sizeof(target_dn_str)-1);
-		close(fd[0]);   // close reading end
-
 		ldb_debug(ldb, LDB_DEBUG_TRACE, ("%s: ucs-school-create_windows_computer returned: '%s' (%d bytes)\n"), ldb_module_get_name(module), target_dn_str, nbytes);
 
 		if (nbytes == 0) {
@@ -92,10 +92,10 @@ class UserDeactivatedError(NetworkAccessError):
 
 class NetworkAccess:
 
-    def __init__(self, username: str, stationId: str, loglevel: int | None = None, logfile: str | None = None) -> None:
+    def __init__(self, username: str, stationId: str, loglevel: int | None = None, logfile: str | None = None, ldapConnection: univention.uldap.access | None = None) -> None:
         self.username = parse_username(username)
         self.mac_address = decode_stationId(stationId)
-        self.ldapConnection = get_ldapConnection()
+        self.ldapConnection = ldapConnection or get_ldapConnection()
         self.configRegistry = univention.config_registry.ConfigRegistry()
         self.configRegistry.load()
         self.use_ssp = self.configRegistry.is_true('radius/use-service-specific-password')
@@ -115,6 +115,10 @@ class NetworkAccess:
         debuglevel = convert_ucs_debuglevel(ucs_debuglevel)
         self.logger = logging.getLogger('radius-ntlm')
         self.logger.setLevel(debuglevel)
+        # a long running process creates one instance per request
+        for handler in self.logger.handlers[:]:
+            self.logger.removeHandler(handler)
+            handler.close()
         if logfile is not None:
             log_handler: logging.Handler = logging.FileHandler(logfile)
             log_formatter = logging.Formatter(f'%(asctime)s - %(name)s - %(levelname)10s: [pid={os.getpid()}; user={self.username}; mac={self.mac_address}] %(message)s')
@@ -1,12 +1,97 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 
 static char COMMAND[] = "/usr/bin/univention-radius-ntlm-auth";
 
+#ifndef BROKER_SOCKET
+#define BROKER_SOCKET "/run/univention-radius/ntlm-auth.sock"
+#endif
+#define BROKER_TIMEOUT 10
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	while (len > 0) {
+		ssize_t n = write(fd, buf, len);
+		if (n <= 0)
+			return -1;
+		buf += n;
+		len -= n;
+	}
+	return 0;
+}
+
+/*
+ * Hand the request to the worker pool of "univention-radius-ntlm-auth --serve".
+ * Returns the exit status and prints the output, or returns -1 without
+ * printing anything if no worker answered and COMMAND has to be run instead.
+ */
+static int broker_authenticate(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct timeval tv = { .tv_sec = BROKER_TIMEOUT };
+	char buf[4096], *out, *end;
+	size_t len = 0;
+	long status;
+	int fd, i;
+
+	for (i = 1; i < argc; i++) {
+		if (strchr(argv[i], '\n'))
+			return -1;
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	strncpy(addr.sun_path, BROKER_SOCKET, sizeof(addr.sun_path) - 1);
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)))
+		goto fail;
+
+	for (i = 1; i < argc; i++) {
+		if (write_all(fd, "arg=", 4) || write_all(fd, argv[i], strlen(argv[i])) || write_all(fd, "\n", 1))
+			goto fail;
+	}
+	if (write_all(fd, "\n", 1))
+		goto fail;
+
+	/* "<status>\n<output>\n", complete once the worker closes the connection */
+	for (;;) {
+		ssize_t n = read(fd, buf + len, sizeof(buf) - 1 - len);
+		if (n < 0)
+			goto fail;
+		if (n == 0)
+			break;
+		len += n;
+		if (len == sizeof(buf) - 1)
+			goto fail;
+	}
+	close(fd);
+	buf[len] = '\0';
+
+	out = strchr(buf, '\n');
+	if (!out)
+		return -1;
+	*out++ = '\0';
+	status = strtol(buf, &end, 10);
+	if (end == buf || *end || status < 0 || status > 255)
+		return -1;
+	fputs(out, stdout);
+	fflush(stdout);
+	return status;
+
+fail:
+	close(fd);
+	return -1;
+}
+
 int main(int argc, char *argv[])
 {
-	int i;
+	int i, status;
 	char* args[10];
 	char* envp[1];
 	if (setgid(getegid())) {
@@ -15,13 +100,17 @@ int main(int argc, char *argv[])
 	if (setuid(geteuid())) {
 		perror("setuid");
 	}
+	if (argc > 9) {
+		argc = 9;
+	}
+	status = broker_authenticate(argc, argv);
+	if (status >= 0) {
+		return status;
+	}
 	args[0] = COMMAND;
 	for (i = 0; i < 10; i++) {
 		args[i] = NULL;
 	}
-	if (argc > 9) {
-		argc = 9;
-	}
 	for (i = 0; i < argc; i++) {
 		args[i] = argv[i];
 	}
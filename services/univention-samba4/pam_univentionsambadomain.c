@@ -55,7 +55,8 @@
 #include <security/pam_modules.h>
 #include <security/_pam_macros.h>
 
-static char *windows_domain;
+static char windows_domain[BUFSIZ];
+static size_t len_windows_domain;
 
 #define UNIVENTIONSAMBADOMAIN_QUIET 020
 
@@ -74,8 +75,12 @@ static void _log_err(int err, const char *format, ...)
 static int _pam_parse(int flags, int argc, const char **argv)
 {
 	int ctrl = 0;
+	char *domain;
 
-	windows_domain = univention_config_get_string("windows/domain");
+	/* UCR lookups are served from the in-process snapshot of libuniventionconfig */
+	domain = univention_config_get_string("windows/domain");
+	snprintf(windows_domain, BUFSIZ, "%s", domain ? domain : "");
+	free(domain);
 	/* does the application require quiet? */
 	if ((flags & PAM_SILENT) == PAM_SILENT)
 		ctrl |= UNIVENTIONSAMBADOMAIN_QUIET;
@@ -87,21 +92,21 @@ static int _pam_parse(int flags, int argc, const char **argv)
 		if (!strcmp(*argv, "silent")) {
 			ctrl |= UNIVENTIONSAMBADOMAIN_QUIET;
 		} else if (!strncmp(*argv,"windows_domain=",15))
-			strncpy(windows_domain,*argv+15,BUFSIZ);
+			snprintf(windows_domain, BUFSIZ, "%s", *argv+15);
 		else {
 			_log_err(LOG_ERR, "unknown option; %s", *argv);
 		}
 	}
+	len_windows_domain = strlen(windows_domain);
 
 	return ctrl;
 }
 
-inline int mapuser(const char *fromuser, char *touser)
+static int mapuser(const char *fromuser, char *touser)
 {
 	int mapped = 0;
-	int len_windows_domain = strlen(windows_domain);
 
-	if ( strlen(fromuser) > len_windows_domain ) {
+	if ( len_windows_domain > 0 && strlen(fromuser) > len_windows_domain ) {
 
 		int i;
 		for (i=0; i<len_windows_domain; i++) {
@@ -110,7 +115,7 @@ inline int mapuser(const char *fromuser, char *touser)
 			}
 		}
 		if (i == len_windows_domain && ( fromuser[i] == '+' || fromuser[i] == '\\' ) ) {
-			strncpy(touser, fromuser + len_windows_domain + 1, strlen(fromuser) - len_windows_domain );
+			snprintf(touser, BUFSIZ, "%s", fromuser + len_windows_domain + 1);
 			mapped = 1;
 		}
 	}